@@ -0,0 +1,93 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "accel.h"
+#include "scene_analysis.h"
+#include "scene_file.h"
+
+// rt.analyze: the statistics of a binary scene file that decide how it renders best (see
+// scene_analysis), as JSON for the planner, without opening a device or building a structure
+int main(int argc, char** argv)
+{
+	std::string scene_path;
+	// --size WxH and --view left,bottom,width,height,near,far as for rt.reworked
+	ortho_view view = default_view();
+	// --tile N bins the image in tiles of N pixels, the cell size of the grid mode by default
+	std::uint32_t tile_size = 16;
+	// --tiles also writes the sphere count of every tile
+	bool tiles = false;
+	// --json file writes the JSON to file instead of the console
+	std::string json;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		bool has_value = i + 1 < argc;
+
+		if (std::strcmp(argv[i], "--size") == 0 && has_value && parse_image_size(argv[i + 1], view))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--view") == 0 && has_value && parse_view_window(argv[i + 1], view))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--tile") == 0 && has_value && std::atoi(argv[i + 1]) > 0)
+		{
+			tile_size = static_cast<std::uint32_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--tiles") == 0)
+		{
+			tiles = true;
+		}
+		else if (std::strcmp(argv[i], "--json") == 0 && has_value)
+		{
+			json = argv[++i];
+		}
+		else if (argv[i][0] != '-' && scene_path.empty())
+		{
+			scene_path = argv[i];
+		}
+		else
+		{
+			scene_path.clear();
+			break;
+		}
+	}
+
+	if (scene_path.empty())
+	{
+		std::cout << "Usage: rt.analyze scene [--size WxH] [--view left,bottom,width,height,near,far] [--tile N] [--tiles] [--json file]\n";
+		return 1;
+	}
+
+	scene_file file;
+	sphere_soa spheres;
+
+	if (!file.open(scene_path))
+		return 1;
+
+	file.copy_spheres(spheres);
+	file.close();
+
+	auto analysis = analyze_scene(spheres, view, tile_size);
+
+	if (json.empty())
+	{
+		write_analysis_json(std::cout, analysis, tiles);
+		return 0;
+	}
+
+	std::ofstream out(json);
+	write_analysis_json(out, analysis, tiles);
+
+	if (!out)
+	{
+		std::cout << "Can't write " << json << "\n";
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,531 @@
+#include "accel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "config.h"
+
+char const* accel_mode_name(accel_mode mode)
+{
+	switch (mode)
+	{
+	case accel_mode::bvh: return "bvh";
+	case accel_mode::grid: return "grid";
+	case accel_mode::splat: return "splat";
+	case accel_mode::sorted: return "sorted";
+	case accel_mode::adaptive: return "adaptive";
+	default: return "none";
+	}
+}
+
+bool parse_accel_mode(char const* name, accel_mode& mode)
+{
+	for (auto candidate : { accel_mode::none, accel_mode::bvh, accel_mode::grid, accel_mode::splat, accel_mode::sorted, accel_mode::adaptive })
+	{
+		if (std::strcmp(name, accel_mode_name(candidate)) == 0)
+		{
+			mode = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+char const* tile_order_name(tile_order order)
+{
+	switch (order)
+	{
+	case tile_order::morton: return "morton";
+	case tile_order::hilbert: return "hilbert";
+	default: return "scanline";
+	}
+}
+
+bool parse_tile_order(char const* name, tile_order& order)
+{
+	for (auto candidate : { tile_order::scanline, tile_order::morton, tile_order::hilbert })
+	{
+		if (std::strcmp(name, tile_order_name(candidate)) == 0)
+		{
+			order = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+ortho_view default_view()
+{
+	return ortho_view{ RT_LEFT, RT_BOTTOM, RT_WIDTH, RT_HEIGHT, RT_NEAR, RT_FAR, kImageWidth, kImageHeight };
+}
+
+bool parse_image_size(char const* text, ortho_view& view)
+{
+	unsigned width = 0, height = 0;
+	char end = 0;
+
+	if (std::sscanf(text, "%ux%u%c", &width, &height, &end) != 2 || width == 0 || height == 0)
+		return false;
+
+	view.image_width = width;
+	view.image_height = height;
+	return true;
+}
+
+bool parse_view_window(char const* text, ortho_view& view)
+{
+	float v[6];
+	char end = 0;
+
+	if (std::sscanf(text, "%f,%f,%f,%f,%f,%f%c", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &end) != 6)
+		return false;
+
+	if (!(v[2] > 0.f && v[3] > 0.f && v[5] > v[4]))
+		return false;
+
+	view.left = v[0];
+	view.bottom = v[1];
+	view.width = v[2];
+	view.height = v[3];
+	view.near = v[4];
+	view.far = v[5];
+	return true;
+}
+
+namespace
+{
+	// Cells of the grid cull_hidden_spheres looks up occluders in
+	std::uint32_t const kOcclusionCell = 8;
+
+	// Replace scene.spheres by the spheres order names, in that order, and map them to the full
+	// set in scene.sphere_ids
+	void permute_scene(render_scene& scene, std::vector<std::uint32_t>& order)
+	{
+		auto const& spheres = scene.spheres;
+
+		sphere_soa permuted;
+		permuted.resize(static_cast<std::uint32_t>(order.size()));
+
+		for (auto i = 0U; i < permuted.size(); ++i)
+		{
+			auto k = order[i];
+			permuted.cx[i] = spheres.cx[k];
+			permuted.cy[i] = spheres.cy[k];
+			permuted.cz[i] = spheres.cz[k];
+			permuted.radius2[i] = spheres.radius2[k];
+			permuted.radius[i] = spheres.radius[k];
+			std::copy(&spheres.color[3 * k], &spheres.color[3 * k] + 3, &permuted.color[3 * i]);
+		}
+
+		// culling a culled set again maps through the first remap
+		if (!scene.sphere_ids.empty())
+		{
+			for (auto& k : order)
+			{
+				k = scene.sphere_ids[k];
+			}
+		}
+
+		scene.spheres = std::move(permuted);
+		scene.sphere_ids = std::move(order);
+		scene.file = nullptr;
+	}
+
+	// Keep the spheres kept of scene.spheres, in ascending order, and map them to the full set
+	// in scene.sphere_ids. Returns the number dropped.
+	std::uint32_t compact_scene(render_scene& scene, std::vector<std::uint32_t>& kept)
+	{
+		auto const& spheres = scene.spheres;
+
+		// an empty buffer is invalid, keep one sphere no ray hits when none is visible
+		if (kept.empty() && spheres.size() != 0)
+			kept.push_back(0);
+
+		auto culled = spheres.size() - static_cast<std::uint32_t>(kept.size());
+
+		if (culled == 0)
+			return 0;
+
+		permute_scene(scene, kept);
+		return culled;
+	}
+
+	// Position of the cell (x, y, z) of 21 bits each on the Z-order curve: the bits interleaved
+	std::uint64_t morton_index(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+	{
+		std::uint64_t index = 0;
+
+		for (auto bit = 0U; bit < 21; ++bit)
+		{
+			index |= (std::uint64_t(x >> bit & 1) << (3 * bit)) | (std::uint64_t(y >> bit & 1) << (3 * bit + 1)) | (std::uint64_t(z >> bit & 1) << (3 * bit + 2));
+		}
+
+		return index;
+	}
+
+	// Copy of the spheres indices names, in that order
+	sphere_soa select_spheres(sphere_soa const& spheres, std::vector<std::uint32_t> const& indices)
+	{
+		sphere_soa selected;
+		selected.resize(static_cast<std::uint32_t>(indices.size()));
+
+		for (std::uint32_t l = 0; l < indices.size(); ++l)
+		{
+			auto k = indices[l];
+			selected.set(l, spheres.cx[k], spheres.cy[k], spheres.cz[k], spheres.radius[k], spheres.color[3 * k], spheres.color[3 * k + 1], spheres.color[3 * k + 2]);
+		}
+
+		return selected;
+	}
+
+	// Build scene.accel over the spheres of scene.spheres that aren't tiny and bin the tiny ones
+	// into scene.tiny, see render_scene::splat_tiny. A tiny sphere lies beyond the near plane, so
+	// the BVH stays exact for it. Returns false and leaves both alone if there are no spheres
+	// of one of the kinds.
+	bool split_tiny_spheres(render_scene& scene)
+	{
+		auto const& spheres = scene.spheres;
+		std::vector<std::uint32_t> tiny, large;
+
+		for (auto k = 0U; k < spheres.size(); ++k)
+		{
+			pixel_rect rect;
+			sphere_footprint(spheres, k, scene.view, rect);
+
+			auto pixels = std::int64_t(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+			bool beyond_near = sphere_bounds(spheres, k, scene.view.near).min.z > scene.view.near;
+
+			(pixels <= kTinySpherePixels && beyond_near ? tiny : large).push_back(k);
+		}
+
+		if (tiny.empty() || large.empty())
+			return false;
+
+		// both are built over copies and their indices mapped back, which keeps them ascending
+		scene.accel = build_bvh(select_spheres(spheres, large), scene.view.near, scene.arena);
+
+		for (auto& k : scene.accel.indices)
+		{
+			k = large[k];
+		}
+
+		scene.tiny = build_grid(select_spheres(spheres, tiny), scene.view, scene.arena, kTinyCellSize);
+		scene.tiny_spheres.resize(scene.tiny.indices.size());
+
+		for (std::size_t l = 0; l < scene.tiny.indices.size(); ++l)
+		{
+			auto& k = scene.tiny.indices[l];
+			k = tiny[k];
+			sphere_footprint(spheres, k, scene.view, scene.tiny_spheres[l].footprint);
+			scene.tiny_spheres[l].zmin = sphere_bounds(spheres, k, scene.view.near).min.z;
+		}
+
+		return true;
+	}
+
+	// The wide and compressed nodes of scene in treelets, see render_scene::treelet_layout
+	void relayout_nodes(render_scene& scene)
+	{
+		layout_treelets(scene.accel4);
+		layout_treelets(scene.accel8);
+		layout_treelets(scene.compressed_nodes);
+	}
+}
+
+std::uint32_t cull_scene(render_scene& scene)
+{
+	return cull_scene(scene, full_roi(scene.view));
+}
+
+std::uint32_t cull_scene(render_scene& scene, render_roi const& roi)
+{
+	if (scene.camera == projection::pinhole || scene.instances)
+		return 0;
+
+	auto const& view = scene.view;
+	auto const& spheres = scene.spheres;
+	auto region = clip_roi(roi, view);
+
+	std::vector<std::uint32_t> kept;
+	kept.reserve(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		pixel_rect rect;
+		auto bounds = sphere_bounds(spheres, k, view.near);
+
+		// rays start on the near plane and end on the far one
+		if (bounds.max.z < view.near || bounds.min.z > view.far || !sphere_footprint(spheres, k, view, rect))
+			continue;
+
+		if (rect.x1 <= std::int32_t(region.xbegin) || rect.x0 >= std::int32_t(region.xend) || rect.y1 <= std::int32_t(region.ybegin) ||
+		    rect.y0 >= std::int32_t(region.yend))
+			continue;
+
+		kept.push_back(k);
+	}
+
+	return compact_scene(scene, kept);
+}
+
+std::uint32_t cull_hidden_spheres(render_scene& scene)
+{
+	if (scene.camera == projection::pinhole || scene.instances)
+		return 0;
+
+	auto const& view = scene.view;
+	auto const& spheres = scene.spheres;
+
+	std::vector<Imath::Box3f> bounds(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		bounds[k] = sphere_bounds(spheres, k, view.near);
+
+		// a sphere around a ray origin is taken at its far root whatever lies in front of it
+		if (bounds[k].min.z <= view.near && bounds[k].max.z >= view.near)
+			return 0;
+	}
+
+	auto grid = build_grid(spheres, view, scene.arena, kOcclusionCell);
+
+	std::vector<std::uint32_t> kept;
+	kept.reserve(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		auto const& box = bounds[k];
+		pixel_rect rect;
+		bool hidden = false;
+
+		if (box.min.z > view.near && sphere_footprint(spheres, k, view, rect))
+		{
+			// an occluder covers every pixel of the footprint, so it is listed in the cell of any one
+			auto c = (rect.y0 / grid.cell_size) * grid.cells_x + rect.x0 / grid.cell_size;
+
+			for (auto n = grid.cell_start[c]; n < grid.cell_start[c + 1] && !hidden; ++n)
+			{
+				auto o = grid.indices[n];
+				auto const& front = bounds[o];
+
+				// every root of o is beyond the near plane, before the far one and before any root of k
+				if (o == k || front.min.z <= view.near || front.max.z >= view.far || front.max.z >= box.min.z)
+					continue;
+
+				// and every ray that can meet k meets o: the corners of the bounds of k lie in its inner disc
+				double dx = std::max(std::fabs(double(box.min.x) - spheres.cx[o]), std::fabs(double(box.max.x) - spheres.cx[o]));
+				double dy = std::max(std::fabs(double(box.min.y) - spheres.cy[o]), std::fabs(double(box.max.y) - spheres.cy[o]));
+				double inner = sphere_inner_radius(spheres, o, view.near);
+
+				hidden = dx * dx + dy * dy < inner * inner;
+			}
+		}
+
+		if (!hidden)
+			kept.push_back(k);
+	}
+
+	return compact_scene(scene, kept);
+}
+
+bool morton_order_spheres(render_scene& scene)
+{
+	auto const& spheres = scene.spheres;
+
+	if (scene.instances || spheres.size() < 2)
+		return false;
+
+	Imath::Box3f centers;
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		centers.extendBy(Imath::V3f(spheres.cx[k], spheres.cy[k], spheres.cz[k]));
+	}
+
+	// the cells of the box along each axis, a flat axis has one
+	float const cells = float(1U << 21) - 1.f;
+	auto size = centers.size();
+	Imath::V3f scale(size.x > 0.f ? cells / size.x : 0.f, size.y > 0.f ? cells / size.y : 0.f, size.z > 0.f ? cells / size.z : 0.f);
+
+	std::vector<std::pair<std::uint64_t, std::uint32_t>> keyed(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		auto x = static_cast<std::uint32_t>((spheres.cx[k] - centers.min.x) * scale.x);
+		auto y = static_cast<std::uint32_t>((spheres.cy[k] - centers.min.y) * scale.y);
+		auto z = static_cast<std::uint32_t>((spheres.cz[k] - centers.min.z) * scale.z);
+		keyed[k] = { morton_index(x, y, z), k };
+	}
+
+	// spheres in the same cell keep their order
+	std::sort(keyed.begin(), keyed.end());
+
+	std::vector<std::uint32_t> order(spheres.size());
+
+	for (auto l = 0U; l < order.size(); ++l)
+	{
+		order[l] = keyed[l].second;
+	}
+
+	permute_scene(scene, order);
+	return true;
+}
+
+void prepare_scene(render_scene& scene, accel_mode mode)
+{
+	if (scene.camera == projection::pinhole)
+		mode = accel_mode::none;
+
+	scene.mode = mode;
+
+	// the scratch of the previous build is not referenced any more
+	scene.arena.reset();
+	scene.accel_links = bvh_links();
+	++scene.builds;
+	scene.tiny = sphere_grid();
+	scene.tiny_spheres.clear();
+	scene.embree_accel.reset();
+
+	switch (mode)
+	{
+	case accel_mode::bvh:
+		if (scene.instances)
+			break;
+
+		// Embree's tree replaces accel if its build has the exactness of build_bvh
+		if (scene.embree && scene.camera == projection::ortho && spheres_beyond_near(scene.spheres, scene.view))
+			scene.embree_accel = build_embree_bvh(scene.spheres, scene.view);
+
+		if (scene.embree_accel)
+		{
+			scene.accel = bvh();
+			scene.accel4.clear();
+			scene.accel8.clear();
+			scene.compressed_nodes.clear();
+			break;
+		}
+
+		if (!scene.splat_tiny || scene.camera != projection::ortho || !split_tiny_spheres(scene))
+		{
+			if (scene.file && scene.file->size() == scene.spheres.size() && scene.file->has_bvh(scene.view.near))
+				scene.accel = scene.file->load_bvh();
+			else
+				scene.accel = build_bvh(scene.spheres, scene.view.near, scene.arena);
+		}
+
+		// Spheres crossing the near plane make the result depend on the test order
+		if (!scene.accel.exact)
+		{
+			scene.mode = accel_mode::none;
+			scene.tiny = sphere_grid();
+			scene.tiny_spheres.clear();
+		}
+
+		scene.accel4 = collapse_bvh4(scene.accel);
+		scene.accel8 = collapse_bvh8(scene.accel);
+		scene.compressed_nodes.clear();
+
+		if (scene.compressed_bvh && scene.accel.exact && scene.tiny.indices.empty())
+			scene.compressed_nodes = compress_bvh(scene.accel);
+
+		if (scene.treelet_layout)
+			relayout_nodes(scene);
+		break;
+	case accel_mode::grid:
+		scene.grid = build_grid(scene.spheres, scene.view, scene.arena);
+		break;
+	case accel_mode::adaptive:
+		scene.grid = build_grid(scene.spheres, scene.view, scene.arena, kAdaptiveBlock);
+		break;
+	case accel_mode::splat:
+		scene.footprints = sphere_footprints(scene.spheres, scene.view);
+		scene.splat_any_order = spheres_beyond_near(scene.spheres, scene.view);
+		scene.grid = build_grid(scene.spheres, scene.view, scene.arena, kSplatCellSize);
+		break;
+	case accel_mode::sorted:
+		scene.order = build_depth_order(scene.spheres, scene.view.near, scene.arena);
+
+		if (!scene.order.exact)
+			scene.mode = accel_mode::none;
+		break;
+	default:
+		break;
+	}
+
+	scene.depth_pruned = 0;
+
+	if (scene.depth_bounds && (scene.mode == accel_mode::grid || scene.mode == accel_mode::adaptive))
+		scene.depth_pruned = prune_grid_depth(scene.grid, scene.spheres, scene.view);
+
+	scene.coverage.clear();
+
+	bool traced = scene.mode == accel_mode::none || scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted;
+
+	if (scene.skip_background && traced && scene.camera == projection::ortho && !scene.instances)
+		scene.coverage = build_coverage(scene.spheres, scene.view);
+
+	scene.halves.clear();
+
+	if (scene.half_spheres && scene.mode == accel_mode::none && scene.camera == projection::ortho && !scene.instances)
+		scene.halves = compress_spheres(scene.spheres, scene.view.near);
+}
+
+bool refit_scene(render_scene& scene, std::vector<std::uint32_t> const& changed, std::vector<std::int32_t>& nodes)
+{
+	nodes.clear();
+
+	if (scene.instances || scene.embree_accel || !scene.coverage.empty() || !scene.halves.empty())
+		return false;
+
+	switch (scene.mode)
+	{
+	case accel_mode::none:
+		return true;
+	case accel_mode::bvh:
+		if (!scene.tiny.indices.empty())
+			return false;
+
+		if (scene.accel_links.parent.size() != scene.accel.nodes.size() || scene.accel_links.leaf.size() != scene.spheres.size())
+			scene.accel_links = link_bvh(scene.accel, scene.spheres.size());
+
+		nodes = refit_bvh(scene.accel, scene.accel_links, scene.spheres, changed, scene.view.near);
+
+		if (!scene.accel.exact)
+			return false;
+
+		scene.accel4 = collapse_bvh4(scene.accel);
+		scene.accel8 = collapse_bvh8(scene.accel);
+
+		if (scene.compressed_bvh)
+			scene.compressed_nodes = compress_bvh(scene.accel);
+
+		if (scene.treelet_layout)
+			relayout_nodes(scene);
+		return true;
+	case accel_mode::splat:
+		for (auto k : changed)
+		{
+			// the order of the splats, and with it the kernel, may change once a sphere reaches the near plane
+			if (scene.splat_any_order && !(sphere_bounds(scene.spheres, k, scene.view.near).min.z > scene.view.near))
+				return false;
+
+			sphere_footprint(scene.spheres, k, scene.view, scene.footprints[k]);
+		}
+
+		// a moved sphere leaves the bins it was in, the scratch of the last build is free
+		scene.arena.reset();
+		scene.grid = build_grid(scene.spheres, scene.view, scene.arena, kSplatCellSize);
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool nearest_hits_supported(std::uint32_t k)
+{
+	return k == 2 || k == 4 || k == 8 || k == kMaxNearestHits;
+}
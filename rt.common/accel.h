@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "depth_order.h"
+#include "embree_bvh.h"
+#include "grid.h"
+#include "half_spheres.h"
+#include "instances.h"
+#include "roi.h"
+#include "scene.h"
+#include "scene_file.h"
+
+// How the tracers find the closest sphere of a pixel
+enum class accel_mode
+{
+	// Test every sphere
+	none,
+	// Bounding volume hierarchy traversal
+	bvh,
+	// Screen-space grid of sphere lists
+	grid,
+	// Sphere footprints splatted into a depth buffer
+	splat,
+	// Spheres sorted front to back, each ray stops at the first one beyond its hit
+	sorted,
+	// Closest spheres of the block corners, blocks of one sphere are filled without tracing
+	adaptive
+};
+
+// Block side of accel_mode::adaptive, the cell size of its grid
+std::uint32_t const kAdaptiveBlock = 8;
+
+// Cell side of the bins of accel_mode::splat, kTileSize of cpu_trace.h, so a tile of the CPU
+// tracers splats the spheres of one bin
+std::uint32_t const kSplatCellSize = 32;
+
+// Largest footprint of the spheres render_scene::splat_tiny splats, in pixels, and the cell
+// side of the grid they are binned into. A footprint reaches past the pixel centers around
+// the sphere by one more pixel on each side, 5 x 5 holds the spheres that may cover at most
+// 2 x 2 pixel centers.
+std::uint32_t const kTinySpherePixels = 25;
+std::uint32_t const kTinyCellSize = 8;
+
+// Sphere of render_scene::tiny: its footprint and the lower z bound of its sphere_bounds()
+struct tiny_sphere
+{
+	pixel_rect footprint;
+	float zmin;
+};
+
+char const* accel_mode_name(accel_mode mode);
+
+// Parse none|bvh|grid|splat|sorted|adaptive, returns false for anything else
+bool parse_accel_mode(char const* name, accel_mode& mode);
+
+// Order the parallel CPU backend hands its tiles to the workers in. Every worker is seeded
+// with a contiguous run of them (see thread_pool), along a space-filling curve the run covers
+// a compact block of the image instead of a few rows, so the spheres and nodes its tiles test
+// stay in the worker's L2 from one tile to the next.
+enum class tile_order
+{
+	// Row by row, left to right
+	scanline,
+	// Z-order over the grid of tiles
+	morton,
+	// Hilbert curve over the grid of tiles, consecutive tiles always share an edge
+	hilbert
+};
+
+char const* tile_order_name(tile_order order);
+
+// Parse scanline|morton|hilbert, returns false for anything else
+bool parse_tile_order(char const* name, tile_order& order);
+
+// The ortho view of config.h
+ortho_view default_view();
+
+// Parse an image size WIDTHxHEIGHT into view, returns false for anything else
+bool parse_image_size(char const* text, ortho_view& view);
+
+// Parse a view window left,bottom,width,height,near,far into view, returns false
+// for anything else or an empty window
+bool parse_view_window(char const* text, ortho_view& view);
+
+// Sphere set together with the view and the structure the selected mode traces through,
+// shared by the CPU tracers and the OpenCL host
+struct render_scene
+{
+	sphere_soa spheres;
+	ortho_view view = default_view();
+	// Rays of the image: the ortho ones of view, or the ones of pinhole with the image size of view
+	projection camera = projection::ortho;
+	pinhole_camera pinhole;
+	accel_mode mode = accel_mode::none;
+	bvh accel;
+	// Parent and leaf links of accel for refit_scene, linked by its first refit after a build
+	bvh_links accel_links;
+	// accel collapsed into 4 and 8 wide nodes for the SSE4 and AVX2 tracers, see collapse_bvh4
+	std::vector<bvh4_node> accel4;
+	std::vector<bvh8_node> accel8;
+	// Cells of grid and adaptive, and the bins of splat: each tile of the CPU tracers splats only
+	// the spheres binned into the cells it overlaps, in index order
+	sphere_grid grid;
+	// grid and adaptive prune the cell lists of grid with prune_grid_depth after the build,
+	// depth_pruned gets the entries the last prepare_scene dropped
+	bool depth_bounds = false;
+	std::uint32_t depth_pruned = 0;
+	std::vector<pixel_rect> footprints;
+	// Set by prepare_scene in mode splat if spheres_beyond_near() holds: the footprints may be
+	// splatted in any order, as the OpenCL devices with 64-bit atomics do
+	bool splat_any_order = false;
+	depth_order order;
+	// Scratch memory of the builds, reset by every prepare_scene
+	frame_arena arena;
+	// Counts the prepare_scene calls on the scene, tells a structure uploaded to a device from
+	// the ones built after it
+	std::uint64_t builds = 0;
+	// bvh and sorted test the sphere a neighbouring ray hit before the traversal, so it starts
+	// with a tight maxt. The traversals keep the closest hit in any visiting order, the image is
+	// the same with and without.
+	bool neighbour_hint = false;
+	// bvh mode on the OpenCL devices traces compressed_nodes, the BVH in the compressed layout
+	// of compress_bvh built by prepare_scene, instead of the full nodes of accel. The image is
+	// the same; compressed_nodes stays empty if the BVH doesn't compress.
+	bool compressed_bvh = false;
+	std::vector<compressed_bvh_node> compressed_nodes;
+	// prepare_scene and refit_scene lay accel4, accel8 and compressed_nodes out in treelets of
+	// a page with layout_treelets, the full nodes of accel keep their depth first order
+	bool treelet_layout = false;
+	// bvh mode on the CPU traces embree_accel, the Embree BVH build_embree_bvh builds over the
+	// spheres in place of accel and its wide nodes, which stay empty (--backend embree).
+	// prepare_scene builds accel instead if the program has no Embree or the scene is instanced.
+	bool embree = false;
+	std::shared_ptr<embree_bvh const> embree_accel;
+	// The tracers of none, bvh and sorted write the background of the pixels no sphere covers
+	// without tracing them, coverage is the build_coverage() mask prepare_scene builds for it
+	// and empty for every other mode and the pinhole camera
+	bool skip_background = false;
+	std::vector<std::uint32_t> coverage;
+	// Brute force tracers test the fp16 half_spheres of halves before the float spheres, the
+	// AVX2 and AVX-512 ones and the trace_half kernel. prepare_scene fills halves for the
+	// ortho camera in mode none, it stays empty otherwise.
+	bool half_spheres = false;
+	std::vector<half_sphere> halves;
+	// In mode bvh with the ortho camera the spheres whose footprint spans at most
+	// kTinySpherePixels pixels stay out of accel: the CPU tracers trace the rays through the BVH
+	// of the others, then splat the tiny ones into the pixel centers of their footprints that
+	// they may reach before the hit there, the same image. tiny bins them into cells of
+	// kTinyCellSize pixels, tiny_spheres holds every entry of tiny.indices; both are empty
+	// unless prepare_scene split some off. The OpenCL kernels trace accel alone, only the CPU
+	// backend may set it.
+	bool splat_tiny = false;
+	sphere_grid tiny;
+	std::vector<tiny_sphere> tiny_spheres;
+	// Mapped file the spheres were copied from, or null for generated ones. Its BVH
+	// replaces the build and its arrays can back device buffers while it stays open.
+	scene_file const* file = nullptr;
+	// Instanced scene the bvh mode traces with its two level BVH instead of spheres and accel,
+	// or null. Its BVHs are built by build_instance_bvhs, spheres stays empty.
+	instance_set const* instances = nullptr;
+	// Index in the loaded or generated set of every sphere of spheres after cull_scene dropped
+	// some, empty while spheres is the whole set
+	std::vector<std::uint32_t> sphere_ids;
+	// Tile side of render_parallel(), at most kTileSize of cpu_trace.h (see cache_tile_size),
+	// and the order its tiles are issued in
+	std::uint32_t tile_size = 32;
+	tile_order tiles = tile_order::scanline;
+};
+
+// Drop the spheres of scene.spheres no ray of scene.view can hit: the ones whose sphere_bounds
+// cover no pixel of the window or lie entirely before view.near or beyond view.far. The kept
+// spheres stay in their order with their colors, so ties between them resolve as before and
+// the image is the same, and scene.sphere_ids maps them back to the full set. Pinhole and
+// instanced scenes are left as they are; scene.file is dropped if anything was culled, its
+// BVH and arrays cover the full set. Call before prepare_scene. Returns the spheres dropped.
+std::uint32_t cull_scene(render_scene& scene);
+
+// cull_scene for an image of which only the pixels of roi are rendered: the spheres whose
+// footprint covers none of them go too. The pixels of roi are the same.
+std::uint32_t cull_scene(render_scene& scene, render_roi const& roi);
+
+// Drop the spheres of scene.spheres no ray of scene.view can see because a nearer sphere hides
+// them: sphere k goes if one sphere o meets every ray that can meet k, by the inner disc of
+// sphere_inner_radius() around the bounds of k, and all roots of o lie between the near plane
+// and both the bounds of k and the far plane. The closest hit then has t0 strictly below any
+// root of k, so k loses every t0 <= maxt comparison and the image, ties included, is the same
+// without it; o may go too, a chain of occluders ends at a kept sphere. Occluders are looked up in the grid cell of one pixel of the footprint of k instead of
+// over all spheres. A sphere crossing the near plane is hit from inside whatever is in front,
+// such a scene is left as it is, as are pinhole and instanced ones. Remaps scene.sphere_ids as
+// cull_scene does; call before prepare_scene. Returns the spheres dropped.
+std::uint32_t cull_hidden_spheres(render_scene& scene);
+
+// Permute scene.spheres into the Z-order of their centers over the box of the centers, so the
+// spheres of a BVH leaf or a grid cell lie next to each other in the arrays instead of
+// wherever the generator put them. The colors move with the spheres and scene.sphere_ids maps
+// them to the loaded or generated set, as after cull_scene. A tie between spheres at exactly
+// the same depth goes to the higher index of the new order, on every backend alike, so such a
+// pixel may show the other one of them than before. Instanced scenes are left as they are,
+// scene.file is dropped. Call after the culling and before prepare_scene. Returns false if
+// the spheres stayed where they were.
+bool morton_order_spheres(render_scene& scene);
+
+// Build the structure for mode over scene.spheres as seen through scene.view and set scene.mode. A BVH or
+// depth order that can't reproduce the brute force tie order (spheres crossing the near plane)
+// falls back to accel_mode::none, compare scene.mode with the request. A BVH stored in
+// scene.file for scene.view.near is loaded instead of built. The structures are built for ortho
+// rays, the pinhole camera falls back to accel_mode::none and culls spheres per tile instead.
+// The BVHs of scene.instances are taken as they are, scene.embree builds Embree's BVH in place
+// of the own one, scene.compressed_bvh compresses the BVH and scene.skip_background and
+// scene.half_spheres build the coverage mask and halves.
+// The temporary data of the build lives in scene.arena.
+void prepare_scene(render_scene& scene, accel_mode mode);
+
+// Bring the structure prepare_scene built for scene.mode up to date with the spheres of changed,
+// edited in place since, without building it again: bvh refits accel over them (refit_bvh) and
+// collapses and compresses it again, splat computes their footprints and bins again and none has nothing
+// to update. nodes gets the nodes of accel whose box changed. Returns false if the scene needs
+// prepare_scene instead: grid, adaptive and sorted, a BVH the edits made inexact, tiny spheres
+// split off the BVH, an Embree BVH, a coverage mask or halves, and instanced scenes.
+bool refit_scene(render_scene& scene, std::vector<std::uint32_t> const& changed, std::vector<std::int32_t>& nodes);
+
+// Any-hit query of occluded(), 16 bytes, mirrored by occlusion_ray in trace.cl: a ray along +Z,
+// the direction every structure is built for, from (ox, oy, oz). It is blocked if it meets a
+// sphere within [0, tmax] by the hit test of trace(), a sphere around the origin included.
+struct occlusion_ray
+{
+	float ox, oy, oz;
+	float tmax;
+};
+
+// One of the k nearest hits of a ray (render_nearest_hits()), 8 bytes, mirrored by ray_hit in
+// trace.cl: the distance of the hit along the ray, as trace() takes it, and the index of the
+// sphere. A ray that meets fewer than k spheres fills the rest with the far end of the ray and -1.
+struct ray_hit
+{
+	float t;
+	std::int32_t id;
+};
+
+// The k nearest hits are traced by tracers specialized for k, a power of two up to kMaxNearestHits
+std::uint32_t const kMaxNearestHits = 16;
+
+// True if k nearest hits have a tracer, 2, 4, 8 or 16
+bool nearest_hits_supported(std::uint32_t k);
@@ -0,0 +1,59 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+frame_arena::frame_arena(std::size_t block_size)
+	: block_size_(std::max<std::size_t>(block_size, kArenaAlignment))
+{
+}
+
+void* frame_arena::allocate(std::size_t bytes, std::size_t alignment)
+{
+	for (;; ++current_, offset_ = 0)
+	{
+		if (current_ == blocks_.size())
+		{
+			// room for the allocation after aligning the start of the block
+			auto size = std::max(block_size_, bytes + alignment);
+			blocks_.push_back(block{ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+		}
+
+		auto& b = blocks_[current_];
+		auto base = reinterpret_cast<std::uintptr_t>(b.memory.get());
+		auto start = (base + offset_ + alignment - 1) & ~std::uintptr_t(alignment - 1);
+
+		if (start + bytes <= base + b.size)
+		{
+			offset_ = start + bytes - base;
+			used_ += bytes;
+			return b.memory.get() + (start - base);
+		}
+	}
+}
+
+void frame_arena::reset()
+{
+	if (blocks_.size() > 1)
+	{
+		auto total = capacity();
+		blocks_.clear();
+		blocks_.push_back(block{ std::unique_ptr<unsigned char[]>(new unsigned char[total]), total });
+	}
+
+	current_ = 0;
+	offset_ = 0;
+	used_ = 0;
+}
+
+std::size_t frame_arena::capacity() const
+{
+	std::size_t total = 0;
+
+	for (auto const& b : blocks_)
+	{
+		total += b.size;
+	}
+
+	return total;
+}
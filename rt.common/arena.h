@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Alignment of every frame_arena allocation, one cache line
+std::size_t const kArenaAlignment = 64;
+
+// Linear allocator for the scratch data of one frame: allocations bump an offset through
+// large blocks and are never freed one by one, reset() releases all of them at once. Memory
+// is not initialized. After a reset that left more than one block the blocks are merged into
+// one of their total size, so a frame needing as much as the last one is served from a
+// single block. Not thread safe.
+class frame_arena
+{
+public:
+	explicit frame_arena(std::size_t block_size = std::size_t(1) << 20);
+
+	frame_arena(frame_arena const&) = delete;
+	frame_arena& operator=(frame_arena const&) = delete;
+	frame_arena(frame_arena&&) = default;
+	frame_arena& operator=(frame_arena&&) = default;
+
+	// bytes of memory aligned to alignment, a power of two, valid until the next reset()
+	void* allocate(std::size_t bytes, std::size_t alignment = kArenaAlignment);
+
+	// Uninitialized array of count T, for trivially destructible T
+	template <typename T>
+	T* allocate_array(std::size_t count)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T) > kArenaAlignment ? alignof(T) : kArenaAlignment));
+	}
+
+	// Release every allocation
+	void reset();
+
+	// Bytes handed out since the last reset and bytes held in blocks
+	std::size_t used() const
+	{
+		return used_;
+	}
+
+	std::size_t capacity() const;
+
+private:
+	struct block
+	{
+		std::unique_ptr<unsigned char[]> memory;
+		std::size_t size;
+	};
+
+	std::size_t block_size_;
+	std::vector<block> blocks_;
+	// Block allocations are taken from and the offset of its first free byte
+	std::size_t current_ = 0;
+	std::size_t offset_ = 0;
+	std::size_t used_ = 0;
+};
+
+// Standard allocator of T taking its memory from an arena, for containers of scratch data that
+// goes away with the arena's reset(). deallocate() does nothing, so a container that grows leaves
+// its old storage in the arena until then: size it once up front.
+template <typename T>
+class arena_allocator
+{
+public:
+	using value_type = T;
+
+	explicit arena_allocator(frame_arena& arena)
+		: arena_(&arena)
+	{
+	}
+
+	template <typename U>
+	arena_allocator(arena_allocator<U> const& other)
+		: arena_(other.arena())
+	{
+	}
+
+	T* allocate(std::size_t count)
+	{
+		return arena_->allocate_array<T>(count);
+	}
+
+	void deallocate(T*, std::size_t)
+	{
+	}
+
+	frame_arena* arena() const
+	{
+		return arena_;
+	}
+
+private:
+	frame_arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(arena_allocator<T> const& a, arena_allocator<U> const& b)
+{
+	return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(arena_allocator<T> const& a, arena_allocator<U> const& b)
+{
+	return a.arena() != b.arena();
+}
+
+// Vector of scratch data living in an arena
+template <typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
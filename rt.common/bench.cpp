@@ -0,0 +1,446 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include <OpenImageIO/timer.h>
+
+namespace
+{
+	// rate per second of count things per median run
+	double per_second(double count, bench_stats const& stats)
+	{
+		return stats.median > 0.0 ? count * 1e6 / stats.median : 0.0;
+	}
+
+	// 97.5% quantile of Student's t distribution with df degrees of freedom, the bound of a
+	// two-sided 95% interval, by the Cornish-Fisher expansion around the normal quantile
+	double t_quantile_975(double df)
+	{
+		double const z = 1.959964;
+		double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+
+		return z + (z3 + z) / (4.0 * df) + (5.0 * z5 + 16.0 * z3 + 3.0 * z) / (96.0 * df * df) +
+		       (3.0 * z7 + 19.0 * z5 + 17.0 * z3 - 15.0 * z) / (384.0 * df * df * df);
+	}
+
+	// Parser of the flat objects of write_bench_json: string and number values, no nesting
+	class json_reader
+	{
+	public:
+		explicit json_reader(std::string const& text)
+			: text_(text)
+		{
+		}
+
+		// Read the next object into result, false at the end of the text or on a syntax error
+		bool next(bench_result& result, bool& error)
+		{
+			error = false;
+			pos_ = text_.find('{', pos_);
+
+			if (pos_ == std::string::npos)
+				return false;
+
+			++pos_;
+			result = bench_result();
+			double rays_per_s = 0.0, tests_per_s = 0.0;
+
+			for (;;)
+			{
+				std::string key, text;
+				double number = 0.0;
+
+				if (!read_string(key) || !expect(':'))
+					return fail(error);
+
+				skip_space();
+
+				if (pos_ < text_.size() && text_[pos_] == '"')
+				{
+					if (!read_string(text))
+						return fail(error);
+				}
+				else
+				{
+					char const* start = text_.c_str() + pos_;
+					char* end = nullptr;
+					number = std::strtod(start, &end);
+
+					if (end == start)
+						return fail(error);
+
+					pos_ += end - start;
+				}
+
+				if (key == "name") result.name = text;
+				else if (key == "width") result.width = static_cast<std::uint32_t>(number);
+				else if (key == "height") result.height = static_cast<std::uint32_t>(number);
+				else if (key == "spheres") result.spheres = static_cast<std::uint32_t>(number);
+				else if (key == "warmup") result.warmup = static_cast<std::uint32_t>(number);
+				else if (key == "runs") result.stats.runs = static_cast<std::size_t>(number);
+				else if (key == "min_us") result.stats.min = number;
+				else if (key == "median_us") result.stats.median = number;
+				else if (key == "p95_us") result.stats.p95 = number;
+				else if (key == "mean_us") result.stats.mean = number;
+				else if (key == "stddev_us") result.stats.stddev = number;
+				else if (key == "rays_per_s") rays_per_s = number;
+				else if (key == "tests_per_s") tests_per_s = number;
+				else if (key == "structure_bytes") result.structure_bytes = number;
+				else if (key == "node_bytes_per_ray") result.node_bytes_per_ray = number;
+				else if (key == "node_misses_per_ray") result.node_misses_per_ray = number;
+				else if (key == "node_pages_per_ray") result.node_pages_per_ray = number;
+				else if (key == "build_ms_per_million") result.build_ms_per_million = number;
+				else if (key == "host_peak_bytes") result.host_peak_bytes = static_cast<std::uint64_t>(number);
+				else if (key == "device_peak_bytes") result.device_peak_bytes = static_cast<std::uint64_t>(number);
+				else if (key == "device_allocated_bytes") result.device_allocated_bytes = static_cast<std::uint64_t>(number);
+				else if (key == "cpu_joules_per_frame") result.cpu_joules_per_run = number;
+				else if (key == "gpu_joules_per_frame") result.gpu_joules_per_run = number;
+
+				skip_space();
+
+				if (pos_ < text_.size() && text_[pos_] == ',')
+				{
+					++pos_;
+					continue;
+				}
+
+				if (!expect('}'))
+					return fail(error);
+
+				break;
+			}
+
+			result.rays = rays_per_s * result.stats.median / 1e6;
+			result.tests = tests_per_s * result.stats.median / 1e6;
+			return true;
+		}
+
+	private:
+		bool fail(bool& error)
+		{
+			error = true;
+			return false;
+		}
+
+		void skip_space()
+		{
+			while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+				++pos_;
+		}
+
+		bool expect(char c)
+		{
+			skip_space();
+
+			if (pos_ >= text_.size() || text_[pos_] != c)
+				return false;
+
+			++pos_;
+			return true;
+		}
+
+		// write_bench_json doesn't escape, a string ends at the next quote
+		bool read_string(std::string& out)
+		{
+			if (!expect('"'))
+				return false;
+
+			auto end = text_.find('"', pos_);
+
+			if (end == std::string::npos)
+				return false;
+
+			out = text_.substr(pos_, end - pos_);
+			pos_ = end + 1;
+			return true;
+		}
+
+		std::string const& text_;
+		std::size_t pos_ = 0;
+	};
+}
+
+bench_stats compute_bench_stats(std::vector<double> samples)
+{
+	bench_stats stats = {};
+	stats.runs = samples.size();
+
+	if (samples.empty())
+		return stats;
+
+	std::sort(samples.begin(), samples.end());
+
+	auto n = samples.size();
+	stats.min = samples.front();
+	stats.median = n % 2 != 0 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+	// nearest rank
+	stats.p95 = samples[static_cast<std::size_t>(std::ceil(0.95 * n)) - 1];
+
+	double sum = 0.0;
+	for (auto s : samples)
+	{
+		sum += s;
+	}
+	stats.mean = sum / n;
+
+	double squares = 0.0;
+	for (auto s : samples)
+	{
+		squares += (s - stats.mean) * (s - stats.mean);
+	}
+	stats.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+
+	return stats;
+}
+
+bench_stats run_bench(std::function<void()> const& run, std::uint32_t warmup, std::uint32_t runs, energy_use* energy)
+{
+	for (auto i = 0U; i < warmup; ++i)
+	{
+		run();
+	}
+
+	std::vector<double> samples;
+	samples.reserve(runs);
+
+	// the sources are looked up only for the runs that are metered
+	std::unique_ptr<power_meter> meter(energy ? new power_meter : nullptr);
+
+	if (meter)
+		meter->start();
+
+	OIIO_NAMESPACE::Timer timer(false);
+
+	for (auto i = 0U; i < runs; ++i)
+	{
+		timer.lap();
+		run();
+		samples.push_back(timer.lap() * 1e6);
+	}
+
+	if (meter)
+		*energy = meter->stop();
+
+	return compute_bench_stats(samples);
+}
+
+void add_bench_energy(bench_result& result, energy_use const& energy)
+{
+	if (result.stats.runs == 0)
+		return;
+
+	result.cpu_joules_per_run = energy.cpu / result.stats.runs;
+	result.gpu_joules_per_run = energy.gpu / result.stats.runs;
+}
+
+void print_bench(bench_result const& result)
+{
+	auto const& stats = result.stats;
+
+	std::cout << result.name << ": " << stats.runs << " runs after " << result.warmup << " warmup, min " << stats.min << " us, median " << stats.median
+	          << " us, p95 " << stats.p95 << " us, stddev " << stats.stddev << " us\n";
+
+	if (result.rays > 0.0)
+		std::cout << "  " << per_second(result.rays, stats) << " rays/s, " << per_second(result.tests, stats) << " ray-sphere tests/s\n";
+
+	if (result.structure_bytes > 0.0)
+	{
+		std::cout << "  " << result.structure_bytes / 1024.0 << " KiB of nodes, " << result.node_bytes_per_ray << " node bytes per ray, "
+		          << result.node_bytes_per_ray * per_second(result.rays, stats) / 1e9 << " GB/s of nodes\n";
+		std::cout << "  " << result.node_misses_per_ray << " node cache line misses per ray, " << result.node_pages_per_ray << " node pages per ray\n";
+	}
+
+	if (result.build_ms_per_million > 0.0)
+		std::cout << "  " << result.build_ms_per_million << " ms build per million spheres\n";
+
+	if (result.host_peak_bytes > 0)
+	{
+		std::cout << "  peak host RSS " << result.host_peak_bytes / (1024.0 * 1024.0) << " MB, device memory peak " << result.device_peak_bytes / (1024.0 * 1024.0)
+		          << " MB of " << result.device_allocated_bytes / (1024.0 * 1024.0) << " MB allocated\n";
+	}
+
+	double joules = result.cpu_joules_per_run + result.gpu_joules_per_run;
+
+	if (joules > 0.0)
+	{
+		std::cout << "  " << joules << " J per frame (CPU packages " << result.cpu_joules_per_run << " J, GPU boards " << result.gpu_joules_per_run << " J), "
+		          << 1.0 / joules << " frames per J\n";
+	}
+}
+
+bool write_bench_json(std::string const& file, bench_result const& result)
+{
+	std::ofstream out(file);
+
+	if (!out)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	auto const& stats = result.stats;
+	double joules = result.cpu_joules_per_run + result.gpu_joules_per_run;
+
+	out << "{\n"
+	    << "  \"name\": \"" << result.name << "\",\n"
+	    << "  \"width\": " << result.width << ",\n"
+	    << "  \"height\": " << result.height << ",\n"
+	    << "  \"spheres\": " << result.spheres << ",\n"
+	    << "  \"warmup\": " << result.warmup << ",\n"
+	    << "  \"runs\": " << stats.runs << ",\n"
+	    << "  \"min_us\": " << stats.min << ",\n"
+	    << "  \"median_us\": " << stats.median << ",\n"
+	    << "  \"p95_us\": " << stats.p95 << ",\n"
+	    << "  \"mean_us\": " << stats.mean << ",\n"
+	    << "  \"stddev_us\": " << stats.stddev << ",\n"
+	    << "  \"rays_per_s\": " << per_second(result.rays, stats) << ",\n"
+	    << "  \"tests_per_s\": " << per_second(result.tests, stats) << ",\n"
+	    << "  \"structure_bytes\": " << result.structure_bytes << ",\n"
+	    << "  \"node_bytes_per_ray\": " << result.node_bytes_per_ray << ",\n"
+	    << "  \"node_misses_per_ray\": " << result.node_misses_per_ray << ",\n"
+	    << "  \"node_pages_per_ray\": " << result.node_pages_per_ray << ",\n"
+	    << "  \"build_ms_per_million\": " << result.build_ms_per_million << ",\n"
+	    << "  \"host_peak_bytes\": " << result.host_peak_bytes << ",\n"
+	    << "  \"device_peak_bytes\": " << result.device_peak_bytes << ",\n"
+	    << "  \"device_allocated_bytes\": " << result.device_allocated_bytes << ",\n"
+	    << "  \"cpu_joules_per_frame\": " << result.cpu_joules_per_run << ",\n"
+	    << "  \"gpu_joules_per_frame\": " << result.gpu_joules_per_run << ",\n"
+	    << "  \"joules_per_frame\": " << joules << ",\n"
+	    << "  \"frames_per_joule\": " << (joules > 0.0 ? 1.0 / joules : 0.0) << "\n"
+	    << "}\n";
+
+	return static_cast<bool>(out);
+}
+
+void write_bench_csv_header(std::ostream& out)
+{
+	out << "name,width,height,spheres,warmup,runs,min_us,median_us,p95_us,mean_us,stddev_us,rays_per_s,tests_per_s,structure_bytes,node_bytes_per_ray,node_misses_per_ray,node_pages_per_ray,build_ms_per_million\n";
+}
+
+void write_bench_csv_row(std::ostream& out, bench_result const& result)
+{
+	auto const& stats = result.stats;
+
+	// names contain commas (device names, thread counts), quote them
+	out << '"' << result.name << "\"," << result.width << ',' << result.height << ',' << result.spheres << ',' << result.warmup << ',' << stats.runs << ','
+	    << stats.min << ',' << stats.median << ',' << stats.p95 << ',' << stats.mean << ',' << stats.stddev << ','
+	    << per_second(result.rays, stats) << ',' << per_second(result.tests, stats) << ',' << result.structure_bytes << ',' << result.node_bytes_per_ray << ','
+	    << result.node_misses_per_ray << ',' << result.node_pages_per_ray << ','
+	    << result.build_ms_per_million << '\n';
+}
+
+bool read_bench_json(std::string const& file, std::vector<bench_result>& results)
+{
+	std::ifstream in(file);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << file << "\n";
+		return false;
+	}
+
+	std::stringstream text;
+	text << in.rdbuf();
+
+	auto contents = text.str();
+	json_reader reader(contents);
+
+	bench_result result;
+	bool error = false;
+
+	while (reader.next(result, error))
+	{
+		results.push_back(result);
+	}
+
+	if (error)
+	{
+		std::cout << "Can't parse the benchmark results of " << file << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+bench_delta compare_bench(bench_result const& baseline, bench_result const& current)
+{
+	bench_delta delta = {};
+
+	auto const& a = baseline.stats;
+	auto const& b = current.stats;
+
+	delta.mean = b.mean - a.mean;
+	delta.median_ratio = a.median > 0.0 ? b.median / a.median - 1.0 : 0.0;
+
+	// squared standard errors of the two means
+	double error_a = a.runs > 1 ? a.stddev * a.stddev / a.runs : 0.0;
+	double error_b = b.runs > 1 ? b.stddev * b.stddev / b.runs : 0.0;
+	double error = std::sqrt(error_a + error_b);
+
+	// a single run or no spread at all leaves nothing to tell noise from change
+	if (a.runs < 2 || b.runs < 2 || error == 0.0)
+	{
+		delta.low = delta.high = delta.mean;
+		return delta;
+	}
+
+	// Welch-Satterthwaite degrees of freedom
+	double df = (error_a + error_b) * (error_a + error_b) / (error_a * error_a / (a.runs - 1) + error_b * error_b / (b.runs - 1));
+	double half_width = t_quantile_975(df) * error;
+
+	delta.low = delta.mean - half_width;
+	delta.high = delta.mean + half_width;
+	delta.slower = delta.low > 0.0;
+	delta.faster = delta.high < 0.0;
+
+	return delta;
+}
+
+std::uint32_t print_bench_comparison(std::vector<bench_result> const& baseline, std::vector<bench_result> const& current)
+{
+	std::uint32_t slower = 0;
+
+	for (auto const& now : current)
+	{
+		auto before = std::find_if(baseline.begin(), baseline.end(), [&](bench_result const& r)
+		{
+			return r.name == now.name && r.width == now.width && r.height == now.height && r.spheres == now.spheres;
+		});
+
+		std::cout << now.name << ", " << now.width << "x" << now.height << ", " << now.spheres << " spheres: ";
+
+		if (before == baseline.end())
+		{
+			std::cout << "not in the baseline\n";
+			continue;
+		}
+
+		auto delta = compare_bench(*before, now);
+
+		std::cout << "median " << before->stats.median << " -> " << now.stats.median << " us (" << (delta.median_ratio >= 0.0 ? "+" : "")
+		          << 100.0 * delta.median_ratio << "%), mean " << (delta.mean >= 0.0 ? "+" : "") << delta.mean << " us, 95% interval ["
+		          << delta.low << ", " << delta.high << "] us";
+
+		if (delta.slower)
+		{
+			std::cout << ", SLOWER";
+			++slower;
+		}
+		else if (delta.faster)
+		{
+			std::cout << ", faster";
+		}
+
+		std::cout << "\n";
+	}
+
+	std::cout << slower << " significant slowdown" << (slower == 1 ? "" : "s") << " of " << current.size() << " cases\n";
+	return slower;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "power_meter.h"
+
+// Timing statistics of the timed runs of a benchmark, in microseconds
+struct bench_stats
+{
+	std::size_t runs;
+	double min;
+	double median;
+	double p95;
+	double mean;
+	double stddev;
+};
+
+// Statistics of the run times samples in microseconds
+bench_stats compute_bench_stats(std::vector<double> samples);
+
+// Call run warmup times untimed, then time runs calls with the OIIO timer. With energy the
+// timed calls are metered by a power_meter, energy is then what they took together.
+bench_stats run_bench(std::function<void()> const& run, std::uint32_t warmup, std::uint32_t runs, energy_use* energy = nullptr);
+
+// One benchmarked configuration. rays and tests per run give the throughput; tests counts
+// every sphere for every ray, as brute force does, so accelerated modes report the
+// equivalent test rate. bvh configurations also report the bytes of their nodes, the node
+// bytes a ray loads and the cache lines and pages of them, see measure_bvh_traffic; all are 0
+// for the others. Builds and refits of an acceleration structure trace no rays and report the
+// median time per million spheres.
+// The memory footprint is the peak resident set of the process and the peak and sum of the
+// device allocations so far, 0 where the caller doesn't know them. The energy per run is the
+// one of the CPU packages and of the GPU boards over the timed runs, 0 where the system
+// doesn't tell (power_meter).
+struct bench_result
+{
+	std::string name;
+	std::uint32_t width, height, spheres;
+	std::uint32_t warmup;
+	bench_stats stats;
+	double rays;
+	double tests;
+	double structure_bytes = 0.0;
+	double node_bytes_per_ray = 0.0;
+	double node_misses_per_ray = 0.0;
+	double node_pages_per_ray = 0.0;
+	double build_ms_per_million = 0.0;
+	std::uint64_t host_peak_bytes = 0;
+	std::uint64_t device_peak_bytes = 0;
+	std::uint64_t device_allocated_bytes = 0;
+	double cpu_joules_per_run = 0.0;
+	double gpu_joules_per_run = 0.0;
+};
+
+// Set the energy per run of result, whose stats are set, from energy of all its timed runs
+void add_bench_energy(bench_result& result, energy_use const& energy);
+
+// Print result with rays/s and tests/s at the median run time, the BVH traffic, the build
+// time, the memory footprint and the energy if there are
+void print_bench(bench_result const& result);
+
+// Write result as a JSON object to file. Returns false if it can't be written.
+bool write_bench_json(std::string const& file, bench_result const& result);
+
+// Column names of write_bench_csv_row(), followed by a newline
+void write_bench_csv_header(std::ostream& out);
+
+// Write result as one comma separated line
+void write_bench_csv_row(std::ostream& out, bench_result const& result);
+
+// Read the results write_bench_json wrote to file back, one per JSON object in it; the rates
+// become rays and tests per run again. Returns false with a message if file can't be read or
+// parsed.
+bool read_bench_json(std::string const& file, std::vector<bench_result>& results);
+
+// Difference of the mean run times of one case in two runs of a benchmark
+struct bench_delta
+{
+	// current - baseline in microseconds, and the bounds of its 95% confidence interval by
+	// Welch's t-test on the means, standard deviations and run counts
+	double mean;
+	double low, high;
+	// Relative change of the median
+	double median_ratio;
+	// The whole interval is above 0: the current run is slower beyond the noise of both
+	bool slower;
+	// The whole interval is below 0
+	bool faster;
+};
+
+bench_delta compare_bench(bench_result const& baseline, bench_result const& current);
+
+// Compare every case of current with the case of baseline of the same name, image size and
+// sphere count and print the deltas, flagging the significant slowdowns. Returns the number
+// of those.
+std::uint32_t print_bench_comparison(std::vector<bench_result> const& baseline, std::vector<bench_result> const& current);
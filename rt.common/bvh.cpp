@@ -0,0 +1,720 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace
+{
+	// Number of centroid bins per axis evaluated by the SAH
+	std::uint32_t const kNumBins = 16;
+	// Below this depth nodes are split at the median, which bounds the tree depth
+	// by kSahMaxDepth + log2(count) <= kBvhMaxDepth
+	std::uint32_t const kSahMaxDepth = 32;
+
+	struct build_item
+	{
+		Imath::Box3f bounds;
+		Imath::V3f centroid;
+		std::uint32_t index;
+	};
+
+	float half_area(Imath::Box3f const& box)
+	{
+		if (box.isEmpty())
+			return 0.f;
+
+		auto size = box.size();
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	class bvh_builder
+	{
+	public:
+		bvh_builder(arena_vector<build_item>& items, std::uint32_t max_leaf_size, bvh& out)
+			: items_(items)
+			, max_leaf_size_(std::max(max_leaf_size, 1U))
+			, out_(out)
+		{
+		}
+
+		// Emit the subtree over items [begin, end) and return its node index
+		std::int32_t build(std::uint32_t begin, std::uint32_t end, std::uint32_t depth)
+		{
+			Imath::Box3f bounds;
+			Imath::Box3f centroid_bounds;
+
+			for (auto i = begin; i < end; ++i)
+			{
+				bounds.extendBy(items_[i].bounds);
+				centroid_bounds.extendBy(items_[i].centroid);
+			}
+
+			auto node_index = static_cast<std::int32_t>(out_.nodes.size());
+			out_.nodes.emplace_back();
+			set_bounds(out_.nodes[node_index], bounds);
+
+			auto count = end - begin;
+			auto mid = begin;
+
+			if (count > max_leaf_size_)
+			{
+				mid = depth < kSahMaxDepth ? split(begin, end, bounds, centroid_bounds) : begin + count / 2;
+
+				if (depth >= kSahMaxDepth && centroid_bounds.size()[centroid_bounds.majorAxis()] > 0.f)
+					mid = partition_median(begin, end, centroid_bounds.majorAxis());
+			}
+
+			if (mid == begin)
+			{
+				out_.nodes[node_index].offset = static_cast<std::int32_t>(out_.indices.size());
+				out_.nodes[node_index].count = static_cast<std::int32_t>(count);
+
+				for (auto i = begin; i < end; ++i)
+				{
+					out_.indices.push_back(items_[i].index);
+				}
+
+				return node_index;
+			}
+
+			build(begin, mid, depth + 1);
+			auto second = build(mid, end, depth + 1);
+
+			out_.nodes[node_index].offset = second;
+			out_.nodes[node_index].count = 0;
+
+			return node_index;
+		}
+
+	private:
+		static void set_bounds(bvh_node& node, Imath::Box3f const& box)
+		{
+			for (auto a = 0; a < 3; ++a)
+			{
+				node.bmin[a] = box.min[a];
+				node.bmax[a] = box.max[a];
+			}
+		}
+
+		// Partition [begin, end) along the best SAH plane. Returns the first item of the
+		// right half, or begin if a leaf is cheaper than any split.
+		std::uint32_t split(std::uint32_t begin, std::uint32_t end, Imath::Box3f const& bounds, Imath::Box3f const& centroid_bounds)
+		{
+			auto count = end - begin;
+			auto extent = centroid_bounds.size();
+			auto axis = centroid_bounds.majorAxis();
+
+			if (!(extent[axis] > 0.f))
+			{
+				// All centroids coincide: no plane separates them, split by position in the list
+				return count > 2 * max_leaf_size_ ? begin + count / 2 : begin;
+			}
+
+			float best_cost = static_cast<float>(count) * half_area(bounds);
+			std::int32_t best_axis = -1;
+			std::uint32_t best_bin = 0;
+
+			for (auto a = 0; a < 3; ++a)
+			{
+				if (!(extent[a] > 0.f))
+					continue;
+
+				Imath::Box3f bin_bounds[kNumBins];
+				std::uint32_t bin_count[kNumBins] = {};
+
+				for (auto i = begin; i < end; ++i)
+				{
+					auto b = bin_of(items_[i].centroid[a], centroid_bounds.min[a], extent[a]);
+					bin_bounds[b].extendBy(items_[i].bounds);
+					++bin_count[b];
+				}
+
+				// Sweep from the right to get the cost of every right-hand side
+				float right_area[kNumBins];
+				std::uint32_t right_count[kNumBins];
+				Imath::Box3f acc;
+				std::uint32_t n = 0;
+
+				for (auto b = kNumBins - 1; b > 0; --b)
+				{
+					acc.extendBy(bin_bounds[b]);
+					n += bin_count[b];
+					right_area[b] = half_area(acc);
+					right_count[b] = n;
+				}
+
+				acc.makeEmpty();
+				n = 0;
+
+				for (auto b = 1U; b < kNumBins; ++b)
+				{
+					acc.extendBy(bin_bounds[b - 1]);
+					n += bin_count[b - 1];
+
+					if (n == 0 || right_count[b] == 0)
+						continue;
+
+					// Traversing an interior node costs about one sphere test
+					float cost = half_area(bounds) + half_area(acc) * n + right_area[b] * right_count[b];
+					if (cost < best_cost)
+					{
+						best_cost = cost;
+						best_axis = a;
+						best_bin = b;
+					}
+				}
+			}
+
+			if (best_axis < 0)
+			{
+				return count > 4 * max_leaf_size_ ? partition_median(begin, end, axis) : begin;
+			}
+
+			auto first = items_.begin() + begin;
+			auto middle = std::partition(first, items_.begin() + end, [&](build_item const& item)
+			{
+				return bin_of(item.centroid[best_axis], centroid_bounds.min[best_axis], extent[best_axis]) < best_bin;
+			});
+
+			return static_cast<std::uint32_t>(middle - items_.begin());
+		}
+
+		std::uint32_t partition_median(std::uint32_t begin, std::uint32_t end, int axis)
+		{
+			auto mid = begin + (end - begin) / 2;
+			std::nth_element(items_.begin() + begin, items_.begin() + mid, items_.begin() + end, [axis](build_item const& l, build_item const& r)
+			{
+				return l.centroid[axis] < r.centroid[axis];
+			});
+			return mid;
+		}
+
+		static std::uint32_t bin_of(float value, float min, float extent)
+		{
+			auto b = static_cast<std::int32_t>((value - min) / extent * kNumBins);
+			return static_cast<std::uint32_t>(std::min(std::max(b, 0), static_cast<std::int32_t>(kNumBins) - 1));
+		}
+
+		arena_vector<build_item>& items_;
+		std::uint32_t max_leaf_size_;
+		bvh& out_;
+	};
+}
+
+bvh build_bvh(sphere_soa const& spheres, float ray_origin_z, frame_arena& scratch, std::uint32_t max_leaf_size)
+{
+	bvh result;
+	result.exact = true;
+
+	arena_vector<build_item> items(spheres.size(), build_item(), arena_allocator<build_item>(scratch));
+
+	for (auto i = 0U; i < spheres.size(); ++i)
+	{
+		items[i].bounds = sphere_bounds(spheres, i, ray_origin_z);
+		items[i].centroid = Imath::V3f(spheres.cx[i], spheres.cy[i], spheres.cz[i]);
+		items[i].index = i;
+
+		if (!(items[i].bounds.min.z > ray_origin_z))
+			result.exact = false;
+	}
+
+	result.nodes.reserve(items.empty() ? 1 : 2 * items.size());
+	result.indices.reserve(items.size());
+
+	bvh_builder builder(items, max_leaf_size, result);
+	builder.build(0U, static_cast<std::uint32_t>(items.size()), 0U);
+
+	return result;
+}
+
+bvh_links link_bvh(bvh const& tree, std::uint32_t num_spheres)
+{
+	bvh_links links;
+	links.parent.assign(tree.nodes.size(), -1);
+	links.leaf.assign(num_spheres, -1);
+
+	for (std::size_t i = 0; i < tree.nodes.size(); ++i)
+	{
+		auto const& node = tree.nodes[i];
+		auto index = static_cast<std::int32_t>(i);
+
+		// the root of an empty tree is a leaf without spheres
+		if (node.count == 0 && tree.nodes.size() > 1)
+		{
+			links.parent[i + 1] = index;
+			links.parent[node.offset] = index;
+			continue;
+		}
+
+		for (auto l = node.offset; l < node.offset + node.count; ++l)
+		{
+			if (tree.indices[l] < num_spheres)
+				links.leaf[tree.indices[l]] = index;
+		}
+	}
+
+	return links;
+}
+
+std::vector<std::int32_t> refit_bvh(bvh& tree, bvh_links const& links, sphere_soa const& spheres, std::vector<std::uint32_t> const& changed,
+                                    float ray_origin_z)
+{
+	std::vector<std::int32_t> visit;
+
+	for (auto k : changed)
+	{
+		if (k >= links.leaf.size() || links.leaf[k] < 0)
+			continue;
+
+		if (!(sphere_bounds(spheres, k, ray_origin_z).min.z > ray_origin_z))
+			tree.exact = false;
+
+		for (auto n = links.leaf[k]; n >= 0; n = links.parent[n])
+		{
+			visit.push_back(n);
+		}
+	}
+
+	std::sort(visit.begin(), visit.end());
+	visit.erase(std::unique(visit.begin(), visit.end()), visit.end());
+
+	std::vector<std::int32_t> refitted;
+
+	// children follow their parent in the depth first layout, so the nodes are refitted bottom up
+	for (auto v = visit.rbegin(); v != visit.rend(); ++v)
+	{
+		auto& node = tree.nodes[*v];
+		Imath::Box3f box;
+
+		if (node.count != 0)
+		{
+			for (auto l = node.offset; l < node.offset + node.count; ++l)
+			{
+				box.extendBy(sphere_bounds(spheres, tree.indices[l], ray_origin_z));
+			}
+		}
+		else
+		{
+			for (auto const* child : { &tree.nodes[*v + 1], &tree.nodes[node.offset] })
+			{
+				box.extendBy(Imath::V3f(child->bmin[0], child->bmin[1], child->bmin[2]));
+				box.extendBy(Imath::V3f(child->bmax[0], child->bmax[1], child->bmax[2]));
+			}
+		}
+
+		bool moved = false;
+
+		for (auto a = 0; a < 3; ++a)
+		{
+			moved = moved || node.bmin[a] != box.min[a] || node.bmax[a] != box.max[a];
+			node.bmin[a] = box.min[a];
+			node.bmax[a] = box.max[a];
+		}
+
+		if (moved)
+			refitted.push_back(*v);
+	}
+
+	std::reverse(refitted.begin(), refitted.end());
+	return refitted;
+}
+
+namespace
+{
+	static_assert(sizeof(compressed_bvh_node) == 40, "compressed_bvh_node is mirrored by trace.cl");
+
+	// Quantize the boxes of children, null for an empty child, onto the grid of node along
+	// every axis of out
+	void quantize_children(bvh_node const& node, bvh_node const* const children[2], compressed_bvh_node& out)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			float origin = node.bmin[a];
+			float extent = node.bmax[a] - node.bmin[a];
+
+			// an empty box gets a grid its children can't be visited on
+			if (!(extent >= 0.f) || !std::isfinite(extent))
+			{
+				origin = 0.f;
+				extent = 0.f;
+			}
+
+			// the smallest power-of-two step whose 255 steps reach the far bound in float
+			int e = 0;
+			std::frexp(extent / 255.f, &e);
+			e = std::max(e, -126);
+			float step = std::ldexp(1.f, e);
+
+			while (origin + 255.f * step < origin + extent && e < 127)
+			{
+				step = std::ldexp(1.f, ++e);
+			}
+
+			out.origin[a] = origin;
+			out.exponent[a] = static_cast<std::uint8_t>(e + 127);
+
+			for (int c = 0; c < 2; ++c)
+			{
+				auto const* child = children[c];
+
+				if (!child || !(child->bmin[a] <= child->bmax[a]) || !(node.bmin[a] <= node.bmax[a]))
+				{
+					out.qlo[c * 3 + a] = 255;
+					out.qhi[c * 3 + a] = 0;
+					continue;
+				}
+
+				float lo = std::floor((child->bmin[a] - origin) / step);
+				float hi = std::ceil((child->bmax[a] - origin) / step);
+				lo = std::min(std::max(lo, 0.f), 255.f);
+				hi = std::min(std::max(hi, 0.f), 255.f);
+
+				// rounded outwards in the float arithmetic of the decoding
+				while (lo > 0.f && origin + lo * step > child->bmin[a])
+				{
+					lo -= 1.f;
+				}
+
+				while (hi < 255.f && origin + hi * step < child->bmax[a])
+				{
+					hi += 1.f;
+				}
+
+				out.qlo[c * 3 + a] = static_cast<std::uint8_t>(lo);
+				out.qhi[c * 3 + a] = static_cast<std::uint8_t>(hi);
+			}
+		}
+	}
+
+	// Append the compressed node of interior node i of tree and its interior descendants,
+	// returns its index or -1 if a leaf doesn't fit
+	std::int32_t compress_node(bvh const& tree, std::int32_t i, std::vector<compressed_bvh_node>& out)
+	{
+		auto const& node = tree.nodes[i];
+		auto at = static_cast<std::int32_t>(out.size());
+		out.emplace_back();
+
+		// a single leaf tree: the root is its own first child and the second one is empty
+		bool root_leaf = node.count != 0 || tree.nodes.size() == 1;
+		std::int32_t child_index[2] = { root_leaf ? i : i + 1, root_leaf ? i : node.offset };
+		bvh_node const* children[2] = { &tree.nodes[child_index[0]], root_leaf ? nullptr : &tree.nodes[child_index[1]] };
+
+		compressed_bvh_node packed = {};
+		quantize_children(node, children, packed);
+
+		for (int c = 0; c < 2; ++c)
+		{
+			auto const* child = children[c];
+
+			if (!child || child->count != 0 || child_index[c] == i)
+			{
+				if (child && child->count > std::numeric_limits<std::uint16_t>::max())
+					return -1;
+
+				packed.leaf_mask |= static_cast<std::uint8_t>(1U << c);
+				packed.child[c] = child ? child->offset : 0;
+				packed.count[c] = child ? static_cast<std::uint16_t>(child->count) : 0;
+				continue;
+			}
+
+			packed.child[c] = compress_node(tree, child_index[c], out);
+
+			if (packed.child[c] < 0)
+				return -1;
+		}
+
+		out[at] = packed;
+		return at;
+	}
+}
+
+std::vector<compressed_bvh_node> compress_bvh(bvh const& tree)
+{
+	std::vector<compressed_bvh_node> out;
+
+	if (tree.nodes.empty())
+		return out;
+
+	out.reserve(tree.nodes.size() / 2 + 1);
+
+	if (compress_node(tree, 0, out) < 0)
+		out.clear();
+
+	return out;
+}
+
+namespace
+{
+	float half_area(bvh_node const& node)
+	{
+		float x = node.bmax[0] - node.bmin[0];
+		float y = node.bmax[1] - node.bmin[1];
+		float z = node.bmax[2] - node.bmin[2];
+		return x * y + y * z + z * x;
+	}
+
+	// Append the wide node of interior node i of tree and its interior descendants, returns its index
+	template <std::uint32_t N>
+	std::int32_t collapse_node(bvh const& tree, std::int32_t i, std::vector<wide_bvh_node<N>>& out)
+	{
+		auto const& node = tree.nodes[i];
+		auto at = static_cast<std::int32_t>(out.size());
+		out.emplace_back();
+
+		// a single leaf tree: the root is its own only child
+		bool root_leaf = node.count != 0 || tree.nodes.size() == 1;
+		std::int32_t slots[N];
+		std::uint32_t used = 0;
+
+		if (root_leaf)
+		{
+			slots[used++] = i;
+		}
+		else
+		{
+			slots[used++] = i + 1;
+			slots[used++] = node.offset;
+		}
+
+		while (!root_leaf && used < N)
+		{
+			std::uint32_t open = N;
+			float largest = -1.f;
+
+			for (auto s = 0U; s < used; ++s)
+			{
+				auto const& child = tree.nodes[slots[s]];
+
+				if (child.count == 0 && half_area(child) > largest)
+				{
+					open = s;
+					largest = half_area(child);
+				}
+			}
+
+			if (open == N)
+				break;
+
+			auto const& opened = tree.nodes[slots[open]];
+			slots[used++] = opened.offset;
+			slots[open] = slots[open] + 1;
+		}
+
+		wide_bvh_node<N> wide;
+
+		for (auto s = 0U; s < N; ++s)
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				wide.bmin[a][s] = std::numeric_limits<float>::infinity();
+				wide.bmax[a][s] = -std::numeric_limits<float>::infinity();
+			}
+
+			wide.child[s] = 0;
+			wide.count[s] = 0;
+		}
+
+		for (auto s = 0U; s < used; ++s)
+		{
+			auto const& child = tree.nodes[slots[s]];
+
+			// the empty leaf of an empty scene stays an unused child
+			if (root_leaf && child.count == 0)
+				continue;
+
+			for (int a = 0; a < 3; ++a)
+			{
+				wide.bmin[a][s] = child.bmin[a];
+				wide.bmax[a][s] = child.bmax[a];
+			}
+
+			wide.count[s] = child.count;
+			wide.child[s] = child.count != 0 ? child.offset : collapse_node(tree, slots[s], out);
+		}
+
+		out[at] = wide;
+		return at;
+	}
+
+	template <std::uint32_t N>
+	std::vector<wide_bvh_node<N>> collapse_bvh(bvh const& tree)
+	{
+		std::vector<wide_bvh_node<N>> out;
+
+		if (tree.nodes.empty())
+			return out;
+
+		out.reserve(tree.nodes.size() / (N - 1) + 1);
+		collapse_node(tree, 0, out);
+		return out;
+	}
+}
+
+std::vector<bvh4_node> collapse_bvh4(bvh const& tree)
+{
+	return collapse_bvh<4>(tree);
+}
+
+std::vector<bvh8_node> collapse_bvh8(bvh const& tree)
+{
+	return collapse_bvh<8>(tree);
+}
+
+namespace
+{
+	float footprint(float const* lo, float const* hi)
+	{
+		return (hi[0] - lo[0]) * (hi[1] - lo[1]);
+	}
+
+	// Call visit(slot, index, footprint) for every interior child of node
+	template <typename Visit>
+	void interior_children(compressed_bvh_node const& node, Visit visit)
+	{
+		for (int c = 0; c < 2; ++c)
+		{
+			if (node.leaf_mask & (1U << c))
+				continue;
+
+			float lo[2], hi[2];
+
+			for (int a = 0; a < 2; ++a)
+			{
+				float step = std::ldexp(1.f, node.exponent[a] - 127);
+				lo[a] = node.origin[a] + node.qlo[c * 3 + a] * step;
+				hi[a] = node.origin[a] + node.qhi[c * 3 + a] * step;
+			}
+
+			visit(c, node.child[c], footprint(lo, hi));
+		}
+	}
+
+	template <std::uint32_t N, typename Visit>
+	void interior_children(wide_bvh_node<N> const& node, Visit visit)
+	{
+		for (auto c = 0U; c < N; ++c)
+		{
+			// unused children are empty leaves of count 0
+			if (node.count[c] != 0 || !(node.bmin[0][c] <= node.bmax[0][c]))
+				continue;
+
+			float lo[2] = { node.bmin[0][c], node.bmin[1][c] };
+			float hi[2] = { node.bmax[0][c], node.bmax[1][c] };
+			visit(c, node.child[c], footprint(lo, hi));
+		}
+	}
+
+	template <typename Node>
+	void layout_treelets(std::vector<Node>& nodes, std::size_t treelet_bytes)
+	{
+		if (nodes.size() < 2)
+			return;
+
+		auto per_treelet = std::max<std::size_t>(treelet_bytes / sizeof(Node), 1);
+
+		std::vector<std::int32_t> order;
+		order.reserve(nodes.size());
+		std::vector<std::int32_t> roots(1, 0);
+		// children of the nodes taken into the treelet, the largest footprint on top
+		std::vector<std::pair<float, std::int32_t>> frontier;
+		std::vector<std::int32_t> members, stack;
+		std::vector<std::pair<float, std::int32_t>> children;
+		std::vector<char> member(nodes.size(), 0);
+
+		while (!roots.empty())
+		{
+			frontier.assign(1, std::make_pair(0.f, roots.back()));
+			roots.pop_back();
+			members.clear();
+
+			// a treelet fills the rest of the current one when a small subtree ended it early
+			do
+			{
+				std::pop_heap(frontier.begin(), frontier.end());
+				auto node = frontier.back().second;
+				frontier.pop_back();
+				members.push_back(node);
+				member[node] = 1;
+
+				interior_children(nodes[node], [&](int, std::int32_t child, float area)
+				{
+					frontier.emplace_back(area, child);
+					std::push_heap(frontier.begin(), frontier.end());
+				});
+			} while (!frontier.empty() && (order.size() + members.size()) % per_treelet != 0);
+
+			// the treelet is stored depth first, the largest child first, so a node and the
+			// child most rays enter next share cache lines as in the layout of the build
+			stack.assign(1, members.front());
+
+			while (!stack.empty())
+			{
+				auto node = stack.back();
+				stack.pop_back();
+				order.push_back(node);
+				children.clear();
+
+				interior_children(nodes[node], [&](int, std::int32_t child, float area)
+				{
+					if (member[child])
+						children.emplace_back(area, child);
+				});
+
+				std::sort(children.begin(), children.end());
+
+				for (auto const& child : children)
+				{
+					stack.push_back(child.second);
+				}
+			}
+
+			// the smallest are taken last
+			std::sort(frontier.begin(), frontier.end());
+
+			for (auto const& child : frontier)
+			{
+				roots.push_back(child.second);
+			}
+		}
+
+		std::vector<std::int32_t> index(nodes.size());
+
+		for (std::size_t i = 0; i < order.size(); ++i)
+		{
+			index[order[i]] = static_cast<std::int32_t>(i);
+		}
+
+		std::vector<Node> out(nodes.size());
+
+		for (std::size_t i = 0; i < order.size(); ++i)
+		{
+			Node node = nodes[order[i]];
+
+			interior_children(node, [&](int slot, std::int32_t child, float)
+			{
+				node.child[slot] = index[child];
+			});
+
+			out[i] = node;
+		}
+
+		nodes.swap(out);
+	}
+}
+
+void layout_treelets(std::vector<compressed_bvh_node>& nodes, std::size_t treelet_bytes)
+{
+	layout_treelets<compressed_bvh_node>(nodes, treelet_bytes);
+}
+
+void layout_treelets(std::vector<bvh4_node>& nodes, std::size_t treelet_bytes)
+{
+	layout_treelets<bvh4_node>(nodes, treelet_bytes);
+}
+
+void layout_treelets(std::vector<bvh8_node>& nodes, std::size_t treelet_bytes)
+{
+	layout_treelets<bvh8_node>(nodes, treelet_bytes);
+}
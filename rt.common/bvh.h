@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "arena.h"
+#include "scene.h"
+
+// Node of the flattened bounding volume hierarchy, 32 bytes, mirrored by bvh_node in trace.cl.
+// Nodes are stored depth first: the first child of an interior node directly follows it,
+// the second child is at index offset. A leaf references count sphere indices starting
+// at bvh::indices[offset].
+struct bvh_node
+{
+	float bmin[3];
+	// Interior: index of the second child, leaf: first entry in bvh::indices
+	std::int32_t offset;
+	float bmax[3];
+	// 0 for interior nodes, number of spheres for leaves
+	std::int32_t count;
+};
+
+// Traversal stack size. The builder keeps every tree shallower than this.
+std::int32_t const kBvhMaxDepth = 64;
+
+struct bvh
+{
+	std::vector<bvh_node> nodes;
+	// Sphere indices referenced by the leaves
+	std::vector<std::uint32_t> indices;
+	// True if every sphere lies entirely in front of the ray origin plane. Then every
+	// hit has t0 > 0, the brute force loop keeps the nearest t0 with the highest index
+	// among equal ones, and any traversal order picks the same sphere.
+	bool exact = false;
+};
+
+// Interior node of a bvh in the compressed layout, 40 bytes, mirrored by compressed_bvh_node
+// in trace.cl. It holds the boxes of both children, quantized to 8 bits per bound on a grid
+// of power-of-two steps from the node's own box: child c spans
+//     origin[a] + qlo[c * 3 + a] * step[a] .. origin[a] + qhi[c * 3 + a] * step[a]
+// along axis a, step[a] being the float with exponent bits exponent[a]. The bounds are rounded
+// outwards in float arithmetic, the decoded box holds the full one on the host and the device.
+// A child is a compressed node (its index in child) or, with its bit in leaf_mask set, a leaf
+// of count spheres from bvh::indices[child]; an empty child decodes to an empty box.
+struct compressed_bvh_node
+{
+	float origin[3];
+	std::uint8_t exponent[3];
+	std::uint8_t leaf_mask;
+	std::uint8_t qlo[6];
+	std::uint8_t qhi[6];
+	std::uint16_t count[2];
+	std::int32_t child[2];
+};
+
+// Node of a wide BVH for the SIMD CPU tracers, which test a ray against all N children at once.
+// Child c spans bmin[a][c] .. bmax[a][c] along axis a, each axis of all children loads as one
+// vector. The child is a wide node (its index in child) if count[c] is 0, otherwise a leaf of
+// count[c] spheres from bvh::indices[child[c]]; unused children have empty bounds.
+template <std::uint32_t N>
+struct wide_bvh_node
+{
+	float bmin[3][N];
+	float bmax[3][N];
+	std::int32_t child[N];
+	std::int32_t count[N];
+};
+
+typedef wide_bvh_node<4> bvh4_node;
+typedef wide_bvh_node<8> bvh8_node;
+
+// Build a BVH over the spheres with the binned surface area heuristic, with the build items in
+// scratch. Leaves hold at most max_leaf_size spheres unless their centroids coincide.
+bvh build_bvh(sphere_soa const& spheres, float ray_origin_z, frame_arena& scratch, std::uint32_t max_leaf_size = 4);
+
+// Parent of every node of a bvh, -1 for the root, and leaf of every sphere, -1 for the spheres
+// the tree doesn't hold: the links refit_bvh walks up from a sphere
+struct bvh_links
+{
+	std::vector<std::int32_t> parent;
+	std::vector<std::int32_t> leaf;
+};
+
+bvh_links link_bvh(bvh const& tree, std::uint32_t num_spheres);
+
+// Refit tree to the spheres of changed as they are now: the boxes of the leaves holding them
+// and of the ancestors of those leaves are computed again with sphere_bounds, the nodes and the
+// order of the leaves stay those of the build, so the work grows with the changed spheres times
+// the depth. The boxes are exact but the tree loses quality as spheres move away from their
+// build position. Clears tree.exact if a changed sphere no longer lies in front of ray_origin_z.
+// Returns the nodes whose box changed, sorted.
+std::vector<std::int32_t> refit_bvh(bvh& tree, bvh_links const& links, sphere_soa const& spheres, std::vector<std::uint32_t> const& changed,
+                                    float ray_origin_z);
+
+// The interior nodes of tree in the compressed layout, root first, referencing the same
+// indices. A tree that is a single leaf gets one node with the leaf as its first child.
+// Returns an empty vector if a leaf holds more spheres than a count can, the tree is then
+// only traced in the full layout.
+std::vector<compressed_bvh_node> compress_bvh(bvh const& tree);
+
+// tree collapsed into nodes of up to 4 or 8 children, root first, referencing the same indices:
+// every wide node starts from the two children of a binary node and opens its interior child of
+// the largest surface area until it has N. The leaves and their boxes are those of tree, so a
+// traversal tests the spheres the binary one may test.
+std::vector<bvh4_node> collapse_bvh4(bvh const& tree);
+std::vector<bvh8_node> collapse_bvh8(bvh const& tree);
+
+// Node bytes of a treelet of layout_treelets, a page
+std::size_t const kTreeletBytes = 4096;
+
+// Reorder nodes, root first, into treelets of treelet_bytes that a traversal loads together:
+// each one is filled from its root with the interior child of the largest xy footprint, the
+// one the most rays along +z enter, and the children left over root the next treelets, so the
+// nodes near the root and the likeliest paths below them share cache lines and pages. A
+// treelet ends at a treelet_bytes boundary of the vector. The child indices are remapped, the
+// traversals visit the same nodes in the same order.
+void layout_treelets(std::vector<compressed_bvh_node>& nodes, std::size_t treelet_bytes = kTreeletBytes);
+void layout_treelets(std::vector<bvh4_node>& nodes, std::size_t treelet_bytes = kTreeletBytes);
+void layout_treelets(std::vector<bvh8_node>& nodes, std::size_t treelet_bytes = kTreeletBytes);
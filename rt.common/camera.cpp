@@ -0,0 +1,99 @@
+#include "camera.h"
+
+#include <cmath>
+#include <cstdio>
+
+bool parse_pinhole_camera(char const* text, pinhole_camera& camera)
+{
+	float v[8];
+	char end = 0;
+
+	v[7] = 1000.f;
+
+	auto count = std::sscanf(text, "%f,%f,%f,%f,%f,%f,%f,%f%c", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &end);
+
+	if (count != 7 && count != 8)
+		return false;
+
+	Imath::V3f eye(v[0], v[1], v[2]);
+	Imath::V3f target(v[3], v[4], v[5]);
+	Imath::V3f direction = target - eye;
+
+	if (!(v[6] > 0.f && v[6] < 180.f && v[7] > 0.f) || (direction.x == 0.f && direction.z == 0.f))
+		return false;
+
+	camera.eye = eye;
+	camera.target = target;
+	camera.fov_y = v[6];
+	camera.far = v[7];
+	return true;
+}
+
+pinhole_rays make_pinhole_rays(pinhole_camera const& camera, ortho_view const& view)
+{
+	pinhole_rays rays;
+	rays.eye = camera.eye;
+	rays.forward = (camera.target - camera.eye).normalized();
+	rays.right = rays.forward.cross(Imath::V3f(0.f, 1.f, 0.f)).normalized();
+	rays.up = rays.right.cross(rays.forward);
+
+	rays.height = 2.f * std::tan(camera.fov_y * 3.14159265f / 360.f);
+	rays.width = rays.height * view.image_width / view.image_height;
+	rays.left = -0.5f * rays.width;
+	rays.bottom = -0.5f * rays.height;
+	rays.far = camera.far;
+	return rays;
+}
+
+bool parse_ortho_orientation(char const* text, ortho_orientation& orientation)
+{
+	float v[6] = { 0.f, 0.f, 0.f, 0.f, 1.f, 0.f };
+	char end = 0;
+
+	auto count = std::sscanf(text, "%f,%f,%f,%f,%f,%f%c", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &end);
+
+	if (count != 3 && count != 6)
+		return false;
+
+	Imath::V3f direction(v[0], v[1], v[2]);
+	Imath::V3f up(v[3], v[4], v[5]);
+
+	if (direction.length() == 0.f || up.cross(direction).length() == 0.f)
+		return false;
+
+	orientation.direction = direction;
+	orientation.up = up;
+	return true;
+}
+
+Imath::M44f ortho_view_matrix(ortho_orientation const& orientation, ortho_view const& view)
+{
+	Imath::V3f forward = orientation.direction.normalized();
+	Imath::V3f right = orientation.up.cross(forward).normalized();
+	Imath::V3f up = forward.cross(right);
+
+	// the columns are the view axes, a row vector p maps to (p . right, p . up, p . forward)
+	Imath::M44f rotation(right.x, up.x, forward.x, 0.f, right.y, up.y, forward.y, 0.f, right.z, up.z, forward.z, 0.f, 0.f, 0.f, 0.f, 1.f);
+
+	Imath::V3f center(view.left + 0.5f * view.width, view.bottom + 0.5f * view.height, 0.5f * (view.near + view.far));
+	Imath::M44f to_center;
+	Imath::M44f from_center;
+	to_center.setTranslation(-center);
+	from_center.setTranslation(center);
+
+	return to_center * rotation * from_center;
+}
+
+void transform_spheres(sphere_soa& spheres, Imath::M44f const& m)
+{
+	for (auto i = 0U; i < spheres.size(); ++i)
+	{
+		float x = spheres.cx[i];
+		float y = spheres.cy[i];
+		float z = spheres.cz[i];
+
+		spheres.cx[i] = x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0];
+		spheres.cy[i] = x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1];
+		spheres.cz[i] = x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2];
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <OpenEXR/ImathMatrix.h>
+#include <OpenEXR/ImathVec.h>
+
+#include "grid.h"
+
+// How the camera rays of an image are generated
+enum class projection
+{
+	// Parallel rays along +Z through the window of the ortho_view
+	ortho,
+	// Rays from one eye point through the pixels of an image plane, see pinhole_camera
+	pinhole
+};
+
+// Perspective camera at eye looking at target with +Y up. The image keeps the size of the
+// ortho_view it is rendered with, fov_y is the vertical field of view in degrees and far
+// the largest depth along the view direction a hit may have.
+struct pinhole_camera
+{
+	Imath::V3f eye;
+	Imath::V3f target;
+	float fov_y;
+	float far;
+};
+
+// Parse eye_x,eye_y,eye_z,target_x,target_y,target_z,fov_y[,far] into camera, far defaults
+// to 1000. Returns false for anything else, a field of view outside (0, 180) degrees or a
+// view direction along Y.
+bool parse_pinhole_camera(char const* text, pinhole_camera& camera);
+
+// Camera space of a pinhole_camera for the image of view: ray (i, j) leaves eye along
+// forward + x * right + y * up with x = left + (width / image_width) * (i + 0.5) and y
+// likewise, so its parameter t is the depth along forward.
+struct pinhole_rays
+{
+	Imath::V3f eye;
+	Imath::V3f forward, right, up;
+	// Window of the image plane at depth 1
+	float left, bottom, width, height;
+	float far;
+};
+
+pinhole_rays make_pinhole_rays(pinhole_camera const& camera, ortho_view const& view);
+
+// Orientation of an orthographic view: the direction its parallel rays run along and the
+// direction that is up in its image. The default is the +Z view with +Y up the tracers and
+// kernels are built for.
+struct ortho_orientation
+{
+	Imath::V3f direction = Imath::V3f(0.f, 0.f, 1.f);
+	Imath::V3f up = Imath::V3f(0.f, 1.f, 0.f);
+};
+
+// Parse dx,dy,dz[,up_x,up_y,up_z] into orientation, up defaults to +Y. Returns false for
+// anything else, a zero direction or an up along it.
+bool parse_ortho_orientation(char const* text, ortho_orientation& orientation);
+
+// Rigid transform, for row vectors as Imath has them, from the world into the space of view
+// oriented by orientation: there the rays run along +Z through the window of view as in the
+// default view. It turns about the center of the view volume, which stays in the middle of the
+// image. The identity for the default orientation.
+Imath::M44f ortho_view_matrix(ortho_orientation const& orientation, ortho_view const& view);
+
+// Move the centers of spheres by the rigid transform m, radii and colors are left as they are
+void transform_spheres(sphere_soa& spheres, Imath::M44f const& m);
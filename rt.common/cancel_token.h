@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+
+// Flag another thread sets to stop a render in flight, such as the UI once the user moved the
+// view. The renderers check it between pieces of work, tiles on the CPU and launches of tiles
+// or chunks on a device, so a cancelled frame ends after the pieces already running; the
+// pixels of the pieces that finished stay in the target. A token may be reused once the
+// render it cancelled returned.
+class cancel_token
+{
+public:
+	void cancel()
+	{
+		cancelled_.store(true, std::memory_order_relaxed);
+	}
+
+	bool cancelled() const
+	{
+		return cancelled_.load(std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		cancelled_.store(false, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<bool> cancelled_{ false };
+};
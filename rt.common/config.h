@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Output image dimensions
+std::uint32_t const kImageWidth = 2048;
+std::uint32_t const kImageHeight = 2048;
+// Number of spheres to render
+std::uint32_t const kNumSpheres = 512;
+
+// Orthographic view, mirrored by the RT_* defines in trace.cl
+#define RT_LEFT -10.f
+#define RT_BOTTOM -10.f
+#define RT_WIDTH 20.f
+#define RT_HEIGHT 20.f
+#define RT_NEAR -10.f
+#define RT_FAR 10.f
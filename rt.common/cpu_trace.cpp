@@ -0,0 +1,2998 @@
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <unordered_map>
+
+#include <OpenEXR/ImathFrustum.h>
+#include <OpenEXR/ImathMatrix.h>
+#include <OpenEXR/ImathPlane.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+#include "half_float.h"
+#include "pixel_cost.h"
+#include "pixel_format.h"
+#include "roi.h"
+
+// MSVC emits any intrinsic regardless of /arch, GCC and Clang need the ISA enabled per function
+#if defined(_MSC_VER)
+#define RT_TARGET(isa)
+#else
+#define RT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// Built with RT_COST_COUNTERS the tracers count their sphere tests and BVH node loads for
+// render_cost(), the normal build compiles the counting out
+#ifdef RT_COST_COUNTERS
+#define RT_COUNT_TEST() (++ray_cost.tests)
+#define RT_COUNT_VISIT() (++ray_cost.visits)
+#else
+#define RT_COUNT_TEST()
+#define RT_COUNT_VISIT()
+#endif
+
+namespace
+{
+#ifdef RT_COST_COUNTERS
+	// Work of the ray the calling thread traces
+	thread_local pixel_cost ray_cost = { 0, 0 };
+#endif
+
+	// Ray with origin, direction and the distance of the closest hit so far
+	struct ray
+	{
+		// Origin
+		float ox, oy, oz;
+		// Direction
+		float dx, dy, dz;
+		// Intersection distance
+		float maxt;
+	};
+
+	float const kBackground[3] = { 0.1f, 0.1f, 0.1f };
+
+	// Pixel layouts of the tile tracers, one per pixel_format. Each converts an rgb float color
+	// as convert_rows() does, so a tracer writing rgba8 leaves the bytes of the float image
+	// converted afterwards.
+	struct float3_pixels
+	{
+		static std::size_t const kSize = 3 * sizeof(float);
+
+		static void write(float const* color, unsigned char* pixel)
+		{
+			std::memcpy(pixel, color, kSize);
+		}
+	};
+
+	// rgb floats and a zero padding them to 16 bytes, as float4 of trace.cl
+	struct float4_pixels
+	{
+		static std::size_t const kSize = 4 * sizeof(float);
+
+		static void write(float const* color, unsigned char* pixel)
+		{
+			float const channels[4] = { color[0], color[1], color[2], 0.f };
+			std::memcpy(pixel, channels, kSize);
+		}
+	};
+
+	struct half3_pixels
+	{
+		static std::size_t const kSize = 3 * sizeof(std::uint16_t);
+
+		static void write(float const* color, unsigned char* pixel)
+		{
+			std::uint16_t const channels[3] = { float_to_half(color[0]), float_to_half(color[1]), float_to_half(color[2]) };
+			std::memcpy(pixel, channels, kSize);
+		}
+	};
+
+	struct rgba8_pixels
+	{
+		static std::size_t const kSize = 4;
+
+		// OIIO's scaled conversion of float to uint8
+		static void write(float const* color, unsigned char* pixel)
+		{
+			for (auto c = 0; c < 3; ++c)
+			{
+				float s = color[c] * 255.f;
+				s += s < 0.f ? -0.5f : 0.5f;
+				pixel[c] = static_cast<unsigned char>(std::min(std::max(s, 0.f), 255.f));
+			}
+
+			pixel[3] = 255;
+		}
+	};
+
+	// Index of the closest sphere per pixel (id16 and id32), all ones for the background
+	template <class Id>
+	struct id_pixels
+	{
+		static std::size_t const kSize = sizeof(Id);
+
+		static void write_id(int idx, unsigned char* pixel)
+		{
+			Id id = idx >= 0 ? static_cast<Id>(idx) : static_cast<Id>(~Id(0));
+			std::memcpy(pixel, &id, kSize);
+		}
+	};
+
+	// Pixel (i, j) of the image img of view in the layout Output
+	template <class Output>
+	inline unsigned char* pixel_at(unsigned char* img, ortho_view const& view, std::uint32_t i, std::uint32_t j)
+	{
+		return img + (std::size_t(j) * view.image_width + i) * Output::kSize;
+	}
+
+	// Write the closest sphere idx to pixel in the layout of the null pointer's type
+	template <class Output>
+	inline void write_hit(Output*, sphere_soa const& spheres, int idx, unsigned char* pixel)
+	{
+		Output::write(idx >= 0 ? &spheres.color[idx * 3] : kBackground, pixel);
+	}
+
+	template <class Id>
+	inline void write_hit(id_pixels<Id>*, sphere_soa const&, int idx, unsigned char* pixel)
+	{
+		id_pixels<Id>::write_id(idx, pixel);
+	}
+
+	// Write the color of the closest sphere idx to pixel, the background if no sphere was hit;
+	// the id layouts write idx itself
+	template <class Output>
+	inline void shade_pixel(sphere_soa const& spheres, int idx, unsigned char* pixel)
+	{
+		write_hit(static_cast<Output*>(nullptr), spheres, idx, pixel);
+	}
+
+	// Solve quadratic equations and return roots if exist
+	// Returns true if roots exist and are returned in x1 and x2
+	// Returns false if no roots exist and x1 and x2 are undefined
+	bool solve_quadratic(float a, float b, float c, float& x1, float& x2)
+	{
+		float d = b*b - 4 * a*c;
+
+		if (d < 0)
+			return false;
+		else
+		{
+			float den = 1 / (2 * a);
+			x1 = (-b - std::sqrt(d))*den;
+			x2 = (-b + std::sqrt(d))*den;
+			return true;
+		}
+	}
+
+	// Roots of the quadratic for the ray and the sphere k
+	// Returns false if the ray's line misses the sphere
+	// The ray is read in place: only the sphere-relative origin is kept in registers.
+	// kAlongZ promises a ray along +Z, the direction is then never read.
+	template <bool kAlongZ = false>
+	bool sphere_roots(sphere_soa const& spheres, std::uint32_t k, ray const& r, float& t0, float& t1)
+	{
+		RT_COUNT_TEST();
+
+		float ox = r.ox - spheres.cx[k];
+		float oy = r.oy - spheres.cy[k];
+		float oz = r.oz - spheres.cz[k];
+
+		if (kAlongZ || (r.dx == 0.f && r.dy == 0.f && r.dz == 1.f))
+		{
+			// Camera rays: a = 1 and b = 2 * oz, so the roots are -oz -+ sqrt(oz^2 - c), the half-b
+			// form without the 4ac product and the division. b, the discriminant and its square root
+			// only differ by powers of two from solve_quadratic(), so the roots are the same floats.
+			float c = ox * ox + oy * oy + oz * oz - spheres.radius2[k];
+			float d = oz * oz - c;
+
+			if (d < 0)
+				return false;
+
+			float sqrt_d = std::sqrt(d);
+			t0 = -oz - sqrt_d;
+			t1 = -oz + sqrt_d;
+			return true;
+		}
+
+		float a = r.dx * r.dx + r.dy * r.dy + r.dz * r.dz;
+		float b = 2 * (ox * r.dx + oy * r.dy + oz * r.dz);
+		float c = ox * ox + oy * oy + oz * oz - spheres.radius2[k];
+
+		return solve_quadratic(a, b, c, t0, t1);
+	}
+
+	// Intersect the ray against the sphere k
+	// If there is an intersection:
+	// * return true
+	// * update r.maxt to intersection distance
+	template <bool kAlongZ = false>
+	bool intersect_sphere(sphere_soa const& spheres, std::uint32_t k, ray& r)
+	{
+		float t0, t1;
+
+		if (sphere_roots<kAlongZ>(spheres, k, r, t0, t1))
+		{
+			if (t0 > r.maxt || t1 < 0.f)
+				return false;
+
+			r.maxt = t0 > 0.f ? t0 : t1;
+			return true;
+		}
+
+		return false;
+	}
+
+	// intersect_sphere() for traversals that visit spheres out of index order, idx is the current hit.
+	// On equal distance the sphere with the higher index wins, as it is the one the in-order
+	// loop of all_spheres would keep.
+	template <bool kAlongZ = false>
+	bool intersect_sphere_ordered(sphere_soa const& spheres, std::uint32_t k, int idx, ray& r)
+	{
+		float t0, t1;
+
+		if (sphere_roots<kAlongZ>(spheres, k, r, t0, t1))
+		{
+			if (t0 > r.maxt || t1 < 0.f)
+				return false;
+
+			if (t0 == r.maxt && static_cast<int>(k) < idx)
+				return false;
+
+			r.maxt = t0 > 0.f ? t0 : t1;
+			return true;
+		}
+
+		return false;
+	}
+
+
+	// Start the ray r with the sphere hint a neighbouring ray hit, -1 for none. Returns hint if
+	// r hits it, with r.maxt at the hit, otherwise -1 and r as is.
+	template <bool kAlongZ>
+	inline int seed_hint(sphere_soa const& spheres, int hint, ray& r)
+	{
+		if (hint >= 0 && intersect_sphere_ordered<kAlongZ>(spheres, static_cast<std::uint32_t>(hint), -1, r))
+			return hint;
+
+		return -1;
+	}
+
+	// Cameras of trace_tile(): row() starts the ray r of row j, pixel() makes it the ray of pixel
+	// (i, j). kAlongZ tells the hit tests the rays run along +Z.
+
+	// Parallel rays along +Z through the window of view. The hit tests take the half-b roots of
+	// sphere_roots() without looking at the direction, so it is never set.
+	struct ortho_rays
+	{
+		static bool const kAlongZ = true;
+
+		explicit ortho_rays(ortho_view const& view)
+			: view(view)
+		{
+		}
+
+		ortho_rays(render_scene const& scene)
+			: view(scene.view)
+		{
+		}
+
+		void row(std::uint32_t j, ray& r) const
+		{
+			r.oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+		}
+
+		void pixel(std::uint32_t i, std::uint32_t, ray& r) const
+		{
+			r.oz = view.near;
+			r.ox = view.left + (view.width / view.image_width) * (i + 0.5f);
+			r.maxt = view.far - view.near;
+		}
+
+		ortho_view const& view;
+	};
+
+	// Rays of the pinhole camera through the pixels of the image of view, see pinhole_rays
+	struct perspective_rays
+	{
+		static bool const kAlongZ = false;
+
+		perspective_rays(ortho_view const& view, pinhole_camera const& camera)
+			: view(view), rays(make_pinhole_rays(camera, view))
+		{
+		}
+
+		perspective_rays(render_scene const& scene)
+			: perspective_rays(scene.view, scene.pinhole)
+		{
+		}
+
+		void row(std::uint32_t, ray&) const
+		{
+		}
+
+		void pixel(std::uint32_t i, std::uint32_t j, ray& r) const
+		{
+			float x = rays.left + (rays.width / view.image_width) * (i + 0.5f);
+			float y = rays.bottom + (rays.height / view.image_height) * (j + 0.5f);
+
+			r.ox = rays.eye.x;
+			r.oy = rays.eye.y;
+			r.oz = rays.eye.z;
+			r.dx = rays.forward.x + x * rays.right.x + y * rays.up.x;
+			r.dy = rays.forward.y + x * rays.right.y + y * rays.up.y;
+			r.dz = rays.forward.z + x * rays.right.z + y * rays.up.z;
+			r.maxt = rays.far;
+		}
+
+		ortho_view const& view;
+		pinhole_rays rays;
+	};
+
+	// Sphere lookups of trace_tile(), made for the camera and the tile: row() is called before
+	// the pixels of row j, closest() returns the closest sphere the ray of pixel i of the row
+	// hits, -1 for the background. The structures are built for ortho rays, their lookups only
+	// compile for cameras along +Z.
+
+	// Every sphere in index order
+	struct all_spheres
+	{
+		explicit all_spheres(sphere_soa const& spheres)
+			: spheres(spheres)
+		{
+		}
+
+		template <class Camera>
+		all_spheres(render_scene const& scene, Camera const&, tile const&)
+			: spheres(scene.spheres)
+		{
+		}
+
+		void row(std::uint32_t)
+		{
+		}
+
+		template <bool kAlongZ>
+		int closest(ray& r, std::uint32_t)
+		{
+			int idx = -1;
+
+			for (auto k = 0U; k < spheres.size(); ++k)
+			{
+				if (intersect_sphere<kAlongZ>(spheres, k, r))
+				{
+					idx = static_cast<int>(k);
+				}
+			}
+
+			return idx;
+		}
+
+		sphere_soa const& spheres;
+	};
+
+	// Spheres of the pinhole image of view that a ray of tile t may hit, in index order: the ones not
+	// entirely outside a side plane of the tile's frustum or beyond its far plane. The frustum is
+	// widened by a pixel on every side and its far plane pushed out, so a sphere culled is further
+	// from every ray of t than the rounding of the hit test.
+	void tile_candidates(sphere_soa const& spheres, pinhole_rays const& rays, ortho_view const& view, tile const& t, std::vector<std::uint32_t>& candidates)
+	{
+		float step_x = rays.width / view.image_width;
+		float step_y = rays.height / view.image_height;
+
+		Imath::Frustumf frustum(1.f, rays.far * (1.f + 1.f / 1024), rays.left + step_x * (static_cast<float>(t.x0) - 1.f), rays.left + step_x * (t.x1 + 1.f),
+		                        rays.bottom + step_y * (t.y1 + 1.f), rays.bottom + step_y * (static_cast<float>(t.y0) - 1.f));
+
+		// Imath cameras look along -Z, the frustum corners map to the image plane of rays
+		Imath::M44f to_world(rays.right.x, rays.right.y, rays.right.z, 0.f, rays.up.x, rays.up.y, rays.up.z, 0.f,
+		                     -rays.forward.x, -rays.forward.y, -rays.forward.z, 0.f, rays.eye.x, rays.eye.y, rays.eye.z, 1.f);
+
+		// Top, right, bottom, left, near and far. Rays start at the eye, the near plane is left out.
+		Imath::Plane3f planes[6];
+		frustum.planes(planes, to_world);
+
+		candidates.clear();
+
+		for (auto k = 0U; k < spheres.size(); ++k)
+		{
+			Imath::V3f center(spheres.cx[k], spheres.cy[k], spheres.cz[k]);
+			float radius = std::sqrt(spheres.radius2[k]);
+
+			bool outside = false;
+
+			for (auto p : { 0, 1, 2, 3, 5 })
+			{
+				outside = outside || planes[p].distanceTo(center) > radius;
+			}
+
+			if (!outside)
+				candidates.push_back(k);
+		}
+	}
+
+	// The spheres of tile_candidates() in index order, the image of all_spheres
+	struct frustum_culled
+	{
+		frustum_culled(render_scene const& scene, perspective_rays const& camera, tile const& t)
+			: spheres(scene.spheres)
+		{
+			tile_candidates(spheres, camera.rays, scene.view, t, candidates);
+		}
+
+		void row(std::uint32_t)
+		{
+		}
+
+		template <bool kAlongZ>
+		int closest(ray& r, std::uint32_t)
+		{
+			int idx = -1;
+
+			for (auto k : candidates)
+			{
+				if (intersect_sphere<kAlongZ>(spheres, k, r))
+				{
+					idx = static_cast<int>(k);
+				}
+			}
+
+			return idx;
+		}
+
+		sphere_soa const& spheres;
+		std::vector<std::uint32_t> candidates;
+	};
+
+	// The spheres binned into the pixel's grid cell. Cell lists keep index order, so the image
+	// is the one of all_spheres.
+	struct grid_cells
+	{
+		template <class Camera>
+		grid_cells(render_scene const& scene, Camera const&, tile const&)
+			: spheres(scene.spheres), grid(scene.grid)
+		{
+		}
+
+		void row(std::uint32_t j)
+		{
+			first_cell = (j / grid.cell_size) * grid.cells_x;
+		}
+
+		template <bool kAlongZ>
+		int closest(ray& r, std::uint32_t i)
+		{
+			static_assert(kAlongZ, "grid cells are pixel blocks of the ortho image");
+
+			std::uint32_t const* cell_start = grid.cell_start.data();
+			std::uint32_t const* indices = grid.indices.data();
+			auto const cell = first_cell + i / grid.cell_size;
+
+			int idx = -1;
+
+			for (auto l = cell_start[cell]; l < cell_start[cell + 1]; ++l)
+			{
+				auto k = indices[l];
+				if (intersect_sphere<kAlongZ>(spheres, k, r))
+				{
+					idx = static_cast<int>(k);
+				}
+			}
+
+			return idx;
+		}
+
+		sphere_soa const& spheres;
+		sphere_grid const& grid;
+		std::uint32_t first_cell = 0;
+	};
+
+	// Traversal of the BVH, giving the image of all_spheres when accel.exact is set. With the
+	// neighbour hint every ray first tests the sphere of the pixel to its left, or above for
+	// the first one of a row.
+	struct bvh_traversal
+	{
+		template <class Camera>
+		bvh_traversal(render_scene const& scene, Camera const&, tile const& t)
+			: spheres(scene.spheres), nodes(scene.accel.nodes.data()), indices(scene.accel.indices.data()), hint(scene.neighbour_hint), x0(t.x0)
+		{
+		}
+
+		void row(std::uint32_t)
+		{
+			left = above;
+		}
+
+		template <bool kAlongZ>
+		int closest(ray& r, std::uint32_t i)
+		{
+			static_assert(kAlongZ, "the BVH is traversed with ortho rays");
+
+			int idx = hint ? seed_hint<kAlongZ>(spheres, left, r) : -1;
+
+			std::int32_t sp = 0;
+			std::int32_t node = 0;
+
+			for (;;)
+			{
+				bvh_node const& n = nodes[node];
+				RT_COUNT_VISIT();
+
+				// The ray runs along +Z: inside the box footprint and overlapping [0, maxt] in depth.
+				// Equal depth is kept, a tie can still change the winning index.
+				bool visit = r.ox >= n.bmin[0] && r.ox <= n.bmax[0] && r.oy >= n.bmin[1] && r.oy <= n.bmax[1] &&
+				             n.bmin[2] - r.oz <= r.maxt && n.bmax[2] - r.oz >= 0.f;
+
+				if (visit && n.count == 0)
+				{
+					// Descend into the child nearer along +Z first, it is likely to shrink maxt
+					auto first = node + 1;
+					auto second = n.offset;
+
+					if (nodes[second].bmin[2] < nodes[first].bmin[2])
+						std::swap(first, second);
+
+					stack[sp++] = second;
+					node = first;
+					continue;
+				}
+
+				if (visit)
+				{
+					for (auto l = 0; l < n.count; ++l)
+					{
+						auto k = indices[n.offset + l];
+						if (intersect_sphere_ordered<kAlongZ>(spheres, k, idx, r))
+						{
+							idx = static_cast<int>(k);
+						}
+					}
+				}
+
+				if (sp == 0)
+					break;
+
+				node = stack[--sp];
+			}
+
+			if (i == x0)
+				above = idx;
+
+			left = idx;
+			return idx;
+		}
+
+		sphere_soa const& spheres;
+		bvh_node const* nodes;
+		std::uint32_t const* indices;
+		bool hint;
+		std::uint32_t x0;
+		int above = -1;
+		int left = -1;
+		std::int32_t stack[kBvhMaxDepth];
+	};
+
+	// Child of a wide BVH node waiting on the traversal stack: a wide node (count 0) or a leaf,
+	// with the depth its box starts at relative to the ray origin
+	struct wide_entry
+	{
+		std::int32_t child;
+		std::int32_t count;
+		float near;
+	};
+
+	// Test the count spheres of a leaf from indices[first] against r, idx is the current hit
+	inline int wide_leaf_closest(sphere_soa const& spheres, std::uint32_t const* indices, std::int32_t first, std::int32_t count, ray& r, int idx)
+	{
+		for (auto l = 0; l < count; ++l)
+		{
+			auto k = indices[first + l];
+			if (intersect_sphere_ordered<true>(spheres, k, idx, r))
+			{
+				idx = static_cast<int>(k);
+			}
+		}
+
+		return idx;
+	}
+
+	// Push the children of node whose bit is set in mask onto stack, the nearest last so it is
+	// popped first
+	template <std::uint32_t N>
+	inline void push_wide_children(wide_bvh_node<N> const& node, unsigned mask, float const* near, wide_entry* stack, std::int32_t& sp)
+	{
+		wide_entry hits[N];
+		std::uint32_t num_hits = 0;
+
+		for (auto c = 0U; c < N; ++c)
+		{
+			if (!(mask & (1U << c)))
+				continue;
+
+			// insertion sort by descending near
+			wide_entry entry{ node.child[c], node.count[c], near[c] };
+			auto at = num_hits++;
+
+			for (; at > 0 && hits[at - 1].near < entry.near; --at)
+				hits[at] = hits[at - 1];
+
+			hits[at] = entry;
+		}
+
+		for (auto h = 0U; h < num_hits; ++h)
+			stack[sp++] = hits[h];
+	}
+
+	// Closest sphere of the ortho ray r through the 4 wide nodes, starting from the hit idx. Each
+	// node tests r against the boxes of its children with one SSE compare per bound, the test
+	// of bvh_traversal in the same float operations, and the children hit are visited front to
+	// back. A popped child that starts beyond the current maxt is skipped.
+	RT_TARGET("sse4.1")
+	int bvh4_closest(sphere_soa const& spheres, bvh4_node const* nodes, std::uint32_t const* indices, ray& r, int idx)
+	{
+		wide_entry stack[kBvhMaxDepth * 4];
+		std::int32_t sp = 0;
+		stack[sp++] = wide_entry{ 0, 0, -std::numeric_limits<float>::infinity() };
+
+		__m128 const ox = _mm_set1_ps(r.ox);
+		__m128 const oy = _mm_set1_ps(r.oy);
+		__m128 const oz = _mm_set1_ps(r.oz);
+		__m128 const zero = _mm_setzero_ps();
+
+		while (sp > 0)
+		{
+			auto entry = stack[--sp];
+
+			if (entry.near > r.maxt)
+				continue;
+
+			if (entry.count != 0)
+			{
+				idx = wide_leaf_closest(spheres, indices, entry.child, entry.count, r, idx);
+				continue;
+			}
+
+			auto const& n = nodes[entry.child];
+			RT_COUNT_VISIT();
+
+			__m128 near = _mm_sub_ps(_mm_loadu_ps(n.bmin[2]), oz);
+			__m128 far = _mm_sub_ps(_mm_loadu_ps(n.bmax[2]), oz);
+
+			__m128 visit = _mm_and_ps(_mm_cmpge_ps(ox, _mm_loadu_ps(n.bmin[0])), _mm_cmple_ps(ox, _mm_loadu_ps(n.bmax[0])));
+			visit = _mm_and_ps(visit, _mm_and_ps(_mm_cmpge_ps(oy, _mm_loadu_ps(n.bmin[1])), _mm_cmple_ps(oy, _mm_loadu_ps(n.bmax[1]))));
+			visit = _mm_and_ps(visit, _mm_and_ps(_mm_cmple_ps(near, _mm_set1_ps(r.maxt)), _mm_cmpge_ps(far, zero)));
+
+			auto mask = static_cast<unsigned>(_mm_movemask_ps(visit));
+
+			if (mask == 0)
+				continue;
+
+			float nears[4];
+			_mm_storeu_ps(nears, near);
+			push_wide_children(n, mask, nears, stack, sp);
+		}
+
+		return idx;
+	}
+
+	// bvh4_closest() through the 8 wide nodes with AVX2
+	RT_TARGET("avx2")
+	int bvh8_closest(sphere_soa const& spheres, bvh8_node const* nodes, std::uint32_t const* indices, ray& r, int idx)
+	{
+		wide_entry stack[kBvhMaxDepth * 8];
+		std::int32_t sp = 0;
+		stack[sp++] = wide_entry{ 0, 0, -std::numeric_limits<float>::infinity() };
+
+		__m256 const ox = _mm256_set1_ps(r.ox);
+		__m256 const oy = _mm256_set1_ps(r.oy);
+		__m256 const oz = _mm256_set1_ps(r.oz);
+		__m256 const zero = _mm256_setzero_ps();
+
+		while (sp > 0)
+		{
+			auto entry = stack[--sp];
+
+			if (entry.near > r.maxt)
+				continue;
+
+			if (entry.count != 0)
+			{
+				idx = wide_leaf_closest(spheres, indices, entry.child, entry.count, r, idx);
+				continue;
+			}
+
+			auto const& n = nodes[entry.child];
+			RT_COUNT_VISIT();
+
+			__m256 near = _mm256_sub_ps(_mm256_loadu_ps(n.bmin[2]), oz);
+			__m256 far = _mm256_sub_ps(_mm256_loadu_ps(n.bmax[2]), oz);
+
+			__m256 visit = _mm256_and_ps(_mm256_cmp_ps(ox, _mm256_loadu_ps(n.bmin[0]), _CMP_GE_OQ), _mm256_cmp_ps(ox, _mm256_loadu_ps(n.bmax[0]), _CMP_LE_OQ));
+			visit = _mm256_and_ps(visit, _mm256_and_ps(_mm256_cmp_ps(oy, _mm256_loadu_ps(n.bmin[1]), _CMP_GE_OQ),
+				_mm256_cmp_ps(oy, _mm256_loadu_ps(n.bmax[1]), _CMP_LE_OQ)));
+			visit = _mm256_and_ps(visit, _mm256_and_ps(_mm256_cmp_ps(near, _mm256_set1_ps(r.maxt), _CMP_LE_OQ), _mm256_cmp_ps(far, zero, _CMP_GE_OQ)));
+
+			auto mask = static_cast<unsigned>(_mm256_movemask_ps(visit));
+
+			if (mask == 0)
+				continue;
+
+			float nears[8];
+			_mm256_storeu_ps(nears, near);
+			push_wide_children(n, mask, nears, stack, sp);
+		}
+
+		return idx;
+	}
+
+	template <std::uint32_t N>
+	std::vector<wide_bvh_node<N>> const& wide_nodes(render_scene const& scene);
+
+	template <>
+	std::vector<bvh4_node> const& wide_nodes<4>(render_scene const& scene)
+	{
+		return scene.accel4;
+	}
+
+	template <>
+	std::vector<bvh8_node> const& wide_nodes<8>(render_scene const& scene)
+	{
+		return scene.accel8;
+	}
+
+	inline int wide_closest(sphere_soa const& spheres, bvh4_node const* nodes, std::uint32_t const* indices, ray& r, int idx)
+	{
+		return bvh4_closest(spheres, nodes, indices, r, idx);
+	}
+
+	inline int wide_closest(sphere_soa const& spheres, bvh8_node const* nodes, std::uint32_t const* indices, ray& r, int idx)
+	{
+		return bvh8_closest(spheres, nodes, indices, r, idx);
+	}
+
+	// bvh_traversal through the N wide nodes of the scene with the SIMD box test of the ISA, the
+	// same image; the neighbour hint seeds the rays as there
+	template <std::uint32_t N>
+	struct wide_bvh_traversal
+	{
+		template <class Camera>
+		wide_bvh_traversal(render_scene const& scene, Camera const&, tile const& t)
+			: spheres(scene.spheres), nodes(wide_nodes<N>(scene).data()), indices(scene.accel.indices.data()), hint(scene.neighbour_hint), x0(t.x0)
+		{
+		}
+
+		void row(std::uint32_t)
+		{
+			left = above;
+		}
+
+		template <bool kAlongZ>
+		int closest(ray& r, std::uint32_t i)
+		{
+			static_assert(kAlongZ, "the BVH is traversed with ortho rays");
+
+			int idx = hint ? seed_hint<kAlongZ>(spheres, left, r) : -1;
+			idx = wide_closest(spheres, nodes, indices, r, idx);
+
+			if (i == x0)
+				above = idx;
+
+			left = idx;
+			return idx;
+		}
+
+		sphere_soa const& spheres;
+		wide_bvh_node<N> const* nodes;
+		std::uint32_t const* indices;
+		bool hint;
+		std::uint32_t x0;
+		int above = -1;
+		int left = -1;
+	};
+
+	// The spheres front to back, a ray stops at the first sphere whose near bound lies beyond
+	// its current hit. Gives the image of all_spheres when order.exact is set, the neighbour
+	// hint seeds the rays as in bvh_traversal.
+	struct depth_sorted
+	{
+		template <class Camera>
+		depth_sorted(render_scene const& scene, Camera const&, tile const& t)
+			: spheres(scene.spheres), order(scene.order), hint(scene.neighbour_hint), x0(t.x0)
+		{
+		}
+
+		void row(std::uint32_t)
+		{
+			left = above;
+		}
+
+		template <bool kAlongZ>
+		int closest(ray& r, std::uint32_t i)
+		{
+			static_assert(kAlongZ, "the depth order is along +Z");
+
+			std::uint32_t const* indices = order.indices.data();
+			float const* zmin = order.zmin.data();
+			auto const count = order.indices.size();
+
+			int idx = hint ? seed_hint<kAlongZ>(spheres, left, r) : -1;
+
+			for (std::size_t l = 0; l < count; ++l)
+			{
+				// Equal depth is kept, a tie can still change the winning index
+				if (zmin[l] - r.oz > r.maxt)
+					break;
+
+				auto k = indices[l];
+				if (intersect_sphere_ordered<kAlongZ>(spheres, k, idx, r))
+				{
+					idx = static_cast<int>(k);
+				}
+			}
+
+			if (i == x0)
+				above = idx;
+
+			left = idx;
+			return idx;
+		}
+
+		sphere_soa const& spheres;
+		depth_order const& order;
+		bool hint;
+		std::uint32_t x0;
+		int above = -1;
+		int left = -1;
+	};
+
+	// Render the pixels of tile t into the image img of view in the layout Output, tracing the rays
+	// of camera against the spheres accel finds for them. Pixels are visited row by row so that
+	// every row of the tile is written contiguously. Every combination compiles to a loop of its
+	// own: ortho_rays, all_spheres and float3_pixels is the reference trace() with the direction
+	// and the layout folded away. Pixels clear in a coverage mask get the background untraced.
+	template <class Output, class Camera, class Accel>
+	void trace_tile(sphere_soa const& spheres, ortho_view const& view, Camera const& camera, Accel& accel, tile const& t, unsigned char* img,
+	                std::uint32_t const* coverage = nullptr)
+	{
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			unsigned char* pixel = pixel_at<Output>(img, view, t.x0, j);
+			auto row = std::size_t(j) * view.image_width;
+
+			ray r;
+			camera.row(j, r);
+			accel.row(j);
+
+			for (auto i = t.x0; i < t.x1; ++i, pixel += Output::kSize)
+			{
+				if (coverage && !pixel_covered(coverage, row + i))
+				{
+					shade_pixel<Output>(spheres, -1, pixel);
+					continue;
+				}
+
+				camera.pixel(i, j, r);
+				shade_pixel<Output>(spheres, accel.template closest<Camera::kAlongZ>(r, i), pixel);
+			}
+		}
+	}
+
+	// Coverage mask of scene for the tracers, null to trace every pixel
+	inline std::uint32_t const* scene_coverage(render_scene const& scene)
+	{
+		return scene.coverage.empty() ? nullptr : scene.coverage.data();
+	}
+
+	// trace_tile() with the camera and the structure of scene
+	template <class Camera, class Accel, class Output>
+	void trace_scene_tile(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		Camera camera(scene);
+		Accel accel(scene, camera, t);
+
+		trace_tile<Output>(scene.spheres, scene.view, camera, accel, t, img, scene_coverage(scene));
+	}
+
+	// Closest sphere of pixel (i, j) among the spheres of its grid cell, -1 for the background
+	int closest_in_cell(sphere_soa const& spheres, ortho_view const& view, sphere_grid const& grid, std::uint32_t i, std::uint32_t j)
+	{
+		auto const cell = (j / grid.cell_size) * grid.cells_x + i / grid.cell_size;
+
+		ray r;
+		r.ox = view.left + (view.width / view.image_width) * (i + 0.5f);
+		r.oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+		r.oz = view.near;
+		r.maxt = view.far - view.near;
+
+		int idx = -1;
+
+		for (auto l = grid.cell_start[cell]; l < grid.cell_start[cell + 1]; ++l)
+		{
+			auto k = grid.indices[l];
+			if (intersect_sphere<true>(spheres, k, r))
+			{
+				idx = static_cast<int>(k);
+			}
+		}
+
+		return idx;
+	}
+
+	// Render the pixels of tile t into the image img from the closest spheres of the block corners,
+	// for a grid of kAdaptiveBlock cells. Blocks whose corners hit no sphere and whose cell lists
+	// no sphere are background. Blocks whose corners all hit sphere s and whose cell lists only s
+	// are s: ox - cx and oy - cy are monotonic in the pixel, and every later operation of the hit
+	// test in sphere_roots() and intersect_sphere() is monotonic in their magnitudes, so a pixel
+	// between the corners passes the test of s if the corner furthest from the center in x and in
+	// y does, in floats as well as exactly. Any other block is traced through grid_cells. The
+	// image is the one of all_spheres.
+	template <class Output>
+	void trace_tile_adaptive(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+		auto const& grid = scene.grid;
+
+		std::uint32_t const kMaxSamples = kTileSize / kAdaptiveBlock + 2;
+
+		// Corner samples of the blocks of t, the parts of its cells: blocks are [xs[a], xs[a + 1]) x
+		// [ys[b], ys[b + 1]), the last corner is the pixel after t, or the last pixel of the image
+		std::uint32_t xs[kMaxSamples], ys[kMaxSamples];
+		int ids[kMaxSamples * kMaxSamples];
+
+		std::uint32_t nx = 0, ny = 0;
+
+		for (auto x = t.x0; x < t.x1; x = (x / kAdaptiveBlock + 1) * kAdaptiveBlock)
+			xs[nx++] = x;
+
+		for (auto y = t.y0; y < t.y1; y = (y / kAdaptiveBlock + 1) * kAdaptiveBlock)
+			ys[ny++] = y;
+
+		xs[nx] = std::min(t.x1, view.image_width - 1);
+		ys[ny] = std::min(t.y1, view.image_height - 1);
+
+		for (auto b = 0U; b <= ny; ++b)
+		{
+			for (auto a = 0U; a <= nx; ++a)
+			{
+				ids[b * kMaxSamples + a] = closest_in_cell(spheres, view, grid, xs[a], ys[b]);
+			}
+		}
+
+		for (auto b = 0U; b < ny; ++b)
+		{
+			for (auto a = 0U; a < nx; ++a)
+			{
+				tile block{ xs[a], ys[b], a + 1 < nx ? xs[a + 1] : t.x1, b + 1 < ny ? ys[b + 1] : t.y1 };
+
+				int s = ids[b * kMaxSamples + a];
+				auto const cell = (block.y0 / grid.cell_size) * grid.cells_x + block.x0 / grid.cell_size;
+				auto const count = grid.cell_start[cell + 1] - grid.cell_start[cell];
+
+				bool uniform = s == ids[b * kMaxSamples + a + 1] && s == ids[(b + 1) * kMaxSamples + a] && s == ids[(b + 1) * kMaxSamples + a + 1] &&
+				               (s < 0 ? count == 0 : count == 1 && grid.indices[grid.cell_start[cell]] == static_cast<std::uint32_t>(s));
+
+				if (!uniform)
+				{
+					trace_scene_tile<ortho_rays, grid_cells, Output>(scene, block, img);
+					continue;
+				}
+
+				unsigned char color[Output::kSize];
+				shade_pixel<Output>(spheres, s, color);
+
+				for (auto j = block.y0; j < block.y1; ++j)
+				{
+					unsigned char* pixel = pixel_at<Output>(img, view, block.x0, j);
+
+					for (auto i = block.x0; i < block.x1; ++i, pixel += Output::kSize)
+					{
+						std::copy(color, color + Output::kSize, pixel);
+					}
+				}
+			}
+		}
+	}
+
+	// Render the pixels of tile t into the image img by splatting spheres instead of tracing pixels.
+	// The tile owns a depth and closest index buffer of its own, so the workers splat their tiles
+	// without atomics. Each cell of scene.grid the tile overlaps splats the spheres binned into it
+	// in index order, each updating the pixels of its footprint in the cell, so every pixel sees
+	// the spheres that may cover it in the order of all_spheres and ties go to the same index.
+	template <class Output>
+	void splat_tile(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+		auto const& footprints = scene.footprints;
+		auto const& grid = scene.grid;
+
+		auto const w = static_cast<std::int32_t>(t.x1 - t.x0);
+		auto const h = static_cast<std::int32_t>(t.y1 - t.y0);
+		auto const tx0 = static_cast<std::int32_t>(t.x0);
+		auto const ty0 = static_cast<std::int32_t>(t.y0);
+		auto const cell_size = static_cast<std::int32_t>(grid.cell_size);
+
+		// Per pixel intersection distance and closest sphere of the tile
+		float maxt[kTileSize * kTileSize];
+		int idx[kTileSize * kTileSize];
+
+		std::fill(maxt, maxt + w * h, view.far - view.near);
+		std::fill(idx, idx + w * h, -1);
+
+		ray r;
+
+		for (auto cy = ty0 / cell_size; cy * cell_size < ty0 + h; ++cy)
+		{
+			for (auto cx = tx0 / cell_size; cx * cell_size < tx0 + w; ++cx)
+			{
+				auto cell = static_cast<std::uint32_t>(cy) * grid.cells_x + static_cast<std::uint32_t>(cx);
+
+				// the pixels of the tile in the cell
+				auto cell_x0 = std::max(cx * cell_size, tx0);
+				auto cell_x1 = std::min((cx + 1) * cell_size, tx0 + w);
+				auto cell_y0 = std::max(cy * cell_size, ty0);
+				auto cell_y1 = std::min((cy + 1) * cell_size, ty0 + h);
+
+				for (auto l = grid.cell_start[cell]; l < grid.cell_start[cell + 1]; ++l)
+				{
+					auto k = grid.indices[l];
+					auto const& rect = footprints[k];
+
+					auto x0 = std::max(rect.x0, cell_x0);
+					auto x1 = std::min(rect.x1, cell_x1);
+					auto y0 = std::max(rect.y0, cell_y0);
+					auto y1 = std::min(rect.y1, cell_y1);
+
+					for (auto j = y0; j < y1; ++j)
+					{
+						r.oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+
+						auto p = (j - ty0) * w + (x0 - tx0);
+
+						for (auto i = x0; i < x1; ++i, ++p)
+						{
+							r.oz = view.near;
+							r.ox = view.left + (view.width / view.image_width) * (i + 0.5f);
+							r.maxt = maxt[p];
+
+							if (intersect_sphere<true>(spheres, k, r))
+							{
+								maxt[p] = r.maxt;
+								idx[p] = static_cast<int>(k);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			unsigned char* pixel = pixel_at<Output>(img, view, t.x0, j);
+			int const* hit = idx + (static_cast<std::int32_t>(j) - ty0) * w;
+
+			for (auto i = 0; i < w; ++i, pixel += Output::kSize)
+			{
+				shade_pixel<Output>(spheres, hit[i], pixel);
+			}
+		}
+	}
+
+	// Write the colors of count horizontally adjacent pixels given their closest sphere indices
+	template <class Output>
+	inline void write_packet_colors(sphere_soa const& spheres, int const* hits, std::uint32_t count, unsigned char* pixel)
+	{
+		for (auto l = 0U; l < count; ++l, pixel += Output::kSize)
+		{
+			shade_pixel<Output>(spheres, hits[l], pixel);
+		}
+	}
+
+	// Write the background to the count pixels of a packet from pixel p if a coverage mask
+	// clears them all, so the packet needs no tracing
+	template <class Output>
+	inline bool skip_uncovered_packet(sphere_soa const& spheres, std::uint32_t const* coverage, std::size_t p, std::uint32_t count, unsigned char* pixel)
+	{
+		if (!coverage)
+			return false;
+
+		for (auto l = 0U; l < count; ++l)
+		{
+			if (pixel_covered(coverage, p + l))
+				return false;
+		}
+
+		for (auto l = 0U; l < count; ++l, pixel += Output::kSize)
+		{
+			shade_pixel<Output>(spheres, -1, pixel);
+		}
+
+		return true;
+	}
+
+	// Test of the half_spheres of a scene against a packet of rays of one row, for the brute
+	// force packet tracers: a sphere is skipped if the box around its disc misses the row oy or
+	// the columns from ox_lo to ox_hi, or it starts beyond the largest maxt of the packet. Only
+	// the 8 bytes of the half are read for a skipped sphere. The fp16 values are converted with
+	// F16C, which every AVX2 processor has.
+	struct half_filter
+	{
+		half_sphere const* halves;
+		// Lanes x, y, z of the test: a half is skipped if its x - r, y - r, zmin - near lie above
+		// high or its x + r, y + r below low
+		__m128 near, low, high;
+
+		RT_TARGET("avx,f16c")
+		half_filter(render_scene const& scene)
+			: halves(scene.halves.empty() ? nullptr : scene.halves.data())
+			, near(_mm_setr_ps(0.f, 0.f, scene.view.near, 0.f))
+		{
+		}
+
+		RT_TARGET("avx,f16c")
+		void packet(float ox_lo, float ox_hi, float oy, float maxt)
+		{
+			low = _mm_setr_ps(ox_lo, oy, -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+			high = _mm_setr_ps(ox_hi, oy, maxt, std::numeric_limits<float>::infinity());
+		}
+
+		RT_TARGET("avx,f16c")
+		void set_maxt(float maxt)
+		{
+			high = _mm_insert_ps(high, _mm_set_ss(maxt), 0x20);
+		}
+
+		RT_TARGET("avx,f16c")
+		bool skip(std::uint32_t k) const
+		{
+			__m128 h = _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(&halves[k])));
+			__m128 r = _mm_permute_ps(h, _MM_SHUFFLE(3, 3, 3, 3));
+
+			__m128 from = _mm_sub_ps(h, _mm_blend_ps(r, near, 0x4));
+			__m128 to = _mm_add_ps(h, r);
+
+			return _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(from, high), _mm_cmplt_ps(to, low))) != 0;
+		}
+	};
+
+	// Packet versions of the ortho all_spheres tracer: each iteration traces kWidth horizontally adjacent pixels
+	// against one sphere at a time. The camera rays all point along +Z, so for every sphere
+	// half of b is near - cz and the per-ray work reduces to c and the roots; the arithmetic
+	// is the same sequence of IEEE operations as the half-b path of sphere_roots(), so the hits
+	// and the image are bit-identical to the scalar path. Closest hits are kept with masked blends.
+	// Columns that don't fill a whole packet are traced by the scalar tracer. The AVX2 and
+	// AVX-512 tracers first skip the spheres the half_filter of the scene rules out.
+	template <class Output>
+	RT_TARGET("sse4.1")
+	void trace_tile_sse4(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+
+		std::uint32_t const kWidth = 4;
+		auto packet_x1 = t.x0 + (t.x1 - t.x0) / kWidth * kWidth;
+
+		float const* cx = spheres.cx.data();
+		float const* cy = spheres.cy.data();
+		float const* cz = spheres.cz.data();
+		float const* radius2 = spheres.radius2.data();
+		auto num_spheres = spheres.size();
+		auto const* coverage = scene_coverage(scene);
+
+		__m128 const lane = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			float oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+
+			for (auto i = t.x0; i < packet_x1; i += kWidth)
+			{
+				if (skip_uncovered_packet<Output>(spheres, coverage, std::size_t(j) * view.image_width + i, kWidth, pixel_at<Output>(img, view, i, j)))
+					continue;
+
+				__m128 ox = _mm_add_ps(_mm_set1_ps(view.left), _mm_mul_ps(_mm_set1_ps(view.width / view.image_width),
+					_mm_add_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lane), _mm_set1_ps(0.5f))));
+				__m128 maxt = _mm_set1_ps(view.far - view.near);
+				__m128i idx = _mm_set1_epi32(-1);
+
+				for (auto k = 0U; k < num_spheres; ++k)
+				{
+					float soy = oy - cy[k];
+					float soz = view.near - cz[k];
+					__m128 sox = _mm_sub_ps(ox, _mm_set1_ps(cx[k]));
+					__m128 c = _mm_add_ps(_mm_mul_ps(sox, sox), _mm_set1_ps(soy * soy));
+					c = _mm_add_ps(c, _mm_set1_ps(soz * soz));
+					c = _mm_sub_ps(c, _mm_set1_ps(radius2[k]));
+
+					__m128 d = _mm_sub_ps(_mm_set1_ps(soz * soz), c);
+					__m128 sqrt_d = _mm_sqrt_ps(d);
+					__m128 t0 = _mm_sub_ps(_mm_set1_ps(-soz), sqrt_d);
+					__m128 t1 = _mm_add_ps(_mm_set1_ps(-soz), sqrt_d);
+
+					__m128 hit = _mm_and_ps(_mm_cmpge_ps(d, _mm_setzero_ps()),
+						_mm_and_ps(_mm_cmple_ps(t0, maxt), _mm_cmpge_ps(t1, _mm_setzero_ps())));
+
+					if (_mm_movemask_ps(hit) == 0)
+						continue;
+
+					__m128 t = _mm_blendv_ps(t1, t0, _mm_cmpgt_ps(t0, _mm_setzero_ps()));
+					maxt = _mm_blendv_ps(maxt, t, hit);
+					idx = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(idx), _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(k))), hit));
+				}
+
+				alignas(16) int hits[kWidth];
+				_mm_store_si128(reinterpret_cast<__m128i*>(hits), idx);
+				write_packet_colors<Output>(spheres, hits, kWidth, pixel_at<Output>(img, view, i, j));
+			}
+		}
+
+		if (packet_x1 < t.x1)
+			trace_scene_tile<ortho_rays, all_spheres, Output>(scene, tile{ packet_x1, t.y0, t.x1, t.y1 }, img);
+	}
+
+	template <class Output>
+	RT_TARGET("avx2,f16c")
+	void trace_tile_avx2(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+
+		std::uint32_t const kWidth = 8;
+		auto packet_x1 = t.x0 + (t.x1 - t.x0) / kWidth * kWidth;
+
+		float const* cx = spheres.cx.data();
+		float const* cy = spheres.cy.data();
+		float const* cz = spheres.cz.data();
+		float const* radius2 = spheres.radius2.data();
+		auto num_spheres = spheres.size();
+		auto const* coverage = scene_coverage(scene);
+
+		half_filter halves(scene);
+
+		__m256 const lane = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			float oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+
+			for (auto i = t.x0; i < packet_x1; i += kWidth)
+			{
+				if (skip_uncovered_packet<Output>(spheres, coverage, std::size_t(j) * view.image_width + i, kWidth, pixel_at<Output>(img, view, i, j)))
+					continue;
+
+				__m256 ox = _mm256_add_ps(_mm256_set1_ps(view.left), _mm256_mul_ps(_mm256_set1_ps(view.width / view.image_width),
+					_mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lane), _mm256_set1_ps(0.5f))));
+				__m256 maxt = _mm256_set1_ps(view.far - view.near);
+				__m256i idx = _mm256_set1_epi32(-1);
+
+				halves.packet(_mm256_cvtss_f32(ox), _mm_cvtss_f32(_mm_permute_ps(_mm256_extractf128_ps(ox, 1), _MM_SHUFFLE(3, 3, 3, 3))), oy, view.far - view.near);
+
+				for (auto k = 0U; k < num_spheres; ++k)
+				{
+					if (halves.halves && halves.skip(k))
+						continue;
+
+					float soy = oy - cy[k];
+					float soz = view.near - cz[k];
+					__m256 sox = _mm256_sub_ps(ox, _mm256_set1_ps(cx[k]));
+					__m256 c = _mm256_add_ps(_mm256_mul_ps(sox, sox), _mm256_set1_ps(soy * soy));
+					c = _mm256_add_ps(c, _mm256_set1_ps(soz * soz));
+					c = _mm256_sub_ps(c, _mm256_set1_ps(radius2[k]));
+
+					__m256 d = _mm256_sub_ps(_mm256_set1_ps(soz * soz), c);
+					__m256 sqrt_d = _mm256_sqrt_ps(d);
+					__m256 t0 = _mm256_sub_ps(_mm256_set1_ps(-soz), sqrt_d);
+					__m256 t1 = _mm256_add_ps(_mm256_set1_ps(-soz), sqrt_d);
+
+					__m256 hit = _mm256_and_ps(_mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ),
+						_mm256_and_ps(_mm256_cmp_ps(t0, maxt, _CMP_LE_OQ), _mm256_cmp_ps(t1, _mm256_setzero_ps(), _CMP_GE_OQ)));
+
+					if (_mm256_movemask_ps(hit) == 0)
+						continue;
+
+					__m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, _mm256_setzero_ps(), _CMP_GT_OQ));
+					maxt = _mm256_blendv_ps(maxt, t, hit);
+					idx = _mm256_blendv_epi8(idx, _mm256_set1_epi32(static_cast<int>(k)), _mm256_castps_si256(hit));
+
+					if (halves.halves)
+					{
+						__m128 widest = _mm_max_ps(_mm256_castps256_ps128(maxt), _mm256_extractf128_ps(maxt, 1));
+						widest = _mm_max_ps(widest, _mm_movehl_ps(widest, widest));
+						halves.set_maxt(_mm_cvtss_f32(_mm_max_ss(widest, _mm_movehdup_ps(widest))));
+					}
+				}
+
+				alignas(32) int hits[kWidth];
+				_mm256_store_si256(reinterpret_cast<__m256i*>(hits), idx);
+				write_packet_colors<Output>(spheres, hits, kWidth, pixel_at<Output>(img, view, i, j));
+			}
+		}
+
+		if (packet_x1 < t.x1)
+			trace_scene_tile<ortho_rays, all_spheres, Output>(scene, tile{ packet_x1, t.y0, t.x1, t.y1 }, img);
+	}
+
+	template <class Output>
+	RT_TARGET("avx512f,f16c")
+	void trace_tile_avx512(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+
+		std::uint32_t const kWidth = 16;
+		auto packet_x1 = t.x0 + (t.x1 - t.x0) / kWidth * kWidth;
+
+		float const* cx = spheres.cx.data();
+		float const* cy = spheres.cy.data();
+		float const* cz = spheres.cz.data();
+		float const* radius2 = spheres.radius2.data();
+		auto num_spheres = spheres.size();
+		auto const* coverage = scene_coverage(scene);
+
+		half_filter halves(scene);
+
+		__m512 const lane = _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			float oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+
+			for (auto i = t.x0; i < packet_x1; i += kWidth)
+			{
+				if (skip_uncovered_packet<Output>(spheres, coverage, std::size_t(j) * view.image_width + i, kWidth, pixel_at<Output>(img, view, i, j)))
+					continue;
+
+				__m512 ox = _mm512_add_ps(_mm512_set1_ps(view.left), _mm512_mul_ps(_mm512_set1_ps(view.width / view.image_width),
+					_mm512_add_ps(_mm512_add_ps(_mm512_set1_ps(static_cast<float>(i)), lane), _mm512_set1_ps(0.5f))));
+				__m512 maxt = _mm512_set1_ps(view.far - view.near);
+				__m512i idx = _mm512_set1_epi32(-1);
+
+				halves.packet(_mm512_cvtss_f32(ox), _mm_cvtss_f32(_mm_permute_ps(_mm512_extractf32x4_ps(ox, 3), _MM_SHUFFLE(3, 3, 3, 3))), oy, view.far - view.near);
+
+				for (auto k = 0U; k < num_spheres; ++k)
+				{
+					if (halves.halves && halves.skip(k))
+						continue;
+
+					float soy = oy - cy[k];
+					float soz = view.near - cz[k];
+					__m512 sox = _mm512_sub_ps(ox, _mm512_set1_ps(cx[k]));
+					__m512 c = _mm512_add_ps(_mm512_mul_ps(sox, sox), _mm512_set1_ps(soy * soy));
+					c = _mm512_add_ps(c, _mm512_set1_ps(soz * soz));
+					c = _mm512_sub_ps(c, _mm512_set1_ps(radius2[k]));
+
+					__m512 d = _mm512_sub_ps(_mm512_set1_ps(soz * soz), c);
+					__m512 sqrt_d = _mm512_sqrt_ps(d);
+					__m512 t0 = _mm512_sub_ps(_mm512_set1_ps(-soz), sqrt_d);
+					__m512 t1 = _mm512_add_ps(_mm512_set1_ps(-soz), sqrt_d);
+
+					__mmask16 hit = _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_GE_OQ)
+						& _mm512_cmp_ps_mask(t0, maxt, _CMP_LE_OQ)
+						& _mm512_cmp_ps_mask(t1, _mm512_setzero_ps(), _CMP_GE_OQ);
+
+					if (hit == 0)
+						continue;
+
+					__m512 t = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, _mm512_setzero_ps(), _CMP_GT_OQ), t1, t0);
+					maxt = _mm512_mask_blend_ps(hit, maxt, t);
+					idx = _mm512_mask_blend_epi32(hit, idx, _mm512_set1_epi32(static_cast<int>(k)));
+
+					if (halves.halves)
+						halves.set_maxt(_mm512_reduce_max_ps(maxt));
+				}
+
+				alignas(64) int hits[kWidth];
+				_mm512_store_si512(hits, idx);
+				write_packet_colors<Output>(spheres, hits, kWidth, pixel_at<Output>(img, view, i, j));
+			}
+		}
+
+		if (packet_x1 < t.x1)
+			trace_scene_tile<ortho_rays, all_spheres, Output>(scene, tile{ packet_x1, t.y0, t.x1, t.y1 }, img);
+	}
+
+	// Render the pixels of tile t into the image img through the BVH lookup Traversal and the
+	// tiny spheres of scene, see render_scene::splat_tiny. The rays are traced through the BVH
+	// first, then the tiny spheres of the cells the tile overlaps are splatted: each tests the
+	// pixel centers of its footprint in the tile whose hit lies beyond its near bound, with the
+	// hit test of the BVH leaves. The BVH is exact and the tiny spheres lie beyond the near
+	// plane, so the closest hit over both sets with ties to the higher index is the one of
+	// all_spheres.
+	template <class Traversal, class Output>
+	void trace_tile_tiny(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+		auto const& grid = scene.tiny;
+		auto const* coverage = scene_coverage(scene);
+
+		auto const w = t.x1 - t.x0;
+
+		// Per pixel intersection distance and closest sphere of the tile
+		float maxt[kTileSize * kTileSize];
+		int idx[kTileSize * kTileSize];
+
+		ortho_rays camera(scene);
+		Traversal traversal(scene, camera, t);
+		ray r;
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			auto row = std::size_t(j) * view.image_width;
+			auto p = (j - t.y0) * w;
+
+			camera.row(j, r);
+			traversal.row(j);
+
+			for (auto i = t.x0; i < t.x1; ++i, ++p)
+			{
+				camera.pixel(i, j, r);
+
+				idx[p] = coverage && !pixel_covered(coverage, row + i) ? -1 : traversal.template closest<true>(r, i);
+				maxt[p] = r.maxt;
+			}
+		}
+
+		for (auto cy = t.y0 / grid.cell_size; cy <= (t.y1 - 1) / grid.cell_size; ++cy)
+		{
+			for (auto cx = t.x0 / grid.cell_size; cx <= (t.x1 - 1) / grid.cell_size; ++cx)
+			{
+				auto cell = cy * grid.cells_x + cx;
+
+				// the pixels of the tile in the cell, every pixel lies in exactly one
+				auto cell_x0 = std::max(cx * grid.cell_size, t.x0);
+				auto cell_x1 = std::min((cx + 1) * grid.cell_size, t.x1);
+				auto cell_y0 = std::max(cy * grid.cell_size, t.y0);
+				auto cell_y1 = std::min((cy + 1) * grid.cell_size, t.y1);
+
+				for (auto l = grid.cell_start[cell]; l < grid.cell_start[cell + 1]; ++l)
+				{
+					auto k = grid.indices[l];
+					auto const& tiny = scene.tiny_spheres[l];
+					auto near = tiny.zmin - view.near;
+
+					auto i0 = std::max(static_cast<std::uint32_t>(tiny.footprint.x0), cell_x0);
+					auto i1 = std::min(static_cast<std::uint32_t>(tiny.footprint.x1), cell_x1);
+					auto j0 = std::max(static_cast<std::uint32_t>(tiny.footprint.y0), cell_y0);
+					auto j1 = std::min(static_cast<std::uint32_t>(tiny.footprint.y1), cell_y1);
+
+					for (auto j = j0; j < j1; ++j)
+					{
+						camera.row(j, r);
+
+						for (auto i = i0; i < i1; ++i)
+						{
+							auto p = (j - t.y0) * w + (i - t.x0);
+
+							// the test of a BVH box the sphere fills, a pixel the tile skipped keeps the background
+							if (near > maxt[p] || (coverage && !pixel_covered(coverage, std::size_t(j) * view.image_width + i)))
+								continue;
+
+							camera.pixel(i, j, r);
+							r.maxt = maxt[p];
+
+							if (intersect_sphere_ordered<true>(spheres, k, idx[p], r))
+							{
+								maxt[p] = r.maxt;
+								idx[p] = static_cast<int>(k);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			unsigned char* pixel = pixel_at<Output>(img, view, t.x0, j);
+			int const* hit = idx + (j - t.y0) * w;
+
+			for (auto i = 0U; i < w; ++i, pixel += Output::kSize)
+			{
+				shade_pixel<Output>(spheres, hit[i], pixel);
+			}
+		}
+	}
+
+	// Render the pixels of tile t into the image img through the Embree BVH of scene, each row in
+	// packets of embree_bvh::packet_width() rays; packets the coverage mask clears are background
+	template <class Output>
+	void trace_tile_embree(render_scene const& scene, tile const& t, unsigned char* img)
+	{
+		auto const& spheres = scene.spheres;
+		auto const& view = scene.view;
+		auto const& accel = *scene.embree_accel;
+		auto const* coverage = scene_coverage(scene);
+		auto const width = accel.packet_width();
+
+		int hits[kMaxEmbreePacket];
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			for (auto i = t.x0; i < t.x1; i += width)
+			{
+				auto count = std::min(width, t.x1 - i);
+				auto* pixel = pixel_at<Output>(img, view, i, j);
+
+				if (skip_uncovered_packet<Output>(spheres, coverage, std::size_t(j) * view.image_width + i, count, pixel))
+					continue;
+
+				accel.closest(spheres, view, i, j, count, hits);
+				write_packet_colors<Output>(spheres, hits, count, pixel);
+			}
+		}
+	}
+
+	typedef void (*tile_tracer)(render_scene const& scene, tile const& t, unsigned char* img);
+
+	// Tile tracer of the BVH of scene for isa: Embree's if prepare_scene built it, the 8 wide
+	// nodes for AVX2 and up, the 4 wide ones for SSE4, the binary nodes otherwise or if the scene
+	// has no wide ones; after the splats of the tiny spheres if prepare_scene split some off
+	template <class Output>
+	tile_tracer select_bvh_tracer(render_scene const& scene, simd_isa isa)
+	{
+		if (scene.embree_accel)
+			return trace_tile_embree<Output>;
+
+		if (!scene.tiny.indices.empty())
+		{
+			if ((isa == simd_isa::avx2 || isa == simd_isa::avx512) && !scene.accel8.empty())
+				return trace_tile_tiny<wide_bvh_traversal<8>, Output>;
+
+			if (isa != simd_isa::scalar && !scene.accel4.empty())
+				return trace_tile_tiny<wide_bvh_traversal<4>, Output>;
+
+			return trace_tile_tiny<bvh_traversal, Output>;
+		}
+
+		if ((isa == simd_isa::avx2 || isa == simd_isa::avx512) && !scene.accel8.empty())
+			return trace_scene_tile<ortho_rays, wide_bvh_traversal<8>, Output>;
+
+		if (isa != simd_isa::scalar && !scene.accel4.empty())
+			return trace_scene_tile<ortho_rays, wide_bvh_traversal<4>, Output>;
+
+		return trace_scene_tile<ortho_rays, bvh_traversal, Output>;
+	}
+
+	// Tile tracer writing the layout Output for the camera and structure of a scene, the packet
+	// tracer of isa for the ortho camera without structure and the wide BVH of isa for bvh. The
+	// structures are built for ortho rays, pinhole tiles cull the spheres themselves.
+	template <class Output>
+	tile_tracer select_tile_tracer(render_scene const& scene, simd_isa isa)
+	{
+		if (scene.camera == projection::pinhole)
+			return trace_scene_tile<perspective_rays, frustum_culled, Output>;
+
+		switch (scene.mode)
+		{
+		case accel_mode::bvh: return select_bvh_tracer<Output>(scene, isa);
+		case accel_mode::grid: return trace_scene_tile<ortho_rays, grid_cells, Output>;
+		case accel_mode::adaptive: return trace_tile_adaptive<Output>;
+		case accel_mode::splat: return splat_tile<Output>;
+		case accel_mode::sorted: return trace_scene_tile<ortho_rays, depth_sorted, Output>;
+		default: break;
+		}
+
+		switch (isa)
+		{
+		case simd_isa::sse4: return trace_tile_sse4<Output>;
+		case simd_isa::avx2: return trace_tile_avx2<Output>;
+		case simd_isa::avx512: return trace_tile_avx512<Output>;
+		default: return trace_scene_tile<ortho_rays, all_spheres, Output>;
+		}
+	}
+
+	// The tile tracer of scene for format, picked once per image rather than per pixel
+	tile_tracer select_tile_tracer(render_scene const& scene, simd_isa isa, pixel_format format)
+	{
+		switch (format)
+		{
+		case pixel_format::half: return select_tile_tracer<half3_pixels>(scene, isa);
+		case pixel_format::float4: return select_tile_tracer<float4_pixels>(scene, isa);
+		case pixel_format::rgba8: return select_tile_tracer<rgba8_pixels>(scene, isa);
+		case pixel_format::id16: return select_tile_tracer<id_pixels<std::uint16_t>>(scene, isa);
+		case pixel_format::id32: return select_tile_tracer<id_pixels<std::uint32_t>>(scene, isa);
+		default: return select_tile_tracer<float3_pixels>(scene, isa);
+		}
+	}
+
+#ifdef RT_COST_COUNTERS
+	// The closest() calls of trace_tile() for the pixels of tile t, the work of each one
+	// written to its pixel of costs instead of a color
+	template <class Camera, class Accel>
+	void cost_scene_tile(render_scene const& scene, tile const& t, pixel_cost* costs)
+	{
+		Camera camera(scene);
+		Accel accel(scene, camera, t);
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			ray r;
+			camera.row(j, r);
+			accel.row(j);
+
+			for (auto i = t.x0; i < t.x1; ++i)
+			{
+				camera.pixel(i, j, r);
+
+				ray_cost = pixel_cost{ 0, 0 };
+				accel.template closest<Camera::kAlongZ>(r, i);
+				costs[std::size_t(j) * scene.view.image_width + i] = ray_cost;
+			}
+		}
+	}
+
+	typedef void (*cost_tracer)(render_scene const& scene, tile const& t, pixel_cost* costs);
+
+	// The structure select_tile_tracer() traces scene with for isa, scalar without one; null
+	// for the adaptive and splat modes, which don't trace a ray per pixel
+	cost_tracer select_cost_tracer(render_scene const& scene, simd_isa isa)
+	{
+		if (scene.camera == projection::pinhole)
+			return cost_scene_tile<perspective_rays, frustum_culled>;
+
+		switch (scene.mode)
+		{
+		case accel_mode::none: return cost_scene_tile<ortho_rays, all_spheres>;
+		case accel_mode::grid: return cost_scene_tile<ortho_rays, grid_cells>;
+		case accel_mode::sorted: return cost_scene_tile<ortho_rays, depth_sorted>;
+		case accel_mode::bvh: break;
+		default: return nullptr;
+		}
+
+		// Embree traverses without counting
+		if (scene.embree_accel)
+			return nullptr;
+
+		if ((isa == simd_isa::avx2 || isa == simd_isa::avx512) && !scene.accel8.empty())
+			return cost_scene_tile<ortho_rays, wide_bvh_traversal<8>>;
+
+		if (isa != simd_isa::scalar && !scene.accel4.empty())
+			return cost_scene_tile<ortho_rays, wide_bvh_traversal<4>>;
+
+		return cost_scene_tile<ortho_rays, bvh_traversal>;
+	}
+#endif
+}
+
+char const* simd_isa_name(simd_isa isa)
+{
+	switch (isa)
+	{
+	case simd_isa::sse4: return "sse4";
+	case simd_isa::avx2: return "avx2";
+	case simd_isa::avx512: return "avx512";
+	default: return "scalar";
+	}
+}
+
+simd_isa detect_simd_isa()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse4 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	std::uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymm_state = (xcr0 & 0x6) == 0x6;
+	bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+	bool avx2 = false;
+	bool avx512 = false;
+
+	if (max_leaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+
+	if (avx512 && zmm_state)
+		return simd_isa::avx512;
+	if (avx && avx2 && ymm_state)
+		return simd_isa::avx2;
+	if (sse4)
+		return simd_isa::sse4;
+	return simd_isa::scalar;
+#else
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return simd_isa::avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return simd_isa::avx2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return simd_isa::sse4;
+	return simd_isa::scalar;
+#endif
+}
+
+std::vector<tile> make_tiles(ortho_view const& view, std::uint32_t tile_size)
+{
+	std::vector<tile> tiles;
+
+	for (auto y = 0U; y < view.image_height; y += tile_size)
+	{
+		for (auto x = 0U; x < view.image_width; x += tile_size)
+		{
+			tiles.push_back(tile{ x, y, std::min(x + tile_size, view.image_width), std::min(y + tile_size, view.image_height) });
+		}
+	}
+
+	return tiles;
+}
+
+namespace
+{
+	// Position of tile (x, y) on the Z-order curve: the bits of x and y interleaved
+	std::uint64_t morton_index(std::uint32_t x, std::uint32_t y)
+	{
+		std::uint64_t index = 0;
+
+		for (auto bit = 0U; bit < 32; ++bit)
+		{
+			index |= (std::uint64_t(x >> bit & 1) << (2 * bit)) | (std::uint64_t(y >> bit & 1) << (2 * bit + 1));
+		}
+
+		return index;
+	}
+
+	// Position of tile (x, y) on the Hilbert curve over a side x side grid, side a power of two
+	std::uint64_t hilbert_index(std::uint32_t side, std::uint32_t x, std::uint32_t y)
+	{
+		std::uint64_t index = 0;
+
+		for (auto s = side / 2; s > 0; s /= 2)
+		{
+			std::uint32_t rx = (x & s) != 0;
+			std::uint32_t ry = (y & s) != 0;
+			index += std::uint64_t(s) * s * ((3 * rx) ^ ry);
+
+			// rotate the quadrant so the curve through it starts where the last one ended
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = side - 1 - x;
+					y = side - 1 - y;
+				}
+
+				std::swap(x, y);
+			}
+		}
+
+		return index;
+	}
+
+	// Bytes a sphere brings into the cache of a tile testing it: its columns of sphere_soa and
+	// about as much of the structure leading to it
+	std::size_t const kSphereWorkingSet = 64;
+	// Bytes of a pixel of a tile: its rgb float and the closest t and sphere of the tracer
+	std::size_t const kPixelWorkingSet = 20;
+}
+
+std::vector<tile> make_tiles(ortho_view const& view, std::uint32_t tile_size, tile_order order)
+{
+	auto tiles = make_tiles(view, tile_size);
+
+	if (order == tile_order::scanline)
+		return tiles;
+
+	// the curves run over the smallest power of two square holding the grid of tiles
+	auto tiles_x = (view.image_width + tile_size - 1) / tile_size;
+	auto tiles_y = (view.image_height + tile_size - 1) / tile_size;
+	std::uint32_t side = 1;
+
+	while (side < std::max(tiles_x, tiles_y))
+	{
+		side *= 2;
+	}
+
+	std::vector<std::pair<std::uint64_t, tile>> keyed;
+	keyed.reserve(tiles.size());
+
+	for (auto const& t : tiles)
+	{
+		auto x = t.x0 / tile_size;
+		auto y = t.y0 / tile_size;
+		keyed.emplace_back(order == tile_order::morton ? morton_index(x, y) : hilbert_index(side, x, y), t);
+	}
+
+	std::sort(keyed.begin(), keyed.end(), [](std::pair<std::uint64_t, tile> const& a, std::pair<std::uint64_t, tile> const& b) { return a.first < b.first; });
+
+	for (std::size_t i = 0; i < keyed.size(); ++i)
+	{
+		tiles[i] = keyed[i].second;
+	}
+
+	return tiles;
+}
+
+std::uint32_t cache_tile_size(render_scene const& scene, std::size_t l2_bytes)
+{
+	auto const& view = scene.view;
+	auto count = scene.spheres.size();
+
+	if (l2_bytes == 0 || scene.mode == accel_mode::none || scene.camera != projection::ortho || count == 0)
+		return kTileSize;
+
+	// sums over the footprints of the spheres in pixels
+	double scale_x = view.image_width / static_cast<double>(view.width);
+	double scale_y = view.image_height / static_cast<double>(view.height);
+	double sum_w = 0., sum_h = 0., sum_area = 0.;
+
+	for (std::uint32_t k = 0; k < count; ++k)
+	{
+		double w = 2. * scene.spheres.radius[k] * scale_x;
+		double h = 2. * scene.spheres.radius[k] * scale_y;
+		sum_w += w;
+		sum_h += h;
+		sum_area += w * h;
+	}
+
+	double image_area = static_cast<double>(view.image_width) * view.image_height;
+	auto size = kTileSize;
+
+	for (; size > kMinCacheTileSize; size /= 2)
+	{
+		// a footprint of w x h meets a tile at a random place with a chance of
+		// (size + w) (size + h) over the image area
+		double spheres = (double(count) * size * size + size * (sum_w + sum_h) + sum_area) / image_area;
+		double bytes = std::min(spheres, double(count)) * kSphereWorkingSet + double(size) * size * kPixelWorkingSet;
+
+		if (bytes <= l2_bytes / 2)
+			break;
+	}
+
+	return size;
+}
+
+std::vector<tile> covered_tiles(std::vector<pixel_rect> const& rects, ortho_view const& view, std::uint32_t tile_size)
+{
+	auto tiles_x = (view.image_width + tile_size - 1) / tile_size;
+	auto tiles_y = (view.image_height + tile_size - 1) / tile_size;
+
+	std::vector<char> covered(std::size_t(tiles_x) * tiles_y, 0);
+
+	for (auto const& rect : rects)
+	{
+		if (rect.x1 <= rect.x0 || rect.y1 <= rect.y0)
+			continue;
+
+		for (auto ty = rect.y0 / tile_size; ty <= (rect.y1 - 1) / tile_size; ++ty)
+		{
+			for (auto tx = rect.x0 / tile_size; tx <= (rect.x1 - 1) / tile_size; ++tx)
+			{
+				covered[std::size_t(ty) * tiles_x + tx] = 1;
+			}
+		}
+	}
+
+	std::vector<tile> tiles;
+
+	for (auto ty = 0U; ty < tiles_y; ++ty)
+	{
+		for (auto tx = 0U; tx < tiles_x; ++tx)
+		{
+			if (!covered[std::size_t(ty) * tiles_x + tx])
+				continue;
+
+			auto x = tx * tile_size;
+			auto y = ty * tile_size;
+			tiles.push_back(tile{ x, y, std::min(x + tile_size, view.image_width), std::min(y + tile_size, view.image_height) });
+		}
+	}
+
+	return tiles;
+}
+
+std::vector<tile> roi_tiles(ortho_view const& view, render_roi const& roi, std::uint32_t tile_size)
+{
+	auto region = clip_roi(roi, view);
+	std::vector<tile> tiles;
+
+	for (auto y = region.ybegin / tile_size * tile_size; y < region.yend; y += tile_size)
+	{
+		for (auto x = region.xbegin / tile_size * tile_size; x < region.xend; x += tile_size)
+		{
+			tiles.push_back(tile{ std::max(x, region.xbegin), std::max(y, region.ybegin), std::min(x + tile_size, region.xend), std::min(y + tile_size, region.yend) });
+		}
+	}
+
+	return tiles;
+}
+
+void trace(sphere_soa const& spheres, ortho_view const& view, float* img)
+{
+	ortho_rays camera(view);
+	all_spheres accel(spheres);
+
+	trace_tile<float3_pixels>(spheres, view, camera, accel, tile{ 0U, 0U, view.image_width, view.image_height }, reinterpret_cast<unsigned char*>(img));
+}
+
+void trace_pinhole(sphere_soa const& spheres, ortho_view const& view, pinhole_camera const& camera, float* img)
+{
+	perspective_rays rays(view, camera);
+	all_spheres accel(spheres);
+
+	trace_tile<float3_pixels>(spheres, view, rays, accel, tile{ 0U, 0U, view.image_width, view.image_height }, reinterpret_cast<unsigned char*>(img));
+}
+
+void render_tile(render_scene const& scene, simd_isa isa, tile const& t, float* img)
+{
+	render_tile(scene, isa, pixel_format::float32, t, reinterpret_cast<unsigned char*>(img));
+}
+
+void render_tile(render_scene const& scene, simd_isa isa, pixel_format format, tile const& t, unsigned char* img)
+{
+	select_tile_tracer(scene, isa, format)(scene, t, img);
+}
+
+void render_parallel(tile_executor& pool, render_scene const& scene, simd_isa isa, float* img)
+{
+	render_parallel(pool, scene, isa, pixel_format::float32, reinterpret_cast<unsigned char*>(img));
+}
+
+void render_parallel(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, unsigned char* img)
+{
+	render_parallel(pool, scene, isa, format, scene.tile_size, img, nullptr);
+}
+
+void render_parallel(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, std::uint32_t tile_size, unsigned char* img,
+                     std::uint32_t* worker_tiles, cancel_token const* cancel)
+{
+	auto tiles = make_tiles(scene.view, std::min(tile_size, kTileSize), scene.tiles);
+	auto tracer = select_tile_tracer(scene, isa, format);
+
+	pool.run_with_worker(tiles, [&](tile const& t, std::uint32_t worker)
+	{
+		if (cancel && cancel->cancelled())
+			return;
+
+		tracer(scene, t, img);
+
+		// only worker writes its counter
+		if (worker_tiles)
+			++worker_tiles[worker];
+	});
+}
+
+#ifdef RT_COST_COUNTERS
+bool render_cost(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_cost* costs)
+{
+	auto tracer = select_cost_tracer(scene, isa);
+
+	if (tracer == nullptr)
+		return false;
+
+	pool.run(make_tiles(scene.view, kTileSize), [&](tile const& t)
+	{
+		tracer(scene, t, costs);
+	});
+
+	return true;
+}
+#endif
+
+std::vector<std::unique_ptr<render_scene>> replicate_scene(tile_executor& pool, render_scene const& scene)
+{
+	std::vector<std::unique_ptr<render_scene>> replicas;
+
+	if (pool.num_nodes() < 2)
+		return replicas;
+
+	replicas.resize(pool.num_nodes());
+
+	// the first worker of every node copies the scene for it
+	pool.run_each([&](std::uint32_t worker)
+	{
+		auto node = pool.node_of(worker);
+
+		if (worker > 0 && pool.node_of(worker - 1) == node)
+			return;
+
+		std::unique_ptr<render_scene> replica(new render_scene);
+		replica->spheres = scene.spheres;
+		replica->view = scene.view;
+		replica->camera = scene.camera;
+		replica->pinhole = scene.pinhole;
+		replica->mode = scene.mode;
+		replica->accel = scene.accel;
+		replica->accel4 = scene.accel4;
+		replica->accel8 = scene.accel8;
+		replica->grid = scene.grid;
+		replica->footprints = scene.footprints;
+		replica->order = scene.order;
+		replica->neighbour_hint = scene.neighbour_hint;
+		replica->skip_background = scene.skip_background;
+		replica->coverage = scene.coverage;
+		replica->half_spheres = scene.half_spheres;
+		replica->halves = scene.halves;
+		replica->splat_tiny = scene.splat_tiny;
+		replica->tiny = scene.tiny;
+		replica->tiny_spheres = scene.tiny_spheres;
+		replicas[node] = std::move(replica);
+	});
+
+	return replicas;
+}
+
+void render_parallel(tile_executor& pool, std::vector<std::unique_ptr<render_scene>> const& replicas, simd_isa isa, float* img)
+{
+	auto tiles = make_tiles(replicas[0]->view, kTileSize);
+	auto tracer = select_tile_tracer(*replicas[0], isa, pixel_format::float32);
+
+	pool.run_with_worker(tiles, [&](tile const& t, std::uint32_t worker)
+	{
+		tracer(*replicas[pool.node_of(worker)], t, reinterpret_cast<unsigned char*>(img));
+	});
+}
+
+void first_touch(tile_executor& pool, ortho_view const& view, float* img)
+{
+	auto tiles = make_tiles(view, kTileSize);
+
+	pool.run_each([&](std::uint32_t worker)
+	{
+		// the rows of the first to the last tile run() seeds the worker with
+		auto first = tiles.size() * worker / pool.size();
+		auto last = tiles.size() * (worker + 1) / pool.size();
+
+		if (first == last)
+			return;
+
+		std::size_t begin = std::size_t(tiles[first].y0) * view.image_width * 3;
+		std::size_t end = std::size_t(tiles[last - 1].y1) * view.image_width * 3;
+
+		// workers sharing a row of tiles both clear it, the first write places the page
+		std::fill(img + begin, img + end, 0.f);
+	});
+}
+
+namespace
+{
+	// First row, row step and rows each traced row stands for, of progressive passes 1 to 4
+	struct row_pass
+	{
+		std::uint32_t first, step, rows;
+	};
+
+	row_pass const kRowPasses[kProgressivePasses - 1] = { { 0, 8, 8 }, { 4, 8, 4 }, { 2, 4, 2 }, { 1, 2, 1 } };
+	std::uint32_t const kProgressiveBlock = 8;
+
+	// Share of the pixels of a tile each progressive pass traces
+	double const kPassShare[kProgressivePasses] = { 1. / 64, 1. / 8, 1. / 8, 1. / 4, 1. / 2 };
+
+	// Trace pass p of render_progressive() over tile t. Tiles start on multiples of 8 rows, so
+	// every pass sees the same rows of each.
+	void trace_progressive_pass(render_scene const& scene, simd_isa isa, std::uint32_t p, tile const& t, float* img)
+	{
+		auto const& view = scene.view;
+
+		if (p == 0)
+		{
+			for (auto y = t.y0; y < t.y1; y += kProgressiveBlock)
+			{
+				auto y1 = std::min(y + kProgressiveBlock, t.y1);
+
+				for (auto x = t.x0; x < t.x1; x += kProgressiveBlock)
+				{
+					auto x1 = std::min(x + kProgressiveBlock, t.x1);
+
+					render_tile(scene, isa, tile{ x, y, x + 1, y + 1 }, img);
+
+					float const* sample = img + (std::size_t(y) * view.image_width + x) * 3;
+
+					for (auto j = y; j < y1; ++j)
+					{
+						float* pixel = img + (std::size_t(j) * view.image_width + x) * 3;
+
+						for (auto i = x; i < x1; ++i, pixel += 3)
+						{
+							std::copy(sample, sample + 3, pixel);
+						}
+					}
+				}
+			}
+
+			return;
+		}
+
+		auto const& pass = kRowPasses[p - 1];
+
+		for (auto y = t.y0 + pass.first; y < t.y1; y += pass.step)
+		{
+			render_tile(scene, isa, tile{ t.x0, y, t.x1, y + 1 }, img);
+
+			float const* row = img + (std::size_t(y) * view.image_width + t.x0) * 3;
+			auto row_end = row + std::size_t(t.x1 - t.x0) * 3;
+
+			for (auto j = y + 1; j < std::min(y + pass.rows, t.y1); ++j)
+			{
+				std::copy(row, row_end, img + (std::size_t(j) * view.image_width + t.x0) * 3);
+			}
+		}
+	}
+}
+
+void render_progressive(tile_executor& pool, render_scene const& scene, simd_isa isa, float* img, std::function<void(std::uint32_t pass)> const& on_pass,
+                        cancel_token const* cancel)
+{
+	auto tiles = make_tiles(scene.view, kTileSize);
+
+	for (std::uint32_t p = 0; p < kProgressivePasses; ++p)
+	{
+		pool.run(tiles, [&](tile const& t)
+		{
+			if (cancel && cancel->cancelled())
+				return;
+
+			trace_progressive_pass(scene, isa, p, t, img);
+		});
+
+		// a tile skipped may leave the pass without a whole preview
+		if (cancel && cancel->cancelled())
+			return;
+
+		on_pass(p);
+	}
+}
+
+deadline_result render_deadline(tile_executor& pool, render_scene const& scene, simd_isa isa, float* img, double budget, tile_costs& costs)
+{
+	typedef std::chrono::steady_clock clock;
+
+	auto start = clock::now();
+	auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(budget));
+
+	auto const& view = scene.view;
+	auto tiles = make_tiles(view, kTileSize);
+	auto tiles_x = (view.image_width + kTileSize - 1) / kTileSize;
+
+	// the costs of another image size are of other tiles
+	if (costs.full.size() != tiles.size())
+		costs.full.assign(tiles.size(), 0.);
+
+	deadline_result result;
+	result.tile_passes.assign(tiles.size(), 0);
+
+	// the last frame's cost of every tile, or none until its coarse pass is timed
+	std::vector<double> estimate = costs.full;
+	// seconds each tile spent in the passes it finished this frame
+	std::vector<double> spent(tiles.size(), 0.);
+
+	for (std::uint32_t p = 0; p < kProgressivePasses && clock::now() < deadline; ++p)
+	{
+		// the tiles that finished the pass before, most expensive first so the pass ends evenly
+		std::vector<tile> pass_tiles;
+
+		for (std::size_t i = 0; i < tiles.size(); ++i)
+		{
+			if (result.tile_passes[i] == p)
+				pass_tiles.push_back(tiles[i]);
+		}
+
+		auto index_of = [&](tile const& t)
+		{
+			return (t.y0 / kTileSize) * tiles_x + t.x0 / kTileSize;
+		};
+
+		std::stable_sort(pass_tiles.begin(), pass_tiles.end(), [&](tile const& a, tile const& b)
+		{
+			return estimate[index_of(a)] > estimate[index_of(b)];
+		});
+
+		pool.run(pass_tiles, [&](tile const& t)
+		{
+			auto i = index_of(t);
+			auto tile_start = clock::now();
+
+			// a tile expected to finish its pass after the deadline keeps what it has
+			if (tile_start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(estimate[i] * kPassShare[p])) > deadline)
+				return;
+
+			trace_progressive_pass(scene, isa, p, t, img);
+
+			spent[i] += std::chrono::duration<double>(clock::now() - tile_start).count();
+			result.tile_passes[i] = static_cast<std::uint8_t>(p + 1);
+		});
+
+		// tiles first timed now are estimated from their coarse pass
+		for (std::size_t i = 0; p == 0 && i < tiles.size(); ++i)
+		{
+			if (estimate[i] == 0.)
+				estimate[i] = spent[i] / kPassShare[0];
+		}
+	}
+
+	result.unfinished = 0;
+
+	for (std::size_t i = 0; i < tiles.size(); ++i)
+	{
+		double share = 0.;
+
+		for (std::uint32_t p = 0; p < result.tile_passes[i]; ++p)
+		{
+			share += kPassShare[p];
+		}
+
+		if (share > 0.)
+			costs.full[i] = spent[i] / share;
+
+		if (result.tile_passes[i] < kProgressivePasses)
+			++result.unfinished;
+	}
+
+	result.elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	return result;
+}
+
+std::vector<double> estimate_tile_costs(render_scene const& scene)
+{
+	auto const& view = scene.view;
+	auto tiles = make_tiles(view, kTileSize);
+	auto tiles_x = (view.image_width + kTileSize - 1) / kTileSize;
+
+	// spheres the rays of each tile test
+	std::vector<double> spheres(tiles.size(), 0.);
+
+	if (scene.mode == accel_mode::none || scene.camera != projection::ortho)
+	{
+		spheres.assign(tiles.size(), static_cast<double>(scene.spheres.size()));
+	}
+	else
+	{
+		for (std::uint32_t k = 0; k < scene.spheres.size(); ++k)
+		{
+			pixel_rect rect;
+
+			if (!sphere_footprint(scene.spheres, k, view, rect))
+				continue;
+
+			for (auto ty = rect.y0 / kTileSize; ty <= (rect.y1 - 1) / kTileSize; ++ty)
+			{
+				for (auto tx = rect.x0 / kTileSize; tx <= (rect.x1 - 1) / kTileSize; ++tx)
+				{
+					spheres[std::size_t(ty) * tiles_x + tx] += 1.;
+				}
+			}
+		}
+	}
+
+	std::vector<double> costs(tiles.size());
+
+	for (std::size_t i = 0; i < tiles.size(); ++i)
+	{
+		// a ray missing everything still costs its background pixel
+		costs[i] = double(tiles[i].x1 - tiles[i].x0) * (tiles[i].y1 - tiles[i].y0) * (1. + spheres[i]);
+	}
+
+	return costs;
+}
+
+std::vector<tile> balanced_tiles(ortho_view const& view, std::vector<double> const& costs, std::uint32_t workers)
+{
+	auto tiles = make_tiles(view, kTileSize);
+	double total = 0.;
+
+	for (std::size_t i = 0; i < tiles.size(); ++i)
+	{
+		total += costs[i];
+	}
+
+	double target = total / (double(std::max(workers, 1U)) * kBalanceItemsPerWorker);
+	std::vector<std::pair<double, tile>> items;
+
+	// the open run of cheap tiles of the current row, if its cost isn't negative
+	tile run = {};
+	double run_cost = -1.;
+
+	auto close_run = [&]
+	{
+		if (run_cost >= 0.)
+			items.emplace_back(run_cost, run);
+
+		run_cost = -1.;
+	};
+
+	for (std::size_t i = 0; i < tiles.size(); ++i)
+	{
+		auto const& t = tiles[i];
+		auto cost = costs[i];
+
+		// runs stay within a row of tiles
+		if (t.x0 == 0)
+			close_run();
+
+		if (cost > target && target > 0.)
+		{
+			close_run();
+
+			// parts of equal area share the cost of the tile
+			std::uint32_t parts = 1;
+
+			while (cost / (double(parts) * parts) > target && kTileSize / (parts * 2) >= kMinCacheTileSize)
+			{
+				parts *= 2;
+			}
+
+			auto side = kTileSize / parts;
+			double area = double(t.x1 - t.x0) * (t.y1 - t.y0);
+
+			for (auto y = t.y0; y < t.y1; y += side)
+			{
+				for (auto x = t.x0; x < t.x1; x += side)
+				{
+					tile part = { x, y, std::min(x + side, t.x1), std::min(y + side, t.y1) };
+					items.emplace_back(cost * (double(part.x1 - part.x0) * (part.y1 - part.y0)) / area, part);
+				}
+			}
+		}
+		else if (run_cost >= 0. && run_cost + cost <= target && t.x1 - run.x0 <= kMaxBalanceRun * kTileSize)
+		{
+			run.x1 = t.x1;
+			run_cost += cost;
+		}
+		else
+		{
+			close_run();
+			run = t;
+			run_cost = cost;
+		}
+	}
+
+	close_run();
+
+	// the expensive items start first, the cheap ones fill the gaps at the end
+	std::stable_sort(items.begin(), items.end(), [](std::pair<double, tile> const& a, std::pair<double, tile> const& b) { return a.first > b.first; });
+
+	std::vector<tile> balanced;
+	balanced.reserve(items.size());
+
+	for (auto const& item : items)
+	{
+		balanced.push_back(item.second);
+	}
+
+	return balanced;
+}
+
+void render_balanced(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, unsigned char* img, tile_costs& costs)
+{
+	typedef std::chrono::steady_clock clock;
+
+	auto const& view = scene.view;
+	auto tiles_x = (view.image_width + kTileSize - 1) / kTileSize;
+	auto num_tiles = make_tiles(view, kTileSize).size();
+
+	// the times of another image size, or of a frame render_deadline() cut short, are incomplete
+	bool timed = costs.full.size() == num_tiles && std::all_of(costs.full.begin(), costs.full.end(), [](double cost) { return cost > 0.; });
+	auto items = balanced_tiles(view, timed ? costs.full : estimate_tile_costs(scene), pool.size());
+	auto tracer = select_tile_tracer(scene, isa, format);
+
+	// seconds of the items each worker traced, only that worker appends to its list
+	std::vector<std::vector<std::pair<tile, double>>> spent(pool.size());
+
+	pool.run_with_worker(items, [&](tile const& t, std::uint32_t worker)
+	{
+		auto item_start = clock::now();
+
+		// a merged run is traced tile by tile
+		for (auto x = t.x0; x < t.x1; x += kTileSize)
+		{
+			tracer(scene, tile{ x, t.y0, std::min(x + kTileSize, t.x1), t.y1 }, img);
+		}
+
+		spent[worker].emplace_back(t, std::chrono::duration<double>(clock::now() - item_start).count());
+	});
+
+	// the parts of a split tile add up to it, a run is shared by its tiles by width
+	costs.full.assign(num_tiles, 0.);
+
+	for (auto const& list : spent)
+	{
+		for (auto const& item : list)
+		{
+			auto const& t = item.first;
+			auto row = std::size_t(t.y0 / kTileSize) * tiles_x;
+
+			for (auto x = t.x0; x < t.x1;)
+			{
+				auto x_end = std::min((x / kTileSize + 1) * kTileSize, t.x1);
+				costs.full[row + x / kTileSize] += item.second * (x_end - x) / (t.x1 - t.x0);
+				x = x_end;
+			}
+		}
+	}
+}
+
+namespace
+{
+	// Cache lines of the node cache of measure_bvh_traffic, 32 KiB of 64 byte lines, and the
+	// pages it counts
+	std::size_t const kCacheLine = 64;
+	std::size_t const kNodeCacheLines = 512;
+	std::size_t const kPageBytes = 4096;
+
+	// Fully associative cache of kNodeCacheLines lines, the least recently used one evicted,
+	// that the node loads of one layout go through from ray to ray, and the pages each ray's
+	// loads touch
+	class node_cache
+	{
+	public:
+		// Load bytes at offset of the node array, counting the lines not held
+		void load(std::size_t offset, std::size_t bytes)
+		{
+			for (auto line = offset / kCacheLine; line <= (offset + bytes - 1) / kCacheLine; ++line)
+			{
+				ray_pages_.push_back(line * kCacheLine / kPageBytes);
+				auto held = lines_.find(line);
+
+				if (held != lines_.end())
+				{
+					order_.splice(order_.begin(), order_, held->second);
+					continue;
+				}
+
+				++misses;
+
+				if (lines_.size() == kNodeCacheLines)
+				{
+					lines_.erase(order_.back());
+					order_.pop_back();
+				}
+
+				order_.push_front(line);
+				lines_[line] = order_.begin();
+			}
+		}
+
+		// Count the distinct pages of the loads since the last call
+		void end_ray()
+		{
+			std::sort(ray_pages_.begin(), ray_pages_.end());
+			pages += static_cast<std::size_t>(std::unique(ray_pages_.begin(), ray_pages_.end()) - ray_pages_.begin());
+			ray_pages_.clear();
+		}
+
+		std::size_t misses = 0;
+		std::size_t pages = 0;
+
+	private:
+		// most recently used first
+		std::list<std::size_t> order_;
+		std::unordered_map<std::size_t, std::list<std::size_t>::iterator> lines_;
+		std::vector<std::size_t> ray_pages_;
+	};
+
+	// Nodes r tests walking the full nodes of bvh_traversal
+	std::size_t full_bvh_loads(render_scene const& scene, ray r, node_cache& cache)
+	{
+		auto const* nodes = scene.accel.nodes.data();
+		auto const* indices = scene.accel.indices.data();
+
+		std::int32_t stack[kBvhMaxDepth];
+		std::int32_t sp = 0;
+		std::int32_t node = 0;
+		std::size_t loads = 0;
+		int idx = -1;
+
+		for (;;)
+		{
+			bvh_node const& n = nodes[node];
+			++loads;
+			cache.load(node * sizeof(bvh_node), sizeof(bvh_node));
+
+			bool visit = r.ox >= n.bmin[0] && r.ox <= n.bmax[0] && r.oy >= n.bmin[1] && r.oy <= n.bmax[1] &&
+			             n.bmin[2] - r.oz <= r.maxt && n.bmax[2] - r.oz >= 0.f;
+
+			if (visit && n.count == 0)
+			{
+				auto first = node + 1;
+				auto second = n.offset;
+
+				if (nodes[second].bmin[2] < nodes[first].bmin[2])
+					std::swap(first, second);
+
+				stack[sp++] = second;
+				node = first;
+				continue;
+			}
+
+			if (visit)
+			{
+				for (auto l = 0; l < n.count; ++l)
+				{
+					auto k = indices[n.offset + l];
+					if (intersect_sphere_ordered<true>(scene.spheres, k, idx, r))
+					{
+						idx = static_cast<int>(k);
+					}
+				}
+			}
+
+			if (sp == 0)
+				break;
+
+			node = stack[--sp];
+		}
+
+		return loads;
+	}
+
+	// Nodes r decodes walking the compressed nodes of bvh_closest in trace.cl
+	std::size_t compressed_bvh_loads(render_scene const& scene, ray r, node_cache& cache)
+	{
+		auto const* nodes = scene.compressed_nodes.data();
+		auto const* indices = scene.accel.indices.data();
+
+		std::int32_t stack[kBvhMaxDepth];
+		std::int32_t sp = 0;
+		std::int32_t node = 0;
+		std::size_t loads = 0;
+		int idx = -1;
+
+		for (;;)
+		{
+			compressed_bvh_node const& n = nodes[node];
+			++loads;
+			cache.load(node * sizeof(compressed_bvh_node), sizeof(compressed_bvh_node));
+
+			std::int32_t inner[2];
+			float inner_z[2];
+			int num_inner = 0;
+
+			for (int c = 0; c < 2; ++c)
+			{
+				float lo[3], hi[3];
+
+				for (int a = 0; a < 3; ++a)
+				{
+					float step = std::ldexp(1.f, n.exponent[a] - 127);
+					lo[a] = n.origin[a] + n.qlo[c * 3 + a] * step;
+					hi[a] = n.origin[a] + n.qhi[c * 3 + a] * step;
+				}
+
+				bool visit = r.ox >= lo[0] && r.ox <= hi[0] && r.oy >= lo[1] && r.oy <= hi[1] && lo[2] - r.oz <= r.maxt && hi[2] - r.oz >= 0.f;
+
+				if (!visit)
+					continue;
+
+				if (n.leaf_mask & (1U << c))
+				{
+					for (auto l = 0; l < n.count[c]; ++l)
+					{
+						auto k = indices[n.child[c] + l];
+						if (intersect_sphere_ordered<true>(scene.spheres, k, idx, r))
+						{
+							idx = static_cast<int>(k);
+						}
+					}
+				}
+				else
+				{
+					inner[num_inner] = n.child[c];
+					inner_z[num_inner++] = lo[2];
+				}
+			}
+
+			if (num_inner == 2)
+			{
+				bool swap = inner_z[1] < inner_z[0];
+				stack[sp++] = inner[swap ? 0 : 1];
+				node = inner[swap ? 1 : 0];
+				continue;
+			}
+
+			if (num_inner == 1)
+			{
+				node = inner[0];
+				continue;
+			}
+
+			if (sp == 0)
+				break;
+
+			node = stack[--sp];
+		}
+
+		return loads;
+	}
+
+	// Wide nodes r tests walking nodes like bvh4_closest and bvh8_closest
+	template <std::uint32_t N>
+	std::size_t wide_bvh_loads(render_scene const& scene, std::vector<wide_bvh_node<N>> const& nodes, ray r, node_cache& cache)
+	{
+		auto const* indices = scene.accel.indices.data();
+
+		wide_entry stack[kBvhMaxDepth * N];
+		std::int32_t sp = 0;
+		stack[sp++] = wide_entry{ 0, 0, -std::numeric_limits<float>::infinity() };
+		std::size_t loads = 0;
+		int idx = -1;
+
+		while (sp > 0)
+		{
+			auto entry = stack[--sp];
+
+			if (entry.near > r.maxt)
+				continue;
+
+			if (entry.count != 0)
+			{
+				idx = wide_leaf_closest(scene.spheres, indices, entry.child, entry.count, r, idx);
+				continue;
+			}
+
+			auto const& n = nodes[entry.child];
+			++loads;
+			cache.load(entry.child * sizeof(wide_bvh_node<N>), sizeof(wide_bvh_node<N>));
+
+			float nears[N];
+			unsigned mask = 0;
+
+			for (auto c = 0U; c < N; ++c)
+			{
+				nears[c] = n.bmin[2][c] - r.oz;
+
+				if (r.ox >= n.bmin[0][c] && r.ox <= n.bmax[0][c] && r.oy >= n.bmin[1][c] && r.oy <= n.bmax[1][c] && nears[c] <= r.maxt &&
+				    n.bmax[2][c] - r.oz >= 0.f)
+					mask |= 1U << c;
+			}
+
+			push_wide_children(n, mask, nears, stack, sp);
+		}
+
+		return loads;
+	}
+}
+
+bvh_traffic measure_bvh_traffic(render_scene const& scene, std::uint32_t stride)
+{
+	bvh_traffic traffic = {};
+
+	if (scene.accel.nodes.empty())
+		return traffic;
+
+	ortho_rays camera(scene.view);
+	std::size_t rays = 0;
+	std::size_t full = 0;
+	std::size_t compressed = 0;
+	std::size_t wide = 0;
+	node_cache full_cache, compressed_cache, wide_cache;
+
+	for (auto j = 0U; j < scene.view.image_height; j += stride)
+	{
+		ray r = {};
+		r.dz = 1.f;
+		camera.row(j, r);
+
+		for (auto i = 0U; i < scene.view.image_width; i += stride)
+		{
+			camera.pixel(i, j, r);
+
+			++rays;
+			full += full_bvh_loads(scene, r, full_cache);
+
+			if (!scene.compressed_nodes.empty())
+				compressed += compressed_bvh_loads(scene, r, compressed_cache);
+
+			if (!scene.accel8.empty())
+				wide += wide_bvh_loads(scene, scene.accel8, r, wide_cache);
+
+			full_cache.end_ray();
+			compressed_cache.end_ray();
+			wide_cache.end_ray();
+		}
+	}
+
+	traffic.full = static_cast<double>(full) * sizeof(bvh_node) / rays;
+	traffic.compressed = static_cast<double>(compressed) * sizeof(compressed_bvh_node) / rays;
+	traffic.wide = static_cast<double>(wide) * sizeof(bvh8_node) / rays;
+	traffic.full_misses = static_cast<double>(full_cache.misses) / rays;
+	traffic.compressed_misses = static_cast<double>(compressed_cache.misses) / rays;
+	traffic.wide_misses = static_cast<double>(wide_cache.misses) / rays;
+	traffic.full_pages = static_cast<double>(full_cache.pages) / rays;
+	traffic.compressed_pages = static_cast<double>(compressed_cache.pages) / rays;
+	traffic.wide_pages = static_cast<double>(wide_cache.pages) / rays;
+	return traffic;
+}
+
+namespace
+{
+	static_assert(sizeof(occlusion_ray) == 16, "occlusion_ray is mirrored by trace.cl");
+
+	// True if sphere k blocks r, the hit test of intersect_sphere() without the update
+	inline bool blocks(sphere_soa const& spheres, std::uint32_t k, ray const& r)
+	{
+		float t0, t1;
+		return sphere_roots<true>(spheres, k, r, t0, t1) && t0 <= r.maxt && t1 >= 0.f;
+	}
+
+	// Any sphere of the BVH of scene that blocks r; the children are visited in node order, as
+	// any blocker ends the walk
+	bool bvh_occluded(render_scene const& scene, ray const& r)
+	{
+		auto const* nodes = scene.accel.nodes.data();
+		auto const* indices = scene.accel.indices.data();
+
+		std::int32_t stack[kBvhMaxDepth];
+		std::int32_t sp = 0;
+		std::int32_t node = 0;
+
+		for (;;)
+		{
+			bvh_node const& n = nodes[node];
+
+			bool visit = r.ox >= n.bmin[0] && r.ox <= n.bmax[0] && r.oy >= n.bmin[1] && r.oy <= n.bmax[1] && n.bmin[2] - r.oz <= r.maxt &&
+			             n.bmax[2] - r.oz >= 0.f;
+
+			if (visit && n.count == 0)
+			{
+				stack[sp++] = n.offset;
+				++node;
+				continue;
+			}
+
+			if (visit)
+			{
+				for (auto l = 0; l < n.count; ++l)
+				{
+					if (blocks(scene.spheres, indices[n.offset + l], r))
+						return true;
+				}
+			}
+
+			if (sp == 0)
+				return false;
+
+			node = stack[--sp];
+		}
+	}
+
+	// Any sphere of the depth order of scene that blocks r, up to the first one starting beyond it
+	bool sorted_occluded(render_scene const& scene, ray const& r)
+	{
+		auto const& order = scene.order;
+
+		for (std::size_t l = 0; l < order.indices.size(); ++l)
+		{
+			if (order.zmin[l] - r.oz > r.maxt)
+				return false;
+
+			if (blocks(scene.spheres, order.indices[l], r))
+				return true;
+		}
+
+		return false;
+	}
+}
+
+bool occluded(render_scene const& scene, occlusion_ray const& query)
+{
+	ray r = {};
+	r.ox = query.ox;
+	r.oy = query.oy;
+	r.oz = query.oz;
+	r.dz = 1.f;
+	r.maxt = query.tmax;
+
+	// the BVH lacks the tiny spheres, whose cells are of pixel centers
+	if (scene.mode == accel_mode::bvh && !scene.accel.nodes.empty() && scene.tiny.indices.empty())
+		return bvh_occluded(scene, r);
+
+	if (scene.mode == accel_mode::sorted)
+		return sorted_occluded(scene, r);
+
+	for (auto k = 0U; k < scene.spheres.size(); ++k)
+	{
+		if (blocks(scene.spheres, k, r))
+			return true;
+	}
+
+	return false;
+}
+
+void occluded(tile_executor& pool, render_scene const& scene, std::vector<occlusion_ray> const& queries, std::vector<unsigned char>& hits)
+{
+	hits.assign(queries.size(), 0);
+
+	// runs of kTileSize * kTileSize queries, as many as the rays of a tile
+	std::size_t const run = std::size_t(kTileSize) * kTileSize;
+	std::vector<tile> runs;
+
+	for (std::size_t first = 0; first < queries.size(); first += run)
+	{
+		runs.push_back(tile{ static_cast<std::uint32_t>(first), 0, static_cast<std::uint32_t>(std::min(first + run, queries.size())), 1 });
+	}
+
+	pool.run(runs, [&](tile const& t)
+	{
+		for (auto i = t.x0; i < t.x1; ++i)
+		{
+			hits[i] = occluded(scene, queries[i]) ? 1 : 0;
+		}
+	});
+}
+
+namespace
+{
+	static_assert(sizeof(ray_hit) == 8, "ray_hit is mirrored by trace.cl");
+
+	// The K nearest hits of a ray, sorted nearest first in arrays the compiler keeps in registers
+	// for the small K of the tracers
+	template <std::uint32_t K>
+	struct nearest_hits
+	{
+		float t[K];
+		int id[K];
+		std::uint32_t count = 0;
+
+		// Distance a hit must reach to be kept, the far end of the ray until K hits are
+		float limit(float maxt) const
+		{
+			return count < K ? maxt : t[K - 1];
+		}
+
+		// Keep sphere k hit at distance hit_t if it is among the K nearest; on equal distance the
+		// higher index goes first, as the in-order loop of trace() keeps it
+		void add(float hit_t, int k)
+		{
+			auto before = [&](std::uint32_t s) { return hit_t < t[s] || (hit_t == t[s] && k > id[s]); };
+
+			if (count == K && !before(K - 1))
+				return;
+
+			auto s = count < K ? count++ : K - 1;
+
+			for (; s > 0 && before(s - 1); --s)
+			{
+				t[s] = t[s - 1];
+				id[s] = id[s - 1];
+			}
+
+			t[s] = hit_t;
+			id[s] = k;
+		}
+	};
+
+	// Add sphere k to hits if r meets it, the hit test of intersect_sphere() against the whole ray
+	template <std::uint32_t K>
+	inline void add_nearest(sphere_soa const& spheres, std::uint32_t k, ray const& r, nearest_hits<K>& hits)
+	{
+		float t0, t1;
+
+		if (sphere_roots<true>(spheres, k, r, t0, t1) && t0 <= r.maxt && t1 >= 0.f)
+			hits.add(t0 > 0.f ? t0 : t1, static_cast<int>(k));
+	}
+
+	// The K nearest hits of r through the BVH of scene: a node is skipped once its box starts
+	// beyond the K-th hit, the children are visited in node order
+	template <std::uint32_t K>
+	void bvh_nearest(render_scene const& scene, ray const& r, nearest_hits<K>& hits)
+	{
+		auto const* nodes = scene.accel.nodes.data();
+		auto const* indices = scene.accel.indices.data();
+
+		std::int32_t stack[kBvhMaxDepth];
+		std::int32_t sp = 0;
+		std::int32_t node = 0;
+
+		for (;;)
+		{
+			bvh_node const& n = nodes[node];
+
+			bool visit = r.ox >= n.bmin[0] && r.ox <= n.bmax[0] && r.oy >= n.bmin[1] && r.oy <= n.bmax[1] && n.bmin[2] - r.oz <= hits.limit(r.maxt) &&
+			             n.bmax[2] - r.oz >= 0.f;
+
+			if (visit && n.count == 0)
+			{
+				stack[sp++] = n.offset;
+				++node;
+				continue;
+			}
+
+			if (visit)
+			{
+				for (auto l = 0; l < n.count; ++l)
+				{
+					add_nearest(scene.spheres, indices[n.offset + l], r, hits);
+				}
+			}
+
+			if (sp == 0)
+				return;
+
+			node = stack[--sp];
+		}
+	}
+
+	template <std::uint32_t K>
+	void trace_nearest_tile(render_scene const& scene, tile const& t, ray_hit* hits)
+	{
+		auto const& view = scene.view;
+		ortho_rays camera(view);
+
+		bool bvh = scene.mode == accel_mode::bvh && !scene.accel.nodes.empty() && scene.tiny.indices.empty();
+		auto const& order = scene.order;
+
+		for (auto j = t.y0; j < t.y1; ++j)
+		{
+			ray r = {};
+			r.dz = 1.f;
+			camera.row(j, r);
+
+			for (auto i = t.x0; i < t.x1; ++i)
+			{
+				camera.pixel(i, j, r);
+				nearest_hits<K> nearest;
+
+				if (bvh)
+				{
+					bvh_nearest(scene, r, nearest);
+				}
+				else if (scene.mode == accel_mode::sorted)
+				{
+					// no sphere after one starting beyond the K-th hit comes nearer
+					for (std::size_t l = 0; l < order.indices.size() && order.zmin[l] - r.oz <= nearest.limit(r.maxt); ++l)
+					{
+						add_nearest(scene.spheres, order.indices[l], r, nearest);
+					}
+				}
+				else
+				{
+					for (auto k = 0U; k < scene.spheres.size(); ++k)
+					{
+						add_nearest(scene.spheres, k, r, nearest);
+					}
+				}
+
+				auto* pixel = hits + (std::size_t(j) * view.image_width + i) * K;
+
+				for (std::uint32_t s = 0; s < K; ++s)
+				{
+					pixel[s] = s < nearest.count ? ray_hit{ nearest.t[s], nearest.id[s] } : ray_hit{ r.maxt, -1 };
+				}
+			}
+		}
+	}
+}
+
+bool render_nearest_hits(tile_executor& pool, render_scene const& scene, std::uint32_t k, std::vector<ray_hit>& hits)
+{
+	void (*tracer)(render_scene const&, tile const&, ray_hit*) = nullptr;
+
+	switch (k)
+	{
+	case 2: tracer = trace_nearest_tile<2>; break;
+	case 4: tracer = trace_nearest_tile<4>; break;
+	case 8: tracer = trace_nearest_tile<8>; break;
+	case kMaxNearestHits: tracer = trace_nearest_tile<kMaxNearestHits>; break;
+	default: return false;
+	}
+
+	if (scene.instances)
+		return false;
+
+	auto const& view = scene.view;
+	hits.resize(std::size_t(k) * view.image_width * view.image_height);
+
+	pool.run(make_tiles(view, kTileSize), [&](tile const& t)
+	{
+		tracer(scene, t, hits.data());
+	});
+
+	return true;
+}
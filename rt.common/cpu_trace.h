@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "accel.h"
+#include "camera.h"
+#include "cancel_token.h"
+#include "config.h"
+#include "scene.h"
+#include "tile_executor.h"
+
+// Framebuffer layouts of pixel_format.h
+enum class pixel_format;
+
+// Per-pixel counters of pixel_cost.h
+struct pixel_cost;
+
+// Pixel region of roi.h
+struct render_roi;
+
+// Tile side in pixels for the parallel CPU backend
+std::uint32_t const kTileSize = 32;
+
+// Instruction sets the packet tracer can run with, detected at runtime
+enum class simd_isa
+{
+	scalar,
+	sse4,
+	avx2,
+	avx512
+};
+
+char const* simd_isa_name(simd_isa isa);
+
+// Returns the widest instruction set supported by both the CPU and the OS
+simd_isa detect_simd_isa();
+
+// Split the image of view into tile_size x tile_size tiles in scanline order,
+// tiles on the right and top borders are clipped to the image
+std::vector<tile> make_tiles(ortho_view const& view, std::uint32_t tile_size);
+
+// The tiles of make_tiles(view, tile_size) in order
+std::vector<tile> make_tiles(ortho_view const& view, std::uint32_t tile_size, tile_order order);
+
+// Smallest tile side tried by cache_tile_size
+std::uint32_t const kMinCacheTileSize = 8;
+
+// Tile side for render_parallel() whose working set fits half of l2_bytes, the L2 share of a
+// worker (detect_l2_cache_size() of numa.h): kTileSize halved down to kMinCacheTileSize while
+// the pixels of a tile and the spheres whose footprints meet a tile on average, with their
+// share of the structure, take more. Tiles that test every sphere, mode none and the pinhole
+// camera, and an unknown L2 keep kTileSize.
+std::uint32_t cache_tile_size(render_scene const& scene, std::size_t l2_bytes);
+
+// The tiles of make_tiles(view, tile_size) that overlap one of rects, in the same order
+std::vector<tile> covered_tiles(std::vector<pixel_rect> const& rects, ortho_view const& view, std::uint32_t tile_size);
+
+// The tiles of make_tiles(view, tile_size) that overlap roi, clipped to it, in the same order
+std::vector<tile> roi_tiles(ortho_view const& view, render_roi const& roi, std::uint32_t tile_size);
+
+// Render the image img usign ray tracing for ortho projection camera.
+// Each pixel of img contains color of closest sphere after the function has finished.
+// Single-threaded scalar reference for all other CPU and OpenCL paths.
+void trace(sphere_soa const& spheres, ortho_view const& view, float* img);
+
+// Render the image img of the pinhole camera with the image size of view, testing every sphere in
+// index order. Single-threaded reference of the pinhole tiles of render_tile().
+void trace_pinhole(sphere_soa const& spheres, ortho_view const& view, pinhole_camera const& camera, float* img);
+
+// Render the pixels of tile t into the image img of scene.view with the structure of scene.mode, or with
+// the packet tracer for isa when the mode is accel_mode::none. Tiles must not be larger
+// than kTileSize in either direction. Every combination gives the image of trace().
+// With the pinhole camera the tile tests the spheres its frustum may see, the image of trace_pinhole().
+void render_tile(render_scene const& scene, simd_isa isa, tile const& t, float* img);
+
+// render_tile() writing the framebuffer img in format, the float image converted as convert_rows()
+// does. Every combination of camera, structure and format is a tracer of its own, compiled
+// for it, so the pixel loops don't branch on any of them.
+void render_tile(render_scene const& scene, simd_isa isa, pixel_format format, tile const& t, unsigned char* img);
+
+// Render the image img on all workers of pool, tile by tile, in tiles of scene.tile_size
+// issued in scene.tiles order
+void render_parallel(tile_executor& pool, render_scene const& scene, simd_isa isa, float* img);
+
+// render_parallel() into the framebuffer img in format, see render_tile()
+void render_parallel(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, unsigned char* img);
+
+// render_parallel() over tiles of tile_size, at most kTileSize, adding the tiles each worker
+// traced to worker_tiles[worker], pool.size() counters, unless it's null. Once cancel, if not
+// null, is cancelled the tiles not yet started are skipped and keep what img held.
+void render_parallel(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, std::uint32_t tile_size, unsigned char* img,
+                     std::uint32_t* worker_tiles, cancel_token const* cancel = nullptr);
+
+#ifdef RT_COST_COUNTERS
+// Trace every pixel of scene.view once more and write the sphere tests and BVH node loads of
+// its ray to costs, image_width x image_height pixels in the row order of img. The structures
+// are the ones of render_parallel() for isa; without a structure the spheres are tested one
+// ray at a time, every sphere for every ray, not with the packet tracers. Only in builds with
+// RT_COST_COUNTERS. Returns false for the adaptive and splat modes.
+bool render_cost(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_cost* costs);
+#endif
+
+// Copies of the spheres and structure of scene, one per NUMA node of pool, each made by a
+// worker of its node so its pages are local to the workers tracing through it. Empty if
+// the pool runs on a single node.
+std::vector<std::unique_ptr<render_scene>> replicate_scene(tile_executor& pool, render_scene const& scene);
+
+// render_parallel() tracing every tile through the replica of the node of its worker. The
+// tiles are the ones of kTileSize in scanline order, whose runs first_touch() placed.
+void render_parallel(tile_executor& pool, std::vector<std::unique_ptr<render_scene>> const& replicas, simd_isa isa, float* img);
+
+// Zero the rgb float image img of view on the workers of pool before anything else touches it:
+// each worker clears the rows of its run of tiles in render_parallel(), so the pages of a band
+// are placed on the node of the workers that render it
+void first_touch(tile_executor& pool, ortho_view const& view, float* img);
+
+// Passes of render_progressive()
+std::uint32_t const kProgressivePasses = 5;
+
+// Render the image img of scene.view like render_parallel(), coarse to fine, calling on_pass(p)
+// once pass p is done with img holding a whole preview. Pass 0 traces every 8th pixel of every
+// 8th row and fills the 8x8 block each sample starts; passes 1 to 4 trace the rows y % 8 == 0,
+// y % 8 == 4, y % 4 == 2 and the odd rows in full and copy each down over the rows no earlier
+// pass traced. The last pass leaves the image of render_parallel(). Every pixel is traced once
+// except the samples of pass 0, which are traced one at a time, without packets, and again by
+// pass 1 to keep its rows whole for the packet tracer. Once cancel, if not null, is cancelled the
+// pass in flight skips the tiles it hasn't started and no later pass runs; on_pass isn't called
+// for a pass cut short, img holds the preview of the pass before over the tiles it skipped.
+void render_progressive(tile_executor& pool, render_scene const& scene, simd_isa isa, float* img, std::function<void(std::uint32_t pass)> const& on_pass,
+                        cancel_token const* cancel = nullptr);
+
+// Seconds every tile of kTileSize of an image took to trace in full, by the progressive passes
+// render_deadline() timed for it; 0 for tiles it hasn't timed. Kept from frame to frame.
+struct tile_costs
+{
+	std::vector<double> full;
+};
+
+// What render_deadline() got done
+struct deadline_result
+{
+	// Progressive passes finished for every tile of make_tiles(view, kTileSize), from 0 (the
+	// tile holds whatever img held) to kProgressivePasses (the tile of render_parallel())
+	std::vector<std::uint8_t> tile_passes;
+	// Tiles short of kProgressivePasses
+	std::uint32_t unfinished;
+	// Seconds from the start to the return
+	double elapsed;
+};
+
+// Render the image img of scene.view in the passes of render_progressive() until budget
+// seconds after the start, and return which passes every tile finished. A tile starts a pass
+// only if its cost in costs, the full trace time of the tile in the last frame scaled to the
+// share of pixels the pass traces, ends before the deadline; a tile without a cost starts the
+// coarse pass and is estimated from it. The tiles of a pass run most expensive first. Each
+// pass waits for the last one, so the image is as even as the budget allows, and the time
+// past the deadline is at most the misestimate of the tiles running at it. costs is updated
+// with the times of this frame for the next.
+deadline_result render_deadline(tile_executor& pool, render_scene const& scene, simd_isa isa, float* img, double budget, tile_costs& costs);
+
+// Work items balanced_tiles() aims at per worker, so the last items to finish are short
+std::uint32_t const kBalanceItemsPerWorker = 4;
+// Tiles of kTileSize balanced_tiles() merges into one item at most
+std::uint32_t const kMaxBalanceRun = 8;
+
+// Relative cost of every tile of make_tiles(view, kTileSize) of scene, in that order, before
+// any frame was timed: its pixels times the spheres its rays test, the ones whose footprints
+// reach it as the grid bins them (the tile depth of scene_analysis.h), every sphere for mode
+// none and the pinhole camera
+std::vector<double> estimate_tile_costs(render_scene const& scene);
+
+// Work items of equal cost for workers covering the image of view once, most expensive first.
+// costs holds a cost for every tile of make_tiles(view, kTileSize) in its order. A tile costing
+// more than an item should is split into 2x2 or 4x4 parts, not below kMinCacheTileSize; runs of
+// cheap tiles in a row of tiles are merged into one item wider than kTileSize, of up to
+// kMaxBalanceRun tiles.
+std::vector<tile> balanced_tiles(ortho_view const& view, std::vector<double> const& costs, std::uint32_t workers);
+
+// render_parallel() over the items of balanced_tiles() for the tile times of costs, the
+// estimate_tile_costs() of scene while costs holds no full frame of the image size, so the
+// dense tiles don't hold up the end of the frame. costs is updated with the times of this
+// frame for the next, as render_deadline() does.
+void render_balanced(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, unsigned char* img, tile_costs& costs);
+
+// Bytes of BVH nodes the bvh traversal of the GPUs loads per ray, in the full and the
+// compressed layout
+struct bvh_traffic
+{
+	double full;
+	double compressed;
+	double wide;
+	// Cache lines per ray the nodes miss in a 32 KiB cache of 64 byte lines, kept from ray to
+	// ray in scan order, and the 4 KiB pages the nodes of a ray lie on
+	double full_misses;
+	double compressed_misses;
+	double wide_misses;
+	double full_pages;
+	double compressed_pages;
+	double wide_pages;
+};
+
+// Walk the BVH of scene like trace_bvh for every stride-th pixel of every stride-th row of
+// scene.view, and count a bvh_node for every node a ray tests, a compressed_bvh_node for
+// every compressed node it decodes and a bvh8_node for every node of scene.accel8 the AVX2
+// tracer tests, with the cache lines and pages of them (layout_treelets). compressed and wide
+// are 0 if scene.compressed_nodes or scene.accel8 is empty.
+bvh_traffic measure_bvh_traffic(render_scene const& scene, std::uint32_t stride);
+
+// True if a sphere of scene blocks query, the first one found ends the search. bvh and sorted
+// scenes are searched through their structures, from rays of the near plane those give the
+// answer of testing every sphere, which the other modes do. The spheres must be expanded, the
+// two level BVH of scene.instances is not searched.
+bool occluded(render_scene const& scene, occlusion_ray const& query);
+
+// occluded() for every query of queries on the workers of pool, hits[i] 1 if query i is blocked
+void occluded(tile_executor& pool, render_scene const& scene, std::vector<occlusion_ray> const& queries, std::vector<unsigned char>& hits);
+
+// The k nearest spheres the ortho ray of every pixel of scene.view meets, in a single pass on
+// the workers of pool: each ray keeps its k nearest hits sorted in a small array, the k hits of
+// a tracer specialized for k (nearest_hits_supported()), and writes them to hits, k per pixel
+// nearest first, image_width x image_height pixels in the row order of img. Equal distances
+// put the higher index first, as trace() keeps it, so the first hit is the sphere of the pixel.
+// bvh and sorted scenes prune their walks at the k-th hit, the other modes test every sphere.
+// Returns false for an unsupported k and for scene.instances, whose spheres aren't expanded.
+bool render_nearest_hits(tile_executor& pool, render_scene const& scene, std::uint32_t k, std::vector<ray_hit>& hits);
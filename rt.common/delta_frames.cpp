@@ -0,0 +1,137 @@
+#include "delta_frames.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	char const kDeltaMagic[8] = { 'R', 'T', 'D', 'E', 'L', 'T', 'A', '1' };
+
+	// Offset of the frames field, the last of the header
+	std::streamoff const kFramesOffset = sizeof(kDeltaMagic) + 5 * sizeof(std::uint32_t);
+}
+
+bool delta_writer::open(std::string const& path, delta_header const& header)
+{
+	path_ = path;
+	header_ = header;
+	header_.frames = 0;
+	tiles_written_ = bytes_written_ = 0;
+
+	out_.open(path, std::ios::binary | std::ios::trunc);
+
+	std::uint32_t fields[] = { header_.width, header_.height, static_cast<std::uint32_t>(header_.format), header_.tile_size, header_.keyframe_interval, 0 };
+
+	out_.write(kDeltaMagic, sizeof(kDeltaMagic));
+	out_.write(reinterpret_cast<char const*>(fields), sizeof(fields));
+
+	if (!out_)
+	{
+		std::cout << "Can't create " << path << "\n";
+		return false;
+	}
+
+	bytes_written_ = sizeof(kDeltaMagic) + sizeof(fields);
+	return true;
+}
+
+bool delta_writer::write_frame(std::uint32_t frame, std::uint32_t const* tiles, std::uint32_t count, unsigned char const* blocks)
+{
+	std::uint32_t fields[] = { frame, count };
+
+	out_.write(reinterpret_cast<char const*>(fields), sizeof(fields));
+	out_.write(reinterpret_cast<char const*>(tiles), sizeof(std::uint32_t) * count);
+	out_.write(reinterpret_cast<char const*>(blocks), header_.block_size() * count);
+
+	++header_.frames;
+	tiles_written_ += count;
+	bytes_written_ += sizeof(fields) + sizeof(std::uint32_t) * count + header_.block_size() * count;
+	return static_cast<bool>(out_);
+}
+
+bool delta_writer::close()
+{
+	out_.seekp(kFramesOffset);
+	out_.write(reinterpret_cast<char const*>(&header_.frames), sizeof(header_.frames));
+	out_.close();
+
+	if (!out_)
+	{
+		std::cout << "Can't write the frames to " << path_ << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool delta_reader::open(std::string const& path)
+{
+	path_ = path;
+	read_ = 0;
+	in_.open(path, std::ios::binary);
+
+	char magic[sizeof(kDeltaMagic)] = {};
+	std::uint32_t fields[6] = {};
+
+	if (!in_.read(magic, sizeof(magic)) || std::memcmp(magic, kDeltaMagic, sizeof(magic)) != 0 || !in_.read(reinterpret_cast<char*>(fields), sizeof(fields)) ||
+	    fields[2] > static_cast<std::uint32_t>(pixel_format::float4) || fields[3] == 0 || fields[4] == 0)
+	{
+		std::cout << path << " is not a delta container\n";
+		return false;
+	}
+
+	header_ = delta_header{ fields[0], fields[1], static_cast<pixel_format>(fields[2]), fields[3], fields[4], fields[5] };
+	return true;
+}
+
+bool delta_reader::next(std::vector<unsigned char>& image, std::uint32_t& frame)
+{
+	if (read_ == header_.frames)
+		return false;
+
+	std::uint32_t fields[2] = {};
+	std::uint32_t tiles = header_.tiles_x() * header_.tiles_y();
+
+	if (!in_.read(reinterpret_cast<char*>(fields), sizeof(fields)) || fields[1] > tiles)
+	{
+		std::cout << path_ << " ends before its " << header_.frames << " frames\n";
+		return false;
+	}
+
+	auto count = fields[1];
+	tiles_.resize(count);
+	blocks_.resize(header_.block_size() * count);
+
+	if (!in_.read(reinterpret_cast<char*>(tiles_.data()), sizeof(std::uint32_t) * count) || !in_.read(reinterpret_cast<char*>(blocks_.data()), blocks_.size()))
+	{
+		std::cout << path_ << " ends in frame " << fields[0] << "\n";
+		return false;
+	}
+
+	auto pixel_bytes = pixel_size(header_.format);
+	image.resize(pixel_bytes * header_.width * header_.height);
+
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		if (tiles_[i] >= tiles)
+		{
+			std::cout << path_ << ": tile " << tiles_[i] << " of frame " << fields[0] << " is outside the image\n";
+			return false;
+		}
+
+		auto x0 = (tiles_[i] % header_.tiles_x()) * header_.tile_size;
+		auto y0 = (tiles_[i] / header_.tiles_x()) * header_.tile_size;
+		auto row_bytes = pixel_bytes * (std::min(x0 + header_.tile_size, header_.width) - x0);
+		auto const* block = &blocks_[header_.block_size() * i];
+
+		for (auto y = y0; y < std::min(y0 + header_.tile_size, header_.height); ++y)
+		{
+			std::memcpy(&image[pixel_bytes * (std::size_t(y) * header_.width + x0)], block + pixel_bytes * header_.tile_size * (y - y0), row_bytes);
+		}
+	}
+
+	frame = fields[0];
+	++read_;
+	return true;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "pixel_format.h"
+
+// Container of an animation stored as the tiles that changed since the frame before
+// (--delta), so frames of a scene that moves little take little space. The image is mapped in
+// square tiles in rows; every keyframe_interval frames, from the first one on, a keyframe holds
+// every tile, where a reader can start. Little endian:
+//   header: "RTDELTA1", then the std::uint32_t width, height, format (pixel_format), tile_size,
+//           keyframe_interval and frames
+//   frame:  the std::uint32_t frame index and tile count, the count indices of its tiles in
+//           ascending order, then their count blocks of tile_size rows of tile_size pixels of
+//           format; the pixels of a block past the edge of the image are zero
+struct delta_header
+{
+	std::uint32_t width, height;
+	pixel_format format;
+	std::uint32_t tile_size;
+	std::uint32_t keyframe_interval;
+	std::uint32_t frames;
+
+	std::uint32_t tiles_x() const
+	{
+		return (width + tile_size - 1) / tile_size;
+	}
+
+	std::uint32_t tiles_y() const
+	{
+		return (height + tile_size - 1) / tile_size;
+	}
+
+	// Bytes of the block of a tile
+	std::size_t block_size() const
+	{
+		return pixel_size(format) * tile_size * tile_size;
+	}
+
+	bool is_keyframe(std::uint32_t frame) const
+	{
+		return frame % keyframe_interval == 0;
+	}
+};
+
+// Writes the frames of an animation to a delta container, in order
+class delta_writer
+{
+public:
+	// Create the container at path for frames of header, whose frames field is ignored. Returns
+	// false with a message if it can't be created.
+	bool open(std::string const& path, delta_header const& header);
+
+	// Append frame, the count tiles of tiles with their blocks one after the other in blocks.
+	// A keyframe must list every tile.
+	bool write_frame(std::uint32_t frame, std::uint32_t const* tiles, std::uint32_t count, unsigned char const* blocks);
+
+	// Store the number of frames in the header and close the container. Returns false with a
+	// message if a write failed.
+	bool close();
+
+	delta_header const& header() const
+	{
+		return header_;
+	}
+
+	// Tiles and bytes written so far, and the bytes the frames would take whole
+	std::size_t tiles_written() const
+	{
+		return tiles_written_;
+	}
+
+	std::size_t bytes_written() const
+	{
+		return bytes_written_;
+	}
+
+	std::size_t whole_bytes() const
+	{
+		return pixel_size(header_.format) * header_.width * header_.height * header_.frames;
+	}
+
+private:
+	std::string path_;
+	std::ofstream out_;
+	delta_header header_ = {};
+	std::size_t tiles_written_ = 0;
+	std::size_t bytes_written_ = 0;
+};
+
+// Reads the frames of a delta container back into whole images
+class delta_reader
+{
+public:
+	// Open the container at path and read its header. Returns false with a message if it isn't
+	// one.
+	bool open(std::string const& path);
+
+	delta_header const& header() const
+	{
+		return header_;
+	}
+
+	// Apply the tiles of the next frame to image, width x height pixels of format, which holds
+	// the frame before; a keyframe replaces all of it. frame gets the index of the frame.
+	// Returns false at the end of the container or with a message if it is cut short.
+	bool next(std::vector<unsigned char>& image, std::uint32_t& frame);
+
+private:
+	std::string path_;
+	std::ifstream in_;
+	delta_header header_ = {};
+	std::uint32_t read_ = 0;
+	std::vector<std::uint32_t> tiles_;
+	std::vector<unsigned char> blocks_;
+};
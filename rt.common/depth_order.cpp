@@ -0,0 +1,40 @@
+#include "depth_order.h"
+
+#include <algorithm>
+
+depth_order build_depth_order(sphere_soa const& spheres, float ray_origin_z, frame_arena& scratch)
+{
+	depth_order result;
+	result.exact = true;
+
+	auto* zmin = scratch.allocate_array<float>(spheres.size());
+
+	for (auto i = 0U; i < spheres.size(); ++i)
+	{
+		zmin[i] = sphere_bounds(spheres, i, ray_origin_z).min.z;
+
+		if (!(zmin[i] > ray_origin_z))
+			result.exact = false;
+	}
+
+	result.indices.resize(spheres.size());
+
+	for (auto i = 0U; i < spheres.size(); ++i)
+	{
+		result.indices[i] = i;
+	}
+
+	std::stable_sort(result.indices.begin(), result.indices.end(), [&](std::uint32_t l, std::uint32_t r)
+	{
+		return zmin[l] < zmin[r];
+	});
+
+	result.zmin.resize(spheres.size());
+
+	for (auto l = 0U; l < spheres.size(); ++l)
+	{
+		result.zmin[l] = zmin[result.indices[l]];
+	}
+
+	return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.h"
+#include "scene.h"
+
+// Spheres sorted front to back along +Z by the near side of their conservative bounds.
+// A ray walking the list can stop at the first sphere whose zmin - ray_origin_z exceeds
+// its maxt: no later sphere can have a smaller t0.
+struct depth_order
+{
+	// Sphere indices in ascending zmin order
+	std::vector<std::uint32_t> indices;
+	// zmin[l] is the lower z bound of sphere indices[l]
+	std::vector<float> zmin;
+	// True if every sphere lies entirely in front of the ray origin plane, see bvh::exact
+	bool exact = false;
+};
+
+// Sort the spheres by sphere_bounds(spheres, k, ray_origin_z).min.z, equal bounds keep index order.
+// The bounds of the sort go to scratch.
+depth_order build_depth_order(sphere_soa const& spheres, float ray_origin_z, frame_arena& scratch);
@@ -0,0 +1,230 @@
+#include "embree_bvh.h"
+
+#include <cmath>
+
+#ifdef RT_WITH_EMBREE
+#include <embree4/rtcore.h>
+
+namespace
+{
+	// What the bounds callback reads while rtcCommitScene builds the tree
+	struct sphere_input
+	{
+		sphere_soa const* spheres;
+		float ray_origin_z;
+	};
+
+	// Query context of a packet, Embree hands it to the intersect callback with the spheres
+	struct sphere_context
+	{
+		RTCRayQueryContext context;
+		sphere_soa const* spheres;
+	};
+
+	void sphere_box(RTCBoundsFunctionArguments const* args)
+	{
+		auto const& input = *static_cast<sphere_input const*>(args->geometryUserPtr);
+		auto box = sphere_bounds(*input.spheres, args->primID, input.ray_origin_z);
+
+		args->bounds_o->lower_x = box.min.x;
+		args->bounds_o->lower_y = box.min.y;
+		args->bounds_o->lower_z = box.min.z;
+		args->bounds_o->upper_x = box.max.x;
+		args->bounds_o->upper_y = box.max.y;
+		args->bounds_o->upper_z = box.max.z;
+	}
+
+	// Test sphere primID against the valid rays of a packet: the half-b roots of sphere_roots()
+	// in cpu_trace.cpp for rays along +Z and the acceptance of intersect_sphere_ordered(), so
+	// the closest hit is the one of the in-order loop whatever order Embree visits the leaves in
+	void sphere_intersect(RTCIntersectFunctionNArguments const* args)
+	{
+		auto const& spheres = *reinterpret_cast<sphere_context const*>(args->context)->spheres;
+		auto k = args->primID;
+		auto n = args->N;
+
+		RTCRayN* rays = RTCRayHitN_RayN(args->rayhit, n);
+		RTCHitN* hits = RTCRayHitN_HitN(args->rayhit, n);
+
+		for (unsigned l = 0; l < n; ++l)
+		{
+			if (args->valid[l] == 0)
+				continue;
+
+			float ox = RTCRayN_org_x(rays, n, l) - spheres.cx[k];
+			float oy = RTCRayN_org_y(rays, n, l) - spheres.cy[k];
+			float oz = RTCRayN_org_z(rays, n, l) - spheres.cz[k];
+
+			float c = ox * ox + oy * oy + oz * oz - spheres.radius2[k];
+			float d = oz * oz - c;
+
+			if (d < 0)
+				continue;
+
+			float sqrt_d = std::sqrt(d);
+			float t0 = -oz - sqrt_d;
+			float t1 = -oz + sqrt_d;
+
+			float& maxt = RTCRayN_tfar(rays, n, l);
+			int idx = RTCHitN_geomID(hits, n, l) == RTC_INVALID_GEOMETRY_ID ? -1 : static_cast<int>(RTCHitN_primID(hits, n, l));
+
+			if (t0 > maxt || t1 < 0.f || (t0 == maxt && static_cast<int>(k) < idx))
+				continue;
+
+			maxt = t0 > 0.f ? t0 : t1;
+			RTCHitN_primID(hits, n, l) = k;
+			RTCHitN_geomID(hits, n, l) = args->geomID;
+			RTCHitN_instID(hits, n, l, 0) = RTC_INVALID_GEOMETRY_ID;
+		}
+	}
+
+	// Trace the count pixels of row j of view from column i on, the ortho_rays of cpu_trace.cpp,
+	// as one packet of N rays through intersect and write their closest spheres to hits
+	template <class Packet, std::uint32_t N>
+	void trace_packet(RTCScene scene, void (*intersect)(int const*, RTCScene, Packet*, RTCIntersectArguments*), sphere_soa const& spheres,
+	                  ortho_view const& view, std::uint32_t i, std::uint32_t j, std::uint32_t count, int* hits)
+	{
+		sphere_context context;
+		rtcInitRayQueryContext(&context.context);
+		context.spheres = &spheres;
+
+		RTCIntersectArguments args;
+		rtcInitIntersectArguments(&args);
+		args.context = &context.context;
+
+		alignas(64) int valid[N];
+		Packet packet;
+
+		float oy = view.bottom + (view.height / view.image_height) * (j + 0.5f);
+
+		for (std::uint32_t l = 0; l < N; ++l)
+		{
+			valid[l] = l < count ? -1 : 0;
+
+			packet.ray.org_x[l] = view.left + (view.width / view.image_width) * ((i + l) + 0.5f);
+			packet.ray.org_y[l] = oy;
+			packet.ray.org_z[l] = view.near;
+			packet.ray.dir_x[l] = 0.f;
+			packet.ray.dir_y[l] = 0.f;
+			packet.ray.dir_z[l] = 1.f;
+			packet.ray.tnear[l] = 0.f;
+			packet.ray.tfar[l] = view.far - view.near;
+			packet.ray.time[l] = 0.f;
+			packet.ray.mask[l] = ~0U;
+			packet.ray.id[l] = l;
+			packet.ray.flags[l] = 0;
+			packet.hit.geomID[l] = RTC_INVALID_GEOMETRY_ID;
+			packet.hit.instID[0][l] = RTC_INVALID_GEOMETRY_ID;
+		}
+
+		intersect(valid, scene, &packet, &args);
+
+		for (std::uint32_t l = 0; l < count; ++l)
+		{
+			hits[l] = packet.hit.geomID[l] == RTC_INVALID_GEOMETRY_ID ? -1 : static_cast<int>(packet.hit.primID[l]);
+		}
+	}
+}
+
+struct embree_bvh::objects
+{
+	~objects()
+	{
+		if (scene)
+			rtcReleaseScene(scene);
+
+		if (device)
+			rtcReleaseDevice(device);
+	}
+
+	RTCDevice device = nullptr;
+	RTCScene scene = nullptr;
+	// User data of the geometry, its spheres only set during the build
+	sphere_input input = {};
+};
+#else
+struct embree_bvh::objects
+{
+};
+#endif
+
+embree_bvh::~embree_bvh() = default;
+
+void embree_bvh::closest(sphere_soa const& spheres, ortho_view const& view, std::uint32_t i, std::uint32_t j, std::uint32_t count, int* hits) const
+{
+#ifdef RT_WITH_EMBREE
+	switch (packet_width_)
+	{
+	case 16: trace_packet<RTCRayHit16, 16>(objects_->scene, rtcIntersect16, spheres, view, i, j, count, hits); break;
+	case 8: trace_packet<RTCRayHit8, 8>(objects_->scene, rtcIntersect8, spheres, view, i, j, count, hits); break;
+	default: trace_packet<RTCRayHit4, 4>(objects_->scene, rtcIntersect4, spheres, view, i, j, count, hits); break;
+	}
+#else
+	(void)spheres;
+	(void)view;
+	(void)i;
+	(void)j;
+
+	for (std::uint32_t l = 0; l < count; ++l)
+	{
+		hits[l] = -1;
+	}
+#endif
+}
+
+bool embree_available()
+{
+#ifdef RT_WITH_EMBREE
+	return true;
+#else
+	return false;
+#endif
+}
+
+std::shared_ptr<embree_bvh const> build_embree_bvh(sphere_soa const& spheres, ortho_view const& view)
+{
+#ifdef RT_WITH_EMBREE
+	std::shared_ptr<embree_bvh> bvh(new embree_bvh);
+	bvh->objects_.reset(new embree_bvh::objects);
+	auto& objects = *bvh->objects_;
+
+	objects.device = rtcNewDevice(nullptr);
+
+	if (!objects.device)
+		return nullptr;
+
+	objects.scene = rtcNewScene(objects.device);
+	objects.input = sphere_input{ &spheres, view.near };
+
+	// the robust box tests widen the boxes by their rounding, a ray grazing the box of a
+	// sphere it hits still visits it
+	rtcSetSceneFlags(objects.scene, RTC_SCENE_FLAG_ROBUST);
+
+	RTCGeometry geometry = rtcNewGeometry(objects.device, RTC_GEOMETRY_TYPE_USER);
+	rtcSetGeometryUserPrimitiveCount(geometry, static_cast<unsigned>(spheres.size()));
+	rtcSetGeometryUserData(geometry, &objects.input);
+	rtcSetGeometryBoundsFunction(geometry, sphere_box, nullptr);
+	rtcSetGeometryIntersectFunction(geometry, sphere_intersect);
+	rtcCommitGeometry(geometry);
+	rtcAttachGeometry(objects.scene, geometry);
+	rtcReleaseGeometry(geometry);
+
+	rtcCommitScene(objects.scene);
+	objects.input.spheres = nullptr;
+
+	if (rtcGetDeviceError(objects.device) != RTC_ERROR_NONE)
+		return nullptr;
+
+	// the widest packet Embree traces natively on this processor
+	if (rtcGetDeviceProperty(objects.device, RTC_DEVICE_PROPERTY_NATIVE_RAY16_SUPPORTED))
+		bvh->packet_width_ = 16;
+	else if (rtcGetDeviceProperty(objects.device, RTC_DEVICE_PROPERTY_NATIVE_RAY8_SUPPORTED))
+		bvh->packet_width_ = 8;
+
+	return bvh;
+#else
+	(void)spheres;
+	(void)view;
+	return nullptr;
+#endif
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "grid.h"
+#include "scene.h"
+
+// Widest ray packet embree_bvh traces, rtcIntersect16
+std::uint32_t const kMaxEmbreePacket = 16;
+
+// BVH of Intel Embree over a sphere set for the +Z rays of the ortho camera, the bvh mode of the
+// cpu backend with --backend embree (see render_scene::embree). The spheres are one user
+// geometry, primitive k the sphere k in its sphere_bounds() box, so Embree's SIMD builders build
+// the tree on all cores and its packet traversal walks it; the intersect callback tests a sphere
+// with the roots of the CPU tracers and keeps the closest hit with ties to the higher index, the
+// image of all_spheres. Embree's native sphere points are left alone: their test rounds
+// differently. The rays of a row are traced in packets as wide as the Embree build and the
+// processor support, rtcIntersect16 on AVX-512, rtcIntersect8 on AVX2, rtcIntersect4 otherwise.
+// Only built with RT_WITH_EMBREE, otherwise build_embree_bvh returns null.
+class embree_bvh
+{
+public:
+	~embree_bvh();
+
+	// Rays of a packet, 4, 8 or 16
+	std::uint32_t packet_width() const
+	{
+		return packet_width_;
+	}
+
+	// Closest sphere of spheres, the set the BVH was built over, for the count <= packet_width()
+	// pixels of row j of view from column i on, -1 where the ray hits none
+	void closest(sphere_soa const& spheres, ortho_view const& view, std::uint32_t i, std::uint32_t j, std::uint32_t count, int* hits) const;
+
+private:
+	friend std::shared_ptr<embree_bvh const> build_embree_bvh(sphere_soa const& spheres, ortho_view const& view);
+
+	embree_bvh() = default;
+
+	// Embree device, scene and geometry, opaque so this header doesn't need Embree
+	struct objects;
+	std::unique_ptr<objects> objects_;
+	std::uint32_t packet_width_ = 4;
+};
+
+// True if the program is built with RT_WITH_EMBREE
+bool embree_available();
+
+// Embree BVH over spheres for the rays of view starting on view.near, or null if the program
+// has no Embree or the build fails. The spheres must lie beyond view.near, as for an exact
+// build_bvh, so that the hit doesn't depend on the order Embree visits them in.
+std::shared_ptr<embree_bvh const> build_embree_bvh(sphere_soa const& spheres, ortho_view const& view);
@@ -0,0 +1,65 @@
+#include "framebuffer_pool.h"
+
+#include <algorithm>
+
+framebuffer_pool::framebuffer_pool(std::size_t max_buffers)
+	: max_buffers_(std::max<std::size_t>(max_buffers, 1U))
+{
+}
+
+std::vector<unsigned char> framebuffer_pool::acquire(std::size_t size)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		// the most recently released buffer is the likeliest to still be in the cache
+		for (auto b = free_.rbegin(); b != free_.rend(); ++b)
+		{
+			if (b->size() == size)
+			{
+				auto buffer = std::move(*b);
+				free_.erase(std::next(b).base());
+				++reused_;
+				return buffer;
+			}
+		}
+
+		++allocated_;
+	}
+
+	return std::vector<unsigned char>(size);
+}
+
+void framebuffer_pool::release(std::vector<unsigned char> buffer)
+{
+	if (buffer.empty())
+		return;
+
+	std::vector<unsigned char> dropped;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		free_.push_back(std::move(buffer));
+
+		if (free_.size() > max_buffers_)
+		{
+			dropped = std::move(free_.front());
+			free_.pop_front();
+		}
+	}
+
+	// the dropped buffer is freed outside the lock
+}
+
+std::size_t framebuffer_pool::reused() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return reused_;
+}
+
+std::size_t framebuffer_pool::allocated() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return allocated_;
+}
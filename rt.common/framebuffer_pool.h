@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Recycles framebuffers between frames and jobs: a frame handed to the writer comes back once
+// it is written and the next frame of the same size renders into it, so its pages are neither
+// allocated nor zeroed again. Buffers are kept by size, at most max_buffers of them, the
+// longest unused ones are freed first. acquire() and release() may be called from any thread.
+class framebuffer_pool
+{
+public:
+	explicit framebuffer_pool(std::size_t max_buffers = 4);
+
+	framebuffer_pool(framebuffer_pool const&) = delete;
+	framebuffer_pool& operator=(framebuffer_pool const&) = delete;
+
+	// A buffer of size bytes: a released one of that size with the contents of its last frame,
+	// or a new zeroed one if there is none
+	std::vector<unsigned char> acquire(std::size_t size);
+
+	// Keep buffer for a later acquire() of its size
+	void release(std::vector<unsigned char> buffer);
+
+	// acquire() calls served from the pool and ones that allocated
+	std::size_t reused() const;
+	std::size_t allocated() const;
+
+private:
+	std::size_t max_buffers_;
+	mutable std::mutex mutex_;
+	// Released buffers, the most recent at the back
+	std::deque<std::vector<unsigned char>> free_;
+	std::size_t reused_ = 0;
+	std::size_t allocated_ = 0;
+};
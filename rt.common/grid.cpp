@@ -0,0 +1,242 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace
+{
+	// First and last pixel along one axis whose center lies in [lo, hi], widened by one
+	// pixel so rounding in the ray origin computation can't move a pixel out of range.
+	// Returns false if no pixel of the image is covered.
+	bool pixel_span(float lo, float hi, float origin, float pixel_size, std::uint32_t num_pixels, std::int64_t& first, std::int64_t& last)
+	{
+		first = static_cast<std::int64_t>(std::floor((lo - origin) / pixel_size - 0.5f)) - 1;
+		last = static_cast<std::int64_t>(std::ceil((hi - origin) / pixel_size - 0.5f)) + 1;
+
+		first = std::max<std::int64_t>(first, 0);
+		last = std::min<std::int64_t>(last, static_cast<std::int64_t>(num_pixels) - 1);
+
+		return first <= last;
+	}
+}
+
+bool sphere_footprint(sphere_soa const& spheres, std::uint32_t k, ortho_view const& view, pixel_rect& rect)
+{
+	auto bounds = sphere_bounds(spheres, k, view.near);
+
+	std::int64_t i0, i1, j0, j1;
+
+	rect = pixel_rect{ 0, 0, 0, 0 };
+
+	if (!pixel_span(bounds.min.x, bounds.max.x, view.left, view.width / view.image_width, view.image_width, i0, i1) ||
+	    !pixel_span(bounds.min.y, bounds.max.y, view.bottom, view.height / view.image_height, view.image_height, j0, j1))
+		return false;
+
+	rect.x0 = static_cast<std::int32_t>(i0);
+	rect.y0 = static_cast<std::int32_t>(j0);
+	rect.x1 = static_cast<std::int32_t>(i1) + 1;
+	rect.y1 = static_cast<std::int32_t>(j1) + 1;
+
+	return true;
+}
+
+std::vector<pixel_rect> sphere_footprints(sphere_soa const& spheres, ortho_view const& view)
+{
+	std::vector<pixel_rect> rects(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		sphere_footprint(spheres, k, view, rects[k]);
+	}
+
+	return rects;
+}
+
+bool spheres_beyond_near(sphere_soa const& spheres, ortho_view const& view)
+{
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		if (sphere_bounds(spheres, k, view.near).min.z <= view.near)
+			return false;
+	}
+
+	return true;
+}
+
+sphere_grid build_grid(sphere_soa const& spheres, ortho_view const& view, frame_arena& scratch, std::uint32_t cell_size)
+{
+	sphere_grid grid;
+	grid.cell_size = std::max(cell_size, 1U);
+	grid.cells_x = (view.image_width + grid.cell_size - 1) / grid.cell_size;
+	grid.cells_y = (view.image_height + grid.cell_size - 1) / grid.cell_size;
+
+	auto num_cells = grid.cells_x * grid.cells_y;
+	grid.cell_start.assign(num_cells + 1, 0U);
+
+	// Pixel footprints, each covers the cells its first to last pixel fall in
+	auto* rects = scratch.allocate_array<pixel_rect>(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		sphere_footprint(spheres, k, view, rects[k]);
+	}
+
+	auto cell_loop = [&](std::uint32_t k, std::function<void(std::uint32_t)> const& fn)
+	{
+		auto const& rect = rects[k];
+
+		if (rect.x0 == rect.x1)
+			return;
+
+		for (auto y = rect.y0 / grid.cell_size; y <= (rect.y1 - 1) / grid.cell_size; ++y)
+		{
+			for (auto x = rect.x0 / grid.cell_size; x <= (rect.x1 - 1) / grid.cell_size; ++x)
+			{
+				fn(y * grid.cells_x + x);
+			}
+		}
+	};
+
+	// Count the spheres of every cell
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		cell_loop(k, [&](std::uint32_t c)
+		{
+			++grid.cell_start[c + 1];
+		});
+	}
+
+	for (auto c = 0U; c < num_cells; ++c)
+	{
+		grid.cell_start[c + 1] += grid.cell_start[c];
+	}
+
+	// Scatter sphere indices, visiting spheres in order keeps every cell list sorted
+	grid.indices.resize(grid.cell_start[num_cells]);
+	auto* fill = scratch.allocate_array<std::uint32_t>(num_cells);
+	std::copy(grid.cell_start.begin(), grid.cell_start.end() - 1, fill);
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		cell_loop(k, [&](std::uint32_t c)
+		{
+			grid.indices[fill[c]++] = k;
+		});
+	}
+
+	return grid;
+}
+
+std::uint32_t prune_grid_depth(sphere_grid& grid, sphere_soa const& spheres, ortho_view const& view)
+{
+	std::vector<Imath::Box3f> bounds(spheres.size());
+	std::vector<float> inner(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		bounds[k] = sphere_bounds(spheres, k, view.near);
+		inner[k] = sphere_inner_radius(spheres, k, view.near);
+	}
+
+	double step_x = double(view.width) / view.image_width;
+	double step_y = double(view.height) / view.image_height;
+
+	auto num_cells = grid.cells_x * grid.cells_y;
+	auto total = static_cast<std::uint32_t>(grid.indices.size());
+	std::uint32_t kept = 0;
+
+	for (auto c = 0U; c < num_cells; ++c)
+	{
+		auto first = grid.cell_start[c];
+		auto last = grid.cell_start[c + 1];
+		grid.cell_start[c] = kept;
+
+		// the rays of the cell, the pixel centers of its pixels within the image
+		auto x0 = (c % grid.cells_x) * grid.cell_size;
+		auto y0 = (c / grid.cells_x) * grid.cell_size;
+		auto x1 = std::min(x0 + grid.cell_size, view.image_width);
+		auto y1 = std::min(y0 + grid.cell_size, view.image_height);
+
+		double left = view.left + step_x * (x0 + 0.5), right = view.left + step_x * (x1 - 0.5);
+		double bottom = view.bottom + step_y * (y0 + 0.5), top = view.bottom + step_y * (y1 - 0.5);
+
+		// bound of the first hits of the cell: a ray meeting o has t0 at most the distance to its
+		// center, the rounding margin of its bounds on top keeps the bound strict
+		float depth = view.far;
+
+		for (auto n = first; n < last; ++n)
+		{
+			auto o = grid.indices[n];
+
+			if (bounds[o].min.z <= view.near)
+				continue;
+
+			double dx = std::max(std::fabs(left - spheres.cx[o]), std::fabs(right - spheres.cx[o]));
+			double dy = std::max(std::fabs(bottom - spheres.cy[o]), std::fabs(top - spheres.cy[o]));
+
+			if (dx * dx + dy * dy < double(inner[o]) * inner[o])
+				depth = std::min(depth, bounds[o].max.z - spheres.radius[o]);
+		}
+
+		for (auto n = first; n < last; ++n)
+		{
+			auto k = grid.indices[n];
+
+			if (!(bounds[k].min.z > depth))
+				grid.indices[kept++] = k;
+		}
+	}
+
+	grid.cell_start[num_cells] = kept;
+	grid.indices.resize(kept);
+
+	return total - kept;
+}
+
+std::vector<std::uint32_t> build_coverage(sphere_soa const& spheres, ortho_view const& view)
+{
+	std::vector<std::uint32_t> coverage((std::size_t(view.image_width) * view.image_height + 31) / 32, 0U);
+
+	float step_x = view.width / view.image_width;
+	float step_y = view.height / view.image_height;
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		pixel_rect rect;
+
+		if (!sphere_footprint(spheres, k, view, rect))
+			continue;
+
+		auto bounds = sphere_bounds(spheres, k, view.near);
+		double radius = 0.5 * (double(bounds.max.x) - bounds.min.x);
+		double cx = 0.5 * (double(bounds.max.x) + bounds.min.x);
+		double cy = 0.5 * (double(bounds.max.y) + bounds.min.y);
+
+		for (auto j = rect.y0; j < rect.y1; ++j)
+		{
+			// the ray of the row lies within a pixel of its center, take the nearest y of that band
+			double y = view.bottom + double(step_y) * (j + 0.5);
+			double dy = std::max(std::fabs(y - cy) - step_y, 0.0);
+
+			if (dy > radius)
+				continue;
+
+			auto half = static_cast<float>(std::sqrt(radius * radius - dy * dy));
+			std::int64_t i0, i1;
+
+			if (!pixel_span(static_cast<float>(cx) - half, static_cast<float>(cx) + half, view.left, step_x, view.image_width, i0, i1))
+				continue;
+
+			auto row = std::size_t(j) * view.image_width;
+
+			for (auto i = i0; i <= i1; ++i)
+			{
+				auto p = row + static_cast<std::size_t>(i);
+				coverage[p / 32] |= 1U << (p % 32);
+			}
+		}
+	}
+
+	return coverage;
+}
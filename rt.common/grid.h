@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.h"
+#include "scene.h"
+
+// Orthographic +Z view. The image of image_width x image_height pixels covers
+// [left, left + width] x [bottom, bottom + height], rays start at z = near and end at z = far.
+struct ortho_view
+{
+	float left, bottom, width, height, near, far;
+	std::uint32_t image_width, image_height;
+};
+
+// Half-open pixel rectangle [x0, x1) x [y0, y1), layout matches int4 in trace.cl
+struct pixel_rect
+{
+	std::int32_t x0, y0, x1, y1;
+};
+
+// Pixels whose rays may hit sphere k, clipped to the image. Returns false and an
+// empty rectangle if the sphere covers no pixel.
+bool sphere_footprint(sphere_soa const& spheres, std::uint32_t k, ortho_view const& view, pixel_rect& rect);
+
+// Footprints of all spheres, indexed by sphere
+std::vector<pixel_rect> sphere_footprints(sphere_soa const& spheres, ortho_view const& view);
+
+// True if every sphere lies beyond the near plane of view: no ray starts inside one, each hit
+// is the first root and the closest one wins whatever order the spheres are tested in
+bool spheres_beyond_near(sphere_soa const& spheres, ortho_view const& view);
+
+// Screen-space grid of cell_size x cell_size pixel cells. Each cell lists, in
+// ascending index order, every sphere whose footprint may cover one of its pixels.
+// Pixel (i, j) reads cell (i / cell_size, j / cell_size), so testing the spheres of
+// a cell in list order gives exactly the hit of the full sphere loop.
+struct sphere_grid
+{
+	std::uint32_t cell_size;
+	std::uint32_t cells_x, cells_y;
+	// Spheres of cell c are indices[cell_start[c]] .. indices[cell_start[c + 1] - 1]
+	std::vector<std::uint32_t> cell_start;
+	std::vector<std::uint32_t> indices;
+};
+
+// Bin the spheres into the grid with two counting passes, linear in the number
+// of (sphere, cell) pairs. The footprints and fill positions of the passes go to scratch.
+sphere_grid build_grid(sphere_soa const& spheres, ortho_view const& view, frame_arena& scratch, std::uint32_t cell_size = 16);
+
+// Hierarchical-Z pass over the lists of grid: bound the farthest first hit of every cell by
+// the spheres of its list that every ray of the cell meets, by the inner disc of
+// sphere_inner_radius(), in front of the near plane's side: a ray meets one no farther than
+// its center. Then drop from the list each sphere whose sphere_bounds() lie beyond the bound,
+// it loses the maxt comparison of every pixel of the cell. The lists keep their order, the
+// image is the same. Returns the entries dropped.
+std::uint32_t prune_grid_depth(sphere_grid& grid, sphere_soa const& spheres, ortho_view const& view);
+
+// One bit per pixel of view, set where a ray may hit a sphere: bit p % 32 of word p / 32 for
+// pixel p = j * image_width + i. Each sphere sets the pixels of its disc, the footprint row
+// by row through the circle of its sphere_bounds() widened by the pixel of slack the
+// footprint has, so a clear bit is a pixel every tracer leaves to the background.
+std::vector<std::uint32_t> build_coverage(sphere_soa const& spheres, ortho_view const& view);
+
+// Whether pixel p of a build_coverage() mask may see a sphere
+inline bool pixel_covered(std::uint32_t const* coverage, std::size_t p)
+{
+	return ((coverage[p / 32] >> (p % 32)) & 1U) != 0;
+}
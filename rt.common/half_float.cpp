@@ -0,0 +1,67 @@
+#include "half_float.h"
+
+#include <cmath>
+#include <cstring>
+
+std::uint16_t float_to_half(float value)
+{
+	std::uint32_t f;
+	std::memcpy(&f, &value, sizeof(f));
+
+	auto sign = static_cast<std::uint16_t>(f >> 16 & 0x8000);
+	auto magnitude = f & 0x7FFFFFFF;
+
+	// infinity, and NaN with the top of its payload and the quiet bit
+	if (magnitude >= 0x7F800000)
+		return static_cast<std::uint16_t>(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 | (magnitude >> 13 & 0x3FF) : 0));
+
+	// 65520, halfway between the largest half 65504 and 65536, and beyond round to infinity
+	if (magnitude >= 0x477FF000)
+		return static_cast<std::uint16_t>(sign | 0x7C00);
+
+	// below 2^-14 the result is a multiple of the smallest subnormal, 2^-24; up to 2^-25 it
+	// rounds to zero
+	if (magnitude < 0x38800000)
+	{
+		if (magnitude <= 0x33000000)
+			return sign;
+
+		auto mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+		auto shift = 126 - (magnitude >> 23);
+		auto result = mantissa >> shift;
+		auto rest = mantissa & ((1U << shift) - 1);
+		auto halfway = 1U << (shift - 1);
+
+		if (rest > halfway || (rest == halfway && (result & 1) != 0))
+			++result;
+
+		return static_cast<std::uint16_t>(sign | result);
+	}
+
+	// the exponent rebiased from 127 to 15; a mantissa rounding up carries into it
+	auto result = (magnitude >> 13) - (112U << 10);
+	auto rest = magnitude & 0x1FFF;
+
+	if (rest > 0x1000 || (rest == 0x1000 && (result & 1) != 0))
+		++result;
+
+	return static_cast<std::uint16_t>(sign | result);
+}
+
+float half_to_float(std::uint16_t bits)
+{
+	std::uint32_t sign = std::uint32_t(bits & 0x8000) << 16;
+	std::uint32_t exponent = bits >> 10 & 0x1F;
+	std::uint32_t mantissa = bits & 0x3FF;
+
+	if (exponent == 0)
+	{
+		auto value = std::ldexp(static_cast<float>(mantissa), -24);
+		return sign != 0 ? -value : value;
+	}
+
+	std::uint32_t f = sign | (exponent == 0x1F ? 0x7F800000 | mantissa << 13 : (exponent + 112) << 23 | mantissa << 13);
+	float value;
+	std::memcpy(&value, &f, sizeof(value));
+	return value;
+}
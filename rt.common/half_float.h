@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// IEEE 754 binary16 bits of value rounded to nearest, ties to even, the conversion of the half
+// type OIIO writes fp16 files with: values from 65520 on overflow to infinity, ones below
+// 2^-14 become subnormals, NaNs stay NaNs
+std::uint16_t float_to_half(float value);
+
+// Float value of the binary16 bits, exact for every one of them
+float half_to_float(std::uint16_t bits);
@@ -0,0 +1,60 @@
+#include "half_spheres.h"
+
+#include <cmath>
+
+#include "half_float.h"
+
+namespace
+{
+	// Relative slack covering the float rounding of the tracers' disc and depth tests
+	float const kDiscSlack = 1.f / (1 << 20);
+
+	// Bits of the nearest fp16 value at or above value: the nearest one, moved a step up when it
+	// lies below, toward zero for a negative one
+	std::uint16_t round_up(float value)
+	{
+		auto bits = float_to_half(value);
+
+		if (half_to_float(bits) < value)
+			bits = static_cast<std::uint16_t>((bits & 0x8000) != 0 ? bits - 1 : bits + 1);
+
+		return bits;
+	}
+
+	// Bits of the nearest fp16 value at or below value
+	std::uint16_t round_down(float value)
+	{
+		return static_cast<std::uint16_t>(round_up(-value) ^ 0x8000);
+	}
+}
+
+std::vector<half_sphere> compress_spheres(sphere_soa const& spheres, float ray_origin_z)
+{
+	std::vector<half_sphere> halves(spheres.size());
+
+	for (auto k = 0U; k < spheres.size(); ++k)
+	{
+		auto bounds = sphere_bounds(spheres, k, ray_origin_z);
+
+		// the centers round to nearest, the disc widens by the distance that moved them
+		auto x = float_to_half(spheres.cx[k]);
+		auto y = float_to_half(spheres.cy[k]);
+		float fx = half_to_float(x);
+		float fy = half_to_float(y);
+
+		float moved = std::hypot(fx - spheres.cx[k], fy - spheres.cy[k]);
+		float radius = 0.5f * (bounds.max.x - bounds.min.x) + moved;
+		radius += (std::fabs(fx) + std::fabs(fy) + radius) * kDiscSlack;
+
+		float zmin = bounds.min.z - (std::fabs(bounds.min.z) + std::fabs(ray_origin_z)) * kDiscSlack;
+
+		halves[k] = half_sphere{ x, y, round_down(zmin), round_up(radius) };
+	}
+
+	return halves;
+}
+
+float half_value(std::uint16_t bits)
+{
+	return half_to_float(bits);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "scene.h"
+
+// Sphere of a sphere_soa in 8 bytes of fp16 bits, read as half4 by vload_half4 in trace.cl:
+// the center x and y rounded to nearest, zmin the lower z bound of sphere_bounds() rounded
+// down, and radius the half width of those bounds plus the distance the rounding moved the
+// center, rounded up. A ray whose origin lies outside the disc of radius around (x, y), or
+// whose maxt ends before zmin - ray_origin_z, can't get a hit from the float test of the
+// sphere, so the tracers skip the test; the centers and radii in float are only read for
+// the spheres that pass and the image is the same.
+struct half_sphere
+{
+	std::uint16_t x, y, zmin, radius;
+};
+
+// The half_sphere of every sphere for +Z rays starting on the plane z = ray_origin_z. Centers
+// of the generated scenes lie in [-10, 10] and radii in [0.15, 1.65], at most a few thousandths
+// away from their fp16 values.
+std::vector<half_sphere> compress_spheres(sphere_soa const& spheres, float ray_origin_z);
+
+// Float value of the fp16 bits of a half_sphere field
+float half_value(std::uint16_t bits);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Largest resident set of the process so far in bytes: the peak working set on Windows,
+// ru_maxrss elsewhere. 0 if the system can't tell.
+std::size_t peak_host_rss();
@@ -0,0 +1,117 @@
+#include "image_compare.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imagebufalgo.h>
+
+namespace
+{
+	// Float bits mapped to integers in the same order as the floats, so adjacent floats
+	// are adjacent integers and -0 sits next to +0
+	std::uint32_t ordered_bits(float value)
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return (bits & 0x80000000U) != 0 ? ~bits : bits | 0x80000000U;
+	}
+
+	std::uint32_t ulp_distance(float a, float b)
+	{
+		auto ia = ordered_bits(a);
+		auto ib = ordered_bits(b);
+		return ia > ib ? ia - ib : ib - ia;
+	}
+
+	void set_max_error(OIIO_NAMESPACE::ImageBufAlgo::CompareResults const& results, image_diff& diff)
+	{
+		diff.max_error = results.maxerror;
+		diff.max_x = results.maxx;
+		diff.max_y = results.maxy;
+	}
+}
+
+image_diff compare_images(float const* image, float const* reference, std::uint32_t width, std::uint32_t height, std::uint32_t max_ulps)
+{
+	OIIO_NAMESPACE_USING;
+
+	image_diff diff = {};
+
+	// both wrap the pixels in place, nothing is copied
+	ImageSpec spec(width, height, 3, TypeDesc::FLOAT);
+	ImageBuf a(spec, const_cast<float*>(image));
+	ImageBuf b(spec, const_cast<float*>(reference));
+
+	ImageBufAlgo::CompareResults results;
+	ImageBufAlgo::compare(a, b, 0.f, 0.f, results);
+	set_max_error(results, diff);
+
+	// compare() only knows absolute thresholds, the float steps are counted here
+	std::size_t size = std::size_t(width) * height * 3;
+
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		auto ulps = ulp_distance(image[i], reference[i]);
+
+		diff.max_ulps = std::max(diff.max_ulps, ulps);
+
+		if (ulps > max_ulps)
+			++diff.failed;
+	}
+
+	return diff;
+}
+
+bool compare_image_files(std::string const& file, std::string const& reference, float threshold, image_diff& diff)
+{
+	OIIO_NAMESPACE_USING;
+
+	diff = image_diff{};
+
+	ImageBuf a(file);
+	ImageBuf b(reference);
+
+	if (!a.read() || !b.read())
+	{
+		std::cout << "Failed to read " << file << " or " << reference << "\n";
+		return false;
+	}
+
+	auto const& sa = a.spec();
+	auto const& sb = b.spec();
+
+	if (sa.width != sb.width || sa.height != sb.height)
+	{
+		std::cout << file << " is " << sa.width << "x" << sa.height << ", " << reference << " is " << sb.width << "x" << sb.height << "\n";
+		return false;
+	}
+
+	// an rgba8 file against an rgb reference: compare just the color channels
+	ImageBufAlgo::CompareResults results;
+	ImageBufAlgo::compare(a, b, threshold, threshold, results, ROI(0, sa.width, 0, sa.height, 0, 1, 0, std::min(std::min(sa.nchannels, sb.nchannels), 3)));
+
+	set_max_error(results, diff);
+	diff.failed = results.nfail;
+
+	return true;
+}
+
+bool check_image_file(std::string const& file, std::string const& reference, float threshold)
+{
+	image_diff diff;
+	if (!compare_image_files(file, reference, threshold, diff))
+		return false;
+
+	std::cout << file << " against " << reference << ": ";
+
+	if (diff.failed == 0)
+	{
+		std::cout << "passed, max error " << diff.max_error << "\n";
+		return true;
+	}
+
+	std::cout << "FAILED, " << diff.failed << " channels differ, max error " << diff.max_error << " at (" << diff.max_x << ", " << diff.max_y << ")\n";
+	return false;
+}
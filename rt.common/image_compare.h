@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Differences of an image from its reference
+struct image_diff
+{
+	// Channels outside the tolerance
+	std::uint64_t failed;
+	// Largest absolute difference of a channel and the pixel it is in
+	double max_error;
+	int max_x, max_y;
+	// Largest distance between two float channels in units in the last place
+	std::uint32_t max_ulps;
+};
+
+// Compare the float rgb image of width x height pixels against reference with
+// ImageBufAlgo::compare. Channels more than max_ulps float steps apart fail, so 0
+// accepts bit-identical images only.
+image_diff compare_images(float const* image, float const* reference, std::uint32_t width, std::uint32_t height, std::uint32_t max_ulps);
+
+// Compare the image file against the reference file, channels that differ by more than
+// threshold fail. Returns false if either file can't be read or their sizes differ.
+bool compare_image_files(std::string const& file, std::string const& reference, float threshold, image_diff& diff);
+
+// compare_image_files() with the result printed. Returns true if file matches reference.
+bool check_image_file(std::string const& file, std::string const& reference, float threshold);
@@ -0,0 +1,563 @@
+#include "image_encoders.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <emmintrin.h>
+
+namespace
+{
+	void put_u32_be(std::string& out, std::uint32_t value)
+	{
+		char bytes[4] = { static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8), static_cast<char>(value) };
+		out.append(bytes, sizeof(bytes));
+	}
+
+	// QOI
+
+	unsigned char const kQoiIndex = 0x00;
+	unsigned char const kQoiDiff = 0x40;
+	unsigned char const kQoiLuma = 0x80;
+	unsigned char const kQoiRun = 0xc0;
+	unsigned char const kQoiRgb = 0xfe;
+	unsigned char const kQoiRgba = 0xff;
+	int const kQoiMaxRun = 62;
+
+	struct qoi_pixel
+	{
+		unsigned char r, g, b, a;
+
+		bool operator==(qoi_pixel const& other) const
+		{
+			return r == other.r && g == other.g && b == other.b && a == other.a;
+		}
+
+		int hash() const
+		{
+			return (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+		}
+	};
+
+	// PNG
+
+	// CRC-32 of the PNG chunks, table driven
+	struct crc_table
+	{
+		std::uint32_t entries[256];
+
+		crc_table()
+		{
+			for (std::uint32_t n = 0; n < 256; ++n)
+			{
+				auto c = n;
+
+				for (int k = 0; k < 8; ++k)
+				{
+					c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+				}
+
+				entries[n] = c;
+			}
+		}
+	};
+
+	std::uint32_t crc32(std::uint32_t crc, char const* data, std::size_t size)
+	{
+		static crc_table const table;
+
+		crc = ~crc;
+
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+		}
+
+		return ~crc;
+	}
+
+	std::uint32_t const kAdlerBase = 65521;
+
+	std::uint32_t adler32(unsigned char const* data, std::size_t size)
+	{
+		std::uint32_t a = 1, b = 0;
+
+		// the sums stay below 2^32 for 5552 bytes between reductions, see zlib
+		while (size > 0)
+		{
+			auto n = std::min<std::size_t>(size, 5552);
+			size -= n;
+
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				a += data[i];
+				b += a;
+			}
+
+			data += n;
+			a %= kAdlerBase;
+			b %= kAdlerBase;
+		}
+
+		return (b << 16) | a;
+	}
+
+	// Adler-32 of two pieces of data from the ones of the pieces, adler2 over size2 bytes, see zlib's adler32_combine
+	std::uint32_t adler32_combine(std::uint32_t adler1, std::uint32_t adler2, std::size_t size2)
+	{
+		auto rem = static_cast<std::uint32_t>(size2 % kAdlerBase);
+		auto sum1 = adler1 & 0xffff;
+		auto sum2 = static_cast<std::uint32_t>((std::uint64_t(rem) * sum1) % kAdlerBase);
+
+		sum1 += (adler2 & 0xffff) + kAdlerBase - 1;
+		sum2 += (adler1 >> 16) + (adler2 >> 16) + kAdlerBase - rem;
+
+		if (sum1 >= kAdlerBase)
+			sum1 -= kAdlerBase;
+
+		if (sum1 >= kAdlerBase)
+			sum1 -= kAdlerBase;
+
+		if (sum2 >= (kAdlerBase << 1))
+			sum2 -= kAdlerBase << 1;
+
+		if (sum2 >= kAdlerBase)
+			sum2 -= kAdlerBase;
+
+		return (sum2 << 16) | sum1;
+	}
+
+	// Fixed Huffman codes of deflate (RFC 1951 3.2.6), bit reversed for the LSB first stream
+	struct fixed_codes
+	{
+		// Literal/length symbols 0 to 287
+		std::uint16_t code[288];
+		std::uint8_t bits[288];
+		// Symbol and extra bits of match lengths 3 to 258
+		std::uint16_t length_symbol[259];
+		std::uint8_t length_extra_bits[259];
+		std::uint16_t length_extra[259];
+
+		static std::uint16_t reverse(std::uint32_t code, int bits)
+		{
+			std::uint32_t result = 0;
+
+			for (int i = 0; i < bits; ++i)
+			{
+				result |= ((code >> i) & 1) << (bits - 1 - i);
+			}
+
+			return static_cast<std::uint16_t>(result);
+		}
+
+		fixed_codes()
+		{
+			for (std::uint32_t s = 0; s < 288; ++s)
+			{
+				if (s < 144)
+				{
+					code[s] = reverse(0x30 + s, 8);
+					bits[s] = 8;
+				}
+				else if (s < 256)
+				{
+					code[s] = reverse(0x190 + s - 144, 9);
+					bits[s] = 9;
+				}
+				else if (s < 280)
+				{
+					code[s] = reverse(s - 256, 7);
+					bits[s] = 7;
+				}
+				else
+				{
+					code[s] = reverse(0xc0 + s - 280, 8);
+					bits[s] = 8;
+				}
+			}
+
+			static std::uint16_t const base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static std::uint8_t const extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+			for (int length = 3; length <= 258; ++length)
+			{
+				// 258 has a symbol of its own, 284 stops at 257
+				int i = 28;
+
+				while (base[i] > length)
+				{
+					--i;
+				}
+
+				length_symbol[length] = static_cast<std::uint16_t>(257 + i);
+				length_extra_bits[length] = extra[i];
+				length_extra[length] = static_cast<std::uint16_t>(length - base[i]);
+			}
+		}
+	};
+
+	// Deflate bit stream, least significant bit first
+	class bit_writer
+	{
+	public:
+		explicit bit_writer(std::string& out)
+			: out_(out)
+		{
+		}
+
+		void put(std::uint32_t value, int bits)
+		{
+			buffer_ |= std::uint64_t(value) << count_;
+			count_ += bits;
+
+			while (count_ >= 8)
+			{
+				out_.push_back(static_cast<char>(buffer_ & 0xff));
+				buffer_ >>= 8;
+				count_ -= 8;
+			}
+		}
+
+		// Pad to the next byte with zero bits
+		void align()
+		{
+			if (count_ > 0)
+				put(0, 8 - count_);
+		}
+
+	private:
+		std::string& out_;
+		std::uint64_t buffer_ = 0;
+		int count_ = 0;
+	};
+
+	// Compress size bytes of data into one fixed Huffman block, not the last one, followed by
+	// an empty stored block that ends it on a byte
+	void deflate_band(unsigned char const* data, std::size_t size, std::string& out)
+	{
+		static fixed_codes const codes;
+
+		bit_writer bits(out);
+
+		// BFINAL 0, BTYPE 01
+		bits.put(0, 1);
+		bits.put(1, 2);
+
+		auto literal = [&](unsigned symbol)
+		{
+			bits.put(codes.code[symbol], codes.bits[symbol]);
+		};
+
+		for (std::size_t i = 0; i < size;)
+		{
+			// run of the previous byte: a match of distance 1
+			std::size_t run = 0;
+
+			if (i > 0)
+			{
+				auto limit = std::min<std::size_t>(258, size - i);
+
+				while (run < limit && data[i + run] == data[i - 1])
+				{
+					++run;
+				}
+			}
+
+			if (run >= 3)
+			{
+				literal(codes.length_symbol[run]);
+				bits.put(codes.length_extra[run], codes.length_extra_bits[run]);
+				// distance code 0, five zero bits
+				bits.put(0, 5);
+				i += run;
+			}
+			else
+			{
+				literal(data[i]);
+				++i;
+			}
+		}
+
+		// end of block
+		literal(256);
+
+		// BFINAL 0, BTYPE 00, LEN 0 and NLEN 0xffff
+		bits.put(0, 3);
+		bits.align();
+		out.append("\x00\x00\xff\xff", 4);
+	}
+
+	void put_chunk(std::string& out, char const* type, std::string const& data)
+	{
+		put_u32_be(out, static_cast<std::uint32_t>(data.size()));
+
+		auto start = out.size();
+		out.append(type, 4);
+		out.append(data);
+
+		put_u32_be(out, crc32(0, out.data() + start, out.size() - start));
+	}
+}
+
+void quantize_rgb8(float const* src, std::size_t count, std::size_t pixel_stride, unsigned char* dst)
+{
+	auto quantize = [](float value)
+	{
+		// a NaN fails both comparisons
+		float scaled = value * 255.f + 0.5f;
+		return static_cast<unsigned char>(scaled > 0.f ? (scaled < 255.f ? scaled : 255.f) : 0.f);
+	};
+
+	std::size_t done = 0;
+
+	// packed rgb is one run of channels, 16 of them become one store
+	if (pixel_stride == 3 * sizeof(float))
+	{
+		auto channels = count * 3;
+		__m128 const scale = _mm_set1_ps(255.f);
+		__m128 const half = _mm_set1_ps(0.5f);
+		__m128 const zero = _mm_setzero_ps();
+
+		auto convert = [&](float const* from)
+		{
+			// max returns its second operand for a NaN
+			__m128 scaled = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from), scale), half);
+			return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(scaled, zero), scale));
+		};
+
+		for (; done + 16 <= channels; done += 16)
+		{
+			__m128i low = _mm_packs_epi32(convert(src + done), convert(src + done + 4));
+			__m128i high = _mm_packs_epi32(convert(src + done + 8), convert(src + done + 12));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + done), _mm_packus_epi16(low, high));
+		}
+
+		for (; done < channels; ++done)
+		{
+			dst[done] = quantize(src[done]);
+		}
+
+		return;
+	}
+
+	auto bytes = reinterpret_cast<unsigned char const*>(src);
+
+	for (std::size_t p = 0; p < count; ++p)
+	{
+		float rgb[3];
+		std::memcpy(rgb, bytes + p * pixel_stride, sizeof(rgb));
+
+		dst[p * 3] = quantize(rgb[0]);
+		dst[p * 3 + 1] = quantize(rgb[1]);
+		dst[p * 3 + 2] = quantize(rgb[2]);
+	}
+}
+
+void encode_ppm(unsigned char const* pixels, std::uint32_t width, std::uint32_t height, int, std::size_t pixel_stride, std::string& out)
+{
+	out = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+	auto header = out.size();
+	auto num_pixels = std::size_t(width) * height;
+	out.resize(header + num_pixels * 3);
+
+	for (std::size_t p = 0; p < num_pixels; ++p)
+	{
+		std::memcpy(&out[header + p * 3], pixels + p * pixel_stride, 3);
+	}
+}
+
+void put_qoi_header(std::uint32_t width, std::uint32_t height, int channels, std::string& out)
+{
+	out.append("qoif", 4);
+	put_u32_be(out, width);
+	put_u32_be(out, height);
+	out.push_back(static_cast<char>(channels));
+	// sRGB with linear alpha
+	out.push_back(0);
+}
+
+void put_qoi_end(std::string& out)
+{
+	out.append("\x00\x00\x00\x00\x00\x00\x00\x01", 8);
+}
+
+void encode_qoi(unsigned char const* pixels, std::uint32_t width, std::uint32_t height, int channels, std::size_t pixel_stride, std::string& out)
+{
+	out.clear();
+	out.reserve(std::size_t(width) * height + 64);
+
+	put_qoi_header(width, height, channels, out);
+
+	qoi_pixel index[64] = {};
+	qoi_pixel previous = { 0, 0, 0, 255 };
+	int run = 0;
+
+	auto num_pixels = std::size_t(width) * height;
+
+	for (std::size_t p = 0; p < num_pixels; ++p)
+	{
+		auto source = pixels + p * pixel_stride;
+		qoi_pixel px = { source[0], source[1], source[2], static_cast<unsigned char>(channels == 4 ? source[3] : 255) };
+
+		if (px == previous)
+		{
+			++run;
+
+			if (run == kQoiMaxRun || p + 1 == num_pixels)
+			{
+				out.push_back(static_cast<char>(kQoiRun | (run - 1)));
+				run = 0;
+			}
+
+			continue;
+		}
+
+		if (run > 0)
+		{
+			out.push_back(static_cast<char>(kQoiRun | (run - 1)));
+			run = 0;
+		}
+
+		auto slot = px.hash();
+
+		if (index[slot] == px)
+		{
+			out.push_back(static_cast<char>(kQoiIndex | slot));
+		}
+		else
+		{
+			index[slot] = px;
+
+			if (px.a == previous.a)
+			{
+				// wrapping differences, as the format defines them
+				auto dr = static_cast<signed char>(px.r - previous.r);
+				auto dg = static_cast<signed char>(px.g - previous.g);
+				auto db = static_cast<signed char>(px.b - previous.b);
+				auto dr_dg = static_cast<signed char>(dr - dg);
+				auto db_dg = static_cast<signed char>(db - dg);
+
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+				{
+					out.push_back(static_cast<char>(kQoiDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+				}
+				else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+				{
+					out.push_back(static_cast<char>(kQoiLuma | (dg + 32)));
+					out.push_back(static_cast<char>((dr_dg + 8) << 4 | (db_dg + 8)));
+				}
+				else
+				{
+					char bytes[4] = { static_cast<char>(kQoiRgb), static_cast<char>(px.r), static_cast<char>(px.g), static_cast<char>(px.b) };
+					out.append(bytes, 4);
+				}
+			}
+			else
+			{
+				char bytes[5] = { static_cast<char>(kQoiRgba), static_cast<char>(px.r), static_cast<char>(px.g), static_cast<char>(px.b), static_cast<char>(px.a) };
+				out.append(bytes, 5);
+			}
+		}
+
+		previous = px;
+	}
+
+	put_qoi_end(out);
+}
+
+void put_png_header(std::uint32_t width, std::uint32_t height, int channels, std::string& out)
+{
+	out.append("\x89PNG\r\n\x1a\n", 8);
+
+	std::string header;
+	put_u32_be(header, width);
+	put_u32_be(header, height);
+	// 8 bits, rgb or rgba, deflate, adaptive filtering, not interlaced
+	char const format[5] = { 8, static_cast<char>(channels == 4 ? 6 : 2), 0, 0, 0 };
+	header.append(format, sizeof(format));
+	put_chunk(out, "IHDR", header);
+
+	// zlib header: deflate with a 32K window, no dictionary, fastest level
+	put_chunk(out, "IDAT", std::string("\x78\x01", 2));
+}
+
+void put_png_end(std::uint32_t adler, std::string& out)
+{
+	// an empty last fixed Huffman block and the Adler-32 of all rows
+	std::string trailer("\x03\x00", 2);
+	put_u32_be(trailer, adler);
+	put_chunk(out, "IDAT", trailer);
+
+	put_chunk(out, "IEND", std::string());
+}
+
+void encode_png(unsigned char const* pixels, std::uint32_t width, std::uint32_t height, int channels, std::size_t pixel_stride, thread_pool& pool,
+                std::string& out)
+{
+	auto row_bytes = std::size_t(width) * channels;
+	auto num_bands = (height + kPngBandRows - 1) / kPngBandRows;
+
+	// IDAT chunk and Adler-32 of the filtered rows of every band
+	std::vector<std::string> bands(num_bands);
+	std::vector<std::uint32_t> adlers(num_bands);
+	std::vector<std::size_t> sizes(num_bands);
+
+	std::vector<tile> tiles;
+
+	for (std::uint32_t b = 0; b < num_bands; ++b)
+	{
+		tiles.push_back(tile{ 0, b * kPngBandRows, width, std::min((b + 1) * kPngBandRows, height) });
+	}
+
+	pool.run(tiles, [&](tile const& t)
+	{
+		auto b = t.y0 / kPngBandRows;
+
+		// filter type byte and the row minus the row above it, the first row of the image as it is
+		std::vector<unsigned char> filtered((row_bytes + 1) * (t.y1 - t.y0));
+		auto* row = filtered.data();
+
+		for (auto y = t.y0; y < t.y1; ++y)
+		{
+			auto source = pixels + pixel_stride * width * y;
+			row[0] = y == 0 ? 0 : 2;
+
+			for (std::uint32_t x = 0; x < width; ++x)
+			{
+				for (int c = 0; c < channels; ++c)
+				{
+					auto value = source[pixel_stride * x + c];
+					auto above = y == 0 ? 0 : source[pixel_stride * x + c - pixel_stride * width];
+					row[1 + x * channels + c] = static_cast<unsigned char>(value - above);
+				}
+			}
+
+			row += row_bytes + 1;
+		}
+
+		adlers[b] = adler32(filtered.data(), filtered.size());
+		sizes[b] = filtered.size();
+
+		std::string deflated;
+		deflate_band(filtered.data(), filtered.size(), deflated);
+		put_chunk(bands[b], "IDAT", deflated);
+	});
+
+	auto adler = adlers[0];
+
+	for (std::uint32_t b = 1; b < num_bands; ++b)
+	{
+		adler = adler32_combine(adler, adlers[b], sizes[b]);
+	}
+
+	out.clear();
+	put_png_header(width, height, channels, out);
+
+	for (auto const& band : bands)
+	{
+		out.append(band);
+	}
+
+	put_png_end(adler, out);
+}
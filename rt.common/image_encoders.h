@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "thread_pool.h"
+
+// Encoders image_writer uses instead of OIIO for 8-bit images, when encoding time matters more
+// than file size. All read width x height pixels of channels 8-bit channels (3 or 4), pixel_stride
+// bytes apart, so the rgb of an rgba framebuffer is read in place.
+
+// Rows of the image each task of encode_png compresses
+std::uint32_t const kPngBandRows = 64;
+
+// Quantize count rgb float pixels, pixel_stride bytes apart, to the 8-bit rgb of dst as OIIO
+// converts float to uint8: clamped to [0, 1], scaled by 255 and rounded, NaN to 0. Packed rgb
+// floats are converted 16 channels at a time with SSE2.
+void quantize_rgb8(float const* src, std::size_t count, std::size_t pixel_stride, unsigned char* dst);
+
+// Encode the image as a binary PPM file (P6) into out, the rgb of every pixel
+void encode_ppm(unsigned char const* pixels, std::uint32_t width, std::uint32_t height, int channels, std::size_t pixel_stride, std::string& out);
+
+// Encode the image as a QOI file (https://qoiformat.org) into out
+void encode_qoi(unsigned char const* pixels, std::uint32_t width, std::uint32_t height, int channels, std::size_t pixel_stride, std::string& out);
+
+// Encode the image as a PNG file into out, compressing bands of kPngBandRows rows on the threads
+// of pool. Every row uses the Up filter and every band is one deflate block with the fixed Huffman
+// codes whose only matches are runs of a repeated byte, closed by an empty stored block so the
+// next band starts on a byte: the file stays a plain zlib stream, the Adler-32 of the bands
+// is combined afterwards and each band is an IDAT chunk of its own. Files are larger than with
+// zlib's levels, the flat backgrounds still shrink to a few bits per pixel.
+void encode_png(unsigned char const* pixels, std::uint32_t width, std::uint32_t height, int channels, std::size_t pixel_stride, thread_pool& pool,
+                std::string& out);
+
+// The parts of the files of encode_qoi and encode_png around their compressed pixels, appended
+// to out, for pixels compressed elsewhere in the same way (encode_frame of the OpenCL
+// renderer). A QOI file is its header, the chunks of the pixels and its end marker. A PNG file
+// is the signature, the IHDR chunk and an IDAT chunk holding the zlib header, the IDAT chunks
+// of the deflate blocks, none of them the last one, and the end: an empty last block and adler,
+// the Adler-32 of all filtered rows, in an IDAT chunk of their own and the IEND chunk.
+void put_qoi_header(std::uint32_t width, std::uint32_t height, int channels, std::string& out);
+void put_qoi_end(std::string& out);
+void put_png_header(std::uint32_t width, std::uint32_t height, int channels, std::string& out);
+void put_png_end(std::uint32_t adler, std::string& out);
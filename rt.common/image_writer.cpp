@@ -0,0 +1,727 @@
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "image_encoders.h"
+#include "profile_markers.h"
+#include "timeline.h"
+
+namespace
+{
+	// Scanlines handed to the encoder per call
+	int const kScanlineChunk = 64;
+
+	// A checkpoint of tiled_image_writer is kCheckpointMagic, the size of the manifest as a
+	// std::uint64_t and the manifest, then a checkpoint_record and its pixels per band
+	char const kCheckpointMagic[8] = { 'r', 't', 'c', 'k', 'p', 't', '1', '\0' };
+
+	struct checkpoint_record
+	{
+		std::uint32_t y_begin, y_end;
+		std::uint64_t pixel_stride;
+		std::uint64_t size;
+	};
+
+	// Bytes of the bands copied at a time when a checkpoint is cut back to its whole records
+	std::size_t const kCopyChunk = std::size_t(1) << 20;
+
+	// Lower case extension of file without the dot, empty if it has none
+	std::string file_extension(std::string const& file)
+	{
+		auto dot = file.find_last_of('.');
+		auto slash = file.find_last_of("/\\");
+
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return std::string();
+
+		auto extension = file.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return extension;
+	}
+
+	// File of MIP level level of file when the levels go to files of their own, file with the
+	// level number before its extension
+	std::string level_file_name(std::string const& file, std::size_t level)
+	{
+		auto extension = file_extension(file);
+		auto stem = extension.empty() ? file : file.substr(0, file.size() - extension.size() - 1);
+		return stem + "." + std::to_string(level) + (extension.empty() ? std::string() : file.substr(stem.size()));
+	}
+}
+
+bool uses_fast_encoder(std::string const& file, image_encoding const& encoding)
+{
+	auto extension = file_extension(file);
+	return extension == "qoi" || extension == "ppm" || extension == "pnm" || (extension == "png" && encoding.fast_png && encoding.png_level < 0);
+}
+
+bool uses_png_encoder(std::string const& file, image_encoding const& encoding)
+{
+	return file_extension(file) == "png" && encoding.fast_png && encoding.png_level < 0;
+}
+
+bool requires_fast_encoder(std::string const& file)
+{
+	return file_extension(file) == "qoi";
+}
+
+image_writer::image_writer(std::size_t max_pending, framebuffer_pool* pool, image_encoding const& encoding)
+	: max_pending_(std::max<std::size_t>(max_pending, 1U))
+	, pool_(pool)
+	, encoding_(encoding)
+	, thread_(&image_writer::writer_main, this)
+{
+}
+
+image_writer::~image_writer()
+{
+	finish();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+
+	queue_cv_.notify_all();
+	thread_.join();
+}
+
+void image_writer::write(std::string const& file, OIIO_NAMESPACE::ImageSpec const& spec, std::vector<unsigned char> pixels, std::size_t pixel_stride)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.size() < max_pending_; });
+
+	queue_.push_back(job{ file, spec, std::move(pixels), pixel_stride, {}, {} });
+	queue_cv_.notify_all();
+}
+
+void image_writer::write(std::string const& file, OIIO_NAMESPACE::ImageSpec const& spec, std::vector<unsigned char> pixels, std::vector<std::vector<unsigned char>> levels,
+                         std::size_t pixel_stride)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.size() < max_pending_; });
+
+	queue_.push_back(job{ file, spec, std::move(pixels), pixel_stride, std::move(levels), {} });
+	queue_cv_.notify_all();
+}
+
+void image_writer::write(std::string const& file, std::string bytes)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.size() < max_pending_; });
+
+	queue_.push_back(job{ file, OIIO_NAMESPACE::ImageSpec(), {}, 0, {}, std::move(bytes) });
+	queue_cv_.notify_all();
+}
+
+bool image_writer::finish()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.empty() && !busy_; });
+
+	return !failed_;
+}
+
+image_writer::stats image_writer::totals()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return totals_;
+}
+
+void image_writer::writer_main()
+{
+	name_timeline_thread("image writer");
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	for (;;)
+	{
+		queue_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+		if (queue_.empty())
+			return;
+
+		job j = std::move(queue_.front());
+		queue_.pop_front();
+		busy_ = true;
+
+		// a slot is free again
+		done_cv_.notify_all();
+
+		stats times = {};
+
+		lock.unlock();
+
+		profile_push("encode");
+		bool ok = !j.bytes.empty() ? write_bytes(j.file, j.bytes, times) : j.levels.empty() ? write_job(j, times) : write_levels(j, times);
+		profile_pop();
+
+		if (pool_)
+			pool_->release(std::move(j.pixels));
+
+		lock.lock();
+
+		totals_.images += ok ? 1 : 0;
+		totals_.encode_time += times.encode_time;
+		totals_.file_time += times.file_time;
+		failed_ = failed_ || !ok;
+		busy_ = false;
+		done_cv_.notify_all();
+	}
+}
+
+bool image_writer::write_job(job const& j, stats& times)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto elapsed = [](clock::time_point start) { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+	// the encoders store the whole image, a region keeps its place with OIIO
+	bool whole = j.spec.x == 0 && j.spec.y == 0 && j.spec.full_width == j.spec.width && j.spec.full_height == j.spec.height;
+
+	if (uses_fast_encoder(j.file, encoding_) && whole)
+	{
+		bool eight_bit = j.spec.format == OIIO_NAMESPACE::TypeDesc::UINT8 && (j.spec.nchannels == 3 || j.spec.nchannels == 4);
+
+		if (eight_bit)
+			return write_encoded(j, times);
+
+		// float rgb, float4 through its stride, is quantized here as OIIO would
+		if (j.spec.format == OIIO_NAMESPACE::TypeDesc::FLOAT && j.spec.nchannels == 3)
+		{
+			auto quantize_start = clock::now();
+			auto num_pixels = std::size_t(j.spec.width) * j.spec.height;
+
+			job quantized{ j.file, j.spec, std::vector<unsigned char>(num_pixels * 3), 3, {}, {} };
+			quantized.spec.set_format(OIIO_NAMESPACE::TypeDesc::UINT8);
+			quantize_rgb8(reinterpret_cast<float const*>(&j.pixels[0]), num_pixels, j.pixel_stride, &quantized.pixels[0]);
+
+			times.encode_time += elapsed(quantize_start);
+			return write_encoded(quantized, times);
+		}
+
+		// other PNG and PPM files go through OIIO
+		if (requires_fast_encoder(j.file))
+		{
+			std::cout << "Can't write " << j.file << ": QOI files store 8-bit rgb or rgba pixels\n";
+			return false;
+		}
+	}
+
+	auto open_start = clock::now();
+
+	std::unique_ptr<OIIO_NAMESPACE::ImageOutput> out(OIIO_NAMESPACE::ImageOutput::create(j.file));
+
+	if (!out)
+	{
+		std::cout << "Can't create image file on disk\n";
+		return false;
+	}
+
+	auto spec = j.spec;
+
+	if (encoding_.png_level >= 0)
+		spec.attribute("png:compressionLevel", std::min(encoding_.png_level, 9));
+
+	if (!out->open(j.file, spec))
+	{
+		std::cout << "Can't open " << j.file << ": " << out->geterror() << "\n";
+		return false;
+	}
+
+	times.file_time += elapsed(open_start);
+
+	auto row_size = static_cast<OIIO_NAMESPACE::stride_t>(j.pixel_stride) * j.spec.width;
+	bool ok = true;
+
+	auto encode_start = clock::now();
+
+	// chunks of scanlines keep the encoder's working set small
+	for (int y = 0; y < j.spec.height && ok; y += kScanlineChunk)
+	{
+		int y_end = std::min(y + kScanlineChunk, j.spec.height);
+		ok = out->write_scanlines(y, y_end, 0, j.spec.format, &j.pixels[0] + row_size * y, static_cast<OIIO_NAMESPACE::stride_t>(j.pixel_stride), row_size);
+	}
+
+	times.encode_time += elapsed(encode_start);
+
+	auto close_start = clock::now();
+	ok = out->close() && ok;
+	times.file_time += elapsed(close_start);
+
+	if (!ok)
+	{
+		std::cout << "Can't write " << j.file << ": " << out->geterror() << "\n";
+	}
+
+	return ok;
+}
+
+bool image_writer::write_levels(job& j, stats& times)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto elapsed = [](clock::time_point start) { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+	auto levels = std::move(j.levels);
+	j.levels.clear();
+
+	auto open_start = clock::now();
+
+	std::unique_ptr<OIIO_NAMESPACE::ImageOutput> out(uses_fast_encoder(j.file, encoding_) ? nullptr : OIIO_NAMESPACE::ImageOutput::create(j.file));
+
+	if (!out || !out->supports("mipmap") || !out->supports("tiles"))
+	{
+		// the image keeps its name, each level gets a file of its own
+		bool ok = write_job(j, times);
+		auto spec = j.spec;
+
+		for (std::size_t l = 0; l < levels.size(); ++l)
+		{
+			spec.width = spec.full_width = spec.width / 2;
+			spec.height = spec.full_height = spec.height / 2;
+
+			job level{ level_file_name(j.file, l + 1), spec, std::move(levels[l]), j.pixel_stride, {}, {} };
+			ok = write_job(level, times) && ok;
+		}
+
+		return ok;
+	}
+
+	auto spec = j.spec;
+	spec.tile_width = spec.tile_height = kMipTileSize;
+
+	bool ok = out->open(j.file, spec);
+	times.file_time += elapsed(open_start);
+
+	auto encode_start = clock::now();
+	ok = ok && out->write_image(spec.format, &j.pixels[0], static_cast<OIIO_NAMESPACE::stride_t>(j.pixel_stride));
+
+	for (std::size_t l = 0; l < levels.size() && ok; ++l)
+	{
+		spec.width = spec.full_width = spec.width / 2;
+		spec.height = spec.full_height = spec.height / 2;
+
+		ok = out->open(j.file, spec, OIIO_NAMESPACE::ImageOutput::AppendMIPLevel) &&
+		     out->write_image(spec.format, &levels[l][0], static_cast<OIIO_NAMESPACE::stride_t>(j.pixel_stride));
+	}
+
+	times.encode_time += elapsed(encode_start);
+
+	auto close_start = clock::now();
+	ok = out->close() && ok;
+	times.file_time += elapsed(close_start);
+
+	if (!ok)
+	{
+		std::cout << "Can't write " << j.file << ": " << out->geterror() << "\n";
+	}
+
+	return ok;
+}
+
+bool image_writer::write_encoded(job const& j, stats& times)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto elapsed = [](clock::time_point start) { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+	auto encode_start = clock::now();
+
+	std::string encoded;
+	auto width = static_cast<std::uint32_t>(j.spec.width);
+	auto height = static_cast<std::uint32_t>(j.spec.height);
+
+	auto extension = file_extension(j.file);
+
+	if (extension == "qoi")
+	{
+		encode_qoi(&j.pixels[0], width, height, j.spec.nchannels, j.pixel_stride, encoded);
+	}
+	else if (extension == "ppm" || extension == "pnm")
+	{
+		encode_ppm(&j.pixels[0], width, height, j.spec.nchannels, j.pixel_stride, encoded);
+	}
+	else
+	{
+		if (!encode_pool_)
+			encode_pool_.reset(new thread_pool(encoding_.threads != 0 ? encoding_.threads : std::thread::hardware_concurrency()));
+
+		encode_png(&j.pixels[0], width, height, j.spec.nchannels, j.pixel_stride, *encode_pool_, encoded);
+	}
+
+	times.encode_time += elapsed(encode_start);
+
+	return write_bytes(j.file, encoded, times);
+}
+
+bool image_writer::write_bytes(std::string const& file, std::string const& bytes, stats& times)
+{
+	auto file_start = std::chrono::high_resolution_clock::now();
+
+	std::ofstream out(file, std::ios::binary);
+	out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+	out.close();
+
+	times.file_time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - file_start).count();
+
+	if (!out)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+tiled_image_writer::tiled_image_writer(std::size_t max_pending)
+	: max_pending_(std::max<std::size_t>(max_pending, 1U))
+	, thread_(&tiled_image_writer::writer_main, this)
+{
+}
+
+tiled_image_writer::~tiled_image_writer()
+{
+	finish();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+
+	queue_cv_.notify_all();
+	thread_.join();
+}
+
+bool tiled_image_writer::open(std::string const& file, OIIO_NAMESPACE::ImageSpec const& spec)
+{
+	auto open_start = std::chrono::high_resolution_clock::now();
+
+	std::unique_ptr<OIIO_NAMESPACE::ImageOutput> out(OIIO_NAMESPACE::ImageOutput::create(file));
+
+	if (!out)
+	{
+		std::cout << "Can't create image file on disk\n";
+		return false;
+	}
+
+	if (!out->supports("tiles"))
+	{
+		std::cout << file << ": the format doesn't store tiles, use .exr or .tif\n";
+		return false;
+	}
+
+	if (!out->open(file, spec))
+	{
+		std::cout << "Can't open " << file << ": " << out->geterror() << "\n";
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	out_ = std::move(out);
+	spec_ = spec;
+	file_ = file;
+	failed_ = false;
+	file_time_ += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - open_start).count();
+	return true;
+}
+
+std::vector<unsigned char> tiled_image_writer::take_buffer()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (free_.empty())
+		return std::vector<unsigned char>();
+
+	auto buffer = std::move(free_.back());
+	free_.pop_back();
+	return buffer;
+}
+
+bool tiled_image_writer::resume(std::string const& file, std::string const& manifest)
+{
+	std::string header(kCheckpointMagic, sizeof(kCheckpointMagic));
+	std::uint64_t manifest_size = manifest.size();
+	header.append(reinterpret_cast<char const*>(&manifest_size), sizeof(manifest_size));
+	header += manifest;
+
+	auto row_limit = static_cast<std::uint32_t>(spec_.height);
+	std::uint64_t row_bytes_limit = static_cast<std::uint64_t>(spec_.width) * (spec_.nchannels + 1) * sizeof(double);
+
+	// the whole records of a checkpoint of the same image, anything after them was cut off
+	std::vector<std::pair<checkpoint_record, std::uint64_t>> records;
+	std::uint64_t valid = 0, file_size = 0;
+
+	{
+		std::ifstream in(file, std::ios::binary | std::ios::ate);
+
+		if (in)
+		{
+			file_size = static_cast<std::uint64_t>(in.tellg());
+			in.seekg(0);
+
+			std::string read(header.size(), '\0');
+
+			if (in.read(&read[0], read.size()) && read == header)
+				valid = header.size();
+		}
+
+		checkpoint_record r;
+
+		while (valid != 0 && in.read(reinterpret_cast<char*>(&r), sizeof(r)))
+		{
+			// a band of the image, no larger than its rows of doubles with alpha
+			if (r.y_end <= r.y_begin || r.y_end > row_limit || r.size == 0 || r.size > row_bytes_limit * (r.y_end - r.y_begin) ||
+			    valid + sizeof(r) + r.size > file_size)
+				break;
+
+			records.emplace_back(r, valid + sizeof(r));
+			valid += sizeof(r) + r.size;
+			in.seekg(static_cast<std::streamoff>(valid));
+		}
+	}
+
+	if (valid == 0)
+	{
+		// not a checkpoint of this image, start a new one
+		checkpoint_.open(file, std::ios::binary | std::ios::trunc);
+		checkpoint_.write(header.data(), header.size());
+	}
+	else if (valid < file_size)
+	{
+		// keep the whole records, written to a new file that replaces the old one
+		std::string cut = file + ".tmp";
+
+		{
+			std::ifstream in(file, std::ios::binary);
+			std::ofstream out(cut, std::ios::binary | std::ios::trunc);
+			std::vector<char> chunk(kCopyChunk);
+
+			for (std::uint64_t copied = 0; copied < valid && in && out;)
+			{
+				auto size = static_cast<std::size_t>(std::min<std::uint64_t>(chunk.size(), valid - copied));
+				in.read(&chunk[0], size);
+				out.write(&chunk[0], size);
+				copied += size;
+			}
+
+			if (!out.flush())
+			{
+				std::cout << "Can't write the checkpoint " << cut << "\n";
+				return false;
+			}
+		}
+
+		std::remove(file.c_str());
+
+		if (std::rename(cut.c_str(), file.c_str()) != 0)
+		{
+			std::cout << "Can't replace the checkpoint " << file << "\n";
+			return false;
+		}
+
+		checkpoint_.open(file, std::ios::binary | std::ios::app);
+	}
+	else
+	{
+		checkpoint_.open(file, std::ios::binary | std::ios::app);
+	}
+
+	if (!checkpoint_.flush())
+	{
+		std::cout << "Can't write the checkpoint " << file << "\n";
+		checkpoint_.close();
+		return false;
+	}
+
+	checkpoint_file_ = file;
+
+	// the restored bands go to the image file like rendered ones
+	std::ifstream in(file, std::ios::binary);
+
+	for (auto const& record : records)
+	{
+		auto const& r = record.first;
+		std::vector<unsigned char> pixels(static_cast<std::size_t>(r.size));
+
+		in.seekg(static_cast<std::streamoff>(record.second));
+
+		if (!in.read(reinterpret_cast<char*>(&pixels[0]), pixels.size()))
+		{
+			std::cout << "Can't read the checkpoint " << file << "\n";
+			return false;
+		}
+
+		restored_.insert(r.y_begin);
+		queue_band(band{ r.y_begin, r.y_end, std::move(pixels), static_cast<std::size_t>(r.pixel_stride), true, {}, {} });
+	}
+
+	return true;
+}
+
+void tiled_image_writer::write_band(std::uint32_t y_begin, std::uint32_t y_end, std::vector<unsigned char> pixels, std::size_t pixel_stride)
+{
+	queue_band(band{ y_begin, y_end, std::move(pixels), pixel_stride, false, {}, {} });
+}
+
+void tiled_image_writer::write_sparse_band(std::uint32_t y_begin, std::uint32_t y_end, std::vector<unsigned char> pixels, std::vector<bool> stored,
+                                           std::vector<unsigned char> background, std::size_t pixel_stride)
+{
+	queue_band(band{ y_begin, y_end, std::move(pixels), pixel_stride, false, std::move(stored), std::move(background) });
+}
+
+void tiled_image_writer::queue_band(band b)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.size() < max_pending_; });
+
+	queue_.push_back(std::move(b));
+	queue_cv_.notify_all();
+}
+
+bool tiled_image_writer::finish()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.empty() && !busy_; });
+
+	if (!out_)
+		return !failed_;
+
+	auto close_start = std::chrono::high_resolution_clock::now();
+
+	if (!out_->close())
+	{
+		std::cout << "Can't write " << file_ << ": " << out_->geterror() << "\n";
+		failed_ = true;
+	}
+
+	out_.reset();
+	file_time_ += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - close_start).count();
+
+	// the file holds every band now
+	if (checkpoint_.is_open())
+	{
+		checkpoint_.close();
+
+		if (!failed_)
+			std::remove(checkpoint_file_.c_str());
+	}
+
+	return !failed_;
+}
+
+void tiled_image_writer::writer_main()
+{
+	name_timeline_thread("tiled image writer");
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	for (;;)
+	{
+		queue_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+		if (queue_.empty())
+			return;
+
+		band b = std::move(queue_.front());
+		queue_.pop_front();
+		busy_ = true;
+
+		// a slot is free again
+		done_cv_.notify_all();
+
+		auto* out = out_.get();
+		bool ok = out != nullptr && !failed_;
+
+		lock.unlock();
+
+		auto encode_start = std::chrono::high_resolution_clock::now();
+		profile_range range("encode");
+
+		if (ok)
+			ok = write_tiles(b);
+
+		// flushed record by record, so a killed process leaves every band written before
+		if (ok && !b.restored && b.stored.empty() && checkpoint_.is_open())
+		{
+			checkpoint_record r = { b.y_begin, b.y_end, b.pixel_stride, b.pixels.size() };
+			checkpoint_.write(reinterpret_cast<char const*>(&r), sizeof(r));
+			checkpoint_.write(reinterpret_cast<char const*>(&b.pixels[0]), b.pixels.size());
+
+			if (!checkpoint_.flush())
+			{
+				std::cout << "Can't write the checkpoint " << checkpoint_file_ << ", rendering on without it\n";
+				checkpoint_.close();
+			}
+		}
+
+		double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encode_start).count();
+
+		lock.lock();
+
+		encode_time_ += time;
+		failed_ = failed_ || !ok;
+		free_.push_back(std::move(b.pixels));
+		busy_ = false;
+		done_cv_.notify_all();
+	}
+}
+
+bool tiled_image_writer::write_tiles(band const& b)
+{
+	auto* out = out_.get();
+	auto stride = static_cast<OIIO_NAMESPACE::stride_t>(b.pixel_stride);
+	bool ok = true;
+
+	// the band is whole tile rows, the last one clipped to the image
+	if (b.stored.empty())
+	{
+		ok = out->write_tiles(0, spec_.width, static_cast<int>(b.y_begin), static_cast<int>(b.y_end), 0, 1, spec_.format, &b.pixels[0], stride,
+		                      stride * spec_.width);
+	}
+	else
+	{
+		auto tile_size = std::size_t(spec_.tile_width) * spec_.tile_height * b.pixel_stride;
+
+		// the background tile is filled once for every run of bands of the same background
+		if (background_pixel_ != b.background)
+		{
+			background_pixel_ = b.background;
+			background_tile_.resize(tile_size);
+
+			for (std::size_t p = 0; p < tile_size; p += b.pixel_stride)
+			{
+				std::copy(b.background.begin(), b.background.end(), background_tile_.begin() + p);
+			}
+		}
+
+		std::size_t next = 0;
+
+		for (std::size_t t = 0; t < b.stored.size() && ok; ++t)
+		{
+			int x_begin = static_cast<int>(t) * spec_.tile_width;
+			int x_end = std::min(x_begin + spec_.tile_width, spec_.width);
+			unsigned char const* tile = b.stored[t] ? &b.pixels[tile_size * next++] : &background_tile_[0];
+
+			ok = out->write_tiles(x_begin, x_end, static_cast<int>(b.y_begin), static_cast<int>(b.y_end), 0, 1, spec_.format, tile, stride,
+			                      stride * spec_.tile_width);
+		}
+	}
+
+	if (!ok)
+	{
+		std::cout << "Can't write " << file_ << ": " << out->geterror() << "\n";
+	}
+
+	return ok;
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <OpenImageIO/imageio.h>
+
+#include "framebuffer_pool.h"
+#include "thread_pool.h"
+
+// How image_writer encodes its files
+struct image_encoding
+{
+	// zlib level of OIIO's PNG writer, from 0 (stored) to 9, -1 for OIIO's default of 6. The
+	// level is the png:compressionLevel attribute of the spec.
+	int png_level = -1;
+	// Write PNG files with encode_png on threads threads instead of OIIO, unless png_level asks
+	// for a zlib level; 0 threads for one per hardware thread. QOI and PPM files are always
+	// written by encode_qoi and encode_ppm. Float rgb pixels are quantized by quantize_rgb8 for
+	// them, images of other channel types and data windows off the origin go through OIIO.
+	bool fast_png = true;
+	std::uint32_t threads = 0;
+};
+
+// True if file is written by one of the encoders of image_encoders.h with encoding, which
+// take 8-bit rgb or rgba pixels only
+bool uses_fast_encoder(std::string const& file, image_encoding const& encoding);
+
+// True if file is a PNG file written by encode_png with encoding
+bool uses_png_encoder(std::string const& file, image_encoding const& encoding);
+
+// True if file has no OIIO writer to fall back to for pixels the encoders don't take, a QOI file
+bool requires_fast_encoder(std::string const& file);
+
+// Tile edge of the files image_writer writes with MIP levels
+int const kMipTileSize = 64;
+
+// Encodes and writes images on a background thread, so the next frame renders while the
+// previous one is compressed. Images are written in the order they were queued.
+class image_writer
+{
+public:
+	// At most max_pending images wait for the writer, write() blocks while the queue is full.
+	// Written pixels are released to pool, if there is one, for the next frame to render into.
+	explicit image_writer(std::size_t max_pending = 2, framebuffer_pool* pool = nullptr, image_encoding const& encoding = image_encoding());
+	// Writes everything still queued
+	~image_writer();
+
+	image_writer(image_writer const&) = delete;
+	image_writer& operator=(image_writer const&) = delete;
+
+	// Queue pixels, laid out as described by spec with pixel_stride bytes per pixel, to be
+	// written to file. The writer takes ownership of the pixels.
+	void write(std::string const& file, OIIO_NAMESPACE::ImageSpec const& spec, std::vector<unsigned char> pixels, std::size_t pixel_stride);
+
+	// Same with levels, the smaller MIP levels of the image in the same layout, each half the
+	// width and height of the one before, rounded down. Formats that store MIP levels (TIFF,
+	// OpenEXR) get one file of kMipTileSize tiles holding all of them, the others a file per
+	// level with its number before the extension, e.g. result.1.png next to result.png.
+	void write(std::string const& file, OIIO_NAMESPACE::ImageSpec const& spec, std::vector<unsigned char> pixels, std::vector<std::vector<unsigned char>> levels,
+	           std::size_t pixel_stride);
+
+	// Queue bytes, a file already encoded elsewhere (encode_frame of the OpenCL renderer), to be
+	// written to file as they are
+	void write(std::string const& file, std::string bytes);
+
+	// Wait until every queued image is written. Returns false if any of them failed.
+	bool finish();
+
+	// Images written so far and their time in ms: in the encoder, which streams to the file
+	// as it goes, and opening and closing (flushing) the files
+	struct stats
+	{
+		std::size_t images;
+		double encode_time;
+		double file_time;
+	};
+
+	stats totals();
+
+private:
+	struct job
+	{
+		std::string file;
+		OIIO_NAMESPACE::ImageSpec spec;
+		std::vector<unsigned char> pixels;
+		std::size_t pixel_stride;
+		std::vector<std::vector<unsigned char>> levels;
+		// The whole file if it came encoded, no pixels then
+		std::string bytes;
+	};
+
+	void writer_main();
+	bool write_job(job const& j, stats& times);
+	// Write j and its MIP levels, moving the levels out of it
+	bool write_levels(job& j, stats& times);
+	// Write j with encode_qoi or encode_png
+	bool write_encoded(job const& j, stats& times);
+	// Write the encoded bytes to file
+	bool write_bytes(std::string const& file, std::string const& bytes, stats& times);
+
+	std::size_t max_pending_;
+	framebuffer_pool* pool_;
+	image_encoding encoding_;
+	// Threads of encode_png, started with the first file it writes
+	std::unique_ptr<thread_pool> encode_pool_;
+	std::deque<job> queue_;
+	bool busy_ = false;
+	bool failed_ = false;
+	bool stop_ = false;
+	stats totals_ = {};
+	std::mutex mutex_;
+	std::condition_variable queue_cv_;
+	std::condition_variable done_cv_;
+	std::thread thread_;
+};
+
+// Streams one image into a tiled file (OpenEXR, TIFF) band by band on a background thread:
+// every band is a run of whole tile rows written with write_tiles once it is rendered, so
+// only the bands in flight are held in memory, not the image. Band buffers are recycled.
+//
+// With a checkpoint (resume()) every band written to the file is also appended to the
+// checkpoint file, so a render that is killed leaves the bands it finished there. A restarted
+// render of the same image writes them into the new file from the checkpoint and traces the
+// others only.
+class tiled_image_writer
+{
+public:
+	// At most max_pending bands wait for the writer, write_band() blocks while the queue is full
+	explicit tiled_image_writer(std::size_t max_pending = 2);
+	// Closes the file if finish() wasn't called
+	~tiled_image_writer();
+
+	tiled_image_writer(tiled_image_writer const&) = delete;
+	tiled_image_writer& operator=(tiled_image_writer const&) = delete;
+
+	// Create file for the image of spec, in tiles of spec.tile_width x spec.tile_height. Returns
+	// false with a message if it can't be opened or its format doesn't store tiles.
+	bool open(std::string const& file, OIIO_NAMESPACE::ImageSpec const& spec);
+
+	// Checkpoint the bands in file after open(). The file starts with manifest, which names
+	// the image and how its bands are rendered; if file already holds a checkpoint with the
+	// same manifest, its bands are queued for the image file at once and band_done() reports
+	// them, a record cut off by a crash is dropped. Any other file is replaced. Returns false
+	// with a message if file can't be written.
+	bool resume(std::string const& file, std::string const& manifest);
+
+	// True if the band starting at row y_begin was restored from the checkpoint, the caller
+	// renders and queues the others
+	bool band_done(std::uint32_t y_begin) const
+	{
+		return restored_.count(y_begin) != 0;
+	}
+
+	// Bands restored by resume()
+	std::size_t restored_bands() const
+	{
+		return restored_.size();
+	}
+
+	// A buffer of a finished band to render the next one into, empty if none was freed yet
+	std::vector<unsigned char> take_buffer();
+
+	// Queue rows [y_begin, y_end) of the image, laid out as described by the spec of open() with
+	// pixel_stride bytes per pixel. y_begin is a multiple of the tile height and y_end is one too
+	// or the image height. The writer takes ownership of the pixels.
+	void write_band(std::uint32_t y_begin, std::uint32_t y_end, std::vector<unsigned char> pixels, std::size_t pixel_stride);
+
+	// Queue rows [y_begin, y_end) of an image that is mostly background (sparse_framebuffer):
+	// stored flags every tile of the band from the left, pixels holds the stored ones in order,
+	// each a whole tile of the spec of open() with rows of tile_width pixels, padded at the
+	// image border, and the others are written from the one pixel of background. Sparse bands
+	// aren't checkpointed.
+	void write_sparse_band(std::uint32_t y_begin, std::uint32_t y_end, std::vector<unsigned char> pixels, std::vector<bool> stored,
+	                       std::vector<unsigned char> background, std::size_t pixel_stride);
+
+	// Wait until every queued band is written and close the file. Returns false if a band or
+	// closing failed. A checkpoint is deleted once the file is complete and kept otherwise.
+	bool finish();
+
+	// Time in ms spent in write_tiles and in opening and closing (flushing) the file, read
+	// them after finish()
+	double encode_time() const
+	{
+		return encode_time_;
+	}
+
+	double file_time() const
+	{
+		return file_time_;
+	}
+
+private:
+	struct band
+	{
+		std::uint32_t y_begin, y_end;
+		std::vector<unsigned char> pixels;
+		std::size_t pixel_stride;
+		// read from the checkpoint, not appended to it again
+		bool restored;
+		// Tiles of a sparse band in pixels and the pixel of the others, empty for dense bands
+		std::vector<bool> stored;
+		std::vector<unsigned char> background;
+	};
+
+	// Write band b, false with a message if it fails
+	bool write_tiles(band const& b);
+
+	// Queue b once fewer than max_pending_ bands wait
+	void queue_band(band b);
+	void writer_main();
+
+	std::size_t max_pending_;
+	std::unique_ptr<OIIO_NAMESPACE::ImageOutput> out_;
+	OIIO_NAMESPACE::ImageSpec spec_;
+	std::string file_;
+	// A tile of the background of the last sparse band, written for each of its tiles not stored
+	std::vector<unsigned char> background_tile_;
+	std::vector<unsigned char> background_pixel_;
+	std::deque<band> queue_;
+	std::vector<std::vector<unsigned char>> free_;
+	bool busy_ = false;
+	bool failed_ = false;
+	bool stop_ = false;
+	double encode_time_ = 0.0;
+	double file_time_ = 0.0;
+	// Checkpoint file, appended to by the writer thread, and the first rows of the bands
+	// restored from it
+	std::ofstream checkpoint_;
+	std::string checkpoint_file_;
+	std::set<std::uint32_t> restored_;
+	std::mutex mutex_;
+	std::condition_variable queue_cv_;
+	std::condition_variable done_cv_;
+	std::thread thread_;
+};
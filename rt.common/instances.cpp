@@ -0,0 +1,250 @@
+#include "instances.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+	// Place the spheres of the cluster of inst into placed, sphere k of the cluster at k
+	void place_cluster(instance_set const& set, sphere_instance const& inst, sphere_soa& placed)
+	{
+		auto begin = set.cluster_start[inst.cluster];
+		auto end = set.cluster_start[inst.cluster + 1];
+		auto const& src = set.spheres;
+		float s = inst.scale;
+
+		placed.resize(end - begin);
+
+		for (auto k = begin; k < end; ++k)
+		{
+			placed.set(k - begin, src.cx[k] * s + inst.offset[0], src.cy[k] * s + inst.offset[1], src.cz[k] * s + inst.offset[2], src.radius[k] * s,
+			           src.color[k * 3], src.color[k * 3 + 1], src.color[k * 3 + 2]);
+		}
+	}
+}
+
+std::uint32_t instance_set::expanded_size() const
+{
+	if (instances.empty())
+		return 0;
+
+	auto const& last = instances.back();
+	return last.first + cluster_start[last.cluster + 1] - cluster_start[last.cluster];
+}
+
+bool read_instance_file(std::string const& file, instance_set& set)
+{
+	std::ifstream in(file);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << file << "\n";
+		return false;
+	}
+
+	set = instance_set();
+
+	std::string line;
+
+	for (auto number = 1; std::getline(in, line); ++number)
+	{
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string record;
+
+		if (!(words >> record))
+			continue;
+
+		bool parsed = false;
+
+		if (record == "cluster")
+		{
+			if (!set.cluster_start.empty() && set.cluster_start.back() == set.spheres.size())
+			{
+				std::cout << file << ":" << number << ": the previous cluster has no spheres\n";
+				return false;
+			}
+
+			set.cluster_start.push_back(set.spheres.size());
+			parsed = true;
+		}
+		else if (record == "sphere")
+		{
+			float x, y, z, r, red, green, blue;
+			parsed = !set.cluster_start.empty() && words >> x >> y >> z >> r >> red >> green >> blue && r > 0.f;
+
+			if (parsed)
+			{
+				auto k = set.spheres.size();
+				set.spheres.resize(k + 1);
+				set.spheres.set(k, x, y, z, r, red, green, blue);
+			}
+		}
+		else if (record == "instance")
+		{
+			sphere_instance inst = {};
+			inst.scale = 1.f;
+			parsed = static_cast<bool>(words >> inst.cluster >> inst.offset[0] >> inst.offset[1] >> inst.offset[2]);
+
+			if (parsed && !(words >> std::ws).eof())
+				parsed = static_cast<bool>(words >> inst.scale);
+
+			parsed = parsed && inst.scale > 0.f;
+
+			if (parsed)
+				set.instances.push_back(inst);
+		}
+
+		std::string rest;
+
+		if (!parsed || words >> rest)
+		{
+			std::cout << file << ":" << number << ": expected cluster, sphere x y z radius red green blue or instance cluster x y z [scale]\n";
+			return false;
+		}
+	}
+
+	if (set.cluster_start.empty() || set.cluster_start.back() == set.spheres.size() || set.instances.empty())
+	{
+		std::cout << file << " holds no instance or ends with an empty cluster\n";
+		return false;
+	}
+
+	set.cluster_start.push_back(set.spheres.size());
+
+	std::uint64_t first = 0;
+
+	for (auto& inst : set.instances)
+	{
+		if (inst.cluster >= set.num_clusters())
+		{
+			std::cout << file << ": instance of cluster " << inst.cluster << ", there are " << set.num_clusters() << "\n";
+			return false;
+		}
+
+		auto begin = set.cluster_start[inst.cluster];
+
+		inst.first = static_cast<std::uint32_t>(first);
+		inst.index_base = static_cast<std::int32_t>(first) - static_cast<std::int32_t>(begin);
+		first += set.cluster_start[inst.cluster + 1] - begin;
+	}
+
+	// the kernels index the expanded scene with ints
+	if (first > static_cast<std::uint64_t>(std::numeric_limits<std::int32_t>::max()))
+	{
+		std::cout << file << " expands to " << first << " spheres, more than the tracers index\n";
+		return false;
+	}
+
+	return true;
+}
+
+void expand_instances(instance_set const& set, sphere_soa& spheres)
+{
+	spheres.resize(set.expanded_size());
+
+	sphere_soa placed;
+
+	for (auto const& inst : set.instances)
+	{
+		place_cluster(set, inst, placed);
+
+		for (auto k = 0U; k < placed.size(); ++k)
+		{
+			spheres.set(inst.first + k, placed.cx[k], placed.cy[k], placed.cz[k], placed.radius[k], placed.color[k * 3], placed.color[k * 3 + 1],
+			            placed.color[k * 3 + 2]);
+		}
+	}
+}
+
+bool build_instance_bvhs(instance_set& set, float ray_origin_z, frame_arena& scratch)
+{
+	auto num_clusters = set.num_clusters();
+
+	// each cluster is built for the lowest origin plane of its instances in its own coordinates:
+	// with every sphere in front of the plane, the bounds then cover the rounding of the
+	// discriminant of all its copies
+	std::vector<float> origin(num_clusters, std::numeric_limits<float>::infinity());
+
+	for (auto const& inst : set.instances)
+	{
+		origin[inst.cluster] = std::min(origin[inst.cluster], (ray_origin_z - inst.offset[2]) / inst.scale);
+	}
+
+	set.cluster_bvh = bvh();
+	set.cluster_root.clear();
+
+	sphere_soa cluster;
+
+	for (auto c = 0U; c < num_clusters; ++c)
+	{
+		auto begin = set.cluster_start[c];
+		auto end = set.cluster_start[c + 1];
+		auto const& src = set.spheres;
+
+		cluster.resize(end - begin);
+
+		for (auto k = begin; k < end; ++k)
+		{
+			cluster.set(k - begin, src.cx[k], src.cy[k], src.cz[k], src.radius[k], src.color[k * 3], src.color[k * 3 + 1], src.color[k * 3 + 2]);
+		}
+
+		auto part = build_bvh(cluster, std::isinf(origin[c]) ? ray_origin_z : origin[c], scratch);
+
+		// the nodes and indices of the cluster follow those of the previous ones
+		auto node_base = static_cast<std::int32_t>(set.cluster_bvh.nodes.size());
+		auto index_base = static_cast<std::int32_t>(set.cluster_bvh.indices.size());
+
+		for (auto node : part.nodes)
+		{
+			node.offset += node.count == 0 ? node_base : index_base;
+			set.cluster_bvh.nodes.push_back(node);
+		}
+
+		for (auto index : part.indices)
+		{
+			set.cluster_bvh.indices.push_back(index + begin);
+		}
+
+		set.cluster_root.push_back(node_base);
+	}
+
+	// the top level is a BVH over one sphere per instance enclosing the bounds of its spheres
+	// as the tracers place them
+	bool exact = true;
+
+	sphere_soa placed;
+	sphere_soa proxies;
+	proxies.resize(static_cast<std::uint32_t>(set.instances.size()));
+
+	for (std::size_t i = 0; i < set.instances.size(); ++i)
+	{
+		auto& inst = set.instances[i];
+		inst.root = set.cluster_root[inst.cluster];
+
+		place_cluster(set, inst, placed);
+
+		Imath::Box3f bounds;
+
+		for (auto k = 0U; k < placed.size(); ++k)
+		{
+			auto sphere = sphere_bounds(placed, k, ray_origin_z);
+			bounds.extendBy(sphere);
+
+			if (!(sphere.min.z > ray_origin_z))
+				exact = false;
+		}
+
+		auto center = bounds.center();
+		float radius = 0.5f * bounds.size().length() * (1.f + 1.f / (1 << 20));
+
+		proxies.set(static_cast<std::uint32_t>(i), center.x, center.y, center.z, radius, 0.f, 0.f, 0.f);
+	}
+
+	set.top = build_bvh(proxies, ray_origin_z, scratch);
+	set.cluster_bvh.exact = set.top.exact = exact;
+	return exact;
+}
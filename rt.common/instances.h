@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "bvh.h"
+#include "scene.h"
+
+// Copy of a sphere cluster placed in the scene, 32 bytes, mirrored by sphere_instance in
+// trace.cl. Sphere k of the cluster lands at its center * scale + offset with its radius *
+// scale, computed in that order by expand_instances and by the kernel, so both place it on the
+// same floats.
+struct sphere_instance
+{
+	float offset[3];
+	float scale;
+	// Root of the cluster's BVH in instance_set::cluster_bvh
+	std::int32_t root;
+	// Index of cluster sphere k in the expanded scene minus k: the instance's first expanded
+	// sphere minus the cluster's first sphere in instance_set::spheres
+	std::int32_t index_base;
+	std::uint32_t cluster;
+	// First sphere of the instance in the expanded scene
+	std::uint32_t first;
+};
+
+// Scene of many copies of a few sphere clusters: the unique spheres are held once, each
+// cluster with a BVH of its own, and a top level BVH over the instances finds the copies a
+// ray passes. Memory grows with the unique spheres and the number of instances, not with
+// the spheres of the expanded scene.
+struct instance_set
+{
+	// Spheres of all clusters in their own coordinates, cluster c holds spheres
+	// cluster_start[c] .. cluster_start[c + 1] - 1
+	sphere_soa spheres;
+	std::vector<std::uint32_t> cluster_start;
+	std::vector<sphere_instance> instances;
+	// BVHs of all clusters in one node array, the root of cluster c is cluster_root[c]; the
+	// leaves list indices into spheres. Built by build_instance_bvhs.
+	bvh cluster_bvh;
+	std::vector<std::int32_t> cluster_root;
+	// BVH over the world bounds of the instances, its leaves list indices into instances
+	bvh top;
+
+	std::uint32_t num_clusters() const
+	{
+		return static_cast<std::uint32_t>(cluster_start.size()) - 1;
+	}
+
+	// Spheres of the expanded scene
+	std::uint32_t expanded_size() const;
+};
+
+// Read an instance file, one record per line, '#' starts a comment:
+//     cluster                          starts the next cluster
+//     sphere x y z radius red green blue   adds a sphere to the current cluster
+//     instance cluster x y z [scale]   places a copy of a cluster, scale 1 if left out
+// Clusters are numbered from 0 in file order. Returns false with a message for a malformed
+// line, an empty cluster or an instance of an unknown cluster.
+bool read_instance_file(std::string const& file, instance_set& set);
+
+// Write the spheres of all instances into spheres, the instances in order and the spheres of
+// each in cluster order
+void expand_instances(instance_set const& set, sphere_soa& spheres);
+
+// Build the cluster BVHs and the top level BVH for rays starting at z = ray_origin_z, with the
+// build items in scratch. Returns false if an instanced sphere crosses the origin plane: then
+// the traversal order would change ties, and the set has to be expanded instead.
+bool build_instance_bvhs(instance_set& set, float ray_origin_z, frame_arena& scratch);
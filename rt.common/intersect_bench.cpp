@@ -0,0 +1,123 @@
+#include "intersect_bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "bench.h"
+#include "pixel_format.h"
+
+namespace
+{
+	// Seed of the sphere batches, so every run times the same ones
+	std::uint32_t const kBatchSeed = 1234;
+
+	// The tile spans the unit square, spheres of radius 1 centered near its middle cover all of
+	// it and the ones centered at x >= 3 none
+	float const kBatchRadius = 1.f;
+	float const kMissOffset = 3.f;
+
+	// Scene of kIntersectBatchSpheres spheres, round(hit_rate * count) of them covering the tile
+	render_scene make_batch(double hit_rate)
+	{
+		render_scene scene;
+		scene.view = ortho_view{ 0.f, 0.f, 1.f, 1.f, 0.f, 1000.f, kTileSize, kTileSize };
+
+		auto num_hits = static_cast<std::uint32_t>(std::lround(hit_rate * kIntersectBatchSpheres));
+
+		std::vector<char> hits(kIntersectBatchSpheres, 0);
+		std::fill(hits.begin(), hits.begin() + num_hits, 1);
+
+		std::mt19937 random(kBatchSeed);
+		std::shuffle(hits.begin(), hits.end(), random);
+
+		std::uniform_real_distribution<float> jitter(-0.1f, 0.1f);
+		std::uniform_real_distribution<float> depth(2.f, 100.f);
+
+		scene.spheres.resize(kIntersectBatchSpheres);
+
+		for (auto k = 0U; k < kIntersectBatchSpheres; ++k)
+		{
+			float x = (hits[k] ? 0.5f : 0.5f + kMissOffset) + jitter(random);
+			scene.spheres.set(k, x, 0.5f + jitter(random), depth(random), kBatchRadius, 1.f, 1.f, 1.f);
+		}
+
+		prepare_scene(scene, accel_mode::none);
+		return scene;
+	}
+}
+
+bool run_intersect_bench(std::string const& file, simd_isa max_isa, std::uint32_t warmup, std::uint32_t runs)
+{
+	std::ofstream csv(file);
+
+	if (!csv)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	csv << "isa,hit_rate,median_us,ns_per_test,tsc_cycles_per_test,tests_per_tsc_cycle\n";
+
+	tile t{ 0, 0, kTileSize, kTileSize };
+	double tests = double(kTileSize) * kTileSize * kIntersectBatchSpheres;
+	bool same = true;
+
+	std::cout << "Ray-sphere tests of " << kTileSize << "x" << kTileSize << " rays against " << kIntersectBatchSpheres << " spheres\n";
+
+	for (auto hit_rate : kIntersectHitRates)
+	{
+		auto scene = make_batch(hit_rate);
+
+		std::vector<float> reference(3 * kTileSize * kTileSize);
+		render_tile(scene, simd_isa::scalar, t, &reference[0]);
+
+		for (auto isa : { simd_isa::scalar, simd_isa::sse4, simd_isa::avx2, simd_isa::avx512 })
+		{
+			if (isa > max_isa)
+				break;
+
+			std::vector<float> img(reference.size());
+			std::vector<double> cycles;
+
+			auto stats = run_bench([&]
+			{
+				auto start = __rdtsc();
+				render_tile(scene, isa, pixel_format::float32, t, reinterpret_cast<unsigned char*>(&img[0]));
+				cycles.push_back(static_cast<double>(__rdtsc() - start));
+			}, warmup, runs);
+
+			// the timed runs come after the warmup ones
+			cycles.erase(cycles.begin(), cycles.begin() + warmup);
+			auto median_cycles = compute_bench_stats(cycles).median;
+
+			double ns_per_test = stats.median * 1e3 / tests;
+			double cycles_per_test = median_cycles / tests;
+
+			std::cout << "  " << simd_isa_name(isa) << ", " << 100.0 * hit_rate << "% hits: " << ns_per_test << " ns/test, " << cycles_per_test
+			          << " TSC cycles/test, " << 1.0 / cycles_per_test << " tests/cycle";
+
+			if (img != reference)
+			{
+				std::cout << ", image differs from scalar";
+				same = false;
+			}
+
+			std::cout << "\n";
+
+			csv << simd_isa_name(isa) << ',' << hit_rate << ',' << stats.median << ',' << ns_per_test << ',' << cycles_per_test << ',' << 1.0 / cycles_per_test
+			    << "\n";
+		}
+	}
+
+	return static_cast<bool>(csv) && same;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "cpu_trace.h"
+
+// Spheres of the synthetic batches of run_intersect_bench, tested by the kTileSize x kTileSize
+// rays of one tile. The centers and radii stay in the L1 cache.
+std::uint32_t const kIntersectBatchSpheres = 1024;
+
+// Shares of the ray-sphere tests of a batch whose ray meets the sphere
+double const kIntersectHitRates[] = { 0.0, 0.01, 0.1, 0.5, 1.0 };
+
+// Time the closest-hit loop of the brute force tracers on its own: the rays of one tile against
+// a batch of spheres, for every hit rate and instruction set up to max_isa, without structures,
+// threads or a frame to write. Every sphere of a batch covers either the whole tile or none of
+// it, in a random order, so a rate is exact and the packet tracers take their miss branch as
+// often as the scalar one. Prints and writes to file as CSV the ns per ray-sphere test and the
+// cycles of the time stamp counter per test. The TSC ticks at a fixed rate, so with turbo and
+// frequency scaling off it counts core cycles and the tests per cycle compare across machines.
+// The image of every instruction set is checked against the scalar one. Returns false if the
+// file can't be written or an image differs.
+bool run_intersect_bench(std::string const& file, simd_isa max_isa, std::uint32_t warmup, std::uint32_t runs);
@@ -0,0 +1,350 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+#ifndef _WIN32
+	// Parse a sysfs cpu list such as "0-15,32-47" into cpus
+	void parse_cpu_list(std::string const& list, std::vector<std::uint32_t>& cpus)
+	{
+		std::size_t pos = 0;
+
+		while (pos < list.size())
+		{
+			unsigned first = 0, last = 0;
+			int length = 0;
+
+			if (std::sscanf(list.c_str() + pos, "%u-%u%n", &first, &last, &length) != 2)
+			{
+				if (std::sscanf(list.c_str() + pos, "%u%n", &first, &length) != 1)
+					return;
+
+				last = first;
+			}
+
+			for (auto cpu = first; cpu <= last; ++cpu)
+			{
+				cpus.push_back(cpu);
+			}
+
+			pos += length + 1;
+		}
+	}
+#endif
+}
+
+numa_topology detect_numa_topology()
+{
+	numa_topology topology;
+
+#ifdef _WIN32
+	ULONG highest = 0;
+
+	if (!GetNumaHighestNodeNumber(&highest))
+		return topology;
+
+	for (USHORT node = 0; node <= highest; ++node)
+	{
+		GROUP_AFFINITY affinity = {};
+
+		if (!GetNumaNodeProcessorMaskEx(node, &affinity) || affinity.Mask == 0)
+			continue;
+
+		std::vector<std::uint32_t> cpus;
+
+		for (std::uint32_t bit = 0; bit < 64; ++bit)
+		{
+			if ((affinity.Mask >> bit) & 1)
+				cpus.push_back(affinity.Group * 64U + bit);
+		}
+
+		topology.node_cpus.push_back(cpus);
+	}
+#else
+	for (std::uint32_t node = 0;; ++node)
+	{
+		std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+		if (!in)
+			break;
+
+		std::string list;
+		std::getline(in, list);
+
+		std::vector<std::uint32_t> cpus;
+		parse_cpu_list(list, cpus);
+
+		// memory-only nodes have no processors to run workers on
+		if (!cpus.empty())
+			topology.node_cpus.push_back(cpus);
+	}
+#endif
+
+	if (topology.node_cpus.size() < 2)
+		topology.node_cpus.clear();
+
+	return topology;
+}
+
+std::vector<std::vector<std::uint32_t>> detect_physical_cores()
+{
+	std::vector<std::vector<std::uint32_t>> cores;
+
+#ifdef _WIN32
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+
+	std::vector<unsigned char> buffer(length);
+
+	if (buffer.empty() || !GetLogicalProcessorInformationEx(RelationProcessorCore, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(&buffer[0]), &length))
+		return cores;
+
+	for (DWORD offset = 0; offset < length;)
+	{
+		auto const& info = *reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const*>(&buffer[offset]);
+		std::vector<std::uint32_t> siblings;
+
+		for (WORD g = 0; g < info.Processor.GroupCount; ++g)
+		{
+			auto const& affinity = info.Processor.GroupMask[g];
+
+			for (std::uint32_t bit = 0; bit < 64; ++bit)
+			{
+				if ((affinity.Mask >> bit) & 1)
+					siblings.push_back(affinity.Group * 64U + bit);
+			}
+		}
+
+		if (!siblings.empty())
+			cores.push_back(siblings);
+
+		offset += info.Size;
+	}
+#else
+	std::string online;
+	std::getline(std::ifstream("/sys/devices/system/cpu/online"), online);
+
+	std::vector<std::uint32_t> cpus;
+	parse_cpu_list(online, cpus);
+
+	std::vector<std::string> seen;
+
+	for (auto cpu : cpus)
+	{
+		std::string list;
+		std::getline(std::ifstream("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"), list);
+
+		if (list.empty() || std::find(seen.begin(), seen.end(), list) != seen.end())
+			continue;
+
+		std::vector<std::uint32_t> siblings;
+		parse_cpu_list(list, siblings);
+
+		if (!siblings.empty())
+		{
+			seen.push_back(list);
+			cores.push_back(siblings);
+		}
+	}
+#endif
+
+	std::sort(cores.begin(), cores.end());
+	return cores;
+}
+
+numa_topology processor_topology(numa_topology const& topology, std::uint32_t num_threads, processor_placement placement)
+{
+	auto nodes = topology.node_cpus;
+
+	if (nodes.empty())
+	{
+		nodes.resize(1);
+
+		for (auto cpu = 0U; cpu < std::max(std::thread::hardware_concurrency(), 1U); ++cpu)
+		{
+			nodes[0].push_back(cpu);
+		}
+	}
+
+	// core of every processor, by its first sibling, and its place among the siblings
+	std::map<std::uint32_t, std::pair<std::uint32_t, std::uint32_t>> core_of;
+
+	for (auto const& siblings : detect_physical_cores())
+	{
+		for (std::uint32_t rank = 0; rank < siblings.size(); ++rank)
+		{
+			core_of[siblings[rank]] = std::make_pair(siblings[0], rank);
+		}
+	}
+
+	auto core_rank = [&](std::uint32_t cpu)
+	{
+		auto found = core_of.find(cpu);
+		return found != core_of.end() ? found->second : std::make_pair(cpu, 0U);
+	};
+
+	for (auto& cpus : nodes)
+	{
+		if (placement == processor_placement::compact)
+		{
+			std::stable_sort(cpus.begin(), cpus.end(), [&](std::uint32_t a, std::uint32_t b) { return core_rank(a) < core_rank(b); });
+		}
+		else
+		{
+			std::stable_sort(cpus.begin(), cpus.end(), [&](std::uint32_t a, std::uint32_t b) { return core_rank(a).second < core_rank(b).second; });
+		}
+
+		if (placement == processor_placement::physical)
+		{
+			cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](std::uint32_t cpu) { return core_rank(cpu).second != 0; }), cpus.end());
+		}
+	}
+
+	nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](std::vector<std::uint32_t> const& cpus) { return cpus.empty(); }), nodes.end());
+
+	std::vector<std::uint32_t> order;
+
+	if (placement == processor_placement::compact)
+	{
+		for (auto const& cpus : nodes)
+		{
+			order.insert(order.end(), cpus.begin(), cpus.end());
+		}
+	}
+	else
+	{
+		// the i-th processor of every node before the (i + 1)-th of any
+		for (std::size_t i = 0; order.size() < num_threads; ++i)
+		{
+			auto before = order.size();
+
+			for (auto const& cpus : nodes)
+			{
+				if (i < cpus.size())
+					order.push_back(cpus[i]);
+			}
+
+			if (order.size() == before)
+				break;
+		}
+	}
+
+	numa_topology single;
+
+	for (auto i = 0U; i < num_threads; ++i)
+	{
+		single.node_cpus.push_back({ order[i % order.size()] });
+	}
+
+	return single;
+}
+
+std::size_t detect_l2_cache_size()
+{
+#ifdef _WIN32
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+	if (infos.empty() || !GetLogicalProcessorInformation(&infos[0], &length))
+		return 0;
+
+	for (auto const& info : infos)
+	{
+		if (info.Relationship != RelationCache || info.Cache.Level != 2 || info.Cache.Type == CacheInstruction)
+			continue;
+
+		std::size_t sharing = 0;
+
+		for (auto mask = info.ProcessorMask; mask != 0; mask &= mask - 1)
+		{
+			++sharing;
+		}
+
+		return info.Cache.Size / std::max<std::size_t>(sharing, 1);
+	}
+
+	return 0;
+#else
+	for (std::uint32_t index = 0;; ++index)
+	{
+		auto dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+		std::ifstream level_in(dir + "level");
+
+		if (!level_in)
+			return 0;
+
+		std::string level, type, size, shared;
+		std::getline(level_in, level);
+		std::ifstream(dir + "type") >> type;
+		std::ifstream(dir + "size") >> size;
+		std::ifstream(dir + "shared_cpu_list") >> shared;
+
+		if (level != "2" || type == "Instruction")
+			continue;
+
+		// "1024K" or "2M"
+		unsigned long value = 0;
+		char unit = 0;
+
+		if (std::sscanf(size.c_str(), "%lu%c", &value, &unit) < 1)
+			return 0;
+
+		std::size_t bytes = value * (unit == 'M' ? 1024UL * 1024 : unit == 'K' ? 1024UL : 1UL);
+
+		std::vector<std::uint32_t> cpus;
+		parse_cpu_list(shared, cpus);
+
+		return bytes / std::max<std::size_t>(cpus.size(), 1);
+	}
+#endif
+}
+
+bool pin_thread_to_node(numa_topology const& topology, std::uint32_t node)
+{
+	if (node >= topology.num_nodes())
+		return false;
+
+	auto const& cpus = topology.node_cpus[node];
+
+#ifdef _WIN32
+	// a thread runs in one processor group, the one of the node's first processor
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = static_cast<WORD>(cpus[0] / 64);
+
+	for (auto cpu : cpus)
+	{
+		if (cpu / 64 == affinity.Group)
+			affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+	}
+
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for (auto cpu : cpus)
+	{
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// NUMA nodes of the machine, each with the logical processors it holds. Processor numbers are
+// the OS ones; on Windows processor group g holds numbers 64 * g to 64 * g + 63.
+struct numa_topology
+{
+	std::vector<std::vector<std::uint32_t>> node_cpus;
+
+	std::uint32_t num_nodes() const
+	{
+		return static_cast<std::uint32_t>(node_cpus.size());
+	}
+};
+
+// Nodes reported by the OS, empty if it reports none or the machine has a single node
+numa_topology detect_numa_topology();
+
+// Logical processors of every physical core reported by the OS, the SMT siblings of a core in
+// OS order, the cores in the order of their first processor. Empty if the OS reports none.
+std::vector<std::vector<std::uint32_t>> detect_physical_cores();
+
+// How processor_topology() hands out the processors
+enum class processor_placement
+{
+	// core by core in OS order, the SMT siblings of a core next to each other, filling a node
+	// before the next one
+	compact,
+	// alternating between the nodes, scattering the workers over the memory controllers, and
+	// within a node one processor of every core before a second one of any
+	scatter,
+	// scatter over the first processor of every core only, no two workers on siblings
+	physical
+};
+
+// One node per worker for num_threads workers, each holding a single logical processor of
+// topology (all processors of the machine as one node if it's empty) placed as placement says,
+// so thread_pool pins every worker to a processor of its own. The siblings come from
+// detect_physical_cores(); without them every processor counts as a core. Workers beyond the
+// processors share them again.
+numa_topology processor_topology(numa_topology const& topology, std::uint32_t num_threads, processor_placement placement);
+
+// Bytes of the L2 (or unified level 2) cache the OS reports for the first processor, divided
+// by the logical processors sharing it, so the share of one worker pinned to a processor of
+// its own. 0 if the OS reports no L2.
+std::size_t detect_l2_cache_size();
+
+// Restrict the calling thread to the processors of node. Returns false if the OS refuses.
+bool pin_thread_to_node(numa_topology const& topology, std::uint32_t node);
@@ -0,0 +1,184 @@
+#include "parallel_executors.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+
+#ifdef RT_WITH_STD_EXECUTION
+#include <execution>
+#endif
+
+#ifdef RT_WITH_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#endif
+
+char const* parallel_runtime_name(parallel_runtime runtime)
+{
+	switch (runtime)
+	{
+	case parallel_runtime::std_execution: return "std";
+	case parallel_runtime::tbb: return "tbb";
+	default: return "pool";
+	}
+}
+
+bool parse_parallel_runtime(char const* name, parallel_runtime& runtime)
+{
+	for (auto candidate : { parallel_runtime::pool, parallel_runtime::std_execution, parallel_runtime::tbb })
+	{
+		if (std::strcmp(name, parallel_runtime_name(candidate)) == 0)
+		{
+			runtime = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std_execution_executor::std_execution_executor(std::uint32_t num_threads)
+	: num_workers_(std::max(num_threads, 1U))
+{
+}
+
+void std_execution_executor::run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn)
+{
+	std::atomic<std::size_t> next(0);
+
+	run_each([&](std::uint32_t worker)
+	{
+		for (auto i = next++; i < tiles.size(); i = next++)
+		{
+			fn(tiles[i], worker);
+		}
+	});
+}
+
+void std_execution_executor::run_each(std::function<void(std::uint32_t)> const& fn)
+{
+	std::vector<std::uint32_t> workers(num_workers_);
+	std::iota(workers.begin(), workers.end(), 0U);
+
+#ifdef RT_WITH_STD_EXECUTION
+	std::for_each(std::execution::par, workers.begin(), workers.end(), fn);
+#else
+	// make_executor doesn't create one in builds without the algorithms
+	std::for_each(workers.begin(), workers.end(), fn);
+#endif
+}
+
+#ifdef RT_WITH_TBB
+struct tbb_executor::arena
+{
+	explicit arena(std::uint32_t num_threads)
+		: slots(static_cast<int>(num_threads))
+	{
+	}
+
+	explicit arena(tbb::task_arena::attach attach)
+		: slots(attach)
+	{
+	}
+
+	tbb::task_arena slots;
+};
+
+tbb_executor::tbb_executor(std::uint32_t num_threads)
+	: arena_(num_threads != 0 ? new arena(num_threads) : new arena(tbb::task_arena::attach()))
+{
+	arena_->slots.initialize();
+}
+
+tbb_executor::~tbb_executor() = default;
+
+std::uint32_t tbb_executor::size() const
+{
+	return static_cast<std::uint32_t>(std::max(arena_->slots.max_concurrency(), 1));
+}
+
+void tbb_executor::run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn)
+{
+	arena_->slots.execute([&]
+	{
+		tbb::parallel_for(tbb::blocked_range<std::size_t>(0, tiles.size(), 1), [&](tbb::blocked_range<std::size_t> const& range)
+		{
+			auto worker = static_cast<std::uint32_t>(tbb::this_task_arena::current_thread_index());
+
+			for (auto i = range.begin(); i != range.end(); ++i)
+			{
+				fn(tiles[i], worker);
+			}
+		});
+	});
+}
+
+void tbb_executor::run_each(std::function<void(std::uint32_t)> const& fn)
+{
+	arena_->slots.execute([&]
+	{
+		tbb::parallel_for(0U, size(), [&](std::uint32_t worker)
+		{
+			fn(worker);
+		});
+	});
+}
+#else
+struct tbb_executor::arena
+{
+};
+
+// make_executor doesn't create one in builds without TBB, the calls run on the calling thread
+tbb_executor::tbb_executor(std::uint32_t)
+	: arena_(new arena)
+{
+}
+
+tbb_executor::~tbb_executor() = default;
+
+std::uint32_t tbb_executor::size() const
+{
+	return 1U;
+}
+
+void tbb_executor::run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn)
+{
+	for (auto const& t : tiles)
+	{
+		fn(t, 0U);
+	}
+}
+
+void tbb_executor::run_each(std::function<void(std::uint32_t)> const& fn)
+{
+	fn(0U);
+}
+#endif
+
+std::unique_ptr<tile_executor> make_executor(parallel_runtime runtime, std::uint32_t num_threads)
+{
+	switch (runtime)
+	{
+	case parallel_runtime::std_execution:
+#ifdef RT_WITH_STD_EXECUTION
+		return std::unique_ptr<tile_executor>(new std_execution_executor(num_threads));
+#else
+		(void)num_threads;
+		std::cout << "Built without RT_WITH_STD_EXECUTION, can't run the tiles on std::execution\n";
+		return nullptr;
+#endif
+	case parallel_runtime::tbb:
+#ifdef RT_WITH_TBB
+		return std::unique_ptr<tile_executor>(new tbb_executor(num_threads));
+#else
+		(void)num_threads;
+		std::cout << "Built without RT_WITH_TBB, can't run the tiles on a TBB arena\n";
+		return nullptr;
+#endif
+	default:
+		return nullptr;
+	}
+}
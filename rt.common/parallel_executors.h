@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "tile_executor.h"
+
+// Parallel runtimes the CPU backend can run its tiles on (--runtime)
+enum class parallel_runtime
+{
+	// thread_pool, the built-in work stealing pool with NUMA placement
+	pool,
+	// The parallel std::for_each of <execution>, only in builds with RT_WITH_STD_EXECUTION
+	std_execution,
+	// A task arena of oneTBB, only in builds with RT_WITH_TBB
+	tbb
+};
+
+char const* parallel_runtime_name(parallel_runtime runtime);
+
+// Parse pool, std or tbb into runtime, returns false and leaves runtime untouched otherwise
+bool parse_parallel_runtime(char const* name, parallel_runtime& runtime);
+
+// Tiles on the parallel std::for_each. The std algorithms have no thread index, so size()
+// workers pull the tiles from a shared counter, each a call of one std::for_each over the
+// workers, and a worker is the call it runs in. The tiles are traced with the std::execution::par
+// policy, not par_unseq: the tracers allocate and the callers count per worker, neither is
+// allowed in the vectorized interleaving of unsequenced calls. In builds without
+// RT_WITH_STD_EXECUTION the workers run one after the other.
+class std_execution_executor : public tile_executor
+{
+public:
+	// num_threads workers, the calls the algorithm may run at once
+	explicit std_execution_executor(std::uint32_t num_threads);
+
+	std::uint32_t size() const override
+	{
+		return num_workers_;
+	}
+
+	void run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn) override;
+	void run_each(std::function<void(std::uint32_t)> const& fn) override;
+
+private:
+	std::uint32_t num_workers_;
+};
+
+// Tiles on a tbb::task_arena of num_threads slots, or on the arena of the calling thread: a
+// program built on TBB renders on its own threads, without oversubscribing the machine. A
+// worker is the arena slot of the thread running the tile (this_task_arena::current_thread_index).
+// In builds without RT_WITH_TBB it is a single worker on the calling thread.
+class tbb_executor : public tile_executor
+{
+public:
+	// Own arena of num_threads slots, or the one of the calling thread if num_threads is 0
+	explicit tbb_executor(std::uint32_t num_threads);
+	~tbb_executor() override;
+
+	std::uint32_t size() const override;
+	void run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn) override;
+	void run_each(std::function<void(std::uint32_t)> const& fn) override;
+
+private:
+	// tbb::task_arena, opaque so this header doesn't need TBB
+	struct arena;
+	std::unique_ptr<arena> arena_;
+};
+
+// Executor of runtime with num_threads workers, null for the pool, which the caller creates
+// with its topology, or with a message for a runtime the program wasn't built with
+std::unique_ptr<tile_executor> make_executor(parallel_runtime runtime, std::uint32_t num_threads);
@@ -0,0 +1,185 @@
+#include "pipe_writer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <csignal>
+#endif
+
+#include "profile_markers.h"
+#include "timeline.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace
+{
+#ifdef _WIN32
+	// binary, the frames must reach the encoder without newline translation
+	char const kPipeMode[] = "wb";
+#else
+	char const kPipeMode[] = "w";
+#endif
+}
+
+char const* pipe_format_name(pipe_format format)
+{
+	return format == pipe_format::yuv420 ? "yuv420" : "rgba";
+}
+
+bool parse_pipe_format(char const* name, pipe_format& format)
+{
+	for (auto candidate : { pipe_format::rgba, pipe_format::yuv420 })
+	{
+		if (std::strcmp(name, pipe_format_name(candidate)) == 0)
+		{
+			format = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::size_t pipe_frame_size(pipe_format format, std::uint32_t width, std::uint32_t height)
+{
+	std::size_t pixels = std::size_t(width) * height;
+	return format == pipe_format::yuv420 ? pixels + 2 * (pixels / 4) : 4 * pixels;
+}
+
+pipe_writer::pipe_writer(std::size_t max_pending, framebuffer_pool* pool)
+	: max_pending_(std::max<std::size_t>(max_pending, 1U))
+	, pool_(pool)
+	, thread_(&pipe_writer::writer_main, this)
+{
+}
+
+pipe_writer::~pipe_writer()
+{
+	finish();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+
+	queue_cv_.notify_all();
+	thread_.join();
+}
+
+bool pipe_writer::open(std::string const& command)
+{
+#ifndef _WIN32
+	// an encoder that exits early fails the writes instead of ending the renderer
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+	pipe_ = popen(command.c_str(), kPipeMode);
+
+	if (!pipe_)
+	{
+		std::cout << "Can't start " << command << "\n";
+		return false;
+	}
+
+	command_ = command;
+	return true;
+}
+
+void pipe_writer::write(std::vector<unsigned char> frame)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.size() < max_pending_; });
+
+	queue_.push_back(std::move(frame));
+	queue_cv_.notify_all();
+}
+
+bool pipe_writer::finish()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	done_cv_.wait(lock, [this] { return queue_.empty() && !busy_; });
+
+	if (pipe_)
+	{
+		// the encoder sees the end of its input and finishes the file
+		if (pclose(pipe_) != 0)
+		{
+			std::cout << command_ << " failed\n";
+			failed_ = true;
+		}
+
+		pipe_ = nullptr;
+	}
+
+	return !failed_;
+}
+
+pipe_writer::stats pipe_writer::totals()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return totals_;
+}
+
+void pipe_writer::writer_main()
+{
+	name_timeline_thread("pipe writer");
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	for (;;)
+	{
+		queue_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+		if (queue_.empty())
+			return;
+
+		auto frame = std::move(queue_.front());
+		queue_.pop_front();
+		busy_ = true;
+
+		// a slot is free again
+		done_cv_.notify_all();
+
+		// after a failed write the encoder is gone, the frames are dropped
+		bool write = pipe_ && !failed_;
+		auto* pipe = pipe_;
+
+		lock.unlock();
+
+		bool ok = true;
+		double time = 0.0;
+
+		if (write)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			profile_push("pipe");
+			ok = std::fwrite(frame.data(), 1, frame.size(), pipe) == frame.size();
+			profile_pop();
+
+			time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			if (!ok)
+				std::cout << "Can't write a frame to " << command_ << "\n";
+		}
+
+		if (pool_)
+			pool_->release(std::move(frame));
+
+		lock.lock();
+
+		totals_.frames += write && ok ? 1 : 0;
+		totals_.write_time += time;
+		failed_ = failed_ || !ok;
+		busy_ = false;
+		done_cv_.notify_all();
+	}
+}
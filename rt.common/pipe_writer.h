@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer_pool.h"
+
+// Raw frame layouts a pipe_writer passes to the encoder
+enum class pipe_format
+{
+	// the rgba8 framebuffer as it is, 4 bytes per pixel (ffmpeg -pix_fmt rgba)
+	rgba,
+	// planar YUV 4:2:0, BT.601 limited range: the Y plane, then the U and V planes at half the
+	// width and height (ffmpeg -pix_fmt yuv420p); needs an even width and height
+	yuv420
+};
+
+char const* pipe_format_name(pipe_format format);
+
+// Parse "rgba" or "yuv420". Returns false for anything else and leaves format untouched.
+bool parse_pipe_format(char const* name, pipe_format& format);
+
+// Bytes of a width x height frame in format
+std::size_t pipe_frame_size(pipe_format format, std::uint32_t width, std::uint32_t height);
+
+// Streams raw frames into the standard input of an external encoder on a background thread,
+// e.g. ffmpeg -f rawvideo -pix_fmt rgba -s 1920x1080 -i - out.mp4, instead of writing an image
+// file per frame for the encoder to read back. The writes block while the encoder is behind,
+// the renderer only waits once max_pending frames are queued. Frames are written in the order
+// they were queued.
+class pipe_writer
+{
+public:
+	// At most max_pending frames wait for the writer, write() blocks while the queue is full.
+	// Written frames are released to pool, if there is one, for the next frame to read into.
+	explicit pipe_writer(std::size_t max_pending = 2, framebuffer_pool* pool = nullptr);
+	// Closes the pipe if finish() wasn't called
+	~pipe_writer();
+
+	pipe_writer(pipe_writer const&) = delete;
+	pipe_writer& operator=(pipe_writer const&) = delete;
+
+	// Start command with its standard input reading from the pipe. Returns false with a
+	// message if it can't be started.
+	bool open(std::string const& command);
+
+	// Queue frame to be written to the pipe as it is. The writer takes ownership of it.
+	void write(std::vector<unsigned char> frame);
+
+	// Wait until every queued frame is written, close the pipe and wait for the encoder to
+	// exit. Returns false if a write failed or the encoder exited with an error.
+	bool finish();
+
+	// Frames written so far and the time in ms spent writing them to the pipe, which includes
+	// waiting for the encoder to read them
+	struct stats
+	{
+		std::size_t frames;
+		double write_time;
+	};
+
+	stats totals();
+
+private:
+	void writer_main();
+
+	std::size_t max_pending_;
+	framebuffer_pool* pool_;
+	std::FILE* pipe_ = nullptr;
+	std::string command_;
+	std::deque<std::vector<unsigned char>> queue_;
+	bool busy_ = false;
+	bool failed_ = false;
+	bool stop_ = false;
+	stats totals_ = {};
+	std::mutex mutex_;
+	std::condition_variable queue_cv_;
+	std::condition_variable done_cv_;
+	std::thread thread_;
+};
@@ -0,0 +1,83 @@
+#include "pixel_cost.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	// Channel value of the fraction f in [0, 1]
+	unsigned char channel(float f)
+	{
+		return static_cast<unsigned char>(std::min(std::max(f, 0.f), 1.f) * 255.f + 0.5f);
+	}
+}
+
+cost_summary summarize_cost(pixel_cost const* costs, std::size_t count, std::uint32_t pixel_cost::*counter)
+{
+	cost_summary summary = {};
+	double sum = 0.0;
+
+	for (std::size_t p = 0; p < count; ++p)
+	{
+		sum += costs[p].*counter;
+		summary.max = std::max(summary.max, costs[p].*counter);
+	}
+
+	summary.mean = count != 0 ? sum / count : 0.0;
+
+	// max / width < kCostBins, so max lands in the last bin that holds anything
+	std::uint32_t width = summary.max / kCostBins + 1;
+
+	for (std::size_t p = 0; p < count; ++p)
+	{
+		++summary.histogram[costs[p].*counter / width];
+	}
+
+	return summary;
+}
+
+void print_cost_summary(char const* name, cost_summary const& summary)
+{
+	std::uint32_t total = 0;
+
+	for (auto pixels : summary.histogram)
+	{
+		total += pixels;
+	}
+
+	std::cout << name << " per pixel: mean " << summary.mean << ", max " << summary.max << "\n";
+
+	std::uint32_t width = summary.max / kCostBins + 1;
+
+	for (std::size_t b = 0; b < kCostBins; ++b)
+	{
+		if (summary.histogram[b] == 0)
+			continue;
+
+		std::cout << "  up to " << (b + 1) * width - 1 << ": " << 100.0 * summary.histogram[b] / total << "% of the pixels\n";
+	}
+}
+
+std::vector<unsigned char> cost_heatmap(pixel_cost const* costs, std::size_t count)
+{
+	std::uint32_t max = 0;
+
+	for (std::size_t p = 0; p < count; ++p)
+	{
+		max = std::max(max, costs[p].tests + costs[p].visits);
+	}
+
+	std::vector<unsigned char> rgb(3 * count);
+
+	for (std::size_t p = 0; p < count; ++p)
+	{
+		// black to red, red to yellow and yellow to white over the thirds of the range
+		float t = max != 0 ? 3.f * (costs[p].tests + costs[p].visits) / max : 0.f;
+
+		rgb[3 * p] = channel(t);
+		rgb[3 * p + 1] = channel(t - 1.f);
+		rgb[3 * p + 2] = channel(t - 2.f);
+	}
+
+	return rgb;
+}
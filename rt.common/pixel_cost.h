@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Work the tracer spent on the ray of one pixel: the ray-sphere tests and the BVH nodes it
+// loaded. The counters only exist in the instrumentation builds, the kernels built with
+// -D RT_AOV_COST (the cost channel of --aov) and the CPU tracers built with RT_COST_COUNTERS
+// (render_cost in cpu_trace.h); the normal builds don't count anything.
+struct pixel_cost
+{
+	std::uint32_t tests;
+	std::uint32_t visits;
+};
+
+// Bins of cost_summary::histogram
+std::size_t const kCostBins = 16;
+
+// One counter of pixel_cost over an image
+struct cost_summary
+{
+	double mean;
+	std::uint32_t max;
+	// Pixels per bin of equal width from 0 to max, the last one holds max
+	std::uint32_t histogram[kCostBins];
+};
+
+// Mean, maximum and histogram of the counter of the count pixels of costs
+cost_summary summarize_cost(pixel_cost const* costs, std::size_t count, std::uint32_t pixel_cost::*counter);
+
+// Print summary of the counter name, the histogram as the upper bound and share of each bin
+void print_cost_summary(char const* name, cost_summary const& summary);
+
+// The tests and visits of each of the count pixels of costs as an rgb8 image: black for no
+// work through red and yellow to white for the most expensive pixel of the image
+std::vector<unsigned char> cost_heatmap(pixel_cost const* costs, std::size_t count);
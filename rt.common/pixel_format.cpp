@@ -0,0 +1,141 @@
+#include "pixel_format.h"
+
+#include <cstring>
+
+#include <OpenImageIO/imageio.h>
+
+char const* pixel_format_name(pixel_format format)
+{
+	switch (format)
+	{
+	case pixel_format::half: return "half";
+	case pixel_format::rgba8: return "rgba8";
+	case pixel_format::id16: return "id16";
+	case pixel_format::id32: return "id32";
+	case pixel_format::float4: return "float4";
+	default: return "float";
+	}
+}
+
+bool parse_pixel_format(char const* name, pixel_format& format)
+{
+	for (auto candidate : { pixel_format::float32, pixel_format::half, pixel_format::rgba8, pixel_format::id16, pixel_format::id32, pixel_format::float4 })
+	{
+		if (std::strcmp(name, pixel_format_name(candidate)) == 0)
+		{
+			format = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::size_t pixel_size(pixel_format format)
+{
+	switch (format)
+	{
+	case pixel_format::half: return 3 * 2;
+	case pixel_format::rgba8: return 4;
+	case pixel_format::id16: return sizeof(std::uint16_t);
+	case pixel_format::id32: return sizeof(std::uint32_t);
+	case pixel_format::float4: return 4 * sizeof(float);
+	default: return 3 * sizeof(float);
+	}
+}
+
+int pixel_channels(pixel_format format)
+{
+	switch (format)
+	{
+	case pixel_format::rgba8:
+	case pixel_format::float4: return 4;
+	case pixel_format::id16:
+	case pixel_format::id32: return 1;
+	default: return 3;
+	}
+}
+
+OIIO_NAMESPACE::TypeDesc pixel_type(pixel_format format)
+{
+	switch (format)
+	{
+	case pixel_format::half: return OIIO_NAMESPACE::TypeDesc::HALF;
+	case pixel_format::rgba8: return OIIO_NAMESPACE::TypeDesc::UINT8;
+	case pixel_format::id16: return OIIO_NAMESPACE::TypeDesc::UINT16;
+	case pixel_format::id32: return OIIO_NAMESPACE::TypeDesc::UINT;
+	default: return OIIO_NAMESPACE::TypeDesc::FLOAT;
+	}
+}
+
+bool is_id_format(pixel_format format)
+{
+	return format == pixel_format::id16 || format == pixel_format::id32;
+}
+
+std::size_t max_id_spheres(pixel_format format)
+{
+	return format == pixel_format::id16 ? kNoSphere16 : kNoSphere32;
+}
+
+void resolve_ids(unsigned char const* ids, pixel_format id_format, std::size_t count, float const* colors, float* dst)
+{
+	// the background of the tracers, kBackground in cpu_trace.cpp
+	float const background[3] = { 0.1f, 0.1f, 0.1f };
+
+	for (std::size_t p = 0; p < count; ++p, dst += 3)
+	{
+		float const* color = background;
+
+		if (id_format == pixel_format::id16)
+		{
+			std::uint16_t id;
+			std::memcpy(&id, ids + p * sizeof(id), sizeof(id));
+
+			if (id != kNoSphere16)
+				color = colors + std::size_t(id) * 3;
+		}
+		else
+		{
+			std::uint32_t id;
+			std::memcpy(&id, ids + p * sizeof(id), sizeof(id));
+
+			if (id != kNoSphere32)
+				color = colors + std::size_t(id) * 3;
+		}
+
+		dst[0] = color[0];
+		dst[1] = color[1];
+		dst[2] = color[2];
+	}
+}
+
+void convert_rows(float const* src, pixel_format format, std::uint32_t width, std::uint32_t row_begin, std::uint32_t row_end, unsigned char* dst)
+{
+	auto size = pixel_size(format);
+	auto rows = static_cast<int>(row_end - row_begin);
+
+	src += std::size_t(width) * row_begin * 3;
+	dst += std::size_t(width) * row_begin * size;
+
+	// OIIO does the same conversion when it writes float pixels to a lower precision file
+	OIIO_NAMESPACE::convert_image(3, static_cast<int>(width), rows, 1, src, OIIO_NAMESPACE::TypeDesc::FLOAT, 3 * sizeof(float), OIIO_NAMESPACE::AutoStride, OIIO_NAMESPACE::AutoStride,
+	                              dst, pixel_type(format), size, OIIO_NAMESPACE::AutoStride, OIIO_NAMESPACE::AutoStride);
+
+	if (format == pixel_format::rgba8)
+	{
+		for (std::size_t p = 0; p < std::size_t(width) * rows; ++p)
+		{
+			dst[p * 4 + 3] = 255;
+		}
+	}
+	else if (format == pixel_format::float4)
+	{
+		float const padding = 0.f;
+
+		for (std::size_t p = 0; p < std::size_t(width) * rows; ++p)
+		{
+			std::memcpy(dst + p * size + 3 * sizeof(float), &padding, sizeof(padding));
+		}
+	}
+}
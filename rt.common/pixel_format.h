@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <OpenImageIO/typedesc.h>
+
+// Framebuffer layout written by the kernels, RT_FORMAT in trace.cl, and the CPU tile tracers
+enum class pixel_format
+{
+	// rgb, 32-bit float per channel
+	float32,
+	// rgb, 16-bit half per channel
+	half,
+	// rgba, 8 bits per channel quantized as OIIO does for PNG, alpha is 255
+	rgba8,
+	// index of the closest sphere, 16 bits, kNoSphere16 for the background; scenes of fewer
+	// than kNoSphere16 spheres. resolve_ids() colors it.
+	id16,
+	// index of the closest sphere, 32 bits, kNoSphere32 for the background
+	id32,
+	// rgb, 32-bit float per channel, padded with a zero to 16 bytes so a pixel is one aligned
+	// vector store; written to files as rgb through a pixel stride of 16 bytes
+	float4
+};
+
+// Background of the id formats
+std::uint16_t const kNoSphere16 = 0xFFFF;
+std::uint32_t const kNoSphere32 = 0xFFFFFFFF;
+
+char const* pixel_format_name(pixel_format format);
+
+// Returns false for an unknown name and leaves format untouched
+bool parse_pixel_format(char const* name, pixel_format& format);
+
+// Bytes per pixel
+std::size_t pixel_size(pixel_format format);
+
+// Channels a pixel holds, rgb first: rgba8 has an alpha channel after them, float4 the padding
+int pixel_channels(pixel_format format);
+
+// Channel type passed to OIIO when writing the framebuffer
+OIIO_NAMESPACE::TypeDesc pixel_type(pixel_format format);
+
+// True for id16 and id32, whose pixels are sphere indices rather than colors
+bool is_id_format(pixel_format format);
+
+// Largest number of spheres format can name, below its background value
+std::size_t max_id_spheres(pixel_format format);
+
+// Color the count pixels of ids, in the id format id_format, with the rgb float colors of the
+// spheres they name (3 floats per sphere) and the background of the tracers elsewhere, into
+// the rgb float pixels of dst
+void resolve_ids(unsigned char const* ids, pixel_format id_format, std::size_t count, float const* colors, float* dst);
+
+// Convert rows [row_begin, row_end) of the rgb float image src into the framebuffer dst of
+// the given format, both width pixels wide; format is not an id format
+void convert_rows(float const* src, pixel_format format, std::uint32_t width, std::uint32_t row_begin, std::uint32_t row_end, unsigned char* dst);
@@ -0,0 +1,883 @@
+#include "point_import.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace
+{
+	// Read-only mapping of a whole file
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		~mapped_file()
+		{
+			close();
+		}
+
+		mapped_file(mapped_file const&) = delete;
+		mapped_file& operator=(mapped_file const&) = delete;
+
+		// Returns false with a message if path can't be mapped or is empty
+		bool open(std::string const& path)
+		{
+#ifdef _WIN32
+			file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			LARGE_INTEGER file_size = {};
+
+			if (file_ == INVALID_HANDLE_VALUE)
+				file_ = nullptr;
+
+			if (file_ && GetFileSizeEx(file_, &file_size))
+				size_ = static_cast<std::size_t>(file_size.QuadPart);
+
+			mapping_ = size_ > 0 ? CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+			data_ = mapping_ ? static_cast<char const*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			struct stat st = {};
+
+			if (fd >= 0 && fstat(fd, &st) == 0)
+				size_ = static_cast<std::size_t>(st.st_size);
+
+			void* data = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+			data_ = data == MAP_FAILED ? nullptr : static_cast<char const*>(data);
+
+			// the pages are read front to back, once
+			if (data_)
+				madvise(data, size_, MADV_SEQUENTIAL);
+
+			if (fd >= 0)
+				::close(fd);
+#endif
+
+			if (!data_)
+			{
+				close();
+				std::cout << "Can't map " << path << "\n";
+				return false;
+			}
+
+			return true;
+		}
+
+		void close()
+		{
+#ifdef _WIN32
+			if (data_)
+				UnmapViewOfFile(data_);
+
+			if (mapping_)
+				CloseHandle(mapping_);
+
+			if (file_)
+				CloseHandle(file_);
+
+			file_ = mapping_ = nullptr;
+#else
+			if (data_)
+				munmap(const_cast<char*>(data_), size_);
+#endif
+
+			data_ = nullptr;
+			size_ = 0;
+		}
+
+		char const* begin() const
+		{
+			return data_;
+		}
+
+		char const* end() const
+		{
+			return data_ + size_;
+		}
+
+		std::size_t size() const
+		{
+			return size_;
+		}
+
+	private:
+		char const* data_ = nullptr;
+		std::size_t size_ = 0;
+#ifdef _WIN32
+		void* file_ = nullptr;
+		void* mapping_ = nullptr;
+#endif
+	};
+
+	double const kPowersOf10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	bool is_digit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	bool is_separator(char c)
+	{
+		return c == ',' || c == ';' || c == ' ' || c == '\t';
+	}
+
+	// Parse a decimal number [+-]digits[.digits][(e|E)[+-]digits] at p into value and move p past
+	// it, false if there is none. The first 19 significant digits are summed in an integer and
+	// scaled by an exact power of ten in double, within a float ulp of std::strtof for the
+	// coordinates of a scan, without its locale and its copy into a terminated string.
+	bool parse_float(char const*& p, char const* end, float& value)
+	{
+		auto s = p;
+		bool negative = false;
+
+		if (s < end && (*s == '-' || *s == '+'))
+			negative = *s++ == '-';
+
+		std::uint64_t mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+
+		for (; s < end && is_digit(*s); ++s, ++digits)
+		{
+			if (mantissa < 1000000000000000000ULL)
+				mantissa = mantissa * 10 + static_cast<std::uint64_t>(*s - '0');
+			else
+				++exponent;
+		}
+
+		if (s < end && *s == '.')
+		{
+			for (++s; s < end && is_digit(*s); ++s, ++digits)
+			{
+				if (mantissa < 1000000000000000000ULL)
+				{
+					mantissa = mantissa * 10 + static_cast<std::uint64_t>(*s - '0');
+					--exponent;
+				}
+			}
+		}
+
+		if (digits == 0)
+			return false;
+
+		if (s < end && (*s == 'e' || *s == 'E'))
+		{
+			auto e = s + 1;
+			bool negative_exponent = false;
+
+			if (e < end && (*e == '-' || *e == '+'))
+				negative_exponent = *e++ == '-';
+
+			if (e < end && is_digit(*e))
+			{
+				int written = 0;
+
+				for (; e < end && is_digit(*e); ++e)
+				{
+					written = std::min(written * 10 + (*e - '0'), 1000);
+				}
+
+				exponent += negative_exponent ? -written : written;
+				s = e;
+			}
+		}
+
+		double result = static_cast<double>(mantissa);
+
+		if (exponent < 0)
+			result = exponent >= -22 ? result / kPowersOf10[-exponent] : result * std::pow(10.0, exponent);
+		else if (exponent > 0)
+			result = exponent <= 22 ? result * kPowersOf10[exponent] : result * std::pow(10.0, exponent);
+
+		value = static_cast<float>(negative ? -result : result);
+		p = s;
+		return true;
+	}
+
+	// Whether the line at p holds data: not blank and no '#' comment
+	bool is_data_line(char const* p, char const* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		{
+			++p;
+		}
+
+		return p < end && *p != '\n' && *p != '#';
+	}
+
+	char const* next_line(char const* p, char const* end)
+	{
+		auto found = static_cast<char const*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+		return found ? found + 1 : end;
+	}
+
+	// Lines [begin, end) of a text in chunks, one per worker, each starting at a line
+	struct text_chunk
+	{
+		char const* begin;
+		char const* end;
+		// Data lines before the chunk and in it
+		std::uint64_t first;
+		std::uint64_t lines;
+	};
+
+	// Cut [begin, end) into a chunk per worker of pool at line breaks and count the data lines
+	// of each on its worker
+	std::vector<text_chunk> split_lines(char const* begin, char const* end, thread_pool& pool)
+	{
+		std::vector<text_chunk> chunks(pool.size());
+		auto size = static_cast<std::size_t>(end - begin);
+		auto start = begin;
+
+		for (std::size_t c = 0; c < chunks.size(); ++c)
+		{
+			auto stop = c + 1 == chunks.size() ? end : std::max(start, begin + size * (c + 1) / chunks.size());
+
+			if (stop != end && stop != begin && stop[-1] != '\n')
+				stop = next_line(stop, end);
+
+			chunks[c] = text_chunk{ start, stop, 0, 0 };
+			start = stop;
+		}
+
+		pool.run_each([&](std::uint32_t worker)
+		{
+			auto& chunk = chunks[worker];
+
+			for (auto p = chunk.begin; p < chunk.end; p = next_line(p, chunk.end))
+			{
+				chunk.lines += is_data_line(p, chunk.end) ? 1 : 0;
+			}
+		});
+
+		for (std::size_t c = 1; c < chunks.size(); ++c)
+		{
+			chunks[c].first = chunks[c - 1].first + chunks[c - 1].lines;
+		}
+
+		return chunks;
+	}
+
+	// Where the values of a point come from: the column, property or field of x, y, z, radius,
+	// red, green and blue, or kMissing
+	int const kMissing = -1;
+
+	enum point_value
+	{
+		value_x,
+		value_y,
+		value_z,
+		value_radius,
+		value_red,
+		value_green,
+		value_blue,
+		num_point_values
+	};
+
+	// Set point i of spheres from the values of its columns, the ones missing from options
+	void set_point(sphere_soa& spheres, std::uint32_t i, float const* values, int const* source, float color_scale, point_import_options const& options)
+	{
+		auto pick = [&](int v, float fallback)
+		{
+			return source[v] == kMissing ? fallback : values[source[v]];
+		};
+
+		spheres.set(i, values[source[value_x]], values[source[value_y]], values[source[value_z]], pick(value_radius, options.radius),
+		            source[value_red] == kMissing ? options.red : values[source[value_red]] * color_scale,
+		            source[value_green] == kMissing ? options.green : values[source[value_green]] * color_scale,
+		            source[value_blue] == kMissing ? options.blue : values[source[value_blue]] * color_scale);
+	}
+
+	// Parse the whitespace or comma separated numbers of the line at p, at most max_values of
+	// them, into values. Returns their count, or -1 if something else is on the line.
+	int parse_line_values(char const* p, char const* end, float* values, int max_values)
+	{
+		int count = 0;
+
+		while (true)
+		{
+			while (p < end && is_separator(*p))
+			{
+				++p;
+			}
+
+			if (p == end || *p == '\n' || *p == '\r')
+				return count;
+
+			float value;
+
+			if (count == max_values || !parse_float(p, end, value))
+				return -1;
+
+			values[count++] = value;
+		}
+	}
+
+	// Parse the data lines of the text [begin, end) as points of the columns in source, the first
+	// max_points of them, into spheres. Returns false with a message naming the first bad line.
+	bool parse_text_points(char const* begin, char const* end, int num_columns, int const* source, float color_scale, std::uint64_t max_points,
+	                       point_import_options const& options, thread_pool& pool, sphere_soa& spheres, std::string const& path)
+	{
+		auto chunks = split_lines(begin, end, pool);
+		auto total = chunks.back().first + chunks.back().lines;
+
+		if (max_points != std::numeric_limits<std::uint64_t>::max() && total < max_points)
+		{
+			std::cout << path << " holds " << total << " of its " << max_points << " points\n";
+			return false;
+		}
+
+		auto count = std::min(total, max_points);
+
+		if (count == 0 || count > std::numeric_limits<std::uint32_t>::max())
+		{
+			std::cout << path << " holds " << count << " points\n";
+			return false;
+		}
+
+		spheres.resize(static_cast<std::uint32_t>(count));
+
+		// the lowest point that failed to parse, count if none did
+		std::atomic<std::uint64_t> bad(count);
+
+		pool.run_each([&](std::uint32_t worker)
+		{
+			auto const& chunk = chunks[worker];
+			auto i = chunk.first;
+			float values[64];
+
+			for (auto p = chunk.begin; p < chunk.end && i < count; p = next_line(p, chunk.end))
+			{
+				if (!is_data_line(p, chunk.end))
+					continue;
+
+				if (parse_line_values(p, chunk.end, values, 64) < num_columns)
+				{
+					auto seen = bad.load();
+
+					while (i < seen && !bad.compare_exchange_weak(seen, i))
+					{
+					}
+
+					return;
+				}
+
+				set_point(spheres, static_cast<std::uint32_t>(i++), values, source, color_scale, options);
+			}
+		});
+
+		if (bad.load() != count)
+		{
+			std::cout << path << ": point " << bad.load() + 1 << " doesn't hold " << num_columns << " numbers\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	std::string lower(std::string text)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+		return text;
+	}
+
+	// Value of a column or property name, num_point_values for one that isn't read
+	int point_value_of(std::string const& name)
+	{
+		static char const* const names[][2] = { { "x", "x" },           { "y", "y" },         { "z", "z" },          { "radius", "radius" },
+		                                        { "red", "r" },         { "green", "g" },     { "blue", "b" } };
+
+		for (int v = 0; v < num_point_values; ++v)
+		{
+			if (name == names[v][0] || name == names[v][1])
+				return v;
+		}
+
+		return num_point_values;
+	}
+
+	bool import_csv(mapped_file const& file, point_import_options const& options, thread_pool& pool, sphere_soa& spheres, std::string const& path)
+	{
+		int source[num_point_values];
+		std::fill(source, source + num_point_values, kMissing);
+
+		// the first data line names the columns or is the first point
+		auto first = file.begin();
+
+		while (first < file.end() && !is_data_line(first, file.end()))
+		{
+			first = next_line(first, file.end());
+		}
+
+		auto first_end = next_line(first, file.end());
+		float values[64];
+		int num_columns = parse_line_values(first, file.end(), values, 64);
+		auto data = first;
+
+		if (num_columns < 0)
+		{
+			std::string header(first, first_end);
+			std::replace_if(header.begin(), header.end(), [](char c) { return is_separator(c) || c == '\r' || c == '\n'; }, ' ');
+			std::istringstream names(header);
+			std::string name;
+
+			for (num_columns = 0; names >> name; ++num_columns)
+			{
+				auto v = point_value_of(lower(name));
+
+				if (v != num_point_values && source[v] == kMissing)
+					source[v] = num_columns;
+			}
+
+			if (source[value_x] == kMissing || source[value_y] == kMissing || source[value_z] == kMissing)
+			{
+				std::cout << path << " names no x, y and z columns\n";
+				return false;
+			}
+
+			data = first_end;
+		}
+		else
+		{
+			// x y z, x y z radius, x y z red green blue or x y z radius red green blue
+			static int const layouts[][num_point_values] = { { 0, 1, 2, kMissing, kMissing, kMissing, kMissing },
+			                                                 { 0, 1, 2, 3, kMissing, kMissing, kMissing },
+			                                                 { 0, 1, 2, kMissing, 3, 4, 5 },
+			                                                 { 0, 1, 2, 3, 4, 5, 6 } };
+			int layout = num_columns == 3 ? 0 : num_columns == 4 ? 1 : num_columns == 6 ? 2 : num_columns == 7 ? 3 : -1;
+
+			if (layout < 0)
+			{
+				std::cout << path << " has " << num_columns << " columns, expected x, y, z, optionally radius and optionally red, green, blue\n";
+				return false;
+			}
+
+			std::copy(layouts[layout], layouts[layout] + num_point_values, source);
+		}
+
+		// colors of 0 to 255 if the first point says so
+		float color_scale = 1.0f;
+		auto first_point = data;
+
+		while (first_point < file.end() && !is_data_line(first_point, file.end()))
+		{
+			first_point = next_line(first_point, file.end());
+		}
+
+		if (parse_line_values(first_point, file.end(), values, 64) >= num_columns)
+		{
+			for (int v = value_red; v <= value_blue; ++v)
+			{
+				if (source[v] != kMissing && values[source[v]] > 1.0f)
+					color_scale = 1.0f / 255.0f;
+			}
+		}
+
+		return parse_text_points(data, file.end(), num_columns, source, color_scale, std::numeric_limits<std::uint64_t>::max(), options, pool, spheres, path);
+	}
+
+	// Binary PLY property types by name, with their size
+	bool ply_type(std::string const& name, std::uint32_t& size, bool& is_float, bool& is_signed)
+	{
+		static struct
+		{
+			char const* names[2];
+			std::uint32_t size;
+			bool is_float, is_signed;
+		} const types[] = { { { "char", "int8" }, 1, false, true },     { { "uchar", "uint8" }, 1, false, false },   { { "short", "int16" }, 2, false, true },
+		                    { { "ushort", "uint16" }, 2, false, false }, { { "int", "int32" }, 4, false, true },      { { "uint", "uint32" }, 4, false, false },
+		                    { { "float", "float32" }, 4, true, true },   { { "double", "float64" }, 8, true, true } };
+
+		for (auto const& type : types)
+		{
+			if (name == type.names[0] || name == type.names[1])
+			{
+				size = type.size;
+				is_float = type.is_float;
+				is_signed = type.is_signed;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	struct ply_property
+	{
+		std::uint32_t offset, size;
+		bool is_float, is_signed;
+		int value;
+	};
+
+	// Read a binary PLY property of a record into a double, swapping its bytes if swap is set
+	double read_property(unsigned char const* record, ply_property const& property, bool swap)
+	{
+		unsigned char bytes[8];
+		std::memcpy(bytes, record + property.offset, property.size);
+
+		if (swap)
+			std::reverse(bytes, bytes + property.size);
+
+		switch (property.size)
+		{
+		case 1:
+			return property.is_signed ? static_cast<double>(static_cast<std::int8_t>(bytes[0])) : static_cast<double>(bytes[0]);
+		case 2:
+		{
+			std::uint16_t v;
+			std::memcpy(&v, bytes, 2);
+			return property.is_signed ? static_cast<double>(static_cast<std::int16_t>(v)) : static_cast<double>(v);
+		}
+		case 4:
+		{
+			if (property.is_float)
+			{
+				float f;
+				std::memcpy(&f, bytes, 4);
+				return f;
+			}
+
+			std::uint32_t v;
+			std::memcpy(&v, bytes, 4);
+			return property.is_signed ? static_cast<double>(static_cast<std::int32_t>(v)) : static_cast<double>(v);
+		}
+		default:
+		{
+			double d;
+			std::memcpy(&d, bytes, 8);
+			return d;
+		}
+		}
+	}
+
+	bool import_ply(mapped_file const& file, point_import_options const& options, thread_pool& pool, sphere_soa& spheres, std::string const& path)
+	{
+		static char const kEndHeader[] = "end_header";
+
+		auto header_end = std::search(file.begin(), file.end(), kEndHeader, kEndHeader + sizeof(kEndHeader) - 1);
+
+		if (file.size() < 4 || std::memcmp(file.begin(), "ply", 3) != 0 || header_end == file.end())
+		{
+			std::cout << path << " is not a PLY file\n";
+			return false;
+		}
+
+		auto data = next_line(header_end, file.end());
+		std::istringstream header(std::string(file.begin(), header_end));
+		std::string line, format;
+		std::uint64_t count = 0;
+		// properties of the vertex element and the bytes of a binary vertex
+		std::vector<ply_property> properties;
+		std::uint32_t stride = 0;
+		int element = 0;
+
+		while (std::getline(header, line))
+		{
+			std::istringstream words(line);
+			std::string keyword, type, name;
+			words >> keyword;
+
+			if (keyword == "format")
+			{
+				words >> format;
+			}
+			else if (keyword == "element")
+			{
+				std::uint64_t elements = 0;
+				words >> name >> elements;
+
+				if (++element == 1)
+					count = elements;
+
+				if (element == 1 && name != "vertex")
+				{
+					std::cout << path << ": the vertex element must come first\n";
+					return false;
+				}
+			}
+			else if (keyword == "property" && element == 1)
+			{
+				ply_property property = {};
+				words >> type >> name;
+
+				if (type == "list" || !ply_type(type, property.size, property.is_float, property.is_signed))
+				{
+					std::cout << path << ": can't read vertex property " << type << " " << name << "\n";
+					return false;
+				}
+
+				property.offset = stride;
+				property.value = point_value_of(name);
+				stride += property.size;
+				properties.push_back(property);
+			}
+		}
+
+		int source[num_point_values];
+		std::fill(source, source + num_point_values, kMissing);
+
+		for (std::size_t p = 0; p < properties.size(); ++p)
+		{
+			if (properties[p].value != num_point_values && source[properties[p].value] == kMissing)
+				source[properties[p].value] = static_cast<int>(p);
+		}
+
+		if (source[value_x] == kMissing || source[value_y] == kMissing || source[value_z] == kMissing || count == 0)
+		{
+			std::cout << path << " has no vertices with x, y and z\n";
+			return false;
+		}
+
+		// integer colors span their type
+		float color_scale = 1.0f;
+
+		if (source[value_red] != kMissing && !properties[source[value_red]].is_float)
+			color_scale = 1.0f / static_cast<float>((std::uint64_t(1) << (8 * properties[source[value_red]].size - (properties[source[value_red]].is_signed ? 1 : 0))) - 1);
+
+		if (format == "ascii")
+			return parse_text_points(data, file.end(), static_cast<int>(properties.size()), source, color_scale, count, options, pool, spheres, path);
+
+		if (format != "binary_little_endian" && format != "binary_big_endian")
+		{
+			std::cout << path << ": unknown format " << format << "\n";
+			return false;
+		}
+
+		if (static_cast<std::uint64_t>(file.end() - data) / stride < count || count > std::numeric_limits<std::uint32_t>::max())
+		{
+			std::cout << path << " ends before its " << count << " vertices\n";
+			return false;
+		}
+
+		std::uint16_t probe = 1;
+		bool little_endian = *reinterpret_cast<unsigned char const*>(&probe) == 1;
+		bool swap = (format == "binary_little_endian") != little_endian;
+		auto records = reinterpret_cast<unsigned char const*>(data);
+
+		spheres.resize(static_cast<std::uint32_t>(count));
+
+		pool.run_each([&](std::uint32_t worker)
+		{
+			auto begin = count * worker / pool.size();
+			auto end = count * (worker + 1) / pool.size();
+			float values[64];
+
+			for (auto i = begin; i < end; ++i)
+			{
+				auto record = records + i * stride;
+
+				for (std::size_t p = 0; p < properties.size() && p < 64; ++p)
+				{
+					values[p] = static_cast<float>(read_property(record, properties[p], swap));
+				}
+
+				set_point(spheres, static_cast<std::uint32_t>(i), values, source, color_scale, options);
+			}
+		});
+
+		return true;
+	}
+
+	template <typename T>
+	T read_field(char const* data, std::size_t offset)
+	{
+		T value;
+		std::memcpy(&value, data + offset, sizeof(value));
+		return value;
+	}
+
+	bool import_las(mapped_file const& file, point_import_options const& options, thread_pool& pool, sphere_soa& spheres, std::string const& path)
+	{
+		// fields of the public header block, LAS 1.0 to 1.4, little endian as every LAS host
+		if (file.size() < 227 || std::memcmp(file.begin(), "LASF", 4) != 0)
+		{
+			std::cout << path << " is not a LAS file\n";
+			return false;
+		}
+
+		auto const* h = file.begin();
+		auto minor = static_cast<std::uint8_t>(h[25]);
+		auto offset = read_field<std::uint32_t>(h, 96);
+		auto point_format = static_cast<std::uint8_t>(h[104]) & 0x3f;
+		std::uint64_t record_length = read_field<std::uint16_t>(h, 105);
+		std::uint64_t count = read_field<std::uint32_t>(h, 107);
+		double scale[3], origin[3];
+
+		for (int a = 0; a < 3; ++a)
+		{
+			scale[a] = read_field<double>(h, 131 + 8 * a);
+			origin[a] = read_field<double>(h, 155 + 8 * a);
+		}
+
+		// LAS 1.4 counts past 2^32 points in a 64-bit field, the legacy one is then zero
+		if (count == 0 && minor >= 4 && file.size() >= 255)
+			count = read_field<std::uint64_t>(h, 247);
+
+		// where the RGB of the point formats that have it start in a record
+		static int const kRgbOffsets[] = { -1, -1, 20, 28, -1, 28, -1, 30, 30, -1, 30 };
+		int rgb = point_format < 11 ? kRgbOffsets[point_format] : -1;
+
+		if (point_format > 10 || record_length < 12 || (rgb >= 0 && record_length < static_cast<std::uint64_t>(rgb) + 6))
+		{
+			std::cout << path << ": can't read point format " << point_format << " of " << record_length << " bytes\n";
+			return false;
+		}
+
+		if (count == 0 || count > std::numeric_limits<std::uint32_t>::max() || offset > file.size() || (file.size() - offset) / record_length < count)
+		{
+			std::cout << path << " doesn't hold its " << count << " points\n";
+			return false;
+		}
+
+		auto records = file.begin() + offset;
+		spheres.resize(static_cast<std::uint32_t>(count));
+
+		pool.run_each([&](std::uint32_t worker)
+		{
+			auto begin = count * worker / pool.size();
+			auto end = count * (worker + 1) / pool.size();
+
+			for (auto i = begin; i < end; ++i)
+			{
+				auto record = records + i * record_length;
+				float position[3];
+
+				for (int a = 0; a < 3; ++a)
+				{
+					position[a] = static_cast<float>(read_field<std::int32_t>(record, 4 * a) * scale[a] + origin[a]);
+				}
+
+				float color[3] = { options.red, options.green, options.blue };
+
+				for (int c = 0; rgb >= 0 && c < 3; ++c)
+				{
+					color[c] = read_field<std::uint16_t>(record, static_cast<std::size_t>(rgb) + 2 * c) / 65535.0f;
+				}
+
+				spheres.set(static_cast<std::uint32_t>(i), position[0], position[1], position[2], options.radius, color[0], color[1], color[2]);
+			}
+		});
+
+		return true;
+	}
+
+	// Scale and move spheres into x and y in [-10, 10], z in [-5, 15], the generated volume, keeping
+	// their proportions
+	void fit_points(sphere_soa& spheres, thread_pool& pool)
+	{
+		std::vector<float> low(3 * pool.size(), std::numeric_limits<float>::max());
+		std::vector<float> high(3 * pool.size(), std::numeric_limits<float>::lowest());
+		auto count = spheres.size();
+
+		pool.run_each([&](std::uint32_t worker)
+		{
+			auto begin = static_cast<std::uint32_t>(std::uint64_t(count) * worker / pool.size());
+			auto end = static_cast<std::uint32_t>(std::uint64_t(count) * (worker + 1) / pool.size());
+			std::vector<float> const* axes[] = { &spheres.cx, &spheres.cy, &spheres.cz };
+
+			for (int a = 0; a < 3; ++a)
+			{
+				for (auto i = begin; i < end; ++i)
+				{
+					low[3 * worker + a] = std::min(low[3 * worker + a], (*axes[a])[i]);
+					high[3 * worker + a] = std::max(high[3 * worker + a], (*axes[a])[i]);
+				}
+			}
+		});
+
+		float center[3], extent = 0.0f;
+
+		for (int a = 0; a < 3; ++a)
+		{
+			float axis_low = std::numeric_limits<float>::max();
+			float axis_high = std::numeric_limits<float>::lowest();
+
+			for (std::uint32_t w = 0; w < pool.size(); ++w)
+			{
+				axis_low = std::min(axis_low, low[3 * w + a]);
+				axis_high = std::max(axis_high, high[3 * w + a]);
+			}
+
+			center[a] = 0.5f * (axis_low + axis_high);
+			extent = std::max(extent, axis_high - axis_low);
+		}
+
+		float scale = extent > 0.0f ? 20.0f / extent : 1.0f;
+
+		pool.run_each([&](std::uint32_t worker)
+		{
+			auto begin = static_cast<std::uint32_t>(std::uint64_t(count) * worker / pool.size());
+			auto end = static_cast<std::uint32_t>(std::uint64_t(count) * (worker + 1) / pool.size());
+
+			for (auto i = begin; i < end; ++i)
+			{
+				spheres.set(i, (spheres.cx[i] - center[0]) * scale, (spheres.cy[i] - center[1]) * scale, (spheres.cz[i] - center[2]) * scale + 5.0f,
+				            spheres.radius[i] * scale, spheres.color[3 * i], spheres.color[3 * i + 1], spheres.color[3 * i + 2]);
+			}
+		});
+	}
+}
+
+char const* point_format_name(point_format format)
+{
+	switch (format)
+	{
+	case point_format::ply: return "ply";
+	case point_format::las: return "las";
+	default: return "csv";
+	}
+}
+
+bool detect_point_format(std::string const& path, point_format& format)
+{
+	auto dot = path.find_last_of('.');
+	auto extension = dot == std::string::npos ? std::string() : lower(path.substr(dot + 1));
+
+	if (extension == "csv" || extension == "txt")
+		format = point_format::csv;
+	else if (extension == "ply")
+		format = point_format::ply;
+	else if (extension == "las")
+		format = point_format::las;
+	else
+		return false;
+
+	return true;
+}
+
+bool import_points(std::string const& path, point_format format, point_import_options const& options, thread_pool& pool, sphere_soa& spheres)
+{
+	mapped_file file;
+
+	if (!file.open(path))
+		return false;
+
+	bool imported = format == point_format::ply ? import_ply(file, options, pool, spheres, path)
+	                : format == point_format::las ? import_las(file, options, pool, spheres, path)
+	                                              : import_csv(file, options, pool, spheres, path);
+
+	if (imported && options.fit)
+		fit_points(spheres, pool);
+
+	return imported;
+}
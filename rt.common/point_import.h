@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+
+#include "scene.h"
+
+class thread_pool;
+
+// Point cloud files import_points reads
+enum class point_format
+{
+	// Text, one point per line
+	csv,
+	// Polygon file format, ascii or binary
+	ply,
+	// ASPRS LAS 1.0 to 1.4
+	las
+};
+
+char const* point_format_name(point_format format);
+
+// Format of path by its extension: .csv or .txt, .ply, .las; returns false for anything else
+bool detect_point_format(std::string const& path, point_format& format);
+
+// What import_points gives the points a file doesn't
+struct point_import_options
+{
+	// Radius of every point without one of its own
+	float radius = 0.05f;
+	// Color of every point without one of its own
+	float red = 0.8f, green = 0.8f, blue = 0.8f;
+	// Scale and move the points, radii included, into the volume generate_spheres fills, so the
+	// default view shows a scan in any units and coordinate system
+	bool fit = false;
+};
+
+// Read the points of path in format into spheres, one sphere each. The file is mapped and cut
+// into chunks the workers of pool parse at once, straight into the arrays of spheres; the text
+// formats are cut at line breaks, counted in a first pass so every chunk knows where its
+// points go. What each format holds:
+//   csv: x, y, z, then optionally radius, then optionally red, green, blue per line, separated by
+//        commas, semicolons or whitespace, or the columns a first line names (x, y, z, radius,
+//        red or r, green or g, blue or b, others are skipped); '#' starts a comment line
+//   ply: the vertex element, which must be the first one, with properties x, y, z and
+//        optionally radius and red, green, blue, in ascii or either binary byte order
+//   las: the scaled coordinates of every point record, and the RGB of point formats 2, 3, 5,
+//        7, 8 and 10
+// Colors in integer PLY and LAS properties span their range, the csv ones 0 to 1, or 0 to 255
+// if a color of the first point is above 1. Returns false with a message if the file can't be
+// read or is not one of format.
+bool import_points(std::string const& path, point_format format, point_import_options const& options, thread_pool& pool, sphere_soa& spheres);
@@ -0,0 +1,137 @@
+#include "post_process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imagebufalgo.h>
+
+#include "profile_markers.h"
+
+namespace
+{
+	// output without its extension and the extension with its dot
+	void split_extension(std::string const& output, std::string& stem, std::string& extension)
+	{
+		auto dot = output.find_last_of('.');
+		auto slash = output.find_last_of("/\\");
+
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			dot = output.size();
+
+		stem = output.substr(0, dot);
+		extension = output.substr(dot);
+	}
+}
+
+bool parse_post_op(char const* text, post_op& op)
+{
+	post_op parsed = {};
+	char end;
+
+	if (std::strcmp(text, "srgb") == 0)
+	{
+		parsed.kind = post_op_kind::srgb;
+	}
+	else if (std::sscanf(text, "thumb:%ux%u%c", &parsed.width, &parsed.height, &end) == 2)
+	{
+		parsed.kind = post_op_kind::thumbnail;
+	}
+	else if (std::sscanf(text, "crop:%u,%u,%ux%u%c", &parsed.x, &parsed.y, &parsed.width, &parsed.height, &end) == 4)
+	{
+		parsed.kind = post_op_kind::crop;
+	}
+	else
+	{
+		return false;
+	}
+
+	if (parsed.kind != post_op_kind::srgb && (parsed.width == 0 || parsed.height == 0))
+		return false;
+
+	op = parsed;
+	return true;
+}
+
+std::string post_op_file_name(std::string const& output, post_op const& op)
+{
+	std::string stem, extension;
+	split_extension(output, stem, extension);
+
+	switch (op.kind)
+	{
+	case post_op_kind::thumbnail: return stem + ".thumb" + std::to_string(op.width) + "x" + std::to_string(op.height) + extension;
+	case post_op_kind::crop: return stem + ".crop" + extension;
+	default: return stem + ".srgb" + extension;
+	}
+}
+
+bool run_post_ops(std::vector<post_op> const& ops, std::string const& output, std::uint32_t width, std::uint32_t height, pixel_format format,
+                  unsigned char* pixels, int threads)
+{
+	using namespace OIIO_NAMESPACE;
+
+	if (ops.empty())
+		return true;
+
+	profile_range range("post");
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// the framebuffer as it is, rgba8 keeps its alpha channel and float4 its padding, the ops
+	// take the rgb ones
+	int channels = pixel_channels(format);
+	ImageBuf frame(ImageSpec(static_cast<int>(width), static_cast<int>(height), channels, pixel_type(format)), pixels);
+	ROI rgb(0, static_cast<int>(width), 0, static_cast<int>(height), 0, 1, 0, 3);
+
+	bool all_done = true;
+
+	for (auto const& op : ops)
+	{
+		auto file = post_op_file_name(output, op);
+		ImageBuf result;
+		bool done = false;
+
+		switch (op.kind)
+		{
+		case post_op_kind::thumbnail:
+			result.reset(ImageSpec(static_cast<int>(op.width), static_cast<int>(op.height), 3, pixel_type(format)));
+			done = ImageBufAlgo::resize(result, frame, "", 0.f, ROI::All(), threads);
+			break;
+
+		case post_op_kind::crop:
+		{
+			if (op.x >= width || op.y >= height)
+			{
+				std::cout << "The crop of " << file << " lies outside the image\n";
+				all_done = false;
+				continue;
+			}
+
+			ROI window(static_cast<int>(op.x), static_cast<int>(std::min(op.width, width - op.x) + op.x), static_cast<int>(op.y),
+			           static_cast<int>(std::min(op.height, height - op.y) + op.y), 0, 1, 0, 3);
+
+			// moved to the origin, so every format stores it
+			done = ImageBufAlgo::cut(result, frame, window, threads);
+			break;
+		}
+
+		default:
+			done = ImageBufAlgo::colorconvert(result, frame, "linear", "sRGB", false, rgb, threads);
+			break;
+		}
+
+		if (!done || !result.write(file))
+		{
+			std::cout << "Can't write " << file << ": " << result.geterror() << "\n";
+			all_done = false;
+		}
+	}
+
+	std::cout << "Post-processed " << ops.size() << " images of " << output << " in "
+	          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms\n";
+
+	return all_done;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pixel_format.h"
+
+// Images derived from a rendered frame (--post), made by OIIO's ImageBufAlgo on the threads of
+// OIIO from an ImageBuf wrapping the framebuffer in place, so the frame is neither copied nor
+// read back from its file
+enum class post_op_kind
+{
+	// resized to width x height
+	thumbnail,
+	// the window of width x height pixels at x, y, clipped to the image
+	crop,
+	// converted from linear to sRGB
+	srgb
+};
+
+struct post_op
+{
+	post_op_kind kind;
+	std::uint32_t x, y, width, height;
+};
+
+// Parse thumb:WxH, crop:x,y,WxH or srgb. Returns false for anything else and leaves op
+// untouched.
+bool parse_post_op(char const* text, post_op& op);
+
+// File the image of op is saved to: output with the op before the extension, e.g.
+// result.thumb256x256.png, result.crop.png or result.srgb.png
+std::string post_op_file_name(std::string const& output, post_op const& op);
+
+// Run ops on the width x height framebuffer pixels in format of the frame saved to output and
+// write their images, in the channel type of format and without the alpha of rgba8. OIIO
+// splits every op over threads threads, 0 for all of them. Returns false with a message if an
+// op or a file fails.
+bool run_post_ops(std::vector<post_op> const& ops, std::string const& output, std::uint32_t width, std::uint32_t height, pixel_format format,
+                  unsigned char* pixels, int threads);
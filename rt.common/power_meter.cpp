@@ -0,0 +1,166 @@
+#include "power_meter.h"
+
+#include <chrono>
+#include <fstream>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+namespace
+{
+	// Period of the board power samples
+	std::chrono::milliseconds const kPowerSample(10);
+
+	// Most DRM cards looked at for a GPU board
+	int const kMaxCards = 16;
+
+	// The number in the sysfs file path
+	bool read_number(std::string const& path, double& value)
+	{
+		std::ifstream in(path);
+		return static_cast<bool>(in >> value);
+	}
+}
+
+power_meter::power_meter()
+{
+#ifndef _WIN32
+	double value = 0.0;
+
+	// the top zones of intel-rapl are the packages, AMD's included, their sub-zones the cores
+	// and DRAM of one
+	for (int p = 0;; ++p)
+	{
+		std::string zone = "/sys/class/powercap/intel-rapl:" + std::to_string(p) + "/";
+		std::ifstream name_file(zone + "name");
+		std::string name;
+
+		if (!(name_file >> name))
+			break;
+
+		if (name.compare(0, 7, "package") == 0 && read_number(zone + "energy_uj", value) && read_number(zone + "max_energy_range_uj", value))
+		{
+			packages_.push_back(zone + "energy_uj");
+			package_ranges_.push_back(value);
+		}
+	}
+
+	for (int card = 0; card < kMaxCards; ++card)
+	{
+		std::string hwmon = "/sys/class/drm/card" + std::to_string(card) + "/device/hwmon/";
+		DIR* dir = opendir(hwmon.c_str());
+
+		if (!dir)
+			continue;
+
+		while (dirent* entry = readdir(dir))
+		{
+			std::string sensor = hwmon + entry->d_name + "/";
+
+			if (entry->d_name[0] == '.')
+				continue;
+
+			// the newer drivers of some boards only have the instantaneous power
+			if (read_number(sensor + "power1_average", value))
+				boards_.push_back(sensor + "power1_average");
+			else if (read_number(sensor + "power1_input", value))
+				boards_.push_back(sensor + "power1_input");
+		}
+
+		closedir(dir);
+	}
+#endif
+
+	package_starts_.resize(packages_.size());
+}
+
+power_meter::~power_meter()
+{
+	if (sampler_.joinable())
+		stop();
+}
+
+bool power_meter::available() const
+{
+	return !packages_.empty() || !boards_.empty();
+}
+
+std::string power_meter::describe() const
+{
+	std::string text = std::to_string(packages_.size()) + (packages_.size() == 1 ? " CPU package, " : " CPU packages, ");
+	return text + std::to_string(boards_.size()) + (boards_.size() == 1 ? " GPU board" : " GPU boards");
+}
+
+void power_meter::start()
+{
+	for (std::size_t p = 0; p < packages_.size(); ++p)
+	{
+		read_number(packages_[p], package_starts_[p]);
+	}
+
+	board_joules_ = 0.0;
+
+	if (boards_.empty())
+		return;
+
+	sampling_ = true;
+
+	// the power of each period is taken at its end, the last one ends at stop()
+	sampler_ = std::thread([this]()
+	{
+		auto before = std::chrono::steady_clock::now();
+		bool running = true;
+
+		while (running)
+		{
+			std::this_thread::sleep_for(kPowerSample);
+			running = sampling_;
+
+			auto now = std::chrono::steady_clock::now();
+			board_joules_ += board_watts() * std::chrono::duration<double>(now - before).count();
+			before = now;
+		}
+	});
+}
+
+energy_use power_meter::stop()
+{
+	energy_use energy = { 0.0, 0.0 };
+
+	for (std::size_t p = 0; p < packages_.size(); ++p)
+	{
+		double now = 0.0;
+
+		if (!read_number(packages_[p], now))
+			continue;
+
+		// the counter wraps around at its range, at most once in a benchmark
+		double used = now >= package_starts_[p] ? now - package_starts_[p] : now + package_ranges_[p] - package_starts_[p];
+		energy.cpu += used * 1e-6;
+	}
+
+	if (sampler_.joinable())
+	{
+		sampling_ = false;
+		sampler_.join();
+		energy.gpu = board_joules_;
+	}
+
+	return energy;
+}
+
+double power_meter::board_watts() const
+{
+	double watts = 0.0;
+
+	for (auto const& board : boards_)
+	{
+		double microwatts = 0.0;
+
+		if (read_number(board, microwatts))
+			watts += microwatts * 1e-6;
+	}
+
+	return watts;
+}
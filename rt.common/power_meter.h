@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Energy in joules the CPU packages and the GPU boards took over a span of time, 0 for a
+// kind the system exposes no source of
+struct energy_use
+{
+	double cpu;
+	double gpu;
+};
+
+// Meter of the energy of the CPU packages, from the RAPL counters of the powercap driver, and
+// of the GPU boards, from the average board power amdgpu exposes through hwmon (what ROCm SMI
+// reads) sampled by a thread of its own while measuring. Linux only, elsewhere it finds no
+// sources; the counters of RAPL may also need root.
+class power_meter
+{
+public:
+	// Find the sources
+	power_meter();
+	~power_meter();
+
+	power_meter(power_meter const&) = delete;
+	power_meter& operator=(power_meter const&) = delete;
+
+	// True if there is a source of either kind
+	bool available() const;
+
+	// The sources for messages, "2 CPU packages, 1 GPU board"
+	std::string describe() const;
+
+	// Start measuring
+	void start();
+
+	// Stop measuring and return the energy since start()
+	energy_use stop();
+
+private:
+	// Board power of all GPUs in watts
+	double board_watts() const;
+
+	// energy_uj of every package, the range it wraps around at and its value at start()
+	std::vector<std::string> packages_;
+	std::vector<double> package_ranges_;
+	std::vector<double> package_starts_;
+	// power1_average or power1_input in microwatts of every board
+	std::vector<std::string> boards_;
+	std::thread sampler_;
+	std::atomic<bool> sampling_{ false };
+	// Written by the sampler, read after it joined
+	double board_joules_ = 0.0;
+};
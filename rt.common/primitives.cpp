@@ -0,0 +1,402 @@
+#include "primitives.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "cpu_trace.h"
+#include "pixel_format.h"
+
+namespace
+{
+	// Tile edge of composite_primitives, its depths stay in the cache from pass to pass
+	std::uint32_t const kPrimitiveTile = 64;
+
+	// Relative growth of the bounding spheres of the BVH builds over their rounding
+	float const kBoundSlack = 1.f / (1 << 16);
+
+	// Type of the hit of a pixel in composite_primitives
+	enum hit_kind : std::uint8_t
+	{
+		hit_sphere,
+		hit_plane,
+		hit_box,
+		hit_capsule
+	};
+
+	// Closest hit of the pixels of one tile, one entry per pixel in row order
+	struct tile_hits
+	{
+		std::vector<float> ox, oy, maxt;
+		std::vector<hit_kind> kind;
+		std::vector<std::uint32_t> index;
+	};
+
+	// Distance t >= 0 at which a +Z ray meets an object spanning [t0, t1] along it: its near side,
+	// or its far side if it starts inside. Returns false if it is behind the ray or not closer
+	// than maxt.
+	inline bool closer_span(float t0, float t1, float maxt, float& t)
+	{
+		t = t0 >= 0.f ? t0 : t1;
+		return t1 >= 0.f && t < maxt;
+	}
+
+	// Roots of the +Z ray from (ox, oy, oz) against the sphere at c of squared radius r2
+	inline bool cap_roots(float ox, float oy, float oz, float cx, float cy, float cz, float r2, float& t0, float& t1)
+	{
+		float dx = ox - cx;
+		float dy = oy - cy;
+		float dz = oz - cz;
+		float h = dz * dz - (dx * dx + dy * dy + dz * dz - r2);
+
+		if (h < 0.f)
+			return false;
+
+		float root = std::sqrt(h);
+		t0 = -dz - root;
+		t1 = -dz + root;
+		return true;
+	}
+
+	// Span of the +Z ray from (ox, oy, oz) through capsule k: the infinite cylinder around its
+	// axis, each end of the span moved onto the cap at that end if it lies past the segment. A
+	// ray parallel to the axis only meets the caps.
+	bool capsule_span(capsule_soa const& capsules, std::uint32_t k, float ox, float oy, float oz, float& t0, float& t1)
+	{
+		float bax = capsules.bx[k] - capsules.ax[k];
+		float bay = capsules.by[k] - capsules.ay[k];
+		float baz = capsules.bz[k] - capsules.az[k];
+		float oax = ox - capsules.ax[k];
+		float oay = oy - capsules.ay[k];
+		float oaz = oz - capsules.az[k];
+		float r2 = capsules.radius[k] * capsules.radius[k];
+
+		float baba = bax * bax + bay * bay + baz * baz;
+		float baoa = bax * oax + bay * oay + baz * oaz;
+		float oaoa = oax * oax + oay * oay + oaz * oaz;
+		float a = baba - baz * baz;
+		float b = baba * oaz - baoa * baz;
+		float c = baba * oaoa - baoa * baoa - r2 * baba;
+
+		float ends[2];
+
+		if (a > 0.f)
+		{
+			float h = b * b - a * c;
+
+			if (h < 0.f)
+				return false;
+
+			float root = std::sqrt(h);
+			ends[0] = (-b - root) / a;
+			ends[1] = (-b + root) / a;
+		}
+		else
+		{
+			// along the axis: inside the cylinder both ends are on the caps
+			if (c > 0.f)
+				return false;
+
+			ends[0] = -std::numeric_limits<float>::infinity();
+			ends[1] = std::numeric_limits<float>::infinity();
+		}
+
+		for (auto e = 0; e < 2; ++e)
+		{
+			float y = baoa + ends[e] * baz;
+
+			if (y > 0.f && y < baba)
+				continue;
+
+			// the cap of the end the axis position lies beyond
+			bool at_a = a > 0.f ? y <= 0.f : (e == 0) == (baz > 0.f);
+			float cx = at_a ? capsules.ax[k] : capsules.bx[k];
+			float cy = at_a ? capsules.ay[k] : capsules.by[k];
+			float cz = at_a ? capsules.az[k] : capsules.bz[k];
+			float cap0, cap1;
+
+			if (!cap_roots(ox, oy, oz, cx, cy, cz, r2, cap0, cap1))
+				return false;
+
+			ends[e] = e == 0 ? cap0 : cap1;
+		}
+
+		t0 = ends[0];
+		t1 = ends[1];
+		return t0 <= t1;
+	}
+
+	// Test the +Z rays of the pixels of hits starting on z = oz against the primitives of tree
+	// the ray's column reaches, test(k, p, t) giving the distance t of primitive k for pixel p
+	template <class Test>
+	void trace_tree(bvh const& tree, hit_kind kind, float oz, tile_hits& hits, Test const& test)
+	{
+		if (tree.nodes.empty())
+			return;
+
+		std::int32_t stack[kBvhMaxDepth];
+
+		for (std::size_t p = 0; p < hits.maxt.size(); ++p)
+		{
+			float ox = hits.ox[p];
+			float oy = hits.oy[p];
+			std::int32_t sp = 0;
+			stack[sp++] = 0;
+
+			while (sp > 0)
+			{
+				auto const& node = tree.nodes[stack[--sp]];
+
+				if (ox < node.bmin[0] || ox > node.bmax[0] || oy < node.bmin[1] || oy > node.bmax[1] || node.bmin[2] - oz >= hits.maxt[p] ||
+				    node.bmax[2] - oz < 0.f)
+					continue;
+
+				if (node.count == 0)
+				{
+					auto current = static_cast<std::int32_t>(&node - tree.nodes.data());
+					stack[sp++] = node.offset;
+					stack[sp++] = current + 1;
+					continue;
+				}
+
+				for (auto l = node.offset; l < node.offset + node.count; ++l)
+				{
+					auto k = tree.indices[l];
+					float t;
+
+					if (test(k, p, t))
+					{
+						hits.maxt[p] = t;
+						hits.kind[p] = kind;
+						hits.index[p] = k;
+					}
+				}
+			}
+		}
+	}
+
+	bool read_values(std::istringstream& words, float* values, int count)
+	{
+		for (auto v = 0; v < count; ++v)
+		{
+			if (!(words >> values[v]) || !std::isfinite(values[v]))
+				return false;
+		}
+
+		std::string rest;
+		return !(words >> rest);
+	}
+
+	void push_color(std::vector<float>& color, float const* rgb)
+	{
+		color.insert(color.end(), rgb, rgb + 3);
+	}
+}
+
+bool read_primitive_file(std::string const& file, primitive_set& set)
+{
+	std::ifstream in(file);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << file << "\n";
+		return false;
+	}
+
+	set = primitive_set();
+
+	std::string line;
+
+	for (auto number = 1; std::getline(in, line); ++number)
+	{
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string type;
+
+		if (!(words >> type))
+			continue;
+
+		float v[10];
+		bool parsed = false;
+
+		if (type == "plane" && (parsed = read_values(words, v, 7)) && v[0] * v[0] + v[1] * v[1] + v[2] * v[2] > 0.f)
+		{
+			set.planes.nx.push_back(v[0]);
+			set.planes.ny.push_back(v[1]);
+			set.planes.nz.push_back(v[2]);
+			set.planes.d.push_back(v[3]);
+			push_color(set.planes.color, v + 4);
+			continue;
+		}
+
+		if (type == "box" && (parsed = read_values(words, v, 9)) && v[0] <= v[3] && v[1] <= v[4] && v[2] <= v[5])
+		{
+			set.boxes.x0.push_back(v[0]);
+			set.boxes.y0.push_back(v[1]);
+			set.boxes.z0.push_back(v[2]);
+			set.boxes.x1.push_back(v[3]);
+			set.boxes.y1.push_back(v[4]);
+			set.boxes.z1.push_back(v[5]);
+			push_color(set.boxes.color, v + 6);
+			continue;
+		}
+
+		if (type == "capsule" && (parsed = read_values(words, v, 10)) && v[6] > 0.f)
+		{
+			set.capsules.ax.push_back(v[0]);
+			set.capsules.ay.push_back(v[1]);
+			set.capsules.az.push_back(v[2]);
+			set.capsules.bx.push_back(v[3]);
+			set.capsules.by.push_back(v[4]);
+			set.capsules.bz.push_back(v[5]);
+			set.capsules.radius.push_back(v[6]);
+			push_color(set.capsules.color, v + 7);
+			continue;
+		}
+
+		if (parsed)
+			std::cout << file << ":" << number << ": the " << type << " has no extent\n";
+		else
+			std::cout << file << ":" << number << ": expected plane nx ny nz d r g b, box x0 y0 z0 x1 y1 z1 r g b or capsule ax ay az bx by bz radius r g b\n";
+
+		return false;
+	}
+
+	return true;
+}
+
+void build_primitive_accels(primitive_set& set, float ray_origin_z, frame_arena& scratch)
+{
+	// the bounding sphere of every box and capsule, grown over its rounding
+	sphere_soa bounds;
+	bounds.resize(set.boxes.size());
+
+	for (std::uint32_t k = 0; k < set.boxes.size(); ++k)
+	{
+		float hx = 0.5f * (set.boxes.x1[k] - set.boxes.x0[k]);
+		float hy = 0.5f * (set.boxes.y1[k] - set.boxes.y0[k]);
+		float hz = 0.5f * (set.boxes.z1[k] - set.boxes.z0[k]);
+		float cx = set.boxes.x0[k] + hx;
+		float cy = set.boxes.y0[k] + hy;
+		float cz = set.boxes.z0[k] + hz;
+		float r = std::sqrt(hx * hx + hy * hy + hz * hz);
+
+		bounds.set(k, cx, cy, cz, r + (r + std::fabs(cx) + std::fabs(cy) + std::fabs(cz)) * kBoundSlack, 0.f, 0.f, 0.f);
+	}
+
+	scratch.reset();
+	set.box_accel = build_bvh(bounds, ray_origin_z, scratch);
+
+	bounds.resize(set.capsules.size());
+
+	for (std::uint32_t k = 0; k < set.capsules.size(); ++k)
+	{
+		float hx = 0.5f * (set.capsules.bx[k] - set.capsules.ax[k]);
+		float hy = 0.5f * (set.capsules.by[k] - set.capsules.ay[k]);
+		float hz = 0.5f * (set.capsules.bz[k] - set.capsules.az[k]);
+		float cx = set.capsules.ax[k] + hx;
+		float cy = set.capsules.ay[k] + hy;
+		float cz = set.capsules.az[k] + hz;
+		float r = std::sqrt(hx * hx + hy * hy + hz * hz) + set.capsules.radius[k];
+
+		bounds.set(k, cx, cy, cz, r + (r + std::fabs(cx) + std::fabs(cy) + std::fabs(cz)) * kBoundSlack, 0.f, 0.f, 0.f);
+	}
+
+	scratch.reset();
+	set.capsule_accel = build_bvh(bounds, ray_origin_z, scratch);
+	scratch.reset();
+}
+
+void composite_primitives(tile_executor& pool, sphere_soa const& spheres, primitive_set const& set, ortho_view const& view, std::uint32_t const* ids,
+                          float* img)
+{
+	if (set.empty())
+		return;
+
+	auto tiles = make_tiles(view, kPrimitiveTile);
+	std::vector<tile_hits> scratch(pool.size());
+
+	float oz = view.near;
+	float step_x = view.width / view.image_width;
+	float step_y = view.height / view.image_height;
+
+	pool.run_with_worker(tiles, [&](tile const& t, std::uint32_t worker)
+	{
+		auto& hits = scratch[worker];
+		std::size_t count = std::size_t(t.x1 - t.x0) * (t.y1 - t.y0);
+
+		hits.ox.resize(count);
+		hits.oy.resize(count);
+		hits.maxt.resize(count);
+		hits.kind.assign(count, hit_sphere);
+		hits.index.resize(count);
+
+		// the depth of every pixel's sphere, from the ray the tracers set up
+		for (std::uint32_t j = t.y0, p = 0; j < t.y1; ++j)
+		{
+			for (std::uint32_t i = t.x0; i < t.x1; ++i, ++p)
+			{
+				auto k = ids[std::size_t(j) * view.image_width + i];
+
+				hits.ox[p] = view.left + step_x * (i + 0.5f);
+				hits.oy[p] = view.bottom + step_y * (j + 0.5f);
+				hits.maxt[p] = view.far - view.near;
+				hits.index[p] = k;
+
+				float t0, t1;
+
+				if (k != kNoSphere32 && cap_roots(hits.ox[p], hits.oy[p], oz, spheres.cx[k], spheres.cy[k], spheres.cz[k], spheres.radius2[k], t0, t1))
+					hits.maxt[p] = t0 > 0.f ? t0 : t1;
+			}
+		}
+
+		// planes: one plane against the row of all pixels at a time
+		for (std::uint32_t k = 0; k < set.planes.size(); ++k)
+		{
+			float nx = set.planes.nx[k];
+			float ny = set.planes.ny[k];
+			float nz = set.planes.nz[k];
+			float d = set.planes.d[k];
+
+			for (std::size_t p = 0; p < count; ++p)
+			{
+				// a plane along the rays gives no finite distance and is never closer
+				float dist = (d - (nx * hits.ox[p] + ny * hits.oy[p] + nz * oz)) / nz;
+				bool closer = dist >= 0.f && dist < hits.maxt[p];
+
+				hits.maxt[p] = closer ? dist : hits.maxt[p];
+				hits.kind[p] = closer ? hit_plane : hits.kind[p];
+				hits.index[p] = closer ? k : hits.index[p];
+			}
+		}
+
+		auto const& boxes = set.boxes;
+
+		trace_tree(set.box_accel, hit_box, oz, hits, [&](std::uint32_t k, std::size_t p, float& dist)
+		{
+			bool inside = hits.ox[p] >= boxes.x0[k] && hits.ox[p] <= boxes.x1[k] && hits.oy[p] >= boxes.y0[k] && hits.oy[p] <= boxes.y1[k];
+			return inside && closer_span(boxes.z0[k] - oz, boxes.z1[k] - oz, hits.maxt[p], dist);
+		});
+
+		trace_tree(set.capsule_accel, hit_capsule, oz, hits, [&](std::uint32_t k, std::size_t p, float& dist)
+		{
+			float t0, t1;
+			return capsule_span(set.capsules, k, hits.ox[p], hits.oy[p], oz, t0, t1) && closer_span(t0, t1, hits.maxt[p], dist);
+		});
+
+		// the pixels a primitive took, the others keep the color of their sphere
+		for (std::uint32_t j = t.y0, p = 0; j < t.y1; ++j)
+		{
+			for (std::uint32_t i = t.x0; i < t.x1; ++i, ++p)
+			{
+				if (hits.kind[p] == hit_sphere)
+					continue;
+
+				auto const& colors = hits.kind[p] == hit_plane ? set.planes.color : hits.kind[p] == hit_box ? boxes.color : set.capsules.color;
+				std::copy(&colors[hits.index[p] * 3], &colors[hits.index[p] * 3] + 3, img + (std::size_t(j) * view.image_width + i) * 3);
+			}
+		}
+	});
+}
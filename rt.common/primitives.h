@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "bvh.h"
+#include "grid.h"
+#include "scene.h"
+#include "tile_executor.h"
+
+// Planes n . p = d, each with an rgb color
+struct plane_soa
+{
+	std::vector<float> nx, ny, nz, d;
+	// 3 floats (r, g, b) per plane
+	std::vector<float> color;
+
+	std::uint32_t size() const
+	{
+		return static_cast<std::uint32_t>(d.size());
+	}
+};
+
+// Axis-aligned boxes from (x0, y0, z0) to (x1, y1, z1), each with an rgb color
+struct box_soa
+{
+	std::vector<float> x0, y0, z0, x1, y1, z1;
+	std::vector<float> color;
+
+	std::uint32_t size() const
+	{
+		return static_cast<std::uint32_t>(x0.size());
+	}
+};
+
+// Capsules, the points within radius of the segment from a to b, each with an rgb color
+struct capsule_soa
+{
+	std::vector<float> ax, ay, az, bx, by, bz, radius;
+	std::vector<float> color;
+
+	std::uint32_t size() const
+	{
+		return static_cast<std::uint32_t>(radius.size());
+	}
+};
+
+// Primitives traced next to the spheres of a scene (--primitives), every type in arrays of its
+// own. Boxes and capsules get a BVH each, built over their bounding spheres so its leaves index
+// the arrays of their type; planes are unbounded and all tested.
+struct primitive_set
+{
+	plane_soa planes;
+	box_soa boxes;
+	capsule_soa capsules;
+	bvh box_accel, capsule_accel;
+
+	bool empty() const
+	{
+		return planes.size() == 0 && boxes.size() == 0 && capsules.size() == 0;
+	}
+};
+
+// Read the primitives of a file, one per line, '#' starts a comment:
+//     plane nx ny nz d r g b                       the plane n . p = d
+//     box x0 y0 z0 x1 y1 z1 r g b                  the box between two corners
+//     capsule ax ay az bx by bz radius r g b       the capsule around a segment
+// Returns false with a message for a malformed line, a plane without a normal, a capsule
+// without a radius or a box whose corners are swapped.
+bool read_primitive_file(std::string const& file, primitive_set& set);
+
+// Build the BVHs of the boxes and capsules of set for +Z rays starting on the plane
+// z = ray_origin_z, with the build items in scratch
+void build_primitive_accels(primitive_set& set, float ray_origin_z, frame_arena& scratch);
+
+// Add the primitives of set to the image img, rgb floats, of view traced with spheres into the
+// id32 image ids, img holding the colors of those hits: a pixel takes the color of the nearest
+// primitive its ray hits closer than its sphere, ties going to the sphere. Every type runs in a
+// pass of its own over a tile, with the depths of the tile's pixels carried from pass to pass,
+// so each inner loop tests one type without branching on it: the planes over every pixel of
+// the tile, the boxes and capsules through their BVH.
+void composite_primitives(tile_executor& pool, sphere_soa const& spheres, primitive_set const& set, ortho_view const& view, std::uint32_t const* ids,
+                          float* img);
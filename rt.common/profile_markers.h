@@ -0,0 +1,83 @@
+#pragma once
+
+// Named ranges of host activity for profilers, so a rocprof or VTune timeline shows which stage
+// of the program the host is in: init, build, generate, upload, trace, readback and encode.
+// Built with RT_WITH_ROCTX the ranges go to ROCTX, with RT_WITH_ITT to Intel ITT. They also go
+// to the timeline of --trace-out (timeline.h), so without either the cost of a range is the
+// check of the timeline's flag. Ranges nest per thread; names must be string literals or
+// otherwise outlive the range.
+
+#include "timeline.h"
+
+#if defined(RT_WITH_ROCTX)
+#include <roctracer/roctx.h>
+#elif defined(RT_WITH_ITT)
+#include <ittnotify.h>
+#endif
+
+#if defined(RT_WITH_ITT) && !defined(RT_WITH_ROCTX)
+namespace profile_detail
+{
+	// Domain of all ranges of the program, created on first use
+	inline __itt_domain* domain()
+	{
+#ifdef _WIN32
+		static __itt_domain* d = __itt_domain_createA("rt");
+#else
+		static __itt_domain* d = __itt_domain_create("rt");
+#endif
+		return d;
+	}
+
+	inline __itt_string_handle* handle(char const* name)
+	{
+#ifdef _WIN32
+		return __itt_string_handle_createA(name);
+#else
+		return __itt_string_handle_create(name);
+#endif
+	}
+}
+#endif
+
+// Open a range named name on the calling thread
+inline void profile_push(char const* name)
+{
+	timeline_begin(name);
+
+#if defined(RT_WITH_ROCTX)
+	roctxRangePushA(name);
+#elif defined(RT_WITH_ITT)
+	__itt_task_begin(profile_detail::domain(), __itt_null, __itt_null, profile_detail::handle(name));
+#endif
+}
+
+// Close the range the calling thread opened last
+inline void profile_pop()
+{
+#if defined(RT_WITH_ROCTX)
+	roctxRangePop();
+#elif defined(RT_WITH_ITT)
+	__itt_task_end(profile_detail::domain());
+#endif
+
+	timeline_end();
+}
+
+// Range open for the lifetime of the object
+class profile_range
+{
+public:
+	explicit profile_range(char const* name)
+	{
+		profile_push(name);
+	}
+
+	~profile_range()
+	{
+		profile_pop();
+	}
+
+	profile_range(profile_range const&) = delete;
+	profile_range& operator=(profile_range const&) = delete;
+};
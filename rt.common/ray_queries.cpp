@@ -0,0 +1,318 @@
+#include "ray_queries.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "cpu_trace.h"
+
+namespace
+{
+	// Rays of a run one worker traces at a time, as many as the rays of a tile
+	std::size_t const kRayRun = std::size_t(kTileSize) * kTileSize;
+
+	// Radix passes of sort_rays() over the 30 bits of the keys, and their digits
+	std::uint32_t const kKeyPasses = 3;
+	std::uint32_t const kKeyDigits = 1U << 10;
+
+	// Runs of kRayRun rays over count rays, as tiles of a row of rays for tile_executor
+	std::vector<tile> ray_runs(std::size_t count)
+	{
+		std::vector<tile> runs;
+
+		for (std::size_t first = 0; first < count; first += kRayRun)
+		{
+			runs.push_back(tile{ static_cast<std::uint32_t>(first), 0, static_cast<std::uint32_t>(std::min(first + kRayRun, count)), 1 });
+		}
+
+		return runs;
+	}
+
+	// 9 bits of v spread to every third bit, spread_bits in trace.cl
+	std::uint32_t spread_bits(std::uint32_t v)
+	{
+		v = (v | (v << 16)) & 0x030000FFU;
+		v = (v | (v << 8)) & 0x0300F00FU;
+		v = (v | (v << 4)) & 0x030C30C3U;
+		v = (v | (v << 2)) & 0x09249249U;
+		return v;
+	}
+
+	// Cell of coordinate v in the 512 cells of the axis from lo with scale
+	std::uint32_t key_cell(float v, float lo, float scale)
+	{
+		return static_cast<std::uint32_t>(std::min(std::max((v - lo) * scale * 512.f, 0.f), 511.f));
+	}
+
+	// Test sphere k against the ray from o along the unit direction d, keeping the distance to
+	// the hit idx in t, as query_closer in trace.cl does. The distances of the hits are
+	// compared, the exit of a sphere around the origin included, and the higher index wins a
+	// tie, so the closest hit doesn't depend on the order the spheres are tested in. Returns
+	// the new hit.
+	std::int32_t query_closer(sphere_soa const& spheres, float const* o, float const* d, std::int32_t k, std::int32_t idx, float& t)
+	{
+		float ox = o[0] - spheres.cx[k];
+		float oy = o[1] - spheres.cy[k];
+		float oz = o[2] - spheres.cz[k];
+
+		// the direction is a unit vector, a = 1
+		float half_b = ox * d[0] + oy * d[1] + oz * d[2];
+		float c = (ox * ox) + (oy * oy) + (oz * oz) - spheres.radius2[k];
+		float disc = half_b * half_b - c;
+
+		if (disc < 0.f)
+			return idx;
+
+		float root = std::sqrt(disc);
+		float t0 = -half_b - root;
+		float t1 = -half_b + root;
+
+		float hit = t0 > 0.f ? t0 : t1;
+
+		if (hit < 0.f || hit > t || (hit == t && k < idx))
+			return idx;
+
+		t = hit;
+		return k;
+	}
+
+	// Closest sphere of the ray from o along d through the nodes of tree, its distance in t:
+	// the boxes are slab tested along the ray, the children in order, as query_bvh_closest in
+	// trace.cl walks them. fmin and fmax drop the NaN of an axis the ray runs parallel to.
+	std::int32_t query_bvh_closest(sphere_soa const& spheres, bvh const& tree, float const* o, float const* d, float& t)
+	{
+		auto const* nodes = tree.nodes.data();
+		auto const* indices = tree.indices.data();
+
+		std::int32_t stack[kBvhMaxDepth];
+		std::int32_t sp = 0;
+		std::int32_t node = 0;
+		std::int32_t idx = -1;
+
+		float inv[3] = { 1.f / d[0], 1.f / d[1], 1.f / d[2] };
+
+		for (;;)
+		{
+			bvh_node const& n = nodes[node];
+
+			float enter = 0.f;
+			float leave = t;
+
+			for (int a = 0; a < 3; ++a)
+			{
+				float lo = (n.bmin[a] - o[a]) * inv[a];
+				float hi = (n.bmax[a] - o[a]) * inv[a];
+				enter = std::fmax(enter, std::fmin(lo, hi));
+				leave = std::fmin(leave, std::fmax(lo, hi));
+			}
+
+			bool visit = enter <= leave;
+
+			if (visit && n.count == 0)
+			{
+				stack[sp++] = n.offset;
+				++node;
+				continue;
+			}
+
+			if (visit)
+			{
+				for (auto l = 0; l < n.count; ++l)
+				{
+					idx = query_closer(spheres, o, d, static_cast<std::int32_t>(indices[n.offset + l]), idx, t);
+				}
+			}
+
+			if (sp == 0)
+				return idx;
+
+			node = stack[--sp];
+		}
+	}
+}
+
+ray_origin_box origin_box(ray_batch const& rays)
+{
+	float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float hi[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+	float const* columns[3] = { rays.ox, rays.oy, rays.oz };
+
+	for (int a = 0; a < 3; ++a)
+	{
+		for (std::size_t i = 0; i < rays.count; ++i)
+		{
+			lo[a] = std::min(lo[a], columns[a][i]);
+			hi[a] = std::max(hi[a], columns[a][i]);
+		}
+	}
+
+	ray_origin_box box = {};
+
+	for (int a = 0; a < 3 && rays.count != 0; ++a)
+	{
+		box.lo[a] = lo[a];
+		box.scale[a] = hi[a] > lo[a] ? 1.f / (hi[a] - lo[a]) : 0.f;
+	}
+
+	return box;
+}
+
+std::uint32_t ray_sort_key(ray_batch const& rays, std::size_t i, ray_origin_box const& box)
+{
+	std::uint32_t x = key_cell(rays.ox[i], box.lo[0], box.scale[0]);
+	std::uint32_t y = key_cell(rays.oy[i], box.lo[1], box.scale[1]);
+	std::uint32_t z = key_cell(rays.oz[i], box.lo[2], box.scale[2]);
+	std::uint32_t octant = (rays.dx[i] < 0.f ? 1U : 0U) | (rays.dy[i] < 0.f ? 2U : 0U) | (rays.dz[i] < 0.f ? 4U : 0U);
+
+	return (octant << 27) | (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+}
+
+void sort_rays(tile_executor& pool, ray_batch const& rays, std::vector<std::uint32_t>& order)
+{
+	auto box = origin_box(rays);
+
+	// the key above the index, the passes sort on the bits of the key
+	std::vector<std::uint64_t> keyed(rays.count);
+	std::vector<std::uint64_t> sorted(rays.count);
+
+	pool.run(ray_runs(rays.count), [&](tile const& t)
+	{
+		for (auto i = t.x0; i < t.x1; ++i)
+		{
+			keyed[i] = (std::uint64_t(ray_sort_key(rays, i, box)) << 32) | i;
+		}
+	});
+
+	std::vector<std::size_t> starts(kKeyDigits);
+
+	for (std::uint32_t pass = 0; pass < kKeyPasses; ++pass)
+	{
+		auto shift = 32 + 10 * pass;
+		std::fill(starts.begin(), starts.end(), 0);
+
+		for (auto k : keyed)
+		{
+			++starts[(k >> shift) & (kKeyDigits - 1)];
+		}
+
+		std::size_t offset = 0;
+
+		for (auto& s : starts)
+		{
+			auto n = s;
+			s = offset;
+			offset += n;
+		}
+
+		for (auto k : keyed)
+		{
+			sorted[starts[(k >> shift) & (kKeyDigits - 1)]++] = k;
+		}
+
+		keyed.swap(sorted);
+	}
+
+	order.resize(rays.count);
+
+	for (std::size_t i = 0; i < rays.count; ++i)
+	{
+		order[i] = static_cast<std::uint32_t>(keyed[i]);
+	}
+}
+
+bool walks_bvh(render_scene const& scene)
+{
+	return scene.mode == accel_mode::bvh && !scene.accel.nodes.empty() && scene.tiny.indices.empty();
+}
+
+bool closest_hits(tile_executor& pool, render_scene const& scene, ray_batch const& rays, bool sort, float* t, std::int32_t* ids)
+{
+	if (scene.instances || rays.count > kMaxBatchRays)
+		return false;
+
+	std::vector<std::uint32_t> order;
+
+	if (sort)
+		sort_rays(pool, rays, order);
+
+	bool walk = walks_bvh(scene);
+	auto const& spheres = scene.spheres;
+	auto num_spheres = static_cast<std::int32_t>(spheres.size());
+
+	pool.run(ray_runs(rays.count), [&](tile const& run)
+	{
+		for (auto i = run.x0; i < run.x1; ++i)
+		{
+			auto r = sort ? order[i] : i;
+
+			// traced along the unit direction, the distances scale back to the caller's
+			float len = std::sqrt(rays.dx[r] * rays.dx[r] + rays.dy[r] * rays.dy[r] + rays.dz[r] * rays.dz[r]);
+			float o[3] = { rays.ox[r], rays.oy[r], rays.oz[r] };
+			float d[3] = { rays.dx[r] / len, rays.dy[r] / len, rays.dz[r] / len };
+			float hit = rays.tmax[r] * len;
+			std::int32_t idx = -1;
+
+			if (walk)
+			{
+				idx = query_bvh_closest(spheres, scene.accel, o, d, hit);
+			}
+			else
+			{
+				for (std::int32_t k = 0; k < num_spheres; ++k)
+				{
+					idx = query_closer(spheres, o, d, k, idx, hit);
+				}
+			}
+
+			t[r] = idx >= 0 ? hit / len : rays.tmax[r];
+			ids[r] = idx;
+		}
+	});
+
+	return true;
+}
+
+bool load_ray_batch(std::string const& path, std::vector<float>& columns, ray_batch& rays)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::uint32_t count = 0;
+
+	if (!in.read(reinterpret_cast<char*>(&count), sizeof(count)))
+	{
+		std::cout << "Can't read rays from " << path << "\n";
+		return false;
+	}
+
+	columns.resize(std::size_t(7) * count);
+
+	if (!in.read(reinterpret_cast<char*>(columns.data()), sizeof(float) * columns.size()))
+	{
+		std::cout << path << " ends before its " << count << " rays\n";
+		return false;
+	}
+
+	float const* column = columns.data();
+	rays = ray_batch{ column, column + count, column + 2 * std::size_t(count), column + 3 * std::size_t(count), column + 4 * std::size_t(count),
+	                  column + 5 * std::size_t(count), column + 6 * std::size_t(count), count };
+	return true;
+}
+
+bool save_ray_hits(std::string const& path, float const* t, std::int32_t const* ids, std::size_t count)
+{
+	std::ofstream out(path, std::ios::binary);
+	auto written = static_cast<std::uint32_t>(count);
+
+	out.write(reinterpret_cast<char const*>(&written), sizeof(written));
+	out.write(reinterpret_cast<char const*>(t), sizeof(float) * count);
+	out.write(reinterpret_cast<char const*>(ids), sizeof(std::int32_t) * count);
+
+	if (!out)
+	{
+		std::cout << "Can't write the hits to " << path << "\n";
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "accel.h"
+#include "tile_executor.h"
+
+// Batch of arbitrary rays for the visibility and collision queries of other programs, in the
+// columns the caller holds them in, read in place: ray i starts at (ox[i], oy[i], oz[i]) and
+// runs along (dx[i], dy[i], dz[i]), of any length but 0, from t = 0 to t = tmax[i] in
+// multiples of that length. Mirrored by the arguments of query_rays in trace.cl.
+struct ray_batch
+{
+	float const* ox;
+	float const* oy;
+	float const* oz;
+	float const* dx;
+	float const* dy;
+	float const* dz;
+	float const* tmax;
+	std::size_t count;
+};
+
+// Most rays of a batch, its ray indices are std::uint32_t
+std::size_t const kMaxBatchRays = 0xffffffffU;
+
+// Box of the ray origins of a batch that ray_sort_key() quantizes: its low corner and the
+// reciprocal of its extent per axis
+struct ray_origin_box
+{
+	float lo[3];
+	float scale[3];
+};
+
+ray_origin_box origin_box(ray_batch const& rays);
+
+// Coherence key of ray i of rays: the octant of its direction in bits 27 to 29 above the
+// Morton code of its origin in box, 9 bits per axis, as bounce_key in trace.cl keys the
+// reflected rays. Rays of neighbouring keys leave the same region in the same general
+// direction, so they test the same spheres and walk the same nodes. ray_keys in trace.cl
+// computes the same key.
+std::uint32_t ray_sort_key(ray_batch const& rays, std::size_t i, ray_origin_box const& box);
+
+// The indices of the rays sorted on ray_sort_key(), equal keys in index order: the keys are
+// computed on the workers of pool, then radix sorted in three passes of 10 bits
+void sort_rays(tile_executor& pool, ray_batch const& rays, std::vector<std::uint32_t>& order);
+
+// Closest sphere of scene.spheres of every ray of rays, on the workers of pool: t[i] gets the
+// distance of the hit of ray i in multiples of its direction and ids[i] the sphere, tmax[i]
+// and -1 if it meets none within [0, tmax[i]]. A ray starting inside a sphere hits it where
+// it leaves; of spheres hit at the same distance the higher index is kept. A bvh scene walks
+// scene.accel with slab tests along each ray, as the reflections of --bounces do on the
+// devices; the structures of the other modes only hold ortho rays, so they test every sphere.
+// With sort the rays are traced in the order of sort_rays(), which pays off for large batches
+// of incoherent rays. Returns false for scene.instances, whose spheres aren't expanded, and
+// for batches of more than kMaxBatchRays rays.
+bool closest_hits(tile_executor& pool, render_scene const& scene, ray_batch const& rays, bool sort, float* t, std::int32_t* ids);
+
+// True if closest_hits() walks the BVH of scene instead of testing every sphere
+bool walks_bvh(render_scene const& scene);
+
+// A batch of rays from the file at path: a little endian std::uint32_t count, then the count
+// floats of each of the columns ox, oy, oz, dx, dy, dz and tmax in turn. columns gets the
+// floats and rays points into it. Returns false with a message if the file can't be read.
+bool load_ray_batch(std::string const& path, std::vector<float>& columns, ray_batch& rays);
+
+// Write the hits of count rays to the file at path: count, then the count floats of t and the
+// count indices of ids. Returns false with a message if the file can't be written.
+bool save_ray_hits(std::string const& path, float const* t, std::int32_t const* ids, std::size_t count);
@@ -0,0 +1,176 @@
+#include "render_planner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace
+{
+	// Setting of the runs of mode on backend in the tuning database, each value the build, trace
+	// and pixel work of a run and the ms it took. The gpu and cpu keys name their device, the
+	// embree runs share the cpu key and get a setting of their own.
+	std::string runs_setting(plan_backend backend, accel_mode mode)
+	{
+		return std::string(backend == plan_backend::embree ? "plan embree " : "plan ") + accel_mode_name(mode);
+	}
+
+	// ms per unit of plan_work before a device has runs of a mode: the host builds on one
+	// thread, a cpu worker tests a sphere in about a nanosecond, a gpu hundreds of them at once
+	// and pays for reading the pixels back
+	double const kDefaultBuildMs = 2e-5;
+	double const kDefaultCpuTraceMs = 1e-6;
+	double const kDefaultGpuTraceMs = 1e-8;
+	double const kDefaultGpuPixelMs = 1e-6;
+	// Embree builds on all threads and traces packets of 4 to 16 rays
+	double const kDefaultEmbreeTraceMs = 5e-7;
+
+}
+
+double default_plan_ms(plan_backend backend, std::uint32_t threads, plan_work const& work)
+{
+	if (backend == plan_backend::gpu)
+		return work.build * kDefaultBuildMs + work.trace * kDefaultGpuTraceMs + work.pixels * kDefaultGpuPixelMs;
+
+	if (backend == plan_backend::embree)
+		return (work.build * kDefaultBuildMs + work.trace * kDefaultEmbreeTraceMs) / std::max(threads, 1U);
+
+	return work.build * kDefaultBuildMs + work.trace * kDefaultCpuTraceMs / std::max(threads, 1U);
+}
+
+scene_stats measure_scene(sphere_soa const& spheres, ortho_view const& view)
+{
+	scene_stats stats = {};
+	stats.spheres = spheres.size();
+	stats.pixels = static_cast<double>(view.image_width) * view.image_height;
+	stats.beyond_near = spheres_beyond_near(spheres, view);
+
+	pixel_rect rect;
+
+	for (std::uint32_t k = 0; k < spheres.size(); ++k)
+	{
+		if (!sphere_footprint(spheres, k, view, rect))
+			continue;
+
+		double area = static_cast<double>(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+		++stats.visible;
+		stats.coverage += area;
+		stats.max_footprint = std::max(stats.max_footprint, area);
+	}
+
+	stats.depth_complexity = stats.pixels > 0.0 ? stats.coverage / stats.pixels : 0.0;
+	stats.mean_footprint = stats.visible > 0 ? stats.coverage / stats.visible : 0.0;
+
+	return stats;
+}
+
+char const* plan_backend_name(plan_backend backend)
+{
+	switch (backend)
+	{
+	case plan_backend::gpu: return "gpu";
+	case plan_backend::embree: return "embree";
+	default: return "cpu";
+	}
+}
+
+plan_work mode_work(scene_stats const& stats, accel_mode mode)
+{
+	double n = stats.spheres;
+	double depth = stats.depth_complexity;
+	double levels = std::log2(n + 1.0);
+	// share of the rays that hit no sphere, footprints spread at random over the image
+	double missed = std::exp(-depth);
+
+	switch (mode)
+	{
+	case accel_mode::bvh:
+		return plan_work{ n * levels, stats.pixels * (2.0 * levels + depth), stats.pixels };
+	case accel_mode::grid:
+		// binning writes a sphere into every 16 x 16 cell of its footprint, a cell lists every
+		// sphere over any of its pixels, more than cover the one ray
+		return plan_work{ n + stats.coverage / 256.0, stats.pixels * (1.0 + 2.0 * depth), stats.pixels };
+	case accel_mode::splat:
+		// the footprints are found on the host, the depth tests of their pixels run in the frame
+		return plan_work{ n, stats.coverage + stats.pixels, stats.pixels };
+	case accel_mode::sorted:
+		// a ray that hits stops at the first sphere beyond its hit, one that misses tests all
+		return plan_work{ n * levels, stats.pixels * n * (missed + (1.0 - missed) / (1.0 + depth)), stats.pixels };
+	case accel_mode::adaptive:
+		// blocks of one sphere are filled without tracing, the edges trace like grid
+		return plan_work{ n + stats.coverage / (kAdaptiveBlock * kAdaptiveBlock), stats.pixels * (1.0 + 2.0 * depth) * 0.5, stats.pixels };
+	default:
+		return plan_work{ n, stats.pixels * n, stats.pixels };
+	}
+}
+
+double plan_calibration::predict(tuning_key const& key, plan_backend backend, std::uint32_t threads, accel_mode mode, plan_work const& work,
+                                 bool& calibrated) const
+{
+	// least squares scale of the default prediction over the runs of the device and mode
+	double measured = 0.0;
+	double squared = 0.0;
+
+	for (auto const& value : find_tuning(key, runs_setting(backend, mode)))
+	{
+		std::istringstream fields(value);
+		plan_work logged;
+		double ms;
+
+		if (!(fields >> logged.build >> logged.trace >> logged.pixels >> ms))
+			continue;
+
+		auto predicted = default_plan_ms(backend, threads, logged);
+		measured += ms * predicted;
+		squared += predicted * predicted;
+	}
+
+	calibrated = squared > 0.0;
+	return (calibrated ? measured / squared : 1.0) * default_plan_ms(backend, threads, work);
+}
+
+bool plan_calibration::record(tuning_key const& key, plan_backend backend, accel_mode mode, plan_work const& work, double ms)
+{
+	std::ostringstream value;
+	value << work.build << " " << work.trace << " " << work.pixels << " " << ms;
+
+	return append_tuning(key, runs_setting(backend, mode), value.str());
+}
+
+std::vector<plan_choice> plan_render(scene_stats const& stats, plan_calibration const& calibration, tuning_key const& cpu_key, std::uint32_t threads,
+                                     tuning_key const& gpu_key, bool embree)
+{
+	std::vector<plan_choice> choices;
+
+	for (auto backend : { plan_backend::cpu, plan_backend::gpu, plan_backend::embree })
+	{
+		if ((backend == plan_backend::gpu && gpu_key.device.empty()) || (backend == plan_backend::embree && !embree))
+			continue;
+
+		auto const& key = backend == plan_backend::gpu ? gpu_key : cpu_key;
+
+		for (auto mode : { accel_mode::none, accel_mode::bvh, accel_mode::grid, accel_mode::splat, accel_mode::sorted, accel_mode::adaptive })
+		{
+			// bvh and sorted render with brute force over spheres crossing the near plane, and
+			// Embree only builds the BVH
+			if ((mode == accel_mode::bvh || mode == accel_mode::sorted) && !stats.beyond_near)
+				continue;
+
+			if (backend == plan_backend::embree && mode != accel_mode::bvh)
+				continue;
+
+			plan_choice choice;
+			choice.backend = backend;
+			choice.mode = mode;
+			choice.work = mode_work(stats, mode);
+			choice.predicted_ms = calibration.predict(key, backend, threads, mode, choice.work, choice.calibrated);
+			choices.push_back(choice);
+		}
+	}
+
+	std::stable_sort(choices.begin(), choices.end(), [](plan_choice const& a, plan_choice const& b)
+	{
+		return a.predicted_ms < b.predicted_ms;
+	});
+
+	return choices;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "accel.h"
+#include "grid.h"
+#include "scene.h"
+#include "tuning_db.h"
+
+// What the render time of a scene depends on, measured before any structure is built
+struct scene_stats
+{
+	std::uint32_t spheres;
+	// Spheres whose footprint covers a pixel of the image
+	std::uint32_t visible;
+	double pixels;
+	// Summed footprint areas of the visible spheres in pixels, and the share of the image
+	// they cover on average: the spheres a ray of a grid cell or a splat pass meets
+	double coverage;
+	double depth_complexity;
+	// Mean and largest footprint of a visible sphere, in pixels
+	double mean_footprint;
+	double max_footprint;
+	// spheres_beyond_near() holds: bvh and sorted build exact structures instead of falling
+	// back to brute force
+	bool beyond_near;
+};
+
+// Statistics of spheres seen through view, one footprint per sphere
+scene_stats measure_scene(sphere_soa const& spheres, ortho_view const& view);
+
+// Backends the planner picks from; embree is the cpu backend tracing bvh through Embree's BVH
+enum class plan_backend
+{
+	cpu,
+	gpu,
+	embree
+};
+
+char const* plan_backend_name(plan_backend backend);
+
+// Work of a frame in one mode, in ray-sphere tests or the like: building the structure on the
+// host, tracing the image through it and the pixels a device reads back
+struct plan_work
+{
+	double build;
+	double trace;
+	double pixels;
+};
+
+// Rough work of mode on a scene of stats, the shape of its cost; the calibration scales it
+plan_work mode_work(scene_stats const& stats, accel_mode mode);
+
+// ms of work on backend, a cpu one running threads workers, before any run calibrates it
+double default_plan_ms(plan_backend backend, std::uint32_t threads, plan_work const& work);
+
+// Backend and mode of a plan with the time predicted for building and tracing one frame
+struct plan_choice
+{
+	plan_backend backend;
+	accel_mode mode;
+	plan_work work;
+	double predicted_ms;
+	// The prediction is scaled by runs of this device and mode, not only the defaults
+	bool calibrated;
+};
+
+// Render times of earlier planned runs, per device and mode, kept in the tuning database. A
+// device's prediction for a mode is the default cost of the work (kDefault* in
+// render_planner.cpp) times the scale that fits the logged runs best, so one run calibrates a
+// mode and later ones refine it.
+class plan_calibration
+{
+public:
+	// Predicted ms of work in mode on the device of key, a cpu one running threads workers
+	double predict(tuning_key const& key, plan_backend backend, std::uint32_t threads, accel_mode mode, plan_work const& work, bool& calibrated) const;
+
+	// Log a run of work in mode on backend of the device of key that took ms, returns false if
+	// it can't be written. The embree runs are kept apart from the cpu ones of the same key.
+	bool record(tuning_key const& key, plan_backend backend, accel_mode mode, plan_work const& work, double ms);
+};
+
+// Every mode on every backend of the devices of the keys, a cpu one running threads workers,
+// the fastest prediction first; a gpu key without a device leaves the gpu out. With embree the
+// bvh mode of the embree backend on the cpu key joins them. Modes that would fall back to brute
+// force on this scene (see prepare_scene) are left out.
+std::vector<plan_choice> plan_render(scene_stats const& stats, plan_calibration const& calibration, tuning_key const& cpu_key, std::uint32_t threads,
+                                     tuning_key const& gpu_key, bool embree);
@@ -0,0 +1,350 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "pixel_format.h"
+
+cpu_renderer::cpu_renderer(std::uint32_t num_threads, simd_isa isa)
+	: own_pool_(new thread_pool(num_threads)), pool_(*own_pool_), isa_(std::min(isa, detect_simd_isa()))
+{
+}
+
+cpu_renderer::cpu_renderer(tile_executor& executor, simd_isa isa)
+	: pool_(executor), isa_(std::min(isa, detect_simd_isa()))
+{
+}
+
+void cpu_renderer::set_scene(sphere_soa spheres, scene_file const* file)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	scene_.spheres = std::move(spheres);
+	scene_.file = file;
+	prepared_ = false;
+	rendered_ = false;
+	edits_.reset();
+	costs_.full.clear();
+}
+
+accel_mode cpu_renderer::render(ortho_view const& view, accel_mode mode, framebuffer_view const& target, cancel_token const* cancel)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	prepare(view, mode);
+
+	dirty_.clear();
+
+	std::size_t row_bytes = 3 * sizeof(float) * view.image_width;
+
+	if (target.row_bytes == row_bytes)
+	{
+		render_parallel(pool_, scene_, isa_, pixel_format::float32, scene_.tile_size, static_cast<unsigned char*>(target.pixels), nullptr, cancel);
+		// a cancelled image has tiles of the last one, render_changes() can't update it
+		rendered_ = !cancel || !cancel->cancelled();
+		return scene_.mode;
+	}
+
+	scratch_.resize(std::size_t(view.image_width) * view.image_height * 3);
+	render_parallel(pool_, scene_, isa_, pixel_format::float32, scene_.tile_size, reinterpret_cast<unsigned char*>(scratch_.data()), nullptr, cancel);
+	rendered_ = !cancel || !cancel->cancelled();
+
+	// the tiles scratch_ skipped hold another image than the ones target skipped
+	for (std::uint32_t y = 0; rendered_ && y < view.image_height; ++y)
+	{
+		std::memcpy(static_cast<char*>(target.pixels) + y * target.row_bytes, &scratch_[std::size_t(y) * view.image_width * 3], row_bytes);
+	}
+
+	return scene_.mode;
+}
+
+deadline_result cpu_renderer::render_deadline(ortho_view const& view, accel_mode mode, double budget, framebuffer_view const& target)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	prepare(view, mode);
+
+	// unfinished tiles don't hold the image render_changes() updates
+	rendered_ = false;
+	dirty_.clear();
+
+	std::size_t row_bytes = 3 * sizeof(float) * view.image_width;
+	bool packed = target.row_bytes == row_bytes;
+
+	if (!packed)
+		scratch_.resize(std::size_t(view.image_width) * view.image_height * 3);
+
+	float* img = packed ? static_cast<float*>(target.pixels) : scratch_.data();
+	auto result = ::render_deadline(pool_, scene_, isa_, img, budget, costs_);
+
+	for (std::uint32_t y = 0; !packed && y < view.image_height; ++y)
+	{
+		std::memcpy(static_cast<char*>(target.pixels) + y * target.row_bytes, &scratch_[std::size_t(y) * view.image_width * 3], row_bytes);
+	}
+
+	return result;
+}
+
+accel_mode cpu_renderer::render_region(ortho_view const& view, accel_mode mode, render_roi const& roi, framebuffer_view const& target,
+                                       render_roi const& window)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	prepare(view, mode);
+
+	// target no longer holds the image render_changes() updates
+	rendered_ = false;
+	dirty_.clear();
+
+	auto region = clip_roi(roi, view);
+	auto full = full_roi(view);
+	std::size_t row_bytes = 3 * sizeof(float) * view.image_width;
+
+	// the tracers write into a packed image of the whole view
+	bool packed = window.xbegin == full.xbegin && window.xend == full.xend && window.ybegin == full.ybegin && window.yend == full.yend &&
+	              target.row_bytes == row_bytes;
+
+	if (!packed)
+		scratch_.resize(std::size_t(view.image_width) * view.image_height * 3);
+
+	float* img = packed ? static_cast<float*>(target.pixels) : scratch_.data();
+
+	pool_.run(roi_tiles(view, region, kTileSize), [&](tile const& t)
+	{
+		render_tile(scene_, isa_, t, img);
+	});
+
+	if (!packed)
+		copy_roi(scratch_.data(), row_bytes, full, target.pixels, target.row_bytes, window, region, 3 * sizeof(float));
+
+	return scene_.mode;
+}
+
+accel_mode cpu_renderer::render_progressive(ortho_view const& view, accel_mode mode, framebuffer_view const& target,
+                                            std::function<void(std::uint32_t pass)> const& on_pass, cancel_token const* cancel)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	prepare(view, mode);
+
+	dirty_.clear();
+
+	std::size_t row_bytes = 3 * sizeof(float) * view.image_width;
+	bool packed = target.row_bytes == row_bytes;
+
+	if (!packed)
+		scratch_.resize(std::size_t(view.image_width) * view.image_height * 3);
+
+	float* img = packed ? static_cast<float*>(target.pixels) : scratch_.data();
+
+	::render_progressive(pool_, scene_, isa_, img, [&](std::uint32_t pass)
+	{
+		for (std::uint32_t y = 0; !packed && y < view.image_height; ++y)
+		{
+			std::memcpy(static_cast<char*>(target.pixels) + y * target.row_bytes, &scratch_[std::size_t(y) * view.image_width * 3], row_bytes);
+		}
+
+		on_pass(pass);
+	}, cancel);
+
+	rendered_ = !cancel || !cancel->cancelled();
+	return scene_.mode;
+}
+
+accel_mode cpu_renderer::render_streaming(ortho_view const& view, accel_mode mode, framebuffer_view const& target, tile_callback const& on_tile,
+                                          stream_times& times, cancel_token const* cancel)
+{
+	typedef std::chrono::steady_clock clock;
+
+	auto start = clock::now();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	prepare(view, mode);
+
+	dirty_.clear();
+
+	std::size_t row_bytes = 3 * sizeof(float) * view.image_width;
+	bool packed = target.row_bytes == row_bytes;
+
+	if (!packed)
+		scratch_.resize(std::size_t(view.image_width) * view.image_height * 3);
+
+	float* img = packed ? static_cast<float*>(target.pixels) : scratch_.data();
+
+	std::atomic<bool> first(true);
+	times.first_tile = 0.0;
+
+	pool_.run(make_tiles(view, std::min(scene_.tile_size, kTileSize), scene_.tiles), [&](tile const& t)
+	{
+		if (cancel && cancel->cancelled())
+			return;
+
+		render_tile(scene_, isa_, t, img);
+
+		auto* pixels = static_cast<char*>(target.pixels) + t.y0 * target.row_bytes + 3 * sizeof(float) * t.x0;
+
+		for (auto y = t.y0; !packed && y < t.y1; ++y)
+		{
+			std::memcpy(pixels + (y - t.y0) * target.row_bytes, &scratch_[(std::size_t(y) * view.image_width + t.x0) * 3], 3 * sizeof(float) * (t.x1 - t.x0));
+		}
+
+		// the one worker to clear the flag times the first tile
+		if (first.exchange(false))
+			times.first_tile = std::chrono::duration<double>(clock::now() - start).count();
+
+		on_tile(t, pixels);
+	});
+
+	times.total = std::chrono::duration<double>(clock::now() - start).count();
+	rendered_ = !cancel || !cancel->cancelled();
+
+	return scene_.mode;
+}
+
+accel_mode cpu_renderer::query_rays(accel_mode mode, ray_batch const& rays, bool sort, float* t, std::int32_t* ids)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	prepare(scene_.view, mode);
+	closest_hits(pool_, scene_, rays, sort, t, ids);
+
+	return walks_bvh(scene_) ? accel_mode::bvh : accel_mode::none;
+}
+
+void cpu_renderer::move_spheres(std::vector<std::uint32_t> const& indices, sphere_soa const& changed)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mark_footprints(indices);
+	edits_.update(scene_.spheres, indices, changed);
+	mark_footprints(indices);
+
+	// a BVH stored in the file no longer matches the spheres
+	scene_.file = nullptr;
+}
+
+std::vector<std::uint32_t> cpu_renderer::add_spheres(sphere_soa const& added)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// the slots taken were tombstones without a footprint
+	auto indices = edits_.add(scene_.spheres, added);
+	mark_footprints(indices);
+
+	scene_.file = nullptr;
+	return indices;
+}
+
+void cpu_renderer::remove_spheres(std::vector<std::uint32_t> const& indices)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mark_footprints(indices);
+	edits_.remove(scene_.spheres, indices);
+
+	scene_.file = nullptr;
+}
+
+std::vector<std::uint32_t> cpu_renderer::compact_spheres()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!edits_.compaction_due(scene_.spheres))
+		return std::vector<std::uint32_t>();
+
+	// the tombstones showed in no image, the pixels of the last one stay valid
+	prepared_ = false;
+	return edits_.compact(scene_.spheres);
+}
+
+accel_mode cpu_renderer::render_changes(framebuffer_view const& target)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (!rendered_)
+	{
+		auto view = scene_.view;
+		auto mode = requested_;
+
+		lock.unlock();
+		return render(view, mode, target);
+	}
+
+	auto const& view = scene_.view;
+	prepare(view, requested_);
+
+	auto tiles = covered_tiles(dirty_, view, kTileSize);
+	dirty_.clear();
+
+	std::size_t row_bytes = 3 * sizeof(float) * view.image_width;
+	bool packed = target.row_bytes == row_bytes;
+
+	if (!packed)
+		scratch_.resize(std::size_t(view.image_width) * view.image_height * 3);
+
+	float* img = packed ? static_cast<float*>(target.pixels) : scratch_.data();
+
+	pool_.run(tiles, [&](tile const& t)
+	{
+		render_tile(scene_, isa_, t, img);
+
+		if (packed)
+			return;
+
+		for (auto y = t.y0; y < t.y1; ++y)
+		{
+			std::memcpy(static_cast<char*>(target.pixels) + y * target.row_bytes + 3 * sizeof(float) * t.x0,
+			            &scratch_[(std::size_t(y) * view.image_width + t.x0) * 3], 3 * sizeof(float) * (t.x1 - t.x0));
+		}
+	});
+
+	return scene_.mode;
+}
+
+void cpu_renderer::prepare(ortho_view const& view, accel_mode mode)
+{
+	// brute force, bvh and sorted are built for the depth range alone (prepare_scene), another
+	// window of the same depths, such as a tile of a virtual_image, keeps them unless the
+	// coverage mask or the tiny spheres of the old window were built too
+	bool window_free = (scene_.mode == accel_mode::none || scene_.mode == accel_mode::bvh || scene_.mode == accel_mode::sorted) &&
+	                   scene_.coverage.empty() && scene_.tiny.indices.empty() && view.near == scene_.view.near && view.far == scene_.view.far;
+	bool build = !prepared_ || mode != requested_ || (!same_view(view, scene_.view) && !window_free) || edits_.grown();
+
+	// appended spheres aren't in the structure yet, other edits are refit into it where the mode allows
+	std::vector<std::int32_t> nodes;
+
+	if (!build && !edits_.changed().empty())
+		build = !refit_scene(scene_, edits_.changed(), nodes);
+
+	scene_.view = view;
+
+	if (build)
+	{
+		prepare_scene(scene_, mode);
+
+		requested_ = mode;
+		prepared_ = true;
+	}
+
+	edits_.clear_changed();
+}
+
+void cpu_renderer::mark_footprints(std::vector<std::uint32_t> const& indices)
+{
+	pixel_rect rect;
+
+	for (auto k : indices)
+	{
+		if (rendered_ && k < scene_.spheres.size() && sphere_footprint(scene_.spheres, k, scene_.view, rect))
+			dirty_.push_back(rect);
+	}
+}
+
+bool same_view(ortho_view const& a, ortho_view const& b)
+{
+	return a.left == b.left && a.bottom == b.bottom && a.width == b.width && a.height == b.height && a.near == b.near && a.far == b.far &&
+	       a.image_width == b.image_width && a.image_height == b.image_height;
+}
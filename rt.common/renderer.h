@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "accel.h"
+#include "cancel_token.h"
+#include "cpu_trace.h"
+#include "ray_queries.h"
+#include "roi.h"
+#include "scene.h"
+#include "scene_edits.h"
+#include "scene_file.h"
+#include "thread_pool.h"
+
+// Caller owned image a renderer writes into: row y of the view starts at pixels + y * row_bytes
+// and holds image_width pixels in the renderer's pixel layout, 3 floats for cpu_renderer.
+// Rows may be padded, row_bytes is at least the size of one row.
+struct framebuffer_view
+{
+	void* pixels;
+	std::size_t row_bytes;
+};
+
+// Called by the streaming renders once tile t of the image is in the target, pixels pointing
+// at its top left pixel there, so a consumer can composite it before the frame is done. It
+// runs on the threads that finish the tiles, several at once, and must not call the renderer.
+typedef std::function<void(tile const& t, void* pixels)> tile_callback;
+
+// Seconds from the start of a streaming render, the structure build included, to its first
+// tile and to its last; first_tile is 0 if no tile finished
+struct stream_times
+{
+	double first_tile;
+	double total;
+};
+
+// Renders spheres with the parallel CPU tracers into caller owned memory, for linking the
+// tracer into another program. The thread pool lives as long as the renderer and the
+// acceleration structure is built once per scene, view and mode, once per depth range for the
+// modes none, bvh and sorted, whose structures don't depend on the window. render() may be called
+// from any thread, concurrent calls run one after the other.
+class cpu_renderer
+{
+public:
+	explicit cpu_renderer(std::uint32_t num_threads = std::thread::hardware_concurrency(), simd_isa isa = detect_simd_isa());
+
+	// Render on the workers of executor instead of a pool of its own, such as the scheduler of
+	// the program embedding the renderer (tile_executor.h); executor must outlive the renderer
+	explicit cpu_renderer(tile_executor& executor, simd_isa isa = detect_simd_isa());
+
+	cpu_renderer(cpu_renderer const&) = delete;
+	cpu_renderer& operator=(cpu_renderer const&) = delete;
+
+	// Render spheres from now on. Spheres copied from file load its stored BVH, file must
+	// stay open while this scene is rendered.
+	void set_scene(sphere_soa spheres, scene_file const* file = nullptr);
+
+	// Render the scene through view with mode into target. Returns the mode used, which
+	// falls back to accel_mode::none as described for prepare_scene. Once cancel, if not null,
+	// is cancelled the tiles not yet started are skipped: a target of packed rows keeps the
+	// tiles that finished, one of padded rows is left as it was.
+	accel_mode render(ortho_view const& view, accel_mode mode, framebuffer_view const& target, cancel_token const* cancel = nullptr);
+
+	// Render into target within budget seconds with the render_deadline() passes, planned from
+	// the tile times of the last call for this scene. Returns which passes every tile finished,
+	// mode() tells the mode used.
+	deadline_result render_deadline(ortho_view const& view, accel_mode mode, double budget, framebuffer_view const& target);
+
+	// Render only the pixels of roi, clipped to the image of view, into target, which holds the
+	// pixels of window: full_roi(view) for a whole framebuffer, or roi for one of the region
+	// alone. Pixels of window outside roi are left as they are. Targets other than a packed
+	// whole image get the pixels through a packed image of the renderer. Returns the mode used.
+	accel_mode render_region(ortho_view const& view, accel_mode mode, render_roi const& roi, framebuffer_view const& target, render_roi const& window);
+
+	// render() in the coarse to fine passes of render_progressive(), calling on_pass(p) once
+	// target holds the preview of pass p. on_pass runs on the calling thread while the renderer
+	// is busy and must not call it. Once cancel, if not null, is cancelled the pass in flight
+	// stops at its next tiles and on_pass isn't called again; target keeps the last preview
+	// passed to on_pass, over which a packed one has the tiles the cut pass finished.
+	accel_mode render_progressive(ortho_view const& view, accel_mode mode, framebuffer_view const& target,
+	                              std::function<void(std::uint32_t pass)> const& on_pass, cancel_token const* cancel = nullptr);
+
+	// render() calling on_tile for every tile of render_parallel() (render_scene::tile_size)
+	// once it is in target; a target of padded rows gets each tile copied from the packed image
+	// of the renderer as it finishes. times gets the time to the first tile and to the whole
+	// image. Once cancel, if not null, is cancelled the tiles not yet started are skipped.
+	accel_mode render_streaming(ortho_view const& view, accel_mode mode, framebuffer_view const& target, tile_callback const& on_tile, stream_times& times,
+	                            cancel_token const* cancel = nullptr);
+
+	// Closest sphere of every ray of rays into t and ids with closest_hits() (ray_queries.h),
+	// sorted first if sort is set, through the structure of mode for the view of the last
+	// render, default_view() before the first. bvh walks its BVH, falling back to none as for
+	// render(); the other modes test every sphere. rays holds at most kMaxBatchRays rays.
+	// Returns bvh if the BVH was walked, none otherwise.
+	accel_mode query_rays(accel_mode mode, ray_batch const& rays, bool sort, float* t, std::int32_t* ids);
+
+	// Set sphere indices[i] to sphere i of changed, for every i. The old and new footprints
+	// of each are remembered for render_changes().
+	void move_spheres(std::vector<std::uint32_t> const& indices, sphere_soa const& changed);
+
+	// Add the spheres of added to the scene, into the slots of removed ones first, and return the
+	// index each one got. Their footprints are remembered for render_changes().
+	std::vector<std::uint32_t> add_spheres(sphere_soa const& added);
+
+	// Remove the spheres indices, they stay tombstones in their slots (scene_edits) until
+	// compact_spheres(). Their footprints are remembered for render_changes().
+	void remove_spheres(std::vector<std::uint32_t> const& indices);
+
+	// Drop the tombstones once they make up kCompactFraction of the scene and renumber the other
+	// spheres. Returns the new index of every old one, kRemovedSphere for the dropped ones, or
+	// nothing if the scene isn't due yet; the next render builds the structure again.
+	std::vector<std::uint32_t> compact_spheres();
+
+	// Bring target, which holds the image of the last render() or render_changes(), up to date
+	// with the spheres edited since, for the view and mode of that render: only the tiles the
+	// edited spheres covered or cover now are traced. Brute force and splat update in place and
+	// bvh refits its tree over the edited spheres (refit_scene), the other modes, and any of
+	// them after spheres were appended or compacted, rebuild their structure. Returns the mode used.
+	accel_mode render_changes(framebuffer_view const& target);
+
+	// Mode the last render used
+	accel_mode mode() const
+	{
+		return scene_.mode;
+	}
+
+private:
+	// Build the structure of mode for view unless scene_ holds it already, refitting it to the
+	// edited spheres where it can
+	void prepare(ortho_view const& view, accel_mode mode);
+
+	// Remember the footprints of the spheres indices in the last image for render_changes()
+	void mark_footprints(std::vector<std::uint32_t> const& indices);
+
+	std::mutex mutex_;
+	// The pool of the renderer, null with an executor of the caller, and the executor the
+	// tiles run on
+	std::unique_ptr<thread_pool> own_pool_;
+	tile_executor& pool_;
+	simd_isa isa_;
+	render_scene scene_;
+	// scene_ holds the structure of requested_ for scene_.view
+	bool prepared_ = false;
+	accel_mode requested_ = accel_mode::none;
+	// An image of scene_.view was rendered in full, dirty_ holds the footprints in it moved spheres
+	// covered or cover now
+	bool rendered_ = false;
+	std::vector<pixel_rect> dirty_;
+	// Spheres added, removed and moved since scene_ was prepared
+	scene_edits edits_;
+	// Packed image for targets with padded rows
+	std::vector<float> scratch_;
+	// Tile times of the last render_deadline() of this scene
+	tile_costs costs_;
+};
+
+// True if a and b give the same image: same window, depth range and size
+bool same_view(ortho_view const& a, ortho_view const& b);
@@ -0,0 +1,236 @@
+#include "renderer_api.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "framebuffer_pool.h"
+#include "renderer.h"
+#include "virtual_image.h"
+
+namespace
+{
+	struct api_renderer
+	{
+		explicit api_renderer(std::uint32_t num_threads)
+			: renderer(num_threads)
+		{
+		}
+
+		cpu_renderer renderer;
+		framebuffer_pool frames;
+		// Buffers handed out by rt_acquire_framebuffer, by their pixels
+		std::mutex mutex;
+		std::map<void*, std::vector<unsigned char>> acquired;
+	};
+}
+
+void* rt_create(std::uint32_t num_threads)
+{
+	try
+	{
+		return new api_renderer(num_threads != 0 ? num_threads : std::max(std::thread::hardware_concurrency(), 1U));
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void rt_destroy(void* renderer)
+{
+	delete static_cast<api_renderer*>(renderer);
+}
+
+bool rt_set_scene(void* renderer, float const* cx, float const* cy, float const* cz, float const* radius, float const* color, std::uint32_t count)
+{
+	try
+	{
+		sphere_soa spheres;
+		spheres.resize(count);
+
+		for (std::uint32_t k = 0; k < count; ++k)
+		{
+			spheres.set(k, cx[k], cy[k], cz[k], radius[k], color[3 * k], color[3 * k + 1], color[3 * k + 2]);
+		}
+
+		static_cast<api_renderer*>(renderer)->renderer.set_scene(std::move(spheres));
+		return true;
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
+
+char const* rt_render(void* renderer, float left, float bottom, float width, float height, float near, float far, std::uint32_t image_width,
+                      std::uint32_t image_height, char const* mode, float* pixels, std::size_t row_bytes)
+{
+	accel_mode requested;
+
+	if (!parse_accel_mode(mode, requested))
+		return nullptr;
+
+	try
+	{
+		ortho_view view = { left, bottom, width, height, near, far, image_width, image_height };
+		return accel_mode_name(static_cast<api_renderer*>(renderer)->renderer.render(view, requested, framebuffer_view{ pixels, row_bytes }));
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+char const* rt_render_streaming(void* renderer, float left, float bottom, float width, float height, float near, float far, std::uint32_t image_width,
+                                std::uint32_t image_height, char const* mode, float* pixels, std::size_t row_bytes, rt_tile_callback on_tile,
+                                void* user, double* first_tile, double* total)
+{
+	accel_mode requested;
+
+	if (!parse_accel_mode(mode, requested))
+		return nullptr;
+
+	try
+	{
+		ortho_view view = { left, bottom, width, height, near, far, image_width, image_height };
+		stream_times times;
+
+		auto used = static_cast<api_renderer*>(renderer)->renderer.render_streaming(view, requested, framebuffer_view{ pixels, row_bytes },
+		                                                                            [&](tile const& t, void* tile_pixels)
+		{
+			on_tile(user, t.x0, t.y0, t.x1, t.y1, static_cast<float*>(tile_pixels));
+		}, times);
+
+		if (first_tile)
+			*first_tile = times.first_tile;
+
+		if (total)
+			*total = times.total;
+
+		return accel_mode_name(used);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+char const* rt_query_rays(void* renderer, float const* ox, float const* oy, float const* oz, float const* dx, float const* dy, float const* dz,
+                          float const* tmax, std::size_t count, char const* mode, bool sort, float* t, std::int32_t* ids)
+{
+	accel_mode requested;
+
+	if (!parse_accel_mode(mode, requested) || count > kMaxBatchRays)
+		return nullptr;
+
+	try
+	{
+		ray_batch rays = { ox, oy, oz, dx, dy, dz, tmax, count };
+		return accel_mode_name(static_cast<api_renderer*>(renderer)->renderer.query_rays(requested, rays, sort, t, ids));
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+float* rt_acquire_framebuffer(void* renderer, std::uint32_t image_width, std::uint32_t image_height)
+{
+	auto& api = *static_cast<api_renderer*>(renderer);
+
+	try
+	{
+		auto buffer = api.frames.acquire(3 * sizeof(float) * image_width * image_height);
+
+		if (buffer.empty())
+			return nullptr;
+
+		void* pixels = buffer.data();
+
+		std::lock_guard<std::mutex> lock(api.mutex);
+		api.acquired[pixels] = std::move(buffer);
+		return static_cast<float*>(pixels);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void rt_release_framebuffer(void* renderer, float* pixels)
+{
+	auto& api = *static_cast<api_renderer*>(renderer);
+	std::vector<unsigned char> buffer;
+
+	{
+		std::lock_guard<std::mutex> lock(api.mutex);
+		auto found = api.acquired.find(pixels);
+
+		if (found == api.acquired.end())
+			return;
+
+		buffer = std::move(found->second);
+		api.acquired.erase(found);
+	}
+
+	api.frames.release(std::move(buffer));
+}
+
+void* rt_open_virtual(void* renderer, float left, float bottom, float width, float height, float near, float far, std::uint32_t image_width,
+                      std::uint32_t image_height, char const* mode, std::size_t budget_mb)
+{
+	accel_mode requested;
+
+	if (!parse_accel_mode(mode, requested))
+		return nullptr;
+
+	try
+	{
+		ortho_view view = { left, bottom, width, height, near, far, image_width, image_height };
+		return new virtual_image(static_cast<api_renderer*>(renderer)->renderer, view, requested, budget_mb << 20);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void rt_close_virtual(void* image)
+{
+	delete static_cast<virtual_image*>(image);
+}
+
+std::uint32_t rt_virtual_levels(void* image)
+{
+	return static_cast<virtual_image*>(image)->levels();
+}
+
+bool rt_virtual_pixels(void* image, std::uint32_t level, std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1, float* pixels,
+                       std::size_t row_bytes)
+{
+	try
+	{
+		return static_cast<virtual_image*>(image)->get_pixels(level, render_roi{ x0, x1, y0, y1 }, framebuffer_view{ pixels, row_bytes });
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
+
+void rt_invalidate_virtual(void* image)
+{
+	static_cast<virtual_image*>(image)->invalidate();
+}
+
+void rt_virtual_stats(void* image, std::uint64_t* counts)
+{
+	auto stats = static_cast<virtual_image*>(image)->stats();
+
+	counts[0] = stats.hits;
+	counts[1] = stats.rendered;
+	counts[2] = stats.evicted;
+	counts[3] = stats.bytes;
+}
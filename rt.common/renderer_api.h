@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// C interface of cpu_renderer (renderer.h) exported from the rt.python library, for callers
+// that load it at run time such as the ctypes bindings of rt.python/rt.py. A handle is a
+// renderer with its framebuffer pool. The functions take caller memory in place and don't
+// throw; none of them touch an interpreter, so a binding may release its lock around them.
+#ifdef _WIN32
+#define RT_API extern "C" __declspec(dllexport)
+#else
+#define RT_API extern "C" __attribute__((visibility("default")))
+#endif
+
+// A renderer on num_threads threads, 0 for one per hardware thread. Null if it can't be created.
+RT_API void* rt_create(std::uint32_t num_threads);
+// Destroy renderer; framebuffers it handed out must have been released
+RT_API void rt_destroy(void* renderer);
+
+// Render count spheres from now on: the columns cx, cy, cz and radius of count floats and
+// color of 3 * count (r, g, b per sphere) are read where they are, into the renderer's own
+// arrays. Returns false if they can't be stored.
+RT_API bool rt_set_scene(void* renderer, float const* cx, float const* cy, float const* cz, float const* radius, float const* color, std::uint32_t count);
+
+// Render the window left, bottom, width, height with depth range near, far into the
+// image_width x image_height rgb float image at pixels, rows of row_bytes bytes, with the
+// accel_mode named mode (parse_accel_mode). Returns the name of the mode used, null if mode is
+// unknown or rendering failed.
+RT_API char const* rt_render(void* renderer, float left, float bottom, float width, float height, float near, float far, std::uint32_t image_width,
+                             std::uint32_t image_height, char const* mode, float* pixels, std::size_t row_bytes);
+
+// Called by rt_render_streaming once the tile [x0, x1) x [y0, y1) is in the image, pixels
+// pointing at its top left pixel there; user is the pointer given to rt_render_streaming. It
+// runs on the renderer's threads, several at once, and must not call the renderer.
+typedef void (*rt_tile_callback)(void* user, std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1, float* pixels);
+
+// rt_render calling on_tile(user, ...) for every tile as it finishes, for compositing before
+// the frame is done. first_tile and total, unless null, get the seconds to the first tile and
+// to the whole image, the structure build included.
+RT_API char const* rt_render_streaming(void* renderer, float left, float bottom, float width, float height, float near, float far, std::uint32_t image_width,
+                                       std::uint32_t image_height, char const* mode, float* pixels, std::size_t row_bytes, rt_tile_callback on_tile,
+                                       void* user, double* first_tile, double* total);
+
+// Closest sphere of each of count arbitrary rays (ray_batch in ray_queries.h): ray i starts at
+// (ox[i], oy[i], oz[i]) and runs along (dx[i], dy[i], dz[i]), of any length but 0, up to
+// tmax[i] times it. t[i] gets the distance of its hit in multiples of the direction and ids[i]
+// the sphere, tmax[i] and -1 for a miss. The scene is searched through the structure of the
+// accel_mode named mode for the window of the last rt_render: bvh walks its BVH, the others
+// test every sphere. With sort the rays are traced in the coherence order of sort_rays, for
+// large batches of incoherent rays. Returns the name of the search used, bvh or none, null if
+// mode is unknown, count is over kMaxBatchRays or the query failed.
+RT_API char const* rt_query_rays(void* renderer, float const* ox, float const* oy, float const* oz, float const* dx, float const* dy, float const* dz,
+                                 float const* tmax, std::size_t count, char const* mode, bool sort, float* t, std::int32_t* ids);
+
+// A packed rgb float framebuffer of image_width x image_height pixels from the renderer's
+// framebuffer_pool, the caller renders into it and hands it back with rt_release_framebuffer.
+// Released buffers of the same size are reused. Null if it can't be allocated.
+RT_API float* rt_acquire_framebuffer(void* renderer, std::uint32_t image_width, std::uint32_t image_height);
+RT_API void rt_release_framebuffer(void* renderer, float* pixels);
+
+// A virtual image (virtual_image.h) of the window left, bottom, width, height with depth range
+// near, far at image_width x image_height pixels, of any size: renderer renders its tiles with
+// the accel_mode named mode as they are first read and keeps at most budget_mb MB of them. Null
+// if mode is unknown or it can't be created. Close it before destroying renderer, and
+// invalidate it after setting another scene.
+RT_API void* rt_open_virtual(void* renderer, float left, float bottom, float width, float height, float near, float far, std::uint32_t image_width,
+                             std::uint32_t image_height, char const* mode, std::size_t budget_mb);
+RT_API void rt_close_virtual(void* image);
+
+// MIP levels of image, level l at the image sizes halved l times down to one pixel
+RT_API std::uint32_t rt_virtual_levels(void* image);
+
+// Copy the pixels [x0, x1) x [y0, y1) of level of image into the rgb float pixels, rows of
+// row_bytes bytes, rendering the tiles they touch that aren't in memory. Returns false if the
+// region reaches outside the level or rendering failed.
+RT_API bool rt_virtual_pixels(void* image, std::uint32_t level, std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1, float* pixels,
+                              std::size_t row_bytes);
+
+// Drop the tiles of image, which are rendered again from the scene as they are read
+RT_API void rt_invalidate_virtual(void* image);
+
+// counts gets the tiles of image read from memory, rendered and evicted so far and the bytes
+// the tiles in memory take
+RT_API void rt_virtual_stats(void* image, std::uint64_t* counts);
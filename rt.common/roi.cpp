@@ -0,0 +1,44 @@
+#include "roi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+render_roi full_roi(ortho_view const& view)
+{
+	return render_roi{ 0U, view.image_width, 0U, view.image_height };
+}
+
+bool parse_roi(char const* text, render_roi& roi)
+{
+	std::uint32_t width, height, x, y;
+	char end;
+
+	if (std::sscanf(text, "%ux%u+%u+%u%c", &width, &height, &x, &y, &end) != 4 || width == 0 || height == 0)
+		return false;
+
+	roi = render_roi{ x, x + width, y, y + height };
+	return true;
+}
+
+render_roi clip_roi(render_roi const& roi, ortho_view const& view)
+{
+	render_roi clipped = { roi.xbegin, std::min(roi.xend, view.image_width), roi.ybegin, std::min(roi.yend, view.image_height) };
+
+	if (clipped.empty())
+		clipped = render_roi{ 0U, 0U, 0U, 0U };
+
+	return clipped;
+}
+
+void copy_roi(void const* src, std::size_t src_row_bytes, render_roi const& src_window, void* dst, std::size_t dst_row_bytes, render_roi const& dst_window,
+              render_roi const& region, std::size_t pixel_bytes)
+{
+	auto from = static_cast<unsigned char const*>(src) + (region.ybegin - src_window.ybegin) * src_row_bytes + (region.xbegin - src_window.xbegin) * pixel_bytes;
+	auto to = static_cast<unsigned char*>(dst) + (region.ybegin - dst_window.ybegin) * dst_row_bytes + (region.xbegin - dst_window.xbegin) * pixel_bytes;
+
+	for (auto y = region.ybegin; y < region.yend; ++y, from += src_row_bytes, to += dst_row_bytes)
+	{
+		std::memcpy(to, from, region.width() * pixel_bytes);
+	}
+}
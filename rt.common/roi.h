@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "grid.h"
+
+// Pixel region [xbegin, xend) x [ybegin, yend) of an image, named after OIIO's ROI without its
+// z and channel ranges. The renderers trace only the pixels of a region and write them into a
+// framebuffer holding either the whole image or the region alone.
+struct render_roi
+{
+	std::uint32_t xbegin, xend, ybegin, yend;
+
+	std::uint32_t width() const
+	{
+		return xend - xbegin;
+	}
+
+	std::uint32_t height() const
+	{
+		return yend - ybegin;
+	}
+
+	bool empty() const
+	{
+		return xend <= xbegin || yend <= ybegin;
+	}
+};
+
+// The whole image of view
+render_roi full_roi(ortho_view const& view);
+
+// Parse a region in oiiotool's geometry WxH+X+Y. Returns false for anything else or an empty
+// region and leaves roi untouched.
+bool parse_roi(char const* text, render_roi& roi);
+
+// roi clipped to the image of view, empty if they don't overlap
+render_roi clip_roi(render_roi const& roi, ortho_view const& view);
+
+// Copy the pixels of region, pixel_bytes each, from src, which holds the pixels of src_window
+// in rows of src_row_bytes, to dst, which holds the ones of dst_window in rows of
+// dst_row_bytes. region lies in both windows.
+void copy_roi(void const* src, std::size_t src_row_bytes, render_roi const& src_window, void* dst, std::size_t dst_row_bytes, render_roi const& dst_window,
+              render_roi const& region, std::size_t pixel_bytes);
@@ -0,0 +1,248 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "thread_pool.h"
+
+// Relative slack covering the float rounding of box vs ray origin comparisons
+static float const kBoundsSlack = 1.f / (1 << 20);
+
+void sphere_soa::resize(std::uint32_t num_spheres)
+{
+	cx.resize(num_spheres);
+	cy.resize(num_spheres);
+	cz.resize(num_spheres);
+	radius2.resize(num_spheres);
+	radius.resize(num_spheres);
+	color.resize(num_spheres * 3);
+}
+
+void sphere_soa::set(std::uint32_t i, float x, float y, float z, float r, float red, float green, float blue)
+{
+	cx[i] = x;
+	cy[i] = y;
+	cz[i] = z;
+	radius[i] = r;
+	radius2[i] = r * r;
+	color[i * 3] = red;
+	color[i * 3 + 1] = green;
+	color[i * 3 + 2] = blue;
+}
+
+namespace
+{
+	// Draws of the MSVC rand() sequence per generated sphere
+	std::uint32_t const kDrawsPerSphere = 7;
+
+	// The linear congruential generator behind MSVC srand()/rand(): RAND_MAX is 32767 and
+	// every draw returns bits 16..30 of the 32-bit state
+	class msvc_rand
+	{
+	public:
+		explicit msvc_rand(std::uint32_t seed)
+			: state_(seed)
+		{
+		}
+
+		// Advance the state by n draws in O(log n): the affine step s -> a * s + c applied n
+		// times is again affine, its coefficients are built by repeated squaring
+		void skip(std::uint64_t n)
+		{
+			std::uint32_t mul = 1, add = 0;
+			std::uint32_t step_mul = kMultiplier, step_add = kIncrement;
+
+			for (; n > 0; n >>= 1)
+			{
+				if (n & 1)
+				{
+					mul *= step_mul;
+					add = add * step_mul + step_add;
+				}
+
+				step_add *= step_mul + 1;
+				step_mul *= step_mul;
+			}
+
+			state_ = state_ * mul + add;
+		}
+
+		// ((float)rand()) / RAND_MAX as the original generator computed it
+		float next_float()
+		{
+			state_ = state_ * kMultiplier + kIncrement;
+			return static_cast<float>((state_ >> 16) & 0x7fff) / 32767.f;
+		}
+
+	private:
+		static std::uint32_t const kMultiplier = 214013;
+		static std::uint32_t const kIncrement = 2531011;
+
+		std::uint32_t state_;
+	};
+
+	// Philox4x32-10 of Salmon et al., "Parallel random numbers: as easy as 1, 2, 3".
+	// Mirrored by philox4x32 in trace.cl.
+	void philox4x32(std::uint32_t counter[4], std::uint32_t key0, std::uint32_t key1)
+	{
+		for (auto round = 0; round < 10; ++round)
+		{
+			std::uint64_t p0 = std::uint64_t(0xD2511F53) * counter[0];
+			std::uint64_t p1 = std::uint64_t(0xCD9E8D57) * counter[2];
+
+			std::uint32_t c0 = static_cast<std::uint32_t>(p1 >> 32) ^ counter[1] ^ key0;
+			std::uint32_t c2 = static_cast<std::uint32_t>(p0 >> 32) ^ counter[3] ^ key1;
+
+			counter[0] = c0;
+			counter[1] = static_cast<std::uint32_t>(p1);
+			counter[2] = c2;
+			counter[3] = static_cast<std::uint32_t>(p0);
+
+			key0 += 0x9E3779B9;
+			key1 += 0xBB67AE85;
+		}
+	}
+
+	// Top 24 bits of bits as a float in [0, 1), exact
+	float unit_float(std::uint32_t bits)
+	{
+		return static_cast<float>(bits >> 8) * (1.f / 16777216.f);
+	}
+}
+
+char const* scene_generator_name(scene_generator generator)
+{
+	return generator == scene_generator::philox ? "philox" : "msvc";
+}
+
+bool parse_scene_generator(char const* name, scene_generator& generator)
+{
+	for (auto candidate : { scene_generator::msvc, scene_generator::philox })
+	{
+		if (std::strcmp(name, scene_generator_name(candidate)) == 0)
+		{
+			generator = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void generate_spheres(sphere_soa& spheres, std::uint32_t num_spheres)
+{
+	spheres.resize(num_spheres);
+	generate_sphere_range(spheres, scene_generator::msvc, 0, num_spheres);
+}
+
+void generate_spheres(sphere_soa& spheres, std::uint32_t num_spheres, scene_generator generator, thread_pool& pool, std::uint32_t seed)
+{
+	spheres.resize(num_spheres);
+
+	pool.run_each([&](std::uint32_t worker)
+	{
+		auto begin = static_cast<std::uint32_t>(std::uint64_t(num_spheres) * worker / pool.size());
+		auto end = static_cast<std::uint32_t>(std::uint64_t(num_spheres) * (worker + 1) / pool.size());
+
+		generate_sphere_range(spheres, generator, begin, end, seed);
+	});
+}
+
+void generate_sphere_range(sphere_soa& spheres, scene_generator generator, std::uint32_t begin, std::uint32_t end, std::uint32_t seed)
+{
+	if (generator == scene_generator::msvc)
+	{
+		msvc_rand rand(seed);
+		rand.skip(std::uint64_t(begin) * kDrawsPerSphere);
+
+		for (auto i = begin; i < end; ++i)
+		{
+			// Keep the rand() call order of the original generator
+			float x = rand.next_float() * 20.f - 10.f;
+			float y = rand.next_float() * 20.f - 10.f;
+			float z = rand.next_float() * 20.f - 5.f;
+			float r = (rand.next_float() + 0.1f) * 1.5f;
+			float red = rand.next_float();
+			float green = rand.next_float();
+			float blue = rand.next_float();
+
+			spheres.set(i, x, y, z, r, red, green, blue);
+		}
+
+		return;
+	}
+
+	for (auto i = begin; i < end; ++i)
+	{
+		// Two blocks of four draws per sphere, the same ranges as the msvc generator
+		std::uint32_t first[4] = { i, 0, 0, 0 };
+		std::uint32_t second[4] = { i, 1, 0, 0 };
+
+		philox4x32(first, seed, 0);
+		philox4x32(second, seed, 0);
+
+		spheres.set(i, unit_float(first[0]) * 20.f - 10.f, unit_float(first[1]) * 20.f - 10.f, unit_float(first[2]) * 20.f - 5.f,
+		            (unit_float(first[3]) + 0.1f) * 1.5f, unit_float(second[0]), unit_float(second[1]), unit_float(second[2]));
+	}
+}
+
+void rotate_spheres(sphere_soa const& rest, float angle, sphere_soa& moved)
+{
+	float const pivot_z = kTurntableAxisZ;
+	float c = std::cos(angle);
+	float s = std::sin(angle);
+
+	for (auto i = 0U; i < rest.size(); ++i)
+	{
+		float x = rest.cx[i];
+		float z = rest.cz[i] - pivot_z;
+
+		moved.cx[i] = c * x + s * z;
+		moved.cy[i] = rest.cy[i];
+		moved.cz[i] = pivot_z - s * x + c * z;
+	}
+}
+
+Imath::Box3f sphere_bounds(sphere_soa const& spheres, std::uint32_t k, float ray_origin_z)
+{
+	float cx = spheres.cx[k];
+	float cy = spheres.cy[k];
+	float cz = spheres.cz[k];
+	float r = spheres.radius[k];
+
+	// Upper bound of ox^2 + oy^2 + oz^2 in the ray-sphere test over the sphere footprint.
+	// The discriminant b^2 - 4c carries a rounding error of a few ulps of 4 * sum, so
+	// pixels slightly outside the exact silhouette may still see d >= 0; grow r^2 by a
+	// generous multiple of that error.
+	float dz = std::fabs(cz - ray_origin_z) + r;
+	float sum = dz * dz + 2.f * r * r;
+	float rb = std::sqrt(spheres.radius2[k] + sum * (64.f / (1 << 24)));
+
+	float slack_xy = (std::fabs(cx) + std::fabs(cy) + rb) * kBoundsSlack;
+	float slack_z = (std::fabs(cz) + std::fabs(ray_origin_z) + rb) * kBoundsSlack;
+
+	return Imath::Box3f(Imath::V3f(cx - rb - slack_xy, cy - rb - slack_xy, cz - rb - slack_z),
+	                    Imath::V3f(cx + rb + slack_xy, cy + rb + slack_xy, cz + rb + slack_z));
+}
+
+float sphere_inner_radius(sphere_soa const& spheres, std::uint32_t k, float ray_origin_z)
+{
+	float cx = spheres.cx[k];
+	float cy = spheres.cy[k];
+	float cz = spheres.cz[k];
+	float r = spheres.radius[k];
+
+	// the discriminant error of sphere_bounds() taken off r^2
+	float dz = std::fabs(cz - ray_origin_z) + r;
+	float sum = dz * dz + 2.f * r * r;
+	float ri2 = spheres.radius2[k] - sum * (64.f / (1 << 24));
+
+	if (ri2 <= 0.f)
+		return 0.f;
+
+	float ri = std::sqrt(ri2);
+	float slack_xy = (std::fabs(cx) + std::fabs(cy) + r) * kBoundsSlack;
+
+	return std::max(ri - slack_xy, 0.f);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <OpenEXR/ImathBox.h>
+
+class thread_pool;
+
+// Seed the sphere set has always been generated with
+std::uint32_t const kSceneSeed = 0x88e8fff4;
+
+// Sphere set in structure-of-arrays layout, shared by the CPU tracers and
+// the OpenCL kernel. The intersection loops stream only the center and
+// squared radius arrays; radius and color are touched by scene builders
+// and when the color of the closest sphere is resolved.
+struct sphere_soa
+{
+	// Centers
+	std::vector<float> cx, cy, cz;
+	// Squared radii, precomputed once per sphere
+	std::vector<float> radius2;
+	// Radii
+	std::vector<float> radius;
+	// Sphere colors, 3 floats (r, g, b) per sphere
+	std::vector<float> color;
+
+	std::uint32_t size() const
+	{
+		return static_cast<std::uint32_t>(cx.size());
+	}
+
+	void resize(std::uint32_t num_spheres);
+
+	// Set sphere i, radius2 is derived from radius
+	void set(std::uint32_t i, float x, float y, float z, float r, float red, float green, float blue);
+};
+
+// Random sequences a sphere set can be drawn from
+enum class scene_generator
+{
+	// The std::rand() sequence of the MSVC runtime the golden images were rendered with,
+	// reproduced on every platform: seven draws per sphere in the original call order
+	msvc,
+	// Counter-based Philox4x32-10 keyed by kSceneSeed, sphere i only depends on i
+	philox
+};
+
+char const* scene_generator_name(scene_generator generator);
+
+// Parse msvc|philox, returns false for anything else
+bool parse_scene_generator(char const* name, scene_generator& generator);
+
+// Randomly generate a set of num_spheres spheres. Spheres are created in the
+// same order and from the same rand() sequence as the original array-of-structures
+// generator built with MSVC, so rendered images don't change.
+void generate_spheres(sphere_soa& spheres, std::uint32_t num_spheres);
+
+// Generate num_spheres spheres of generator on all threads of pool. Every thread
+// starts its range where the sequence is at, so the set is the one of a serial run.
+// Another seed than kSceneSeed starts another sequence, for sets of random scenes.
+void generate_spheres(sphere_soa& spheres, std::uint32_t num_spheres, scene_generator generator, thread_pool& pool, std::uint32_t seed = kSceneSeed);
+
+// Spheres [begin, end) of the sequence of generator from seed, spheres must hold at least end
+// spheres
+void generate_sphere_range(sphere_soa& spheres, scene_generator generator, std::uint32_t begin, std::uint32_t end, std::uint32_t seed = kSceneSeed);
+
+// z of the vertical axis of rotate_spheres, the middle of the generated volume
+float const kTurntableAxisZ = 5.f;
+
+// Turntable motion: set the centers of moved to those of rest rotated by angle radians
+// about the vertical axis through the middle of the generated volume (x = 0, z =
+// kTurntableAxisZ). moved must have the size of rest; radii and colors are left as they are.
+void rotate_spheres(sphere_soa const& rest, float angle, sphere_soa& moved);
+
+// Bounds of sphere k that contain every point the float ray-sphere test in trace()
+// can report for +Z rays starting on the plane z = ray_origin_z. The radius is widened
+// by the rounding error of the discriminant, so culling against these bounds never
+// drops a hit the brute force loop would find.
+Imath::Box3f sphere_bounds(sphere_soa const& spheres, std::uint32_t k, float ray_origin_z);
+
+// Radius of the disc around the center of sphere k inside which every +Z ray starting on the
+// plane z = ray_origin_z meets the sphere in the float test of trace(): the radius of
+// sphere_bounds() shrunk by its error terms instead of grown. 0 if they swallow the sphere.
+float sphere_inner_radius(sphere_soa const& spheres, std::uint32_t k, float ray_origin_z);
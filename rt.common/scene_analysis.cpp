@@ -0,0 +1,175 @@
+#include "scene_analysis.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	tile_spread spread(std::vector<std::uint32_t> counts)
+	{
+		tile_spread result = {};
+
+		if (counts.empty())
+			return result;
+
+		double sum = 0.0;
+
+		for (auto count : counts)
+		{
+			sum += count;
+		}
+
+		std::sort(counts.begin(), counts.end());
+
+		// nearest rank, as bench_result's percentiles
+		auto rank = [&](double p)
+		{
+			return counts[std::max<std::size_t>(static_cast<std::size_t>(std::ceil(p * counts.size())), 1) - 1];
+		};
+
+		result.mean = sum / counts.size();
+		result.p50 = rank(0.5);
+		result.p95 = rank(0.95);
+		result.max = counts.back();
+		return result;
+	}
+
+	std::uint32_t bit_count(std::uint32_t word)
+	{
+		std::uint32_t count = 0;
+
+		for (; word != 0; word &= word - 1)
+		{
+			++count;
+		}
+
+		return count;
+	}
+}
+
+scene_analysis analyze_scene(sphere_soa const& spheres, ortho_view const& view, std::uint32_t tile_size)
+{
+	scene_analysis analysis = {};
+	analysis.stats = measure_scene(spheres, view);
+	analysis.tile_size = tile_size;
+
+	frame_arena scratch;
+	auto grid = build_grid(spheres, view, scratch, tile_size);
+	analysis.tiles_x = grid.cells_x;
+	analysis.tiles_y = grid.cells_y;
+	analysis.tile_spheres.resize(std::size_t(grid.cells_x) * grid.cells_y);
+
+	for (std::size_t c = 0; c < analysis.tile_spheres.size(); ++c)
+	{
+		auto count = grid.cell_start[c + 1] - grid.cell_start[c];
+		analysis.tile_spheres[c] = count;
+		analysis.empty_tiles += count == 0 ? 1 : 0;
+		analysis.overlapped_tiles += count > 1 ? 1 : 0;
+	}
+
+	analysis.tile_depth = spread(analysis.tile_spheres);
+
+	pixel_rect rect;
+
+	for (std::uint32_t k = 0; k < spheres.size(); ++k)
+	{
+		if (!sphere_footprint(spheres, k, view, rect))
+			continue;
+
+		auto area = static_cast<std::uint64_t>(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+		std::size_t bin = 0;
+
+		for (; area > 1; area >>= 1)
+		{
+			++bin;
+		}
+
+		if (analysis.footprint_histogram.size() <= bin)
+			analysis.footprint_histogram.resize(bin + 1);
+
+		++analysis.footprint_histogram[bin];
+	}
+
+	for (auto word : build_coverage(spheres, view))
+	{
+		analysis.covered_pixels += bit_count(word);
+	}
+
+	analysis.covered_share = analysis.stats.pixels > 0.0 ? analysis.covered_pixels / analysis.stats.pixels : 0.0;
+	analysis.overlap_ratio = analysis.covered_pixels > 0.0 ? analysis.stats.coverage / analysis.covered_pixels : 0.0;
+
+	for (auto mode : { accel_mode::none, accel_mode::bvh, accel_mode::grid, accel_mode::splat, accel_mode::sorted, accel_mode::adaptive })
+	{
+		// as plan_render, bvh and sorted fall back to brute force over spheres crossing the near plane
+		if ((mode == accel_mode::bvh || mode == accel_mode::sorted) && !analysis.stats.beyond_near)
+			continue;
+
+		mode_estimate estimate;
+		estimate.mode = mode;
+		estimate.work = mode_work(analysis.stats, mode);
+		estimate.cpu_ms = default_plan_ms(plan_backend::cpu, 1, estimate.work);
+		estimate.gpu_ms = default_plan_ms(plan_backend::gpu, 1, estimate.work);
+		analysis.estimates.push_back(estimate);
+	}
+
+	return analysis;
+}
+
+void write_analysis_json(std::ostream& out, scene_analysis const& analysis, bool tiles)
+{
+	auto const& stats = analysis.stats;
+
+	out << "{\n"
+	    << "  \"spheres\": " << stats.spheres << ",\n"
+	    << "  \"visible\": " << stats.visible << ",\n"
+	    << "  \"pixels\": " << stats.pixels << ",\n"
+	    << "  \"beyond_near\": " << (stats.beyond_near ? "true" : "false") << ",\n"
+	    << "  \"depth_complexity\": " << stats.depth_complexity << ",\n"
+	    << "  \"mean_footprint\": " << stats.mean_footprint << ",\n"
+	    << "  \"max_footprint\": " << stats.max_footprint << ",\n"
+	    << "  \"covered_pixels\": " << analysis.covered_pixels << ",\n"
+	    << "  \"covered_share\": " << analysis.covered_share << ",\n"
+	    << "  \"overlap_ratio\": " << analysis.overlap_ratio << ",\n"
+	    << "  \"footprint_histogram\": [";
+
+	for (std::size_t b = 0; b < analysis.footprint_histogram.size(); ++b)
+	{
+		out << (b == 0 ? " " : ", ") << "{ \"min_pixels\": " << (std::uint64_t(1) << b) << ", \"spheres\": " << analysis.footprint_histogram[b] << " }";
+	}
+
+	out << " ],\n"
+	    << "  \"tiles\": {\n"
+	    << "    \"size\": " << analysis.tile_size << ",\n"
+	    << "    \"x\": " << analysis.tiles_x << ",\n"
+	    << "    \"y\": " << analysis.tiles_y << ",\n"
+	    << "    \"empty\": " << analysis.empty_tiles << ",\n"
+	    << "    \"overlapped\": " << analysis.overlapped_tiles << ",\n"
+	    << "    \"depth_complexity\": { \"mean\": " << analysis.tile_depth.mean << ", \"p50\": " << analysis.tile_depth.p50 << ", \"p95\": " << analysis.tile_depth.p95
+	    << ", \"max\": " << analysis.tile_depth.max << " }";
+
+	if (tiles)
+	{
+		out << ",\n    \"spheres\": [";
+
+		for (std::size_t t = 0; t < analysis.tile_spheres.size(); ++t)
+		{
+			out << (t == 0 ? "" : ", ") << analysis.tile_spheres[t];
+		}
+
+		out << "]";
+	}
+
+	out << "\n  },\n"
+	    << "  \"modes\": [\n";
+
+	for (std::size_t i = 0; i < analysis.estimates.size(); ++i)
+	{
+		auto const& estimate = analysis.estimates[i];
+		out << "    { \"mode\": \"" << accel_mode_name(estimate.mode) << "\", \"build\": " << estimate.work.build << ", \"trace\": " << estimate.work.trace
+		    << ", \"pixels\": " << estimate.work.pixels << ", \"cpu_ms\": " << estimate.cpu_ms << ", \"gpu_ms\": " << estimate.gpu_ms << " }"
+		    << (i + 1 < analysis.estimates.size() ? ",\n" : "\n");
+	}
+
+	out << "  ]\n"
+	    << "}\n";
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "accel.h"
+#include "grid.h"
+#include "render_planner.h"
+#include "scene.h"
+
+// Spread of a count over the tiles of an image
+struct tile_spread
+{
+	double mean;
+	std::uint32_t p50, p95, max;
+};
+
+// Work and uncalibrated cost of tracing a scene in one mode (see mode_work, default_plan_ms)
+struct mode_estimate
+{
+	accel_mode mode;
+	plan_work work;
+	// One cpu worker, all the gpu
+	double cpu_ms;
+	double gpu_ms;
+};
+
+// Statistics of a scene through a view for choosing its mode before anything is built, as
+// rt.analyze reports them
+struct scene_analysis
+{
+	scene_stats stats;
+	// The image in tiles of tile_size pixels binned as build_grid bins them: tile_spheres[t]
+	// holds the spheres whose footprint reaches tile t, row by row, its depth complexity as the
+	// grid mode traces it
+	std::uint32_t tile_size;
+	std::uint32_t tiles_x, tiles_y;
+	std::vector<std::uint32_t> tile_spheres;
+	tile_spread tile_depth;
+	// Tiles no sphere reaches, and tiles two or more spheres reach
+	std::uint32_t empty_tiles;
+	std::uint32_t overlapped_tiles;
+	// footprint_histogram[b] counts the visible spheres whose footprint covers 2^b up to
+	// 2^(b + 1) - 1 pixels
+	std::vector<std::uint32_t> footprint_histogram;
+	// Pixels some sphere covers (build_coverage), the share of the image they make up, and the
+	// footprints over such a pixel on average: 1 if no footprints overlap
+	double covered_pixels;
+	double covered_share;
+	double overlap_ratio;
+	// Every mode the scene can take, brute force first; bvh and sorted only if spheres_beyond_near
+	std::vector<mode_estimate> estimates;
+};
+
+// Analyze spheres seen through view in tiles of tile_size pixels
+scene_analysis analyze_scene(sphere_soa const& spheres, ortho_view const& view, std::uint32_t tile_size);
+
+// Write analysis as a JSON object to out, the sphere count of every tile as well with tiles
+void write_analysis_json(std::ostream& out, scene_analysis const& analysis, bool tiles);
@@ -0,0 +1,127 @@
+#include "scene_edits.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Copy sphere i of from over sphere k of to
+	void copy_sphere(sphere_soa& to, std::uint32_t k, sphere_soa const& from, std::uint32_t i)
+	{
+		to.cx[k] = from.cx[i];
+		to.cy[k] = from.cy[i];
+		to.cz[k] = from.cz[i];
+		to.radius2[k] = from.radius2[i];
+		to.radius[k] = from.radius[i];
+		std::copy(&from.color[3 * i], &from.color[3 * i] + 3, &to.color[3 * k]);
+	}
+}
+
+std::vector<sphere_range> index_ranges(std::vector<std::uint32_t> indices)
+{
+	std::sort(indices.begin(), indices.end());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+	std::vector<sphere_range> ranges;
+
+	for (auto k : indices)
+	{
+		if (!ranges.empty() && ranges.back().first + ranges.back().count == k)
+			++ranges.back().count;
+		else
+			ranges.push_back(sphere_range{ k, 1U });
+	}
+
+	return ranges;
+}
+
+bool is_tombstone(sphere_soa const& spheres, std::uint32_t k)
+{
+	return spheres.radius[k] == 0.f && spheres.cx[k] == kTombstoneCoord && spheres.cy[k] == kTombstoneCoord && spheres.cz[k] == kTombstoneCoord;
+}
+
+void scene_edits::reset()
+{
+	free_.clear();
+	changed_.clear();
+	grown_ = false;
+}
+
+std::vector<std::uint32_t> scene_edits::add(sphere_soa& spheres, sphere_soa const& added)
+{
+	std::vector<std::uint32_t> indices(added.size());
+
+	for (std::uint32_t i = 0; i < added.size(); ++i)
+	{
+		if (!free_.empty())
+		{
+			indices[i] = free_.back();
+			free_.pop_back();
+		}
+		else
+		{
+			indices[i] = spheres.size();
+			spheres.resize(spheres.size() + 1);
+			grown_ = true;
+		}
+
+		copy_sphere(spheres, indices[i], added, i);
+		changed_.push_back(indices[i]);
+	}
+
+	return indices;
+}
+
+void scene_edits::remove(sphere_soa& spheres, std::vector<std::uint32_t> const& indices)
+{
+	for (auto k : indices)
+	{
+		if (k >= spheres.size() || is_tombstone(spheres, k))
+			continue;
+
+		spheres.set(k, kTombstoneCoord, kTombstoneCoord, kTombstoneCoord, 0.f, 0.f, 0.f, 0.f);
+		free_.push_back(k);
+		changed_.push_back(k);
+	}
+}
+
+void scene_edits::update(sphere_soa& spheres, std::vector<std::uint32_t> const& indices, sphere_soa const& changed)
+{
+	for (std::uint32_t i = 0; i < changed.size() && i < indices.size(); ++i)
+	{
+		copy_sphere(spheres, indices[i], changed, i);
+		changed_.push_back(indices[i]);
+	}
+}
+
+void scene_edits::clear_changed()
+{
+	changed_.clear();
+	grown_ = false;
+}
+
+bool scene_edits::compaction_due(sphere_soa const& spheres) const
+{
+	return !free_.empty() && free_.size() >= kCompactFraction * spheres.size();
+}
+
+std::vector<std::uint32_t> scene_edits::compact(sphere_soa& spheres)
+{
+	std::vector<std::uint32_t> remap(spheres.size(), kRemovedSphere);
+	std::uint32_t kept = 0;
+
+	for (std::uint32_t k = 0; k < spheres.size(); ++k)
+	{
+		if (is_tombstone(spheres, k))
+			continue;
+
+		if (kept != k)
+			copy_sphere(spheres, kept, spheres, k);
+
+		remap[k] = kept++;
+	}
+
+	spheres.resize(kept);
+	reset();
+
+	return remap;
+}
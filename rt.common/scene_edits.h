@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "scene.h"
+
+// Coordinate a removed sphere is parked at along every axis: a point this far out is met by no
+// ray of a view and has no footprint, yet its squares stay finite, so the tracers and the
+// builders take it as any other sphere
+float const kTombstoneCoord = 1e18f;
+
+// Share of the spheres that may be tombstones before scene_edits::compaction_due() holds
+float const kCompactFraction = 0.25f;
+
+// New index compact() gives a dropped sphere
+std::uint32_t const kRemovedSphere = 0xffffffffU;
+
+// Run [first, first + count) of consecutive sphere indices
+struct sphere_range
+{
+	std::uint32_t first;
+	std::uint32_t count;
+};
+
+// The sorted runs of consecutive indices in indices, repeats merged
+std::vector<sphere_range> index_ranges(std::vector<std::uint32_t> indices);
+
+// True if sphere k of spheres is the tombstone of a removed one
+bool is_tombstone(sphere_soa const& spheres, std::uint32_t k);
+
+// Edits of a sphere set between frames. A removed sphere stays in its slot as a tombstone, a
+// sphere of zero radius parked at kTombstoneCoord, so the other indices keep their place in the
+// device buffers and the structures built over the set; added spheres take the slots of removed
+// ones before they are appended. The renderers upload the index ranges changed since the last
+// frame and refit their structure over them (refit_scene), compact() drops the tombstones.
+class scene_edits
+{
+public:
+	// Start over for a set without tombstones
+	void reset();
+
+	// Add the spheres of added to spheres, returns the index each one got
+	std::vector<std::uint32_t> add(sphere_soa& spheres, sphere_soa const& added);
+
+	// Turn the spheres indices into tombstones, tombstones are left as they are
+	void remove(sphere_soa& spheres, std::vector<std::uint32_t> const& indices);
+
+	// Set sphere indices[i] to sphere i of changed, for every i; the indices are of spheres that
+	// weren't removed
+	void update(sphere_soa& spheres, std::vector<std::uint32_t> const& indices, sphere_soa const& changed);
+
+	// Indices edited since the last clear_changed(), appended ones included, in the order of
+	// the edits and with repeats
+	std::vector<std::uint32_t> const& changed() const
+	{
+		return changed_;
+	}
+
+	// True if spheres were appended since the last clear_changed(): buffers, kernels and
+	// structures sized for the set must be set up again
+	bool grown() const
+	{
+		return grown_;
+	}
+
+	void clear_changed();
+
+	std::uint32_t tombstones() const
+	{
+		return static_cast<std::uint32_t>(free_.size());
+	}
+
+	// True once tombstones make up kCompactFraction of spheres
+	bool compaction_due(sphere_soa const& spheres) const;
+
+	// Drop the tombstones from spheres, the others keep their order. Returns the new index of
+	// every old one, kRemovedSphere for the dropped ones; the edits start over.
+	std::vector<std::uint32_t> compact(sphere_soa& spheres);
+
+private:
+	// Slots of the tombstones, reused from the back
+	std::vector<std::uint32_t> free_;
+	std::vector<std::uint32_t> changed_;
+	bool grown_ = false;
+};
@@ -0,0 +1,429 @@
+#include "scene_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	char const kSceneMagic[8] = "RTSCENE";
+
+	static_assert(std::is_trivially_copyable<scene_file_header>::value, "the header is written as is");
+	static_assert(sizeof(bvh_node) == 32, "bvh nodes are written as is");
+
+#ifdef _WIN32
+	// Named mappings of this session
+	std::string mapping_name(std::string const& name)
+	{
+		return "Local\\" + name;
+	}
+#else
+	std::string mapping_name(std::string const& name)
+	{
+		return "/" + name;
+	}
+#endif
+
+	std::uint64_t align_offset(std::uint64_t offset)
+	{
+		return (offset + kSceneAlignment - 1) / kSceneAlignment * kSceneAlignment;
+	}
+
+	// Array a of spheres, const if spheres is
+	template <typename Soa>
+	auto soa_array(Soa& spheres, scene_array a) -> decltype((spheres.cx))
+	{
+		switch (a)
+		{
+		case scene_array::cx: return spheres.cx;
+		case scene_array::cy: return spheres.cy;
+		case scene_array::cz: return spheres.cz;
+		case scene_array::radius2: return spheres.radius2;
+		case scene_array::radius: return spheres.radius;
+		default: return spheres.color;
+		}
+	}
+
+	std::uint64_t array_floats(std::uint32_t num_spheres, scene_array a)
+	{
+		return std::uint64_t(num_spheres) * (a == scene_array::color ? 3 : 1);
+	}
+
+	// Write size bytes of data at offset, zero padding from the current position
+	void write_at(std::ostream& out, std::uint64_t offset, void const* data, std::size_t size)
+	{
+		static char const zeros[kSceneAlignment] = {};
+
+		auto position = static_cast<std::uint64_t>(out.tellp());
+
+		if (position < offset)
+			out.write(zeros, static_cast<std::streamsize>(offset - position));
+
+		out.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+	}
+
+	// Write the scene file of spheres, and accel unless it is null, to out
+	void write_scene(std::ostream& out, sphere_soa const& spheres, bvh const* accel, float ray_origin_z)
+	{
+		scene_file_header header = {};
+		std::memcpy(header.magic, kSceneMagic, sizeof(header.magic));
+		header.version = kSceneFileVersion;
+		header.num_spheres = spheres.size();
+
+		std::uint64_t offset = align_offset(sizeof(header));
+
+		for (auto a = 0; a < static_cast<int>(scene_array::count); ++a)
+		{
+			header.array_offset[a] = offset;
+			offset = align_offset(offset + sizeof(float) * array_floats(header.num_spheres, static_cast<scene_array>(a)));
+		}
+
+		if (accel)
+		{
+			header.num_nodes = static_cast<std::uint32_t>(accel->nodes.size());
+			header.num_indices = static_cast<std::uint32_t>(accel->indices.size());
+			header.bvh_origin_z = ray_origin_z;
+			header.bvh_exact = accel->exact ? 1 : 0;
+			header.node_offset = offset;
+			header.index_offset = align_offset(offset + sizeof(bvh_node) * header.num_nodes);
+		}
+
+		write_at(out, 0, &header, sizeof(header));
+
+		for (auto a = 0; a < static_cast<int>(scene_array::count); ++a)
+		{
+			auto const& data = soa_array(spheres, static_cast<scene_array>(a));
+			write_at(out, header.array_offset[a], data.data(), sizeof(float) * data.size());
+		}
+
+		if (accel)
+		{
+			write_at(out, header.node_offset, accel->nodes.data(), sizeof(bvh_node) * accel->nodes.size());
+			write_at(out, header.index_offset, accel->indices.data(), sizeof(std::uint32_t) * accel->indices.size());
+		}
+	}
+}
+
+bool write_scene_file(std::string const& file, sphere_soa const& spheres, bvh const* accel, float ray_origin_z)
+{
+	std::ofstream out(file, std::ios::binary);
+
+	write_scene(out, spheres, accel, ray_origin_z);
+
+	if (!out)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+std::string scene_file_bytes(sphere_soa const& spheres, bvh const* accel, float ray_origin_z)
+{
+	std::ostringstream out(std::ios::binary);
+	write_scene(out, spheres, accel, ray_origin_z);
+	return out.str();
+}
+
+scene_file::~scene_file()
+{
+	close();
+}
+
+bool scene_file::open(std::string const& file)
+{
+	close();
+
+#ifdef _WIN32
+	file_ = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	LARGE_INTEGER file_size = {};
+
+	if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &file_size))
+	{
+		if (file_ == INVALID_HANDLE_VALUE)
+			file_ = nullptr;
+
+		close();
+		std::cout << "Can't open " << file << "\n";
+		return false;
+	}
+
+	size_ = static_cast<std::size_t>(file_size.QuadPart);
+	mapping_ = size_ > 0 ? CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	data_ = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+	int fd = ::open(file.c_str(), O_RDONLY);
+	struct stat st = {};
+
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		if (fd >= 0)
+			::close(fd);
+
+		std::cout << "Can't open " << file << "\n";
+		return false;
+	}
+
+	size_ = static_cast<std::size_t>(st.st_size);
+
+	void* data = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	data_ = data == MAP_FAILED ? nullptr : data;
+
+	// the mapping keeps its own reference to the file
+	::close(fd);
+#endif
+
+	if (!data_)
+	{
+		close();
+		std::cout << "Can't map " << file << "\n";
+		return false;
+	}
+
+	return check(file);
+}
+
+bool scene_file::open_bytes(std::string bytes, std::string const& name)
+{
+	close();
+
+	bytes_ = std::move(bytes);
+	data_ = bytes_.data();
+	size_ = bytes_.size();
+
+	return check(name);
+}
+
+bool scene_file::open_shared(std::string const& name)
+{
+	close();
+
+#ifdef _WIN32
+	mapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, mapping_name(name).c_str());
+	data_ = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	// the region in whole pages, check() only needs the sections inside it
+	MEMORY_BASIC_INFORMATION info = {};
+
+	if (data_ && VirtualQuery(data_, &info, sizeof(info)) != 0)
+		size_ = static_cast<std::size_t>(info.RegionSize);
+#else
+	int fd = shm_open(mapping_name(name).c_str(), O_RDONLY, 0);
+	struct stat st = {};
+
+	if (fd >= 0 && fstat(fd, &st) == 0)
+		size_ = static_cast<std::size_t>(st.st_size);
+
+	void* data = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	data_ = data == MAP_FAILED ? nullptr : data;
+
+	if (fd >= 0)
+		::close(fd);
+#endif
+
+	if (!data_)
+	{
+		close();
+		std::cout << "Can't map the shared memory " << name << "\n";
+		return false;
+	}
+
+	return check(name);
+}
+
+bool scene_file::check(std::string const& file)
+{
+	if (size_ < sizeof(scene_file_header))
+	{
+		close();
+		std::cout << file << " is not a version " << kSceneFileVersion << " scene file\n";
+		return false;
+	}
+
+	auto const& h = header();
+
+	if (std::memcmp(h.magic, kSceneMagic, sizeof(h.magic)) != 0 || h.version != kSceneFileVersion)
+	{
+		close();
+		std::cout << file << " is not a version " << kSceneFileVersion << " scene file\n";
+		return false;
+	}
+
+	// every section must be aligned and end inside the file
+	auto inside = [&](std::uint64_t offset, std::uint64_t bytes)
+	{
+		return offset % kSceneAlignment == 0 && offset <= size_ && bytes <= size_ - offset;
+	};
+
+	bool valid = h.num_spheres > 0;
+
+	for (auto a = 0; a < static_cast<int>(scene_array::count); ++a)
+	{
+		valid = valid && inside(h.array_offset[a], sizeof(float) * array_floats(h.num_spheres, static_cast<scene_array>(a)));
+	}
+
+	if (h.node_offset != 0)
+	{
+		valid = valid && h.num_nodes > 0 && inside(h.node_offset, sizeof(bvh_node) * std::uint64_t(h.num_nodes)) &&
+		        inside(h.index_offset, sizeof(std::uint32_t) * std::uint64_t(h.num_indices));
+	}
+
+	if (!valid)
+	{
+		close();
+		std::cout << file << " is truncated or damaged\n";
+		return false;
+	}
+
+	return true;
+}
+
+void scene_file::close()
+{
+	if (data_ && data_ == bytes_.data())
+	{
+		// the data of open_bytes, nothing is mapped
+		data_ = nullptr;
+		bytes_.clear();
+	}
+
+#ifdef _WIN32
+	if (data_)
+		UnmapViewOfFile(data_);
+
+	if (mapping_)
+		CloseHandle(mapping_);
+
+	if (file_)
+		CloseHandle(file_);
+
+	file_ = mapping_ = nullptr;
+#else
+	if (data_)
+		munmap(const_cast<void*>(data_), size_);
+#endif
+
+	data_ = nullptr;
+	size_ = 0;
+}
+
+float const* scene_file::array(scene_array a) const
+{
+	auto base = static_cast<char const*>(data_);
+	return reinterpret_cast<float const*>(base + header().array_offset[static_cast<int>(a)]);
+}
+
+std::size_t scene_file::array_bytes(scene_array a) const
+{
+	return static_cast<std::size_t>(sizeof(float) * array_floats(size(), a));
+}
+
+void scene_file::copy_spheres(sphere_soa& spheres) const
+{
+	spheres.resize(size());
+
+	for (auto a = 0; a < static_cast<int>(scene_array::count); ++a)
+	{
+		auto& data = soa_array(spheres, static_cast<scene_array>(a));
+		std::memcpy(data.data(), array(static_cast<scene_array>(a)), array_bytes(static_cast<scene_array>(a)));
+	}
+}
+
+bool scene_file::has_bvh(float ray_origin_z) const
+{
+	return header().node_offset != 0 && header().bvh_origin_z == ray_origin_z;
+}
+
+bvh scene_file::load_bvh() const
+{
+	auto const& h = header();
+	auto base = static_cast<char const*>(data_);
+
+	bvh result;
+	result.exact = h.bvh_exact != 0;
+
+	auto nodes = reinterpret_cast<bvh_node const*>(base + h.node_offset);
+	auto indices = reinterpret_cast<std::uint32_t const*>(base + h.index_offset);
+
+	result.nodes.assign(nodes, nodes + h.num_nodes);
+	result.indices.assign(indices, indices + h.num_indices);
+
+	return result;
+}
+
+shared_scene::~shared_scene()
+{
+	close();
+}
+
+bool shared_scene::create(std::string const& name, sphere_soa const& spheres, bvh const* accel, float ray_origin_z)
+{
+	close();
+
+	auto bytes = scene_file_bytes(spheres, accel, ray_origin_z);
+
+#ifdef _WIN32
+	auto size = static_cast<std::uint64_t>(bytes.size());
+	mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), mapping_name(name).c_str());
+	data_ = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+#else
+	int fd = shm_open(mapping_name(name).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	void* data = fd >= 0 && ftruncate(fd, static_cast<off_t>(bytes.size())) == 0 ? mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	data_ = data == MAP_FAILED ? nullptr : data;
+
+	if (fd >= 0)
+		::close(fd);
+#endif
+
+	name_ = name;
+	size_ = bytes.size();
+
+	if (!data_)
+	{
+		close();
+		std::cout << "Can't create the shared memory " << name << "\n";
+		return false;
+	}
+
+	std::memcpy(data_, bytes.data(), bytes.size());
+	return true;
+}
+
+void shared_scene::close()
+{
+#ifdef _WIN32
+	if (data_)
+		UnmapViewOfFile(data_);
+
+	if (mapping_)
+		CloseHandle(mapping_);
+
+	mapping_ = nullptr;
+#else
+	if (data_)
+		munmap(data_, size_);
+
+	if (!name_.empty())
+		shm_unlink(mapping_name(name_).c_str());
+#endif
+
+	data_ = nullptr;
+	size_ = 0;
+	name_.clear();
+}
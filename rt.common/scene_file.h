@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "bvh.h"
+#include "scene.h"
+
+// Binary scene file, little endian:
+// * scene_file_header at offset 0
+// * sphere section: the sphere_soa arrays cx, cy, cz, radius2, radius and color (3 floats per
+//   sphere), each starting on a kSceneAlignment boundary
+// * optional BVH section: the bvh_node array and the index array, each aligned the same way
+// Every offset is from the start of the file, so a mapped file is used in place.
+std::uint32_t const kSceneFileVersion = 1;
+std::size_t const kSceneAlignment = 64;
+
+// Arrays of the sphere section in file order
+enum class scene_array
+{
+	cx,
+	cy,
+	cz,
+	radius2,
+	radius,
+	color,
+	count
+};
+
+struct scene_file_header
+{
+	// "RTSCENE" and a terminating zero
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t num_spheres;
+	std::uint64_t array_offset[static_cast<int>(scene_array::count)];
+	// BVH section, node_offset == 0 if the file has none
+	std::uint64_t node_offset;
+	std::uint64_t index_offset;
+	std::uint32_t num_nodes;
+	std::uint32_t num_indices;
+	// Ray origin plane the BVH was built for and its bvh::exact flag
+	float bvh_origin_z;
+	std::uint32_t bvh_exact;
+};
+
+// Write spheres, and accel built for rays starting at z = ray_origin_z unless it is null, to file.
+// Returns false if the file can't be written.
+bool write_scene_file(std::string const& file, sphere_soa const& spheres, bvh const* accel, float ray_origin_z);
+
+// The bytes write_scene_file writes, for sending a scene without a file
+std::string scene_file_bytes(sphere_soa const& spheres, bvh const* accel, float ray_origin_z);
+
+// Read-only memory mapping of a scene file. The arrays point into the mapping and stay
+// valid until the scene_file is closed or destroyed.
+class scene_file
+{
+public:
+	scene_file() = default;
+	~scene_file();
+
+	scene_file(scene_file const&) = delete;
+	scene_file& operator=(scene_file const&) = delete;
+
+	// Map file and check the header and that every section lies inside the file.
+	// Returns false with a message if it isn't a scene file of kSceneFileVersion.
+	bool open(std::string const& file);
+	// Same for a scene file received in memory, kept by the scene_file instead of a mapping;
+	// name is used in the messages
+	bool open_bytes(std::string bytes, std::string const& name);
+	// Same for a scene file another process put in the named shared memory name (see
+	// shared_scene), mapped read-only
+	bool open_shared(std::string const& name);
+	void close();
+
+	std::uint32_t size() const
+	{
+		return header().num_spheres;
+	}
+
+	// Sphere array a in the sphere_soa layout, kSceneAlignment aligned
+	float const* array(scene_array a) const;
+	std::size_t array_bytes(scene_array a) const;
+
+	// Copy the sphere section into spheres, one memcpy per array
+	void copy_spheres(sphere_soa& spheres) const;
+
+	// The whole file, for the sections a snapshot appends after the scene (snapshot.h)
+	void const* data() const
+	{
+		return data_;
+	}
+
+	std::size_t file_size() const
+	{
+		return size_;
+	}
+
+	// True if the file holds a BVH built for rays starting at z = ray_origin_z
+	bool has_bvh(float ray_origin_z) const;
+	bvh load_bvh() const;
+
+private:
+	// Check the header and sections of the data in place, close and return false with a message if they are wrong
+	bool check(std::string const& name);
+
+	scene_file_header const& header() const
+	{
+		return *static_cast<scene_file_header const*>(data_);
+	}
+
+	void const* data_ = nullptr;
+	std::size_t size_ = 0;
+	// File contents of open_bytes, data_ points into it; empty for a mapping
+	std::string bytes_;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+// A scene file in named shared memory, for a render server in another process to map with
+// scene_file::open_shared instead of reading a file or a socket: the shm_open name "/name",
+// "Local\\name" on Windows, as for shared_framebuffer. The region lives until close(), the
+// mappings of the server stay valid after it.
+class shared_scene
+{
+public:
+	shared_scene() = default;
+	~shared_scene();
+
+	shared_scene(shared_scene const&) = delete;
+	shared_scene& operator=(shared_scene const&) = delete;
+
+	// Create the region name holding what write_scene_file writes for the arguments. Returns
+	// false with a message if it can't be created.
+	bool create(std::string const& name, sphere_soa const& spheres, bvh const* accel, float ray_origin_z);
+	void close();
+
+private:
+	void* data_ = nullptr;
+	std::size_t size_ = 0;
+	std::string name_;
+#ifdef _WIN32
+	void* mapping_ = nullptr;
+#endif
+};
@@ -0,0 +1,397 @@
+#include "shared_framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	char const kFrameMagic[8] = "RTFRAME";
+	char const kRawMagic[8] = "RTRAW";
+
+	static_assert(std::is_standard_layout<shared_frame_header>::value, "the header is shared between processes");
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "lock based atomics don't work between processes");
+
+	std::size_t align_size(std::size_t size)
+	{
+		return (size + kSharedFrameAlignment - 1) / kSharedFrameAlignment * kSharedFrameAlignment;
+	}
+
+#ifdef _WIN32
+	// Named mappings of this session
+	std::string mapping_name(std::string const& name)
+	{
+		return "Local\\" + name;
+	}
+#else
+	std::string mapping_name(std::string const& name)
+	{
+		return "/" + name;
+	}
+#endif
+
+	// Map the region name, creating it with size bytes if create is set, else size is set to the
+	// size of the existing one. Returns null with a message if it fails.
+	void* map_region(std::string const& name, bool is_file, bool create, std::size_t& size, void*& file, void*& mapping)
+	{
+		void* data = nullptr;
+
+#ifdef _WIN32
+		file = mapping = nullptr;
+
+		if (is_file)
+		{
+			file = CreateFileA(name.c_str(), create ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+			                   create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+			if (file == INVALID_HANDLE_VALUE)
+				file = nullptr;
+		}
+
+		if (!is_file || file)
+		{
+			if (create)
+			{
+				auto bytes = static_cast<std::uint64_t>(size);
+				mapping = CreateFileMappingA(is_file ? file : INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(bytes >> 32), static_cast<DWORD>(bytes),
+				                             is_file ? nullptr : mapping_name(name).c_str());
+			}
+			else
+			{
+				mapping = is_file ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : OpenFileMappingA(FILE_MAP_READ, FALSE, mapping_name(name).c_str());
+			}
+		}
+
+		data = mapping ? MapViewOfFile(mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+		MEMORY_BASIC_INFORMATION info = {};
+
+		if (data && !create && VirtualQuery(data, &info, sizeof(info)) != 0)
+			size = static_cast<std::size_t>(info.RegionSize);
+
+		if (!data)
+		{
+			if (mapping)
+				CloseHandle(mapping);
+
+			if (file)
+				CloseHandle(file);
+
+			file = mapping = nullptr;
+		}
+#else
+		file = mapping = nullptr;
+
+		int flags = create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;
+		int fd = is_file ? ::open(name.c_str(), flags, 0644) : shm_open(mapping_name(name).c_str(), flags, 0644);
+		struct stat st = {};
+
+		bool sized = fd >= 0 && (create ? ftruncate(fd, static_cast<off_t>(size)) == 0 : fstat(fd, &st) == 0);
+
+		if (sized && !create)
+			size = static_cast<std::size_t>(st.st_size);
+
+		if (sized && size > 0)
+		{
+			data = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+			data = data == MAP_FAILED ? nullptr : data;
+		}
+
+		// the mapping keeps its own reference
+		if (fd >= 0)
+			::close(fd);
+#endif
+
+		if (!data)
+		{
+			std::cout << "Can't " << (create ? "create " : "map ") << (is_file ? "the file " : "the shared memory ") << name << "\n";
+		}
+
+		return data;
+	}
+
+	void unmap_region(void* data, std::size_t size, void* file, void* mapping)
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+
+		if (mapping)
+			CloseHandle(mapping);
+
+		if (file)
+			CloseHandle(file);
+#else
+		(void)file;
+		(void)mapping;
+
+		if (data)
+			munmap(data, size);
+#endif
+	}
+}
+
+shared_framebuffer::~shared_framebuffer()
+{
+	close();
+}
+
+bool shared_framebuffer::create(std::string const& name, bool is_file, std::uint32_t width, std::uint32_t height, std::uint32_t format, std::uint32_t pixel_size)
+{
+	close();
+
+	auto frame_size = std::size_t(width) * height * pixel_size;
+	auto header_size = align_size(sizeof(shared_frame_header));
+	auto size = header_size + kSharedFrameSlots * align_size(frame_size);
+
+	void* file = nullptr;
+	void* mapping = nullptr;
+	void* data = map_region(name, is_file, true, size, file, mapping);
+
+	if (!data)
+		return false;
+
+	// a new region is zero filled, the header is constructed in place
+	header_ = new (data) shared_frame_header;
+	std::memcpy(header_->magic, kFrameMagic, sizeof(header_->magic));
+	header_->version = kSharedFrameVersion;
+	header_->width = width;
+	header_->height = height;
+	header_->format = format;
+	header_->pixel_size = pixel_size;
+	header_->num_slots = kSharedFrameSlots;
+	header_->frame_size = frame_size;
+
+	for (std::uint32_t s = 0; s < kSharedFrameSlots; ++s)
+	{
+		header_->slots[s].sequence.store(0);
+		header_->slots[s].frame = 0;
+		header_->slots[s].offset = header_size + s * align_size(frame_size);
+	}
+
+	header_->published.store(0, std::memory_order_release);
+
+	size_ = size;
+	name_ = name;
+	is_file_ = is_file;
+#ifdef _WIN32
+	file_ = file;
+	mapping_ = mapping;
+#endif
+	return true;
+}
+
+void shared_framebuffer::close()
+{
+	if (!header_)
+		return;
+
+#ifdef _WIN32
+	unmap_region(header_, size_, file_, mapping_);
+	file_ = mapping_ = nullptr;
+#else
+	unmap_region(header_, size_, nullptr, nullptr);
+
+	// readers that mapped it keep their mapping, new ones can't open it anymore
+	if (!is_file_)
+		shm_unlink(mapping_name(name_).c_str());
+#endif
+
+	header_ = nullptr;
+	size_ = 0;
+}
+
+void shared_framebuffer::publish(std::uint64_t frame, void const* pixels, std::size_t size)
+{
+	auto published = header_->published.load(std::memory_order_relaxed);
+	auto& slot = header_->slots[published % kSharedFrameSlots];
+
+	// odd while the pixels are written
+	auto sequence = slot.sequence.load(std::memory_order_relaxed) + 1;
+	slot.sequence.store(sequence, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	std::memcpy(reinterpret_cast<char*>(header_) + slot.offset, pixels, std::min<std::size_t>(size, header_->frame_size));
+	slot.frame = frame;
+
+	slot.sequence.store(sequence + 1, std::memory_order_release);
+	header_->published.store(published + 1, std::memory_order_release);
+}
+
+shared_frame_reader::~shared_frame_reader()
+{
+	close();
+}
+
+bool shared_frame_reader::open(std::string const& name, bool is_file)
+{
+	close();
+
+	std::size_t size = 0;
+	void* file = nullptr;
+	void* mapping = nullptr;
+	void* data = map_region(name, is_file, false, size, file, mapping);
+
+	if (!data)
+		return false;
+
+	auto header = static_cast<shared_frame_header*>(data);
+
+	bool valid = size >= sizeof(shared_frame_header) && std::memcmp(header->magic, kFrameMagic, sizeof(kFrameMagic)) == 0 &&
+	             header->version == kSharedFrameVersion && header->num_slots == kSharedFrameSlots;
+
+	for (std::uint32_t s = 0; valid && s < kSharedFrameSlots; ++s)
+	{
+		valid = header->slots[s].offset <= size && header->frame_size <= size - header->slots[s].offset;
+	}
+
+	if (!valid)
+	{
+		unmap_region(data, size, file, mapping);
+		std::cout << name << " is not a version " << kSharedFrameVersion << " frame region\n";
+		return false;
+	}
+
+	header_ = header;
+	size_ = size;
+#ifdef _WIN32
+	file_ = file;
+	mapping_ = mapping;
+#endif
+	return true;
+}
+
+void shared_frame_reader::close()
+{
+	if (!header_)
+		return;
+
+#ifdef _WIN32
+	unmap_region(header_, size_, file_, mapping_);
+	file_ = mapping_ = nullptr;
+#else
+	unmap_region(header_, size_, nullptr, nullptr);
+#endif
+
+	header_ = nullptr;
+	size_ = 0;
+}
+
+bool shared_frame_reader::newest(void const*& pixels, std::uint64_t& frame, std::uint64_t& sequence) const
+{
+	auto published = header_->published.load(std::memory_order_acquire);
+
+	if (published == 0)
+		return false;
+
+	auto const& slot = header_->slots[(published - 1) % kSharedFrameSlots];
+	sequence = slot.sequence.load(std::memory_order_acquire);
+
+	if (sequence % 2 != 0)
+		return false;
+
+	pixels = reinterpret_cast<char const*>(header_) + slot.offset;
+	frame = slot.frame;
+	return still_valid(frame, sequence);
+}
+
+bool shared_frame_reader::still_valid(std::uint64_t frame, std::uint64_t sequence) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	for (auto const& slot : header_->slots)
+	{
+		if (slot.sequence.load(std::memory_order_relaxed) == sequence && slot.frame == frame)
+			return true;
+	}
+
+	return false;
+}
+
+raw_image_file::~raw_image_file()
+{
+	close();
+}
+
+bool raw_image_file::create(std::string const& file, std::uint32_t width, std::uint32_t height, std::uint32_t format, std::uint32_t pixel_size)
+{
+	close();
+
+	auto offset = (sizeof(raw_image_header) + kRawImageAlignment - 1) / kRawImageAlignment * kRawImageAlignment;
+	auto frame_size = std::size_t(width) * height * pixel_size;
+	auto size = offset + frame_size;
+
+	void* handle = nullptr;
+	void* mapping = nullptr;
+	void* data = map_region(file, true, true, size, handle, mapping);
+
+	if (!data)
+		return false;
+
+	header_ = new (data) raw_image_header;
+	std::memcpy(header_->magic, kRawMagic, sizeof(header_->magic));
+	header_->version = kRawImageVersion;
+	header_->width = width;
+	header_->height = height;
+	header_->format = format;
+	header_->pixel_size = pixel_size;
+	header_->reserved = 0;
+	header_->offset = offset;
+	header_->size = frame_size;
+
+	size_ = size;
+	file_ = file;
+#ifdef _WIN32
+	file_handle_ = handle;
+	mapping_ = mapping;
+#endif
+	return true;
+}
+
+bool raw_image_file::flush()
+{
+	if (!header_)
+		return true;
+
+#ifdef _WIN32
+	bool flushed = FlushViewOfFile(header_, 0) != 0;
+#else
+	bool flushed = msync(header_, size_, MS_SYNC) == 0;
+#endif
+
+	if (!flushed)
+		std::cout << "Can't write " << file_ << "\n";
+
+	return flushed;
+}
+
+void raw_image_file::close()
+{
+	if (!header_)
+		return;
+
+	flush();
+
+#ifdef _WIN32
+	unmap_region(header_, size_, file_handle_, mapping_);
+	file_handle_ = mapping_ = nullptr;
+#else
+	unmap_region(header_, size_, nullptr, nullptr);
+#endif
+
+	header_ = nullptr;
+	size_ = 0;
+}
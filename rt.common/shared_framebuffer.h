@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Frames published through named shared memory, or a memory mapped file, for processes on the
+// same machine to map without a file encode and decode. The region starts with a
+// shared_frame_header, the pixels of kSharedFrameSlots frames follow at slots[s].offset. Frames
+// go to the slots in turn: the publisher makes the sequence of a slot odd, writes the pixels
+// and the frame number, makes the sequence even again and then counts the frame in published.
+// A reader takes the slot of frame published - 1, reads its sequence, uses the pixels in place
+// and checks that the sequence is still the same, else the slot was overwritten meanwhile.
+std::uint32_t const kSharedFrameVersion = 1;
+std::uint32_t const kSharedFrameSlots = 2;
+std::size_t const kSharedFrameAlignment = 64;
+
+struct shared_frame_slot
+{
+	std::atomic<std::uint64_t> sequence;
+	std::uint64_t frame;
+	std::uint64_t offset;
+};
+
+struct shared_frame_header
+{
+	// "RTFRAME" and a terminating zero
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t width, height;
+	// pixel_format of the renderer: 0 rgb float, 1 rgb half, 2 rgba8, 3 id16, 4 id32, 5 rgb
+	// float padded to 16 bytes
+	std::uint32_t format;
+	// Bytes per pixel and per frame, rows follow each other without padding
+	std::uint32_t pixel_size;
+	std::uint32_t num_slots;
+	std::uint64_t frame_size;
+	// Frames published so far, the newest is in slot (published - 1) % num_slots
+	std::atomic<std::uint64_t> published;
+	shared_frame_slot slots[kSharedFrameSlots];
+};
+
+// Publisher side of a shared frame region
+class shared_framebuffer
+{
+public:
+	shared_framebuffer() = default;
+	~shared_framebuffer();
+
+	shared_framebuffer(shared_framebuffer const&) = delete;
+	shared_framebuffer& operator=(shared_framebuffer const&) = delete;
+
+	// Create the region name, named shared memory, or the file name if is_file, for frames of
+	// width x height pixels of pixel_size bytes in format. Returns false with a message if it
+	// can't be created or mapped.
+	bool create(std::string const& name, bool is_file, std::uint32_t width, std::uint32_t height, std::uint32_t format, std::uint32_t pixel_size);
+	void close();
+
+	// Copy the size bytes of pixels into the next slot as frame
+	void publish(std::uint64_t frame, void const* pixels, std::size_t size);
+
+private:
+	shared_frame_header* header_ = nullptr;
+	std::size_t size_ = 0;
+	std::string name_;
+	bool is_file_ = false;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+// Reader side: maps a region created by shared_framebuffer in another process
+class shared_frame_reader
+{
+public:
+	shared_frame_reader() = default;
+	~shared_frame_reader();
+
+	shared_frame_reader(shared_frame_reader const&) = delete;
+	shared_frame_reader& operator=(shared_frame_reader const&) = delete;
+
+	// Map the region name, or the file name if is_file. Returns false with a message if it
+	// doesn't exist or is not a version kSharedFrameVersion region.
+	bool open(std::string const& name, bool is_file);
+	void close();
+
+	shared_frame_header const& header() const
+	{
+		return *header_;
+	}
+
+	// The newest frame: its pixels in the mapping, its number and the sequence to pass to
+	// still_valid(). Returns false if no frame was published yet or the newest one is being
+	// written.
+	bool newest(void const*& pixels, std::uint64_t& frame, std::uint64_t& sequence) const;
+
+	// True if the pixels of frame newest() returned with sequence were not overwritten since
+	bool still_valid(std::uint64_t frame, std::uint64_t sequence) const;
+
+private:
+	shared_frame_header* header_ = nullptr;
+	std::size_t size_ = 0;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+// A single frame file for consumers that read the pixels as they are: a raw_image_header,
+// then the rows of the frame packed at offset, which is page aligned. The renderer creates the
+// file at its full size, maps it and reads the frame back into the mapping, so there is no
+// copy through a framebuffer or encoder and the file is complete once the frame is.
+std::uint32_t const kRawImageVersion = 1;
+std::size_t const kRawImageAlignment = 4096;
+
+struct raw_image_header
+{
+	// "RTRAW" and terminating zeros
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t width, height;
+	// pixel_format, as in shared_frame_header
+	std::uint32_t format;
+	std::uint32_t pixel_size;
+	// zero, aligns offset
+	std::uint32_t reserved;
+	// Bytes from the start of the file to the pixels and of the pixels
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+// Writer of a raw image file, the mapping stays open until close()
+class raw_image_file
+{
+public:
+	raw_image_file() = default;
+	~raw_image_file();
+
+	raw_image_file(raw_image_file const&) = delete;
+	raw_image_file& operator=(raw_image_file const&) = delete;
+
+	// Create file for a frame of width x height pixels of pixel_size bytes in format and map
+	// it. Returns false with a message if it can't be created or mapped.
+	bool create(std::string const& file, std::uint32_t width, std::uint32_t height, std::uint32_t format, std::uint32_t pixel_size);
+
+	// Write the mapped pages to the file. Returns false with a message if that fails.
+	bool flush();
+
+	// Flush and unmap the file
+	void close();
+
+	// The frame in the mapping, null if no file is open
+	unsigned char* pixels() const
+	{
+		return header_ ? reinterpret_cast<unsigned char*>(header_) + header_->offset : nullptr;
+	}
+
+private:
+	raw_image_header* header_ = nullptr;
+	std::size_t size_ = 0;
+	std::string file_;
+#ifdef _WIN32
+	void* file_handle_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
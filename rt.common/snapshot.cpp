@@ -0,0 +1,157 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "scene_file.h"
+
+namespace
+{
+	char const kSnapshotMagic[8] = "RTSNAP";
+
+	// Pad bytes with zeros to the next kSceneAlignment boundary and return where that is
+	std::uint64_t align_end(std::string& bytes)
+	{
+		bytes.resize((bytes.size() + kSceneAlignment - 1) / kSceneAlignment * kSceneAlignment, '\0');
+		return bytes.size();
+	}
+
+	template <typename T>
+	void append(std::string& bytes, T const& value)
+	{
+		bytes.append(reinterpret_cast<char const*>(&value), sizeof(value));
+	}
+}
+
+std::string const* snapshot_state::setting(std::string const& name) const
+{
+	for (auto const& entry : settings)
+	{
+		if (entry.first == name)
+			return &entry.second;
+	}
+
+	return nullptr;
+}
+
+bool write_snapshot(std::string const& file, sphere_soa const& spheres, bvh const* accel, float ray_origin_z, snapshot_state const& state)
+{
+	auto bytes = scene_file_bytes(spheres, accel, ray_origin_z);
+
+	snapshot_trailer trailer = {};
+	std::memcpy(trailer.magic, kSnapshotMagic, sizeof(trailer.magic));
+	trailer.version = kSnapshotVersion;
+	trailer.num_blobs = static_cast<std::uint32_t>(state.blobs.size());
+
+	trailer.settings_offset = align_end(bytes);
+
+	for (auto const& entry : state.settings)
+	{
+		bytes += entry.first + "\t" + entry.second + "\n";
+	}
+
+	trailer.settings_size = bytes.size() - trailer.settings_offset;
+
+	trailer.tuning_offset = align_end(bytes);
+	bytes += state.tuning;
+	trailer.tuning_size = state.tuning.size();
+
+	// the table first, the names and data after it in blob order
+	trailer.blobs_offset = align_end(bytes);
+	std::uint64_t next = trailer.blobs_offset + sizeof(snapshot_blob) * state.blobs.size();
+
+	for (auto const& blob : state.blobs)
+	{
+		snapshot_blob entry = { next, blob.first.size(), next + blob.first.size(), blob.second.size() };
+		append(bytes, entry);
+		next = entry.data_offset + entry.data_size;
+	}
+
+	for (auto const& blob : state.blobs)
+	{
+		bytes += blob.first;
+		bytes.append(blob.second.data(), blob.second.size());
+	}
+
+	append(bytes, trailer);
+
+	std::ofstream out(file, std::ios::binary);
+	out.write(bytes.data(), bytes.size());
+
+	if (!out)
+	{
+		std::cout << "Can't write the snapshot " << file << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool read_snapshot(std::string const& file, snapshot_state& state)
+{
+	scene_file mapped;
+
+	if (!mapped.open(file))
+		return false;
+
+	auto const* data = static_cast<char const*>(mapped.data());
+	auto size = static_cast<std::uint64_t>(mapped.file_size());
+
+	snapshot_trailer trailer = {};
+
+	if (size >= sizeof(trailer))
+		std::memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+
+	if (size < sizeof(trailer) || std::memcmp(trailer.magic, kSnapshotMagic, sizeof(trailer.magic)) != 0 || trailer.version != kSnapshotVersion)
+	{
+		std::cout << file << " holds no version " << kSnapshotVersion << " snapshot\n";
+		return false;
+	}
+
+	// every section must end before the trailer
+	auto end = size - sizeof(trailer);
+
+	auto inside = [&](std::uint64_t offset, std::uint64_t bytes)
+	{
+		return offset <= end && bytes <= end - offset;
+	};
+
+	bool valid = inside(trailer.settings_offset, trailer.settings_size) && inside(trailer.tuning_offset, trailer.tuning_size) &&
+	             inside(trailer.blobs_offset, sizeof(snapshot_blob) * std::uint64_t(trailer.num_blobs));
+
+	state = snapshot_state();
+
+	for (std::uint32_t b = 0; valid && b < trailer.num_blobs; ++b)
+	{
+		snapshot_blob blob;
+		std::memcpy(&blob, data + trailer.blobs_offset + sizeof(blob) * b, sizeof(blob));
+
+		valid = inside(blob.name_offset, blob.name_size) && inside(blob.data_offset, blob.data_size);
+
+		if (valid)
+			state.blobs.emplace_back(std::string(data + blob.name_offset, blob.name_size),
+			                         std::vector<char>(data + blob.data_offset, data + blob.data_offset + blob.data_size));
+	}
+
+	if (!valid)
+	{
+		std::cout << "The snapshot of " << file << " is truncated or damaged\n";
+		return false;
+	}
+
+	std::istringstream settings(std::string(data + trailer.settings_offset, trailer.settings_size));
+	std::string line;
+
+	while (std::getline(settings, line))
+	{
+		auto tab = line.find('\t');
+
+		if (tab != std::string::npos)
+			state.settings.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+	}
+
+	state.tuning.assign(data + trailer.tuning_offset, trailer.tuning_size);
+	return true;
+}
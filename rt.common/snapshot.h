@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bvh.h"
+#include "scene.h"
+
+// Snapshot of a run ready to render (--snapshot, --restore): a scene file (scene_file.h) of
+// the spheres and the BVH, followed by the state the rest of the setup arrived at, so a new
+// process maps one file instead of generating the scene, building the structure, tuning and
+// compiling. After the scene file come, each on a kSceneAlignment boundary:
+// * the settings, one line of name, a tab and value each
+// * the tuning of the devices, lines of tuning.txt (export_tuning in tuning_db.h)
+// * the blobs, a snapshot_blob table followed by their names and data: the program binaries
+//   by the names of their cache files (program_binary_name in program_cache.h)
+// and snapshot_trailer as the last bytes of the file. A snapshot is still a scene file, --scene
+// reads its spheres and BVH and leaves the rest.
+std::uint32_t const kSnapshotVersion = 1;
+
+struct snapshot_trailer
+{
+	// "RTSNAP" and terminating zeros
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t num_blobs;
+	std::uint64_t settings_offset, settings_size;
+	std::uint64_t tuning_offset, tuning_size;
+	std::uint64_t blobs_offset;
+};
+
+struct snapshot_blob
+{
+	std::uint64_t name_offset, name_size;
+	std::uint64_t data_offset, data_size;
+};
+
+// What a snapshot holds besides the scene
+struct snapshot_state
+{
+	// Names and values, without tabs or line breaks
+	std::vector<std::pair<std::string, std::string>> settings;
+	std::string tuning;
+	std::vector<std::pair<std::string, std::vector<char>>> blobs;
+
+	// Value of the setting name, null if there is none
+	std::string const* setting(std::string const& name) const;
+};
+
+// Write spheres, and accel built for rays starting at z = ray_origin_z unless it is null, as
+// write_scene_file does, and state after them to file. Returns false with a message if the file
+// can't be written.
+bool write_snapshot(std::string const& file, sphere_soa const& spheres, bvh const* accel, float ray_origin_z, snapshot_state const& state);
+
+// Map the snapshot file and read its state; the scene is left to scene_file. Returns false with
+// a message if file is no scene file or has no snapshot of kSnapshotVersion after its scene.
+bool read_snapshot(std::string const& file, snapshot_state& state);
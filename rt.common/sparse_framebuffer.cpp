@@ -0,0 +1,110 @@
+#include "sparse_framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "grid.h"
+
+sparse_framebuffer::sparse_framebuffer(render_scene const& scene, pixel_format format, std::uint32_t tile_size)
+	: view_(scene.view)
+	, format_(format)
+	, tile_size_(std::min(tile_size, kTileSize))
+{
+	tiles_x_ = (view_.image_width + tile_size_ - 1) / tile_size_;
+	tiles_y_ = (view_.image_height + tile_size_ - 1) / tile_size_;
+	tiles_ = covered_tiles(sphere_footprints(scene.spheres, view_), view_, tile_size_);
+
+	// covered_tiles goes row of tiles by row of tiles
+	row_start_.assign(tiles_y_ + 1, 0);
+
+	for (auto const& t : tiles_)
+	{
+		++row_start_[t.y0 / tile_size_ + 1];
+	}
+
+	for (std::uint32_t ty = 0; ty < tiles_y_; ++ty)
+	{
+		row_start_[ty + 1] += row_start_[ty];
+	}
+
+	pixels_.resize(block_size() * tiles_.size());
+
+	// the background of the tracers, as it is written in format
+	background_.resize(pixel_size(format_));
+
+	if (format_ == pixel_format::id16)
+	{
+		std::memcpy(&background_[0], &kNoSphere16, sizeof(kNoSphere16));
+	}
+	else if (format_ == pixel_format::id32)
+	{
+		std::memcpy(&background_[0], &kNoSphere32, sizeof(kNoSphere32));
+	}
+	else
+	{
+		float const background[3] = { 0.1f, 0.1f, 0.1f };
+		convert_rows(background, format_, 1, 0, 1, &background_[0]);
+	}
+}
+
+void sparse_framebuffer::render(tile_executor& pool, render_scene const& scene, simd_isa isa)
+{
+	auto pixel_bytes = pixel_size(format_);
+	std::vector<unsigned char> band(pixel_bytes * view_.image_width * tile_size_);
+
+	for (std::uint32_t ty = 0; ty < tiles_y_; ++ty)
+	{
+		auto first = row_start_[ty];
+		auto last = row_start_[ty + 1];
+
+		if (first == last)
+			continue;
+
+		std::vector<tile> row(tiles_.begin() + first, tiles_.begin() + last);
+
+		// render_tile addresses the pixels of an image, which starts y_begin rows above the band
+		auto y_begin = ty * tile_size_;
+		unsigned char* origin = &band[0] - std::size_t(y_begin) * view_.image_width * pixel_bytes;
+
+		pool.run(row, [&](tile const& t)
+		{
+			render_tile(scene, isa, format_, t, origin);
+		});
+
+		for (auto i = first; i < last; ++i)
+		{
+			auto const& t = tiles_[i];
+			auto row_bytes = pixel_bytes * (t.x1 - t.x0);
+
+			for (auto y = t.y0; y < t.y1; ++y)
+			{
+				std::memcpy(tile_pixels(i) + pixel_bytes * tile_size_ * (y - t.y0), &band[pixel_bytes * (std::size_t(y - y_begin) * view_.image_width + t.x0)],
+				            row_bytes);
+			}
+		}
+	}
+}
+
+void sparse_framebuffer::write(tiled_image_writer& writer) const
+{
+	for (std::uint32_t ty = 0; ty < tiles_y_; ++ty)
+	{
+		auto first = row_start_[ty];
+		auto last = row_start_[ty + 1];
+
+		std::vector<bool> stored(tiles_x_, false);
+		auto pixels = writer.take_buffer();
+		pixels.resize(block_size() * (last - first));
+
+		for (auto i = first; i < last; ++i)
+		{
+			stored[tiles_[i].x0 / tile_size_] = true;
+		}
+
+		std::copy(pixels_.begin() + block_size() * first, pixels_.begin() + block_size() * last, pixels.begin());
+
+		auto y_begin = ty * tile_size_;
+		auto y_end = std::min(y_begin + tile_size_, view_.image_height);
+		writer.write_sparse_band(y_begin, y_end, std::move(pixels), std::move(stored), background_, pixel_size(format_));
+	}
+}
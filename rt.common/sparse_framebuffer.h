@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "accel.h"
+#include "cpu_trace.h"
+#include "image_writer.h"
+#include "pixel_format.h"
+
+// Framebuffer of an image that is mostly background, for huge images of sparse scenes: it is
+// mapped in square tiles, and only the tiles the footprint of a sphere touches
+// (covered_tiles()) are traced and stored, each in a block of its own. The others are the
+// background every tracer writes where no sphere is hit, one pixel of the format, and take
+// no memory.
+class sparse_framebuffer
+{
+public:
+	// Map the image of scene.view in format and tiles of tile_size, at most kTileSize
+	sparse_framebuffer(render_scene const& scene, pixel_format format, std::uint32_t tile_size);
+
+	// Trace the stored tiles of the image of scene on pool, a row of tiles at a time through a
+	// band of image rows (render_tile() writes whole image rows), which gives their blocks
+	void render(tile_executor& pool, render_scene const& scene, simd_isa isa);
+
+	// Queue the image to writer, opened for the image with tiles of tile_size, a sparse band per
+	// row of tiles
+	void write(tiled_image_writer& writer) const;
+
+	// The stored tiles in scanline order
+	std::vector<tile> const& tiles() const
+	{
+		return tiles_;
+	}
+
+	// Bytes of the stored tiles, and of the image held whole
+	std::size_t stored_bytes() const
+	{
+		return pixels_.size();
+	}
+
+	std::size_t dense_bytes() const
+	{
+		return pixel_size(format_) * view_.image_width * view_.image_height;
+	}
+
+private:
+	// Pixels of stored tile i, tile_size rows of tile_size pixels
+	unsigned char* tile_pixels(std::size_t i)
+	{
+		return &pixels_[block_size() * i];
+	}
+
+	std::size_t block_size() const
+	{
+		return pixel_size(format_) * tile_size_ * tile_size_;
+	}
+
+	ortho_view view_;
+	pixel_format format_;
+	std::uint32_t tile_size_;
+	std::uint32_t tiles_x_, tiles_y_;
+	std::vector<tile> tiles_;
+	// First stored tile of every row of tiles and one past the last row
+	std::vector<std::size_t> row_start_;
+	std::vector<unsigned char> pixels_;
+	std::vector<unsigned char> background_;
+};
@@ -0,0 +1,71 @@
+#include "sphere_batches.h"
+
+#include <iostream>
+#include <utility>
+
+namespace
+{
+	// Floats of a sphere record
+	std::size_t const kRecordFloats = 7;
+}
+
+sphere_batch_reader::sphere_batch_reader(read_bytes read)
+	: read_(std::move(read))
+{
+}
+
+bool sphere_batch_reader::next(sphere_soa& batch)
+{
+	if (ended_)
+		return false;
+
+	std::uint32_t count = 0;
+
+	// the stream may end between batches instead of sending a count of 0
+	if (!read_(&count, sizeof(count)) || count == 0)
+	{
+		ended_ = true;
+		return false;
+	}
+
+	ended_ = true;
+
+	if (count > kMaxBatchSpheres)
+	{
+		std::cout << "Batch " << batches_ + 1 << " has " << count << " spheres, more than " << kMaxBatchSpheres << "\n";
+		failed_ = true;
+		return false;
+	}
+
+	records_.resize(kRecordFloats * count);
+
+	if (!read_(records_.data(), sizeof(float) * records_.size()))
+	{
+		std::cout << "The stream ended inside batch " << batches_ + 1 << " of " << count << " spheres\n";
+		failed_ = true;
+		return false;
+	}
+
+	batch.resize(count);
+
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		float const* r = &records_[kRecordFloats * i];
+		batch.set(i, r[0], r[1], r[2], r[3], r[4], r[5], r[6]);
+	}
+
+	ended_ = false;
+	++batches_;
+	spheres_ += count;
+	return true;
+}
+
+void append_spheres(sphere_soa& spheres, sphere_soa const& batch)
+{
+	spheres.cx.insert(spheres.cx.end(), batch.cx.begin(), batch.cx.end());
+	spheres.cy.insert(spheres.cy.end(), batch.cy.begin(), batch.cy.end());
+	spheres.cz.insert(spheres.cz.end(), batch.cz.begin(), batch.cz.end());
+	spheres.radius2.insert(spheres.radius2.end(), batch.radius2.begin(), batch.radius2.end());
+	spheres.radius.insert(spheres.radius.end(), batch.radius.begin(), batch.radius.end());
+	spheres.color.insert(spheres.color.end(), batch.color.begin(), batch.color.end());
+}
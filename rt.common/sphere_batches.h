@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "scene.h"
+
+// Spheres of a scene sent in batches through a pipe or a socket, as an upstream simulation
+// produces them. Every batch is a little endian std::uint32_t count followed by count records
+// of 7 floats: center x, y and z, radius and color r, g and b, the arguments of
+// sphere_soa::set. A count of 0, or the end of the stream between two batches, ends the scene.
+// The spheres of the scene are those of the batches in the order they arrived.
+std::uint32_t const kMaxBatchSpheres = 1U << 24;
+
+class sphere_batch_reader
+{
+public:
+	// Fill data with the next size bytes of the stream, false if it ended before
+	typedef std::function<bool(void* data, std::size_t size)> read_bytes;
+
+	explicit sphere_batch_reader(read_bytes read);
+
+	// Read the next batch into batch. Returns false once the scene has ended, or with a message
+	// if the stream ended inside a batch or its count is over kMaxBatchSpheres; failed() tells.
+	bool next(sphere_soa& batch);
+
+	bool failed() const
+	{
+		return failed_;
+	}
+
+	// Batches and spheres read so far
+	std::uint32_t batches() const
+	{
+		return batches_;
+	}
+
+	std::uint64_t spheres() const
+	{
+		return spheres_;
+	}
+
+private:
+	read_bytes read_;
+	std::vector<float> records_;
+	bool ended_ = false;
+	bool failed_ = false;
+	std::uint32_t batches_ = 0;
+	std::uint64_t spheres_ = 0;
+};
+
+// Append the spheres of batch to spheres
+void append_spheres(sphere_soa& spheres, sphere_soa const& batch);
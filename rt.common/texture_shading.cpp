@@ -0,0 +1,215 @@
+#include "texture_shading.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+#include "pixel_format.h"
+
+namespace
+{
+	// Textured hits a worker shades in one go, all of one texture
+	std::uint32_t const kShadeChunk = 1024;
+
+	// Tile side of files that aren't tiled, see texture_shader
+	int const kAutoTile = 64;
+
+	float const kPi = 3.14159265358979f;
+
+	// Longitude s and latitude t in [0, 1] of the point of sphere k the orthographic ray of
+	// pixel (x, y) of view hits first, pixel coordinates off the sphere taken to its rim;
+	// s = 0.5 faces the view and t = 0 is the top
+	void sphere_st(sphere_soa const& spheres, std::uint32_t k, ortho_view const& view, float x, float y, float& s, float& t)
+	{
+		float dx = view.left + (view.width / view.image_width) * (x + 0.5f) - spheres.cx[k];
+		float dy = view.bottom + (view.height / view.image_height) * (y + 0.5f) - spheres.cy[k];
+		float r = spheres.radius[k];
+		float h = std::sqrt(std::max(spheres.radius2[k] - dx * dx - dy * dy, 0.f));
+
+		// a ray starting inside the sphere hits its far side
+		float dz = spheres.cz[k] - h < view.near ? h : -h;
+
+		s = 0.5f + std::atan2(dx / r, -dz / r) / (2.f * kPi);
+		t = 0.5f - std::asin(std::min(std::max(dy / r, -1.f), 1.f)) / kPi;
+	}
+
+	// Difference of longitudes the short way round
+	float wrapped(float d)
+	{
+		return d - std::floor(d + 0.5f);
+	}
+}
+
+bool read_texture_file(std::string const& file, std::uint32_t num_spheres, sphere_textures& textures)
+{
+	std::ifstream in(file);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << file << "\n";
+		return false;
+	}
+
+	textures = sphere_textures();
+	textures.texture.assign(num_spheres, kNoTexture);
+
+	std::string line;
+
+	for (auto number = 1; std::getline(in, line); ++number)
+	{
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string range;
+		std::string path;
+
+		if (!(words >> range))
+			continue;
+
+		unsigned long first = 0;
+		unsigned long last = 0;
+		char dash = 0;
+		std::istringstream bounds(range);
+		bool parsed = static_cast<bool>(bounds >> first);
+
+		if (parsed && bounds >> dash)
+			parsed = dash == '-' && bounds >> last && bounds.eof() && first <= last;
+		else
+			last = first;
+
+		if (!parsed || !(words >> path))
+		{
+			std::cout << file << ":" << number << ": expected first[-last] path\n";
+			return false;
+		}
+
+		if (last >= num_spheres)
+		{
+			std::cout << file << ":" << number << ": sphere " << last << " is past the " << num_spheres << " spheres of the scene\n";
+			return false;
+		}
+
+		auto found = std::find(textures.files.begin(), textures.files.end(), path);
+		auto index = static_cast<std::uint32_t>(found - textures.files.begin());
+
+		if (found == textures.files.end())
+			textures.files.push_back(path);
+
+		std::fill(textures.texture.begin() + first, textures.texture.begin() + last + 1, index);
+	}
+
+	return true;
+}
+
+texture_shader::texture_shader(float cache_mb)
+	: system_(OIIO_NAMESPACE::TextureSystem::create(false))
+{
+	system_->attribute("max_memory_MB", cache_mb);
+	system_->attribute("autotile", kAutoTile);
+	system_->attribute("automip", 1);
+}
+
+texture_shader::~texture_shader()
+{
+	OIIO_NAMESPACE::TextureSystem::destroy(system_);
+}
+
+bool texture_shader::shade(tile_executor& pool, sphere_soa const& spheres, sphere_textures const& textures, ortho_view const& view, std::uint32_t const* ids,
+                           float* img, std::string& error)
+{
+	std::size_t num_pixels = std::size_t(view.image_width) * view.image_height;
+
+	resolve_ids(reinterpret_cast<unsigned char const*>(ids), pixel_format::id32, num_pixels, spheres.color.data(), img);
+
+	// the textured pixels grouped by texture, each group in scanline order
+	std::vector<std::uint32_t> starts(textures.files.size() + 1, 0);
+
+	for (std::size_t p = 0; p < num_pixels; ++p)
+	{
+		if (ids[p] != kNoSphere32 && textures.texture[ids[p]] != kNoTexture)
+			++starts[textures.texture[ids[p]] + 1];
+	}
+
+	std::partial_sum(starts.begin(), starts.end(), starts.begin());
+
+	std::vector<std::uint32_t> pixels(starts.back());
+	auto next = starts;
+
+	for (std::size_t p = 0; p < num_pixels; ++p)
+	{
+		if (ids[p] != kNoSphere32 && textures.texture[ids[p]] != kNoTexture)
+			pixels[next[textures.texture[ids[p]]]++] = static_cast<std::uint32_t>(p);
+	}
+
+	// chunks of one texture each, in texture order, taken by the workers as they get free
+	struct shade_chunk
+	{
+		std::uint32_t texture;
+		std::uint32_t begin, end;
+	};
+
+	std::vector<shade_chunk> chunks;
+
+	for (std::uint32_t tex = 0; tex < textures.files.size(); ++tex)
+	{
+		for (auto begin = starts[tex]; begin < starts[tex + 1]; begin += kShadeChunk)
+		{
+			chunks.push_back(shade_chunk{ tex, begin, std::min(begin + kShadeChunk, starts[tex + 1]) });
+		}
+	}
+
+	std::atomic<std::size_t> taken(0);
+	std::atomic<bool> failed(false);
+
+	pool.run_each([&](std::uint32_t)
+	{
+		auto* thread_info = system_->get_perthread_info();
+
+		for (auto c = taken++; c < chunks.size(); c = taken++)
+		{
+			auto const& chunk = chunks[c];
+			auto* handle = system_->get_texture_handle(OIIO_NAMESPACE::ustring(textures.files[chunk.texture]), thread_info);
+
+			OIIO_NAMESPACE::TextureOpt options;
+			options.nchannels = 3;
+			options.swrap = OIIO_NAMESPACE::TextureOpt::WrapPeriodic;
+			options.twrap = OIIO_NAMESPACE::TextureOpt::WrapClamp;
+
+			for (auto n = chunk.begin; n < chunk.end; ++n)
+			{
+				auto p = pixels[n];
+				auto k = ids[p];
+				float x = static_cast<float>(p % view.image_width);
+				float y = static_cast<float>(p / view.image_width);
+
+				// the footprint of the pixel in texture space picks the MIP level
+				float s, t, sx, tx, sy, ty;
+				sphere_st(spheres, k, view, x, y, s, t);
+				sphere_st(spheres, k, view, x + 1.f, y, sx, tx);
+				sphere_st(spheres, k, view, x, y + 1.f, sy, ty);
+
+				float texel[3];
+
+				if (handle == nullptr || !system_->texture(handle, thread_info, options, s, t, wrapped(sx - s), tx - t, wrapped(sy - s), ty - t, texel))
+				{
+					// the first failure of the frame keeps its message, the hits of the texture keep their color
+					if (!failed.exchange(true))
+						error = textures.files[chunk.texture] + ": " + system_->geterror();
+
+					break;
+				}
+
+				std::copy(texel, texel + 3, img + std::size_t(p) * 3);
+			}
+		}
+	});
+
+	return !failed;
+}
+
+std::string texture_shader::stats() const
+{
+	return system_->getstats(1, true);
+}
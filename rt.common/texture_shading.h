@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <OpenImageIO/texture.h>
+
+#include "grid.h"
+#include "scene.h"
+#include "tile_executor.h"
+
+// Texture of every sphere: files lists the texture files once each, sphere k is mapped with
+// files[texture[k]] or keeps its color if texture[k] is kNoTexture
+struct sphere_textures
+{
+	std::vector<std::string> files;
+	std::vector<std::uint32_t> texture;
+};
+
+std::uint32_t const kNoTexture = 0xFFFFFFFFU;
+
+// Read a texture file of num_spheres spheres, one mapping per line, '#' starts a comment:
+//     first path            maps sphere first with the image at path
+//     first-last path       maps spheres first to last, both included
+// A later line overrides an earlier one. Returns false with a message for a malformed line or
+// a sphere past num_spheres.
+bool read_texture_file(std::string const& file, std::uint32_t num_spheres, sphere_textures& textures);
+
+// Deferred texturing of the CPU tracers: the frame is traced into the closest sphere index of
+// every pixel (pixel_format::id32), then shade() looks the textured hits up through an OIIO
+// TextureSystem. Its tile cache keeps at most cache_mb of texels whatever the number and
+// size of the textures: files that aren't tiled are read in 64 x 64 tiles and get MIP levels
+// made on the fly, so a lookup reads only the tiles of the level its footprint needs.
+class texture_shader
+{
+public:
+	explicit texture_shader(float cache_mb);
+	~texture_shader();
+
+	texture_shader(texture_shader const&) = delete;
+	texture_shader& operator=(texture_shader const&) = delete;
+
+	// Color the image img, rgb floats, of view from the id32 image ids of spheres: textured
+	// hits get the filtered texel at their longitude and latitude, the other pixels the color
+	// of their sphere or the background as resolve_ids() does. The hits are batched by texture
+	// and run on the workers of pool texture after texture, in scanline order within one, so
+	// the workers share the tiles they read. Returns false with the message of the texture
+	// system if a texture can't be read; its hits keep the color of their sphere.
+	bool shade(tile_executor& pool, sphere_soa const& spheres, sphere_textures const& textures, ortho_view const& view, std::uint32_t const* ids,
+	           float* img, std::string& error);
+
+	// Statistics of the texture system and its cache, several lines
+	std::string stats() const;
+
+private:
+	OIIO_NAMESPACE::TextureSystem* system_;
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "numa.h"
+#include "tile_executor.h"
+#include "timeline.h"
+#include "work_deque.h"
+
+// Fixed set of worker threads executing a function over a list of tiles.
+// Every worker owns a work_deque seeded with a contiguous run of tiles: it takes
+// tiles from the front of its own run and, once that is empty, steals
+// from the back of the other runs, so uneven tiles don't leave threads idle.
+// Taking and stealing tiles is lock-free, so small tiles on many threads don't
+// queue up on a lock.
+// Given a NUMA topology, the workers are split into one contiguous run per node and pinned
+// to it, so the contiguous runs of tiles of a node's workers form one band of the image, and
+// a worker steals from workers of its own node before it crosses to another one. A topology
+// of processor_topology() pins every worker to a processor of its own. The constructor
+// returns once every worker is pinned, so no tile is ever traced from the wrong processor.
+// With the timeline enabled (timeline.h) every tile is a range on its worker's row.
+class thread_pool : public tile_executor
+{
+public:
+	explicit thread_pool(std::uint32_t num_threads, numa_topology const& topology = numa_topology())
+		: topology_(topology)
+	{
+		num_threads = std::max(num_threads, 1U);
+
+		for (auto i = 0U; i < num_threads; ++i)
+		{
+			queues_.emplace_back(new work_deque<tile>);
+			worker_nodes_.push_back(topology_.num_nodes() > 1 ? i * topology_.num_nodes() / num_threads : 0U);
+		}
+
+		for (auto i = 0U; i < num_threads; ++i)
+		{
+			threads_.emplace_back(&thread_pool::worker_main, this, i);
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_cv_.wait(lock, [this] { return started_ == worker_nodes_.size(); });
+	}
+
+	~thread_pool() override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+
+		start_cv_.notify_all();
+
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	thread_pool(thread_pool const&) = delete;
+	thread_pool& operator=(thread_pool const&) = delete;
+
+	std::uint32_t size() const override
+	{
+		return static_cast<std::uint32_t>(threads_.size());
+	}
+
+	// NUMA nodes the workers are spread over, 1 without a topology
+	std::uint32_t num_nodes() const override
+	{
+		return std::max(topology_.num_nodes(), 1U);
+	}
+
+	// Node worker runs on
+	std::uint32_t node_of(std::uint32_t worker) const override
+	{
+		return worker_nodes_[worker];
+	}
+
+	// Whether the OS took the affinity of every worker, true without a topology
+	bool pinned() const
+	{
+		return pinned_;
+	}
+
+	void run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn) override
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		auto num_queues = queues_.size();
+
+		// the workers are waiting for the next generation, the deques are theirs once it starts
+		for (auto i = 0U; i < num_queues; ++i)
+		{
+			queues_[i]->assign(tiles.begin() + tiles.size() * i / num_queues,
+			                   tiles.begin() + tiles.size() * (i + 1) / num_queues);
+		}
+
+		job_ = &fn;
+		busy_ = size();
+		++generation_;
+
+		start_cv_.notify_all();
+		done_cv_.wait(lock, [this] { return busy_ == 0; });
+
+		job_ = nullptr;
+	}
+
+	// Runs the calls on all workers at once
+	void run_each(std::function<void(std::uint32_t)> const& fn) override
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		each_job_ = &fn;
+		busy_ = size();
+		++generation_;
+
+		start_cv_.notify_all();
+		done_cv_.wait(lock, [this] { return busy_ == 0; });
+
+		each_job_ = nullptr;
+	}
+
+private:
+	// Take the next tile of worker id, stealing from other workers if its own queue is empty,
+	// the ones of its node first. Returns false once all queues are drained.
+	bool next_tile(std::uint32_t id, tile& t)
+	{
+		if (queues_[id]->pop(t))
+			return true;
+
+		for (auto local : { true, false })
+		{
+			for (auto i = 1U; i < size(); ++i)
+			{
+				auto victim_id = (id + i) % size();
+
+				if ((worker_nodes_[victim_id] == worker_nodes_[id]) != local)
+					continue;
+
+				// a steal that lost the race for a tile tries again while the victim has some left
+				auto& victim = *queues_[victim_id];
+
+				while (!victim.empty())
+				{
+					if (victim.steal(t))
+						return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	void worker_main(std::uint32_t id)
+	{
+		std::uint64_t seen_generation = 0;
+
+		name_timeline_thread("worker " + std::to_string(id));
+
+		bool pinned = topology_.num_nodes() == 0 || pin_thread_to_node(topology_, worker_nodes_[id]);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pinned_ = pinned_ && pinned;
+
+			// threads_ is still growing, worker_nodes_ is complete
+			if (++started_ == worker_nodes_.size())
+				done_cv_.notify_one();
+		}
+
+		for (;;)
+		{
+			std::function<void(tile const&, std::uint32_t)> const* job = nullptr;
+			std::function<void(std::uint32_t)> const* each_job = nullptr;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				start_cv_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+
+				if (stop_)
+					return;
+
+				seen_generation = generation_;
+				job = job_;
+				each_job = each_job_;
+			}
+
+			if (each_job)
+			{
+				(*each_job)(id);
+			}
+			else
+			{
+				bool timeline = timeline_enabled();
+
+				tile t;
+				while (next_tile(id, t))
+				{
+					double start = timeline ? timeline_now() : 0.0;
+
+					(*job)(t, id);
+
+					if (timeline)
+						timeline_span("tile " + std::to_string(t.x0) + "," + std::to_string(t.y0), start, timeline_now() - start);
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (--busy_ == 0)
+					done_cv_.notify_one();
+			}
+		}
+	}
+
+	numa_topology topology_;
+	std::vector<std::uint32_t> worker_nodes_;
+	std::vector<std::unique_ptr<work_deque<tile>>> queues_;
+	std::vector<std::thread> threads_;
+
+	std::mutex mutex_;
+	std::condition_variable start_cv_;
+	std::condition_variable done_cv_;
+	std::function<void(tile const&, std::uint32_t)> const* job_ = nullptr;
+	std::function<void(std::uint32_t)> const* each_job_ = nullptr;
+	std::uint64_t generation_ = 0;
+	std::uint32_t busy_ = 0;
+	std::uint32_t started_ = 0;
+	bool pinned_ = true;
+	bool stop_ = false;
+};
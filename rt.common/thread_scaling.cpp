@@ -0,0 +1,194 @@
+#include "thread_scaling.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "bench.h"
+#include "numa.h"
+
+namespace
+{
+	// Pool of num_threads workers placed as affinity says
+	std::unique_ptr<thread_pool> make_pool(std::uint32_t num_threads, thread_affinity affinity, numa_topology const& machine)
+	{
+		return std::unique_ptr<thread_pool>(new thread_pool(num_threads, affinity_topology(affinity, num_threads, machine)));
+	}
+}
+
+numa_topology affinity_topology(thread_affinity affinity, std::uint32_t num_threads, numa_topology const& machine)
+{
+	switch (affinity)
+	{
+	case thread_affinity::node: return machine;
+	case thread_affinity::compact: return processor_topology(machine, num_threads, processor_placement::compact);
+	case thread_affinity::scatter: return processor_topology(machine, num_threads, processor_placement::scatter);
+	case thread_affinity::physical: return processor_topology(machine, num_threads, processor_placement::physical);
+	default: return numa_topology();
+	}
+}
+
+char const* thread_affinity_name(thread_affinity affinity)
+{
+	switch (affinity)
+	{
+	case thread_affinity::node: return "node";
+	case thread_affinity::compact: return "compact";
+	case thread_affinity::scatter: return "scatter";
+	case thread_affinity::physical: return "physical";
+	default: return "none";
+	}
+}
+
+bool parse_thread_affinities(char const* names, std::vector<thread_affinity>& affinities)
+{
+	std::vector<thread_affinity> parsed;
+
+	for (char const* name = names;; ++name)
+	{
+		auto length = std::strcspn(name, ",");
+		bool known = false;
+
+		for (auto candidate : { thread_affinity::none, thread_affinity::node, thread_affinity::compact, thread_affinity::scatter, thread_affinity::physical })
+		{
+			if (std::strlen(thread_affinity_name(candidate)) == length && std::strncmp(name, thread_affinity_name(candidate), length) == 0)
+			{
+				parsed.push_back(candidate);
+				known = true;
+			}
+		}
+
+		if (!known)
+			return false;
+
+		name += length;
+
+		if (*name == '\0')
+			break;
+	}
+
+	affinities = parsed;
+	return true;
+}
+
+bool parse_tile_sizes(char const* text, std::vector<std::uint32_t>& sizes)
+{
+	std::vector<std::uint32_t> parsed;
+
+	for (char const* pos = text;; ++pos)
+	{
+		char* end = nullptr;
+		auto size = std::strtoul(pos, &end, 10);
+
+		if (end == pos || size == 0 || size > kTileSize || (*end != ',' && *end != '\0'))
+			return false;
+
+		parsed.push_back(static_cast<std::uint32_t>(size));
+		pos = end;
+
+		if (*pos == '\0')
+			break;
+	}
+
+	sizes = parsed;
+	return true;
+}
+
+std::vector<std::uint32_t> thread_steps(std::uint32_t max_threads)
+{
+	std::vector<std::uint32_t> steps;
+
+	for (std::uint32_t threads = 1; threads < max_threads; threads *= 2)
+	{
+		steps.push_back(threads);
+	}
+
+	steps.push_back(std::max(max_threads, 1U));
+	return steps;
+}
+
+bool run_thread_sweep(std::string const& file, render_scene const& scene, simd_isa isa, pixel_format format, std::uint32_t max_threads,
+                      std::vector<std::uint32_t> const& tile_sizes, std::vector<thread_affinity> const& affinities, std::uint32_t warmup,
+                      std::uint32_t runs)
+{
+	std::ofstream csv(file);
+
+	if (!csv)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	csv << "affinity,tile_size,threads,median_us,speedup,efficiency,write_gb_per_s,min_tiles,max_tiles,tile_imbalance,tiles_per_thread\n";
+
+	auto machine = detect_numa_topology();
+
+	std::size_t frame_bytes = pixel_size(format) * scene.view.image_width * scene.view.image_height;
+	std::vector<unsigned char> frame(frame_bytes);
+
+	std::cout << "Thread scaling of the cpu backend (" << simd_isa_name(isa) << ", " << accel_mode_name(scene.mode) << ", "
+	          << pixel_format_name(format) << "), " << scene.view.image_width << "x" << scene.view.image_height << ", "
+	          << machine.num_nodes() << " NUMA nodes\n";
+
+	for (auto affinity : affinities)
+	{
+		for (auto tile_size : tile_sizes)
+		{
+			double serial_median = 0.0;
+
+			std::cout << thread_affinity_name(affinity) << " affinity, " << tile_size << "x" << tile_size << " tiles\n";
+
+			for (auto threads : thread_steps(max_threads))
+			{
+				auto pool = make_pool(threads, affinity, machine);
+				std::vector<std::uint32_t> worker_tiles(threads);
+
+				auto stats = run_bench([&]
+				{
+					std::fill(worker_tiles.begin(), worker_tiles.end(), 0U);
+					render_parallel(*pool, scene, isa, format, tile_size, &frame[0], &worker_tiles[0]);
+				}, warmup, runs);
+
+				if (threads == 1)
+					serial_median = stats.median;
+
+				double speedup = serial_median / stats.median;
+				double efficiency = speedup / threads;
+				double write_gbs = frame_bytes / (stats.median * 1e3);
+
+				auto fewest = *std::min_element(worker_tiles.begin(), worker_tiles.end());
+				auto most = *std::max_element(worker_tiles.begin(), worker_tiles.end());
+
+				double mean_tiles = 0.0;
+
+				for (auto tiles : worker_tiles)
+				{
+					mean_tiles += tiles;
+				}
+
+				mean_tiles /= threads;
+
+				double imbalance = mean_tiles > 0.0 ? most / mean_tiles : 1.0;
+
+				std::cout << "  " << threads << " threads: median " << stats.median << " us, speedup " << speedup << ", efficiency " << 100.0 * efficiency
+				          << "%, " << write_gbs << " GB/s written, tiles per thread " << fewest << " to " << most << " (max/mean " << imbalance << ")\n";
+
+				csv << thread_affinity_name(affinity) << ',' << tile_size << ',' << threads << ',' << stats.median << ',' << speedup << ',' << efficiency << ','
+				    << write_gbs << ',' << fewest << ',' << most << ',' << imbalance << ',';
+
+				for (std::size_t w = 0; w < worker_tiles.size(); ++w)
+				{
+					csv << (w != 0 ? ";" : "") << worker_tiles[w];
+				}
+
+				csv << "\n";
+				csv.flush();
+			}
+		}
+	}
+
+	return static_cast<bool>(csv);
+}
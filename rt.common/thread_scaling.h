@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cpu_trace.h"
+#include "pixel_format.h"
+#include "thread_pool.h"
+
+// Placement of the workers of the cpu backend and the thread scaling benchmark
+enum class thread_affinity
+{
+	// wherever the OS schedules them
+	none,
+	// pinned to the NUMA nodes as the cpu backend does by default, the same as none on a
+	// single node
+	node,
+	// one processor per worker, see processor_placement
+	compact,
+	scatter,
+	physical
+};
+
+char const* thread_affinity_name(thread_affinity affinity);
+
+// Topology a thread_pool of num_threads workers is given to place them as affinity says on
+// machine, the detect_numa_topology() of the machine
+numa_topology affinity_topology(thread_affinity affinity, std::uint32_t num_threads, numa_topology const& machine);
+
+// Parse a comma separated list of affinity names. Returns false for an unknown name and
+// leaves affinities untouched.
+bool parse_thread_affinities(char const* names, std::vector<thread_affinity>& affinities);
+
+// Parse a comma separated list of tile sides from 1 to kTileSize. Returns false for anything
+// else and leaves sizes untouched.
+bool parse_tile_sizes(char const* text, std::vector<std::uint32_t>& sizes);
+
+// Thread counts of the benchmark: the powers of two below max_threads, then max_threads
+std::vector<std::uint32_t> thread_steps(std::uint32_t max_threads);
+
+// Time warmup and runs frames of the cpu backend rendering scene into a framebuffer in format on
+// each count of thread_steps(max_threads), for every tile size and affinity. Prints and writes
+// to file as CSV, one line per step: the median frame, the speedup over 1 thread with the same
+// tiles and affinity, the parallel efficiency (speedup per thread), the framebuffer bytes
+// written per second, and the tiles each worker traced in the last frame with the fewest, the
+// most and the most over the mean. Workers stealing unevenly show up in the tile counts;
+// efficiency falling while the write rate stays flat over more threads points to memory
+// bandwidth. Returns false if file can't be written.
+bool run_thread_sweep(std::string const& file, render_scene const& scene, simd_isa isa, pixel_format format, std::uint32_t max_threads,
+                      std::vector<std::uint32_t> const& tile_sizes, std::vector<thread_affinity> const& affinities, std::uint32_t warmup,
+                      std::uint32_t runs);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Rectangle of pixels [x0, x1) x [y0, y1)
+struct tile
+{
+	std::uint32_t x0, y0;
+	std::uint32_t x1, y1;
+};
+
+// Parallel loop the CPU tracers run their tiles on. thread_pool is the built-in one,
+// parallel_executors.h has ones on the std::execution algorithms and on a TBB arena, and a
+// program embedding the renderer may pass one on its own scheduler, so the tracers share the
+// threads of the program instead of oversubscribing the machine.
+//
+// A worker is a slot in [0, size()) that runs one call at a time: per-worker state of the
+// callers, such as counters or scratch, is indexed by it without locking. Workers of several
+// NUMA nodes are numbered node by node.
+class tile_executor
+{
+public:
+	virtual ~tile_executor() = default;
+
+	// Number of workers, the bound of the worker argument of the calls
+	virtual std::uint32_t size() const = 0;
+
+	// NUMA nodes the workers are spread over
+	virtual std::uint32_t num_nodes() const
+	{
+		return 1U;
+	}
+
+	// Node worker runs on
+	virtual std::uint32_t node_of(std::uint32_t) const
+	{
+		return 0U;
+	}
+
+	// Call fn for every tile, with the worker processing it, and return once all of them have
+	// been processed. Tiles near the front of the list are started first.
+	virtual void run_with_worker(std::vector<tile> const& tiles, std::function<void(tile const&, std::uint32_t worker)> const& fn) = 0;
+
+	// Call fn(worker) once for every worker and return once all calls have finished. Lets the
+	// workers pull work from a source of their own; the calls may run one after the other, so
+	// they must not wait for each other.
+	virtual void run_each(std::function<void(std::uint32_t)> const& fn) = 0;
+
+	// Same as run_with_worker() without the worker
+	void run(std::vector<tile> const& tiles, std::function<void(tile const&)> const& fn)
+	{
+		run_with_worker(tiles, [&](tile const& t, std::uint32_t)
+		{
+			fn(t);
+		});
+	}
+};
@@ -0,0 +1,296 @@
+#include "tile_pyramid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#endif
+
+#include "grid.h"
+#include "pixel_format.h"
+
+namespace
+{
+	// Create the directory path unless it exists already
+	bool make_directory(std::string const& path)
+	{
+#ifdef _WIN32
+		bool made = CreateDirectoryA(path.c_str(), nullptr) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+		bool made = mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+
+		if (!made)
+			std::cout << "Can't create the directory " << path << "\n";
+
+		return made;
+	}
+
+	// path without its extension
+	std::string path_stem(std::string const& path)
+	{
+		auto dot = path.find_last_of('.');
+		auto slash = path.find_last_of("/\\");
+		return dot == std::string::npos || (slash != std::string::npos && dot < slash) ? path : path.substr(0, dot);
+	}
+
+	// The Deep Zoom descriptor of an image of width x height in tiles of options
+	bool write_descriptor(std::string const& path, std::uint32_t width, std::uint32_t height, pyramid_options const& options)
+	{
+		std::ofstream file(path, std::ios::binary);
+
+		file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		     << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"" << options.extension << "\" Overlap=\"0\" TileSize=\""
+		     << options.tile_size << "\">\n"
+		     << "  <Size Width=\"" << width << "\" Height=\"" << height << "\"/>\n"
+		     << "</Image>\n";
+
+		if (!file)
+			std::cout << "Can't write " << path << "\n";
+
+		return static_cast<bool>(file);
+	}
+}
+
+char const* pyramid_layout_name(pyramid_layout layout)
+{
+	switch (layout)
+	{
+	case pyramid_layout::dzi:
+		return "dzi";
+	case pyramid_layout::xyz:
+		return "xyz";
+	}
+
+	return "unknown";
+}
+
+bool parse_pyramid_layout(char const* name, pyramid_layout& layout)
+{
+	for (auto candidate : { pyramid_layout::dzi, pyramid_layout::xyz })
+	{
+		if (std::strcmp(name, pyramid_layout_name(candidate)) == 0)
+		{
+			layout = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool render_pyramid(tile_executor& pool, render_scene& scene, accel_mode mode, simd_isa isa, pyramid_options const& options, std::string const& path,
+                    pyramid_stats& stats)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	auto const full = scene.view;
+	auto const size = options.tile_size;
+
+	stats = {};
+
+	// level l is the full image halved max_level - l times, level 0 a single pixel
+	std::vector<std::uint32_t> widths(1, full.image_width), heights(1, full.image_height);
+
+	while (std::max(widths.back(), heights.back()) > 1)
+	{
+		widths.push_back((widths.back() + 1) / 2);
+		heights.push_back((heights.back() + 1) / 2);
+	}
+
+	std::reverse(widths.begin(), widths.end());
+	std::reverse(heights.begin(), heights.end());
+
+	auto max_level = static_cast<std::uint32_t>(widths.size() - 1);
+	stats.levels = max_level + 1;
+
+	std::string tiles_dir;
+	std::uint32_t first_level = 0;
+
+	if (options.layout == pyramid_layout::dzi)
+	{
+		tiles_dir = path_stem(path) + "_files";
+
+		if (!write_descriptor(path, full.image_width, full.image_height, options) || !make_directory(tiles_dir))
+			return false;
+	}
+	else
+	{
+		tiles_dir = path;
+
+		// zoom 0 is the largest level of a single tile
+		while (first_level < max_level && std::max(widths[first_level + 1], heights[first_level + 1]) <= size)
+		{
+			++first_level;
+		}
+
+		if (!make_directory(tiles_dir))
+			return false;
+	}
+
+	// small files, each encoded on the thread of its writer
+	auto encoding = options.encoding;
+	encoding.threads = 1;
+
+	std::vector<std::unique_ptr<image_writer>> writers;
+
+	for (std::size_t w = 0; w < kPyramidWriters; ++w)
+	{
+		writers.emplace_back(new image_writer(8, nullptr, encoding));
+	}
+
+	// the background of the tracers, as it is written in rgba8
+	unsigned char background[4];
+	float const background_rgb[3] = { 0.1f, 0.1f, 0.1f };
+	convert_rows(background_rgb, pixel_format::rgba8, 1, 0, 1, background);
+
+	// the structures of these modes don't depend on the window (prepare_scene)
+	bool window_free = (scene.mode == accel_mode::none || scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted) && scene.coverage.empty() &&
+	                   scene.tiny.indices.empty();
+
+	std::vector<unsigned char> band;
+	bool made = true;
+
+	for (auto level = first_level; made && level <= max_level; ++level)
+	{
+		auto width = widths[level];
+		auto height = heights[level];
+		auto scale = float(1U << (max_level - level));
+
+		// the pixels of the full image scaled from its left bottom corner, its own window at the full level
+		auto view = full;
+		view.image_width = width;
+		view.image_height = height;
+
+		if (level != max_level)
+		{
+			view.width = full.width / full.image_width * scale * width;
+			view.height = full.height / full.image_height * scale * height;
+		}
+
+		scene.view = view;
+
+		if (!window_free)
+		{
+			prepare_scene(scene, mode);
+			++stats.builds;
+		}
+
+		auto level_dir = tiles_dir + "/" + std::to_string(level - first_level);
+		auto tiles_x = (width + size - 1) / size;
+		auto tiles_y = (height + size - 1) / size;
+
+		made = make_directory(level_dir);
+
+		for (std::uint32_t tx = 0; made && options.layout == pyramid_layout::xyz && tx < tiles_x; ++tx)
+		{
+			made = make_directory(level_dir + "/" + std::to_string(tx));
+		}
+
+		if (!made)
+			break;
+
+		// the tracer tiles no sphere footprint touches are the background
+		auto covered = covered_tiles(sphere_footprints(scene.spheres, view), view, kTileSize);
+		auto subs_x = (width + kTileSize - 1) / kTileSize;
+		std::vector<bool> traced(std::size_t(subs_x) * (size / kTileSize));
+		std::size_t next = 0;
+
+		band.resize(std::size_t(4) * width * size);
+
+		for (std::uint32_t ty = 0; ty < tiles_y; ++ty)
+		{
+			auto y_begin = ty * size;
+			auto y_end = std::min(y_begin + size, height);
+
+			// covered_tiles goes row of tiles by row of tiles
+			std::vector<tile> band_tiles;
+			std::fill(traced.begin(), traced.end(), false);
+
+			for (; next < covered.size() && covered[next].y0 < y_end; ++next)
+			{
+				band_tiles.push_back(covered[next]);
+				traced[(covered[next].y0 - y_begin) / kTileSize * subs_x + covered[next].x0 / kTileSize] = true;
+			}
+
+			// render_tile addresses the pixels of an image, which starts y_begin rows above the band
+			unsigned char* origin = &band[0] - std::size_t(y_begin) * width * 4;
+			auto trace_start = std::chrono::high_resolution_clock::now();
+
+			pool.run(band_tiles, [&](tile const& t)
+			{
+				render_tile(scene, isa, pixel_format::rgba8, t, origin);
+			});
+
+			stats.trace_time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - trace_start).count();
+			stats.traced += band_tiles.size();
+
+			for (std::uint32_t tx = 0; tx < tiles_x; ++tx)
+			{
+				auto x_begin = tx * size;
+				auto x_end = std::min(x_begin + size, width);
+
+				// xyz tiles are whole, the part past the image is the background
+				auto tile_width = options.layout == pyramid_layout::xyz ? size : x_end - x_begin;
+				auto tile_height = options.layout == pyramid_layout::xyz ? size : y_end - y_begin;
+
+				std::vector<unsigned char> pixels(std::size_t(4) * tile_width * tile_height);
+				bool empty = true;
+
+				for (std::size_t p = 0; p < pixels.size(); p += 4)
+				{
+					std::memcpy(&pixels[p], background, 4);
+				}
+
+				for (auto y0 = y_begin; y0 < y_end; y0 += kTileSize)
+				{
+					for (auto x0 = x_begin; x0 < x_end; x0 += kTileSize)
+					{
+						if (!traced[(y0 - y_begin) / kTileSize * subs_x + x0 / kTileSize])
+							continue;
+
+						empty = false;
+						auto row_bytes = std::size_t(4) * (std::min(x0 + kTileSize, x_end) - x0);
+
+						for (auto y = y0; y < std::min(y0 + kTileSize, y_end); ++y)
+						{
+							std::memcpy(&pixels[std::size_t(4) * ((y - y_begin) * tile_width + x0 - x_begin)], &band[std::size_t(4) * ((y - y_begin) * width + x0)],
+							            row_bytes);
+						}
+					}
+				}
+
+				auto file = options.layout == pyramid_layout::dzi ? level_dir + "/" + std::to_string(tx) + "_" + std::to_string(ty)
+				                                                  : level_dir + "/" + std::to_string(tx) + "/" + std::to_string(ty);
+
+				// the file gets the rgb, the stride skips the alpha
+				OIIO_NAMESPACE::ImageSpec spec(tile_width, tile_height, 3, OIIO_NAMESPACE::TypeDesc::UINT8);
+				writers[stats.tiles % writers.size()]->write(file + "." + options.extension, spec, std::move(pixels), 4);
+
+				stats.empty_tiles += empty ? 1 : 0;
+				++stats.tiles;
+			}
+		}
+	}
+
+	bool written = made;
+
+	for (auto& writer : writers)
+	{
+		written = writer->finish() && written;
+	}
+
+	scene.view = full;
+	stats.total_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return written;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "accel.h"
+#include "cpu_trace.h"
+#include "image_writer.h"
+
+// Tile edge of render_pyramid unless asked otherwise, the one of the common viewers
+std::uint32_t const kPyramidTileSize = 256;
+
+// Writers of render_pyramid encoding tiles at the same time
+std::size_t const kPyramidWriters = 4;
+
+// File trees render_pyramid writes
+enum class pyramid_layout
+{
+	// Deep Zoom: name.dzi describing the image and name_files/level/column_row.ext, level 0 of
+	// one pixel up to the full image, tiles clipped at the right and bottom edges
+	dzi,
+	// Slippy map: dir/z/x/y.ext, z 0 the largest level that fits in one tile, every tile of
+	// tile_size pixels, the ones past the edges filled with the background
+	xyz
+};
+
+char const* pyramid_layout_name(pyramid_layout layout);
+
+// Returns false for an unknown name and leaves layout untouched
+bool parse_pyramid_layout(char const* name, pyramid_layout& layout);
+
+struct pyramid_options
+{
+	pyramid_layout layout = pyramid_layout::dzi;
+	// A multiple of kTileSize
+	std::uint32_t tile_size = kPyramidTileSize;
+	// Extension, without the dot, of the tile files, which tells image_writer the format
+	std::string extension = "png";
+	image_encoding encoding;
+};
+
+struct pyramid_stats
+{
+	std::uint32_t levels;
+	// Tiles written, the ones of them no sphere touches, written as the background without
+	// tracing, and the kTileSize tiles the others traced
+	std::size_t tiles;
+	std::size_t empty_tiles;
+	std::size_t traced;
+	// Structures built for the levels after the one of scene, see render_pyramid
+	std::uint32_t builds;
+	// ms tracing and in the whole pyramid, the writes included
+	double trace_time;
+	double total_time;
+};
+
+// Render scene, as prepared by prepare_scene for mode through scene.view, as a zoomable tile
+// pyramid at path (the .dzi file or the xyz directory) in options.layout. Every level is traced
+// at its own resolution, not downsampled from the full image: level l below the full one has
+// the pixels of scene.view scaled by 2^l from its left bottom corner and the sizes halved l
+// times, rounded up, so its last column and row may reach past the window by less than one of
+// its pixels. The levels go from the coarsest to the full image, so a viewer finds the coarse
+// ones first, the .dzi file before any of them. The structures of none, bvh and sorted are built
+// for the depths alone and traced at every level, the others, and the coverage mask and tiny
+// spheres, are built again for each level. A level is traced a band of tile rows at a time on
+// pool, only the kTileSize tiles of the footprints of the spheres, the rest is the background,
+// and the tiles of the band are queued on kPyramidWriters writers while the next band traces.
+// scene.view is left as it was. Returns false with a message if a directory or file can't be
+// written.
+bool render_pyramid(tile_executor& pool, render_scene& scene, accel_mode mode, simd_isa isa, pyramid_options const& options, std::string const& path,
+                    pyramid_stats& stats);
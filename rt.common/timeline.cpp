@@ -0,0 +1,183 @@
+#include "timeline.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	// Process ids of the host threads and of the device tracks in the trace
+	std::uint32_t const kHostProcess = 1;
+	std::uint32_t const kDeviceProcess = 2;
+
+	struct timeline_event
+	{
+		// B begin, E end, X complete
+		char phase;
+		std::string name;
+		double start;
+		double duration;
+		std::uint32_t process;
+		std::uint32_t thread;
+	};
+
+	std::atomic<bool> enabled(false);
+	std::chrono::steady_clock::time_point origin;
+
+	std::mutex mutex;
+	std::vector<timeline_event> events;
+	std::map<std::uint32_t, std::string> thread_names;
+	std::map<std::string, std::uint32_t> device_tracks;
+
+	std::atomic<std::uint32_t> next_thread(1);
+
+	// Row of the calling thread, numbered in the order threads first touch the timeline
+	std::uint32_t this_thread()
+	{
+		thread_local std::uint32_t id = next_thread++;
+		return id;
+	}
+
+	void add(timeline_event event)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(std::move(event));
+	}
+
+	std::string quoted(std::string const& text)
+	{
+		std::string out = "\"";
+
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+				out += '\\';
+
+			out += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+		}
+
+		return out + "\"";
+	}
+
+	// Metadata event naming a process or thread
+	std::string name_event(char const* kind, std::uint32_t process, std::uint32_t thread, std::string const& name)
+	{
+		return "{\"ph\":\"M\",\"name\":\"" + std::string(kind) + "\",\"pid\":" + std::to_string(process) + ",\"tid\":" + std::to_string(thread) +
+		       ",\"args\":{\"name\":" + quoted(name) + "}}";
+	}
+}
+
+void enable_timeline()
+{
+	origin = std::chrono::steady_clock::now();
+	enabled = true;
+}
+
+bool timeline_enabled()
+{
+	return enabled;
+}
+
+double timeline_now()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void name_timeline_thread(std::string const& name)
+{
+	auto thread = this_thread();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	thread_names[thread] = name;
+}
+
+void timeline_begin(char const* name)
+{
+	if (enabled)
+		add(timeline_event{ 'B', name, timeline_now(), 0.0, kHostProcess, this_thread() });
+}
+
+void timeline_end()
+{
+	if (enabled)
+		add(timeline_event{ 'E', std::string(), timeline_now(), 0.0, kHostProcess, this_thread() });
+}
+
+void timeline_span(std::string const& name, double start, double duration)
+{
+	if (enabled)
+		add(timeline_event{ 'X', name, start, duration, kHostProcess, this_thread() });
+}
+
+void timeline_device_span(std::string const& track, std::string const& name, double start, double duration)
+{
+	if (!enabled)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto found = device_tracks.find(track);
+
+	if (found == device_tracks.end())
+		found = device_tracks.emplace(track, static_cast<std::uint32_t>(device_tracks.size()) + 1).first;
+
+	events.push_back(timeline_event{ 'X', name, start, duration, kDeviceProcess, found->second });
+}
+
+bool write_timeline(std::string const& file)
+{
+	std::ofstream out(file);
+
+	if (!out)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out << name_event("process_name", kHostProcess, 0, "host") << ",\n";
+	out << name_event("process_name", kDeviceProcess, 0, "OpenCL devices");
+
+	for (auto const& thread : thread_names)
+	{
+		out << ",\n" << name_event("thread_name", kHostProcess, thread.first, thread.second);
+	}
+
+	for (auto const& track : device_tracks)
+	{
+		out << ",\n" << name_event("thread_name", kDeviceProcess, track.second, track.first);
+	}
+
+	out.precision(3);
+	out << std::fixed;
+
+	for (auto const& event : events)
+	{
+		out << ",\n{\"ph\":\"" << event.phase << "\",\"pid\":" << event.process << ",\"tid\":" << event.thread << ",\"ts\":" << event.start;
+
+		if (event.phase == 'X')
+			out << ",\"dur\":" << event.duration;
+
+		if (event.phase != 'E')
+			out << ",\"name\":" << quoted(event.name);
+
+		out << "}";
+	}
+
+	out << "\n]}\n";
+
+	if (!out)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	return true;
+}
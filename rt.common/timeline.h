@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+// Timeline of the run in the Chrome trace event format, for --trace-out: the profile_push
+// ranges of every thread, the tiles of the thread pool workers and the commands of the
+// OpenCL devices, viewable in chrome://tracing or Perfetto. All times are microseconds of
+// the steady clock since enable_timeline(); device commands are moved onto it by their
+// caller. Nothing is recorded before enable_timeline(), which the program calls once before
+// it starts its threads. All functions may be called from any thread.
+
+void enable_timeline();
+bool timeline_enabled();
+
+// Microseconds since enable_timeline()
+double timeline_now();
+
+// Name the calling thread's row in the timeline, kept even if it is enabled later
+void name_timeline_thread(std::string const& name);
+
+// Open and close a nested range on the calling thread's row
+void timeline_begin(char const* name);
+void timeline_end();
+
+// Range from start to start + duration on the calling thread's row
+void timeline_span(std::string const& name, double start, double duration);
+
+// Range from start to start + duration on the row of the device track, one row per track name
+void timeline_device_span(std::string const& track, std::string const& name, double start, double duration);
+
+// Write everything recorded so far to file, returns false with a message if it can't
+bool write_timeline(std::string const& file);
@@ -0,0 +1,215 @@
+#include "tuning_db.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace
+{
+	char const* const kTuningFile = "tuning.txt";
+
+	struct tuning_entry
+	{
+		tuning_key key;
+		std::string name;
+		std::string value;
+	};
+
+	std::mutex mutex;
+	bool loaded = false;
+	std::vector<tuning_entry> entries;
+
+	// the fields are tab separated, the names of devices and drivers may hold any other character
+	std::string clean(std::string s)
+	{
+		s.erase(std::find(s.begin(), s.end(), '\0'), s.end());
+		std::replace(s.begin(), s.end(), '\t', ' ');
+		std::replace(s.begin(), s.end(), '\n', ' ');
+		return s;
+	}
+
+	tuning_key clean(tuning_key const& key)
+	{
+		return tuning_key{ clean(key.device), clean(key.driver), clean(key.kernel) };
+	}
+
+	bool same_key(tuning_key const& a, tuning_key const& b)
+	{
+		return a.device == b.device && a.driver == b.driver && a.kernel == b.kernel;
+	}
+
+	// the entry as a line of the file
+	void write_entry(std::ostream& out, tuning_entry const& entry)
+	{
+		out << entry.key.device << "\t" << entry.key.driver << "\t" << entry.key.kernel << "\t" << entry.name << "\t" << entry.value << "\n";
+	}
+
+	// the entries of the lines of in, appended to parsed
+	void read_entries(std::istream& in, std::vector<tuning_entry>& parsed)
+	{
+		std::string line;
+
+		while (std::getline(in, line))
+		{
+			std::istringstream fields_in(line);
+			std::vector<std::string> fields;
+			std::string field;
+
+			while (std::getline(fields_in, field, '\t'))
+			{
+				fields.push_back(field);
+			}
+
+			if (fields.size() == 5)
+				parsed.push_back(tuning_entry{ tuning_key{ fields[0], fields[1], fields[2] }, fields[3], fields[4] });
+		}
+	}
+
+	// read the file on the first call, under the lock
+	void load()
+	{
+		if (loaded)
+			return;
+
+		loaded = true;
+
+		std::ifstream file(kTuningFile);
+		read_entries(file, entries);
+	}
+
+	// write all entries, under the lock
+	bool save()
+	{
+		std::ofstream file(kTuningFile);
+
+		for (auto const& entry : entries)
+		{
+			write_entry(file, entry);
+		}
+
+		return static_cast<bool>(file);
+	}
+}
+
+std::vector<std::string> find_tuning(tuning_key const& key, std::string const& name)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	load();
+
+	auto cleaned = clean(key);
+	auto cleaned_name = clean(name);
+	std::vector<std::string> values;
+
+	for (auto const& entry : entries)
+	{
+		if (same_key(entry.key, cleaned) && entry.name == cleaned_name)
+			values.push_back(entry.value);
+	}
+
+	return values;
+}
+
+bool find_tuning(tuning_key const& key, std::string const& name, std::string& value)
+{
+	auto values = find_tuning(key, name);
+
+	if (values.empty())
+		return false;
+
+	value = values.back();
+	return true;
+}
+
+bool store_tuning(tuning_key const& key, std::string const& name, std::string const& value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	load();
+
+	auto cleaned = clean(key);
+	auto cleaned_name = clean(name);
+
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [&](tuning_entry const& entry)
+	{
+		return same_key(entry.key, cleaned) && entry.name == cleaned_name;
+	}), entries.end());
+
+	entries.push_back(tuning_entry{ cleaned, cleaned_name, clean(value) });
+	return save();
+}
+
+bool append_tuning(tuning_key const& key, std::string const& name, std::string const& value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	load();
+
+	entries.push_back(tuning_entry{ clean(key), clean(name), clean(value) });
+	return save();
+}
+
+std::size_t invalidate_tuning(std::string const& device, std::string const& driver)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	load();
+
+	auto cleaned_device = clean(device);
+	auto cleaned_driver = clean(driver);
+	auto size = entries.size();
+
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [&](tuning_entry const& entry)
+	{
+		return entry.key.device == cleaned_device && entry.key.driver != cleaned_driver;
+	}), entries.end());
+
+	auto dropped = size - entries.size();
+
+	if (dropped != 0)
+		save();
+
+	return dropped;
+}
+
+std::string export_tuning(tuning_key const& key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	load();
+
+	auto cleaned = clean(key);
+	std::ostringstream out;
+
+	for (auto const& entry : entries)
+	{
+		if (same_key(entry.key, cleaned))
+			write_entry(out, entry);
+	}
+
+	return out.str();
+}
+
+std::size_t import_tuning(std::string const& lines)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	load();
+
+	std::istringstream in(lines);
+	std::vector<tuning_entry> parsed;
+	read_entries(in, parsed);
+
+	std::size_t added = 0;
+
+	for (auto const& entry : parsed)
+	{
+		bool known = std::any_of(entries.begin(), entries.end(), [&](tuning_entry const& stored)
+		{
+			return same_key(stored.key, entry.key) && stored.name == entry.name && stored.value == entry.value;
+		});
+
+		if (!known)
+		{
+			entries.push_back(entry);
+			++added;
+		}
+	}
+
+	return added;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Settings the autotuners measured, kept across runs in tuning.txt in the working directory:
+// the work-group sizes of --tune, the fast math verdicts of --fast-math and the runs the planner
+// calibrates from. The file is read on the first call and written after every change, one line
+// per value: device, driver, kernel, setting name and value, separated by tabs. All functions
+// may be called from any thread.
+
+// What a setting was measured for: the device, its driver version and a hash of the kernel
+// source (see source_digest), empty for the settings of the CPU
+struct tuning_key
+{
+	std::string device;
+	std::string driver;
+	std::string kernel;
+};
+
+// Values of name stored for key, oldest first
+std::vector<std::string> find_tuning(tuning_key const& key, std::string const& name);
+
+// Latest value of name stored for key, returns false if there is none
+bool find_tuning(tuning_key const& key, std::string const& name, std::string& value);
+
+// Store value as the one value of name for key, returns false if the file can't be written
+bool store_tuning(tuning_key const& key, std::string const& name, std::string const& value);
+
+// Add value to the values of name for key, returns false if the file can't be written
+bool append_tuning(tuning_key const& key, std::string const& name, std::string const& value);
+
+// Drop the settings of device measured with another driver than driver and return how many
+// there were. open_device calls it for every device, so an updated driver is tuned again
+// instead of running with the settings of the old one.
+std::size_t invalidate_tuning(std::string const& device, std::string const& driver);
+
+// The settings stored for key as the lines of the file, for a snapshot (snapshot.h)
+std::string export_tuning(tuning_key const& key);
+
+// Take the settings of the lines of export_tuning that aren't stored yet for this run, without
+// writing them to the file; a later store writes them along. Returns how many were new.
+std::size_t import_tuning(std::string const& lines);
@@ -0,0 +1,180 @@
+#include "virtual_image.h"
+
+#include <algorithm>
+
+virtual_image::virtual_image(cpu_renderer& renderer, ortho_view const& view, accel_mode mode, std::size_t budget)
+	: renderer_(renderer), view_(view), mode_(mode), levels_(1), bin_budget_(budget / kVirtualImageBins)
+{
+	for (auto size = std::max(view.image_width, view.image_height); size > 1; size = (size + 1) / 2)
+	{
+		++levels_;
+	}
+}
+
+ortho_view virtual_image::level_view(std::uint32_t level) const
+{
+	auto view = view_;
+
+	for (std::uint32_t l = 0; l < level; ++l)
+	{
+		view.image_width = (view.image_width + 1) / 2;
+		view.image_height = (view.image_height + 1) / 2;
+	}
+
+	return view;
+}
+
+bool virtual_image::get_pixels(std::uint32_t level, render_roi const& region, framebuffer_view const& target)
+{
+	if (level >= levels_)
+		return false;
+
+	auto image = full_roi(level_view(level));
+
+	if (region.xend > image.xend || region.yend > image.yend)
+		return false;
+
+	for (auto y = region.ybegin / kVirtualTileSize * kVirtualTileSize; y < region.yend; y += kVirtualTileSize)
+	{
+		for (auto x = region.xbegin / kVirtualTileSize * kVirtualTileSize; x < region.xend; x += kVirtualTileSize)
+		{
+			auto pixels = get_tile(level, x, y);
+			auto rect = tile_rect(level, x, y);
+			render_roi common = { std::max(rect.xbegin, region.xbegin), std::min(rect.xend, region.xend), std::max(rect.ybegin, region.ybegin),
+			                      std::min(rect.yend, region.yend) };
+
+			copy_roi(pixels->data(), 3 * sizeof(float) * rect.width(), rect, target.pixels, target.row_bytes, region, common, 3 * sizeof(float));
+		}
+	}
+
+	return true;
+}
+
+virtual_tile virtual_image::get_tile(std::uint32_t level, std::uint32_t x, std::uint32_t y)
+{
+	if (level >= levels_)
+		return nullptr;
+
+	auto view = level_view(level);
+
+	if (x >= view.image_width || y >= view.image_height)
+		return nullptr;
+
+	auto key = tile_key(level, x / kVirtualTileSize, y / kVirtualTileSize);
+	auto pixels = find(key);
+
+	if (pixels)
+		return pixels;
+
+	std::lock_guard<std::mutex> lock(render_mutex_);
+
+	// another thread may have rendered it while this one waited
+	pixels = find(key);
+
+	if (pixels)
+		return pixels;
+
+	// the tile is a window of its own, at the pixel steps of its level
+	auto rect = tile_rect(level, x, y);
+	float step_x = view.width / view.image_width;
+	float step_y = view.height / view.image_height;
+	ortho_view window = { view.left + step_x * rect.xbegin, view.bottom + step_y * rect.ybegin, step_x * rect.width(), step_y * rect.height(), view.near, view.far,
+		                  rect.width(), rect.height() };
+
+	auto rendered = std::make_shared<std::vector<float>>(std::size_t(3) * rect.width() * rect.height());
+	renderer_.render(window, mode_, framebuffer_view{ rendered->data(), 3 * sizeof(float) * rect.width() });
+
+	++rendered_;
+	insert(key, rendered);
+	return rendered;
+}
+
+render_roi virtual_image::tile_rect(std::uint32_t level, std::uint32_t x, std::uint32_t y) const
+{
+	auto view = level_view(level);
+	auto x0 = x / kVirtualTileSize * kVirtualTileSize;
+	auto y0 = y / kVirtualTileSize * kVirtualTileSize;
+
+	return render_roi{ x0, std::min(x0 + kVirtualTileSize, view.image_width), y0, std::min(y0 + kVirtualTileSize, view.image_height) };
+}
+
+void virtual_image::invalidate()
+{
+	// a tile in flight is of the old scene, it goes too
+	std::lock_guard<std::mutex> rendering(render_mutex_);
+
+	for (auto& b : bins_)
+	{
+		std::lock_guard<std::mutex> lock(b.mutex);
+		b.tiles.clear();
+		b.lru.clear();
+		b.bytes = 0;
+	}
+}
+
+virtual_image_stats virtual_image::stats() const
+{
+	virtual_image_stats stats = { hits_, rendered_, evicted_, 0 };
+
+	for (auto& b : bins_)
+	{
+		std::lock_guard<std::mutex> lock(b.mutex);
+		stats.bytes += b.bytes;
+	}
+
+	return stats;
+}
+
+std::uint64_t virtual_image::tile_key(std::uint32_t level, std::uint32_t tx, std::uint32_t ty)
+{
+	// 2^32 pixels a side are at most 2^24 tiles
+	return (std::uint64_t(level) << 48) | (std::uint64_t(ty) << 24) | tx;
+}
+
+virtual_image::bin& virtual_image::bin_of(std::uint64_t key)
+{
+	// neighbouring tiles land in different bins
+	return bins_[(key ^ (key >> 24)) % kVirtualImageBins];
+}
+
+virtual_tile virtual_image::find(std::uint64_t key)
+{
+	auto& b = bin_of(key);
+	std::lock_guard<std::mutex> lock(b.mutex);
+	auto found = b.tiles.find(key);
+
+	if (found == b.tiles.end())
+		return nullptr;
+
+	b.lru.splice(b.lru.begin(), b.lru, found->second.lru);
+	++hits_;
+	return found->second.pixels;
+}
+
+void virtual_image::insert(std::uint64_t key, virtual_tile pixels)
+{
+	auto& b = bin_of(key);
+	auto size = pixels->size() * sizeof(float);
+
+	// a tile larger than the bin's share is handed out but not kept
+	if (size > bin_budget_)
+	{
+		++evicted_;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(b.mutex);
+
+	b.bytes += size;
+	b.lru.push_front(key);
+	b.tiles[key] = entry{ std::move(pixels), b.lru.begin() };
+
+	while (b.bytes > bin_budget_)
+	{
+		auto victim = b.tiles.find(b.lru.back());
+		b.bytes -= victim->second.pixels->size() * sizeof(float);
+		b.tiles.erase(victim);
+		b.lru.pop_back();
+		++evicted_;
+	}
+}
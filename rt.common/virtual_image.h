@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "accel.h"
+#include "renderer.h"
+#include "roi.h"
+
+// Edge of the tiles of virtual_image
+std::uint32_t const kVirtualTileSize = 256;
+
+// Bins of virtual_image, each with a lock of its own
+std::size_t const kVirtualImageBins = 16;
+
+// Counters of a virtual_image since it was opened
+struct virtual_image_stats
+{
+	// Tiles asked for that were in memory, and the ones rendered because they weren't
+	std::uint64_t hits;
+	std::uint64_t rendered;
+	// Tiles dropped to stay within the budget
+	std::uint64_t evicted;
+	// Bytes the tiles in memory take now
+	std::size_t bytes;
+};
+
+// Rgb float pixels of a tile of a virtual_image, packed rows of the pixels of its tile_rect
+typedef std::shared_ptr<std::vector<float> const> virtual_tile;
+
+// An image of any size, far larger than would fit in memory, whose tiles are rendered by a
+// cpu_renderer only when first asked for, after OIIO's ImageCache: a viewer reads the pixels
+// of the part it shows with get_pixels and pays for the tiles it touches, no more. Level l of
+// the MIP levels is the window of view at image sizes halved l times, rendered from the spheres
+// at that resolution, for zooming out. The tiles of kVirtualTileSize pixels are spread over
+// kVirtualImageBins bins by position, each with its own lock, map and least recently used
+// list as OIIO's unordered_map_concurrent, and each holds at most its share of budget bytes;
+// an evicted tile is rendered again when asked for. A tile renders as a window of its own on
+// all the workers of the renderer, which keeps the structures of modes none, bvh and sorted
+// across the windows; the other modes are built for every tile. Tiles wait for the one being
+// rendered, so each is rendered once. All members may be called from any thread.
+class virtual_image
+{
+public:
+	// view is the whole image at level 0, rendered by renderer with mode. renderer must
+	// outlive the virtual image and keep its scene, or have invalidate() called after a change.
+	virtual_image(cpu_renderer& renderer, ortho_view const& view, accel_mode mode, std::size_t budget);
+
+	virtual_image(virtual_image const&) = delete;
+	virtual_image& operator=(virtual_image const&) = delete;
+
+	// Image of level, for level 0 the view given, its sizes halved and rounded up level times
+	ortho_view level_view(std::uint32_t level) const;
+
+	// Levels down to an image of one pixel
+	std::uint32_t levels() const
+	{
+		return levels_;
+	}
+
+	// ImageCache::get_pixels: copy the pixels of region of level, rendering the tiles it
+	// touches that aren't in memory, into target, whose rows hold region alone. Returns false
+	// if level doesn't exist or region reaches outside its image.
+	bool get_pixels(std::uint32_t level, render_roi const& region, framebuffer_view const& target);
+
+	// ImageCache::get_tile: the tile of level at pixel x, y, rendered if it isn't in memory,
+	// null outside the image. The pixels stay valid as long as the handle, eviction only drops
+	// the image's reference. tile_rect gives the pixels it covers.
+	virtual_tile get_tile(std::uint32_t level, std::uint32_t x, std::uint32_t y);
+	render_roi tile_rect(std::uint32_t level, std::uint32_t x, std::uint32_t y) const;
+
+	// ImageCache::invalidate_all: drop every tile, for a scene that changed; tiles handed out
+	// keep their pixels
+	void invalidate();
+
+	virtual_image_stats stats() const;
+
+private:
+	struct entry
+	{
+		virtual_tile pixels;
+		std::list<std::uint64_t>::iterator lru;
+	};
+
+	struct bin
+	{
+		mutable std::mutex mutex;
+		std::unordered_map<std::uint64_t, entry> tiles;
+		// Keys from most to least recently used
+		std::list<std::uint64_t> lru;
+		std::size_t bytes = 0;
+	};
+
+	// Key of the tile of level at tile column tx and row ty
+	static std::uint64_t tile_key(std::uint32_t level, std::uint32_t tx, std::uint32_t ty);
+
+	bin& bin_of(std::uint64_t key);
+
+	// The tile of key from memory, marked most recently used, or null
+	virtual_tile find(std::uint64_t key);
+
+	void insert(std::uint64_t key, virtual_tile pixels);
+
+	cpu_renderer& renderer_;
+	ortho_view view_;
+	accel_mode mode_;
+	std::uint32_t levels_;
+	std::size_t bin_budget_;
+	bin bins_[kVirtualImageBins];
+	// Held while a tile renders, by the one thread rendering
+	std::mutex render_mutex_;
+	std::atomic<std::uint64_t> hits_{ 0 };
+	std::atomic<std::uint64_t> rendered_{ 0 };
+	std::atomic<std::uint64_t> evicted_{ 0 };
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Chase-Lev work-stealing deque of one worker: the owner takes items from the bottom, any
+// other thread steals from the top, and neither takes a lock. The items are set with assign()
+// while no thread takes any, e.g. before the workers of a run start; a run only removes them,
+// so the slots are never written while they can be read. assign() puts the first item at
+// the bottom: the owner takes the items in order and thieves take the last ones first.
+template <class T>
+class work_deque
+{
+public:
+	work_deque() = default;
+
+	work_deque(work_deque const&) = delete;
+	work_deque& operator=(work_deque const&) = delete;
+
+	// Replace the items with [first, last), first at the bottom
+	template <class It>
+	void assign(It first, It last)
+	{
+		items_.assign(first, last);
+		std::reverse(items_.begin(), items_.end());
+
+		top_.store(0, std::memory_order_relaxed);
+		bottom_.store(static_cast<std::int64_t>(items_.size()), std::memory_order_release);
+	}
+
+	// Take the bottom item, owner only. Returns false if the deque is empty.
+	bool pop(T& item)
+	{
+		auto b = bottom_.load(std::memory_order_relaxed) - 1;
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto t = top_.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		item = items_[static_cast<std::size_t>(b)];
+
+		if (t == b)
+		{
+			// the last item: a thief may be taking it too, the top decides
+			bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+
+		return true;
+	}
+
+	// Take the top item from another thread. Returns false if the deque is empty or another
+	// thread took the item first.
+	bool steal(T& item)
+	{
+		auto t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto b = bottom_.load(std::memory_order_acquire);
+
+		if (t >= b)
+			return false;
+
+		item = items_[static_cast<std::size_t>(t)];
+		return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	// True if no item is left; only a hint while the deque is in use
+	bool empty() const
+	{
+		return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+	}
+
+private:
+	// The top and bottom change with every take, padded onto cache lines of their own so the
+	// owner and the thieves don't share one
+	std::atomic<std::int64_t> top_{ 0 };
+	char top_pad_[64 - sizeof(std::atomic<std::int64_t>)];
+	std::atomic<std::int64_t> bottom_{ 0 };
+	char bottom_pad_[64 - sizeof(std::atomic<std::int64_t>)];
+	std::vector<T> items_;
+};
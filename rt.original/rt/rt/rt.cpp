@@ -11,186 +11,434 @@
 	the same output.
 */
 
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "oiio/include/OpenImageIO/imageio.h"
 
-struct ray
+#include "accel.h"
+#include "bench.h"
+#include "config.h"
+#include "cpu_trace.h"
+#include "image_compare.h"
+#include "image_writer.h"
+#include "pixel_format.h"
+#include "roi.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "thread_pool.h"
+
+int main(int argc, char** argv)
 {
-	// Origin
-	float ox, oy, oz;
-	// Direction
-	float dx, dy, dz;
-	// Intersection distance
-	float maxt;
-};
+	// --serial renders with the single-threaded reference trace(),
+	// --threads N overrides the number of worker threads,
+	// --isa scalar|sse4|avx2|avx512 caps the packet tracer instruction set,
+	// --accel bvh traces through a bounding volume hierarchy instead of testing every sphere,
+	// --accel grid tests only the spheres binned into the pixel's screen-space cell,
+	// --accel splat rasterizes sphere footprints into a depth buffer,
+	// --accel sorted tests spheres front to back and stops each ray at the first one behind its hit,
+	// --accel adaptive traces the corners of 8x8 blocks and fills the blocks only one sphere can cover,
+	// --hint starts every bvh and sorted ray with the sphere the pixel to its left hit,
+	// --camera eye_x,eye_y,eye_z,target_x,target_y,target_z,fov_y[,far] renders through a pinhole camera,
+	// --size WxH, --spheres N and --view left,bottom,width,height,near,far override config.h,
+	// --compare file checks result.png against a golden image, channels may differ by --tolerance X,
+	// --bench times --runs N renders after --warmup K untimed ones, --json file saves the statistics,
+	// --scene file renders the spheres of a binary scene file instead of generating them,
+	// --save-scene file writes the scene, and the BVH of --accel bvh, to one,
+	// --generator msvc|philox selects the random sequence generated scenes are drawn from,
+	// --progressive renders coarse to fine and writes every preview to preview.png as it is done,
+	// --roi WxH+X+Y renders only that region of the image, without the spheres outside it, and
+	// writes it to result.png with its place in the image as the data window,
+	// --deadline ms renders progressive passes until ms after the start, the later runs of --bench
+	// planned from the tile times of the run before, and marks the passes every tile finished in
+	// deadline.png, one pixel per tile,
+	// --balance splits the expensive tiles and merges the cheap ones into work items of equal
+	// cost, planned from the tile times of the frame before or the scene for the first one
+	bool serial = false;
+	accel_mode mode = accel_mode::none;
+	ortho_view view = default_view();
+	std::uint32_t num_spheres = kNumSpheres;
+	std::uint32_t num_threads = std::thread::hardware_concurrency();
+	simd_isa isa = detect_simd_isa();
+	std::string golden;
+	float tolerance = 0.f;
+	bool bench = false;
+	std::uint32_t warmup = 3;
+	std::uint32_t runs = 20;
+	std::string json;
+	std::string scene_path;
+	std::string save_scene;
+	scene_generator generator = scene_generator::msvc;
+	bool progressive = false;
+	bool neighbour_hint = false;
+	bool perspective = false;
+	pinhole_camera pinhole;
+	render_roi roi = {};
+	double deadline_ms = 0.;
+	bool balance = false;
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--serial") == 0)
+		{
+			serial = true;
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			num_threads = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+		{
+			++i;
+			simd_isa requested = simd_isa::scalar;
+			for (auto candidate : { simd_isa::sse4, simd_isa::avx2, simd_isa::avx512 })
+			{
+				if (std::strcmp(argv[i], simd_isa_name(candidate)) == 0)
+					requested = candidate;
+			}
+			isa = std::min(isa, requested);
+		}
+		else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc && parse_image_size(argv[i + 1], view))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--view") == 0 && i + 1 < argc && parse_view_window(argv[i + 1], view))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--spheres") == 0 && i + 1 < argc)
+		{
+			num_spheres = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+		{
+			golden = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+		{
+			tolerance = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--bench") == 0)
+		{
+			bench = true;
+		}
+		else if (std::strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+		{
+			warmup = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			runs = std::max(1U, static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+		}
+		else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			json = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+		{
+			scene_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--save-scene") == 0 && i + 1 < argc)
+		{
+			save_scene = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--progressive") == 0)
+		{
+			progressive = true;
+		}
+		else if (std::strcmp(argv[i], "--hint") == 0)
+		{
+			neighbour_hint = true;
+		}
+		else if (std::strcmp(argv[i], "--camera") == 0 && i + 1 < argc && parse_pinhole_camera(argv[i + 1], pinhole))
+		{
+			perspective = true;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--generator") == 0 && i + 1 < argc && parse_scene_generator(argv[i + 1], generator))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--roi") == 0 && i + 1 < argc && parse_roi(argv[i + 1], roi))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--deadline") == 0 && i + 1 < argc)
+		{
+			deadline_ms = std::max(0., std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--balance") == 0)
+		{
+			balance = true;
+		}
+		else if (!(std::strcmp(argv[i], "--accel") == 0 && i + 1 < argc && parse_accel_mode(argv[++i], mode)))
+		{
+			std::cout << "Usage: rt [--serial] [--threads N] [--isa scalar|sse4|avx2|avx512] [--accel none|bvh|grid|splat|sorted|adaptive]\n"
+			             "          [--hint] [--size WxH] [--spheres N] [--view left,bottom,width,height,near,far]\n"
+			             "          [--camera eye_x,eye_y,eye_z,target_x,target_y,target_z,fov_y[,far]]\n"
+			             "          [--compare file [--tolerance X]] [--bench [--warmup K] [--runs N] [--json file]]\n"
+			             "          [--scene file] [--save-scene file] [--generator msvc|philox] [--progressive] [--roi WxH+X+Y]\n"
+			             "          [--deadline ms] [--balance]\n";
+			return -1;
+		}
+	}
+
+	if (!roi.empty())
+	{
+		roi = clip_roi(roi, view);
 
+		if (roi.empty())
+		{
+			std::cout << "The region lies outside the image\n";
+			return -1;
+		}
 
-struct sphere
-{
-	// Center
-	float cx, cy, cz;
-	// Radius
-	float radius;
-	// Shpere color
-	float r, g, b;
-};
-
-// Output image dimensions
-std::uint32_t const kImageWidth = 2048;
-std::uint32_t const kImageHeight = 2048;
-// Number of spheres to render
-std::uint32_t const kNumSpheres = 512;
-
-#define RAND_FLOAT (((float)std::rand()) / RAND_MAX)
-#define LEFT -10.f
-#define BOTTOM -10.f
-#define WIDTH 20.f
-#define HEIGHT 20.f
-#define NEAR -10.f
-#define FAR 10.f
-
-// Randomly generate sphere array of num_spheres items
-void generate_spheres(sphere* spheres, std::uint32_t num_spheres)
-{
-	std::srand(0x88e8fff4);
+		if (progressive || deadline_ms > 0.)
+		{
+			std::cout << "--progressive and --deadline render whole images, ignoring --roi\n";
+			roi = render_roi{};
+		}
+		else if (!golden.empty())
+		{
+			std::cout << "--compare checks whole images, ignoring --roi\n";
+			roi = render_roi{};
+		}
+	}
 
-	for (auto i = 0U; i < num_spheres; ++i)
+	if (deadline_ms > 0. && progressive)
 	{
-		spheres[i].cx = RAND_FLOAT * 20.f - 10.f;
-		spheres[i].cy = RAND_FLOAT * 20.f - 10.f;
-		spheres[i].cz = RAND_FLOAT * 20.f - 5.f;
-		spheres[i].radius = (RAND_FLOAT + 0.1f) * 1.5f;
-		spheres[i].r = RAND_FLOAT;
-		spheres[i].g = RAND_FLOAT;
-		spheres[i].b = RAND_FLOAT;
+		std::cout << "--deadline renders its own progressive passes, ignoring --progressive\n";
+		progressive = false;
 	}
-}
 
-// Solve quadratic equations and return roots if exist
-// Returns true if roots exist and are returned in x1 and x2
-// Returns false if no roots exist and x1 and x2 are undefined
-bool solve_quadratic(float a, float b, float c, float& x1, float& x2)
-{
-	float d = b*b - 4 * a*c;
+	if (balance && (serial || progressive || deadline_ms > 0. || !roi.empty()))
+	{
+		std::cout << "--balance plans the tiles of whole parallel frames, rendering without it\n";
+		balance = false;
+	}
+
+	render_scene scene;
+	scene.view = view;
+	scene.neighbour_hint = neighbour_hint;
+	scene.camera = perspective ? projection::pinhole : projection::ortho;
+	scene.pinhole = pinhole;
+
+	thread_pool pool(serial ? 1U : num_threads);
 
-	if (d < 0)
-		return false;
+	scene_file file;
+
+	if (!scene_path.empty())
+	{
+		auto load_start = std::chrono::high_resolution_clock::now();
+
+		if (!file.open(scene_path))
+			return -1;
+
+		file.copy_spheres(scene.spheres);
+		scene.file = &file;
+
+		auto load_delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count();
+		std::cout << "Loaded " << scene.spheres.size() << " spheres from " << scene_path << " in " << load_delta << " ms\n";
+	}
 	else
 	{
-		float den = 1 / (2 * a);
-		x1 = (-b - std::sqrt(d))*den;
-		x2 = (-b + std::sqrt(d))*den;
-		return true;
+		auto generate_start = std::chrono::high_resolution_clock::now();
+		generate_spheres(scene.spheres, num_spheres, generator, pool);
+		auto generate_delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - generate_start).count();
+
+		std::cout << "Generated " << num_spheres << " spheres (" << scene_generator_name(generator) << ") in " << generate_delta << " ms\n";
+
+		// This program always skipped sphere 0 when coloring (it tested idx > 0): the sphere still
+		// hides what is behind it but shows the background. Painting it in the background color
+		// keeps that image with the shared tracers, which color every hit sphere.
+		if (num_spheres > 0)
+		{
+			scene.spheres.color[0] = scene.spheres.color[1] = scene.spheres.color[2] = 0.1f;
+		}
 	}
-}
 
-// Intersect the ray against the sphere
-// If there is an intersection:
-// * return true
-// * update r.maxt to intersection distance
-bool intersect_sphere(sphere const& sphere, ray& r)
-{
-	ray rtemp = r;
-	rtemp.ox -= sphere.cx;
-	rtemp.oy -= sphere.cy;
-	rtemp.oz -= sphere.cz;
+	// a saved scene holds every sphere
+	if (!roi.empty() && save_scene.empty())
+	{
+		auto total = scene.spheres.size();
+		auto culled = cull_scene(scene, roi);
+
+		std::cout << "Culled " << culled << " of " << total << " spheres outside the region\n";
+	}
 
-	float a = rtemp.dx * rtemp.dx + rtemp.dy * rtemp.dy + rtemp.dz * rtemp.dz;
-	float b = 2 * (rtemp.ox * rtemp.dx + rtemp.oy * rtemp.dy + rtemp.oz * rtemp.dz);
-	float c = rtemp.ox * rtemp.ox + rtemp.oy * rtemp.oy + rtemp.oz * rtemp.oz - sphere.radius * sphere.radius;
+	std::vector<float> img(std::size_t(view.image_width) * view.image_height * 3);
 
-	float t0, t1;
+	if (perspective && mode != accel_mode::none)
+	{
+		std::cout << "The acceleration structures trace ortho rays, the pinhole camera culls spheres per tile instead\n";
+		mode = accel_mode::none;
+	}
 
-	if (solve_quadratic(a, b, c, t0, t1))
+	if (mode != accel_mode::none)
 	{
-		if (t0 > r.maxt || t1 < 0.f)
-			return false;
+		auto build_start = std::chrono::high_resolution_clock::now();
+		prepare_scene(scene, mode);
+		auto build_delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+		std::cout << "Acceleration structure build time " << build_delta << " ms\n";
 
-		r.maxt = t0 > 0.f ? t0 : t1;
-		return true;
+		if (scene.mode != mode)
+		{
+			std::cout << "Some spheres cross the near plane, falling back to brute force\n";
+		}
 	}
 
-	return false;
-}
+	if (!save_scene.empty() && !write_scene_file(save_scene, scene.spheres, scene.mode == accel_mode::bvh ? &scene.accel : nullptr, view.near))
+	{
+		return -1;
+	}
 
+	bool use_serial = serial && scene.mode == accel_mode::none;
+	std::string name = use_serial ? "serial" : simd_isa_name(isa);
 
-// Render the image img usign ray tracing for ortho projection camera.
-// Each pixel of img contains color of closest sphere after the function has finished.
-void trace(sphere const* spheres, std::uint32_t num_spheres, float* img)
-{
-	for (auto i = 0U; i < kImageWidth; ++i)
+	if (!use_serial)
 	{
-		for (auto j = 0U; j < kImageHeight; ++j)
-		{
-			ray r;
-			r.oz = NEAR;
-			r.ox = LEFT + (WIDTH / kImageWidth) * (i + 0.5f);
-			r.oy = BOTTOM + (HEIGHT / kImageHeight) * (j + 0.5f);
-			r.dx = r.dy = 0.f;
-			r.dz = 1.f;
-			r.maxt = FAR - NEAR;
+		if (scene.mode != accel_mode::none)
+			name = accel_mode_name(scene.mode);
+		else if (perspective)
+			name = "pinhole";
 
-			int idx = -1;
+		std::cout << "Using " << pool.size() << " threads, " << name << "\n";
+	}
 
-			for (auto k = 0U; k < num_spheres; ++k)
-			{
-				if (intersect_sphere(spheres[k], r))
-				{
-					idx = k;
-				}
-			}
+	// tile times of the last --deadline or --balance frame and what the last --deadline one got done
+	tile_costs costs;
+	deadline_result done;
 
-			if (idx > 0)
-			{
-				img[(j * kImageWidth + i) * 3] = spheres[idx].r;
-				img[(j * kImageWidth + i) * 3 + 1] = spheres[idx].g;
-				img[(j * kImageWidth + i) * 3 + 2] = spheres[idx].b;
-			}
-			else
+	auto render = [&]
+	{
+		if (deadline_ms > 0.)
+		{
+			done = render_deadline(pool, scene, isa, &img[0], deadline_ms / 1000., costs);
+		}
+		// the tiles of the region, in the image of the whole view
+		else if (!roi.empty())
+		{
+			pool.run(roi_tiles(view, roi, kTileSize), [&](tile const& t)
 			{
-				img[(j * kImageWidth + i) * 3] = 0.1f;
-				img[(j * kImageWidth + i) * 3 + 1] = 0.1f;
-				img[(j * kImageWidth + i) * 3 + 2] = 0.1f;
-			}
+				render_tile(scene, isa, t, &img[0]);
+			});
 		}
+		else if (use_serial && perspective)
+			trace_pinhole(scene.spheres, view, pinhole, &img[0]);
+		else if (use_serial)
+			trace(scene.spheres, view, &img[0]);
+		else if (balance)
+			render_balanced(pool, scene, isa, pixel_format::float32, reinterpret_cast<unsigned char*>(&img[0]), costs);
+		else
+			render_parallel(pool, scene, isa, &img[0]);
+	};
+
+	if (bench)
+	{
+		bench_result result;
+		result.name = name + ", " + std::to_string(pool.size()) + " threads";
+		result.width = roi.empty() ? view.image_width : roi.width();
+		result.height = roi.empty() ? view.image_height : roi.height();
+		result.spheres = static_cast<std::uint32_t>(scene.spheres.size());
+		result.warmup = warmup;
+		energy_use energy = {};
+		result.stats = run_bench(render, warmup, runs, &energy);
+		add_bench_energy(result, energy);
+		result.rays = static_cast<double>(result.width) * result.height;
+		result.tests = result.rays * scene.spheres.size();
+
+		print_bench(result);
+
+		if (!json.empty() && !write_bench_json(json, result))
+			return -1;
 	}
-}
+	else if (!progressive)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
 
-int main()
-{
-	std::vector<sphere> spheres(kNumSpheres);
+		render();
 
-	generate_spheres(&spheres[0], kNumSpheres);
+		auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
 
-	std::vector<float> img(kImageWidth * kImageHeight * 3);
+		std::cout << "Execution time " << delta << " ms\n";
+	}
 
-	auto start = std::chrono::high_resolution_clock::now();
+	OIIO_NAMESPACE_USING;
 
-	trace(&spheres[0], kNumSpheres, &img[0]);
+	ImageSpec spec(view.image_width, view.image_height, 3, TypeDesc::FLOAT);
 
-	auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+	// encoded on the writer thread in chunks of scanlines
+	image_writer writer;
 
-	std::cout << "Execution time " << delta << " ms\n";
+	if (progressive && !bench)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
 
-	OIIO_NAMESPACE_USING;
+		render_progressive(pool, scene, isa, &img[0], [&](std::uint32_t pass)
+		{
+			auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+			if (pass == 0)
+				std::cout << "Time to first image " << delta << " ms\n";
 
-	ImageOutput* out = ImageOutput::create("result.png");
+			std::cout << "Pass " << pass + 1 << " of " << kProgressivePasses << " done after " << delta << " ms\n";
+
+			// the writer copies the preview, the next pass refines img meanwhile
+			if (pass + 1 < kProgressivePasses)
+			{
+				auto preview = reinterpret_cast<unsigned char const*>(img.data());
+				writer.write("preview.png", spec, std::vector<unsigned char>(preview, preview + sizeof(float) * img.size()), sizeof(float) * 3);
+			}
+		});
+	}
+	auto bytes = reinterpret_cast<unsigned char const*>(img.data());
 
-	if (!out)
+	if (!roi.empty())
 	{
-		std::cout << "Can't create image file on disk";
-		return -1;
+		ImageSpec region_spec(roi.width(), roi.height(), 3, TypeDesc::FLOAT);
+		region_spec.x = static_cast<int>(roi.xbegin);
+		region_spec.y = static_cast<int>(roi.ybegin);
+		region_spec.full_width = static_cast<int>(view.image_width);
+		region_spec.full_height = static_cast<int>(view.image_height);
+
+		std::vector<unsigned char> region(sizeof(float) * 3 * roi.width() * roi.height());
+		copy_roi(bytes, sizeof(float) * 3 * view.image_width, full_roi(view), region.data(), sizeof(float) * 3 * roi.width(), roi, roi, sizeof(float) * 3);
+		writer.write("result.png", region_spec, std::move(region), sizeof(float) * 3);
+	}
+	else
+	{
+		writer.write("result.png", spec, std::vector<unsigned char>(bytes, bytes + sizeof(float) * img.size()), sizeof(float) * 3);
 	}
 
-	ImageSpec spec(kImageWidth, kImageHeight, 3, TypeDesc::FLOAT);
+	if (deadline_ms > 0.)
+	{
+		std::cout << "Deadline " << deadline_ms << " ms: " << done.elapsed * 1000. << " ms, " << done.unfinished << " of " << done.tile_passes.size()
+		          << " tiles unfinished\n";
+
+		// 255 for a finished tile, less for the ones short of the passes
+		std::vector<unsigned char> marks(done.tile_passes.size());
 
-	out->open("result.png", spec);
-	out->write_image(TypeDesc::FLOAT, &img[0], sizeof(float) * 3);
-	out->close();
+		for (std::size_t t = 0; t < marks.size(); ++t)
+		{
+			marks[t] = static_cast<unsigned char>(done.tile_passes[t] * 255 / kProgressivePasses);
+		}
+
+		ImageSpec marks_spec((view.image_width + kTileSize - 1) / kTileSize, (view.image_height + kTileSize - 1) / kTileSize, 1, TypeDesc::UINT8);
+		writer.write("deadline.png", marks_spec, std::move(marks), 1);
+	}
+
+	if (!writer.finish())
+	{
+		return -1;
+	}
 
-	return 0;
+	return golden.empty() || check_image_file("result.png", golden, tolerance) ? 0 : -1;
 }
@@ -0,0 +1,234 @@
+"""NumPy bindings of the CPU renderer, through the C interface of rt.common/renderer_api.h.
+
+The rt.python library is loaded with ctypes, which releases the GIL for every call into it, so
+other Python threads run while a frame renders. Arrays are passed to the library in place:
+the scene columns are read where they are and render() writes into a pooled framebuffer the
+returned array views, or into the array given as out.
+
+    import numpy as np, rt
+
+    renderer = rt.Renderer()
+    renderer.set_scene(cx, cy, cz, radius, color)   # float32 columns, color of shape (n, 3)
+    image = renderer.render(size=(1920, 1080))      # float32 array of shape (1080, 1920, 3)
+    t, ids = renderer.query_rays(origins, directions, tmax, accel="bvh")
+
+    huge = renderer.virtual_image(size=(1 << 20, 1 << 20), accel="bvh")
+    crop = huge.pixels(500000, 500000, 1280, 720)     # renders the tiles it touches only
+"""
+
+import ctypes
+import os
+import sys
+import weakref
+
+import numpy as np
+
+# Window, depth range and image size of default_view() in accel.h
+DEFAULT_WINDOW = (-10.0, -10.0, 20.0, 20.0, -10.0, 10.0)
+DEFAULT_SIZE = (2048, 2048)
+
+
+def _load_library():
+    path = os.environ.get("RT_LIBRARY")
+
+    if not path:
+        name = "rt.python.dll" if sys.platform == "win32" else "librt.python.so"
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)), name)
+
+    lib = ctypes.CDLL(path)
+
+    floats = ctypes.POINTER(ctypes.c_float)
+
+    lib.rt_create.argtypes = [ctypes.c_uint32]
+    lib.rt_create.restype = ctypes.c_void_p
+    lib.rt_destroy.argtypes = [ctypes.c_void_p]
+    lib.rt_destroy.restype = None
+    lib.rt_set_scene.argtypes = [ctypes.c_void_p, floats, floats, floats, floats, floats, ctypes.c_uint32]
+    lib.rt_set_scene.restype = ctypes.c_bool
+    lib.rt_render.argtypes = [ctypes.c_void_p] + [ctypes.c_float] * 6 + [ctypes.c_uint32, ctypes.c_uint32, ctypes.c_char_p, floats, ctypes.c_size_t]
+    lib.rt_render.restype = ctypes.c_char_p
+    lib.rt_query_rays.argtypes = [ctypes.c_void_p] + [floats] * 7 + [ctypes.c_size_t, ctypes.c_char_p, ctypes.c_bool, floats, ctypes.POINTER(ctypes.c_int32)]
+    lib.rt_query_rays.restype = ctypes.c_char_p
+    lib.rt_acquire_framebuffer.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32]
+    lib.rt_acquire_framebuffer.restype = floats
+    lib.rt_release_framebuffer.argtypes = [ctypes.c_void_p, floats]
+    lib.rt_release_framebuffer.restype = None
+    lib.rt_open_virtual.argtypes = [ctypes.c_void_p] + [ctypes.c_float] * 6 + [ctypes.c_uint32, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_size_t]
+    lib.rt_open_virtual.restype = ctypes.c_void_p
+    lib.rt_close_virtual.argtypes = [ctypes.c_void_p]
+    lib.rt_close_virtual.restype = None
+    lib.rt_virtual_levels.argtypes = [ctypes.c_void_p]
+    lib.rt_virtual_levels.restype = ctypes.c_uint32
+    lib.rt_virtual_pixels.argtypes = [ctypes.c_void_p] + [ctypes.c_uint32] * 5 + [floats, ctypes.c_size_t]
+    lib.rt_virtual_pixels.restype = ctypes.c_bool
+    lib.rt_invalidate_virtual.argtypes = [ctypes.c_void_p]
+    lib.rt_invalidate_virtual.restype = None
+    lib.rt_virtual_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint64)]
+    lib.rt_virtual_stats.restype = None
+    return lib
+
+
+_lib = _load_library()
+
+
+def _float_pointer(array):
+    return array.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+
+
+def _column(name, array, shape):
+    # converting would copy, the columns must already be what the renderer reads
+    if not isinstance(array, np.ndarray) or array.dtype != np.float32 or not array.flags.c_contiguous or array.shape != shape:
+        raise ValueError("%s must be a C-contiguous float32 array of shape %s" % (name, shape))
+
+    return _float_pointer(array)
+
+
+class _Handle:
+    """Owns the renderer of the library; framebuffers handed out keep it alive."""
+
+    def __init__(self, threads):
+        self.pointer = _lib.rt_create(threads)
+
+        if not self.pointer:
+            raise MemoryError("can't create the renderer")
+
+    def __del__(self):
+        if self.pointer:
+            _lib.rt_destroy(self.pointer)
+
+
+def _release(handle, pixels):
+    _lib.rt_release_framebuffer(handle.pointer, pixels)
+
+
+class Renderer:
+    """The parallel CPU tracers of cpu_renderer on threads threads, 0 for all of them."""
+
+    def __init__(self, threads=0):
+        self._handle = _Handle(threads)
+        self._virtual_images = weakref.WeakSet()
+        self.mode = None
+
+    def set_scene(self, cx, cy, cz, radius, color):
+        """Render the spheres of the float32 columns cx, cy, cz and radius of n values and
+        color of shape (n, 3) from now on."""
+        count = len(cx)
+        pointers = [_column(name, array, (count,)) for name, array in (("cx", cx), ("cy", cy), ("cz", cz), ("radius", radius))]
+        pointers.append(_column("color", color, (count, 3)))
+
+        if not _lib.rt_set_scene(self._handle.pointer, *(pointers + [count])):
+            raise MemoryError("can't store %d spheres" % count)
+
+        # the tiles of the old scene are rendered again as they are read
+        for image in self._virtual_images:
+            image.invalidate()
+
+    def render(self, size=DEFAULT_SIZE, window=DEFAULT_WINDOW, accel="none", out=None):
+        """Render window (left, bottom, width, height, near, far) at size (width, height) with
+        the accel mode named accel and return the rgb float32 image of shape (height, width, 3).
+
+        Without out the image is a framebuffer of the renderer's pool, returned to the pool
+        once the array and every view of it are gone. out may be a float32 array of that shape
+        whose rows are packed pixels, e.g. a crop of a larger image. The mode used, which
+        falls back to none where the accel mode can't hold the scene, is left in self.mode."""
+        width, height = size
+
+        if out is None:
+            pixels = _lib.rt_acquire_framebuffer(self._handle.pointer, width, height)
+
+            if not pixels:
+                raise MemoryError("can't allocate a %dx%d framebuffer" % (width, height))
+
+            # every view of the array holds the buffer, which hands it back when it goes
+            buffer = (ctypes.c_float * (3 * width * height)).from_address(ctypes.addressof(pixels.contents))
+            weakref.finalize(buffer, _release, self._handle, pixels)
+            out = np.frombuffer(buffer, dtype=np.float32).reshape(height, width, 3)
+        elif out.dtype != np.float32 or out.shape != (height, width, 3) or out.strides[1:] != (12, 4) or out.strides[0] < 12 * width:
+            raise ValueError("out must be a float32 array of shape (%d, %d, 3) with packed rows" % (height, width))
+
+        mode = _lib.rt_render(self._handle.pointer, *(list(window) + [width, height, accel.encode(), _float_pointer(out), out.strides[0]]))
+
+        if mode is None:
+            raise ValueError("can't render with accel mode %s" % accel)
+
+        self.mode = mode.decode()
+        return out
+
+    def query_rays(self, origins, directions, tmax, accel="bvh", sort=True):
+        """Closest sphere of each of n arbitrary rays, the float32 origins and directions of
+        shape (3, n), x, y and z columns whose rows are read in place, and tmax of n values.
+        A direction may have any length but 0, tmax and the distances are in multiples of it.
+        Returns the float32 distances of the hits and the int32 sphere indices, tmax and -1 for
+        a miss. accel bvh walks the BVH of the renderer, other modes test every sphere; sort
+        traces the rays in coherence order, for large batches of incoherent rays. The search
+        used, bvh or none, is left in self.mode."""
+        count = len(tmax)
+        columns = [_column("%s[%d]" % (name, axis), array[axis], (count,)) for name, array in (("origins", origins), ("directions", directions))
+                   for axis in range(3)]
+        columns.append(_column("tmax", tmax, (count,)))
+
+        t = np.empty(count, dtype=np.float32)
+        ids = np.empty(count, dtype=np.int32)
+        mode = _lib.rt_query_rays(self._handle.pointer, *(columns + [count, accel.encode(), sort, _float_pointer(t),
+                                                                      ids.ctypes.data_as(ctypes.POINTER(ctypes.c_int32))]))
+
+        if mode is None:
+            raise ValueError("can't query %d rays with accel mode %s" % (count, accel))
+
+        self.mode = mode.decode()
+        return t, ids
+
+    def virtual_image(self, size, window=DEFAULT_WINDOW, accel="bvh", budget_mb=256):
+        """A VirtualImage of window (left, bottom, width, height, near, far) at size (width,
+        height), of any size, whose tiles are rendered with the accel mode named accel as they
+        are first read, keeping at most budget_mb MB of them. Setting another scene drops its
+        tiles. none, bvh and sorted render the tiles from one structure, the other modes build
+        theirs for every tile."""
+        image = VirtualImage(self._handle, size, window, accel, budget_mb)
+        self._virtual_images.add(image)
+        return image
+
+
+class VirtualImage:
+    """An image of a Renderer rendered tile by tile as a viewer reads it, see
+    Renderer.virtual_image. Level l of the MIP levels is the window at the sizes halved l
+    times, rendered from the spheres at that resolution for zooming out."""
+
+    def __init__(self, handle, size, window, accel, budget_mb):
+        # the renderer lives as long as its images
+        self._handle = handle
+        self.size = size
+        self.pointer = _lib.rt_open_virtual(handle.pointer, *(list(window) + [size[0], size[1], accel.encode(), budget_mb]))
+
+        if not self.pointer:
+            raise ValueError("can't open a virtual image with accel mode %s" % accel)
+
+        self.levels = _lib.rt_virtual_levels(self.pointer)
+
+    def __del__(self):
+        if getattr(self, "pointer", None):
+            _lib.rt_close_virtual(self.pointer)
+
+    def pixels(self, x, y, width, height, level=0, out=None):
+        """The rgb float32 pixels [x, x + width) x [y, y + height) of level as an array of shape
+        (height, width, 3), rendering the tiles they touch that aren't in memory, or written
+        into out, a float32 array of that shape with packed pixels in its rows."""
+        if out is None:
+            out = np.empty((height, width, 3), dtype=np.float32)
+        elif out.dtype != np.float32 or out.shape != (height, width, 3) or out.strides[1:] != (12, 4) or out.strides[0] < 12 * width:
+            raise ValueError("out must be a float32 array of shape (%d, %d, 3) with packed rows" % (height, width))
+
+        if not _lib.rt_virtual_pixels(self.pointer, level, x, y, x + width, y + height, _float_pointer(out), out.strides[0]):
+            raise ValueError("%dx%d+%d+%d is not in level %d of the image" % (width, height, x, y, level))
+
+        return out
+
+    def invalidate(self):
+        """Drop every tile, rendering them again from the scene as they are read."""
+        _lib.rt_invalidate_virtual(self.pointer)
+
+    def stats(self):
+        """Tiles read from memory, rendered and evicted so far and the bytes of the tiles kept."""
+        counts = (ctypes.c_uint64 * 4)()
+        _lib.rt_virtual_stats(self.pointer, counts)
+        return dict(zip(("hits", "rendered", "evicted", "bytes"), counts))
@@ -0,0 +1,618 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "delta_frames.h"
+#include "device_memory.h"
+#include "framebuffer_pool.h"
+#include "grid_builder.h"
+#include "image_writer.h"
+#include "lbvh_builder.h"
+#include "output_files.h"
+#include "pipe_writer.h"
+#include "profile_markers.h"
+#include "timeline.h"
+
+namespace
+{
+	// Mark the tiles of kGroupTileSize pixels of view in dirty, a byte per tile in rows, that the
+	// footprint of a sphere which moved between before and after covers in either of them. With
+	// !reuse every tile is marked. Returns the tiles left clear, whose pixels --temporal copies
+	// from the frame before.
+	std::size_t mark_moved_tiles(sphere_soa const& before, sphere_soa const& after, ortho_view const& view, bool reuse, std::vector<cl_uchar>& dirty)
+	{
+		std::uint32_t tiles_x = (view.image_width + kGroupTileSize - 1) / kGroupTileSize;
+		std::uint32_t tiles_y = (view.image_height + kGroupTileSize - 1) / kGroupTileSize;
+
+		dirty.assign(std::size_t(tiles_x) * tiles_y, reuse ? 0 : 1);
+
+		if (!reuse)
+			return 0;
+
+		auto mark = [&](sphere_soa const& spheres, std::uint32_t k)
+		{
+			pixel_rect rect;
+
+			if (!sphere_footprint(spheres, k, view, rect))
+				return;
+
+			for (auto ty = rect.y0 / kGroupTileSize; ty <= (rect.y1 - 1) / kGroupTileSize; ++ty)
+			{
+				for (auto tx = rect.x0 / kGroupTileSize; tx <= (rect.x1 - 1) / kGroupTileSize; ++tx)
+				{
+					dirty[std::size_t(ty) * tiles_x + tx] = 1;
+				}
+			}
+		};
+
+		for (auto k = 0U; k < after.size(); ++k)
+		{
+			if (before.cx[k] != after.cx[k] || before.cy[k] != after.cy[k] || before.cz[k] != after.cz[k] || before.radius[k] != after.radius[k])
+			{
+				mark(before, k);
+				mark(after, k);
+			}
+		}
+
+		return static_cast<std::size_t>(std::count(dirty.begin(), dirty.end(), cl_uchar(0)));
+	}
+
+	// Pairs of sphere and cell the grid of cell_size pixel cells over view holds at most in any
+	// frame of the turntable animation of rest (rotate_spheres), for grid_builder. A sphere keeps
+	// its distance to the axis, which bounds the distance from the near plane and the center
+	// coordinates the footprint is widened by (sphere_bounds), and a footprint of a given width
+	// covers at most one cell more than the cells of that width, whatever its position.
+	std::size_t turntable_grid_pairs(sphere_soa const& rest, ortho_view const& view, std::uint32_t cell_size)
+	{
+		std::uint32_t cells_x = (view.image_width + cell_size - 1) / cell_size;
+		std::uint32_t cells_y = (view.image_height + cell_size - 1) / cell_size;
+
+		double pixel_x = double(view.width) / view.image_width;
+		double pixel_y = double(view.height) / view.image_height;
+
+		// the cells a span of pixels covers, the pixels a footprint half reach wide covers
+		// (pixel_span in grid.cpp: one more on each side and one for rounding)
+		auto cells = [&](double reach, double pixel, std::uint32_t limit)
+		{
+			double pixels = std::ceil(2.0 * reach / pixel) + 4.0;
+			return std::min<double>(limit, std::floor((pixels - 1.0) / cell_size) + 2.0);
+		};
+
+		double pairs = 0.0;
+
+		for (auto k = 0U; k < rest.size(); ++k)
+		{
+			double x = rest.cx[k];
+			double z = rest.cz[k] - kTurntableAxisZ;
+			double distance = std::sqrt(x * x + z * z);
+			double r = rest.radius[k];
+
+			double dz = std::max(std::fabs(kTurntableAxisZ + distance - view.near), std::fabs(kTurntableAxisZ - distance - view.near)) + r;
+			double sum = dz * dz + 2.0 * r * r;
+			double rb = std::sqrt(double(rest.radius2[k]) + sum * (64.0 / (1 << 24)));
+
+			// the float slack of sphere_bounds, doubled for the rounding of the float reach
+			double reach = (rb + (distance + std::fabs(rest.cy[k]) + rb) * (2.0 / (1 << 20))) * (1.0 + 1e-6);
+
+			pairs += cells(reach, pixel_x, cells_x) * cells(reach, pixel_y, cells_y);
+		}
+
+		return static_cast<std::size_t>(pairs);
+	}
+
+	// Render num_frames frames of the turntable animation (rotate_spheres) with the brute force
+	// kernel of dev and pass them to writer. Three queues carry the uploads of the moving
+	// centers, the kernels and the readbacks, and two sets of device buffers alternate between
+	// frames, so upload of frame f + 1, kernel of frame f and readback of frame f - 1 can run
+	// at the same time. Events order each stage after the frame it depends on and keep frame
+	// f + 2 from reusing a slot before frame f is done with it. Frames are read back into buffers
+	// of frames, which writer releases them to once they are written. With a builder, dev traces
+	// through trace_bvh and every frame rebuilds the BVH over its centers on the device before
+	// the kernel; a frame with a sphere crossing the near plane, whose bounds wouldn't hold the
+	// ties of the brute force order, is traced with the brute force kernel instead. With a
+	// refit_threshold above 0 the frames after a build refit its tree, until the SAH cost of the
+	// refit tree exceeds refit_threshold times the cost of the build. With a pipe the frames are
+	// streamed to its encoder in layout instead of written to files; the rgba8 image of a yuv420
+	// frame is converted by convert_yuv420 after the kernel on the device, into a buffer of the
+	// slot that is read back in its place. With temporal the kernels reuse the frame before: the
+	// tiles mark_moved_tiles leaves clear are copied from it and the other pixels test the sphere
+	// they hit in it first (--temporal). With deltas the frames go to its container instead: the
+	// tiles of kGroupTileSize pixels that differ from the frame before are found and packed on the
+	// device after the kernel, and only they are read back (--delta). With a grid, dev traces through
+	// the grid kernel and every frame bins its centers into the grid on the device before the
+	// kernel; the lists keep index order, so every frame is exact.
+	void render_animation(render_device& dev, sphere_soa const& rest, std::uint32_t num_frames, std::string const& output, image_writer& writer,
+	                      framebuffer_pool& frames, lbvh_builder* builder, grid_builder* grid, double refit_threshold, pipe_writer* pipe, pipe_format layout,
+	                      bool temporal, delta_writer* deltas)
+	{
+		cl_int err = 0;
+
+		// every frame is traced whole into a buffer of its slot
+		if (dev.auto_bands)
+		{
+			std::cout << "The frames are larger than one allocation on " << dev.name << ", not animating\n";
+			return;
+		}
+
+		// only x and z move on the turntable, y, radii and colors stay in the buffers of init_device
+		struct frame_slot
+		{
+			sphere_soa spheres;
+			cl::Buffer cx_buf, cz_buf, out_buf, yuv_buf;
+			// --temporal: the sphere id of every pixel and the dirty tiles of the frame
+			cl::Buffer ids_buf, dirty_buf;
+			std::vector<cl_uchar> dirty;
+			// --delta: the changed flag of every tile, their list and blocks
+			cl::Buffer changed_buf, list_buf, blocks_buf;
+			cl::Event uploaded, rendered, read;
+		};
+
+		struct pending_frame
+		{
+			std::uint32_t frame;
+			std::vector<unsigned char> pixels;
+			// --delta: the number of changed tiles, then their indices
+			std::vector<cl_uint> tiles;
+			cl::Event read;
+		};
+
+		std::size_t geometry_size = sizeof(float) * rest.size();
+		auto const& view = dev.view;
+		std::size_t image_size = pixel_size(dev.format) * view.image_width * view.image_height;
+
+		bool yuv = pipe && layout == pipe_format::yuv420;
+		std::size_t frame_size = yuv ? pipe_frame_size(layout, view.image_width, view.image_height) : image_size;
+
+		std::uint32_t tiles_x = (view.image_width + kGroupTileSize - 1) / kGroupTileSize;
+		std::uint32_t tiles_y = (view.image_height + kGroupTileSize - 1) / kGroupTileSize;
+		std::size_t num_tiles = std::size_t(tiles_x) * tiles_y;
+		std::size_t block_size = pixel_size(dev.format) * kGroupTileSize * kGroupTileSize;
+
+		// the kernels of the next frame read the image of a slot with --temporal, diff_tiles with
+		// --delta
+		cl_mem_flags out_flags = (temporal || deltas ? CL_MEM_READ_WRITE : CL_MEM_WRITE_ONLY) | CL_MEM_HOST_READ_ONLY;
+
+		frame_slot slots[2];
+
+		for (auto& slot : slots)
+		{
+			slot.spheres = rest;
+			slot.cx_buf = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, geometry_size, nullptr, &err, "animation cx");
+			slot.cz_buf = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, geometry_size, nullptr, &err, "animation cz");
+			slot.out_buf = create_buffer(dev.context, out_flags, image_size, nullptr, &err, "animation framebuffer");
+
+			if (yuv)
+				slot.yuv_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, frame_size, nullptr, &err, "animation yuv frame");
+
+			if (temporal)
+			{
+				std::size_t tiles = std::size_t((view.image_width + kGroupTileSize - 1) / kGroupTileSize) * ((view.image_height + kGroupTileSize - 1) / kGroupTileSize);
+				slot.ids_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_int) * view.image_width * view.image_height, nullptr, &err,
+				                             "animation ids");
+				slot.dirty_buf = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, tiles, nullptr, &err, "animation dirty tiles");
+
+				// no hits before the first frame
+				err = dev.queue.enqueueFillBuffer(slot.ids_buf, cl_int(-1), 0, sizeof(cl_int) * view.image_width * view.image_height);
+			}
+
+			if (deltas)
+			{
+				slot.changed_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * num_tiles, nullptr, &err, "delta changed tiles");
+				slot.list_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, sizeof(cl_uint) * (num_tiles + 1), nullptr, &err, "delta tile list");
+				slot.blocks_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, block_size * num_tiles, nullptr, &err, "delta tile blocks");
+			}
+		}
+
+		cl::Kernel convert;
+
+		if (yuv)
+			convert = cl::Kernel(dev.program, "convert_yuv420", &err);
+
+		cl::CommandQueue upload_queue(dev.context, dev.device, 0, &err);
+		cl::CommandQueue read_queue(dev.context, dev.device, 0, &err);
+
+		// --delta: the kernels that find and pack the changed tiles, and a queue of its own for the
+		// read of the blocks, which would wait behind the list of the next frame on read_queue
+		cl::Kernel diff_tiles, list_tiles, pack_tiles;
+		cl::CommandQueue blocks_queue;
+		std::vector<unsigned char> blocks;
+
+		if (deltas)
+		{
+			diff_tiles = cl::Kernel(dev.program, "diff_tiles", &err);
+			list_tiles = cl::Kernel(dev.program, "list_tiles", &err);
+			pack_tiles = cl::Kernel(dev.program, "pack_tiles", &err);
+			blocks_queue = cl::CommandQueue(dev.context, dev.device, 0, &err);
+		}
+
+		cl::Kernel brute_force;
+
+		if (builder)
+		{
+			brute_force = cl::Kernel(dev.program, "trace", &err);
+
+			// the centers that move are set every frame
+			for (cl_uint a : { 1, 3, 4 })
+			{
+				err = set_scene_arg(dev, brute_force, a);
+			}
+		}
+
+		// --temporal: the kernels of trace_temporal and trace_bvh_temporal in place of dev.kernel
+		// and brute_force, and the tiles they copied
+		cl::Kernel temporal_brute_force, temporal_bvh;
+		std::size_t reused_tiles = 0, total_tiles = 0;
+
+		if (temporal)
+		{
+			temporal_brute_force = cl::Kernel(dev.program, "trace_temporal", &err);
+
+			if (builder)
+				temporal_bvh = cl::Kernel(dev.program, "trace_bvh_temporal", &err);
+
+			for (cl_uint a : { 1, 3, 4 })
+			{
+				err = set_scene_arg(dev, temporal_brute_force, a);
+
+				if (builder)
+					err = set_scene_arg(dev, temporal_bvh, a);
+			}
+		}
+
+		// first and last kernel of every frame's build and refit, of the BVH or the grid
+		std::vector<std::pair<cl::Event, cl::Event>> builds, refits;
+
+		// SAH cost of the last build, the read of the cost of the last build or refit
+		double built_cost = 0.0;
+		cl::Event cost_read;
+		bool cost_of_build = false;
+
+		std::deque<pending_frame> pending;
+
+		auto write_oldest = [&]
+		{
+			auto& oldest = pending.front();
+			oldest.read.wait();
+
+			if (deltas)
+			{
+				cl_uint count = oldest.tiles[0];
+				blocks.resize(block_size * count);
+
+				if (count != 0)
+					err = blocks_queue.enqueueReadBuffer(slots[oldest.frame % 2].blocks_buf, CL_TRUE, 0, blocks.size(), blocks.data());
+
+				deltas->write_frame(oldest.frame, &oldest.tiles[1], count, blocks.data());
+				pending.pop_front();
+				return;
+			}
+
+			if (pipe)
+			{
+				pipe->write(std::move(oldest.pixels));
+				pending.pop_front();
+				return;
+			}
+
+			writer.write(frame_file_name(output, oldest.frame, num_frames), OIIO_NAMESPACE::ImageSpec(view.image_width, view.image_height, 3, pixel_type(dev.format)),
+			             std::move(oldest.pixels), pixel_size(dev.format));
+			pending.pop_front();
+		};
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (auto frame = 0U; frame < num_frames; ++frame)
+		{
+			auto& slot = slots[frame % 2];
+			bool reused = frame >= 2;
+
+			// the host copy of frame - 2 must have left before it is overwritten
+			if (reused)
+				slot.uploaded.wait();
+
+			rotate_spheres(rest, 6.2831853f * frame / num_frames, slot.spheres);
+
+			// frame - 2 must be done reading the slot's centers and its image must be read back
+			std::vector<cl::Event> upload_wait;
+			std::vector<cl::Event> kernel_wait;
+
+			if (reused)
+			{
+				upload_wait.push_back(slot.rendered);
+				kernel_wait.push_back(slot.read);
+			}
+
+			// the other slot holds the frame before
+			auto& before = slots[(frame + 1) % 2];
+
+			if (temporal)
+			{
+				reused_tiles += mark_moved_tiles(before.spheres, slot.spheres, view, frame > 0, slot.dirty);
+				total_tiles += slot.dirty.size();
+				err = upload_queue.enqueueWriteBuffer(slot.dirty_buf, CL_FALSE, 0, slot.dirty.size(), slot.dirty.data(), &upload_wait);
+			}
+
+			err = upload_queue.enqueueWriteBuffer(slot.cx_buf, CL_FALSE, 0, geometry_size, slot.spheres.cx.data(), &upload_wait);
+			err = upload_queue.enqueueWriteBuffer(slot.cz_buf, CL_FALSE, 0, geometry_size, slot.spheres.cz.data(), &upload_wait, &slot.uploaded);
+
+			kernel_wait.push_back(slot.uploaded);
+
+			auto* kernel = &dev.kernel;
+			// trace_bvh writes the image at 7, the grid kernels at 9, the brute force kernels at 5
+			cl_uint out_arg = 5;
+
+			if (grid)
+			{
+				builds.emplace_back();
+				err = enqueue_grid_build(*grid, dev, &slot.cx_buf, &slot.cz_buf, &kernel_wait, &builds.back().first, &builds.back().second);
+				kernel_wait.assign(1, builds.back().second);
+
+				// the cell size and columns are the ones init_device set
+				err = dev.kernel.setArg(5, grid->cell_start);
+				err = dev.kernel.setArg(6, grid->values[0]);
+				out_arg = 9;
+			}
+
+			if (builder)
+			{
+				Imath::Box3f centers;
+				bool exact = true;
+
+				for (auto k = 0U; k < slot.spheres.size(); ++k)
+				{
+					centers.extendBy(Imath::V3f(slot.spheres.cx[k], slot.spheres.cy[k], slot.spheres.cz[k]));
+
+					if (!(sphere_bounds(slot.spheres, k, view.near).min.z > view.near))
+						exact = false;
+				}
+
+				if (exact)
+				{
+					bool rebuild = refit_threshold <= 0.0 || builds.empty();
+
+					// the cost of the previous frame's tree is read before its kernel runs
+					if (!rebuild && cost_read())
+					{
+						cost_read.wait();
+						double cost = lbvh_cost(*builder);
+
+						if (cost_of_build)
+							built_cost = cost;
+						else
+							rebuild = cost > built_cost * refit_threshold;
+					}
+
+					auto& timed = rebuild ? builds : refits;
+					timed.emplace_back();
+
+					if (rebuild)
+						err = enqueue_lbvh_build(*builder, dev, &slot.cx_buf, &slot.cz_buf, centers, &kernel_wait, &timed.back().first, &timed.back().second);
+					else
+						err = enqueue_lbvh_refit(*builder, dev, &slot.cx_buf, &slot.cz_buf, &kernel_wait, &timed.back().first, &timed.back().second);
+
+					kernel_wait.assign(1, timed.back().second);
+
+					if (refit_threshold > 0.0)
+					{
+						err = enqueue_lbvh_cost(*builder, dev, &cost_read);
+						cost_of_build = rebuild;
+					}
+
+					err = dev.kernel.setArg(5, builder->nodes);
+					err = dev.kernel.setArg(6, builder->values[0]);
+					out_arg = 7;
+				}
+				else
+				{
+					kernel = &brute_force;
+				}
+			}
+
+			if (temporal)
+			{
+				if (out_arg == 7)
+				{
+					err = temporal_bvh.setArg(5, builder->nodes);
+					err = temporal_bvh.setArg(6, builder->values[0]);
+					kernel = &temporal_bvh;
+				}
+				else
+				{
+					kernel = &temporal_brute_force;
+				}
+
+				// the queue runs in order, the kernel of the frame before has written its image and ids
+				err = kernel->setArg(out_arg + 1, before.out_buf);
+				err = kernel->setArg(out_arg + 2, before.ids_buf);
+				err = kernel->setArg(out_arg + 3, slot.ids_buf);
+				err = kernel->setArg(out_arg + 4, slot.dirty_buf);
+			}
+
+			err = kernel->setArg(0, slot.cx_buf);
+			err = kernel->setArg(2, slot.cz_buf);
+			err = kernel->setArg(out_arg, slot.out_buf);
+
+			err = dev.queue.enqueueNDRangeKernel(*kernel, cl::NullRange, cl::NDRange(view.image_width, view.image_height), group_size(dev, view.image_height),
+			                                     &kernel_wait, &slot.rendered);
+
+			auto* read_buf = &slot.out_buf;
+
+			// the queue runs in order, the conversion follows the kernel
+			if (yuv)
+			{
+				err = convert.setArg(0, slot.out_buf);
+				err = convert.setArg(1, slot.yuv_buf);
+				err = dev.queue.enqueueNDRangeKernel(convert, cl::NullRange, cl::NDRange(view.image_width / 2, view.image_height / 2), cl::NullRange, nullptr,
+				                                     &slot.rendered);
+				read_buf = &slot.yuv_buf;
+			}
+
+			// the queue runs in order, the frame before is still in the other slot: the kernel of the
+			// next frame writes it after these
+			if (deltas)
+			{
+				err = diff_tiles.setArg(0, slot.out_buf);
+				err = diff_tiles.setArg(1, frame > 0 ? before.out_buf : slot.out_buf);
+				err = diff_tiles.setArg(2, cl_uint(deltas->header().is_keyframe(frame) ? 1 : 0));
+				err = diff_tiles.setArg(3, slot.changed_buf);
+				err = dev.queue.enqueueNDRangeKernel(diff_tiles, cl::NullRange, cl::NDRange(tiles_x * kGroupTileSize, tiles_y * kGroupTileSize),
+				                                     cl::NDRange(kGroupTileSize, kGroupTileSize));
+
+				err = list_tiles.setArg(0, slot.changed_buf);
+				err = list_tiles.setArg(1, cl_uint(num_tiles));
+				err = list_tiles.setArg(2, slot.list_buf);
+				err = dev.queue.enqueueNDRangeKernel(list_tiles, cl::NullRange, cl::NDRange(kRadixGroup), cl::NDRange(kRadixGroup));
+
+				err = pack_tiles.setArg(0, slot.out_buf);
+				err = pack_tiles.setArg(1, slot.list_buf);
+				err = pack_tiles.setArg(2, slot.blocks_buf);
+				err = dev.queue.enqueueNDRangeKernel(pack_tiles, cl::NullRange, cl::NDRange(kGroupTileSize, kGroupTileSize * num_tiles),
+				                                     cl::NDRange(kGroupTileSize, kGroupTileSize), nullptr, &slot.rendered);
+			}
+
+			std::vector<cl::Event> read_wait(1, slot.rendered);
+
+			if (deltas)
+			{
+				// the list now, the blocks it counts once the writer takes the frame
+				pending.push_back(pending_frame{ frame, {}, std::vector<cl_uint>(num_tiles + 1), cl::Event() });
+				err = read_queue.enqueueReadBuffer(slot.list_buf, CL_FALSE, 0, sizeof(cl_uint) * (num_tiles + 1), pending.back().tiles.data(), &read_wait, &slot.read);
+			}
+			else
+			{
+				pending.push_back(pending_frame{ frame, frames.acquire(frame_size), {}, cl::Event() });
+				err = read_queue.enqueueReadBuffer(*read_buf, CL_FALSE, 0, frame_size, &pending.back().pixels[0], &read_wait, &slot.read);
+			}
+
+			pending.back().read = slot.read;
+
+			err = upload_queue.flush();
+			err = dev.queue.flush();
+			err = read_queue.flush();
+
+			// keep two frames in flight, hand the one before them to the writer. The blocks of a
+			// --delta frame are read from its slot, so it is written before the next frame takes
+			// the slot over, while the device traces this one.
+			if (pending.size() > (deltas ? 1U : 2U))
+				write_oldest();
+		}
+
+		while (!pending.empty())
+		{
+			write_oldest();
+		}
+
+		auto delta = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "Rendered " << num_frames << " frames in " << delta << " ms, " << num_frames * 1000.0 / delta << " frames/s\n";
+
+		if (temporal)
+			std::cout << "Reused " << reused_tiles << " of " << total_tiles << " tiles\n";
+
+		if (deltas)
+			std::cout << "Read back " << deltas->tiles_written() << " of " << std::size_t(num_frames) * num_tiles << " tiles, a keyframe every "
+			          << deltas->header().keyframe_interval << " frames\n";
+
+		if (builder || grid)
+		{
+			auto report = [&](char const* what, std::vector<std::pair<cl::Event, cl::Event>> const& timed)
+			{
+				double time = 0.0;
+
+				for (auto const& events : timed)
+				{
+					time += (events.second.getProfilingInfo<CL_PROFILING_COMMAND_END>() - events.first.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-6;
+				}
+
+				std::cout << what << (grid ? " the grid of " : " the BVH of ") << timed.size() << " of " << num_frames << " frames on the device";
+
+				if (!timed.empty())
+				{
+					double per_frame = time / timed.size();
+					std::cout << ", " << per_frame << " ms per frame, " << per_frame * 1e6 / std::max(rest.size(), 1U) << " ms per million spheres";
+				}
+
+				std::cout << "\n";
+			};
+
+			report("Built", builds);
+
+			if (refit_threshold > 0.0)
+				report("Refit", refits);
+		}
+	}
+}
+
+int run_animation(run_options const& options, render_device& dev, render_scene const& scene)
+{
+	framebuffer_pool frames;
+	image_writer writer(2, &frames, options.encoding);
+	lbvh_builder builder;
+
+	if (scene.mode == accel_mode::bvh && !init_lbvh_builder(builder, dev, scene.spheres))
+	{
+		std::cout << dev.name << ": can't create the BVH builder\n";
+		return 1;
+	}
+
+	grid_builder grid;
+
+	if (scene.mode == accel_mode::grid &&
+	    !init_grid_builder(grid, dev, scene.spheres, scene.grid, turntable_grid_pairs(scene.spheres, options.view, scene.grid.cell_size)))
+	{
+		std::cout << dev.name << ": can't create the grid builder\n";
+		return 1;
+	}
+
+	pipe_writer pipe(2, &frames);
+
+	if (!options.pipe_command.empty())
+	{
+		if (!pipe.open(options.pipe_command))
+			return 1;
+
+		std::cout << "Piping " << options.view.image_width << "x" << options.view.image_height << " " << pipe_format_name(options.pipe_layout) << " frames to "
+		          << options.pipe_command << "\n";
+	}
+
+	delta_writer deltas;
+
+	if (options.delta_interval != 0)
+	{
+		auto path = file_stem(options.output) + ".rtd";
+
+		if (!deltas.open(path, delta_header{ options.view.image_width, options.view.image_height, dev.format, kGroupTileSize, options.delta_interval, 0 }))
+			return 1;
+
+		std::cout << "Writing the frames as deltas to " << path << "\n";
+	}
+
+	render_animation(dev, scene.spheres, options.num_animated, options.output, writer, frames, scene.mode == accel_mode::bvh ? &builder : nullptr,
+	                 scene.mode == accel_mode::grid ? &grid : nullptr, options.refit_threshold, options.pipe_command.empty() ? nullptr : &pipe, options.pipe_layout,
+	                 options.temporal,
+	                 options.delta_interval != 0 ? &deltas : nullptr);
+
+	if (options.delta_interval != 0)
+	{
+		bool closed = deltas.close();
+		std::cout << "Wrote " << deltas.bytes_written() << " bytes of deltas for " << deltas.whole_bytes() << " bytes of frames\n";
+		return closed ? 0 : -1;
+	}
+
+	if (!options.pipe_command.empty())
+	{
+		bool piped = pipe.finish();
+		auto totals = pipe.totals();
+		std::cout << "Piped " << totals.frames << " frames, " << totals.write_time << " ms in pipe writes\n";
+		return piped ? 0 : -1;
+	}
+
+	bool written = writer.finish();
+	print_write_times(writer);
+	return written ? 0 : -1;
+}
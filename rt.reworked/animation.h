@@ -0,0 +1,9 @@
+#pragma once
+
+#include "render_device.h"
+#include "run_options.h"
+#include "scene.h"
+
+// Render the --animate frames of the turntable animation of scene on dev, into files, the pipe
+// of --pipe or the deltas of --delta, see render_animation. Returns the exit code of main.
+int run_animation(run_options const& options, render_device& dev, render_scene const& scene);
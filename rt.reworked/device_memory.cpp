@@ -0,0 +1,144 @@
+#include "device_memory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+#include "host_memory.h"
+
+namespace
+{
+	auto const start = std::chrono::steady_clock::now();
+
+	std::mutex mutex;
+	std::vector<device_allocation> allocations;
+	std::size_t live_bytes = 0;
+	std::size_t peak_bytes = 0;
+
+	double now()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void CL_CALLBACK buffer_released(cl_mem, void* id)
+	{
+		record_release(reinterpret_cast<std::size_t>(id));
+	}
+
+	// The access flags of flags, | separated
+	std::string flag_names(cl_mem_flags flags)
+	{
+		struct flag_name
+		{
+			cl_mem_flags flag;
+			char const* name;
+		};
+
+		flag_name const names[] = { { CL_MEM_READ_WRITE, "read_write" }, { CL_MEM_READ_ONLY, "read_only" }, { CL_MEM_WRITE_ONLY, "write_only" },
+		                            { CL_MEM_USE_HOST_PTR, "use_host_ptr" }, { CL_MEM_ALLOC_HOST_PTR, "alloc_host_ptr" },
+		                            { CL_MEM_COPY_HOST_PTR, "copy_host_ptr" }, { CL_MEM_HOST_WRITE_ONLY, "host_write_only" },
+		                            { CL_MEM_HOST_READ_ONLY, "host_read_only" }, { CL_MEM_HOST_NO_ACCESS, "host_no_access" },
+		                            { CL_MEM_SVM_FINE_GRAIN_BUFFER, "svm_fine_grain" } };
+
+		std::string text;
+
+		for (auto const& n : names)
+		{
+			if ((flags & n.flag) != 0)
+				text += (text.empty() ? "" : "|") + std::string(n.name);
+		}
+
+		// CL_MEM_READ_WRITE is 1 << 0, a buffer without access flags is read_write too
+		return text.empty() ? "read_write" : text;
+	}
+}
+
+cl::Buffer create_buffer(cl::Context const& context, cl_mem_flags flags, std::size_t size, void* host_ptr, cl_int* err, char const* name)
+{
+	cl_int made = CL_SUCCESS;
+	cl::Buffer buffer(context, flags, size, host_ptr, &made);
+
+	if (err != nullptr)
+		*err = made;
+
+	if (made == CL_SUCCESS)
+	{
+		auto id = record_allocation(context, flags, size, name);
+		clSetMemObjectDestructorCallback(buffer(), buffer_released, reinterpret_cast<void*>(id));
+	}
+
+	return buffer;
+}
+
+std::size_t record_allocation(cl::Context const& context, cl_mem_flags flags, std::size_t size, char const* name)
+{
+	std::string device;
+	auto devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+	if (!devices.empty())
+		device = devices[0].getInfo<CL_DEVICE_NAME>();
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	live_bytes += size;
+	peak_bytes = std::max(peak_bytes, live_bytes);
+	allocations.push_back(device_allocation{ name, device, size, flags, now(), -1.0 });
+	return allocations.size() - 1;
+}
+
+void record_release(std::size_t id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto& allocation = allocations[id];
+
+	if (allocation.released >= 0.0)
+		return;
+
+	allocation.released = now();
+	live_bytes -= allocation.size;
+}
+
+device_memory_totals device_memory()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	device_memory_totals totals = { allocations.size(), 0, live_bytes, peak_bytes };
+
+	for (auto const& allocation : allocations)
+	{
+		totals.allocated_bytes += allocation.size;
+	}
+
+	return totals;
+}
+
+std::vector<device_allocation> device_allocations()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return allocations;
+}
+
+void print_memory_footprint(bool list)
+{
+	auto totals = device_memory();
+
+	std::cout << "Peak host RSS " << peak_host_rss() / (1024.0 * 1024.0) << " MB, device memory peak " << totals.peak_bytes / (1024.0 * 1024.0) << " MB, "
+	          << totals.allocations << " allocations of " << totals.allocated_bytes / (1024.0 * 1024.0) << " MB, " << totals.live_bytes / (1024.0 * 1024.0)
+	          << " MB held\n";
+
+	if (!list)
+		return;
+
+	for (auto const& allocation : device_allocations())
+	{
+		std::cout << "  " << allocation.name << " on " << allocation.device << ": " << allocation.size / 1024.0 << " KB, " << flag_names(allocation.flags) << ", "
+		          << allocation.created << " ms to ";
+
+		if (allocation.released >= 0.0)
+			std::cout << allocation.released << " ms\n";
+		else
+			std::cout << "the end\n";
+	}
+}
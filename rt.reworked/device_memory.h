@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+// Device memory of the program: every cl::Buffer comes from create_buffer() and every SVM
+// block records itself, so the allocations, their flags and their lifetimes can be reported.
+// All functions may be called from any thread, the release of a buffer is recorded by the
+// OpenCL runtime's destructor callback.
+
+// One allocation of device memory
+struct device_allocation
+{
+	// What the buffer holds, a string literal of the caller
+	char const* name;
+	std::string device;
+	std::size_t size;
+	cl_mem_flags flags;
+	// ms since the program started, released is negative while the memory is held
+	double created;
+	double released;
+};
+
+// Sums over all allocations so far; the peak is the most bytes held at once on all devices
+struct device_memory_totals
+{
+	std::size_t allocations;
+	std::size_t allocated_bytes;
+	std::size_t live_bytes;
+	std::size_t peak_bytes;
+};
+
+// cl::Buffer(context, flags, size, host_ptr, err) recorded under name if it is created
+cl::Buffer create_buffer(cl::Context const& context, cl_mem_flags flags, std::size_t size, void* host_ptr, cl_int* err, char const* name);
+
+// Record an allocation made without a cl::Buffer and its release, the id is the one to release
+std::size_t record_allocation(cl::Context const& context, cl_mem_flags flags, std::size_t size, char const* name);
+void record_release(std::size_t id);
+
+device_memory_totals device_memory();
+
+// Every allocation so far in the order they were made
+std::vector<device_allocation> device_allocations();
+
+// Print the totals and the peak host RSS (host_memory.h), with list every allocation
+void print_memory_footprint(bool list);
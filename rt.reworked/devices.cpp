@@ -0,0 +1,191 @@
+#include "devices.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <tuple>
+
+namespace
+{
+	// Lanes of a GPU compute unit for the peak flops estimate, the 64 of an AMD compute unit or
+	// of the smaller NVIDIA SMs
+	cl_uint const kGpuLanes = 64;
+
+	std::string to_lower(std::string s)
+	{
+		std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c)
+		{
+			return static_cast<char>(std::tolower(c));
+		});
+		return s;
+	}
+
+	// Sort key, larger is faster
+	std::tuple<int, cl_ulong, cl_ulong> rank(device_entry const& d)
+	{
+		int is_gpu = (d.type & (CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR)) != 0 ? 1 : 0;
+		return std::make_tuple(is_gpu, static_cast<cl_ulong>(d.compute_units) * d.clock, d.global_mem);
+	}
+}
+
+std::vector<device_entry> enumerate_devices()
+{
+	std::vector<device_entry> result;
+
+	std::vector<cl::Platform> platforms;
+	if (cl::Platform::get(&platforms) != CL_SUCCESS)
+		return result;
+
+	for (auto const& platform : platforms)
+	{
+		std::vector<cl::Device> devices;
+
+		// fails with CL_DEVICE_NOT_FOUND on platforms without devices
+		if (platform.getDevices(CL_DEVICE_TYPE_ALL, &devices) != CL_SUCCESS)
+			continue;
+
+		for (auto const& device : devices)
+		{
+			device_entry entry;
+			entry.platform = platform;
+			entry.device = device;
+			entry.name = device.getInfo<CL_DEVICE_NAME>();
+			entry.type = device.getInfo<CL_DEVICE_TYPE>();
+			entry.compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+			entry.clock = device.getInfo<CL_DEVICE_MAX_CLOCK_FREQUENCY>();
+			entry.global_mem = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+
+			// a fused multiply-add per lane and clock, CPUs are as wide as their float vectors
+			cl_uint lanes = (entry.type & CL_DEVICE_TYPE_GPU) != 0 ? kGpuLanes : device.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT>();
+			entry.peak_gflops = 2.0 * lanes * entry.compute_units * entry.clock / 1000.0;
+			entry.peak_gbs = 0.0;
+			result.push_back(entry);
+		}
+	}
+
+	// stable, so equally ranked devices keep the ICD loader order
+	std::stable_sort(result.begin(), result.end(), [](device_entry const& l, device_entry const& r)
+	{
+		return rank(l) > rank(r);
+	});
+
+	return result;
+}
+
+bool parse_device_peak(char const* text, device_peak& peak)
+{
+	std::string s(text);
+	device_peak parsed;
+
+	auto equals = s.find('=');
+	parsed.pattern = equals == std::string::npos ? std::string() : to_lower(s.substr(0, equals));
+
+	char const* numbers = text + (equals == std::string::npos ? 0 : equals + 1);
+	char* end = nullptr;
+	parsed.gflops = std::strtod(numbers, &end);
+
+	if (end == numbers || *end != ',')
+		return false;
+
+	numbers = end + 1;
+	parsed.gbs = std::strtod(numbers, &end);
+
+	if (end == numbers || *end != '\0' || parsed.gflops <= 0.0 || parsed.gbs <= 0.0)
+		return false;
+
+	peak = parsed;
+	return true;
+}
+
+void apply_device_peaks(std::vector<device_entry>& devices, std::vector<device_peak> const& peaks)
+{
+	for (auto const& peak : peaks)
+	{
+		for (auto& d : devices)
+		{
+			if (to_lower(d.name).find(peak.pattern) != std::string::npos)
+			{
+				d.peak_gflops = peak.gflops;
+				d.peak_gbs = peak.gbs;
+			}
+		}
+	}
+}
+
+std::vector<device_entry> split_numa_domains(device_entry const& entry)
+{
+	std::vector<device_entry> result;
+
+	if ((entry.type & CL_DEVICE_TYPE_CPU) == 0)
+		return result;
+
+	cl_device_affinity_domain domains = 0;
+
+	if (clGetDeviceInfo(entry.device(), CL_DEVICE_PARTITION_AFFINITY_DOMAIN, sizeof(domains), &domains, nullptr) != CL_SUCCESS ||
+	    (domains & CL_DEVICE_AFFINITY_DOMAIN_NUMA) == 0)
+		return result;
+
+	cl_device_partition_property const properties[] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+	cl_uint count = 0;
+
+	if (clCreateSubDevices(entry.device(), properties, 0, nullptr, &count) != CL_SUCCESS || count < 2)
+		return result;
+
+	std::vector<cl_device_id> ids(count);
+
+	if (clCreateSubDevices(entry.device(), properties, count, ids.data(), nullptr) != CL_SUCCESS)
+		return result;
+
+	for (cl_uint n = 0; n < count; ++n)
+	{
+		device_entry sub = entry;
+
+		// the wrapper takes over the reference clCreateSubDevices returned
+		sub.device = cl::Device(ids[n]);
+		sub.name = entry.name + " (NUMA node " + std::to_string(n) + ")";
+		sub.compute_units = sub.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+		sub.peak_gflops = entry.peak_gflops * sub.compute_units / entry.compute_units;
+		sub.peak_gbs = entry.peak_gbs / count;
+		result.push_back(sub);
+	}
+
+	return result;
+}
+
+bool select_device(std::vector<device_entry> const& devices, std::string const& selector, device_entry& selected)
+{
+	if (devices.empty())
+		return false;
+
+	if (selector.empty())
+	{
+		selected = devices.front();
+		return true;
+	}
+
+	char* end = nullptr;
+	auto position = std::strtoul(selector.c_str(), &end, 10);
+
+	if (*end == '\0')
+	{
+		if (position >= devices.size())
+			return false;
+
+		selected = devices[position];
+		return true;
+	}
+
+	auto pattern = to_lower(selector);
+
+	for (auto const& d : devices)
+	{
+		if (to_lower(d.name).find(pattern) != std::string::npos)
+		{
+			selected = d;
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+// OpenCL device found on one of the platforms
+struct device_entry
+{
+	cl::Platform platform;
+	cl::Device device;
+	std::string name;
+	cl_device_type type;
+	cl_uint compute_units;
+	// Max clock in MHz
+	cl_uint clock;
+	cl_ulong global_mem;
+	// Peak single precision GFLOPS and memory bandwidth in GB/s for the roofline report of
+	// print_throughput: the flops are estimated from the compute units and clock, OpenCL
+	// can't tell the bandwidth, 0 until given with apply_device_peaks
+	double peak_gflops;
+	double peak_gbs;
+};
+
+// Peaks of the devices whose name contains pattern, case-insensitive, every device if empty
+struct device_peak
+{
+	std::string pattern;
+	double gflops;
+	double gbs;
+};
+
+// Devices of every platform, fastest first: GPUs and accelerators before CPUs, then by
+// compute units x clock, then by global memory size. Platforms without devices or
+// failing queries are skipped.
+std::vector<device_entry> enumerate_devices();
+
+// Parse [pattern=]GFLOPS,GB/s into peak. Returns false for a malformed text.
+bool parse_device_peak(char const* text, device_peak& peak);
+
+// Set the peaks of the devices that match each of peaks, later ones win
+void apply_device_peaks(std::vector<device_entry>& devices, std::vector<device_peak> const& peaks);
+
+// The sub-devices of a CPU device, one per NUMA node, made with clCreateSubDevices by
+// CL_DEVICE_AFFINITY_DOMAIN_NUMA, so the work-groups of each stay on the cores and memory of
+// its node. Named after the device with the node appended, on its platform. Empty if the device
+// isn't a CPU, its runtime can't partition it by NUMA node or it spans a single node.
+std::vector<device_entry> split_numa_domains(device_entry const& entry);
+
+// Pick a device from the ranked list. selector is either empty (take the first one),
+// a position in the list, or a case-insensitive substring of the device name.
+// Returns false if nothing matches.
+bool select_device(std::vector<device_entry> const& devices, std::string const& selector, device_entry& selected);
@@ -0,0 +1,824 @@
+#include "farm.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <emmintrin.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Workers connecting while the coordinator accepts the others
+	int const kBacklog = 16;
+
+	// Longest run encode_pixels writes, the count field holds run length - 1 in 15 bits
+	std::size_t const kMaxRun = 0x8000;
+	std::uint16_t const kRepeatFlag = 0x8000;
+
+	// encode_band tries LZ4 on a band whose runs leave more than 1 / kLz4Fallback of its bytes
+	std::size_t const kLz4Fallback = 4;
+
+	// LZ4 block format: a match is at least kMinMatch bytes, the last kLastLiterals bytes are
+	// literals and no match starts in the last kMatchLimit bytes
+	std::size_t const kMinMatch = 4;
+	std::size_t const kLastLiterals = 5;
+	std::size_t const kMatchLimit = 12;
+	std::size_t const kMaxOffset = 0xFFFF;
+	// Positions of the last 4-byte sequences of each hash, 64K entries like LZ4's default
+	int const kLz4HashBits = 16;
+
+	// Number of bytes at the start of a and b that are equal, at most size; 16 bytes per SSE2
+	// compare, so long runs and matches are measured at memory speed
+	std::size_t common_prefix(unsigned char const* a, unsigned char const* b, std::size_t size)
+	{
+		std::size_t n = 0;
+
+		for (; n + 16 <= size; n += 16)
+		{
+			auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(a + n)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + n)));
+			auto differ = static_cast<unsigned>(_mm_movemask_epi8(equal)) ^ 0xFFFFU;
+
+			if (differ != 0)
+			{
+#if defined(_MSC_VER)
+				unsigned long first;
+				_BitScanForward(&first, differ);
+				return n + first;
+#else
+				return n + static_cast<std::size_t>(__builtin_ctz(differ));
+#endif
+			}
+		}
+
+		while (n < size && a[n] == b[n])
+		{
+			++n;
+		}
+
+		return n;
+	}
+
+	// Repeat the pattern of the first pattern_size bytes of dst up to size bytes, the copies
+	// double each time so a long run takes a few wide memcpy calls
+	void fill_pattern(unsigned char* dst, std::size_t pattern_size, std::size_t size)
+	{
+		for (auto filled = std::min(pattern_size, size); filled < size; filled *= 2)
+		{
+			std::memcpy(dst + filled, dst, std::min(filled, size - filled));
+		}
+	}
+
+	std::uint32_t load32(unsigned char const* p)
+	{
+		std::uint32_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	// Length of an LZ4 token field: 15 in the token and the rest in bytes of 255 and a last one
+	void put_length(std::size_t length, std::string& out)
+	{
+		for (length -= 15; length >= 255; length -= 255)
+		{
+			out.push_back(static_cast<char>(255));
+		}
+
+		out.push_back(static_cast<char>(length));
+	}
+
+	bool get_length(char const* data, std::size_t data_size, std::size_t& read, std::size_t& length)
+	{
+		unsigned char byte;
+
+		do
+		{
+			if (read == data_size)
+				return false;
+
+			byte = static_cast<unsigned char>(data[read++]);
+			length += byte;
+		} while (byte == 255);
+
+		return true;
+	}
+
+	// One LZ4 sequence: the literals [anchor, anchor + literals) and a match of match_length
+	// bytes offset bytes back, or none if match_length is 0
+	void put_sequence(unsigned char const* data, std::size_t anchor, std::size_t literals, std::size_t offset, std::size_t match_length, std::string& out)
+	{
+		auto match_field = match_length != 0 ? match_length - kMinMatch : 0;
+		out.push_back(static_cast<char>((std::min<std::size_t>(literals, 15) << 4) | std::min<std::size_t>(match_field, 15)));
+
+		if (literals >= 15)
+			put_length(literals, out);
+
+		out.append(reinterpret_cast<char const*>(data + anchor), literals);
+
+		if (match_length == 0)
+			return;
+
+		out.push_back(static_cast<char>(offset & 0xFF));
+		out.push_back(static_cast<char>(offset >> 8));
+
+		if (match_field >= 15)
+			put_length(match_field, out);
+	}
+
+	static_assert(std::is_trivially_copyable<farm_job>::value && std::is_trivially_copyable<farm_band>::value, "messages are sent as is");
+
+#ifdef _WIN32
+	typedef SOCKET native_socket;
+	int const kSendFlags = 0;
+#else
+	typedef int native_socket;
+	// a worker that hung up must not kill the coordinator with SIGPIPE
+	int const kSendFlags = MSG_NOSIGNAL;
+#endif
+
+	native_socket native(std::uintptr_t s)
+	{
+		return static_cast<native_socket>(s);
+	}
+
+	void close_socket(std::uintptr_t s)
+	{
+#ifdef _WIN32
+		closesocket(native(s));
+#else
+		::close(native(s));
+#endif
+	}
+
+#ifdef _WIN32
+	bool start_winsock(bool& started)
+	{
+		WSADATA data = {};
+
+		if (!started && WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			std::cout << "Can't start Winsock\n";
+			return false;
+		}
+
+		started = true;
+		return true;
+	}
+#endif
+
+	// Bands are sent as soon as they are written, don't let them wait for more data
+	void set_no_delay(std::uintptr_t s)
+	{
+		int no_delay = 1;
+		setsockopt(native(s), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const*>(&no_delay), sizeof(no_delay));
+	}
+}
+
+bool parse_host_port(char const* text, std::string& host, std::uint16_t& port)
+{
+	std::string value(text);
+	auto colon = value.rfind(':');
+
+	if (colon == std::string::npos || colon == 0)
+		return false;
+
+	auto number = std::atoi(value.c_str() + colon + 1);
+
+	if (number <= 0 || number >= 65536)
+		return false;
+
+	host = value.substr(0, colon);
+	port = static_cast<std::uint16_t>(number);
+	return true;
+}
+
+farm_connection::~farm_connection()
+{
+	close();
+}
+
+bool farm_connection::connect(std::string const& host, std::uint16_t port)
+{
+	close();
+
+#ifdef _WIN32
+	if (!start_winsock(started_))
+		return false;
+#endif
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	addrinfo* addresses = nullptr;
+
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+	{
+		std::cout << "Can't resolve " << host << "\n";
+		return false;
+	}
+
+	for (auto a = addresses; a && socket_ == kNoSocket; a = a->ai_next)
+	{
+		socket_ = static_cast<std::uintptr_t>(socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+
+		if (socket_ != kNoSocket && ::connect(native(socket_), a->ai_addr, static_cast<int>(a->ai_addrlen)) != 0)
+		{
+			close_socket(socket_);
+			socket_ = kNoSocket;
+		}
+	}
+
+	freeaddrinfo(addresses);
+
+	if (socket_ == kNoSocket)
+	{
+		close();
+		std::cout << "Can't connect to " << host << ":" << port << "\n";
+		return false;
+	}
+
+	set_no_delay(socket_);
+	return true;
+}
+
+void farm_connection::close()
+{
+	if (socket_ != kNoSocket)
+		close_socket(socket_);
+
+	socket_ = kNoSocket;
+
+#ifdef _WIN32
+	if (started_)
+		WSACleanup();
+
+	started_ = false;
+#endif
+}
+
+bool farm_connection::send(farm_message type, void const* head, std::size_t head_size, void const* data, std::size_t data_size)
+{
+	farm_message_header header = { type, 0, head_size + data_size };
+
+	return send_bytes(&header, sizeof(header)) && send_bytes(head, head_size) && send_bytes(data, data_size);
+}
+
+bool farm_connection::receive(farm_message& type, std::string& payload)
+{
+	farm_message_header header;
+
+	if (!receive_bytes(&header, sizeof(header)))
+		return false;
+
+	// an unknown type or a size beyond what the type can hold is no peer of ours, don't allocate it
+	auto index = static_cast<std::uint32_t>(header.type) - 1;
+
+	if (index >= kNumFarmMessages || header.size > limits_[index])
+	{
+		close();
+		return false;
+	}
+
+	type = header.type;
+	payload.resize(static_cast<std::size_t>(header.size));
+
+	return payload.empty() || receive_bytes(&payload[0], payload.size());
+}
+
+void farm_connection::set_limit(farm_message type, std::uint64_t max_size)
+{
+	limits_[static_cast<std::uint32_t>(type) - 1] = max_size;
+}
+
+bool farm_connection::send_bytes(void const* data, std::size_t size)
+{
+	if (socket_ == kNoSocket)
+		return false;
+
+	auto bytes = static_cast<char const*>(data);
+
+	for (std::size_t sent = 0; sent < size;)
+	{
+		// one call sends at most an int's worth
+		auto count = ::send(native(socket_), bytes + sent, static_cast<int>(std::min<std::size_t>(size - sent, 1U << 30)), kSendFlags);
+
+		if (count <= 0)
+		{
+			close();
+			return false;
+		}
+
+		sent += static_cast<std::size_t>(count);
+	}
+
+	return true;
+}
+
+bool farm_connection::receive_bytes(void* data, std::size_t size)
+{
+	if (socket_ == kNoSocket)
+		return false;
+
+	auto bytes = static_cast<char*>(data);
+
+	for (std::size_t received = 0; received < size;)
+	{
+		auto count = recv(native(socket_), bytes + received, static_cast<int>(std::min<std::size_t>(size - received, 1U << 30)), 0);
+
+		if (count <= 0)
+		{
+			close();
+			return false;
+		}
+
+		received += static_cast<std::size_t>(count);
+	}
+
+	return true;
+}
+
+farm_listener::~farm_listener()
+{
+	close();
+}
+
+bool farm_listener::listen(std::uint16_t port)
+{
+	close();
+
+#ifdef _WIN32
+	if (!start_winsock(started_))
+		return false;
+#endif
+
+	server_ = static_cast<std::uintptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+
+#ifndef _WIN32
+	// see line_server::listen
+	int reuse = 1;
+
+	if (server_ != farm_connection::kNoSocket)
+		setsockopt(native(server_), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (server_ == farm_connection::kNoSocket || bind(native(server_), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0 ||
+	    ::listen(native(server_), kBacklog) != 0)
+	{
+		close();
+		std::cout << "Can't listen on port " << port << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+void farm_listener::close()
+{
+	if (server_ != farm_connection::kNoSocket)
+		close_socket(server_);
+
+	server_ = farm_connection::kNoSocket;
+
+#ifdef _WIN32
+	if (started_)
+		WSACleanup();
+
+	started_ = false;
+#endif
+}
+
+bool farm_listener::accept(farm_connection& worker)
+{
+	worker.close();
+
+	if (server_ == farm_connection::kNoSocket)
+		return false;
+
+	auto s = static_cast<std::uintptr_t>(::accept(native(server_), nullptr, nullptr));
+
+	if (s == farm_connection::kNoSocket)
+		return false;
+
+	set_no_delay(s);
+	worker.socket_ = s;
+
+#ifdef _WIN32
+	// the connection may outlive the listener
+	start_winsock(worker.started_);
+#endif
+
+	return true;
+}
+
+void encode_pixels(unsigned char const* pixels, std::size_t size, std::size_t pixel_bytes, std::string& out)
+{
+	auto num_pixels = size / pixel_bytes;
+
+	out.clear();
+	out.reserve(size / 4);
+
+	auto put_count = [&](std::size_t count, std::uint16_t flag)
+	{
+		std::uint16_t field = static_cast<std::uint16_t>(count - 1) | flag;
+		out.append(reinterpret_cast<char const*>(&field), sizeof(field));
+	};
+
+	std::size_t literal_begin = 0;
+
+	auto flush_literals = [&](std::size_t end)
+	{
+		for (auto p = literal_begin; p < end; p += kMaxRun)
+		{
+			auto count = std::min(kMaxRun, end - p);
+			put_count(count, 0);
+			out.append(reinterpret_cast<char const*>(pixels + p * pixel_bytes), count * pixel_bytes);
+		}
+	};
+
+	for (std::size_t p = 0; p < num_pixels;)
+	{
+		// the bytes after pixel p equal the ones a pixel before them as long as the pixels repeat
+		auto span = (std::min(num_pixels - p, kMaxRun) - 1) * pixel_bytes;
+		auto run = 1 + common_prefix(pixels + p * pixel_bytes, pixels + (p + 1) * pixel_bytes, span) / pixel_bytes;
+
+		// a run of two costs as much as two literals
+		if (run < 3)
+		{
+			p += run;
+			continue;
+		}
+
+		flush_literals(p);
+		put_count(run, kRepeatFlag);
+		out.append(reinterpret_cast<char const*>(pixels + p * pixel_bytes), pixel_bytes);
+
+		p += run;
+		literal_begin = p;
+	}
+
+	flush_literals(num_pixels);
+}
+
+bool decode_pixels(char const* data, std::size_t data_size, std::size_t pixel_bytes, unsigned char* pixels, std::size_t size)
+{
+	std::size_t read = 0, written = 0;
+
+	while (read + sizeof(std::uint16_t) <= data_size)
+	{
+		std::uint16_t field;
+		std::memcpy(&field, data + read, sizeof(field));
+		read += sizeof(field);
+
+		auto count = std::size_t(field & ~kRepeatFlag) + 1;
+		auto bytes = count * pixel_bytes;
+		bool repeat = (field & kRepeatFlag) != 0;
+
+		if (written + bytes > size || read + (repeat ? pixel_bytes : bytes) > data_size)
+			return false;
+
+		if (repeat)
+		{
+			std::memcpy(pixels + written, data + read, pixel_bytes);
+			fill_pattern(pixels + written, pixel_bytes, bytes);
+			read += pixel_bytes;
+		}
+		else
+		{
+			std::memcpy(pixels + written, data + read, bytes);
+			read += bytes;
+		}
+
+		written += bytes;
+	}
+
+	return read == data_size && written == size;
+}
+
+void encode_lz4(unsigned char const* data, std::size_t size, std::string& out)
+{
+	out.clear();
+	out.reserve(size / 4);
+
+	std::size_t anchor = 0;
+
+	if (size > kMatchLimit)
+	{
+		// greedy parse, positions + 1 of the last sequences so 0 is none
+		std::vector<std::uint32_t> table(std::size_t(1) << kLz4HashBits, 0U);
+		auto const match_end = size - kLastLiterals;
+
+		for (std::size_t p = 0; p + kMatchLimit < size;)
+		{
+			auto sequence = load32(data + p);
+			auto hash = (sequence * 2654435761U) >> (32 - kLz4HashBits);
+			std::size_t candidate = table[hash];
+			table[hash] = static_cast<std::uint32_t>(p + 1);
+
+			if (candidate == 0 || p + 1 - candidate > kMaxOffset || load32(data + candidate - 1) != sequence)
+			{
+				// literals that find no match are skipped faster and faster, as LZ4 does
+				p += 1 + ((p - anchor) >> 6);
+				continue;
+			}
+
+			--candidate;
+
+			auto length = kMinMatch + common_prefix(data + candidate + kMinMatch, data + p + kMinMatch, match_end - p - kMinMatch);
+			put_sequence(data, anchor, p - anchor, p - candidate, length, out);
+
+			p += length;
+			anchor = p;
+		}
+	}
+
+	put_sequence(data, anchor, size - anchor, 0, 0, out);
+}
+
+bool decode_lz4(char const* data, std::size_t data_size, unsigned char* out, std::size_t size)
+{
+	std::size_t read = 0, written = 0;
+
+	while (read < data_size)
+	{
+		auto token = static_cast<unsigned char>(data[read++]);
+		std::size_t literals = token >> 4;
+
+		if (literals == 15 && !get_length(data, data_size, read, literals))
+			return false;
+
+		if (literals > data_size - read || literals > size - written)
+			return false;
+
+		std::memcpy(out + written, data + read, literals);
+		read += literals;
+		written += literals;
+
+		// the last sequence has no match
+		if (read == data_size)
+			break;
+
+		if (data_size - read < 2)
+			return false;
+
+		std::size_t offset = static_cast<unsigned char>(data[read]) | std::size_t(static_cast<unsigned char>(data[read + 1])) << 8;
+		read += 2;
+
+		std::size_t length = token & 15U;
+
+		if (length == 15 && !get_length(data, data_size, read, length))
+			return false;
+
+		length += kMinMatch;
+
+		if (offset == 0 || offset > written || length > size - written)
+			return false;
+
+		// a match closer than its length repeats its first offset bytes
+		if (offset >= length)
+		{
+			std::memcpy(out + written, out + written - offset, length);
+		}
+		else
+		{
+			std::memcpy(out + written, out + written - offset, offset);
+			fill_pattern(out + written, offset, length);
+		}
+
+		written += length;
+	}
+
+	return written == size;
+}
+
+void encode_band(unsigned char const* pixels, std::size_t size, std::size_t pixel_bytes, std::string& out)
+{
+	std::string encoded;
+	auto encoding = farm_encoding::rle;
+	encode_pixels(pixels, size, pixel_bytes, encoded);
+
+	// runs don't catch bands that repeat at longer distances, such as rows of the same spheres
+	if (encoded.size() > size / kLz4Fallback)
+	{
+		std::string lz4;
+		encode_lz4(pixels, size, lz4);
+
+		if (lz4.size() < encoded.size())
+		{
+			encoding = farm_encoding::lz4;
+			encoded.swap(lz4);
+		}
+	}
+
+	out.assign(reinterpret_cast<char const*>(&encoding), sizeof(encoding));
+	out += encoded;
+}
+
+std::size_t max_encoded_band(std::size_t size, std::size_t pixel_bytes)
+{
+	// LZ4 is only taken when it is shorter than the runs
+	return sizeof(farm_encoding) + size + size / pixel_bytes * sizeof(std::uint16_t);
+}
+
+bool decode_band(char const* data, std::size_t data_size, std::size_t pixel_bytes, unsigned char* pixels, std::size_t size)
+{
+	farm_encoding encoding;
+
+	if (data_size < sizeof(encoding))
+		return false;
+
+	std::memcpy(&encoding, data, sizeof(encoding));
+	data += sizeof(encoding);
+	data_size -= sizeof(encoding);
+
+	switch (encoding)
+	{
+	case farm_encoding::rle: return decode_pixels(data, data_size, pixel_bytes, pixels, size);
+	case farm_encoding::lz4: return decode_lz4(data, data_size, pixels, size);
+	default: return false;
+	}
+}
+
+farm_scheduler::farm_scheduler(std::uint32_t num_bands)
+	: bands_(num_bands)
+{
+	for (std::uint32_t b = 0; b < num_bands; ++b)
+	{
+		queue_.push_back(b);
+	}
+}
+
+bool farm_scheduler::take(std::uint32_t worker, std::uint32_t& band)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto now = clock::now();
+
+	if (!queue_.empty())
+	{
+		band = queue_.front();
+		queue_.pop_front();
+
+		auto& state = bands_[band];
+		state.issued = 1;
+		state.running = 1;
+		state.owner = worker;
+		state.start = now;
+		return true;
+	}
+
+	if (times_.empty())
+		return false;
+
+	// the median band time of the bands done so far
+	auto times = times_;
+	std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+	auto limit = kSpeculateFactor * times[times.size() / 2];
+
+	// the straggler issued longest ago
+	bool found = false;
+
+	for (std::uint32_t b = 0; b < bands_.size(); ++b)
+	{
+		auto const& state = bands_[b];
+
+		if (state.claimed || state.done || state.issued != 1 || state.running == 0 || state.owner == worker ||
+		    std::chrono::duration<double, std::milli>(now - state.start).count() <= limit)
+			continue;
+
+		if (!found || state.start < bands_[band].start)
+		{
+			band = b;
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	++bands_[band].issued;
+	++bands_[band].running;
+	++reissued_;
+	return true;
+}
+
+bool farm_scheduler::claim(std::uint32_t band)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto& state = bands_[band];
+	--state.running;
+
+	if (state.claimed || state.done)
+		return false;
+
+	state.claimed = true;
+	return true;
+}
+
+void farm_scheduler::complete(std::uint32_t band, double ms)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		bands_[band].done = true;
+		times_.push_back(ms);
+		++done_;
+	}
+
+	changed_.notify_all();
+}
+
+void farm_scheduler::give_back(std::uint32_t band, bool claimed)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto& state = bands_[band];
+
+		if (claimed)
+			state.claimed = false;
+		else
+			--state.running;
+
+		if (state.done || state.claimed || state.running > 0)
+			return;
+
+		// hand it out first, it may hold up the frame already
+		state.issued = 0;
+		queue_.push_front(band);
+	}
+
+	changed_.notify_all();
+}
+
+void farm_scheduler::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (queue_.empty() && done_ < bands_.size())
+	{
+		// a running band may turn into a straggler without anything to notify
+		changed_.wait_for(lock, std::chrono::milliseconds(10));
+	}
+}
+
+void farm_scheduler::add_worker()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	++workers_;
+}
+
+void farm_scheduler::remove_worker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		--workers_;
+	}
+
+	changed_.notify_all();
+}
+
+bool farm_scheduler::wait_finished()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	changed_.wait(lock, [&] { return done_ == bands_.size() || workers_ == 0; });
+	return done_ == bands_.size();
+}
+
+bool farm_scheduler::finished()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return done_ == bands_.size();
+}
+
+std::uint32_t farm_scheduler::reissued()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return reissued_;
+}
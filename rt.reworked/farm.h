@@ -0,0 +1,247 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "grid.h"
+
+// Render farm: a coordinator sends the scene, as the bytes of a scene file, and the job to
+// every worker, then hands out bands of rows to them and assembles the image from the bands
+// they send back. A band that runs much longer than the others is issued a second time to an
+// idle worker, the first result wins.
+//
+// Every message is a farm_message_header followed by size bytes of payload, little endian:
+// * scene: the scene file (see scene_file_bytes), coordinator to worker
+// * job: farm_job, coordinator to worker
+// * band: farm_band, coordinator to worker
+// * result: farm_band and the band's pixels in the job's format, encoded by encode_band
+// * done: empty, the worker disconnects
+// A message of another type or larger than its limit (farm_connection::set_limit) drops the
+// connection.
+enum class farm_message : std::uint32_t
+{
+	scene = 1,
+	job,
+	band,
+	result,
+	done
+};
+
+std::uint32_t const kNumFarmMessages = 5;
+
+struct farm_message_header
+{
+	farm_message type;
+	// zero, aligns size
+	std::uint32_t reserved;
+	std::uint64_t size;
+};
+
+// Image, structure and framebuffer layout the worker renders the bands of
+struct farm_job
+{
+	ortho_view view;
+	// accel_mode and pixel_format
+	std::uint32_t mode;
+	std::uint32_t format;
+};
+
+// Rows [y_begin, y_end) of the image, band index of the coordinator
+struct farm_band
+{
+	std::uint32_t index;
+	std::uint32_t y_begin, y_end;
+};
+
+// Rows per band the coordinator hands out
+std::uint32_t const kFarmBandRows = 64;
+
+// Bands the coordinator sends a worker ahead of its results, so the next one is there when the
+// worker finishes one
+std::uint32_t const kFarmBandsInFlight = 2;
+
+// Largest scene message a worker accepts, 16 GiB, some hundred million spheres with their BVH
+std::uint64_t const kFarmMaxSceneBytes = std::uint64_t(1) << 34;
+
+// Parse host:port. Returns false and leaves host and port untouched if text isn't one.
+bool parse_host_port(char const* text, std::string& host, std::uint16_t& port);
+
+// One end of a farm connection, on either side
+class farm_connection
+{
+public:
+	farm_connection() = default;
+	~farm_connection();
+
+	farm_connection(farm_connection const&) = delete;
+	farm_connection& operator=(farm_connection const&) = delete;
+
+	// Connect to the coordinator at host:port. Returns false with a message if it can't.
+	bool connect(std::string const& host, std::uint16_t port);
+	void close();
+
+	// Send one message of payload head followed by data, false if the peer has disconnected
+	bool send(farm_message type, void const* head, std::size_t head_size, void const* data = nullptr, std::size_t data_size = 0);
+
+	// Receive the next message into type and payload, false if the peer has disconnected or
+	// sent a message of an unknown type or above its limit, which closes the connection
+	bool receive(farm_message& type, std::string& payload);
+
+	// Largest payload receive() accepts in a message of type. The job, band and done messages
+	// are limited to their size, scene messages to kFarmMaxSceneBytes, result messages to none
+	// until the coordinator sets the size of a band, see max_encoded_band().
+	void set_limit(farm_message type, std::uint64_t max_size);
+
+private:
+	friend class farm_listener;
+
+	bool send_bytes(void const* data, std::size_t size);
+	bool receive_bytes(void* data, std::size_t size);
+
+	// SOCKET on Windows, file descriptor elsewhere; kNoSocket if not open
+	static std::uintptr_t const kNoSocket = ~std::uintptr_t(0);
+
+	std::uintptr_t socket_ = kNoSocket;
+	// by farm_message - 1
+	std::uint64_t limits_[kNumFarmMessages] = { kFarmMaxSceneBytes, sizeof(farm_job), sizeof(farm_band), 0, 0 };
+#ifdef _WIN32
+	bool started_ = false;
+#endif
+};
+
+// Coordinator socket the workers connect to. Unlike line_server it listens on every
+// interface, the workers run on other machines.
+class farm_listener
+{
+public:
+	farm_listener() = default;
+	~farm_listener();
+
+	farm_listener(farm_listener const&) = delete;
+	farm_listener& operator=(farm_listener const&) = delete;
+
+	// Listen on port. Returns false with a message if the port can't be bound.
+	bool listen(std::uint16_t port);
+	void close();
+
+	// Wait for the next worker and hand its connection to worker, false if the socket failed
+	bool accept(farm_connection& worker);
+
+private:
+	std::uintptr_t server_ = farm_connection::kNoSocket;
+#ifdef _WIN32
+	bool started_ = false;
+#endif
+};
+
+// Encoding of a band in a result message
+enum class farm_encoding : std::uint32_t
+{
+	// encode_pixels
+	rle = 1,
+	// encode_lz4
+	lz4
+};
+
+// Run-length encode the pixels of size bytes, pixel_bytes each, into out: runs of up to 32768
+// equal pixels become a 16-bit count with the high bit set and the pixel, the pixels between
+// them a 16-bit count and the pixels as they are. Backgrounds and flat shaded spheres shrink
+// to a few bytes per run, other pixels grow by 2 bytes per 32768. The id formats make the
+// longest runs, a run is one sphere whatever its shading.
+void encode_pixels(unsigned char const* pixels, std::size_t size, std::size_t pixel_bytes, std::string& out);
+
+// Decode what encode_pixels wrote into the size bytes at pixels. Returns false if data does
+// not decode to exactly size bytes.
+bool decode_pixels(char const* data, std::size_t data_size, std::size_t pixel_bytes, unsigned char* pixels, std::size_t size);
+
+// Compress the size bytes of data into out in the LZ4 block format, with a greedy parse of
+// 4-byte hashes as LZ4's fast level does. Matches up to 64 KB back also catch rows repeating
+// the one above.
+void encode_lz4(unsigned char const* data, std::size_t size, std::string& out);
+
+// Decompress the LZ4 block data into the size bytes at out. Returns false if it is not a
+// block of exactly size bytes.
+bool decode_lz4(char const* data, std::size_t data_size, unsigned char* out, std::size_t size);
+
+// Encode a band for a result message: its farm_encoding, then the runs of encode_pixels or, if
+// they leave more than a quarter of the bytes and LZ4 does better, the LZ4 block
+void encode_band(unsigned char const* pixels, std::size_t size, std::size_t pixel_bytes, std::string& out);
+
+// Most bytes encode_band() writes for size bytes of pixel_bytes pixels: the encoding, the
+// pixels and, at worst, a count of encode_pixels for every pixel
+std::size_t max_encoded_band(std::size_t size, std::size_t pixel_bytes);
+
+// Decode what encode_band wrote into the size bytes at pixels, false if data is not a band of
+// exactly size bytes
+bool decode_band(char const* data, std::size_t data_size, std::size_t pixel_bytes, unsigned char* pixels, std::size_t size);
+
+// Which bands the coordinator still has to hand out, which ones run on workers and which ones
+// are done, shared by the threads talking to the workers
+class farm_scheduler
+{
+public:
+	// A band running longer than kSpeculateFactor times the median band is issued again
+	static double constexpr kSpeculateFactor = 2.0;
+
+	explicit farm_scheduler(std::uint32_t num_bands);
+
+	// Next band for worker: one never issued, else one running on another worker for more
+	// than kSpeculateFactor times the median band time and issued only once. Returns false
+	// if there is none right now.
+	bool take(std::uint32_t worker, std::uint32_t& band);
+
+	// A result of band arrived. Returns true for the first one, which the caller copies into
+	// the image before calling complete(); false for the result of a band done already.
+	bool claim(std::uint32_t band);
+
+	// The first result of band, which took ms on its worker, is in the image
+	void complete(std::uint32_t band, double ms);
+
+	// A worker that ran band is gone or sent a result that does not decode. The band is
+	// handed out again unless another worker runs or has finished it.
+	void give_back(std::uint32_t band, bool claimed);
+
+	// Wait until a band may be available to take() or all are done
+	void wait();
+
+	// A thread talking to a worker starts or ends
+	void add_worker();
+	void remove_worker();
+
+	// Wait until every band is done, true, or every worker is gone before, false
+	bool wait_finished();
+
+	bool finished();
+
+	// Bands issued a second time
+	std::uint32_t reissued();
+
+private:
+	typedef std::chrono::high_resolution_clock clock;
+
+	struct band_state
+	{
+		std::uint32_t issued = 0;
+		std::uint32_t running = 0;
+		std::uint32_t owner = 0;
+		bool claimed = false;
+		bool done = false;
+		clock::time_point start;
+	};
+
+	std::mutex mutex_;
+	std::condition_variable changed_;
+	std::vector<band_state> bands_;
+	// Bands to hand out, in order
+	std::deque<std::uint32_t> queue_;
+	std::vector<double> times_;
+	std::uint32_t done_ = 0;
+	std::uint32_t workers_ = 0;
+	std::uint32_t reissued_ = 0;
+};
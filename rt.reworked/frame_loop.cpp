@@ -0,0 +1,809 @@
+#include "frame_loop.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "device_memory.h"
+#include "framebuffer_pool.h"
+#include "host_memory.h"
+#include "image_compare.h"
+#include "image_writer.h"
+#include "numa.h"
+#include "output_files.h"
+#include "parallel_executors.h"
+#include "pixel_cost.h"
+#include "pixel_format.h"
+#include "post_process.h"
+#include "profile_markers.h"
+#include "ray_queries.h"
+#include "shared_framebuffer.h"
+#include "thread_pool.h"
+#include "thread_scaling.h"
+
+namespace
+{
+	// Rows and columns between the rays whose BVH traffic the benchmarks measure
+	std::uint32_t const kTrafficStride = 4;
+	// Spheres --stats lists with the pixels they won, the ones with the most
+	std::size_t const kTopSpheres = 10;
+
+	// Hands out bands of whole kGroupTileSize row blocks, top to bottom, to every GPU and
+	// CPU worker rendering the same frame. A take is a compare and swap of the next block, no
+	// thread waits on a lock for its band.
+	class row_dispenser
+	{
+	public:
+		explicit row_dispenser(std::uint32_t image_height)
+			: image_height_(image_height)
+		{
+		}
+
+		// Take fraction of the remaining blocks but at least min_blocks, as rows [row_begin, row_end).
+		// Returns false once the whole image has been handed out.
+		bool take(double fraction, std::uint32_t min_blocks, std::uint32_t& row_begin, std::uint32_t& row_end)
+		{
+			auto const num_blocks = (image_height_ + kGroupTileSize - 1) / kGroupTileSize;
+
+			auto first = next_block_.load(std::memory_order_relaxed);
+			std::uint32_t blocks;
+
+			do
+			{
+				if (first >= num_blocks)
+					return false;
+
+				auto remaining = num_blocks - first;
+				blocks = std::max(min_blocks, static_cast<std::uint32_t>(remaining * fraction));
+				blocks = std::min(std::max(blocks, 1U), remaining);
+			} while (!next_block_.compare_exchange_weak(first, first + blocks, std::memory_order_relaxed));
+
+			row_begin = first * kGroupTileSize;
+			row_end = std::min((first + blocks) * kGroupTileSize, image_height_);
+
+			return true;
+		}
+
+	private:
+		std::uint32_t image_height_;
+		std::atomic<std::uint32_t> next_block_{ 0 };
+	};
+
+	// Render one frame with the GPUs and the CPU pool pulling bands from one dispenser.
+	// GPUs take guided chunks, a shrinking share of what is left, so they get big launches
+	// early and small ones at the end; CPU workers take one block at a time. Both produce the
+	// same pixels: CPU workers write their rows into img in format. report prints who rendered
+	// how many rows.
+	void render_hybrid(std::vector<render_device>& devices, thread_pool& pool, render_scene const& scene, simd_isa isa, pixel_format format,
+	                   std::vector<unsigned char>& img, bool report)
+	{
+		row_dispenser rows(scene.view.image_height);
+
+		double gpu_fraction = 1.0 / (2 * (devices.size() + 1));
+		std::vector<std::uint32_t> gpu_rows(devices.size(), 0U);
+		std::atomic<std::uint32_t> cpu_rows(0U);
+
+		std::vector<std::thread> drivers;
+
+		for (std::size_t d = 0; d < devices.size(); ++d)
+		{
+			drivers.emplace_back([&, d]
+			{
+				auto& dev = devices[d];
+				dev.kernel_time = dev.transfer_time = 0.0;
+
+				name_timeline_thread("driver of " + dev.name);
+
+				std::uint32_t row_begin, row_end;
+
+				while (rows.take(gpu_fraction, 4U, row_begin, row_end))
+				{
+					cl::Event kernel_event;
+					enqueue_band(dev, row_begin, row_end, &img[0], &kernel_event);
+					dev.queue.finish();
+
+					auto const& first_kernel = dev.persistent ? kernel_event : dev.first_kernel;
+
+					dev.kernel_profile = profile(first_kernel, kernel_event);
+					dev.kernel_time += dev.kernel_profile.run;
+					record_command(dev, "trace", first_kernel, kernel_event);
+					dev.transfer_time += finish_band(dev, row_begin, row_end, &img[0]);
+
+					gpu_rows[d] += row_end - row_begin;
+				}
+			});
+		}
+
+		pool.run_each([&](std::uint32_t)
+		{
+			std::uint32_t row_begin, row_end;
+
+			while (rows.take(0.0, 1U, row_begin, row_end))
+			{
+				auto width = scene.view.image_width;
+				double start = timeline_enabled() ? timeline_now() : 0.0;
+
+				for (auto y = row_begin; y < row_end; y += kTileSize)
+				{
+					for (auto x = 0U; x < width; x += kTileSize)
+					{
+						render_tile(scene, isa, format, tile{ x, y, std::min(x + kTileSize, width), std::min(y + kTileSize, row_end) }, &img[0]);
+					}
+				}
+
+				cpu_rows += row_end - row_begin;
+
+				if (timeline_enabled())
+					timeline_span("rows " + std::to_string(row_begin) + "-" + std::to_string(row_end), start, timeline_now() - start);
+			}
+		});
+
+		for (auto& driver : drivers)
+		{
+			driver.join();
+		}
+
+		if (!report)
+			return;
+
+		for (std::size_t d = 0; d < devices.size(); ++d)
+		{
+			std::cout << "  " << devices[d].name << ": " << gpu_rows[d] << " rows, kernel " << devices[d].kernel_time << " ms, transfer "
+			          << devices[d].transfer_time << " ms\n";
+			print_profile(devices[d]);
+		}
+
+		std::cout << "  CPU (" << pool.size() << " threads): " << cpu_rows << " rows\n";
+	}
+
+	// How many spheres the rays of the pixels cross, out of the k nearest hits of each
+	void print_depth_complexity(std::vector<ray_hit> const& hits, std::uint32_t k)
+	{
+		std::size_t pixels = hits.size() / k;
+		std::uint64_t total = 0;
+		std::size_t missed = 0, full = 0;
+
+		for (std::size_t p = 0; p < pixels; ++p)
+		{
+			std::uint32_t count = 0;
+
+			while (count < k && hits[k * p + count].id >= 0)
+				++count;
+
+			total += count;
+			missed += count == 0;
+			full += count == k;
+		}
+
+		std::cout << "Depth complexity: " << double(total) / double(std::max<std::size_t>(pixels, 1)) << " hits per pixel, " << missed << " pixels hit nothing, "
+		          << full << " hit " << k << " spheres or more\n";
+	}
+
+	// Print the statistics of a frame of --stats: its channels, its coverage and the spheres that won
+	// the most pixels, named by their index in the full set if sphere_ids maps a culled one
+	void print_frame_stats(frame_stats const& stats, std::vector<std::uint32_t> const& sphere_ids)
+	{
+		char const* const channels[] = { "r", "g", "b" };
+
+		std::vector<std::uint32_t> visible;
+
+		for (std::uint32_t k = 0; k < stats.hits.size(); ++k)
+		{
+			if (stats.hits[k] != 0)
+				visible.push_back(k);
+		}
+
+		std::cout << "Frame statistics in " << stats.time << " ms: " << 100.0 * stats.coverage << "% covered by " << visible.size() << " of " << stats.hits.size()
+		          << " spheres\n";
+
+		for (auto ch = 0; ch < 3; ++ch)
+		{
+			std::cout << "  " << channels[ch] << " min " << stats.min[ch] << " max " << stats.max[ch] << " mean " << stats.mean[ch] << "\n";
+		}
+
+		auto shown = std::min<std::size_t>(visible.size(), kTopSpheres);
+
+		std::partial_sort(visible.begin(), visible.begin() + shown, visible.end(), [&](std::uint32_t a, std::uint32_t b)
+		{
+			return stats.hits[a] > stats.hits[b] || (stats.hits[a] == stats.hits[b] && a < b);
+		});
+
+		for (std::size_t n = 0; n < shown; ++n)
+		{
+			auto k = visible[n];
+			std::cout << "  sphere " << (sphere_ids.empty() ? k : sphere_ids[k]) << ": " << stats.hits[k] << " pixels\n";
+		}
+	}
+}
+
+void add_bvh_traffic(render_scene const& scene, bool gpu, simd_isa isa, bench_result& result)
+{
+	if (scene.mode != accel_mode::bvh || scene.instances || scene.accel.nodes.empty())
+		return;
+
+	auto traffic = measure_bvh_traffic(scene, kTrafficStride);
+
+	if (gpu && !scene.compressed_nodes.empty())
+	{
+		result.structure_bytes = static_cast<double>(sizeof(compressed_bvh_node) * scene.compressed_nodes.size());
+		result.node_bytes_per_ray = traffic.compressed;
+		result.node_misses_per_ray = traffic.compressed_misses;
+		result.node_pages_per_ray = traffic.compressed_pages;
+	}
+	else if (!gpu && (isa == simd_isa::avx2 || isa == simd_isa::avx512) && !scene.accel8.empty())
+	{
+		result.structure_bytes = static_cast<double>(sizeof(bvh8_node) * scene.accel8.size());
+		result.node_bytes_per_ray = traffic.wide;
+		result.node_misses_per_ray = traffic.wide_misses;
+		result.node_pages_per_ray = traffic.wide_pages;
+	}
+	else
+	{
+		result.structure_bytes = static_cast<double>(sizeof(bvh_node) * scene.accel.nodes.size());
+		result.node_bytes_per_ray = traffic.full;
+		result.node_misses_per_ray = traffic.full_misses;
+		result.node_pages_per_ray = traffic.full_pages;
+	}
+}
+
+int run_frame_loop(run_options& options, render_scene& scene, std::vector<render_device>& devices, hip_device& hip, vulkan_device& vulkan,
+                   sphere_textures const& textures, primitive_set const& primitives, std::chrono::high_resolution_clock::time_point startup_start,
+                   std::function<void(double frame_ms)> const& log_plan)
+{
+	// the cpu backend runs its tiles on the pool, or on the executor of another runtime, which
+	// then leaves the pool a single idle thread
+	auto runtime_executor = make_executor(options.runtime, options.num_threads);
+
+	// the gpu, hip and vulkan backends don't use the pool, keep it to a single idle thread. The
+	// cpu backend spreads its workers over the NUMA nodes of the machine, if it has more than one.
+	bool uses_pool = (options.backend == render_backend::cpu && !runtime_executor) || options.backend == render_backend::hybrid;
+	auto placement = !options.affinity.empty() ? options.affinity[0] : uses_pool && options.backend == render_backend::cpu ? thread_affinity::node : thread_affinity::none;
+	auto topology = uses_pool ? affinity_topology(placement, options.num_threads, detect_numa_topology()) : numa_topology();
+	thread_pool pool(uses_pool ? options.num_threads : 1U, topology);
+	tile_executor& cpu_executor = runtime_executor ? *runtime_executor : static_cast<tile_executor&>(pool);
+
+	if (runtime_executor)
+	{
+		std::cout << "Using " << cpu_executor.size() << " " << parallel_runtime_name(options.runtime) << " threads, "
+		          << (scene.mode == accel_mode::none ? simd_isa_name(options.isa) : accel_mode_name(scene.mode)) << "\n";
+	}
+	else if (uses_pool)
+	{
+		std::cout << "Using " << pool.size() << " CPU threads, " << (scene.mode == accel_mode::none ? simd_isa_name(options.isa) : accel_mode_name(scene.mode)) << "\n";
+
+		if (!pool.pinned())
+			std::cout << "Can't pin every worker for " << thread_affinity_name(placement) << " affinity, the OS places some of them\n";
+	}
+
+	if (!options.query_rays_path.empty())
+	{
+		std::vector<float> columns;
+		ray_batch rays;
+
+		if (!load_ray_batch(options.query_rays_path, columns, rays))
+			return 1;
+
+		std::vector<float> t(rays.count);
+		std::vector<std::int32_t> ids(rays.count);
+		bool gpu = options.backend == render_backend::gpu;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		bool queried = gpu ? query_rays(devices[0], scene, rays, options.sort_query_rays, t.data(), ids.data())
+		                   : closest_hits(cpu_executor, scene, rays, options.sort_query_rays, t.data(), ids.data());
+		auto seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (!queried)
+			return -1;
+
+		auto hits = std::count_if(ids.begin(), ids.end(), [](std::int32_t id) { return id >= 0; });
+		bool walk = scene.mode == accel_mode::bvh && (gpu ? scene.compressed_nodes.empty() : walks_bvh(scene));
+
+		std::cout << "Queried " << rays.count << " rays" << (options.sort_query_rays ? " sorted" : "") << (walk ? " through the BVH" : " against every sphere") << " in "
+		          << seconds * 1000.0 << " ms, " << rays.count / std::max(seconds, 1e-9) / 1e6 << " Mrays/s, " << hits << " hit a sphere\n";
+
+		return save_ray_hits(options.query_hits_path, t.data(), ids.data(), rays.count) ? 0 : 1;
+	}
+
+	std::size_t num_pixels = std::size_t(options.view.image_width) * options.view.image_height;
+
+	// on several nodes every node traces through its own copy of the scene, into an image whose
+	// bands were first touched by the workers rendering them; the frame is copied into img after.
+	// The copies render colors, sphere indices are traced through the scene itself.
+	std::vector<std::unique_ptr<render_scene>> replicas;
+	std::unique_ptr<float[]> numa_img;
+
+	// the nodes of the other affinities are single processors
+	if (!is_id_format(options.format) && options.textures_path.empty() && options.primitives_path.empty() && placement == thread_affinity::node)
+		replicas = replicate_scene(pool, scene);
+
+	if (!replicas.empty())
+	{
+		std::cout << "Using " << pool.num_nodes() << " NUMA nodes, one scene copy each\n";
+
+		numa_img.reset(new float[num_pixels * 3]);
+		first_touch(pool, options.view, numa_img.get());
+
+		if (options.balance)
+		{
+			std::cout << "The scene copies trace the tiles first_touch placed, rendering without --balance\n";
+			options.balance = false;
+		}
+	}
+
+	// the replicas trace the scanline tiles first_touch placed
+	if (options.backend == render_backend::cpu && replicas.empty() && options.balance)
+	{
+		std::cout << "Tiles of " << kTileSize << "x" << kTileSize << " split and merged by their cost\n";
+	}
+	else if (options.backend == render_backend::cpu && replicas.empty())
+	{
+		scene.tile_size = cache_tile_size(scene, detect_l2_cache_size());
+		std::cout << "Tiles of " << scene.tile_size << "x" << scene.tile_size << " in " << tile_order_name(scene.tiles) << " order\n";
+	}
+
+	// the frames written to files come back to the pool for the next frame
+	framebuffer_pool frames;
+	auto img = frames.acquire(pixel_size(options.format) * num_pixels);
+
+	// the file gets rgb in the framebuffer's channel type, the stride skips the alpha of rgba8;
+	// sphere indices are written as the rgb floats of their colors
+	auto file_format = is_id_format(options.format) ? pixel_format::float32 : options.format;
+	OIIO_NAMESPACE::ImageSpec spec(options.view.image_width, options.view.image_height, 3, pixel_type(file_format));
+
+	image_writer writer(2, &frames, options.encoding);
+
+	shared_framebuffer shared;
+
+	if (!options.shared_name.empty())
+	{
+		if (!shared.create(options.shared_name, options.shared_is_file, options.view.image_width, options.view.image_height, static_cast<std::uint32_t>(options.format),
+		                   pixel_size(options.format)))
+			return 1;
+
+		std::cout << "Publishing frames to " << (options.shared_is_file ? "the file " : "the shared memory ") << options.shared_name << "\n";
+	}
+
+	// the frame is rendered or read back into the mapping of a raw output, in place of img
+	raw_image_file raw;
+
+	if (is_raw_output(options.output) && !raw.create(options.output, options.view.image_width, options.view.image_height, static_cast<std::uint32_t>(options.format),
+	                                                 pixel_size(options.format)))
+		return 1;
+
+	unsigned char* target = raw.pixels() ? raw.pixels() : &img[0];
+
+	// statistics of the last frame of --stats
+	frame_stats frame_statistics;
+	// smaller MIP levels of the frame of --mip, level 1 first
+	std::vector<std::vector<unsigned char>> mip_pixels;
+	// file of the frame of --device-encode as its device encoded it
+	std::string encoded;
+	// channel planes of the frame, in the layout of render_device::aov_buf
+	std::vector<float> aov_planes;
+
+	// the texture pass keeps its cache from frame to frame; the sphere indices it shades and the
+	// primitives are composited over are traced into hit_ids
+	std::unique_ptr<texture_shader> shader;
+	std::vector<std::uint32_t> hit_ids;
+
+	if (!options.textures_path.empty())
+	{
+		shader.reset(new texture_shader(options.texture_cache_mb));
+	}
+
+	if (shader || !primitives.empty())
+	{
+		hit_ids.resize(num_pixels);
+	}
+
+	// the first frame reports the time from the start of the program to its launch
+	bool launched = false;
+	// tile times of the last --balance frame
+	tile_costs balance_costs;
+
+	// render one frame into img with the selected backend
+	auto render = [&](bool report)
+	{
+		if (!launched)
+		{
+			launched = true;
+			std::cout << "Time to first kernel "
+			          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startup_start).count() << " ms\n";
+		}
+
+		if (!hit_ids.empty())
+		{
+			{
+				profile_range range("trace");
+				render_parallel(cpu_executor, scene, options.isa, pixel_format::id32, reinterpret_cast<unsigned char*>(&hit_ids[0]));
+			}
+
+			if (shader)
+			{
+				profile_range range("texture");
+				std::string error;
+
+				if (!shader->shade(cpu_executor, scene.spheres, textures, options.view, &hit_ids[0], reinterpret_cast<float*>(target), error))
+				{
+					std::cout << "Can't read a texture, " << error << "\n";
+				}
+			}
+			else
+			{
+				resolve_ids(reinterpret_cast<unsigned char const*>(&hit_ids[0]), pixel_format::id32, num_pixels, scene.spheres.color.data(),
+				            reinterpret_cast<float*>(target));
+			}
+
+			profile_range range("primitives");
+			composite_primitives(cpu_executor, scene.spheres, primitives, options.view, &hit_ids[0], reinterpret_cast<float*>(target));
+		}
+		else if (options.backend == render_backend::cpu && numa_img)
+		{
+			profile_range range("trace");
+			render_parallel(pool, replicas, options.isa, numa_img.get());
+
+			if (options.format != pixel_format::float32)
+			{
+				convert_rows(numa_img.get(), options.format, options.view.image_width, 0, options.view.image_height, target);
+			}
+			else
+			{
+				std::memcpy(target, numa_img.get(), num_pixels * 3 * sizeof(float));
+			}
+		}
+		else if (options.backend == render_backend::cpu && options.balance)
+		{
+			profile_range range("trace");
+			render_balanced(cpu_executor, scene, options.isa, options.format, target, balance_costs);
+		}
+		else if (options.backend == render_backend::cpu)
+		{
+			profile_range range("trace");
+			render_parallel(cpu_executor, scene, options.isa, options.format, target);
+		}
+		else if (options.backend == render_backend::hybrid)
+		{
+			profile_range range("trace");
+			render_hybrid(devices, pool, scene, options.isa, options.format, img, report);
+		}
+		else if (options.backend == render_backend::hip)
+		{
+			// the frame is read back inside
+			profile_range range("trace");
+
+			if (!render_hip_frame(hip, img))
+			{
+				std::cout << "Can't render on " << hip.name << "\n";
+			}
+		}
+		else if (options.backend == render_backend::vulkan)
+		{
+			profile_range range("trace");
+
+			if (!render_vulkan_frame(vulkan, img))
+			{
+				std::cout << "Can't render on " << vulkan.name << "\n";
+			}
+		}
+		else if (options.device_encode)
+		{
+			partition_rows(devices);
+
+			if (!encode_frame(devices[0], encoded))
+				encoded.clear();
+		}
+		else
+		{
+			partition_rows(devices);
+			render_frame(devices, target);
+
+			if (options.aovs != 0 && !read_aovs(devices, aov_planes))
+			{
+				std::cout << "Can't read the channels back\n";
+			}
+
+			if (options.stats && !reduce_frame_stats(devices, frame_statistics))
+			{
+				std::cout << "Can't reduce the frame statistics\n";
+			}
+			else if (options.stats && report)
+			{
+				print_frame_stats(frame_statistics, scene.sphere_ids);
+			}
+
+			if (options.mip_levels > 1 && !read_mip_levels(devices, mip_pixels))
+			{
+				std::cout << "Can't build the MIP levels\n";
+				mip_pixels.clear();
+			}
+		}
+
+		// the hybrid, hip and vulkan backends read back into img
+		if (target != &img[0] && (options.backend == render_backend::hybrid || options.single_device()))
+		{
+			std::memcpy(target, &img[0], img.size());
+		}
+
+#ifdef RT_COST_COUNTERS
+		if (options.backend == render_backend::cpu && options.aovs != 0)
+		{
+			aov_planes.resize(aov_floats(options.aovs) * num_pixels);
+
+			if (!render_cost(cpu_executor, scene, options.isa, reinterpret_cast<pixel_cost*>(&aov_planes[0])))
+			{
+				std::cout << "Can't count the cost of the " << accel_mode_name(scene.mode) << " mode\n";
+			}
+		}
+#endif
+	};
+
+	if (options.bench)
+	{
+		char const* backend_names[] = { "gpu", "cpu", "hybrid", "hip", "vulkan" };
+
+		bench_result result;
+		result.name = std::string(backend_names[static_cast<int>(options.backend)]) + " " + accel_mode_name(scene.mode) + (scene.embree_accel ? " embree" : "");
+
+		if (runtime_executor)
+		{
+			result.name += std::string(" ") + simd_isa_name(options.isa) + ", " + std::to_string(cpu_executor.size()) + " " + parallel_runtime_name(options.runtime) + " threads";
+		}
+		else if (uses_pool)
+		{
+			result.name += std::string(" ") + simd_isa_name(options.isa) + ", " + std::to_string(pool.size()) + " threads";
+		}
+
+		for (auto const& dev : devices)
+		{
+			result.name += ", " + dev.name;
+		}
+
+		if (options.backend == render_backend::hip)
+		{
+			result.name += ", " + hip.name;
+		}
+		else if (options.backend == render_backend::vulkan)
+		{
+			result.name += (vulkan.ray_query ? " ray query, " : ", ") + vulkan.name;
+		}
+
+		result.width = options.view.image_width;
+		result.height = options.view.image_height;
+		result.spheres = options.num_spheres;
+		result.warmup = options.warmup;
+		energy_use energy = {};
+		result.stats = run_bench([&] { render(false); }, options.warmup, options.runs, &energy);
+		add_bench_energy(result, energy);
+		log_plan(result.stats.median / 1000.0);
+		result.rays = static_cast<double>(num_pixels);
+		result.tests = result.rays * options.num_spheres;
+		add_bvh_traffic(scene, options.backend == render_backend::gpu, options.isa, result);
+
+		auto device_totals = device_memory();
+		result.host_peak_bytes = peak_host_rss();
+		result.device_peak_bytes = device_totals.peak_bytes;
+		result.device_allocated_bytes = device_totals.allocated_bytes;
+
+		print_bench(result);
+
+		// what the compressed layout saves over the full nodes
+		if (options.backend == render_backend::gpu && scene.mode == accel_mode::bvh && !scene.instances && !scene.compressed_nodes.empty())
+		{
+			auto traffic = measure_bvh_traffic(scene, kTrafficStride);
+			std::cout << "  full nodes: " << sizeof(bvh_node) * scene.accel.nodes.size() / 1024.0 << " KiB, " << traffic.full << " node bytes per ray\n";
+		}
+
+		if (!options.json.empty() && !write_bench_json(options.json, result))
+			return 1;
+
+		// only the last run is written
+		options.num_frames = 1;
+	}
+
+	for (auto frame = 0U; frame < options.num_frames; ++frame)
+	{
+		if (!options.bench)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			render(true);
+
+			auto elapsed = std::chrono::high_resolution_clock::now() - start;
+			auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+
+			std::cout << "Execution time " << delta << " ms\n";
+			log_plan(std::chrono::duration<double, std::milli>(elapsed).count());
+
+			if (options.backend == render_backend::gpu)
+			{
+				for (auto const& dev : devices)
+				{
+					std::cout << "  " << dev.name << ": rows " << dev.row_begin << "-" << dev.row_end << ", kernel " << dev.kernel_time
+					          << " ms, transfer " << dev.transfer_time << " ms\n";
+					print_profile(dev);
+					print_throughput(dev, scene);
+				}
+			}
+			else if (options.backend == render_backend::hip)
+			{
+				std::cout << "  " << hip.name << ": rows 0-" << options.view.image_height << ", kernel " << hip.kernel_time << " ms, transfer " << hip.transfer_time << " ms\n";
+				print_profile(hip);
+			}
+			else if (options.backend == render_backend::vulkan)
+			{
+				std::cout << "  " << vulkan.name << ": rows 0-" << options.view.image_height << ", kernel " << vulkan.kernel_time << " ms, transfer " << vulkan.transfer_time
+				          << " ms\n";
+				print_profile(vulkan);
+			}
+		}
+
+		// a shared frame is copied into its slot and img is rendered into again, else the writer
+		// owns the finished frame and the next one renders into a fresh framebuffer
+		if (!options.shared_name.empty())
+		{
+			shared.publish(frame, &img[0], img.size());
+		}
+		else if (raw.pixels())
+		{
+			// the frame is already in the file
+		}
+		else if (options.device_encode)
+		{
+			if (encoded.empty())
+				return -1;
+
+			writer.write(frame_file_name(options.output, frame, options.num_frames), std::move(encoded));
+		}
+		else if (is_id_format(options.format))
+		{
+			// the indices stay in img for the next frame, the file gets their colors
+			auto file = frame_file_name(options.output, frame, options.num_frames);
+			auto const& colors = scene.instances ? scene.instances->spheres.color : scene.spheres.color;
+			auto pixels = frames.acquire(pixel_size(file_format) * num_pixels);
+			resolve_ids(&img[0], options.format, num_pixels, colors.data(), reinterpret_cast<float*>(&pixels[0]));
+
+			if (!run_post_ops(options.post_ops, file, options.view.image_width, options.view.image_height, file_format, &pixels[0], static_cast<int>(options.num_threads)))
+				return -1;
+
+			writer.write(file, spec, std::move(pixels), pixel_size(file_format));
+		}
+		else
+		{
+			auto size = img.size();
+			auto file = frame_file_name(options.output, frame, options.num_frames);
+
+			// before the writer takes the frame, it is still in img
+			if (!run_post_ops(options.post_ops, file, options.view.image_width, options.view.image_height, options.format, &img[0], static_cast<int>(options.num_threads)))
+				return -1;
+
+			if (mip_pixels.empty())
+				writer.write(file, spec, std::move(img), pixel_size(options.format));
+			else
+				writer.write(file, spec, std::move(img), std::move(mip_pixels), pixel_size(options.format));
+
+			mip_pixels.clear();
+			img = frames.acquire(size);
+		}
+
+		std::size_t plane_offset = 0;
+
+		for (auto channel : { aov_depth, aov_id, aov_normal, aov_cost })
+		{
+			if ((options.aovs & channel) == 0)
+				continue;
+
+			// the ids and counts are ints in a float plane, written as uint they keep all 32 bits
+			int channels = static_cast<int>(aov_channel_floats(channel));
+			auto type = channel == aov_id || channel == aov_cost ? OIIO_NAMESPACE::TypeDesc::UINT : OIIO_NAMESPACE::TypeDesc::FLOAT;
+			auto const* first = reinterpret_cast<unsigned char const*>(&aov_planes[plane_offset]);
+
+			if (channel == aov_cost)
+			{
+				auto const* costs = reinterpret_cast<pixel_cost const*>(first);
+				print_cost_summary("Sphere tests", summarize_cost(costs, num_pixels, &pixel_cost::tests));
+				print_cost_summary("BVH node visits", summarize_cost(costs, num_pixels, &pixel_cost::visits));
+
+				writer.write(frame_file_name(cost_heatmap_file_name(options.output), frame, options.num_frames), OIIO_NAMESPACE::ImageSpec(options.view.image_width, options.view.image_height, 3, OIIO_NAMESPACE::TypeDesc::UINT8),
+				             cost_heatmap(costs, num_pixels), 3);
+			}
+
+			std::vector<unsigned char> plane(first, first + sizeof(float) * channels * num_pixels);
+
+			// ids of a culled set name the spheres of the full one, misses stay -1
+			if (channel == aov_id && !scene.sphere_ids.empty())
+			{
+				auto* ids = reinterpret_cast<std::int32_t*>(&plane[0]);
+
+				for (std::size_t p = 0; p < num_pixels; ++p)
+				{
+					if (ids[p] >= 0)
+						ids[p] = static_cast<std::int32_t>(scene.sphere_ids[ids[p]]);
+				}
+			}
+
+			writer.write(frame_file_name(aov_file_name(options.output, channel), frame, options.num_frames),
+			             OIIO_NAMESPACE::ImageSpec(options.view.image_width, options.view.image_height, channels, type),
+			             std::move(plane), sizeof(float) * channels);
+
+			plane_offset += channels * num_pixels;
+		}
+	}
+
+	if (options.nearest_hits != 0)
+	{
+		std::vector<ray_hit> hits;
+		bool traced = options.backend == render_backend::gpu ? query_nearest_hits(devices[0], scene.mode, options.nearest_hits, hits)
+		                                                     : render_nearest_hits(cpu_executor, scene, options.nearest_hits, hits);
+
+		if (!traced)
+			return -1;
+
+		print_depth_complexity(hits, options.nearest_hits);
+
+		// the distances as float, the sphere indices as uint with 0xffffffff past the last hit
+		std::vector<unsigned char> depths(sizeof(float) * hits.size());
+		std::vector<unsigned char> ids(sizeof(std::int32_t) * hits.size());
+		auto* t = reinterpret_cast<float*>(&depths[0]);
+		auto* id = reinterpret_cast<std::int32_t*>(&ids[0]);
+
+		for (std::size_t h = 0; h < hits.size(); ++h)
+		{
+			t[h] = hits[h].t;
+			id[h] = hits[h].id >= 0 && !scene.sphere_ids.empty() ? static_cast<std::int32_t>(scene.sphere_ids[hits[h].id]) : hits[h].id;
+		}
+
+		int channels = static_cast<int>(options.nearest_hits);
+		writer.write(nearest_hits_file_name(options.output, "depth"), OIIO_NAMESPACE::ImageSpec(options.view.image_width, options.view.image_height, channels,
+		                                                                                        OIIO_NAMESPACE::TypeDesc::FLOAT),
+		             std::move(depths), sizeof(float) * channels);
+		writer.write(nearest_hits_file_name(options.output, "id"), OIIO_NAMESPACE::ImageSpec(options.view.image_width, options.view.image_height, channels,
+		                                                                                     OIIO_NAMESPACE::TypeDesc::UINT),
+		             std::move(ids), sizeof(std::int32_t) * channels);
+	}
+
+	bool written = writer.finish();
+	print_write_times(writer);
+
+	if (raw.pixels())
+	{
+		written = raw.flush() && written;
+
+		if (written)
+			std::cout << "Wrote " << options.output << "\n";
+	}
+
+	if (options.memory_report)
+	{
+		print_memory_footprint(true);
+	}
+
+	if (shader)
+	{
+		std::cout << shader->stats();
+	}
+
+	if (!written)
+	{
+		return -1;
+	}
+
+	if (!options.golden.empty() && options.shared_name.empty())
+	{
+		bool all_passed = true;
+
+		for (auto frame = 0U; frame < options.num_frames; ++frame)
+		{
+			all_passed = check_image_file(frame_file_name(options.output, frame, options.num_frames), options.golden, options.tolerance) && all_passed;
+		}
+
+		if (!all_passed)
+			return 1;
+	}
+
+	//system("pause");
+
+	return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "bench.h"
+#include "cpu_trace.h"
+#include "hip_device.h"
+#include "primitives.h"
+#include "render_device.h"
+#include "run_options.h"
+#include "scene.h"
+#include "texture_shading.h"
+#include "vulkan_device.h"
+
+// Set the node bytes of result and the node bytes, cache line misses and pages a ray loads for the
+// BVH of scene, in the compressed layout if the OpenCL devices (gpu) trace that one and in the
+// 8 wide one if the CPU tracers of isa do
+void add_bvh_traffic(render_scene const& scene, bool gpu, simd_isa isa, bench_result& result);
+
+// Render the --frames frames of scene with the gpu, cpu, hybrid, hip or vulkan backend of
+// options, on devices, hip or vulkan as it needs, and write them to --output, the shared
+// framebuffer of --shared or the raw file; --bench times them instead, --query-rays traces its
+// rays in their place. The cpu backend shades the textures and composites the primitives.
+// startup_start is when the program started, for the time to the first kernel; log_plan gets
+// the time of the first frame of a --plan run. Returns the exit code of main.
+int run_frame_loop(run_options& options, render_scene& scene, std::vector<render_device>& devices, hip_device& hip, vulkan_device& vulkan,
+                   sphere_textures const& textures, primitive_set const& primitives, std::chrono::high_resolution_clock::time_point startup_start,
+                   std::function<void(double frame_ms)> const& log_plan);
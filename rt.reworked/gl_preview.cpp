@@ -0,0 +1,274 @@
+#include "gl_preview.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <GL/gl.h>
+#include <CL/cl_gl.h>
+#endif
+
+#ifdef _WIN32
+namespace
+{
+	char const kWindowClass[] = "rt.reworked preview";
+
+	LRESULT CALLBACK preview_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam)
+	{
+		// closing the window ends the preview, poll() sees the quit message
+		if (message == WM_DESTROY)
+		{
+			PostQuitMessage(0);
+			return 0;
+		}
+
+		return DefWindowProcA(window, message, wparam, lparam);
+	}
+}
+#endif
+
+gl_preview::~gl_preview()
+{
+	close();
+}
+
+bool gl_preview::open(std::uint32_t width, std::uint32_t height)
+{
+#ifdef _WIN32
+	auto instance = GetModuleHandleA(nullptr);
+
+	WNDCLASSA window_class = {};
+	window_class.style = CS_OWNDC;
+	window_class.lpfnWndProc = preview_proc;
+	window_class.hInstance = instance;
+	window_class.hCursor = LoadCursor(nullptr, IDC_ARROW);
+	window_class.lpszClassName = kWindowClass;
+	RegisterClassA(&window_class);
+
+	// a client area of the image's size
+	DWORD style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX;
+	RECT rect = { 0, 0, static_cast<LONG>(width), static_cast<LONG>(height) };
+	AdjustWindowRect(&rect, style, FALSE);
+
+	auto window = CreateWindowA(kWindowClass, "rt.reworked", style | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, rect.right - rect.left, rect.bottom - rect.top,
+	                            nullptr, nullptr, instance, nullptr);
+
+	if (!window)
+	{
+		std::cout << "Can't create the preview window\n";
+		return false;
+	}
+
+	window_ = window;
+	dc_ = GetDC(window);
+
+	PIXELFORMATDESCRIPTOR format = {};
+	format.nSize = sizeof(format);
+	format.nVersion = 1;
+	format.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
+	format.iPixelType = PFD_TYPE_RGBA;
+	format.cColorBits = 32;
+	format.iLayerType = PFD_MAIN_PLANE;
+
+	auto dc = static_cast<HDC>(dc_);
+	int index = ChoosePixelFormat(dc, &format);
+
+	if (index == 0 || !SetPixelFormat(dc, index, &format) || !(gl_context_ = wglCreateContext(dc)) || !wglMakeCurrent(dc, static_cast<HGLRC>(gl_context_)))
+	{
+		std::cout << "Can't create an OpenGL context for the preview window\n";
+		close();
+		return false;
+	}
+
+	width_ = width;
+	height_ = height;
+
+	// the shared texture must be complete without mipmaps
+	glGenTextures(1, &texture_);
+	glBindTexture(GL_TEXTURE_2D, texture_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glEnable(GL_TEXTURE_2D);
+	glViewport(0, 0, width, height);
+
+	if (glGetError() != GL_NO_ERROR)
+	{
+		std::cout << "Can't create the preview texture\n";
+		close();
+		return false;
+	}
+
+	return true;
+#else
+	(void)width;
+	(void)height;
+	std::cout << "The preview window needs Windows\n";
+	return false;
+#endif
+}
+
+void gl_preview::close()
+{
+	image_ = cl::ImageGL();
+
+#ifdef _WIN32
+	if (gl_context_)
+	{
+		glDeleteTextures(1, &texture_);
+		wglMakeCurrent(nullptr, nullptr);
+		wglDeleteContext(static_cast<HGLRC>(gl_context_));
+	}
+
+	auto window = static_cast<HWND>(window_);
+
+	if (window && IsWindow(window))
+	{
+		ReleaseDC(window, static_cast<HDC>(dc_));
+		DestroyWindow(window);
+	}
+
+	window_ = dc_ = gl_context_ = nullptr;
+	texture_ = 0;
+#endif
+}
+
+std::vector<cl_context_properties> gl_preview::context_properties(cl::Platform const& platform) const
+{
+	std::vector<cl_context_properties> properties;
+
+#ifdef _WIN32
+	if (gl_context_)
+	{
+		properties = { CL_GL_CONTEXT_KHR, reinterpret_cast<cl_context_properties>(gl_context_), CL_WGL_HDC_KHR, reinterpret_cast<cl_context_properties>(dc_),
+		               CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform()), 0 };
+	}
+#else
+	(void)platform;
+#endif
+
+	return properties;
+}
+
+bool gl_preview::attach(render_device& dev)
+{
+#ifdef _WIN32
+	if (dev.device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_gl_sharing") == std::string::npos)
+	{
+		std::cout << dev.name << " can't share OpenGL textures (no cl_khr_gl_sharing)\n";
+		return false;
+	}
+
+	// the context was created with the window's GL context, check that dev is the device
+	// behind it; a context on another device can't take the texture
+	auto platform = dev.device.getInfo<CL_DEVICE_PLATFORM>();
+	auto get_gl_context_info =
+	    reinterpret_cast<clGetGLContextInfoKHR_fn>(clGetExtensionFunctionAddressForPlatform(platform, "clGetGLContextInfoKHR"));
+
+	cl_device_id gl_device = nullptr;
+
+	if (!get_gl_context_info || dev.context_properties.empty() ||
+	    get_gl_context_info(&dev.context_properties[0], CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, sizeof(gl_device), &gl_device, nullptr) != CL_SUCCESS ||
+	    gl_device != dev.device())
+	{
+		std::cout << dev.name << " doesn't drive the OpenGL context of the preview window\n";
+		return false;
+	}
+
+	cl_int err = CL_SUCCESS;
+	image_ = cl::ImageGL(dev.context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, texture_, &err);
+
+	if (err != CL_SUCCESS)
+	{
+		std::cout << dev.name << ": can't share the preview texture (" << err << ")\n";
+		return false;
+	}
+
+	return true;
+#else
+	(void)dev;
+	return false;
+#endif
+}
+
+bool gl_preview::present(render_device& dev)
+{
+#ifdef _WIN32
+	cl_int err = enqueue_kernel(dev, 0, dev.view.image_height, nullptr);
+
+	// GL must be done with the texture before the device takes it
+	glFinish();
+
+	std::vector<cl::Memory> objects(1, image_);
+
+	cl::size_t<3> origin;
+	origin[0] = origin[1] = origin[2] = 0;
+
+	cl::size_t<3> region;
+	region[0] = width_;
+	region[1] = height_;
+	region[2] = 1;
+
+	if (err == CL_SUCCESS)
+		err = dev.queue.enqueueAcquireGLObjects(&objects);
+
+	if (err == CL_SUCCESS)
+		err = dev.queue.enqueueCopyBufferToImage(dev.out_buf, image_, 0, origin, region);
+
+	if (err == CL_SUCCESS)
+		err = dev.queue.enqueueReleaseGLObjects(&objects);
+
+	// and the device with it before GL draws it
+	if (err == CL_SUCCESS)
+		err = dev.queue.finish();
+
+	if (err != CL_SUCCESS)
+	{
+		std::cout << dev.name << ": preview frame failed (" << err << ")\n";
+		return false;
+	}
+
+	// row 0 of the image is its top row, the quad covers the window
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0.f, 1.f);
+	glVertex2f(-1.f, -1.f);
+	glTexCoord2f(1.f, 1.f);
+	glVertex2f(1.f, -1.f);
+	glTexCoord2f(1.f, 0.f);
+	glVertex2f(1.f, 1.f);
+	glTexCoord2f(0.f, 0.f);
+	glVertex2f(-1.f, 1.f);
+	glEnd();
+
+	SwapBuffers(static_cast<HDC>(dc_));
+	return true;
+#else
+	(void)dev;
+	return false;
+#endif
+}
+
+bool gl_preview::poll()
+{
+#ifdef _WIN32
+	MSG message;
+
+	while (PeekMessageA(&message, nullptr, 0, 0, PM_REMOVE))
+	{
+		if (message.message == WM_QUIT)
+			return false;
+
+		TranslateMessage(&message);
+		DispatchMessageA(&message);
+	}
+
+	return window_ && IsWindow(static_cast<HWND>(window_));
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+#include "render_device.h"
+
+// Window showing the frames of one device as they are rendered (--preview). The device renders
+// into out_buf as usual and copies it into a GL texture its context shares with the window
+// through cl_khr_gl_sharing, so a frame never crosses to the host. The device's context is
+// created with context_properties() and the device must be the one driving the window's GL
+// context. Win32 and WGL only, open() fails elsewhere.
+class gl_preview
+{
+public:
+	gl_preview() = default;
+	~gl_preview();
+
+	gl_preview(gl_preview const&) = delete;
+	gl_preview& operator=(gl_preview const&) = delete;
+
+	// Open a window of width x height pixels with its GL context and an RGBA8 texture of that
+	// size. Returns false with a message if it can't.
+	bool open(std::uint32_t width, std::uint32_t height);
+	void close();
+
+	// Properties for a context on platform sharing the window's GL context, for
+	// render_device::context_properties; empty if the window isn't open
+	std::vector<cl_context_properties> context_properties(cl::Platform const& platform) const;
+
+	// Share the texture with the context of dev, opened with context_properties(). Returns false
+	// with a message if dev lacks cl_khr_gl_sharing or doesn't drive the GL context.
+	bool attach(render_device& dev);
+
+	// Render a frame on dev into its rgba8 out_buf, copy it into the texture between acquiring
+	// and releasing it and draw it into the window. Returns false if a command fails.
+	bool present(render_device& dev);
+
+	// Handle the messages of the window, false once it was closed
+	bool poll();
+
+private:
+	std::uint32_t width_ = 0, height_ = 0;
+	cl::ImageGL image_;
+#ifdef _WIN32
+	void* window_ = nullptr;
+	void* dc_ = nullptr;
+	void* gl_context_ = nullptr;
+	unsigned int texture_ = 0;
+#endif
+};
@@ -0,0 +1,893 @@
+#include "gpu_renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+	// Runs of tiles render_runs() keeps queued for a render that may be cancelled or streams its
+	// runs: enough to keep the devices busy, few enough that a cancel skips most of the image
+	// and every run is handed on soon after its read
+	std::size_t const kRunsInFlight = 4;
+
+	// Frame of render_async in flight: the reads still running, the copy of the image when the
+	// target's rows aren't packed and what to call once the last read completes
+	struct async_frame
+	{
+		std::atomic<std::size_t> pending;
+		std::atomic<bool> failed;
+		std::vector<unsigned char> staging;
+		std::size_t row_bytes;
+		std::uint32_t rows;
+		framebuffer_view target;
+		std::function<void(bool)> done;
+	};
+
+	void CL_CALLBACK read_complete(cl_event, cl_int status, void* user_data)
+	{
+		auto frame = static_cast<async_frame*>(user_data);
+
+		if (status < 0)
+			frame->failed = true;
+
+		if (--frame->pending != 0)
+			return;
+
+		std::unique_ptr<async_frame> owned(frame);
+
+		if (!frame->failed && !frame->staging.empty())
+		{
+			for (std::uint32_t y = 0; y < frame->rows; ++y)
+			{
+				std::memcpy(static_cast<unsigned char*>(frame->target.pixels) + y * frame->target.row_bytes, &frame->staging[y * frame->row_bytes], frame->row_bytes);
+			}
+		}
+
+		frame->done(!frame->failed);
+	}
+}
+
+gpu_renderer::gpu_renderer(std::vector<device_entry> const& devices, std::string src, gpu_settings const& settings)
+	: src_(std::move(src)), settings_(settings), devices_(devices.size())
+{
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		set_device(devices_[d], devices[d], settings.format, settings.map_readback);
+	}
+}
+
+void gpu_renderer::set_scene(sphere_soa spheres, scene_file const* file, std::string digest)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	stash_scene();
+
+	// buffers of the old scene may read from a mapping the caller is about to close
+	for (auto& dev : devices_)
+	{
+		dev.buffers.clear();
+		dev.svm_arrays.clear();
+		dev.scene_key.clear();
+		dev.structure_key.clear();
+	}
+
+	scene_.spheres = std::move(spheres);
+	scene_.file = file;
+	digest_ = std::move(digest);
+	++scene_revision_;
+	prepared_ = false;
+	devices_ready_ = false;
+	rendered_ = false;
+	dirty_.clear();
+	edits_.reset();
+}
+
+render_times gpu_renderer::take_times()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto times = times_;
+	times_ = render_times();
+	return times;
+}
+
+bool gpu_renderer::restore_scene(std::string const& digest)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (digest.empty())
+		return false;
+
+	if (digest == digest_)
+	{
+		++scene_hits_;
+		return true;
+	}
+
+	auto found = std::find_if(cache_.begin(), cache_.end(), [&](cached_scene const& cached)
+	{
+		return cached.digest == digest;
+	});
+
+	if (found == cache_.end())
+	{
+		++scene_misses_;
+		return false;
+	}
+
+	cached_scene restored = std::move(*found);
+	cache_.erase(found);
+
+	stash_scene();
+
+	scene_ = std::move(restored.scene);
+	digest_ = std::move(restored.digest);
+	requested_ = restored.requested;
+	prepared_ = restored.prepared;
+
+	// the buffers get the key of the new revision, init_device keeps them for the next frame
+	// and the structure ones too while it is the build they hold
+	++scene_revision_;
+
+	for (std::size_t d = 0; d < devices_.size(); ++d)
+	{
+		restored.arrays[d].scene_key = std::to_string(scene_revision_);
+		restore_arrays(devices_[d], std::move(restored.arrays[d]));
+	}
+
+	devices_ready_ = false;
+	rendered_ = false;
+	dirty_.clear();
+	edits_.reset();
+	++scene_hits_;
+
+	return true;
+}
+
+std::size_t gpu_renderer::set_aside_bytes()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	std::size_t most = 0;
+
+	for (std::size_t d = 0; d < devices_.size(); ++d)
+	{
+		std::size_t bytes = 0;
+
+		for (auto const& cached : cache_)
+		{
+			bytes += arrays_bytes(cached.arrays[d]);
+		}
+
+		most = std::max(most, bytes);
+	}
+
+	return most;
+}
+
+void gpu_renderer::set_band_rows(std::uint32_t rows)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// the framebuffers of the devices change size with the bands
+	if (rows != band_rows_)
+	{
+		band_rows_ = rows;
+		devices_ready_ = false;
+	}
+}
+
+bool gpu_renderer::render(ortho_view const& view, accel_mode mode, framebuffer_view const& target, cancel_token const* cancel)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!prepare(view, mode))
+		return false;
+
+	dirty_.clear();
+
+	if (!cancel || !partial_launches())
+	{
+		render_image(target, cancel);
+		// a cancelled image isn't the one render_changes() updates
+		rendered_ = !cancel || !cancel->cancelled();
+		return true;
+	}
+
+	partition_rows(devices_);
+	auto err = render_runs(make_tiles(view, kGroupTileSize), target, full_roi(view), cancel);
+	rendered_ = !cancel->cancelled();
+
+	return err == CL_SUCCESS;
+}
+
+bool gpu_renderer::render_streaming(ortho_view const& view, accel_mode mode, framebuffer_view const& target, tile_callback const& on_tile,
+                                    stream_times& times, cancel_token const* cancel)
+{
+	typedef std::chrono::steady_clock clock;
+
+	auto start = clock::now();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	times.first_tile = times.total = 0.0;
+
+	if (!prepare(view, mode))
+		return false;
+
+	dirty_.clear();
+
+	std::size_t pixel_bytes = pixel_size(settings_.format);
+
+	auto on_run = [&](tile const& run)
+	{
+		if (times.first_tile == 0.0)
+			times.first_tile = std::chrono::duration<double>(clock::now() - start).count();
+
+		on_tile(run, static_cast<unsigned char*>(target.pixels) + run.y0 * target.row_bytes + pixel_bytes * run.x0);
+	};
+
+	auto rows = make_tiles(view, kGroupTileSize);
+	cl_int err = CL_SUCCESS;
+
+	if (partial_launches())
+	{
+		partition_rows(devices_);
+		err = render_runs(rows, target, full_roi(view), cancel, on_run);
+	}
+	else
+	{
+		render_image(target, cancel);
+
+		// whole-image launches hand on their runs once the image is in target
+		for (std::size_t begin = 0, end = 0; (!cancel || !cancel->cancelled()) && begin < rows.size(); begin = end)
+		{
+			auto run = rows[begin];
+
+			for (end = begin + 1; end < rows.size() && rows[end].y0 == run.y0; ++end)
+				run.x1 = rows[end].x1;
+
+			on_run(run);
+		}
+	}
+
+	times.total = std::chrono::duration<double>(clock::now() - start).count();
+	rendered_ = !cancel || !cancel->cancelled();
+
+	return err == CL_SUCCESS;
+}
+
+bool gpu_renderer::render_async(ortho_view const& view, accel_mode mode, framebuffer_view const& target, std::function<void(bool)> done)
+{
+	if (settings_.map_readback)
+	{
+		bool rendered = render(view, mode, target);
+		done(rendered);
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (!prepare(view, mode))
+	{
+		lock.unlock();
+		done(false);
+		return false;
+	}
+
+	rendered_ = true;
+	dirty_.clear();
+
+	std::unique_ptr<async_frame> frame(new async_frame);
+	frame->row_bytes = pixel_size(settings_.format) * view.image_width;
+	frame->rows = view.image_height;
+	frame->target = target;
+	frame->done = std::move(done);
+	frame->failed = false;
+
+	// packed rows are read in place, others through the frame's own copy
+	auto* img = static_cast<unsigned char*>(target.pixels);
+
+	if (target.row_bytes != frame->row_bytes)
+	{
+		frame->staging.resize(frame->row_bytes * view.image_height);
+		img = frame->staging.data();
+	}
+
+	partition_rows(devices_);
+
+	std::vector<cl::Event> reads;
+	cl_int err = CL_SUCCESS;
+
+	for (auto& dev : devices_)
+	{
+		if (dev.row_end == dev.row_begin)
+			continue;
+
+		std::size_t offset = frame->row_bytes * dev.row_begin;
+		std::size_t size = frame->row_bytes * (dev.row_end - dev.row_begin);
+
+		err = enqueue_kernel(dev, dev.row_begin, dev.row_end, nullptr);
+
+		if (err != CL_SUCCESS)
+			break;
+
+		reads.emplace_back();
+		err = dev.queue.enqueueReadBuffer(dev.out_buf, CL_FALSE, offset, size, img + offset, nullptr, &reads.back());
+
+		if (err != CL_SUCCESS)
+			break;
+	}
+
+	// the reads that were queued complete before the failure is reported, they write into img
+	if (err != CL_SUCCESS)
+	{
+		for (auto& dev : devices_)
+		{
+			dev.queue.finish();
+		}
+
+		lock.unlock();
+		frame->done(false);
+		return false;
+	}
+
+	if (reads.empty())
+	{
+		lock.unlock();
+		frame->done(true);
+		return false;
+	}
+
+	// the last callback frees the frame, which may happen before the loop is done
+	frame->pending = reads.size();
+	auto* pending = frame.release();
+
+	for (auto& read : reads)
+	{
+		read.setCallback(CL_COMPLETE, read_complete, pending);
+	}
+
+	for (auto& dev : devices_)
+	{
+		dev.queue.flush();
+	}
+
+	return true;
+}
+
+void gpu_renderer::move_spheres(std::vector<std::uint32_t> const& indices, sphere_soa const& changed)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mark_footprints(indices);
+	edits_.update(scene_.spheres, indices, changed);
+	mark_footprints(indices);
+	drop_file();
+	digest_.clear();
+}
+
+std::vector<std::uint32_t> gpu_renderer::add_spheres(sphere_soa const& added)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// the slots taken were tombstones without a footprint
+	auto indices = edits_.add(scene_.spheres, added);
+	mark_footprints(indices);
+	drop_file();
+	digest_.clear();
+
+	return indices;
+}
+
+void gpu_renderer::remove_spheres(std::vector<std::uint32_t> const& indices)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mark_footprints(indices);
+	edits_.remove(scene_.spheres, indices);
+	drop_file();
+	digest_.clear();
+}
+
+std::vector<std::uint32_t> gpu_renderer::compact_spheres()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!edits_.compaction_due(scene_.spheres))
+		return std::vector<std::uint32_t>();
+
+	// the tombstones showed in no image, the pixels of the last one stay valid
+	++scene_revision_;
+	prepared_ = false;
+	devices_ready_ = false;
+	digest_.clear();
+
+	return edits_.compact(scene_.spheres);
+}
+
+bool gpu_renderer::render_changes(framebuffer_view const& target)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (!rendered_)
+	{
+		auto view = scene_.view;
+		auto mode = requested_;
+
+		lock.unlock();
+		return render(view, mode, target);
+	}
+
+	if (!prepare(scene_.view, requested_))
+		return false;
+
+	if (!partial_launches())
+	{
+		dirty_.clear();
+		render_image(target);
+		return true;
+	}
+
+	auto err = render_runs(covered_tiles(dirty_, scene_.view, kGroupTileSize), target, full_roi(scene_.view));
+	dirty_.clear();
+
+	return err == CL_SUCCESS;
+}
+
+bool gpu_renderer::render_tiles(ortho_view const& view, accel_mode mode, std::vector<tile> const& tiles, framebuffer_view const& target)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!prepare(view, mode))
+		return false;
+
+	// target only holds the image render_changes() updates if all of it is rendered
+	dirty_.clear();
+
+	if (!partial_launches())
+	{
+		rendered_ = true;
+		render_image(target);
+		return true;
+	}
+
+	rendered_ = false;
+
+	// the rows go to the devices in proportion to their speed, as for a whole frame
+	partition_rows(devices_);
+	return render_runs(tiles, target, full_roi(view)) == CL_SUCCESS;
+}
+
+bool gpu_renderer::render_region(ortho_view const& view, accel_mode mode, render_roi const& roi, framebuffer_view const& target, render_roi const& window)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!prepare(view, mode))
+		return false;
+
+	// target no longer holds the image render_changes() updates
+	rendered_ = false;
+	dirty_.clear();
+
+	auto region = clip_roi(roi, view);
+	std::size_t pixel_bytes = pixel_size(settings_.format);
+
+	if (!partial_launches())
+	{
+		partition_rows(devices_);
+		render_frame(devices_, frame_);
+		copy_roi(frame_.data(), pixel_bytes * view.image_width, full_roi(view), target.pixels, target.row_bytes, window, region, pixel_bytes);
+		return true;
+	}
+
+	partition_rows(devices_);
+	return render_runs(roi_tiles(view, region, kGroupTileSize), target, window) == CL_SUCCESS;
+}
+
+void gpu_renderer::render_image(framebuffer_view const& target, cancel_token const* cancel)
+{
+	if (cancel && cancel->cancelled())
+		return;
+
+	auto const& view = scene_.view;
+	std::size_t row_bytes = pixel_size(settings_.format) * view.image_width;
+	frame_.resize(row_bytes * view.image_height);
+
+	partition_rows(devices_);
+
+	for (auto& dev : devices_)
+	{
+		dev.cancel = cancel;
+	}
+
+	render_frame(devices_, frame_);
+
+	for (auto& dev : devices_)
+	{
+		dev.cancel = nullptr;
+		times_.kernel += dev.kernel_time;
+		times_.readback += dev.transfer_time;
+	}
+
+	// streamed chunks may have stopped before the image was done
+	if (cancel && cancel->cancelled())
+		return;
+
+	for (std::uint32_t y = 0; y < view.image_height; ++y)
+	{
+		std::memcpy(static_cast<unsigned char*>(target.pixels) + y * target.row_bytes, &frame_[y * row_bytes], row_bytes);
+	}
+}
+
+bool gpu_renderer::partial_launches() const
+{
+	// swizzled launches place their pixels by work-group across the whole image width, the
+	// pixel blocks of coarsened ones by work-item from the left edge; images in bands (see
+	// render_device::band_rows) aren't held whole in out_buf
+	bool swizzled = scene_.mode == accel_mode::bvh || scene_.mode == accel_mode::sorted;
+
+	return std::all_of(devices_.begin(), devices_.end(), [&](render_device const& dev)
+	{
+		return !dev.persistent && dev.chunk_spheres == 0 && !dev.waves.active && !dev.splat_atomic && !(dev.swizzle && swizzled) && dev.coarse.x == 1 &&
+		       dev.coarse.y == 1 && dev.band_rows == 0;
+	});
+}
+
+cl_int gpu_renderer::render_runs(std::vector<tile> const& tiles, framebuffer_view const& target, render_roi const& window, cancel_token const* cancel,
+                                 std::function<void(tile const&)> const& on_run)
+{
+	cl_int err = CL_SUCCESS;
+
+	auto const& view = scene_.view;
+	std::size_t pixel_bytes = pixel_size(settings_.format);
+
+	// runs queued for a render that may be cancelled or reports its runs, with their reads
+	bool tracked = cancel || on_run;
+	std::deque<std::pair<tile, cl::Event>> in_flight;
+	// kernel and read of every run, timed once they are done
+	std::vector<std::pair<cl::Event, cl::Event>> timed;
+
+	auto retire = [&]()
+	{
+		err = in_flight.front().second.wait();
+
+		if (on_run)
+			on_run(in_flight.front().first);
+
+		in_flight.pop_front();
+	};
+
+	// one launch and read per run of tiles in a tile row, on the device whose band of the
+	// last frame holds the row
+	for (std::size_t begin = 0, end = 0; begin < tiles.size(); begin = end)
+	{
+		auto run = tiles[begin];
+
+		end = begin + 1;
+
+		while (end < tiles.size() && tiles[end].y0 == run.y0 && tiles[end].x0 == run.x1)
+			run.x1 = tiles[end++].x1;
+
+		while (tracked && in_flight.size() >= kRunsInFlight)
+		{
+			retire();
+		}
+
+		if (cancel && cancel->cancelled())
+			break;
+
+		auto owner = std::find_if(devices_.begin(), devices_.end(), [&](render_device const& dev)
+		{
+			return dev.row_begin <= run.y0 && run.y0 < dev.row_end;
+		});
+
+		auto& dev = owner != devices_.end() ? *owner : devices_[0];
+
+		auto width = run.x1 - run.x0;
+		auto rows = run.y1 - run.y0;
+
+		cl::Event launch;
+		err = dev.queue.enqueueNDRangeKernel(dev.kernel, cl::NDRange(run.x0, run.y0), cl::NDRange(width, rows), group_size(dev, width, rows), nullptr, &launch);
+
+		cl::size_t<3> origin;
+		origin[0] = pixel_bytes * run.x0;
+		origin[1] = run.y0;
+		origin[2] = 0;
+
+		cl::size_t<3> region;
+		region[0] = pixel_bytes * width;
+		region[1] = rows;
+		region[2] = 1;
+
+		cl::size_t<3> host_origin;
+		host_origin[0] = pixel_bytes * (run.x0 - window.xbegin);
+		host_origin[1] = run.y0 - window.ybegin;
+		host_origin[2] = 0;
+
+		cl::Event read;
+		err = dev.queue.enqueueReadBufferRect(dev.out_buf, CL_FALSE, origin, host_origin, region, pixel_bytes * view.image_width, 0, target.row_bytes, 0,
+		                                      target.pixels, nullptr, &read);
+		timed.emplace_back(launch, read);
+
+		if (tracked)
+		{
+			err = dev.queue.flush();
+			in_flight.emplace_back(run, read);
+		}
+	}
+
+	while (!in_flight.empty())
+	{
+		retire();
+	}
+
+	for (auto& dev : devices_)
+	{
+		err = dev.queue.finish();
+	}
+
+	for (auto const& run : timed)
+	{
+		times_.kernel += profile(run.first).run;
+		times_.readback += profile(run.second).run;
+	}
+
+	return err;
+}
+
+bool gpu_renderer::render_views(std::vector<ortho_view> const& views, accel_mode mode, framebuffer_view const& target)
+{
+	if (views.empty())
+		return true;
+
+	auto const& view = views[0];
+
+	for (auto const& v : views)
+	{
+		if (v.image_width != view.image_width || v.image_height != view.image_height || v.near != view.near || v.far != view.far)
+		{
+			std::cout << "The views of a batch share image size, near and far\n";
+			return false;
+		}
+	}
+
+	// the BVH and the depth order don't depend on the window, the screen-space structures do
+	if (mode != accel_mode::bvh && mode != accel_mode::sorted)
+		mode = accel_mode::none;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!prepare(view, mode))
+		return false;
+
+	std::vector<view_window> windows;
+
+	for (auto const& v : views)
+	{
+		windows.push_back(make_view_window(v));
+	}
+
+	// target no longer holds the image render_changes() updates
+	rendered_ = false;
+	dirty_.clear();
+
+	// the devices left without views keep the times of their last frame and their read
+	std::vector<cl_event> reads;
+
+	for (auto const& dev : devices_)
+	{
+		reads.push_back(dev.transfer_event());
+	}
+
+	if (!::render_views(devices_, scene_.mode, windows, frame_))
+		return false;
+
+	for (std::size_t d = 0; d < devices_.size(); ++d)
+	{
+		if (devices_[d].transfer_event() == reads[d])
+			continue;
+
+		times_.kernel += devices_[d].kernel_time;
+		times_.readback += devices_[d].transfer_time;
+	}
+
+	std::size_t row_bytes = pixel_size(settings_.format) * view.image_width;
+
+	for (std::size_t y = 0; y < views.size() * view.image_height; ++y)
+	{
+		std::memcpy(static_cast<unsigned char*>(target.pixels) + y * target.row_bytes, &frame_[y * row_bytes], row_bytes);
+	}
+
+	return true;
+}
+
+void gpu_renderer::mark_footprints(std::vector<std::uint32_t> const& indices)
+{
+	pixel_rect rect;
+
+	for (auto k : indices)
+	{
+		if (rendered_ && k < scene_.spheres.size() && sphere_footprint(scene_.spheres, k, scene_.view, rect))
+			dirty_.push_back(rect);
+	}
+}
+
+void gpu_renderer::stash_scene()
+{
+	if (digest_.empty() || scene_.file || settings_.scene_cache_share <= 0.0)
+		return;
+
+	// devices that hold another revision or streamed chunks would upload the scene anyway
+	for (auto const& dev : devices_)
+	{
+		if (dev.scene_key != std::to_string(scene_revision_))
+			return;
+	}
+
+	cache_.remove_if([&](cached_scene const& cached)
+	{
+		return cached.digest == digest_;
+	});
+
+	cache_.push_front(cached_scene{ std::move(digest_), std::move(scene_), requested_, prepared_, std::vector<device_arrays>(devices_.size()) });
+	scene_ = render_scene();
+	digest_.clear();
+
+	for (std::size_t d = 0; d < devices_.size(); ++d)
+	{
+		take_arrays(devices_[d], cache_.front().arrays[d]);
+	}
+
+	// drop from the back until every device is within its share
+	auto over_budget = [&]
+	{
+		for (std::size_t d = 0; d < devices_.size(); ++d)
+		{
+			std::size_t bytes = 0;
+
+			for (auto const& cached : cache_)
+			{
+				bytes += arrays_bytes(cached.arrays[d]);
+			}
+
+			if (bytes > settings_.scene_cache_share * devices_[d].device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>())
+				return true;
+		}
+
+		return false;
+	};
+
+	while (!cache_.empty() && over_budget())
+	{
+		cache_.pop_back();
+	}
+}
+
+void gpu_renderer::drop_file()
+{
+	// buffers of a mapped file read the mapping, which holds the spheres as they were before
+	// the edits; the spheres are uploaded from scene_ again
+	if (scene_.file)
+	{
+		scene_.file = nullptr;
+		++scene_revision_;
+		devices_ready_ = false;
+	}
+}
+
+bool gpu_renderer::prepare(ortho_view const& view, accel_mode mode)
+{
+	// appended spheres change the size of the buffers and of the kernels' loops
+	if (edits_.grown())
+	{
+		++scene_revision_;
+		prepared_ = false;
+		devices_ready_ = false;
+	}
+
+	std::vector<std::int32_t> nodes;
+	bool refit = false;
+
+	if (prepared_ && mode == requested_ && same_view(view, scene_.view) && !edits_.changed().empty())
+	{
+		refit = refit_scene(scene_, edits_.changed(), nodes);
+		prepared_ = refit;
+	}
+
+	if (!prepared_ || mode != requested_ || !same_view(view, scene_.view))
+	{
+		scene_.view = view;
+		prepare_scene(scene_, mode);
+
+		// an empty buffer is invalid, keep at least one entry when no sphere is visible
+		scene_.grid.indices.resize(std::max<std::size_t>(scene_.grid.indices.size(), 1U));
+
+		requested_ = mode;
+		prepared_ = true;
+		devices_ready_ = false;
+	}
+
+	// a new scene, view or mode needs its kernels and buffers, the same one renders again as is
+	if (!devices_ready_)
+	{
+		for (auto& dev : devices_)
+		{
+			dev.persistent = settings_.persistent;
+			dev.coarsen = settings_.coarsen;
+			dev.image_reads = settings_.image_reads;
+			dev.async_prefetch = settings_.async_prefetch;
+			dev.svm = settings_.svm;
+			dev.fast_math = settings_.fast_math;
+			dev.swizzle = settings_.swizzle;
+			dev.wavefront = settings_.wavefront;
+			dev.fast_math_ulps = settings_.fast_math_ulps;
+			dev.chunk_spheres = settings_.chunk_spheres;
+			dev.num_queues = settings_.num_queues;
+			// init_device picks the bands of an image larger than one allocation itself; bands are
+			// traced by the one kernel per pixel launches, as those
+			dev.band_rows = band_rows_;
+			dev.auto_bands = false;
+
+			if (band_rows_ != 0)
+			{
+				dev.persistent = false;
+				dev.chunk_spheres = 0;
+			}
+
+			// a new size or mode compiles its variant on all devices at once
+			prefetch_programs(dev, src_, scene_, settings_.use_cache);
+		}
+
+		for (auto& dev : devices_)
+		{
+			if (!init_device(dev, src_, scene_, settings_.use_cache, false, std::to_string(scene_revision_)))
+			{
+				std::cout << dev.name << ": can't build the kernels\n";
+				return false;
+			}
+
+			times_.build += dev.build_time;
+			times_.upload += dev.upload_time;
+		}
+
+		devices_ready_ = true;
+	}
+
+	// sphere buffers kept across a new structure or a refit get the edited ranges, a refit its
+	// nodes or footprints; every device holds all spheres
+	if (!edits_.changed().empty())
+	{
+		auto ranges = index_ranges(edits_.changed());
+		cl_int err = CL_SUCCESS;
+
+		for (auto& dev : devices_)
+		{
+			if (dev.chunk_spheres != 0 || scene_arrays(dev) < 5)
+				continue;
+
+			for (auto const& range : ranges)
+			{
+				err = err == CL_SUCCESS ? write_spheres(dev, scene_.spheres, range.first, range.count) : err;
+			}
+
+			if (refit)
+				err = err == CL_SUCCESS ? write_refit(dev, scene_, nodes, ranges) : err;
+		}
+
+		edits_.clear_changed();
+
+		if (err != CL_SUCCESS)
+		{
+			std::cout << "Can't write the edited spheres to the devices\n";
+			return false;
+		}
+	}
+
+	return true;
+}
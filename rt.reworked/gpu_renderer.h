@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "accel.h"
+#include "devices.h"
+#include "pixel_format.h"
+#include "render_device.h"
+#include "renderer.h"
+#include "roi.h"
+#include "scene.h"
+#include "scene_file.h"
+
+// How gpu_renderer sets up its devices
+struct gpu_settings
+{
+	// Layout of the framebuffer_view pixels
+	pixel_format format = pixel_format::float32;
+	// Load and store program binaries, see build_program
+	bool use_cache = true;
+	// See render_device
+	bool map_readback = false;
+	bool persistent = false;
+	bool coarsen = false;
+	bool image_reads = false;
+	bool async_prefetch = false;
+	bool svm = false;
+	bool fast_math = false;
+	bool swizzle = false;
+	bool wavefront = false;
+	std::uint32_t fast_math_ulps = 0;
+	std::uint32_t chunk_spheres = 0;
+	std::uint32_t num_queues = 1;
+	// Share of the global memory of a device the scenes set aside by set_scene() may take on it,
+	// see restore_scene(); 0 keeps none
+	double scene_cache_share = 0.0;
+};
+
+// Device time of the frames of a gpu_renderer in ms, summed over its devices
+struct render_times
+{
+	// Kernel builds or binary loads and scene uploads of the devices set up anew
+	double build = 0.0;
+	double upload = 0.0;
+	// Kernels and reads of the frames rendered
+	double kernel = 0.0;
+	double readback = 0.0;
+};
+
+// Renders spheres with OpenCL into caller owned memory, splitting every image between the
+// devices it was given, for linking the tracer into another program. Each device keeps its
+// context, queue and program variants for the lifetime of the renderer and the sphere
+// buffers until the next set_scene(); a new view or mode only builds (or reuses) the kernels
+// specialized for it. render() may be called from any thread, concurrent calls run one after
+// the other.
+class gpu_renderer
+{
+public:
+	// Render on devices with the kernels of the OpenCL source src
+	gpu_renderer(std::vector<device_entry> const& devices, std::string src, gpu_settings const& settings);
+
+	gpu_renderer(gpu_renderer const&) = delete;
+	gpu_renderer& operator=(gpu_renderer const&) = delete;
+
+	// Render spheres from now on. Spheres copied from file load its stored BVH and the device
+	// buffers read from its mapping, file must stay open while this scene is rendered. A digest
+	// names the spheres for restore_scene(): with settings.scene_cache_share the scene before
+	// is set aside, its structures and device buffers with it, if it had one and no file.
+	void set_scene(sphere_soa spheres, scene_file const* file = nullptr, std::string digest = std::string());
+
+	// Render the scene set aside under digest again, with the structure and the device buffers
+	// it had, instead of loading, building and uploading it anew; the current one is set aside
+	// in its place. Scenes are set aside most recent first and dropped from the back once
+	// their buffers take more than settings.scene_cache_share of a device. Returns false if no
+	// scene of digest is kept, true also if it is the current one.
+	bool restore_scene(std::string const& digest);
+
+	// restore_scene() calls that found their scene and ones that didn't
+	std::uint64_t scene_hits() const
+	{
+		return scene_hits_;
+	}
+
+	std::uint64_t scene_misses() const
+	{
+		return scene_misses_;
+	}
+
+	// Bytes the scenes set aside hold on the device that holds the most of them
+	std::size_t set_aside_bytes();
+
+	// Render the images of the views after this in bands of rows rows, whole multiples of
+	// kGroupTileSize, through kBandOutputs band buffers per device instead of a framebuffer
+	// of the whole image (render_device::band_rows); 0 renders them whole, or in the bands an
+	// image larger than one allocation needs. Batches of views (render_views()) need 0.
+	void set_band_rows(std::uint32_t rows);
+
+	// Device time spent since the last call, render_async() frames excluded as their kernels
+	// aren't timed
+	render_times take_times();
+
+	// Render the scene through view with mode into target, in settings.format. Returns false
+	// with a message if a device can't build its kernels; a mode that falls back as described
+	// for prepare_scene renders with brute force, mode() tells which one was used. With cancel,
+	// if not null, kernels that can launch over part of the image (see render_tiles()) run row
+	// of tiles by row, a few rows in flight, and once it is cancelled the rows not launched are
+	// skipped; target keeps the rows read before. Streamed chunks stop between chunks and
+	// leave target as it was, as does cancelling before the launch of the other kernels, which
+	// cover the whole image at once.
+	bool render(ortho_view const& view, accel_mode mode, framebuffer_view const& target, cancel_token const* cancel = nullptr);
+
+	// Same as render(), but returns once the kernels and reads are queued instead of waiting
+	// for them: done(true) is called when the image is in target, done(false) if a command
+	// failed, from a thread of the OpenCL runtime (clSetEventCallback on the reads), so done
+	// must not block and target must stay valid until then. The queues are in order, so any
+	// number of frames can be in flight; each holds a copy of the image only if target's rows
+	// aren't packed. Devices that map their output (--readback map) render with render() and
+	// call done before render_async returns, as do a failure to set the devices up and an empty
+	// image; returns false then. Kernel times are those of the last render(), async frames don't time them.
+	bool render_async(ortho_view const& view, accel_mode mode, framebuffer_view const& target, std::function<void(bool)> done);
+
+	// render() calling on_tile, on the calling thread, for every run of kGroupTileSize tiles
+	// across the image once it is in target: each run's read is waited for while the next ones
+	// run. Launches that only cover the whole image (see render_tiles()) hand on all runs once
+	// the image is done. times gets the time to the first run and to the whole image, cancel
+	// stops the launches as for render().
+	bool render_streaming(ortho_view const& view, accel_mode mode, framebuffer_view const& target, tile_callback const& on_tile, stream_times& times,
+	                      cancel_token const* cancel = nullptr);
+
+	// Render the image of every view into target, the first one in its top rows and the others
+	// below it, in one launch per device (see render_views in render_device.h). The views share
+	// image size, near and far; bvh and sorted trace through the structure prepared for the
+	// first view, the other modes render with brute force. Returns false with a message if
+	// the views don't match or the devices can't run the batch.
+	bool render_views(std::vector<ortho_view> const& views, accel_mode mode, framebuffer_view const& target);
+
+	// Set sphere indices[i] to sphere i of changed, for every i. The old and new footprints
+	// of each are remembered for render_changes().
+	void move_spheres(std::vector<std::uint32_t> const& indices, sphere_soa const& changed);
+
+	// Add the spheres of added to the scene, into the slots of removed ones first, and return the
+	// index each one got. Their footprints are remembered for render_changes(). Spheres appended
+	// to the scene grow the sphere buffers, the next frame sets the devices up again.
+	std::vector<std::uint32_t> add_spheres(sphere_soa const& added);
+
+	// Remove the spheres indices, they stay tombstones in their slots (scene_edits) until
+	// compact_spheres(). Their footprints are remembered for render_changes().
+	void remove_spheres(std::vector<std::uint32_t> const& indices);
+
+	// Drop the tombstones once they make up kCompactFraction of the scene and renumber the other
+	// spheres. Returns the new index of every old one, kRemovedSphere for the dropped ones, or
+	// nothing if the scene isn't due yet; the next frame uploads the scene again.
+	std::vector<std::uint32_t> compact_spheres();
+
+	// Bring target, which holds the image of the last render() or render_changes(), up to date
+	// with the spheres edited since, for the view and mode of that render. The kernels write the
+	// runs of kGroupTileSize tiles the edited spheres covered or cover now and only those runs
+	// are read back into target. Every frame first writes the edited ranges of the sphere buffers
+	// and the nodes or footprints refit_scene changed; modes it can't refit build their structure
+	// again. Persistent work-groups, streamed spheres and the other launches of render_tiles()
+	// that only cover whole images render everything.
+	bool render_changes(framebuffer_view const& target);
+
+	// Render the tiles of the image of view with mode into target and leave its other pixels
+	// as they are, one launch and read per run of tiles in a row like render_changes(). The
+	// tiles are sorted by rows and then columns. Persistent work-groups, streamed spheres, the
+	// wavefront pipeline and swizzled launches only render whole images, they write all of
+	// target. Returns false with a message if a device can't build its kernels.
+	bool render_tiles(ortho_view const& view, accel_mode mode, std::vector<tile> const& tiles, framebuffer_view const& target);
+
+	// Render only the pixels of roi, clipped to the image of view, into target, which holds the
+	// pixels of window: full_roi(view) for a whole framebuffer, or roi for one of the region
+	// alone. The kernels launch over the rows of kGroupTileSize tiles the region covers, with
+	// the global offset of its corner, and the reads place them in target; where the kernels
+	// only launch over whole images (see render_tiles) the image is rendered and the region
+	// copied. Returns false with a message if a device can't build its kernels.
+	bool render_region(ortho_view const& view, accel_mode mode, render_roi const& roi, framebuffer_view const& target, render_roi const& window);
+
+	// True if the last render() or render_tiles() wrote all of target; render_tiles() does when
+	// the kernels can't launch over part of the image
+	bool rendered_whole_image() const
+	{
+		return rendered_;
+	}
+
+	accel_mode mode() const
+	{
+		return scene_.mode;
+	}
+
+	std::vector<render_device> const& devices() const
+	{
+		return devices_;
+	}
+
+private:
+	// Build the structure of mode for view and set the devices up for it, unless they already
+	// are, and write the spheres edited since into the device buffers, refitting the structure
+	// to them where it can
+	bool prepare(ortho_view const& view, accel_mode mode);
+
+	// Remember the footprints of the spheres indices in the last image for render_changes()
+	void mark_footprints(std::vector<std::uint32_t> const& indices);
+
+	// Scene set aside by set_scene() with the device arrays it had, one entry per device
+	struct cached_scene
+	{
+		std::string digest;
+		render_scene scene;
+		accel_mode requested;
+		bool prepared;
+		std::vector<device_arrays> arrays;
+	};
+
+	// Set scene_ aside under digest_ if there is one, the devices hold its buffers and it reads
+	// no file, then drop the least recently set aside scenes over the budget
+	void stash_scene();
+
+	// Upload the spheres from scene_ instead of the mapped file they were loaded from, once
+	// they were edited
+	void drop_file();
+
+	// Render the whole image of the prepared view into target, unless cancel is cancelled
+	// before the image is done
+	void render_image(framebuffer_view const& target, cancel_token const* cancel = nullptr);
+
+	// True if the kernels of every device can launch over part of the image
+	bool partial_launches() const;
+
+	// Launch the kernels over the runs of tiles in a row and read them into target, which holds
+	// the pixels of window. With cancel or on_run kRunsInFlight runs are queued at a time,
+	// on_run is called with each run once its read is done and the runs left once cancel is
+	// cancelled aren't launched.
+	cl_int render_runs(std::vector<tile> const& tiles, framebuffer_view const& target, render_roi const& window, cancel_token const* cancel = nullptr,
+	                   std::function<void(tile const&)> const& on_run = nullptr);
+
+	std::mutex mutex_;
+	std::string src_;
+	gpu_settings settings_;
+	std::vector<render_device> devices_;
+	render_scene scene_;
+	// Counts set_scene() calls, the key of the scene the device buffers hold
+	std::uint64_t scene_revision_ = 0;
+	// scene_ holds the structure of requested_ for scene_.view
+	bool prepared_ = false;
+	accel_mode requested_ = accel_mode::none;
+	// The devices are set up for scene_
+	bool devices_ready_ = false;
+	// An image of scene_.view was rendered; dirty_ holds the footprints in it edited spheres
+	// covered or cover now
+	bool rendered_ = false;
+	std::vector<pixel_rect> dirty_;
+	// Spheres added, removed and moved since the devices were last written
+	scene_edits edits_;
+	// Rows of the bands set_band_rows() asked for
+	std::uint32_t band_rows_ = 0;
+	// Names scene_ for the cache, empty once it was edited
+	std::string digest_;
+	// Scenes set aside, the most recent first
+	std::list<cached_scene> cache_;
+	std::uint64_t scene_hits_ = 0;
+	std::uint64_t scene_misses_ = 0;
+	// Summed up for take_times()
+	render_times times_;
+	// Full image render_frame reads the bands into
+	std::vector<unsigned char> frame_;
+};
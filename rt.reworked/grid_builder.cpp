@@ -0,0 +1,161 @@
+#include "grid_builder.h"
+
+#include <algorithm>
+
+#include "device_memory.h"
+#include "lbvh_builder.h"
+
+namespace
+{
+	// Global size of count work-items in whole groups of group
+	cl::NDRange whole_groups(std::size_t count, std::size_t group)
+	{
+		return cl::NDRange((std::max<std::size_t>(count, 1U) + group - 1) / group * group);
+	}
+}
+
+bool init_grid_builder(grid_builder& builder, render_device const& dev, sphere_soa const& spheres, sphere_grid const& layout, std::size_t capacity)
+{
+	cl_int err = CL_SUCCESS;
+
+	cl::Kernel* kernels[] = { &builder.count, &builder.scan, &builder.pairs, &builder.digits, &builder.scatter, &builder.starts };
+	char const* names[] = { "grid_count", "radix_scan", "grid_pairs", "radix_count", "radix_scatter", "grid_starts" };
+
+	for (auto k = 0; k < 6; ++k)
+	{
+		*kernels[k] = cl::Kernel(dev.program, names[k], &err);
+
+		if (err != CL_SUCCESS)
+			return false;
+	}
+
+	builder.spheres = spheres.size();
+	builder.cell_size = layout.cell_size;
+	builder.cells_x = layout.cells_x;
+	builder.cells_y = layout.cells_y;
+	builder.capacity = static_cast<std::uint32_t>(std::max<std::size_t>(capacity, 1U));
+
+	// the low bits of the unused keys, all set, must sort after every cell, an even number of
+	// passes leaves the pairs in the first buffers
+	std::uint64_t num_cells = std::uint64_t(layout.cells_x) * layout.cells_y;
+	builder.passes = 2;
+
+	while ((std::uint64_t(1) << (4 * builder.passes)) - 1 < num_cells)
+	{
+		builder.passes += 2;
+	}
+
+	std::size_t n = std::max<std::size_t>(spheres.size(), 1U);
+	std::size_t groups = (builder.capacity + kRadixGroup - 1) / kRadixGroup;
+
+	auto make = [&](std::size_t size, char const* name)
+	{
+		cl_int made = CL_SUCCESS;
+		cl::Buffer buffer = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, size, nullptr, &made, name);
+		err = made != CL_SUCCESS ? made : err;
+		return buffer;
+	};
+
+	builder.cells = make(sizeof(cl_int4) * n, "grid cells");
+	builder.offsets = make(sizeof(std::uint32_t) * n, "grid offsets");
+
+	for (auto b = 0; b < 2; ++b)
+	{
+		builder.keys[b] = make(sizeof(std::uint32_t) * builder.capacity, "grid keys");
+		builder.values[b] = make(sizeof(std::uint32_t) * builder.capacity, "grid values");
+	}
+
+	builder.histogram = make(sizeof(std::uint32_t) * 16 * groups, "grid histogram");
+	builder.cell_start = make(sizeof(std::uint32_t) * (num_cells + 1), "grid cell starts");
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	builder.radius = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(float) * n, nullptr, &err, "grid radii");
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	if (!spheres.radius.empty())
+		err = dev.queue.enqueueWriteBuffer(builder.radius, CL_TRUE, 0, sizeof(float) * spheres.size(), spheres.radius.data());
+
+	return err == CL_SUCCESS;
+}
+
+cl_int enqueue_grid_build(grid_builder& builder, render_device& dev, cl::Buffer const* cx, cl::Buffer const* cz, std::vector<cl::Event> const* wait,
+                          cl::Event* first, cl::Event* done)
+{
+	cl_int err = CL_SUCCESS;
+	cl_uint n = builder.spheres;
+	cl_uint capacity = builder.capacity;
+	cl_uint num_cells = builder.cells_x * builder.cells_y;
+
+	cl_uint groups = (capacity + kRadixGroup - 1) / kRadixGroup;
+	cl::NDRange radix_global(std::size_t(groups) * kRadixGroup);
+	cl::NDRange radix_local(kRadixGroup);
+
+	// the pairs no sphere writes sort after every cell
+	err = dev.queue.enqueueFillBuffer(builder.keys[0], cl_uint(0xFFFFFFFFU), 0, sizeof(cl_uint) * capacity, wait, first);
+
+	if (n != 0)
+	{
+		auto& count = builder.count;
+		err = cx ? count.setArg(0, *cx) : set_scene_arg(dev, count, 0);
+		err = set_scene_arg(dev, count, 1);
+		err = cz ? count.setArg(2, *cz) : set_scene_arg(dev, count, 2);
+		err = set_scene_arg(dev, count, 3);
+		err = count.setArg(4, builder.radius);
+		err = count.setArg(5, n);
+		err = count.setArg(6, builder.cell_size);
+		err = count.setArg(7, builder.cells);
+		err = count.setArg(8, builder.offsets);
+		err = dev.queue.enqueueNDRangeKernel(count, cl::NullRange, whole_groups(n, 64), cl::NullRange);
+
+		err = builder.scan.setArg(0, builder.offsets);
+		err = builder.scan.setArg(1, n);
+		err = dev.queue.enqueueNDRangeKernel(builder.scan, cl::NullRange, radix_local, radix_local);
+
+		err = builder.pairs.setArg(0, builder.cells);
+		err = builder.pairs.setArg(1, builder.offsets);
+		err = builder.pairs.setArg(2, n);
+		err = builder.pairs.setArg(3, builder.cells_x);
+		err = builder.pairs.setArg(4, capacity);
+		err = builder.pairs.setArg(5, builder.keys[0]);
+		err = builder.pairs.setArg(6, builder.values[0]);
+		err = dev.queue.enqueueNDRangeKernel(builder.pairs, cl::NullRange, whole_groups(n, 64), cl::NullRange);
+	}
+
+	for (cl_uint pass = 0; pass < builder.passes; ++pass)
+	{
+		auto from = pass % 2;
+		auto to = 1 - from;
+		cl_uint shift = pass * 4;
+
+		err = builder.digits.setArg(0, builder.keys[from]);
+		err = builder.digits.setArg(1, capacity);
+		err = builder.digits.setArg(2, shift);
+		err = builder.digits.setArg(3, builder.histogram);
+		err = dev.queue.enqueueNDRangeKernel(builder.digits, cl::NullRange, radix_global, radix_local);
+
+		err = builder.scan.setArg(0, builder.histogram);
+		err = builder.scan.setArg(1, groups * 16);
+		err = dev.queue.enqueueNDRangeKernel(builder.scan, cl::NullRange, radix_local, radix_local);
+
+		err = builder.scatter.setArg(0, builder.keys[from]);
+		err = builder.scatter.setArg(1, builder.values[from]);
+		err = builder.scatter.setArg(2, builder.keys[to]);
+		err = builder.scatter.setArg(3, builder.values[to]);
+		err = builder.scatter.setArg(4, capacity);
+		err = builder.scatter.setArg(5, shift);
+		err = builder.scatter.setArg(6, builder.histogram);
+		err = dev.queue.enqueueNDRangeKernel(builder.scatter, cl::NullRange, radix_global, radix_local);
+	}
+
+	err = builder.starts.setArg(0, builder.keys[0]);
+	err = builder.starts.setArg(1, capacity);
+	err = builder.starts.setArg(2, num_cells);
+	err = builder.starts.setArg(3, builder.cell_start);
+	err = dev.queue.enqueueNDRangeKernel(builder.starts, cl::NullRange, whole_groups(std::size_t(capacity) + 1, 64), cl::NullRange, nullptr, done);
+
+	return err;
+}
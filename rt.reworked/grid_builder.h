@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+#include "grid.h"
+#include "render_device.h"
+#include "scene.h"
+
+// Kernels and buffers of the on-device screen-space grid (grid_count .. grid_starts in
+// trace.cl) of a render_device, for animations traced with --accel grid: binning the moved
+// spheres on the host and uploading the lists every frame would take longer than the frame.
+// The build counts the cells of the footprint of every sphere, scans the counts into the
+// first (cell, sphere) pair of each, writes the pairs in sphere order and sorts them by cell
+// with the stable radix sort of the BVH builder (lbvh_builder.h), so every cell lists its
+// spheres in index order like build_grid and trace_grid finds the hits of trace. The pairs
+// are sized once for the whole animation, see init_grid_builder; the unused ones sort last.
+struct grid_builder
+{
+	cl::Kernel count, scan, pairs, digits, scatter, starts;
+	std::uint32_t spheres = 0;
+	// Layout of the grid, the one init_device set up the grid kernel with
+	std::uint32_t cell_size = 0;
+	std::uint32_t cells_x = 0, cells_y = 0;
+	// Pairs the buffers hold, and the radix passes of 4 bits that sort their cell keys
+	std::uint32_t capacity = 0;
+	std::uint32_t passes = 0;
+	// Cells of the footprint of every sphere, their counts scanned into the first pair of each
+	cl::Buffer cells, offsets;
+	// Cell keys and sphere indices of the pairs, sorted from one of each pair into the other
+	cl::Buffer keys[2], values[2];
+	cl::Buffer histogram;
+	// The num_cells + 1 entries of sphere_grid::cell_start; the indices are values[0]
+	cl::Buffer cell_start;
+	// Radii of the spheres, which don't change between frames
+	cl::Buffer radius;
+};
+
+// Create the kernels of builder from the program of dev and its buffers for spheres binned in
+// the cells of layout, with room for capacity pairs, which must bound the pairs of every frame
+// the builder builds. The radii are uploaded once. Returns false if a kernel or buffer can't be
+// created.
+bool init_grid_builder(grid_builder& builder, render_device const& dev, sphere_soa const& spheres, sphere_grid const& layout, std::size_t capacity);
+
+// Enqueue the build over the spheres of dev, with the centers in cx and cz if they are not
+// null (the moving ones of an animation frame), on dev.queue after wait. first and done
+// receive the events of the first and last command, to time the build.
+cl_int enqueue_grid_build(grid_builder& builder, render_device& dev, cl::Buffer const* cx, cl::Buffer const* cz, std::vector<cl::Event> const* wait,
+                          cl::Event* first, cl::Event* done);
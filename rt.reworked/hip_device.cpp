@@ -0,0 +1,316 @@
+#include "hip_device.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#ifdef RT_WITH_HIP
+#include <hip/hip_runtime.h>
+#include <hip/hiprtc.h>
+#endif
+
+#ifdef RT_WITH_HIP
+namespace
+{
+	// Milliseconds from first to last, both recorded and finished
+	double elapsed(hipEvent_t first, hipEvent_t last)
+	{
+		float ms = 0.f;
+		hipEventElapsedTime(&ms, first, last);
+		return ms;
+	}
+
+	double host_ms(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Ordinal of the device selector names, see init_hip_device, or -1
+	int select_hip_device(std::string const& selector)
+	{
+		int count = 0;
+
+		if (hipGetDeviceCount(&count) != hipSuccess || count == 0)
+			return -1;
+
+		if (selector.empty())
+			return 0;
+
+		char* end = nullptr;
+		long ordinal = std::strtol(selector.c_str(), &end, 10);
+
+		if (*end == '\0')
+			return ordinal >= 0 && ordinal < count ? static_cast<int>(ordinal) : -1;
+
+		for (int d = 0; d < count; ++d)
+		{
+			hipDeviceProp_t props;
+
+			if (hipGetDeviceProperties(&props, d) == hipSuccess && std::string(props.name).find(selector) != std::string::npos)
+				return d;
+		}
+
+		return -1;
+	}
+
+	// Copy size bytes of data into a new allocation of dev
+	void* upload(hip_device& dev, void const* data, std::size_t size)
+	{
+		void* buffer = nullptr;
+
+		if (hipMalloc(&buffer, size) != hipSuccess)
+			return nullptr;
+
+		dev.buffers.push_back(buffer);
+		hipMemcpyAsync(buffer, data, size, hipMemcpyHostToDevice, static_cast<hipStream_t>(dev.stream));
+		return buffer;
+	}
+}
+#endif
+
+hip_device::~hip_device()
+{
+#ifdef RT_WITH_HIP
+	for (auto buffer : buffers)
+	{
+		hipFree(buffer);
+	}
+
+	if (out_buf)
+		hipFree(out_buf);
+
+	if (stream)
+		hipStreamDestroy(static_cast<hipStream_t>(stream));
+
+	if (module)
+		hipModuleUnload(static_cast<hipModule_t>(module));
+#endif
+}
+
+bool init_hip_device(hip_device& dev, std::string const& src, render_scene const& scene, pixel_format format, std::string const& selector)
+{
+#ifdef RT_WITH_HIP
+	dev.ordinal = select_hip_device(selector);
+
+	if (dev.ordinal < 0)
+	{
+		std::cout << " No HIP device matches \"" << selector << "\"\n";
+		return false;
+	}
+
+	hipDeviceProp_t props;
+	hipGetDeviceProperties(&props, dev.ordinal);
+	hipSetDevice(dev.ordinal);
+
+	dev.name = props.name;
+	dev.format = format;
+	dev.view = scene.view;
+
+	char const* kernel_name = nullptr;
+
+	switch (scene.mode)
+	{
+	case accel_mode::none: kernel_name = "trace"; break;
+	case accel_mode::bvh: kernel_name = "trace_bvh"; break;
+	case accel_mode::sorted: kernel_name = "trace_sorted"; break;
+	case accel_mode::grid:
+	case accel_mode::adaptive: kernel_name = "trace_grid"; break;
+	default:
+		std::cout << "trace.hip has no kernel for " << accel_mode_name(scene.mode) << "\n";
+		return false;
+	}
+
+	// no contraction and correctly rounded sqrt, as for trace.cl; the -D options are split
+	// into one argument each
+	std::vector<std::string> options = { "-std=c++17", "-ffp-contract=off", "-fhip-fp32-correctly-rounded-divide-sqrt",
+	                                     std::string("--offload-arch=") + props.gcnArchName };
+
+	std::istringstream defines(scene_defines(scene, format));
+	std::string word;
+
+	while (defines >> word)
+	{
+		if (word != "-D")
+			options.push_back("-D" + word);
+	}
+
+	if (scene.neighbour_hint && (scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted))
+	{
+		options.push_back("-DRT_NEIGHBOUR_HINT");
+	}
+
+	std::vector<char const*> option_ptrs;
+
+	for (auto const& option : options)
+	{
+		option_ptrs.push_back(option.c_str());
+	}
+
+	auto build_start = std::chrono::high_resolution_clock::now();
+
+	hiprtcProgram program;
+	hiprtcCreateProgram(&program, src.c_str(), "trace.hip", 0, nullptr, nullptr);
+
+	if (hiprtcCompileProgram(program, static_cast<int>(option_ptrs.size()), option_ptrs.data()) != HIPRTC_SUCCESS)
+	{
+		std::size_t log_size = 0;
+		hiprtcGetProgramLogSize(program, &log_size);
+
+		std::string log(log_size, '\0');
+		hiprtcGetProgramLog(program, &log[0]);
+		hiprtcDestroyProgram(&program);
+
+		std::cout << "trace.hip does not build for " << dev.name << ":\n" << log << "\n";
+		return false;
+	}
+
+	std::size_t code_size = 0;
+	hiprtcGetCodeSize(program, &code_size);
+
+	std::vector<char> code(code_size);
+	hiprtcGetCode(program, code.data());
+	hiprtcDestroyProgram(&program);
+
+	hipModule_t module = nullptr;
+	hipFunction_t function = nullptr;
+
+	if (hipModuleLoadData(&module, code.data()) != hipSuccess || hipModuleGetFunction(&function, module, kernel_name) != hipSuccess)
+	{
+		std::cout << "Can't load " << kernel_name << " on " << dev.name << "\n";
+
+		if (module)
+			hipModuleUnload(module);
+
+		return false;
+	}
+
+	dev.module = module;
+	dev.function = function;
+
+	dev.build_time = host_ms(build_start);
+
+	auto upload_start = std::chrono::high_resolution_clock::now();
+
+	hipStream_t stream = nullptr;
+	hipStreamCreate(&stream);
+	dev.stream = stream;
+
+	auto const& spheres = scene.spheres;
+	bool uploaded = upload(dev, spheres.cx.data(), sizeof(float) * spheres.cx.size()) && upload(dev, spheres.cy.data(), sizeof(float) * spheres.cy.size()) &&
+	                upload(dev, spheres.cz.data(), sizeof(float) * spheres.cz.size()) &&
+	                upload(dev, spheres.radius2.data(), sizeof(float) * spheres.radius2.size()) &&
+	                upload(dev, spheres.color.data(), sizeof(float) * spheres.color.size());
+
+	if (scene.mode == accel_mode::bvh)
+	{
+		uploaded = uploaded && upload(dev, scene.accel.nodes.data(), sizeof(bvh_node) * scene.accel.nodes.size()) &&
+		           upload(dev, scene.accel.indices.data(), sizeof(std::uint32_t) * scene.accel.indices.size());
+	}
+	else if (scene.mode == accel_mode::sorted)
+	{
+		uploaded = uploaded && upload(dev, scene.order.indices.data(), sizeof(std::uint32_t) * scene.order.indices.size()) &&
+		           upload(dev, scene.order.zmin.data(), sizeof(float) * scene.order.zmin.size());
+	}
+	else if (scene.mode != accel_mode::none)
+	{
+		uploaded = uploaded && upload(dev, scene.grid.cell_start.data(), sizeof(std::uint32_t) * scene.grid.cell_start.size()) &&
+		           upload(dev, scene.grid.indices.data(), sizeof(std::uint32_t) * scene.grid.indices.size());
+		dev.cell_size = scene.grid.cell_size;
+		dev.cells_x = scene.grid.cells_x;
+	}
+
+	uploaded = uploaded && hipMalloc(&dev.out_buf, pixel_size(format) * dev.view.image_width * dev.view.image_height) == hipSuccess;
+	uploaded = uploaded && hipStreamSynchronize(stream) == hipSuccess;
+
+	if (!uploaded)
+	{
+		std::cout << "Can't upload the scene to " << dev.name << "\n";
+		return false;
+	}
+
+	dev.upload_time = host_ms(upload_start);
+	return true;
+#else
+	(void)dev;
+	(void)src;
+	(void)scene;
+	(void)format;
+	(void)selector;
+
+	std::cout << "This build has no HIP support, build with RT_WITH_HIP for --backend hip\n";
+	return false;
+#endif
+}
+
+bool render_hip_frame(hip_device& dev, std::vector<unsigned char>& img)
+{
+#ifdef RT_WITH_HIP
+	auto stream = static_cast<hipStream_t>(dev.stream);
+
+	// the kernels take the scene buffers in upload order, then the grid's numbers and the image
+	std::vector<void*> args;
+
+	for (auto& buffer : dev.buffers)
+	{
+		args.push_back(&buffer);
+	}
+
+	if (dev.cell_size != 0)
+	{
+		args.push_back(&dev.cell_size);
+		args.push_back(&dev.cells_x);
+	}
+
+	args.push_back(&dev.out_buf);
+
+	hipEvent_t events[4];
+
+	for (auto& event : events)
+	{
+		hipEventCreate(&event);
+	}
+
+	auto width = dev.view.image_width;
+	auto height = dev.view.image_height;
+	auto size = pixel_size(dev.format) * width * height;
+
+	hipEventRecord(events[0], stream);
+
+	auto launch_start = std::chrono::high_resolution_clock::now();
+	auto err = hipModuleLaunchKernel(static_cast<hipFunction_t>(dev.function), (width + kGroupTileSize - 1) / kGroupTileSize,
+	                                 (height + kGroupTileSize - 1) / kGroupTileSize, 1, kGroupTileSize, kGroupTileSize, 1, 0, stream, args.data(), nullptr);
+	double launch_time = host_ms(launch_start);
+
+	hipEventRecord(events[1], stream);
+	hipEventRecord(events[2], stream);
+
+	auto copy_start = std::chrono::high_resolution_clock::now();
+	err = err == hipSuccess ? hipMemcpyAsync(&img[0], dev.out_buf, size, hipMemcpyDeviceToHost, stream) : err;
+	double copy_time = host_ms(copy_start);
+
+	hipEventRecord(events[3], stream);
+	hipEventSynchronize(events[3]);
+
+	dev.kernel_profile = command_time{ launch_time, 0.0, elapsed(events[0], events[1]) };
+	dev.transfer_profile = command_time{ copy_time, 0.0, elapsed(events[2], events[3]) };
+	dev.kernel_time = dev.kernel_profile.run;
+	dev.transfer_time = dev.transfer_profile.run;
+
+	for (auto& event : events)
+	{
+		hipEventDestroy(event);
+	}
+
+	return err == hipSuccess;
+#else
+	(void)dev;
+	(void)img;
+	return false;
+#endif
+}
+
+void print_profile(hip_device const& dev)
+{
+	print_profile(dev.kernel_profile, dev.transfer_profile);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "accel.h"
+#include "pixel_format.h"
+#include "render_device.h"
+
+// One AMD GPU rendering whole frames through HIP for --backend hip: the kernels of trace.hip,
+// the ports of trace, trace_bvh, trace_sorted and trace_grid, are compiled by hiprtc with the
+// scene_defines() options trace.cl gets and read the same sphere arrays and structures. The
+// HIP runtime is only used if the program is built with RT_WITH_HIP, otherwise
+// init_hip_device fails with a message.
+struct hip_device
+{
+	hip_device() = default;
+	~hip_device();
+
+	hip_device(hip_device const&) = delete;
+	hip_device& operator=(hip_device const&) = delete;
+
+	int ordinal = -1;
+	std::string name;
+	// hipModule_t, hipFunction_t and hipStream_t, opaque so this header doesn't need HIP
+	void* module = nullptr;
+	void* function = nullptr;
+	void* stream = nullptr;
+	// Device allocations of the scene, the sphere arrays first, and of the output image
+	std::vector<void*> buffers;
+	void* out_buf = nullptr;
+	// Kernel arguments after the sphere arrays and before the output, the grid's cell size and width
+	std::uint32_t cell_size = 0, cells_x = 0;
+	pixel_format format = pixel_format::float32;
+	ortho_view view;
+	// Program build and scene upload of init_hip_device in ms
+	double build_time = 0.0;
+	double upload_time = 0.0;
+	// Profiles of the last frame's kernel and readback. HIP events have no submit timestamp:
+	// queued is the time the launch or copy call took on the host, submitted stays 0.
+	command_time kernel_profile = {};
+	command_time transfer_profile = {};
+	double kernel_time = 0.0;
+	double transfer_time = 0.0;
+};
+
+// Pick the HIP device named by selector, its ordinal or part of its name, or the first one if
+// it is empty, build the kernel of scene.mode from src and upload the scene. brute force, bvh,
+// sorted, grid and adaptive scenes render, adaptive through the grid like on the OpenCL
+// devices. Returns false with a message if there is no such device, the mode has no kernel
+// or the program does not build.
+bool init_hip_device(hip_device& dev, std::string const& src, render_scene const& scene, pixel_format format, std::string const& selector);
+
+// Render the whole image of dev into img and record the kernel and readback times
+bool render_hip_frame(hip_device& dev, std::vector<unsigned char>& img);
+
+// Print the queue, launch and run times of the last kernel and readback of dev
+void print_profile(hip_device const& dev);
@@ -0,0 +1,80 @@
+#include "job_memory.h"
+
+#include <algorithm>
+
+#include "bvh.h"
+#include "render_device.h"
+
+namespace
+{
+	// Floats of a sphere in sphere_soa: center, squared radius, radius and color
+	std::size_t const kSphereBytes = 8 * sizeof(float);
+
+	// Bytes of the structure of mode per sphere, on the host and on every device: a BVH of a
+	// leaf per sphere at worst with its index list, an index per sphere and cell it covers for
+	// the grids, keys and indices for the depth order
+	std::size_t structure_bytes(accel_mode mode)
+	{
+		switch (mode)
+		{
+		case accel_mode::bvh: return 2 * sizeof(bvh_node) + sizeof(std::uint32_t);
+		case accel_mode::grid: return 4 * sizeof(std::uint32_t);
+		case accel_mode::adaptive: return 4 * sizeof(std::uint32_t);
+		case accel_mode::splat: return 2 * sizeof(std::uint32_t);
+		case accel_mode::sorted: return 2 * sizeof(std::uint32_t);
+		default: return 0;
+		}
+	}
+}
+
+job_memory estimate_job_memory(std::uint32_t num_spheres, accel_mode mode, ortho_view const& view, pixel_format format, std::size_t num_views,
+                               std::uint32_t band_rows)
+{
+	std::size_t scene = (kSphereBytes + structure_bytes(mode)) * num_spheres;
+	std::size_t row_bytes = pixel_size(format) * view.image_width;
+	std::size_t image = row_bytes * view.image_height * num_views;
+	std::size_t device_image = band_rows != 0 ? row_bytes * std::min(band_rows, view.image_height) * kBandOutputs : image;
+
+	// splat keeps a depth key per pixel next to the image
+	if (mode == accel_mode::splat)
+		device_image += sizeof(std::uint64_t) * view.image_width * (band_rows != 0 ? std::min(band_rows, view.image_height) : view.image_height) * num_views;
+
+	return job_memory{ scene + 2 * image, scene + device_image };
+}
+
+bool fit_band_rows(std::uint32_t num_spheres, accel_mode mode, ortho_view const& view, pixel_format format, memory_budget const& budget,
+                   job_memory const& taken, std::uint32_t& band_rows)
+{
+	auto fits = [&](std::uint32_t rows)
+	{
+		auto memory = estimate_job_memory(num_spheres, mode, view, format, 1, rows);
+		memory.host += taken.host;
+		memory.device += taken.device;
+		return budget.fits(memory);
+	};
+
+	band_rows = 0;
+
+	if (fits(0))
+		return true;
+
+	if (!fits(kGroupTileSize))
+		return false;
+
+	// the most whole tiles of rows that fit, the device side grows with the rows
+	std::uint32_t low = 1;
+	std::uint32_t high = (view.image_height + kGroupTileSize - 1) / kGroupTileSize;
+
+	while (low < high)
+	{
+		auto mid = low + (high - low + 1) / 2;
+
+		if (fits(mid * kGroupTileSize))
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	band_rows = low * kGroupTileSize;
+	return true;
+}
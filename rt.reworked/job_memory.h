@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "accel.h"
+#include "grid.h"
+#include "pixel_format.h"
+
+// Bytes a render job of the server holds while it renders, on the host and on every device
+struct job_memory
+{
+	std::size_t host;
+	std::size_t device;
+};
+
+// Memory the render server admits jobs within (--host-budget, --device-budget), 0 for no limit
+struct memory_budget
+{
+	std::size_t host = 0;
+	std::size_t device = 0;
+
+	bool fits(job_memory const& memory) const
+	{
+		return (host == 0 || memory.host <= host) && (device == 0 || memory.device <= device);
+	}
+};
+
+// Estimate the memory of a job rendering num_views images of view in format from a scene of
+// num_spheres spheres with mode, before its scene is loaded: the sphere arrays on the host and
+// on every device, the structure of mode on both, sized from the spheres alone, and the
+// framebuffers. A device holds the images whole, or kBandOutputs bands of band_rows rows of one
+// with band_rows; the host holds the images gpu_renderer reads into and the ones written. The
+// estimates of the structures err on the large side.
+job_memory estimate_job_memory(std::uint32_t num_spheres, accel_mode mode, ortho_view const& view, pixel_format format, std::size_t num_views,
+                               std::uint32_t band_rows);
+
+// The rows of the bands a job of one image must render in to fit budget next to the memory
+// taken already, on the host and on every device: 0 if the image fits whole, else the most
+// rows, whole multiples of kGroupTileSize, that fit. Returns false if even bands of
+// kGroupTileSize rows or the host side don't fit.
+bool fit_band_rows(std::uint32_t num_spheres, accel_mode mode, ortho_view const& view, pixel_format format, memory_budget const& budget,
+                   job_memory const& taken, std::uint32_t& band_rows);
@@ -0,0 +1,257 @@
+#include "job_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+#include "line_server.h"
+
+bool job_trace_writer::open(std::string const& path)
+{
+	out_.open(path, std::ios::trunc);
+
+	if (!out_)
+	{
+		std::cout << "Can't create the job trace " << path << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+void job_trace_writer::record(traced_job const& job)
+{
+	out_ << job.time << '\t' << (job.scene_hash.empty() ? "-" : job.scene_hash) << '\t' << job.width << '\t' << job.height << '\t'
+	     << (job.interactive ? "interactive" : "batch") << '\t' << job.line << std::endl;
+}
+
+bool load_job_trace(std::string const& path, std::vector<traced_job>& jobs)
+{
+	std::ifstream in(path);
+
+	if (!in)
+	{
+		std::cout << "Can't read the job trace " << path << "\n";
+		return false;
+	}
+
+	std::string record;
+	std::size_t number = 0;
+
+	while (std::getline(in, record))
+	{
+		++number;
+
+		if (record.empty())
+			continue;
+
+		std::istringstream fields(record);
+		traced_job job;
+		std::string priority;
+
+		// the line may hold tabs of its own, it is the rest of the record
+		if (!(fields >> job.time >> job.scene_hash >> job.width >> job.height >> priority) || fields.get() != '\t' ||
+		    (priority != "interactive" && priority != "batch"))
+		{
+			std::cout << path << ":" << number << ": expected time, scene hash, width, height, priority and the job line\n";
+			return false;
+		}
+
+		std::getline(fields, job.line);
+
+		if (job.scene_hash == "-")
+			job.scene_hash.clear();
+
+		job.interactive = priority == "interactive";
+		jobs.push_back(std::move(job));
+	}
+
+	if (jobs.empty())
+	{
+		std::cout << path << " holds no jobs\n";
+		return false;
+	}
+
+	return true;
+}
+
+latency_summary summarize_latencies(std::vector<double> samples)
+{
+	latency_summary summary = {};
+
+	if (samples.empty())
+		return summary;
+
+	std::sort(samples.begin(), samples.end());
+
+	auto rank = [&](double p)
+	{
+		return samples[std::max<std::size_t>(static_cast<std::size_t>(std::ceil(p * samples.size())), 1) - 1];
+	};
+
+	summary.p50 = rank(0.5);
+	summary.p95 = rank(0.95);
+	summary.p99 = rank(0.99);
+	summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+	summary.max = samples.back();
+	return summary;
+}
+
+bool replay_jobs(std::vector<traced_job> const& jobs, std::uint16_t port, double rate, replay_report& report)
+{
+	typedef std::chrono::steady_clock clock;
+
+	line_client client;
+
+	if (!client.connect(port))
+		return false;
+
+	// jobs sent and not answered yet, by the order the server answers them in
+	struct sent_job
+	{
+		std::size_t index;
+		clock::time_point sent;
+	};
+
+	std::mutex mutex;
+	std::condition_variable stopped;
+	std::deque<sent_job> batch, interactive;
+	bool stop = false;
+	bool send_failed = false;
+
+	auto start = clock::now();
+	double first = jobs.front().time;
+
+	std::thread sender([&]
+	{
+		for (std::size_t i = 0; i < jobs.size(); ++i)
+		{
+			auto offset = std::chrono::duration<double, std::milli>(std::max(jobs[i].time - first, 0.0) / rate);
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				if (stopped.wait_until(lock, start + std::chrono::duration_cast<clock::duration>(offset), [&] { return stop; }))
+					return;
+
+				(jobs[i].interactive ? interactive : batch).push_back(sent_job{ i, clock::now() });
+			}
+
+			if (!client.write_line(jobs[i].line))
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				send_failed = true;
+				return;
+			}
+		}
+	});
+
+	std::vector<double> latencies, interactive_latencies, queueing;
+	report = replay_report();
+	report.rate = rate;
+
+	std::string prefix = "interactive ";
+	std::string reply;
+	bool answered = true;
+
+	for (std::size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (!client.read_line(reply))
+		{
+			answered = false;
+			break;
+		}
+
+		auto received = clock::now();
+		bool urgent = reply.compare(0, prefix.size(), prefix) == 0;
+
+		sent_job job;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& queue = urgent ? interactive : batch;
+
+			if (queue.empty())
+			{
+				std::cout << "Unexpected answer \"" << reply << "\"\n";
+				answered = false;
+				break;
+			}
+
+			job = queue.front();
+			queue.pop_front();
+		}
+
+		if (urgent)
+			reply.erase(0, prefix.size());
+
+		double latency = std::chrono::duration<double, std::milli>(received - job.sent).count();
+		latencies.push_back(latency);
+
+		if (urgent)
+		{
+			interactive_latencies.push_back(latency);
+			++report.interactive_jobs;
+		}
+
+		if (reply.compare(0, 3, "ok ") == 0)
+			queueing.push_back(std::max(latency - std::atof(reply.c_str() + 3), 0.0));
+		else
+			++report.errors;
+
+		report.duration = std::chrono::duration<double, std::milli>(received - start).count();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+
+	stopped.notify_one();
+	sender.join();
+	client.close();
+
+	if (!answered || send_failed)
+	{
+		std::cout << "The server disconnected after answering " << latencies.size() << " of " << jobs.size() << " jobs\n";
+		return false;
+	}
+
+	report.jobs = latencies.size();
+	report.throughput = report.duration > 0.0 ? report.jobs * 1000.0 / report.duration : 0.0;
+	report.latency = summarize_latencies(latencies);
+	report.interactive_latency = summarize_latencies(interactive_latencies);
+	report.queueing = summarize_latencies(queueing);
+	return true;
+}
+
+void write_replay_json(std::ostream& out, replay_report const& report)
+{
+	auto write_summary = [&](char const* name, latency_summary const& summary, bool last)
+	{
+		out << "  \"" << name << "\": { \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99 << ", \"mean\": " << summary.mean
+		    << ", \"max\": " << summary.max << " }" << (last ? "\n" : ",\n");
+	};
+
+	out << "{\n"
+	    << "  \"jobs\": " << report.jobs << ",\n"
+	    << "  \"errors\": " << report.errors << ",\n"
+	    << "  \"interactive_jobs\": " << report.interactive_jobs << ",\n"
+	    << "  \"rate\": " << report.rate << ",\n"
+	    << "  \"duration_ms\": " << report.duration << ",\n"
+	    << "  \"jobs_per_s\": " << report.throughput << ",\n";
+
+	write_summary("latency_ms", report.latency, false);
+	write_summary("interactive_latency_ms", report.interactive_latency, false);
+	write_summary("queueing_ms", report.queueing, true);
+
+	out << "}\n";
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A job line the render server received, as --record-jobs records it and --replay sends it
+// again. The trace file holds one per line, tab separated in this order, the line last.
+struct traced_job
+{
+	// ms since the server started serving
+	double time;
+	// SHA-1 of the scene key of the job (job_scene_key), empty for a line that isn't a job
+	std::string scene_hash;
+	std::uint32_t width, height;
+	bool interactive;
+	std::string line;
+};
+
+// Appends the jobs a server receives to a trace file, each flushed as it is recorded so the
+// trace of a server that is killed holds every job it took in
+class job_trace_writer
+{
+public:
+	// Create the trace at path. Returns false with a message if it can't be created.
+	bool open(std::string const& path);
+
+	bool is_open() const
+	{
+		return out_.is_open();
+	}
+
+	void record(traced_job const& job);
+
+private:
+	std::ofstream out_;
+};
+
+// Read the trace at path into jobs. Returns false with a message if it can't be read or holds
+// a malformed record.
+bool load_job_trace(std::string const& path, std::vector<traced_job>& jobs);
+
+// Nearest rank percentiles of a set of times in ms
+struct latency_summary
+{
+	double p50, p95, p99, mean, max;
+};
+
+latency_summary summarize_latencies(std::vector<double> samples);
+
+// What replay_jobs measured
+struct replay_report
+{
+	std::size_t jobs;
+	std::size_t errors;
+	std::size_t interactive_jobs;
+	// Speed of the replay, 2 sends the jobs twice as fast as they were recorded
+	double rate;
+	// ms from the first send to the last answer
+	double duration;
+	// Jobs answered per second
+	double throughput;
+	// From sending a job to its answer, of all jobs and of the interactive ones
+	latency_summary latency, interactive_latency;
+	// Of the jobs answered ok: the latency less the time the server reports for the job, which
+	// runs from the start of its batch, so the time the job waited to be taken in
+	latency_summary queueing;
+};
+
+// Send the lines of jobs to the render server on 127.0.0.1:port at the times they were
+// recorded, divided by rate, from a thread of their own, and time their answers: the batch
+// jobs are answered in the order they were sent, the interactive ones ahead of them with
+// "interactive " in front. Returns false with a message if the server can't be reached or
+// disconnects before answering every job.
+bool replay_jobs(std::vector<traced_job> const& jobs, std::uint16_t port, double rate, replay_report& report);
+
+// Write report as a JSON object to out
+void write_replay_json(std::ostream& out, replay_report const& report);
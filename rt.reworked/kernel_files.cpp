@@ -0,0 +1,31 @@
+#include "kernel_files.h"
+
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+std::string load_kernel_file(char const* name, int resource)
+{
+#ifdef _WIN32
+	// resources of the executable stay mapped as long as it runs, nothing is freed; type 10
+	// is RT_RCDATA, whose macro follows the UNICODE setting instead of the A function
+	if (HRSRC info = FindResourceA(nullptr, MAKEINTRESOURCEA(resource), MAKEINTRESOURCEA(10)))
+	{
+		HGLOBAL data = LoadResource(nullptr, info);
+		auto const* bytes = data ? static_cast<char const*>(LockResource(data)) : nullptr;
+
+		if (bytes)
+			return std::string(bytes, SizeofResource(nullptr, info));
+	}
+#else
+	(void)resource;
+#endif
+
+	std::ifstream file(name, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+#include "kernel_resources.h"
+
+// Bytes of the kernel file name, the copy kernels.rc embedded in the executable under resource,
+// or where the executable has none, as in builds without the resource script, the file name
+// in the working directory. Empty if neither exists.
+std::string load_kernel_file(char const* name, int resource);
@@ -0,0 +1,159 @@
+#include "kernel_report.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+	// Work-items a compute unit keeps in flight at most, 64 warps of 32 or 32 wavefronts of 64;
+	// the devices don't report it
+	std::size_t const kResidentItems = 2048;
+
+	// Registers of a compute unit where the device doesn't report them
+	cl_uint const kDefaultRegisters = 65536;
+
+	// CL_DEVICE_REGISTERS_PER_BLOCK_NV of cl_nv_device_attribute_query
+	cl_device_info const kRegistersPerBlockNv = 0x4002;
+
+	bool has_extension(cl::Device const& device, char const* extension)
+	{
+		return device.getInfo<CL_DEVICE_EXTENSIONS>().find(extension) != std::string::npos;
+	}
+
+	// The lines ptxas logs for kernel name with -cl-nv-verbose, from its entry function up to
+	// the next one: "Used N registers" and "N bytes spill stores"
+	void parse_ptxas(std::string const& log, std::string const& name, kernel_resources& resources)
+	{
+		std::string const entry = "Compiling entry function '";
+		auto begin = log.find(entry + name + "'");
+
+		if (begin == std::string::npos)
+			return;
+
+		auto end = log.find(entry, begin + entry.size());
+		std::string block = log.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+
+		auto used = block.find("Used ");
+		unsigned registers = 0;
+
+		if (used != std::string::npos && std::sscanf(block.c_str() + used, "Used %u registers", &registers) == 1)
+		{
+			resources.registers = registers;
+			resources.registers_known = true;
+		}
+
+		auto spills = block.find(" bytes spill stores");
+
+		if (spills != std::string::npos)
+		{
+			// the count is the number before the phrase
+			auto digits = block.find_last_not_of("0123456789", spills - 1);
+			resources.spill_bytes = static_cast<std::uint32_t>(std::strtoul(block.c_str() + digits + 1, nullptr, 10));
+		}
+	}
+}
+
+std::string kernel_report_options(cl::Device const& device)
+{
+	return has_extension(device, "cl_nv_compiler_options") ? " -cl-nv-verbose" : std::string();
+}
+
+kernel_resources query_kernel(cl::Kernel const& kernel, cl::Device const& device, std::string const& build_log)
+{
+	kernel_resources resources = {};
+	resources.name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+	resources.private_bytes = kernel.getWorkGroupInfo<CL_KERNEL_PRIVATE_MEM_SIZE>(device);
+	resources.local_bytes = kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+	resources.max_group = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+	resources.group_multiple = kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+
+	auto required = kernel.getWorkGroupInfo<CL_KERNEL_COMPILE_WORK_GROUP_SIZE>(device);
+	resources.required_group = required[0] * required[1] * required[2];
+
+	parse_ptxas(build_log, resources.name, resources);
+	return resources;
+}
+
+std::vector<kernel_resources> query_program(cl::Program const& program, cl::Device const& device)
+{
+	std::vector<cl::Kernel> kernels;
+	std::vector<kernel_resources> resources;
+
+	// createKernels isn't const, the copy shares the program
+	cl::Program built = program;
+
+	if (built.createKernels(&kernels) != CL_SUCCESS)
+		return resources;
+
+	auto log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+
+	for (auto const& kernel : kernels)
+	{
+		resources.push_back(query_kernel(kernel, device, log));
+	}
+
+	return resources;
+}
+
+occupancy_estimate estimate_occupancy(kernel_resources const& resources, cl::Device const& device, std::size_t group)
+{
+	std::size_t items = group != 0 ? group : resources.required_group != 0 ? resources.required_group : resources.max_group;
+	items = std::max<std::size_t>(items, 1U);
+
+	occupancy_estimate estimate{ 0.0, "work-items" };
+	std::size_t groups = kResidentItems / items;
+
+	if (resources.local_bytes > 0)
+	{
+		auto by_local = static_cast<std::size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / resources.local_bytes);
+
+		if (by_local < groups)
+		{
+			groups = by_local;
+			estimate.limit = "local memory";
+		}
+	}
+
+	if (resources.registers_known && resources.registers > 0)
+	{
+		cl_uint registers = 0;
+
+		if (!has_extension(device, "cl_nv_device_attribute_query") || device.getInfo(kRegistersPerBlockNv, &registers) != CL_SUCCESS || registers == 0)
+			registers = kDefaultRegisters;
+
+		auto by_registers = registers / (std::size_t(resources.registers) * items);
+
+		if (by_registers < groups)
+		{
+			groups = by_registers;
+			estimate.limit = "registers";
+		}
+	}
+
+	estimate.occupancy = std::min(static_cast<double>(groups * items) / kResidentItems, 1.0);
+	return estimate;
+}
+
+void print_kernel_report(cl::Program const& program, cl::Device const& device)
+{
+	auto log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+
+	// the log of a clean build is empty or white space on most drivers
+	if (log.find_first_not_of(" \t\r\n") != std::string::npos)
+		std::cout << "  build log:\n" << log << "\n";
+
+	for (auto const& resources : query_program(program, device))
+	{
+		auto estimate = estimate_occupancy(resources, device);
+
+		std::cout << "  " << resources.name << ": private " << resources.private_bytes << " B, local " << resources.local_bytes << " B, work-groups up to "
+		          << resources.max_group << " (multiple of " << resources.group_multiple << ")";
+
+		if (resources.registers_known)
+			std::cout << ", " << resources.registers << " registers, " << (resources.spill_bytes > 0 ? std::to_string(resources.spill_bytes) + " B spilled" : "no spills");
+
+		std::cout << ", occupancy ~" << static_cast<int>(estimate.occupancy * 100.0 + 0.5) << "% (" << estimate.limit << ")\n";
+	}
+}
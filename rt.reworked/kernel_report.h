@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+// Resources one kernel of a built program takes on a device, what bounds how many of its
+// work-items a compute unit keeps in flight (--kernel-report)
+struct kernel_resources
+{
+	std::string name;
+	// CL_KERNEL_PRIVATE_MEM_SIZE per work-item, its stack arrays and spilled registers, and
+	// CL_KERNEL_LOCAL_MEM_SIZE per work-group
+	cl_ulong private_bytes;
+	cl_ulong local_bytes;
+	// CL_KERNEL_WORK_GROUP_SIZE and CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+	std::size_t max_group;
+	std::size_t group_multiple;
+	// Work-items of the reqd_work_group_size the kernel is compiled with, 0 if it has none
+	std::size_t required_group;
+	// Registers per work-item and bytes of spill stores from the build log of the vendor's
+	// compiler, 0 where it doesn't tell; registers_known is set if it did
+	std::uint32_t registers;
+	std::uint32_t spill_bytes;
+	bool registers_known;
+};
+
+// Occupancy of a kernel on a device: the share of the work-items a compute unit can hold that
+// its work-groups keep resident, and what limits them
+struct occupancy_estimate
+{
+	double occupancy;
+	char const* limit;
+};
+
+// Build options that make the compiler of device log the register use and spills of every
+// kernel, " -cl-nv-verbose" on NVIDIA; empty where the vendor has none
+std::string kernel_report_options(cl::Device const& device);
+
+// Resources of kernel on device, the registers and spills taken from build_log, the build log
+// of its program, if it holds them
+kernel_resources query_kernel(cl::Kernel const& kernel, cl::Device const& device, std::string const& build_log);
+
+// Resources of every kernel of program on device, in the order the program lists them
+std::vector<kernel_resources> query_program(cl::Program const& program, cl::Device const& device);
+
+// Estimated occupancy of the kernel of resources on device with work-groups of group
+// work-items, 0 for its required or largest one: as many groups as fit the work-items, the
+// local memory and, with a known register count, the registers of a compute unit
+occupancy_estimate estimate_occupancy(kernel_resources const& resources, cl::Device const& device, std::size_t group = 0);
+
+// Print the build log of program on device, if any, and the resources and occupancy estimate
+// of each of its kernels, one line per kernel
+void print_kernel_report(cl::Program const& program, cl::Device const& device);
@@ -0,0 +1,7 @@
+#pragma once
+
+// Resource ids of the kernel files kernels.rc embeds in the executable, see load_kernel_file
+#define IDR_TRACE_CL 101
+#define IDR_TRACE_HIP 102
+#define IDR_TRACE_SPV 103
+#define IDR_TRACE_RQ_SPV 104
@@ -0,0 +1,223 @@
+#include "lbvh_builder.h"
+
+#include <algorithm>
+
+#include "bvh.h"
+#include "device_memory.h"
+
+namespace
+{
+	// Global size of count work-items in whole groups of group
+	cl::NDRange whole_groups(std::size_t count, std::size_t group)
+	{
+		return cl::NDRange((std::max<std::size_t>(count, 1U) + group - 1) / group * group);
+	}
+}
+
+bool init_lbvh_builder(lbvh_builder& builder, render_device const& dev, sphere_soa const& spheres)
+{
+	cl_int err = CL_SUCCESS;
+
+	cl::Kernel* kernels[] = { &builder.morton, &builder.count, &builder.scan, &builder.scatter, &builder.hierarchy, &builder.bounds, &builder.emit, &builder.cost };
+	char const* names[] = { "lbvh_morton", "radix_count", "radix_scan", "radix_scatter", "lbvh_hierarchy", "lbvh_bounds", "lbvh_emit", "lbvh_cost" };
+
+	for (auto k = 0; k < 8; ++k)
+	{
+		*kernels[k] = cl::Kernel(dev.program, names[k], &err);
+
+		if (err != CL_SUCCESS)
+			return false;
+	}
+
+	std::size_t n = std::max<std::size_t>(spheres.size(), 1U);
+	std::size_t groups = (n + kRadixGroup - 1) / kRadixGroup;
+	std::size_t num_nodes = 2 * n - 1;
+
+	builder.spheres = spheres.size();
+
+	auto make = [&](std::size_t size, char const* name)
+	{
+		cl_int made = CL_SUCCESS;
+		cl::Buffer buffer = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, size, nullptr, &made, name);
+		err = made != CL_SUCCESS ? made : err;
+		return buffer;
+	};
+
+	for (auto b = 0; b < 2; ++b)
+	{
+		builder.keys[b] = make(sizeof(std::uint32_t) * n, "lbvh keys");
+		builder.values[b] = make(sizeof(std::uint32_t) * n, "lbvh values");
+	}
+
+	builder.histogram = make(sizeof(std::uint32_t) * 16 * groups, "lbvh histogram");
+	builder.tree = make(sizeof(cl_int4) * std::max<std::size_t>(n - 1, 1U), "lbvh tree");
+	builder.parents = make(sizeof(std::int32_t) * num_nodes, "lbvh parents");
+	builder.boxes = make(sizeof(float) * 6 * num_nodes, "lbvh boxes");
+	builder.arrivals = make(sizeof(std::int32_t) * std::max<std::size_t>(n - 1, 1U), "lbvh arrivals");
+	builder.nodes = make(sizeof(bvh_node) * num_nodes, "lbvh nodes");
+
+	std::size_t cost_groups = (num_nodes + kRadixGroup - 1) / kRadixGroup;
+	builder.partial_costs = make(sizeof(float) * cost_groups, "lbvh partial costs");
+	builder.partials.assign(cost_groups, 0.f);
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	builder.radius = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(float) * n, nullptr, &err, "lbvh radii");
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	if (!spheres.radius.empty())
+		err = dev.queue.enqueueWriteBuffer(builder.radius, CL_TRUE, 0, sizeof(float) * spheres.size(), spheres.radius.data());
+
+	return err == CL_SUCCESS;
+}
+
+cl_int enqueue_lbvh_build(lbvh_builder& builder, render_device& dev, cl::Buffer const* cx, cl::Buffer const* cz, Imath::Box3f const& centers,
+                          std::vector<cl::Event> const* wait, cl::Event* first, cl::Event* done)
+{
+	cl_int err = CL_SUCCESS;
+	cl_uint n = builder.spheres;
+
+	if (n == 0)
+		return CL_SUCCESS;
+
+	cl_uint groups = (n + kRadixGroup - 1) / kRadixGroup;
+	cl::NDRange radix_global(std::size_t(groups) * kRadixGroup);
+	cl::NDRange radix_local(kRadixGroup);
+
+	// codes in the box of the centers, a flat axis maps to 0
+	auto extent = centers.size();
+	float scale[3] = { extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f, extent.z > 0.f ? 1.f / extent.z : 0.f };
+
+	auto& morton = builder.morton;
+	err = cx ? morton.setArg(0, *cx) : set_scene_arg(dev, morton, 0);
+	err = set_scene_arg(dev, morton, 1);
+	err = cz ? morton.setArg(2, *cz) : set_scene_arg(dev, morton, 2);
+	err = morton.setArg(3, n);
+	err = morton.setArg(4, centers.min.x);
+	err = morton.setArg(5, centers.min.y);
+	err = morton.setArg(6, centers.min.z);
+	err = morton.setArg(7, scale[0]);
+	err = morton.setArg(8, scale[1]);
+	err = morton.setArg(9, scale[2]);
+	err = morton.setArg(10, builder.keys[0]);
+	err = morton.setArg(11, builder.values[0]);
+	err = dev.queue.enqueueNDRangeKernel(morton, cl::NullRange, whole_groups(n, 64), cl::NullRange, wait, first);
+
+	for (cl_uint pass = 0; pass < kRadixPasses; ++pass)
+	{
+		auto from = pass % 2;
+		auto to = 1 - from;
+		cl_uint shift = pass * 4;
+
+		err = builder.count.setArg(0, builder.keys[from]);
+		err = builder.count.setArg(1, n);
+		err = builder.count.setArg(2, shift);
+		err = builder.count.setArg(3, builder.histogram);
+		err = dev.queue.enqueueNDRangeKernel(builder.count, cl::NullRange, radix_global, radix_local);
+
+		err = builder.scan.setArg(0, builder.histogram);
+		err = builder.scan.setArg(1, groups * 16);
+		err = dev.queue.enqueueNDRangeKernel(builder.scan, cl::NullRange, radix_local, radix_local);
+
+		err = builder.scatter.setArg(0, builder.keys[from]);
+		err = builder.scatter.setArg(1, builder.values[from]);
+		err = builder.scatter.setArg(2, builder.keys[to]);
+		err = builder.scatter.setArg(3, builder.values[to]);
+		err = builder.scatter.setArg(4, n);
+		err = builder.scatter.setArg(5, shift);
+		err = builder.scatter.setArg(6, builder.histogram);
+		err = dev.queue.enqueueNDRangeKernel(builder.scatter, cl::NullRange, radix_global, radix_local);
+	}
+
+	// the root has no parent, the other entries are written by lbvh_hierarchy
+	err = dev.queue.enqueueFillBuffer(builder.parents, cl_int(-1), 0, sizeof(cl_int));
+
+	if (n > 1)
+	{
+		err = builder.hierarchy.setArg(0, builder.keys[0]);
+		err = builder.hierarchy.setArg(1, n);
+		err = builder.hierarchy.setArg(2, builder.tree);
+		err = builder.hierarchy.setArg(3, builder.parents);
+		err = dev.queue.enqueueNDRangeKernel(builder.hierarchy, cl::NullRange, whole_groups(n - 1, 64), cl::NullRange);
+	}
+
+	cl_int fitted = enqueue_lbvh_refit(builder, dev, cx, cz, nullptr, nullptr, done);
+	return err != CL_SUCCESS ? err : fitted;
+}
+
+cl_int enqueue_lbvh_refit(lbvh_builder& builder, render_device& dev, cl::Buffer const* cx, cl::Buffer const* cz, std::vector<cl::Event> const* wait,
+                          cl::Event* first, cl::Event* done)
+{
+	cl_int err = CL_SUCCESS;
+	cl_uint n = builder.spheres;
+
+	if (n == 0)
+		return CL_SUCCESS;
+
+	err = dev.queue.enqueueFillBuffer(builder.arrivals, cl_int(0), 0, sizeof(cl_int) * std::max<cl_uint>(n - 1, 1U), wait, first);
+
+	auto& bounds = builder.bounds;
+	err = cx ? bounds.setArg(0, *cx) : set_scene_arg(dev, bounds, 0);
+	err = set_scene_arg(dev, bounds, 1);
+	err = cz ? bounds.setArg(2, *cz) : set_scene_arg(dev, bounds, 2);
+	err = set_scene_arg(dev, bounds, 3);
+	err = bounds.setArg(4, builder.radius);
+	err = bounds.setArg(5, builder.values[0]);
+	err = bounds.setArg(6, n);
+	err = bounds.setArg(7, dev.view.near);
+	err = bounds.setArg(8, builder.tree);
+	err = bounds.setArg(9, builder.parents);
+	err = bounds.setArg(10, builder.boxes);
+	err = bounds.setArg(11, builder.arrivals);
+	err = dev.queue.enqueueNDRangeKernel(bounds, cl::NullRange, whole_groups(n, 64), cl::NullRange);
+
+	err = builder.emit.setArg(0, n);
+	err = builder.emit.setArg(1, builder.tree);
+	err = builder.emit.setArg(2, builder.parents);
+	err = builder.emit.setArg(3, builder.boxes);
+	err = builder.emit.setArg(4, builder.nodes);
+	err = dev.queue.enqueueNDRangeKernel(builder.emit, cl::NullRange, whole_groups(2 * n - 1, 64), cl::NullRange, nullptr, done);
+
+	return err;
+}
+
+cl_int enqueue_lbvh_cost(lbvh_builder& builder, render_device& dev, cl::Event* read)
+{
+	cl_int err = CL_SUCCESS;
+	cl_uint n = builder.spheres;
+
+	if (n == 0)
+		return CL_SUCCESS;
+
+	err = builder.cost.setArg(0, n);
+	err = builder.cost.setArg(1, builder.boxes);
+	err = builder.cost.setArg(2, builder.partial_costs);
+	err = dev.queue.enqueueNDRangeKernel(builder.cost, cl::NullRange, cl::NDRange(builder.partials.size() * kRadixGroup), cl::NDRange(kRadixGroup));
+
+	// node 0 is the root, internal or the only leaf
+	err = dev.queue.enqueueReadBuffer(builder.boxes, CL_FALSE, 0, sizeof(builder.root_box), builder.root_box);
+	err = dev.queue.enqueueReadBuffer(builder.partial_costs, CL_FALSE, 0, sizeof(float) * builder.partials.size(), builder.partials.data(), nullptr, read);
+
+	return err;
+}
+
+double lbvh_cost(lbvh_builder const& builder)
+{
+	double sum = 0.0;
+
+	for (auto partial : builder.partials)
+	{
+		sum += partial;
+	}
+
+	auto const* box = builder.root_box;
+	double dx = box[3] - box[0];
+	double dy = box[4] - box[1];
+	double dz = box[5] - box[2];
+	double root_area = dx * dy + dy * dz + dz * dx;
+
+	return root_area > 0.0 ? sum / root_area : 0.0;
+}
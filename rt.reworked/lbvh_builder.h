@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+#include <OpenEXR/ImathBox.h>
+
+#include "render_device.h"
+#include "scene.h"
+
+// Work-items of a radix sort work-group, kRadixGroup in trace.cl
+std::uint32_t const kRadixGroup = 256;
+
+// Passes of kRadixBits bits over the 30 bit Morton codes, an even number leaves the sorted
+// keys and values in the first buffer of each pair
+std::uint32_t const kRadixPasses = 8;
+
+// Kernels and buffers of the on-device linear BVH (lbvh_morton .. lbvh_emit in trace.cl) of a
+// render_device, for animations whose spheres move every frame: rebuilding the SAH BVH on the
+// host and uploading it would take longer than the frame. The build sorts the spheres by the
+// Morton codes of their centers and emits Karras' radix tree over them as the bvh_node array
+// and indices trace_bvh reads, all on the device's queue in the context of its program. Every
+// leaf holds one sphere with the bounds of sphere_bounds(), the tree is not SAH built but
+// traverses to the same image. A refit keeps the order and the tree of the last build and only
+// recomputes the bounds, for centers that moved a little: the SAH cost of the refit tree
+// tells when it has degraded enough to be built again.
+struct lbvh_builder
+{
+	cl::Kernel morton, count, scan, scatter, hierarchy, bounds, emit, cost;
+	std::uint32_t spheres = 0;
+	// Morton codes and sphere indices, sorted from one of each pair into the other
+	cl::Buffer keys[2], values[2];
+	cl::Buffer histogram;
+	// (first, last, left, right) of each internal node, the parent of every node
+	cl::Buffer tree, parents;
+	// min and max of every node, and the children that arrived at each internal node
+	cl::Buffer boxes, arrivals;
+	// Radii of the spheres, which don't change between frames
+	cl::Buffer radius;
+	// The 2 * spheres - 1 nodes in depth first order; the indices are values[0]
+	cl::Buffer nodes;
+	// Half area sums of lbvh_cost per work-group, and their copy with the root box read back
+	// by enqueue_lbvh_cost
+	cl::Buffer partial_costs;
+	std::vector<float> partials;
+	float root_box[6] = {};
+};
+
+// Create the kernels of builder from the program of dev and its buffers for spheres, whose
+// radii are uploaded once. Returns false if a kernel or buffer can't be created.
+bool init_lbvh_builder(lbvh_builder& builder, render_device const& dev, sphere_soa const& spheres);
+
+// Enqueue the build over the spheres of dev, with the centers in cx and cz if they are not
+// null (the moving ones of an animation frame), on dev.queue after wait. centers bounds the
+// centers for the Morton codes, the bounds are built for rays from dev.view.near. first and
+// done receive the events of the first and last kernel, to time the build.
+cl_int enqueue_lbvh_build(lbvh_builder& builder, render_device& dev, cl::Buffer const* cx, cl::Buffer const* cz, Imath::Box3f const& centers,
+                          std::vector<cl::Event> const* wait, cl::Event* first, cl::Event* done);
+
+// Enqueue a refit of the tree of the last build of builder to the centers in cx and cz, like
+// enqueue_lbvh_build. The tree must have been built over the same spheres.
+cl_int enqueue_lbvh_refit(lbvh_builder& builder, render_device& dev, cl::Buffer const* cx, cl::Buffer const* cz, std::vector<cl::Event> const* wait,
+                          cl::Event* first, cl::Event* done);
+
+// Enqueue the SAH cost of the nodes of the last build or refit and its non-blocking read into
+// builder, read is the event of the read. lbvh_cost() gives the cost once it is complete.
+cl_int enqueue_lbvh_cost(lbvh_builder& builder, render_device& dev, cl::Event* read);
+
+// SAH cost read by the last enqueue_lbvh_cost: the expected sphere tests of a ray hitting the
+// root, counting the traversal of a node as one test like build_bvh
+double lbvh_cost(lbvh_builder const& builder);
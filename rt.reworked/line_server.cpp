@@ -0,0 +1,669 @@
+#include "line_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Clients waiting for accept while a job renders
+	int const kBacklog = 4;
+
+	// Clients a line_hub serves at once, the ones connecting past it are closed right away
+	std::size_t const kMaxHubClients = 256;
+	// Bytes a line_hub holds of a client's lines not read yet; it stops receiving from the
+	// client at this size and drops it if they hold no whole line
+	std::size_t const kMaxHubPending = 64 * 1024;
+	// Bytes of answers a line_hub holds for a client that doesn't read them, past it the
+	// client is dropped
+	std::size_t const kMaxHubOutbox = 1024 * 1024;
+
+#ifdef _WIN32
+	typedef SOCKET native_socket;
+	int const kSendFlags = 0;
+#else
+	typedef int native_socket;
+	// a client that hung up must not kill the server with SIGPIPE
+	int const kSendFlags = MSG_NOSIGNAL;
+#endif
+
+	native_socket native(std::uintptr_t s)
+	{
+		return static_cast<native_socket>(s);
+	}
+
+	void close_socket(std::uintptr_t s)
+	{
+#ifdef _WIN32
+		closesocket(native(s));
+#else
+		::close(native(s));
+#endif
+	}
+
+	void set_non_blocking(std::uintptr_t s)
+	{
+#ifdef _WIN32
+		u_long on = 1;
+		ioctlsocket(native(s), FIONBIO, &on);
+#else
+		fcntl(native(s), F_SETFL, fcntl(native(s), F_GETFL) | O_NONBLOCK);
+#endif
+	}
+
+	// The last call on a non-blocking socket failed only because it would have had to wait
+	bool would_block()
+	{
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+	}
+
+	// Wait up to timeout_ms milliseconds, forever if negative, for the events of sockets
+	int poll_sockets(std::vector<pollfd>& sockets, int timeout_ms)
+	{
+#ifdef _WIN32
+		return WSAPoll(sockets.data(), static_cast<ULONG>(sockets.size()), timeout_ms);
+#else
+		return poll(sockets.data(), static_cast<nfds_t>(sockets.size()), timeout_ms);
+#endif
+	}
+
+	pollfd poll_entry(std::uintptr_t s, short events)
+	{
+		pollfd entry = {};
+		entry.fd = native(s);
+		entry.events = events;
+		return entry;
+	}
+}
+
+line_server::~line_server()
+{
+	close();
+}
+
+bool line_server::listen(std::uint16_t port)
+{
+	close();
+
+#ifdef _WIN32
+	WSADATA data = {};
+
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+	{
+		std::cout << "Can't start Winsock\n";
+		return false;
+	}
+
+	started_ = true;
+#endif
+
+	server_ = static_cast<std::uintptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+
+#ifndef _WIN32
+	// a restarted server binds again while connections of the last one are in TIME_WAIT,
+	// which Windows allows without the option
+	int reuse = 1;
+
+	if (server_ != kNoSocket)
+		setsockopt(native(server_), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (server_ == kNoSocket || bind(native(server_), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0 ||
+	    ::listen(native(server_), kBacklog) != 0)
+	{
+		close();
+		std::cout << "Can't listen on 127.0.0.1:" << port << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+void line_server::close()
+{
+	close_client();
+
+	if (server_ != kNoSocket)
+		close_socket(server_);
+
+	server_ = kNoSocket;
+
+#ifdef _WIN32
+	if (started_)
+		WSACleanup();
+
+	started_ = false;
+#endif
+}
+
+void line_server::close_client()
+{
+	if (client_ != kNoSocket)
+		close_socket(client_);
+
+	client_ = kNoSocket;
+	pending_.clear();
+}
+
+bool line_server::accept()
+{
+	close_client();
+
+	if (server_ == kNoSocket)
+		return false;
+
+	client_ = static_cast<std::uintptr_t>(::accept(native(server_), nullptr, nullptr));
+	return client_ != kNoSocket;
+}
+
+bool line_server::read_line(std::string& line)
+{
+	if (client_ == kNoSocket)
+		return false;
+
+	std::size_t end;
+
+	while ((end = pending_.find('\n')) == std::string::npos)
+	{
+		char data[4096];
+		auto received = recv(native(client_), data, sizeof(data), 0);
+
+		if (received <= 0)
+		{
+			close_client();
+			return false;
+		}
+
+		pending_.append(data, static_cast<std::size_t>(received));
+	}
+
+	// clients may send \r\n
+	line = pending_.substr(0, end > 0 && pending_[end - 1] == '\r' ? end - 1 : end);
+	pending_.erase(0, end + 1);
+
+	return true;
+}
+
+bool line_server::read_bytes(void* data, std::size_t size)
+{
+	if (client_ == kNoSocket)
+		return false;
+
+	while (pending_.size() < size)
+	{
+		char received_data[4096];
+		auto received = recv(native(client_), received_data, sizeof(received_data), 0);
+
+		if (received <= 0)
+		{
+			close_client();
+			return false;
+		}
+
+		pending_.append(received_data, static_cast<std::size_t>(received));
+	}
+
+	std::memcpy(data, pending_.data(), size);
+	pending_.erase(0, size);
+
+	return true;
+}
+
+bool line_server::poll_line(std::string& line)
+{
+	if (client_ == kNoSocket)
+		return false;
+
+	while (pending_.find('\n') == std::string::npos)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(native(client_), &readable);
+
+		timeval now = {};
+
+		// the socket is ignored on Windows, nfds is the highest descriptor + 1 elsewhere
+		if (select(static_cast<int>(native(client_)) + 1, &readable, nullptr, nullptr, &now) <= 0)
+			return false;
+
+		char data[4096];
+		auto received = recv(native(client_), data, sizeof(data), 0);
+
+		if (received <= 0)
+		{
+			close_client();
+			return false;
+		}
+
+		pending_.append(data, static_cast<std::size_t>(received));
+	}
+
+	return read_line(line);
+}
+
+bool line_server::write_line(std::string const& text)
+{
+	if (client_ == kNoSocket)
+		return false;
+
+	std::string data = text + "\n";
+
+	for (std::size_t sent = 0; sent < data.size();)
+	{
+		auto count = send(native(client_), data.data() + sent, static_cast<int>(data.size() - sent), kSendFlags);
+
+		if (count <= 0)
+		{
+			close_client();
+			return false;
+		}
+
+		sent += static_cast<std::size_t>(count);
+	}
+
+	return true;
+}
+
+line_hub::~line_hub()
+{
+	close();
+}
+
+bool line_hub::listen(std::uint16_t port)
+{
+	close();
+
+#ifdef _WIN32
+	WSADATA data = {};
+
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+	{
+		std::cout << "Can't start Winsock\n";
+		return false;
+	}
+
+	started_ = true;
+#endif
+
+	server_ = static_cast<std::uintptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+
+#ifndef _WIN32
+	// see line_server::listen
+	int reuse = 1;
+
+	if (server_ != line_server::kNoSocket)
+		setsockopt(native(server_), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (server_ == line_server::kNoSocket || bind(native(server_), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0 ||
+	    ::listen(native(server_), kBacklog) != 0)
+	{
+		close();
+		std::cout << "Can't listen on 127.0.0.1:" << port << "\n";
+		return false;
+	}
+
+	// a client that connected and reset before accept mustn't block it
+	set_non_blocking(server_);
+	return true;
+}
+
+void line_hub::close()
+{
+	for (auto const& client : clients_)
+	{
+		if (client.socket != line_server::kNoSocket)
+			close_socket(client.socket);
+	}
+
+	clients_.clear();
+	turn_ = 0;
+
+	if (server_ != line_server::kNoSocket)
+		close_socket(server_);
+
+	server_ = line_server::kNoSocket;
+
+#ifdef _WIN32
+	if (started_)
+		WSACleanup();
+
+	started_ = false;
+#endif
+}
+
+bool line_hub::take_line(std::uint64_t& client, std::string& line)
+{
+	for (std::size_t i = 0; i < clients_.size(); ++i)
+	{
+		auto c = (turn_ + i) % clients_.size();
+		auto& pending = clients_[c].pending;
+		auto end = pending.find('\n');
+
+		if (end == std::string::npos)
+			continue;
+
+		// clients may send \r\n
+		line = pending.substr(0, end > 0 && pending[end - 1] == '\r' ? end - 1 : end);
+		pending.erase(0, end + 1);
+		client = clients_[c].id;
+		turn_ = c + 1;
+		return true;
+	}
+
+	return false;
+}
+
+bool line_hub::receive(bool wait)
+{
+	if (server_ == line_server::kNoSocket)
+		return false;
+
+	// the server socket, then the clients that can take more lines or have answers to send
+	std::vector<pollfd> sockets(1, poll_entry(server_, POLLIN));
+	std::vector<std::size_t> polled;
+
+	for (std::size_t c = 0; c < clients_.size(); ++c)
+	{
+		auto const& client = clients_[c];
+		short events = (client.pending.size() < kMaxHubPending ? POLLIN : 0) | (client.outbox.empty() ? 0 : POLLOUT);
+
+		if (client.socket == line_server::kNoSocket || events == 0)
+			continue;
+
+		sockets.push_back(poll_entry(client.socket, events));
+		polled.push_back(c);
+	}
+
+	if (poll_sockets(sockets, wait ? -1 : 0) < 0)
+		return false;
+
+	for (std::size_t i = 0; i < polled.size(); ++i)
+	{
+		auto& client = clients_[polled[i]];
+		auto events = sockets[i + 1].revents;
+
+		if ((events & POLLOUT) != 0)
+			send_outbox(client);
+
+		if (client.socket == line_server::kNoSocket || (events & (POLLIN | POLLERR | POLLHUP)) == 0)
+			continue;
+
+		char data[4096];
+		auto received = recv(native(client.socket), data, sizeof(data), 0);
+
+		if (received < 0 && would_block())
+			continue;
+
+		if (received <= 0)
+		{
+			drop(client);
+			continue;
+		}
+
+		client.pending.append(data, static_cast<std::size_t>(received));
+
+		// a line longer than the server holds is no job
+		if (client.pending.size() >= kMaxHubPending && client.pending.find('\n') == std::string::npos)
+		{
+			drop(client);
+			client.pending.clear();
+		}
+	}
+
+	// a client that is gone stays only for the lines it sent before
+	clients_.erase(std::remove_if(clients_.begin(), clients_.end(), [](connection const& client)
+	{
+		return client.socket == line_server::kNoSocket && client.pending.find('\n') == std::string::npos;
+	}), clients_.end());
+
+	if ((sockets[0].revents & POLLIN) != 0)
+	{
+		auto accepted = static_cast<std::uintptr_t>(::accept(native(server_), nullptr, nullptr));
+
+		if (accepted != line_server::kNoSocket && clients_.size() >= kMaxHubClients)
+		{
+			close_socket(accepted);
+		}
+		else if (accepted != line_server::kNoSocket)
+		{
+			set_non_blocking(accepted);
+			clients_.push_back(connection{ next_id_++, accepted, std::string(), std::string() });
+		}
+	}
+
+	return true;
+}
+
+void line_hub::send_outbox(connection& client)
+{
+	std::size_t sent = 0;
+
+	while (client.socket != line_server::kNoSocket && sent < client.outbox.size())
+	{
+		auto count = send(native(client.socket), client.outbox.data() + sent, static_cast<int>(std::min<std::size_t>(client.outbox.size() - sent, 1U << 30)), kSendFlags);
+
+		if (count < 0 && would_block())
+			break;
+
+		if (count <= 0)
+		{
+			// its pending lines are still read, receive() drops it after them
+			drop(client);
+			return;
+		}
+
+		sent += static_cast<std::size_t>(count);
+	}
+
+	client.outbox.erase(0, sent);
+}
+
+void line_hub::drop(connection& client)
+{
+	if (client.socket != line_server::kNoSocket)
+		close_socket(client.socket);
+
+	client.socket = line_server::kNoSocket;
+	client.outbox.clear();
+}
+
+bool line_hub::read_line(std::uint64_t& client, std::string& line)
+{
+	while (!take_line(client, line))
+	{
+		if (!receive(true))
+			return false;
+	}
+
+	return true;
+}
+
+bool line_hub::poll_line(std::uint64_t& client, std::string& line)
+{
+	return take_line(client, line) || (receive(false) && take_line(client, line));
+}
+
+bool line_hub::write_line(std::uint64_t client, std::string const& text)
+{
+	auto found = std::find_if(clients_.begin(), clients_.end(), [&](connection const& c) { return c.id == client; });
+
+	if (found == clients_.end() || found->socket == line_server::kNoSocket)
+		return false;
+
+	// a client that doesn't read its answers mustn't hold the server's memory
+	if (found->outbox.size() + text.size() + 1 > kMaxHubOutbox)
+	{
+		drop(*found);
+		return false;
+	}
+
+	found->outbox += text;
+	found->outbox += '\n';
+	send_outbox(*found);
+
+	return found->socket != line_server::kNoSocket;
+}
+
+bool line_hub::flush(int timeout_ms)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+	for (;;)
+	{
+		std::vector<pollfd> sockets;
+		std::vector<connection*> polled;
+
+		for (auto& client : clients_)
+		{
+			if (client.socket != line_server::kNoSocket && !client.outbox.empty())
+			{
+				sockets.push_back(poll_entry(client.socket, POLLOUT));
+				polled.push_back(&client);
+			}
+		}
+
+		if (sockets.empty())
+			return true;
+
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+		if (left <= 0 || poll_sockets(sockets, static_cast<int>(left)) < 0)
+			return false;
+
+		for (std::size_t i = 0; i < polled.size(); ++i)
+		{
+			if (sockets[i].revents != 0)
+				send_outbox(*polled[i]);
+		}
+	}
+}
+
+line_client::~line_client()
+{
+	close();
+}
+
+bool line_client::connect(std::uint16_t port)
+{
+	close();
+
+#ifdef _WIN32
+	WSADATA data = {};
+
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+	{
+		std::cout << "Can't start Winsock\n";
+		return false;
+	}
+
+	started_ = true;
+#endif
+
+	socket_ = static_cast<std::uintptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (socket_ == line_server::kNoSocket || ::connect(native(socket_), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0)
+	{
+		close();
+		std::cout << "Can't connect to 127.0.0.1:" << port << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+void line_client::close()
+{
+	if (socket_ != line_server::kNoSocket)
+		close_socket(socket_);
+
+	socket_ = line_server::kNoSocket;
+	pending_.clear();
+
+#ifdef _WIN32
+	if (started_)
+		WSACleanup();
+
+	started_ = false;
+#endif
+}
+
+bool line_client::read_line(std::string& line)
+{
+	if (socket_ == line_server::kNoSocket)
+		return false;
+
+	std::size_t end;
+
+	while ((end = pending_.find('\n')) == std::string::npos)
+	{
+		char data[4096];
+		auto received = recv(native(socket_), data, sizeof(data), 0);
+
+		if (received <= 0)
+			return false;
+
+		pending_.append(data, static_cast<std::size_t>(received));
+	}
+
+	line = pending_.substr(0, end > 0 && pending_[end - 1] == '\r' ? end - 1 : end);
+	pending_.erase(0, end + 1);
+
+	return true;
+}
+
+bool line_client::write_line(std::string const& text)
+{
+	if (socket_ == line_server::kNoSocket)
+		return false;
+
+	std::string data = text + "\n";
+
+	for (std::size_t sent = 0; sent < data.size();)
+	{
+		auto count = send(native(socket_), data.data() + sent, static_cast<int>(data.size() - sent), kSendFlags);
+
+		if (count <= 0)
+			return false;
+
+		sent += static_cast<std::size_t>(count);
+	}
+
+	return true;
+}
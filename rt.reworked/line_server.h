@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Line based TCP server on the loopback interface, talking to one client at a time.
+// Only processes of the same machine can connect.
+class line_server
+{
+public:
+	line_server() = default;
+	~line_server();
+
+	line_server(line_server const&) = delete;
+	line_server& operator=(line_server const&) = delete;
+
+	// Listen on 127.0.0.1:port. Returns false with a message if the port can't be bound.
+	bool listen(std::uint16_t port);
+	void close();
+
+	// Wait for the next client, dropping the current one. Returns false if the server socket failed.
+	bool accept();
+
+	// Next line from the client without its line break, false once the client has disconnected
+	bool read_line(std::string& line);
+
+	// Next line like read_line if the client has sent all of it already, without waiting for
+	// more. False if it hasn't or the client has disconnected.
+	bool poll_line(std::string& line);
+
+	// Fill data with the next size bytes from the client, binary data after the lines read
+	// before. False if the client has disconnected first.
+	bool read_bytes(void* data, std::size_t size);
+
+	// Send text followed by a line break to the client, false if it has disconnected
+	bool write_line(std::string const& text);
+
+	// SOCKET on Windows, file descriptor elsewhere; kNoSocket if not open
+	static std::uintptr_t const kNoSocket = ~std::uintptr_t(0);
+
+private:
+	void close_client();
+
+	std::uintptr_t server_ = kNoSocket;
+	std::uintptr_t client_ = kNoSocket;
+	// Received bytes after the last line returned by read_line
+	std::string pending_;
+#ifdef _WIN32
+	bool started_ = false;
+#endif
+};
+
+// Line based TCP server on the loopback interface talking to many clients at once, for a
+// server several processes share: every line comes with the id of the client that sent it and
+// its answers go back to that client. Clients connect and disconnect while the server runs.
+// The sockets are polled with poll (WSAPoll on Windows), so their number and descriptors aren't
+// limited by FD_SETSIZE, and never block the server: a client that stops reading its answers
+// or sends more than the server takes is held back or dropped instead, and the clients
+// connected at once are limited.
+class line_hub
+{
+public:
+	line_hub() = default;
+	~line_hub();
+
+	line_hub(line_hub const&) = delete;
+	line_hub& operator=(line_hub const&) = delete;
+
+	// Listen on 127.0.0.1:port. Returns false with a message if the port can't be bound.
+	bool listen(std::uint16_t port);
+	void close();
+
+	// Next line from any client without its line break, taking the clients with whole lines in
+	// turn so none waits behind another one's stream, and the client that sent it. Waits for a
+	// line, accepting new clients meanwhile. False if the server socket failed.
+	bool read_line(std::uint64_t& client, std::string& line);
+
+	// Next line like read_line if a client has sent all of it already, without waiting for
+	// more. False if none has.
+	bool poll_line(std::uint64_t& client, std::string& line);
+
+	// Queue text followed by a line break for client and send what its socket takes now, the
+	// rest goes out while the hub waits for lines. False if the client has disconnected or
+	// been dropped for leaving too many answers unread.
+	bool write_line(std::uint64_t client, std::string const& text);
+
+	// Wait up to timeout_ms milliseconds for the answers queued by write_line to be sent, true
+	// if they all were
+	bool flush(int timeout_ms);
+
+	// Clients connected, or with lines not read yet
+	std::size_t clients() const
+	{
+		return clients_.size();
+	}
+
+private:
+	struct connection
+	{
+		std::uint64_t id;
+		// kNoSocket once the client disconnected, its last lines may still be pending
+		std::uintptr_t socket;
+		std::string pending;
+		// Answers its socket hasn't taken yet
+		std::string outbox;
+	};
+
+	// Take the next whole line of a client, in turn after the one last taken
+	bool take_line(std::uint64_t& client, std::string& line);
+
+	// Accept new clients, receive what the clients sent and send what they have in their
+	// outboxes, waiting for something to arrive if wait is set. False if the server socket failed.
+	bool receive(bool wait);
+
+	// Send the outbox of client until its socket takes no more
+	void send_outbox(connection& client);
+
+	// Close the socket of client, keeping its pending lines
+	void drop(connection& client);
+
+	std::uintptr_t server_ = line_server::kNoSocket;
+	std::vector<connection> clients_;
+	std::uint64_t next_id_ = 1;
+	// Client to look at first for the next line
+	std::size_t turn_ = 0;
+#ifdef _WIN32
+	bool started_ = false;
+#endif
+};
+
+// Client of a line_server or line_hub on the loopback interface, for driving a server from another
+// process. One thread may read while another writes.
+class line_client
+{
+public:
+	line_client() = default;
+	~line_client();
+
+	line_client(line_client const&) = delete;
+	line_client& operator=(line_client const&) = delete;
+
+	// Connect to 127.0.0.1:port. Returns false with a message if nothing listens there.
+	bool connect(std::uint16_t port);
+	void close();
+
+	// Next line from the server without its line break, false once it has disconnected
+	bool read_line(std::string& line);
+
+	// Send text followed by a line break to the server, false if it has disconnected
+	bool write_line(std::string const& text);
+
+private:
+	std::uintptr_t socket_ = line_server::kNoSocket;
+	// Received bytes after the last line returned by read_line
+	std::string pending_;
+#ifdef _WIN32
+	bool started_ = false;
+#endif
+};
@@ -0,0 +1,54 @@
+#include "output_files.h"
+
+#include <cstdio>
+#include <iostream>
+
+void print_write_times(image_writer& writer)
+{
+	auto totals = writer.totals();
+	std::cout << "Wrote " << totals.images << " images, encode " << totals.encode_time << " ms, file open and close " << totals.file_time << " ms\n";
+}
+
+std::string frame_file_name(std::string const& output, std::uint32_t frame, std::uint32_t num_frames)
+{
+	if (num_frames == 1)
+		return output;
+
+	char number[16];
+	std::snprintf(number, sizeof(number), ".%04u", frame);
+
+	auto dot = output.find_last_of('.');
+	auto slash = output.find_last_of("/\\");
+
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return output + number;
+
+	return output.substr(0, dot) + number + output.substr(dot);
+}
+
+std::string file_stem(std::string const& output)
+{
+	auto dot = output.find_last_of('.');
+	auto slash = output.find_last_of("/\\");
+	return dot == std::string::npos || (slash != std::string::npos && dot < slash) ? output : output.substr(0, dot);
+}
+
+bool is_raw_output(std::string const& output)
+{
+	return output.size() > 6 && output.compare(output.size() - 6, 6, ".rtraw") == 0;
+}
+
+std::string aov_file_name(std::string const& output, aov_channel channel)
+{
+	return file_stem(output) + "." + aov_channel_name(channel) + ".exr";
+}
+
+std::string nearest_hits_file_name(std::string const& output, char const* plane)
+{
+	return file_stem(output) + ".hits_" + plane + ".exr";
+}
+
+std::string cost_heatmap_file_name(std::string const& output)
+{
+	return file_stem(output) + ".cost.png";
+}
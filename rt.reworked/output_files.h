@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "image_writer.h"
+#include "render_device.h"
+
+// Print the encode and file times of everything writer has written
+void print_write_times(image_writer& writer);
+
+// File frame of a multi-frame run is saved to: output with the frame number before the
+// extension, e.g. result.0003.png. Single frames keep the plain name.
+std::string frame_file_name(std::string const& output, std::uint32_t frame, std::uint32_t num_frames);
+
+// output without its extension
+std::string file_stem(std::string const& output);
+
+// Whether output names a raw image file (see raw_image_file), which is written by mapping it
+bool is_raw_output(std::string const& output);
+
+// File the channel of --aov is saved to: output with the channel name instead of its
+// extension, always an EXR so the floats and ids are kept, e.g. result.depth.exr
+std::string aov_file_name(std::string const& output, aov_channel channel);
+
+// File the plane of --nearest-hits is saved to: output with hits_ and the plane name instead of
+// its extension
+std::string nearest_hits_file_name(std::string const& output, char const* plane);
+
+// File the heatmap of the cost channel is saved to, e.g. result.cost.png
+std::string cost_heatmap_file_name(std::string const& output);
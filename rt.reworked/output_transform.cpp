@@ -0,0 +1,92 @@
+#include "output_transform.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	// f as an OpenCL C float literal of the same value
+	std::string float_literal(float f)
+	{
+		char text[32];
+		std::snprintf(text, sizeof(text), "%af", static_cast<double>(f));
+		return text;
+	}
+}
+
+bool read_lut_file(std::string const& file, std::vector<float>& lut)
+{
+	std::ifstream in(file);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << file << "\n";
+		return false;
+	}
+
+	std::vector<float> entries;
+	std::string line;
+
+	for (auto number = 1; std::getline(in, line); ++number)
+	{
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string word;
+
+		while (words >> word)
+		{
+			char* end = nullptr;
+			float entry = std::strtof(word.c_str(), &end);
+
+			if (*end != '\0' || !std::isfinite(entry))
+			{
+				std::cout << file << ":" << number << ": " << word << " is not a LUT entry\n";
+				return false;
+			}
+
+			entries.push_back(entry);
+		}
+	}
+
+	if (entries.size() < 2)
+	{
+		std::cout << file << " holds fewer than two LUT entries\n";
+		return false;
+	}
+
+	lut = std::move(entries);
+	return true;
+}
+
+std::string output_transform_source(output_transform const& transform)
+{
+	if (transform.identity())
+		return std::string();
+
+	std::string source = "#define RT_OUTPUT_TRANSFORM\n";
+
+	if (transform.exposure != 0.f)
+		source += "#define RT_EXPOSURE_SCALE " + float_literal(std::exp2(transform.exposure)) + "\n";
+
+	if (transform.srgb)
+		source += "#define RT_OETF_SRGB\n";
+
+	if (!transform.lut.empty())
+	{
+		source += "#define RT_LUT_SIZE " + std::to_string(transform.lut.size()) + "\n";
+		source += "__constant float kOutputLut[RT_LUT_SIZE] = {";
+
+		for (std::size_t i = 0; i < transform.lut.size(); ++i)
+		{
+			source += (i == 0 ? " " : ", ") + float_literal(transform.lut[i]);
+		}
+
+		source += " };\n";
+	}
+
+	// the build log keeps the line numbers of trace.cl
+	return source + "#line 1\n";
+}
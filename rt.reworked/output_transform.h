@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Transform the kernels of trace.cl apply to every color on its way into the framebuffer,
+// fused into write_pixel instead of a pass over the frame on the host: the exposure, then the
+// sRGB OETF, then a 1D LUT. rgba8 quantizes the result as OIIO converts float to uint8, as it
+// does without a transform, so the identity leaves the kernels and their images as they were.
+struct output_transform
+{
+	// Stops the linear color is scaled by, by 2^exposure
+	float exposure = 0.f;
+	// Encode with the sRGB OETF, as OIIO converts "linear" to "sRGB"
+	bool srgb = false;
+	// Entries of a LUT over [0, 1] applied to every channel, interpolated linearly, inputs
+	// outside clamped to it; empty for none
+	std::vector<float> lut;
+
+	bool identity() const
+	{
+		return exposure == 0.f && !srgb && lut.empty();
+	}
+};
+
+// Read the entries of a LUT, separated by white space, '#' starts a comment. Returns false
+// with a message if the file can't be read, holds anything else or fewer than two entries.
+bool read_lut_file(std::string const& file, std::vector<float>& lut);
+
+// Code defining RT_OUTPUT_TRANSFORM and the constants of transform, prepended to the source of
+// trace.cl; empty for the identity. The floats are written exactly, as hex literals, and a
+// #line directive keeps the line numbers of trace.cl.
+std::string output_transform_source(output_transform const& transform);
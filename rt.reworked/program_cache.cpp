@@ -0,0 +1,281 @@
+#include "program_cache.h"
+
+#include "oiio/include/OpenImageIO/hash.h"
+
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	std::atomic<std::uint64_t> binary_hits{ 0 };
+	std::atomic<std::uint64_t> binary_misses{ 0 };
+
+	// Binaries of preload_program_binary by the name of their cache file
+	std::mutex preloaded_mutex;
+	std::map<std::string, std::vector<char>> preloaded;
+
+	// Cache file name, a SHA-1 over everything that affects the compiled binary
+	std::string cache_file_name(cl::Device const& device, std::string const& source, std::string const& options)
+	{
+		std::string const parts[] =
+		{
+			source,
+			options,
+			device.getInfo<CL_DEVICE_NAME>(),
+			device.getInfo<CL_DEVICE_VERSION>(),
+			device.getInfo<CL_DRIVER_VERSION>()
+		};
+
+		OIIO_NAMESPACE::SHA1 sha;
+
+		for (auto const& part : parts)
+		{
+			// keep the terminating zero so part boundaries are part of the hash
+			sha.append(part.c_str(), part.size() + 1);
+		}
+
+		return "trace." + sha.digest() + ".clbin";
+	}
+
+	bool load_binary(cl::Context const& context, cl::Device const& device, std::vector<char> const& binary, std::string const& options, cl::Program& program)
+	{
+		if (binary.empty())
+			return false;
+
+		cl_int err = CL_SUCCESS;
+		std::vector<cl_int> status;
+		std::vector<cl::Device> devices(1, device);
+		cl::Program::Binaries binaries(1, std::make_pair(static_cast<void const*>(binary.data()), binary.size()));
+
+		program = cl::Program(context, devices, binaries, &status, &err);
+
+		if (err != CL_SUCCESS || status.empty() || status[0] != CL_SUCCESS)
+			return false;
+
+		// a binary still has to be built, the driver may reject it after an update
+		return program.build(devices, options.c_str()) == CL_SUCCESS;
+	}
+
+	bool load_binary_file(cl::Context const& context, cl::Device const& device, std::string const& file_name, std::string const& options, cl::Program& program)
+	{
+		std::ifstream file(file_name, std::ios::binary);
+
+		if (!file)
+			return false;
+
+		std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		return load_binary(context, device, binary, options, program);
+	}
+
+	void store_binary(cl::Program const& program, cl::Device const& device, std::string const& file_name)
+	{
+		std::vector<char> binary;
+
+		if (!program_binary(program, device, binary))
+			return;
+
+		// written under a name of its own and renamed, a build of the same binary on another
+		// thread never loads half a file; where the rename can't replace a file another thread
+		// stored it first
+		std::ostringstream temp_name;
+		temp_name << file_name << "." << std::this_thread::get_id() << ".tmp";
+
+		{
+			std::ofstream file(temp_name.str(), std::ios::binary);
+			file.write(binary.data(), binary.size());
+
+			if (!file)
+			{
+				file.close();
+				std::remove(temp_name.str().c_str());
+				return;
+			}
+		}
+
+		if (std::rename(temp_name.str().c_str(), file_name.c_str()) != 0)
+			std::remove(temp_name.str().c_str());
+	}
+}
+
+bool program_binary(cl::Program const& program, cl::Device const& device, std::vector<char>& binary)
+{
+	// a context shared by several devices (--gather) has a binary per device, built or not
+	auto devices = program.getInfo<CL_PROGRAM_DEVICES>();
+	auto sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+	std::size_t d = 0;
+
+	while (d < devices.size() && devices[d]() != device())
+	{
+		++d;
+	}
+
+	if (d == devices.size() || sizes.size() != devices.size() || sizes[d] == 0)
+		return false;
+
+	binary.assign(sizes[d], 0);
+	std::vector<char*> pointers(devices.size(), nullptr);
+	pointers[d] = binary.data();
+
+	return program.getInfo(CL_PROGRAM_BINARIES, &pointers) == CL_SUCCESS;
+}
+
+std::string program_binary_name(cl::Device const& device, std::string const& source, std::string const& options)
+{
+	return cache_file_name(device, source, options);
+}
+
+void preload_program_binary(std::string const& name, std::vector<char> binary)
+{
+	std::lock_guard<std::mutex> lock(preloaded_mutex);
+	preloaded[name] = std::move(binary);
+}
+
+program_cache_counts program_cache_stats()
+{
+	return program_cache_counts{ binary_hits.load(std::memory_order_relaxed), binary_misses.load(std::memory_order_relaxed) };
+}
+
+std::string source_digest(std::string const& source)
+{
+	OIIO_NAMESPACE::SHA1 sha;
+	sha.append(source.c_str(), source.size());
+	return sha.digest();
+}
+
+cl::Program build_program(cl::Context const& context, cl::Device const& device, std::string const& source,
+                          std::string const& options, bool use_cache, cl_int* err)
+{
+	std::string file_name = cache_file_name(device, source, options);
+	cl::Program program;
+
+	// a preloaded binary is taken with or without the cache
+	std::vector<char> const* restored = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(preloaded_mutex);
+		auto found = preloaded.find(file_name);
+		restored = found != preloaded.end() ? &found->second : nullptr;
+	}
+
+	if (restored && load_binary(context, device, *restored, options, program))
+	{
+		std::cout << "Using the restored program binary " << file_name << "\n";
+		binary_hits.fetch_add(1, std::memory_order_relaxed);
+		*err = CL_SUCCESS;
+		return program;
+	}
+
+	if (use_cache)
+	{
+		if (load_binary_file(context, device, file_name, options, program))
+		{
+			std::cout << "Using cached program binary " << file_name << "\n";
+			binary_hits.fetch_add(1, std::memory_order_relaxed);
+			*err = CL_SUCCESS;
+			return program;
+		}
+
+		binary_misses.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	cl::Program::Sources sources(1, std::make_pair(source.c_str(), source.length() + 1));
+
+	program = cl::Program(context, sources);
+
+	*err = program.build(std::vector<cl::Device>(1, device), options.c_str());
+
+	if (*err != CL_SUCCESS)
+	{
+		std::cout << "Program build failed:\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << "\n";
+		return program;
+	}
+
+	if (use_cache)
+	{
+		store_binary(program, device, file_name);
+	}
+
+	return program;
+}
+
+program_variants::program_variants(cl::Context const& context, cl::Device const& device, std::string const& source,
+                                   bool use_cache, std::size_t capacity)
+	: context_(context)
+	, device_(device)
+	, source_(source)
+	, use_cache_(use_cache)
+	, capacity_(capacity > 0 ? capacity : 1)
+{
+}
+
+cl::Program program_variants::get(std::string const& options, cl_int* err)
+{
+	for (auto it = entries_.begin(); it != entries_.end(); ++it)
+	{
+		if (it->first == options)
+		{
+			auto built = it->second.get();
+			*err = built.err;
+
+			if (built.err != CL_SUCCESS)
+			{
+				entries_.erase(it);
+				return built.program;
+			}
+
+			entries_.splice(entries_.begin(), entries_, it);
+			return built.program;
+		}
+	}
+
+	built_program built;
+	built.program = build_program(context_, device_, source_, options, use_cache_, &built.err);
+	*err = built.err;
+
+	if (built.err != CL_SUCCESS)
+		return built.program;
+
+	std::promise<built_program> done;
+	done.set_value(built);
+	add(options, done.get_future().share());
+	return built.program;
+}
+
+void program_variants::prefetch(std::string const& options)
+{
+	for (auto const& entry : entries_)
+	{
+		if (entry.first == options)
+			return;
+	}
+
+	// the thread gets copies, the handles share the context and device
+	auto context = context_;
+	auto device = device_;
+	auto source = source_;
+	auto use_cache = use_cache_;
+
+	add(options, std::async(std::launch::async, [=]
+	{
+		built_program built;
+		built.program = build_program(context, device, source, options, use_cache, &built.err);
+		return built;
+	}).share());
+}
+
+void program_variants::add(std::string const& options, std::shared_future<built_program> build)
+{
+	entries_.emplace_front(options, std::move(build));
+
+	// a released build that is still running is waited for
+	if (entries_.size() > capacity_)
+		entries_.pop_back();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+// Build the OpenCL program from source for device. If use_cache is set, a program
+// binary stored by an earlier run for the same source, build options, device and
+// driver is loaded instead of compiling. After a source build the binary is written
+// to the working directory for the next run. Any cache mismatch or load failure
+// falls back to the source build.
+cl::Program build_program(cl::Context const& context, cl::Device const& device, std::string const& source,
+                          std::string const& options, bool use_cache, cl_int* err);
+
+// The binary of program for device, false if it has none
+bool program_binary(cl::Program const& program, cl::Device const& device, std::vector<char>& binary);
+
+// Name of the cache file of the build of source with options for device, which names its binary
+std::string program_binary_name(cl::Device const& device, std::string const& source, std::string const& options);
+
+// Keep binary, read from a snapshot (snapshot.h), for the build named name: build_program
+// loads it in place of the cache file or the source build, with or without use_cache, as long
+// as the driver takes it. Any thread may call it, before the builds that take the binary.
+void preload_program_binary(std::string const& name, std::vector<char> binary);
+
+// build_program calls with use_cache that loaded a stored binary and ones that built the
+// source, since the program started; any thread may read them
+struct program_cache_counts
+{
+	std::uint64_t hits;
+	std::uint64_t misses;
+};
+
+program_cache_counts program_cache_stats();
+
+// SHA-1 of source as hex digits, names a kernel source in the tuning database (tuning_db.h)
+std::string source_digest(std::string const& source);
+
+// Programs of one context and device specialized through their build options, which carry
+// the image size, sphere count and output format the kernels are compiled for. Keeps the
+// capacity most recently used variants; older ones are released and rebuilt, or reloaded
+// from the binary cache, when they are needed again. Builds started with prefetch run on
+// threads of their own, so the variants of several devices, or the ones a device needs next,
+// compile at the same time; the object itself belongs to one thread.
+class program_variants
+{
+public:
+	program_variants(cl::Context const& context, cl::Device const& device, std::string const& source,
+	                 bool use_cache, std::size_t capacity = 8);
+
+	// Program built with options, from the in-memory list if it was built or prefetched
+	// before, waiting for a prefetched build that hasn't finished
+	cl::Program get(std::string const& options, cl_int* err);
+
+	// Start building the program of options on a thread of its own unless the list holds it,
+	// get() takes it later. The builds start in the order of the calls, the one needed first
+	// should come first.
+	void prefetch(std::string const& options);
+
+private:
+	struct built_program
+	{
+		cl::Program program;
+		cl_int err;
+	};
+
+	cl::Context context_;
+	cl::Device device_;
+	std::string source_;
+	bool use_cache_;
+	std::size_t capacity_;
+	// Most recently used first; a failed build is dropped when get() finds it
+	std::list<std::pair<std::string, std::shared_future<built_program>>> entries_;
+
+	void add(std::string const& options, std::shared_future<built_program> build);
+};
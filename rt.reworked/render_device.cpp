@@ -0,0 +1,3796 @@
+#include "render_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "device_memory.h"
+#include "image_compare.h"
+#include "image_encoders.h"
+#include "image_writer.h"
+#include "kernel_report.h"
+#include "profile_markers.h"
+#include "ray_queries.h"
+#include "scene_file.h"
+#include "timeline.h"
+
+namespace
+{
+	// Spheres trace_local, trace_local_async and trace_grid_local stage into local memory at a time, kLocalBatch in trace.cl
+	std::uint32_t const kLocalBatch = 256;
+	// trace_persistent launches this many work-groups per compute unit, enough to hide latency
+	std::uint32_t const kPersistentGroupsPerUnit = 4;
+	// Out-of-core brute force: chunks of spheres rotate through this many sets of device buffers
+	std::uint32_t const kStreamSlots = 3;
+	// Output buffers of other image sizes each device keeps for later views
+	std::size_t const kSpareOutputs = 2;
+	// Scenes of up to this many spheres get their sphere loops fully unrolled, RT_UNROLL_SPHERES in trace.cl
+	std::uint32_t const kUnrollSpheres = 64;
+	// Pixel blocks of swizzled launches, kSwizzleTile in trace.cl
+	std::uint32_t const kSwizzleTile = 8;
+	// Ray origins trace_half2 takes, within the range of half with room for the differences
+	float const kMaxPackedHalfOrigin = 32768.f;
+	// Work-groups of the antialias kernels of --aa and how many of them run per compute unit,
+	// enough to keep it busy as they stride through the edge pixels
+	std::uint32_t const kAntialiasGroup = 64;
+	std::uint32_t const kAntialiasGroupsPerUnit = 8;
+	// Work-group of the wavefront queue kernels, kRadixGroup in trace.cl
+	std::uint32_t const kWaveGroup = 256;
+	// Size of queued_ray in trace.cl
+	std::size_t const kQueuedRayBytes = 24;
+	// Work-group of the bounce kernels of --bounces and the size of their bounce_ray, kBounceGroup
+	// and bounce_ray in trace.cl
+	std::uint32_t const kBounceGroup = 64;
+	std::size_t const kBounceRayBytes = 36;
+	// Radix passes over the 30 bits of bounce_key and ray_keys in trace.cl, an even number
+	// leaves the sorted keys in the buffers they started in
+	cl_uint const kRaySortPasses = 8;
+	// Rays of a batch of query_rays traced per launch, which bounds the device buffers of a batch
+	std::size_t const kQueryLaunchRays = std::size_t(1) << 22;
+
+	// Float operations of a sphere test in sphere_roots() of trace.cl: the relative origin,
+	// c and the discriminant; the square root of a hit is left out
+	double const kFlopsPerTest = 11.0;
+	// Bytes of cx, cy, cz and radius2 a sphere test reads
+	double const kBytesPerTest = 16.0;
+	// Bytes of the color of the hit a ray reads
+	double const kColorBytesPerRay = 12.0;
+
+	// Channels of --aov in the order of their planes
+	char const* const kAovNames[] = { "depth", "id", "normal", "cost" };
+
+	// Work-items of an image_stats work-group and pixels each of them reduces, kStatsGroup and
+	// kStatsPixels in trace.cl, and the words a group stores
+	std::uint32_t const kStatsGroup = 256;
+	std::uint32_t const kStatsPixels = 16;
+	std::size_t const kStatsWords = 10;
+
+	// Work-items of a pack_encoded work-group, which copies one encoded row
+	std::uint32_t const kPackGroup = 64;
+
+	// Kernels of --coarsen and the pixel blocks their work-items trace, see trace_block in trace.cl
+	struct coarse_kernel
+	{
+		char const* name;
+		work_group block;
+	};
+
+	coarse_kernel const kCoarseKernels[] = { { "trace_coarse_2x1", { 2, 1 } }, { "trace_coarse_2x2", { 2, 2 } }, { "trace_coarse_4x1", { 4, 1 } } };
+
+	// Launches timed per kernel variant by --coarsen and --image-reads with --tune, the fastest
+	// counts
+	int const kVariantRuns = 3;
+
+	// Share of the occupancy estimate of a kernel a variant of it has to keep to be timed or
+	// picked instead of it (kernel_report.h)
+	double const kPruneOccupancy = 0.5;
+
+	// Set up the out-of-core brute force of dev: the chunk buffer slots, the upload queue,
+	// the per-pixel state carried between chunks and the resolve kernel that writes out_buf.
+	// The chunks are read from the mapped arrays of scene.file, if any, or from scene.spheres.
+	void init_stream(render_device& dev, render_scene const& scene)
+	{
+		cl_int err = 0;
+
+		std::vector<float> const* arrays[5] = { &scene.spheres.cx, &scene.spheres.cy, &scene.spheres.cz, &scene.spheres.radius2, &scene.spheres.color };
+		scene_array const file_arrays[5] = { scene_array::cx, scene_array::cy, scene_array::cz, scene_array::radius2, scene_array::color };
+
+		for (auto a = 0; a < 5; ++a)
+		{
+			dev.stream_source[a] = scene.file ? scene.file->array(file_arrays[a]) : arrays[a]->data();
+		}
+
+		dev.stream_size = scene.spheres.size();
+		dev.stream_chunks = 0;
+
+		// the slots of a scene streamed in batches hold chunks of any batch
+		if (!dev.stream_batches)
+			dev.chunk_spheres = std::min(dev.chunk_spheres, dev.stream_size);
+
+		dev.slots.resize(kStreamSlots);
+
+		for (auto& slot : dev.slots)
+		{
+			for (auto a = 0; a < 5; ++a)
+			{
+				std::size_t size = sizeof(float) * dev.chunk_spheres * (a == 4 ? 3 : 1);
+				slot.arrays[a] = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, size, nullptr, &err, "stream slot");
+			}
+
+			slot.in_use = false;
+		}
+
+		dev.upload_queue = cl::CommandQueue(dev.context, dev.device, 0, &err);
+
+		std::size_t num_pixels = std::size_t(dev.view.image_width) * dev.view.image_height;
+
+		dev.maxt_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(float) * num_pixels, nullptr, &err, "stream maxt");
+		dev.idx_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_int) * num_pixels, nullptr, &err, "stream hits");
+		dev.rgb_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, 3 * sizeof(float) * num_pixels, nullptr, &err, "stream colors");
+
+		// the chunk arguments 0-6 change with every chunk, enqueue_band sets them
+		err = dev.kernel.setArg(7, dev.maxt_buf);
+		err = dev.kernel.setArg(8, dev.idx_buf);
+		err = dev.kernel.setArg(9, dev.rgb_buf);
+
+		dev.resolve_kernel = cl::Kernel(dev.program, "resolve_chunks", &err);
+		err = dev.resolve_kernel.setArg(0, dev.idx_buf);
+		err = dev.resolve_kernel.setArg(1, dev.rgb_buf);
+		err = dev.resolve_kernel.setArg(2, dev.out_buf);
+
+		if (dev.stream_batches)
+			std::cout << dev.name << ": streaming batches of spheres in chunks of " << dev.chunk_spheres << "\n";
+		else
+			std::cout << dev.name << ": streaming " << dev.stream_size << " spheres in chunks of " << dev.chunk_spheres << "\n";
+	}
+
+	// Set up the frame statistics of dev for the spheres on it: the reduction kernel, the hit
+	// counts of the spheres and the partial results of the groups of a launch over the image
+	void init_stats(render_device& dev, render_scene const& scene)
+	{
+		cl_int err = 0;
+
+		dev.stats_spheres = static_cast<std::uint32_t>(scene.instances ? scene.instances->spheres.size() : scene.spheres.size());
+		dev.stats_kernel = cl::Kernel(dev.program, "image_stats", &err);
+
+		std::size_t num_pixels = std::size_t(dev.view.image_width) * dev.view.image_height;
+		std::size_t num_groups = (num_pixels + kStatsGroup * kStatsPixels - 1) / (kStatsGroup * kStatsPixels);
+		std::size_t hits_size = sizeof(cl_uint) * std::max<std::size_t>(dev.stats_spheres, 1);
+
+		if (dev.stats_hits() == nullptr || dev.stats_hits.getInfo<CL_MEM_SIZE>() != hits_size)
+			dev.stats_hits = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, hits_size, nullptr, &err, "stats hits");
+
+		if (dev.stats_groups() == nullptr || dev.stats_groups.getInfo<CL_MEM_SIZE>() < sizeof(cl_uint) * kStatsWords * num_groups)
+			dev.stats_groups = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(cl_uint) * kStatsWords * num_groups, nullptr, &err, "stats groups");
+	}
+
+	// Kernels and buffers of the antialiasing of --aa for the scene dev was built for, see
+	// render_device::aa_grid
+	void init_antialias(render_device& dev, render_scene const& scene)
+	{
+		cl_int err = 0;
+
+		char const* name = scene.mode == accel_mode::bvh ? "antialias_bvh" : scene.mode == accel_mode::sorted ? "antialias_sorted" : "antialias";
+
+		// sphere arrays, then the structure of bvh and sorted, as the kernel of the first pass has them
+		cl_uint scene_args = scene.mode == accel_mode::none ? 5 : 7;
+		std::size_t edges_size = sizeof(cl_uint) * dev.view.image_width * dev.view.image_height;
+
+		if (dev.edge_buf() == nullptr || dev.edge_buf.getInfo<CL_MEM_SIZE>() != edges_size)
+			dev.edge_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, edges_size, nullptr, &err, "edge pixels");
+
+		if (dev.edge_count() == nullptr)
+			dev.edge_count = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint), nullptr, &err, "edge count");
+
+		// the id channel is the only plane of aov_buf
+		dev.edge_kernel = cl::Kernel(dev.program, "find_edges", &err);
+		err = dev.edge_kernel.setArg(0, dev.aov_buf);
+		err = dev.edge_kernel.setArg(1, dev.edge_count);
+		err = dev.edge_kernel.setArg(2, dev.edge_buf);
+
+		dev.aa_kernel = cl::Kernel(dev.program, name, &err);
+
+		for (cl_uint a = 0; a < scene_args; ++a)
+		{
+			err = set_scene_arg(dev, dev.aa_kernel, a);
+		}
+
+		err = dev.aa_kernel.setArg(scene_args, dev.out_buf);
+		err = dev.aa_kernel.setArg(scene_args + 1, dev.edge_count);
+		err = dev.aa_kernel.setArg(scene_args + 2, dev.edge_buf);
+		err = dev.aa_kernel.setArg(scene_args + 3, dev.aa_grid);
+
+		dev.aa_items = dev.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * kAntialiasGroupsPerUnit * kAntialiasGroup;
+	}
+
+	// Enqueue the antialiasing of rows [row_begin, row_end) of dev after the kernel traced them:
+	// the rows next to the band, whose ids the edges of its outer rows are found against, the
+	// edge list of the band and the samples of its pixels; event is the last of them
+	cl_int enqueue_antialias(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* event)
+	{
+		cl_int err = CL_SUCCESS;
+
+		if (row_begin > 0)
+			err = enqueue_pixels(dev, dev.queue, row_begin - 1, row_begin, nullptr, nullptr);
+
+		if (row_end < dev.view.image_height && err == CL_SUCCESS)
+			err = enqueue_pixels(dev, dev.queue, row_end, row_end + 1, nullptr, nullptr);
+
+		err = err == CL_SUCCESS ? dev.queue.enqueueFillBuffer(dev.edge_count, 0U, 0, sizeof(cl_uint)) : err;
+		err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.edge_kernel, cl::NDRange(0, row_begin), cl::NDRange(dev.view.image_width, row_end - row_begin),
+		                                                         cl::NullRange)
+		                        : err;
+
+		return err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.aa_kernel, cl::NullRange, cl::NDRange(dev.aa_items), cl::NDRange(kAntialiasGroup), nullptr, event)
+		                         : err;
+	}
+
+	// Kernels and buffers of the reflections of --bounces for the scene dev was built for, see
+	// render_device::bounces. The queues hold a ray per pixel of the image, the most a band
+	// can queue.
+	void init_bounces(render_device& dev, render_scene const& scene)
+	{
+		cl_int err = 0;
+
+		// the full BVH has a walk for rays in any direction, other scenes test every sphere
+		bool walk = scene.mode == accel_mode::bvh && scene.compressed_nodes.empty();
+		cl_uint scene_args = walk ? 7 : 5;
+		std::size_t pixels = std::size_t(dev.view.image_width) * dev.view.image_height;
+		std::size_t groups = (pixels + kWaveGroup - 1) / kWaveGroup;
+
+		if (dev.bounce_accum() == nullptr || dev.bounce_accum.getInfo<CL_MEM_SIZE>() != 3 * sizeof(float) * pixels)
+		{
+			for (auto b = 0; b < 2; ++b)
+			{
+				dev.bounce_rays[b] = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, kBounceRayBytes * pixels, nullptr, &err, "bounce rays");
+				dev.bounce_keys[b] = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * pixels, nullptr, &err, "bounce keys");
+				dev.bounce_values[b] = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * pixels, nullptr, &err, "bounce values");
+				dev.bounce_queued[b] = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, sizeof(cl_uint), nullptr, &err, "bounce count");
+			}
+
+			dev.bounce_histogram = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * 16 * groups, nullptr, &err, "bounce histogram");
+			dev.bounce_accum = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, 3 * sizeof(float) * pixels, nullptr, &err, "bounce colors");
+		}
+
+		// the id channel is the only plane of aov_buf
+		dev.bounce_generate = cl::Kernel(dev.program, "bounce_generate", &err);
+		dev.bounce_intersect = cl::Kernel(dev.program, walk ? "bounce_intersect_bvh" : "bounce_intersect", &err);
+
+		for (cl_uint a = 0; a < scene_args; ++a)
+		{
+			err = a < 5 ? set_scene_arg(dev, dev.bounce_generate, a) : err;
+			err = set_scene_arg(dev, dev.bounce_intersect, a);
+		}
+
+		err = dev.bounce_generate.setArg(5, dev.aov_buf);
+		err = dev.bounce_generate.setArg(8, dev.reflectivity);
+		err = dev.bounce_generate.setArg(9, dev.bounce_accum);
+		err = dev.bounce_generate.setArg(10, dev.bounce_queued[0]);
+		err = dev.bounce_generate.setArg(11, dev.bounce_rays[0]);
+		err = dev.bounce_generate.setArg(12, dev.bounce_keys[0]);
+		err = dev.bounce_generate.setArg(13, dev.bounce_values[0]);
+
+		// the queues of a bounce and the count are set per bounce by enqueue_bounces
+		err = dev.bounce_intersect.setArg(scene_args + 3, dev.reflectivity);
+		err = dev.bounce_intersect.setArg(scene_args + 5, dev.bounce_accum);
+
+		dev.bounce_count = cl::Kernel(dev.program, "radix_count", &err);
+		err = dev.bounce_count.setArg(3, dev.bounce_histogram);
+
+		dev.bounce_scan = cl::Kernel(dev.program, "radix_scan", &err);
+		err = dev.bounce_scan.setArg(0, dev.bounce_histogram);
+
+		dev.bounce_scatter = cl::Kernel(dev.program, "radix_scatter", &err);
+		err = dev.bounce_scatter.setArg(6, dev.bounce_histogram);
+
+		dev.bounce_resolve = cl::Kernel(dev.program, "resolve_bounces", &err);
+		err = dev.bounce_resolve.setArg(0, dev.aov_buf);
+		err = dev.bounce_resolve.setArg(1, dev.bounce_accum);
+		err = dev.bounce_resolve.setArg(4, dev.out_buf);
+	}
+
+	// Sort the count keys of keys[q] with their values in kRaySortPasses radix passes of
+	// radix_count, radix_scan and radix_scatter, the kernels count_kernel, scan and scatter with
+	// their histogram set, keys[1 - q] and values[1 - q] serving as the buffers of every other
+	// pass; first and last, unless null, get the first and last command
+	cl_int enqueue_radix_sort(cl::CommandQueue& queue, cl::Kernel& count_kernel, cl::Kernel& scan, cl::Kernel& scatter, cl::Buffer const* keys,
+	                          cl::Buffer const* values, std::uint32_t q, cl_uint count, cl::Event* first, cl::Event* last)
+	{
+		cl_int err = CL_SUCCESS;
+		cl_uint groups = (count + kWaveGroup - 1) / kWaveGroup;
+		cl::NDRange global(std::size_t(groups) * kWaveGroup);
+		cl::NDRange local(kWaveGroup);
+
+		err = count_kernel.setArg(1, count);
+		err = scan.setArg(1, groups * 16);
+		err = scatter.setArg(4, count);
+
+		for (cl_uint pass = 0; pass < kRaySortPasses && err == CL_SUCCESS; ++pass)
+		{
+			auto from = (q + pass) % 2;
+			auto to = 1 - from;
+			cl_uint shift = pass * 4;
+
+			err = count_kernel.setArg(0, keys[from]);
+			err = count_kernel.setArg(2, shift);
+			err = queue.enqueueNDRangeKernel(count_kernel, cl::NullRange, global, local, nullptr, pass == 0 ? first : nullptr);
+
+			err = err == CL_SUCCESS ? queue.enqueueNDRangeKernel(scan, cl::NullRange, local, local) : err;
+
+			err = scatter.setArg(0, keys[from]);
+			err = scatter.setArg(1, values[from]);
+			err = scatter.setArg(2, keys[to]);
+			err = scatter.setArg(3, values[to]);
+			err = scatter.setArg(5, shift);
+			err = queue.enqueueNDRangeKernel(scatter, cl::NullRange, global, local, nullptr, pass + 1 == kRaySortPasses ? last : nullptr);
+		}
+
+		return err;
+	}
+
+	// Sort the count keys of bounce queue q of dev with the values of their slots, the other
+	// queue's keys and values serving as the buffers of every other pass; stage gets the first
+	// and last command
+	cl_int enqueue_bounce_sort(render_device& dev, std::uint32_t q, cl_uint count, bounce_stage& stage)
+	{
+		return enqueue_radix_sort(dev.queue, dev.bounce_count, dev.bounce_scan, dev.bounce_scatter, dev.bounce_keys, dev.bounce_values, q, count,
+		                          &stage.sort_first, &stage.sort_last);
+	}
+
+	// Enqueue the reflections of rows [row_begin, row_end) of dev after the kernel traced them:
+	// the first bounce queued from the id channel, then every bounce sorted and traced while
+	// it has rays, and the colors written; event is the last command. The ray count of every
+	// bounce is read back, so the call waits for the bounces before it.
+	cl_int enqueue_bounces(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* event)
+	{
+		cl_uint first = row_begin * dev.view.image_width;
+		cl_uint pixels = (row_end - row_begin) * dev.view.image_width;
+		cl::NDRange global((pixels + kBounceGroup - 1) / kBounceGroup * kBounceGroup);
+		cl::NDRange local(kBounceGroup);
+
+		// the queues of the bounce_intersect arguments follow the scene's
+		cl_uint args = dev.bounce_intersect.getInfo<CL_KERNEL_NUM_ARGS>() - 10;
+
+		dev.bounce_stages.clear();
+
+		cl_int err = dev.queue.enqueueFillBuffer(dev.bounce_queued[0], 0U, 0, sizeof(cl_uint));
+		err = dev.bounce_generate.setArg(6, first);
+		err = dev.bounce_generate.setArg(7, pixels);
+		err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.bounce_generate, cl::NullRange, global, local) : err;
+
+		cl_uint count = 0;
+		err = err == CL_SUCCESS ? dev.queue.enqueueReadBuffer(dev.bounce_queued[0], CL_TRUE, 0, sizeof(cl_uint), &count) : err;
+
+		for (std::uint32_t b = 0; b < dev.bounces && count != 0 && err == CL_SUCCESS; ++b)
+		{
+			auto q = b % 2;
+			auto next = 1 - q;
+			bool last = b + 1 == dev.bounces;
+
+			dev.bounce_stages.push_back(bounce_stage{ count });
+			auto& stage = dev.bounce_stages.back();
+
+			if (dev.sort_bounces)
+				err = enqueue_bounce_sort(dev, q, count, stage);
+
+			if (!last && err == CL_SUCCESS)
+				err = dev.queue.enqueueFillBuffer(dev.bounce_queued[next], 0U, 0, sizeof(cl_uint));
+
+			if (err != CL_SUCCESS)
+				break;
+
+			err = dev.bounce_intersect.setArg(args, dev.bounce_rays[q]);
+			err = dev.bounce_intersect.setArg(args + 1, dev.bounce_values[q]);
+			err = dev.bounce_intersect.setArg(args + 2, count);
+			err = dev.bounce_intersect.setArg(args + 4, cl_uint(last ? 1 : 0));
+			err = dev.bounce_intersect.setArg(args + 6, dev.bounce_queued[next]);
+			err = dev.bounce_intersect.setArg(args + 7, dev.bounce_rays[next]);
+			err = dev.bounce_intersect.setArg(args + 8, dev.bounce_keys[next]);
+			err = dev.bounce_intersect.setArg(args + 9, dev.bounce_values[next]);
+			err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.bounce_intersect, cl::NullRange,
+			                                                         cl::NDRange((count + kBounceGroup - 1) / kBounceGroup * kBounceGroup), local, nullptr,
+			                                                         &stage.intersect)
+			                        : err;
+
+			count = 0;
+
+			if (!last && err == CL_SUCCESS)
+				err = dev.queue.enqueueReadBuffer(dev.bounce_queued[next], CL_TRUE, 0, sizeof(cl_uint), &count);
+		}
+
+		if (err != CL_SUCCESS)
+			return err;
+
+		err = dev.bounce_resolve.setArg(2, first);
+		err = dev.bounce_resolve.setArg(3, pixels);
+
+		return dev.queue.enqueueNDRangeKernel(dev.bounce_resolve, cl::NullRange, global, cl::NullRange, nullptr, event);
+	}
+
+	// Float of a key of float_key() in trace.cl
+	float key_float(cl_uint key)
+	{
+		cl_uint bits = (key & 0x80000000U) != 0U ? key & 0x7FFFFFFFU : ~key;
+		float f;
+		std::memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	// Enqueue a chunk of the out-of-core brute force of rows [row_begin, row_end) of dev, spheres
+	// base .. base + count - 1 of the scene whose arrays start at chunk_arrays: they are uploaded
+	// on the upload queue into slot, once the kernel of the chunk before that used it is done
+	// with it, and the chunk's kernel is queued on dev.queue behind the upload. An empty first
+	// chunk only starts every pixel empty.
+	cl_int enqueue_chunk(render_device& dev, stream_slot& slot, float const* const* chunk_arrays, std::uint32_t base, std::uint32_t count,
+	                     std::uint32_t row_begin, std::uint32_t row_end)
+	{
+		cl_int err = CL_SUCCESS;
+
+		auto width = dev.view.image_width;
+		auto rows = row_end - row_begin;
+
+		std::vector<cl::Event> upload_wait;
+		std::vector<cl::Event> kernel_wait;
+
+		if (slot.in_use)
+			upload_wait.push_back(slot.used);
+
+		if (count != 0)
+		{
+			for (auto a = 0; a < 5; ++a)
+			{
+				std::size_t floats = a == 4 ? 3 : 1;
+				err = dev.upload_queue.enqueueWriteBuffer(slot.arrays[a], CL_FALSE, 0, sizeof(float) * floats * count, chunk_arrays[a], &upload_wait,
+				                                          a == 4 ? &slot.uploaded : nullptr);
+			}
+
+			err = dev.upload_queue.flush();
+			kernel_wait.push_back(slot.uploaded);
+		}
+
+		for (auto a = 0; a < 5; ++a)
+		{
+			err = dev.kernel.setArg(a, slot.arrays[a]);
+		}
+
+		err = dev.kernel.setArg(5, base);
+		err = dev.kernel.setArg(6, count);
+
+		err = dev.queue.enqueueNDRangeKernel(dev.kernel, cl::NDRange(0, row_begin), cl::NDRange(width, rows), group_size(dev, rows),
+		                                     kernel_wait.empty() ? nullptr : &kernel_wait, &slot.used);
+
+		if (err != CL_SUCCESS)
+			return err;
+
+		slot.in_use = true;
+
+		if (base == 0)
+			dev.first_kernel = slot.used;
+
+		return CL_SUCCESS;
+	}
+
+	// Enqueue the out-of-core brute force of rows [row_begin, row_end) of dev: every chunk is
+	// uploaded on the upload queue into the next slot, once the kernel of the chunk kStreamSlots
+	// before it is done with that slot, while the previous chunk's kernel runs. The kernels run
+	// in chunk order on dev.queue, then the resolve kernel of kernel_event writes the rows. With
+	// dev.cancel the chunks are queued at most kStreamSlots ahead and end once it is cancelled.
+	// The chunks of a scene streamed in batches are already queued, only the resolve is left.
+	cl_int enqueue_chunks(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* kernel_event)
+	{
+		cl_int err = CL_SUCCESS;
+
+		auto width = dev.view.image_width;
+		auto rows = row_end - row_begin;
+
+		// an empty scene still runs one chunk to start the pixels
+		bool chunks = !dev.stream_batches || dev.stream_chunks == 0;
+
+		for (std::uint32_t base = 0, chunk = 0; chunks && (chunk == 0 || base < dev.stream_size); base += dev.chunk_spheres, ++chunk)
+		{
+			auto count = std::min(dev.chunk_spheres, dev.stream_size - base);
+			auto& slot = dev.slots[chunk % kStreamSlots];
+
+			if (slot.in_use && dev.cancel)
+			{
+				err = dev.queue.flush();
+				err = slot.used.wait();
+
+				// the resolve still runs, over the chunks done so far
+				if (dev.cancel->cancelled())
+					break;
+			}
+
+			float const* chunk_arrays[5];
+
+			for (auto a = 0; a < 5; ++a)
+			{
+				chunk_arrays[a] = dev.stream_source[a] + (a == 4 ? 3 : 1) * std::size_t(base);
+			}
+
+			err = enqueue_chunk(dev, slot, chunk_arrays, base, count, row_begin, row_end);
+
+			if (err != CL_SUCCESS)
+				return err;
+		}
+
+		return dev.queue.enqueueNDRangeKernel(dev.resolve_kernel, cl::NDRange(0, row_begin), cl::NDRange(width, rows), group_size(dev, rows), nullptr, kernel_event);
+	}
+
+	// Set up the wavefront pipeline of dev, whose kernel is the intersection stage of the mode of
+	// scene with its scene arguments set: the kernels of the other stages and the queues, sized
+	// for every pixel of the image, and the work list of the coverage mask of scene if it has one
+	void init_wavefront(render_device& dev, render_scene const& scene)
+	{
+		cl_int err = 0;
+		auto mode = scene.mode;
+
+		auto& waves = dev.waves;
+		std::size_t num_rays = std::size_t(dev.view.image_width) * dev.view.image_height;
+		std::size_t groups = (num_rays + kWaveGroup - 1) / kWaveGroup;
+
+		if (waves.rays() == nullptr || waves.rays.getInfo<CL_MEM_SIZE>() != kQueuedRayBytes * num_rays)
+		{
+			waves.rays = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, kQueuedRayBytes * num_rays, nullptr, &err, "wavefront rays");
+			waves.group_counts = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * groups, nullptr, &err, "wavefront group counts");
+			waves.shade_queue = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * num_rays, nullptr, &err, "wavefront shade queue");
+			waves.shaded = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint), nullptr, &err, "wavefront shaded");
+		}
+
+		// the counts are set per band by enqueue_wavefront
+		waves.rays_arg = mode == accel_mode::none ? 5 : 7;
+		err = dev.kernel.setArg(waves.rays_arg, waves.rays);
+
+		waves.generate = cl::Kernel(dev.program, "wave_generate", &err);
+		err = waves.generate.setArg(2, waves.rays);
+
+		waves.count = cl::Kernel(dev.program, "wave_count", &err);
+		err = waves.count.setArg(0, waves.rays);
+		err = waves.count.setArg(2, waves.group_counts);
+
+		waves.scan = cl::Kernel(dev.program, "radix_scan", &err);
+		err = waves.scan.setArg(0, waves.group_counts);
+
+		waves.compact = cl::Kernel(dev.program, "wave_compact", &err);
+		err = waves.compact.setArg(0, waves.rays);
+		err = waves.compact.setArg(2, waves.group_counts);
+		err = waves.compact.setArg(3, waves.shade_queue);
+		err = waves.compact.setArg(4, waves.shaded);
+		err = waves.compact.setArg(5, dev.out_buf);
+
+		waves.shade = cl::Kernel(dev.program, "wave_shade", &err);
+
+		for (cl_uint a = 0; a < 5; ++a)
+		{
+			err = set_scene_arg(dev, waves.shade, a);
+		}
+
+		err = waves.shade.setArg(5, waves.rays);
+		err = waves.shade.setArg(6, waves.shade_queue);
+		err = waves.shade.setArg(7, waves.shaded);
+		err = waves.shade.setArg(8, dev.out_buf);
+
+		waves.covered = !scene.coverage.empty();
+		waves.row_covered.clear();
+
+		if (waves.covered)
+		{
+			std::vector<cl_uint> pixels;
+			waves.row_covered.push_back(0U);
+
+			for (auto j = 0U; j < dev.view.image_height; ++j)
+			{
+				for (auto p = std::size_t(j) * dev.view.image_width; p < std::size_t(j + 1) * dev.view.image_width; ++p)
+				{
+					if (pixel_covered(scene.coverage.data(), p))
+						pixels.push_back(static_cast<cl_uint>(p));
+				}
+
+				waves.row_covered.push_back(static_cast<cl_uint>(pixels.size()));
+			}
+
+			// an empty buffer is invalid, keep one entry when no pixel is covered
+			pixels.resize(std::max<std::size_t>(pixels.size(), 1U));
+
+			waves.pixels = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(cl_uint) * pixels.size(), nullptr, &err, "wavefront work list");
+			waves.coverage = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(std::uint32_t) * scene.coverage.size(), nullptr, &err,
+			                               "wavefront coverage");
+			err = dev.queue.enqueueWriteBuffer(waves.pixels, CL_TRUE, 0, sizeof(cl_uint) * pixels.size(), pixels.data());
+			err = dev.queue.enqueueWriteBuffer(waves.coverage, CL_TRUE, 0, sizeof(std::uint32_t) * scene.coverage.size(), scene.coverage.data());
+
+			waves.generate_covered = cl::Kernel(dev.program, "wave_generate_covered", &err);
+			err = waves.generate_covered.setArg(2, waves.pixels);
+			err = waves.generate_covered.setArg(3, waves.rays);
+
+			waves.background = cl::Kernel(dev.program, "wave_background", &err);
+			err = waves.background.setArg(2, waves.coverage);
+			err = waves.background.setArg(3, dev.out_buf);
+		}
+
+		waves.active = true;
+	}
+
+	// Enqueue the wavefront pipeline of rows [row_begin, row_end) of dev, one launch per stage
+	// over whole work-groups of kWaveGroup rays; the in-order queue runs them one after the
+	// other. With a coverage mask the background of the band is written first and only the
+	// covered pixels are queued, at least one work-group still runs so every stage has a
+	// launch. wave_shade of kernel_event writes the hits.
+	cl_int enqueue_wavefront(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* kernel_event)
+	{
+		auto& waves = dev.waves;
+		cl_uint pixels = dev.view.image_width * (row_end - row_begin);
+		cl_uint count = waves.covered ? waves.row_covered[row_end] - waves.row_covered[row_begin] : pixels;
+		cl_uint groups = std::max<cl_uint>((count + kWaveGroup - 1) / kWaveGroup, 1U);
+
+		cl::NDRange rays(std::size_t(groups) * kWaveGroup);
+		cl::NDRange group(kWaveGroup);
+
+		cl_int err = 0;
+
+		if (waves.covered)
+		{
+			err = waves.background.setArg(0, row_begin);
+			err = waves.background.setArg(1, pixels);
+			err = dev.queue.enqueueNDRangeKernel(waves.background, cl::NullRange, cl::NDRange((pixels + kWaveGroup - 1) / kWaveGroup * kWaveGroup), group, nullptr,
+			                                     &dev.first_kernel);
+
+			err = waves.generate_covered.setArg(0, waves.row_covered[row_begin]);
+			err = waves.generate_covered.setArg(1, count);
+			err = dev.queue.enqueueNDRangeKernel(waves.generate_covered, cl::NullRange, rays, group);
+		}
+		else
+		{
+			err = waves.generate.setArg(0, row_begin);
+			err = waves.generate.setArg(1, count);
+			err = dev.queue.enqueueNDRangeKernel(waves.generate, cl::NullRange, rays, group, nullptr, &dev.first_kernel);
+		}
+
+		err = dev.kernel.setArg(waves.rays_arg + 1, count);
+		err = dev.queue.enqueueNDRangeKernel(dev.kernel, cl::NullRange, rays, group);
+
+		err = waves.count.setArg(1, count);
+		err = dev.queue.enqueueNDRangeKernel(waves.count, cl::NullRange, rays, group);
+
+		err = waves.scan.setArg(1, groups);
+		err = dev.queue.enqueueNDRangeKernel(waves.scan, cl::NullRange, group, group);
+
+		err = waves.compact.setArg(1, count);
+		err = dev.queue.enqueueNDRangeKernel(waves.compact, cl::NullRange, rays, group);
+
+		if (err != CL_SUCCESS)
+			return err;
+
+		return dev.queue.enqueueNDRangeKernel(waves.shade, cl::NullRange, rays, group, nullptr, kernel_event);
+	}
+
+	// Enqueue the atomic splat of rows [row_begin, row_end) of dev: the depth entries of the
+	// rows are emptied, splat_atomic splats every sphere into them and resolve_splat of
+	// kernel_event writes the rows
+	cl_int enqueue_splat(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* kernel_event)
+	{
+		auto width = dev.view.image_width;
+		auto rows = row_end - row_begin;
+
+		cl_int err = dev.queue.enqueueFillBuffer(dev.depth_buf, cl_ulong(~0ULL), sizeof(cl_ulong) * width * row_begin, sizeof(cl_ulong) * width * rows, nullptr,
+		                                         &dev.first_kernel);
+
+		err = dev.kernel.setArg(6, row_begin);
+		err = dev.kernel.setArg(7, row_end);
+		err = dev.queue.enqueueNDRangeKernel(dev.kernel, cl::NullRange, cl::NDRange((std::size_t(dev.splat_spheres) + 63) / 64 * 64), cl::NDRange(64));
+
+		if (err != CL_SUCCESS)
+			return err;
+
+		return dev.queue.enqueueNDRangeKernel(dev.resolve_kernel, cl::NDRange(0, row_begin), cl::NDRange(width, rows), group_size(dev, rows), nullptr, kernel_event);
+	}
+
+	// Enqueue the band of dev as tiles of whole work-group rows, kTilesPerQueue per queue,
+	// round-robin to dev.queues: the kernel of a tile waits for the kernel of the tile before
+	// it, the read into img follows it in its queue. kernel_event is the kernel of the last tile.
+	cl_int enqueue_tiles(render_device& dev, unsigned char* img, cl::Event* kernel_event)
+	{
+		auto width = dev.view.image_width;
+		auto rows = dev.row_end - dev.row_begin;
+		auto tiles = static_cast<std::uint32_t>(dev.queues.size()) * kTilesPerQueue;
+		auto tile_rows = std::max((rows + tiles - 1) / tiles + kGroupTileSize - 1, kGroupTileSize) / kGroupTileSize * kGroupTileSize;
+
+		dev.tile_kernels.clear();
+		dev.tile_reads.clear();
+
+		cl_int err = CL_SUCCESS;
+
+		for (auto begin = dev.row_begin; begin < dev.row_end && err == CL_SUCCESS; begin += tile_rows)
+		{
+			auto end = std::min(begin + tile_rows, dev.row_end);
+			auto& queue = dev.queues[dev.tile_kernels.size() % dev.queues.size()];
+
+			std::vector<cl::Event> traced;
+
+			if (!dev.tile_kernels.empty())
+				traced.push_back(dev.tile_kernels.back());
+
+			std::size_t offset = pixel_size(dev.format) * width * begin;
+			std::size_t size = pixel_size(dev.format) * width * (end - begin);
+
+			cl::Event kernel, read;
+			err = enqueue_pixels(dev, queue, begin, end, &traced, &kernel);
+			err = queue.enqueueReadBuffer(dev.out_buf, CL_FALSE, offset, size, img + offset, nullptr, &read);
+			err = queue.flush();
+
+			dev.tile_kernels.push_back(kernel);
+			dev.tile_reads.push_back(read);
+		}
+
+		if (err != CL_SUCCESS)
+			return err;
+
+		dev.first_kernel = dev.tile_kernels.front();
+		*kernel_event = dev.tile_kernels.back();
+		return CL_SUCCESS;
+	}
+
+	// Render the whole image of dev into img, false if a command fails
+	bool render_whole(render_device& dev, std::vector<unsigned char>& img)
+	{
+		img.resize(pixel_size(dev.format) * dev.view.image_width * dev.view.image_height);
+
+		cl::Event kernel_event;
+		cl_int err = enqueue_band(dev, 0, dev.view.image_height, &img[0], &kernel_event);
+		err = err == CL_SUCCESS ? dev.queue.finish() : err;
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		finish_band(dev, 0, dev.view.image_height, &img[0]);
+		return dev.queue.finish() == CL_SUCCESS;
+	}
+
+	// Largest distance between the channels of two images of format in steps of the format:
+	// units in the last place of a float or half, levels of an 8-bit channel. A pixel naming
+	// another sphere is off by any number of steps.
+	std::uint32_t max_steps(std::vector<unsigned char> const& image, std::vector<unsigned char> const& reference, pixel_format format, ortho_view const& view)
+	{
+		if (is_id_format(format))
+			return image == reference ? 0U : std::numeric_limits<std::uint32_t>::max();
+
+		if (format == pixel_format::float32)
+		{
+			auto const* a = reinterpret_cast<float const*>(&image[0]);
+			auto const* b = reinterpret_cast<float const*>(&reference[0]);
+			return compare_images(a, b, view.image_width, view.image_height, 0).max_ulps;
+		}
+
+		std::uint32_t steps = 0;
+
+		// the floats of float4 and its padding, bits ordered like their values as image_compare.cpp does
+		if (format == pixel_format::float4)
+		{
+			for (std::size_t i = 0; i + 3 < image.size(); i += 4)
+			{
+				std::uint32_t a, b;
+				std::memcpy(&a, &image[i], sizeof(a));
+				std::memcpy(&b, &reference[i], sizeof(b));
+				a = (a & 0x80000000U) != 0 ? ~a : a | 0x80000000U;
+				b = (b & 0x80000000U) != 0 ? ~b : b | 0x80000000U;
+				steps = std::max(steps, a > b ? a - b : b - a);
+			}
+
+			return steps;
+		}
+
+		if (format == pixel_format::rgba8)
+		{
+			for (std::size_t i = 0; i < image.size(); ++i)
+			{
+				steps = std::max<std::uint32_t>(steps, image[i] > reference[i] ? image[i] - reference[i] : reference[i] - image[i]);
+			}
+
+			return steps;
+		}
+
+		// half bits ordered like their values, as image_compare.cpp does for floats
+		auto ordered = [](unsigned char const* p)
+		{
+			std::uint16_t bits;
+			std::memcpy(&bits, p, sizeof(bits));
+			return (bits & 0x8000U) != 0 ? std::uint32_t(0xFFFFU & ~bits) : std::uint32_t(bits | 0x8000U);
+		};
+
+		for (std::size_t i = 0; i + 1 < image.size(); i += 2)
+		{
+			auto a = ordered(&image[i]);
+			auto b = ordered(&reference[i]);
+			steps = std::max(steps, a > b ? a - b : b - a);
+		}
+
+		return steps;
+	}
+
+	// True if the kernel variant of the program of dev is estimated to keep less than
+	// kPruneOccupancy of the occupancy of base, or spills more than it going by the build log;
+	// why then says which
+	bool prune_variant(render_device const& dev, char const* variant, char const* base, std::string& why)
+	{
+		cl_int err = CL_SUCCESS;
+		cl::Kernel variant_kernel(dev.program, variant, &err);
+		cl::Kernel base_kernel(dev.program, base, &err);
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		auto log = dev.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(dev.device);
+		auto resources = query_kernel(variant_kernel, dev.device, log);
+		auto base_resources = query_kernel(base_kernel, dev.device, log);
+		auto occupancy = estimate_occupancy(resources, dev.device);
+		auto base_occupancy = estimate_occupancy(base_resources, dev.device);
+
+		if (occupancy.occupancy < kPruneOccupancy * base_occupancy.occupancy)
+		{
+			why = "occupancy ~" + std::to_string(static_cast<int>(occupancy.occupancy * 100.0 + 0.5)) + "% against ~" +
+			      std::to_string(static_cast<int>(base_occupancy.occupancy * 100.0 + 0.5)) + "%, limited by " + occupancy.limit;
+			return true;
+		}
+
+		if (resources.spill_bytes > base_resources.spill_bytes)
+		{
+			why = std::to_string(resources.spill_bytes) + " B of registers spilled";
+			return true;
+		}
+
+		return false;
+	}
+
+	// Setting of the block size of --coarsen for the brute force kernel base in the tuning
+	// database, its value is x and y, 1 1 for base itself
+	std::string coarse_setting(char const* base)
+	{
+		return std::string("coarsen ") + base;
+	}
+
+	// Fastest of kVariantRuns launches of the kernel of dev over rows rows in ms, -1 if it
+	// doesn't run
+	double time_variant(render_device& dev, std::uint32_t rows)
+	{
+		double fastest = 0.0;
+
+		for (auto run = 0; run < kVariantRuns; ++run)
+		{
+			cl::Event event;
+			cl_int err = enqueue_pixels(dev, dev.queue, 0, rows, nullptr, &event);
+			err = err == CL_SUCCESS ? event.wait() : err;
+
+			if (err != CL_SUCCESS)
+				return -1.0;
+
+			fastest = run == 0 ? profile(event).run : std::min(fastest, profile(event).run);
+		}
+
+		return fastest;
+	}
+
+	// Run the brute force kernel name of dev, a kernel with the arguments of trace whose
+	// work-items trace blocks of block.x x block.y pixels
+	cl_int use_block_kernel(render_device& dev, char const* name, work_group block)
+	{
+		cl_int err = CL_SUCCESS;
+		cl::Kernel kernel(dev.program, name, &err);
+
+		for (cl_uint a = 0; a < 5; ++a)
+		{
+			err = set_scene_arg(dev, kernel, a);
+		}
+
+		err = kernel.setArg(5, dev.out_buf);
+		dev.kernel = kernel;
+		dev.coarse = block;
+		dev.tiled = false;
+		dev.out_arg = 5;
+		return err;
+	}
+
+	// Pick the pixel block of the brute force kernel base of dev, whose arguments are set: with
+	// tune time rows rows with base and with every trace_coarse kernel and store the fastest,
+	// otherwise take the stored one. dev then runs the kernel picked with base's arguments.
+	void choose_coarsening(render_device& dev, char const* base, bool tune, std::uint32_t rows)
+	{
+		cl_int err = CL_SUCCESS;
+		work_group block{ 1, 1 };
+
+		auto use = [&](coarse_kernel const& candidate)
+		{
+			err = use_block_kernel(dev, candidate.name, candidate.block);
+		};
+
+		if (tune && rows > 0)
+		{
+			std::cout << dev.name << ": tuning the pixel block of " << base << "\n";
+
+			auto base_kernel = dev.kernel;
+			auto base_tiled = dev.tiled;
+			double best_time = time_variant(dev, rows);
+			std::cout << "  1x1: " << best_time << " ms\n";
+
+			for (auto const& candidate : kCoarseKernels)
+			{
+				std::string why;
+
+				// the blocks keep more state per work-item, a variant that runs short of it isn't timed
+				if (prune_variant(dev, candidate.name, base, why))
+				{
+					std::cout << "  " << candidate.name << " pruned: " << why << "\n";
+					continue;
+				}
+
+				use(candidate);
+
+				double candidate_time = err == CL_SUCCESS ? time_variant(dev, rows) : -1.0;
+
+				if (candidate_time < 0.0)
+				{
+					std::cout << "  " << candidate.name << " does not run\n";
+					continue;
+				}
+
+				std::cout << "  " << candidate.block.x << "x" << candidate.block.y << ": " << candidate_time << " ms\n";
+
+				if (best_time < 0.0 || candidate_time < best_time)
+				{
+					best_time = candidate_time;
+					block = candidate.block;
+				}
+			}
+
+			dev.kernel = base_kernel;
+			dev.coarse = work_group{ 1, 1 };
+			dev.tiled = base_tiled;
+
+			if (!store_tuning(dev.tuning, coarse_setting(base), std::to_string(block.x) + " " + std::to_string(block.y)))
+				std::cout << dev.name << ": can't store the tuned pixel block\n";
+		}
+		else
+		{
+			std::string value;
+			std::istringstream values(find_tuning(dev.tuning, coarse_setting(base), value) ? value : std::string());
+
+			// without a stored block base keeps running, one pixel per work-item
+			if (!(values >> block.x >> block.y))
+				return;
+		}
+
+		for (auto const& candidate : kCoarseKernels)
+		{
+			if (candidate.block.x == block.x && candidate.block.y == block.y)
+			{
+				use(candidate);
+				std::cout << dev.name << ": using kernel " << candidate.name << "\n";
+			}
+		}
+	}
+
+	// Layout of the geometry image of count spheres on device for trace_image: row is 0 for an
+	// image1d_buffer_t of a texel per sphere, or the width of an image2d_t for more spheres than
+	// CL_DEVICE_IMAGE_MAX_BUFFER_SIZE. Returns false if the device has no images or the spheres
+	// don't fit an image2d_t either.
+	bool geometry_layout(cl::Device const& device, std::size_t count, std::size_t& row)
+	{
+		row = 0;
+
+		if (count == 0 || !device.getInfo<CL_DEVICE_IMAGE_SUPPORT>())
+			return false;
+
+		if (count <= device.getInfo<CL_DEVICE_IMAGE_MAX_BUFFER_SIZE>())
+			return true;
+
+		row = device.getInfo<CL_DEVICE_IMAGE2D_MAX_WIDTH>();
+		return (count + row - 1) / row <= device.getInfo<CL_DEVICE_IMAGE2D_MAX_HEIGHT>();
+	}
+
+	// Write the geometry of spheres first .. first + count - 1 of the arrays cx, cy, cz and
+	// radius2 to their texels in the geometry image of dev, row by row of an image2d_t
+	cl_int write_geometry(render_device& dev, float const* const* arrays, std::size_t first, std::size_t count)
+	{
+		std::vector<float> texels(4 * count);
+
+		for (std::size_t k = 0; k < count; ++k)
+		{
+			for (std::size_t a = 0; a < 4; ++a)
+			{
+				texels[4 * k + a] = arrays[a][first + k];
+			}
+		}
+
+		if (dev.geometry_row == 0)
+			return dev.queue.enqueueWriteBuffer(dev.geometry_texels, CL_TRUE, 4 * sizeof(float) * first, sizeof(float) * texels.size(), texels.data());
+
+		cl_int err = CL_SUCCESS;
+
+		for (std::size_t k = first; k < first + count && err == CL_SUCCESS;)
+		{
+			std::size_t run = std::min(dev.geometry_row - k % dev.geometry_row, first + count - k);
+
+			cl::size_t<3> origin, region;
+			origin[0] = k % dev.geometry_row;
+			origin[1] = k / dev.geometry_row;
+			origin[2] = 0;
+			region[0] = run;
+			region[1] = 1;
+			region[2] = 1;
+
+			err = dev.queue.enqueueWriteImage(dev.geometry_rows, CL_TRUE, origin, region, 0, 0, &texels[4 * (k - first)]);
+			k += run;
+		}
+
+		return err;
+	}
+
+	// Release the geometry images of dev, trace_image no longer runs
+	void release_geometry(render_device& dev)
+	{
+		dev.geometry_image = cl::Image1DBuffer();
+		dev.geometry_texels = cl::Buffer();
+		dev.geometry_rows = cl::Image2D();
+	}
+
+	// Create the geometry image of dev for the spheres of scene, in rows of row texels or a
+	// buffer image if row is 0, and write it from the mapped arrays of scene.file, if any, or
+	// from scene.spheres. Returns false without an image if it can't.
+	bool upload_geometry(render_device& dev, render_scene const& scene, std::size_t row)
+	{
+		cl_int err = CL_SUCCESS;
+		std::size_t count = scene.spheres.size();
+		cl::ImageFormat format(CL_RGBA, CL_FLOAT);
+
+		dev.geometry_row = row;
+
+		if (row == 0)
+		{
+			dev.geometry_texels = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, 4 * sizeof(float) * count, nullptr, &err, "geometry texels");
+
+			if (err == CL_SUCCESS)
+				dev.geometry_image = cl::Image1DBuffer(dev.context, CL_MEM_READ_ONLY, format, count, dev.geometry_texels, &err);
+		}
+		else
+		{
+			dev.geometry_rows = cl::Image2D(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, format, row, (count + row - 1) / row, 0, nullptr, &err);
+		}
+
+		scene_array const file_arrays[4] = { scene_array::cx, scene_array::cy, scene_array::cz, scene_array::radius2 };
+		float const* arrays[4] = { scene.spheres.cx.data(), scene.spheres.cy.data(), scene.spheres.cz.data(), scene.spheres.radius2.data() };
+
+		for (auto a = 0; a < 4 && scene.file; ++a)
+		{
+			arrays[a] = scene.file->array(file_arrays[a]);
+		}
+
+		if (err == CL_SUCCESS)
+			err = write_geometry(dev, arrays, 0, count);
+
+		if (err != CL_SUCCESS)
+		{
+			release_geometry(dev);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Setting of the --image-reads verdict for the brute force kernel base in the tuning
+	// database, its value is 1 if trace_image runs instead
+	std::string image_reads_setting(char const* base)
+	{
+		return std::string("image_reads ") + base;
+	}
+
+	// Pick between the brute force kernel base of dev, whose arguments are set, and trace_image
+	// reading the geometry of scene from an image of row texels a row (see geometry_layout): with
+	// tune time rows rows with both and store the faster, otherwise take the stored one. dev
+	// then runs the kernel picked, trace_image with base's arguments and the image.
+	void choose_image_reads(render_device& dev, render_scene const& scene, char const* base, bool tune, std::uint32_t rows, std::size_t row)
+	{
+		cl_int err = CL_SUCCESS;
+		bool timed = tune && rows > 0;
+		std::string verdict;
+
+		// without a stored verdict base keeps reading buffers
+		if (!timed && !(find_tuning(dev.tuning, image_reads_setting(base), verdict) && verdict == "1"))
+			return;
+
+		if (!upload_geometry(dev, scene, row))
+		{
+			std::cout << dev.name << ": can't create the geometry image, reading buffers\n";
+			return;
+		}
+
+		cl::Kernel kernel(dev.program, "trace_image", &err);
+
+		for (cl_uint a = 0; a < 5; ++a)
+		{
+			err = set_scene_arg(dev, kernel, a);
+		}
+
+		err = row == 0 ? kernel.setArg(5, dev.geometry_image) : kernel.setArg(5, dev.geometry_rows);
+		err = kernel.setArg(6, dev.out_buf);
+
+		auto base_kernel = dev.kernel;
+		auto base_tiled = dev.tiled;
+		auto base_out_arg = dev.out_arg;
+		double base_time = timed ? time_variant(dev, rows) : 0.0;
+
+		dev.kernel = kernel;
+		dev.tiled = false;
+		dev.out_arg = 6;
+
+		if (timed)
+		{
+			double image_time = err == CL_SUCCESS ? time_variant(dev, rows) : -1.0;
+			bool faster = image_time >= 0.0 && (base_time < 0.0 || image_time < base_time);
+
+			std::cout << dev.name << ": " << base << " " << base_time << " ms, trace_image ";
+
+			if (image_time < 0.0)
+				std::cout << "does not run\n";
+			else
+				std::cout << image_time << " ms\n";
+
+			if (!store_tuning(dev.tuning, image_reads_setting(base), faster ? "1" : "0"))
+				std::cout << dev.name << ": can't store the image reads verdict\n";
+
+			if (!faster)
+			{
+				dev.kernel = base_kernel;
+				dev.tiled = base_tiled;
+				dev.out_arg = base_out_arg;
+				release_geometry(dev);
+				return;
+			}
+		}
+
+		std::cout << dev.name << ": using kernel trace_image\n";
+	}
+
+	// Setting of the fast math verdict of the strict build options in the tuning database, the
+	// value is 1 if the fast build is used
+	std::string fast_math_setting(render_device const& dev, std::string const& options)
+	{
+		return "fast_math " + std::to_string(dev.fast_math_ulps) + " " + options;
+	}
+
+	// First init_device of the build options on dev with fast_math: a frame of the strict and
+	// of the fast math build decides which one dev keeps, the verdict is recorded for options
+	// and stored in the tuning database
+	bool validate_fast_math(render_device& dev, std::string const& src, render_scene& scene, bool use_cache, bool tune, std::string const& scene_key,
+	                        std::string const& options)
+	{
+		std::vector<unsigned char> strict_frame, fast_frame;
+
+		dev.fast_math_verdicts[options] = false;
+
+		if (!init_device(dev, src, scene, use_cache, false, scene_key) || !render_whole(dev, strict_frame))
+		{
+			dev.fast_math_verdicts.erase(options);
+			return false;
+		}
+
+		dev.fast_math_verdicts[options] = true;
+
+		bool promoted = false;
+
+		if (!init_device(dev, src, scene, use_cache, false, scene_key) || !render_whole(dev, fast_frame))
+		{
+			std::cout << dev.name << ": the fast math build does not run, keeping the strict one\n";
+		}
+		else
+		{
+			auto steps = max_steps(fast_frame, strict_frame, dev.format, dev.view);
+			promoted = steps <= dev.fast_math_ulps;
+
+			std::cout << dev.name << ": fast math " << (steps == 0 ? "identical" : promoted ? "within tolerance" : "differs") << ", max " << steps
+			          << " steps, " << (promoted ? "using" : "not using") << " it\n";
+		}
+
+		dev.fast_math_verdicts[options] = promoted;
+
+		if (!store_tuning(dev.tuning, fast_math_setting(dev, options), promoted ? "1" : "0"))
+			std::cout << dev.name << ": can't store the fast math verdict\n";
+
+		// the fast build is set up already unless its work-groups are to be tuned
+		if (promoted && !tune)
+			return true;
+
+		return init_device(dev, src, scene, use_cache, tune, scene_key);
+	}
+}
+
+char const* aov_channel_name(aov_channel channel)
+{
+	return channel == aov_depth ? kAovNames[0] : channel == aov_id ? kAovNames[1] : channel == aov_normal ? kAovNames[2] : kAovNames[3];
+}
+
+bool parse_aov_channels(char const* names, std::uint32_t& aovs)
+{
+	std::uint32_t parsed = 0;
+
+	for (char const* name = names;; ++name)
+	{
+		auto length = std::strcspn(name, ",");
+		bool known = false;
+
+		for (std::uint32_t c = 0; c < 4; ++c)
+		{
+			if (std::strlen(kAovNames[c]) == length && std::strncmp(name, kAovNames[c], length) == 0)
+			{
+				parsed |= 1U << c;
+				known = true;
+			}
+		}
+
+		if (!known)
+			return false;
+
+		name += length;
+
+		if (*name == '\0')
+			break;
+	}
+
+	aovs = parsed;
+	return true;
+}
+
+std::size_t aov_floats(std::uint32_t aovs)
+{
+	std::size_t floats = 0;
+
+	for (auto channel : { aov_depth, aov_id, aov_normal, aov_cost })
+	{
+		if ((aovs & channel) != 0)
+			floats += aov_channel_floats(channel);
+	}
+
+	return floats;
+}
+
+std::size_t aov_channel_floats(aov_channel channel)
+{
+	return channel == aov_normal ? 3 : channel == aov_cost ? 2 : 1;
+}
+
+command_time profile(cl::Event const& event)
+{
+	auto queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+	auto submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+	auto start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	auto end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+	return command_time{ (submit - queued) * 1e-6, (start - submit) * 1e-6, (end - start) * 1e-6 };
+}
+
+command_time profile(cl::Event const& first, cl::Event const& last)
+{
+	auto time = profile(first);
+	auto start = first.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	auto end = last.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+	time.run = (end - start) * 1e-6;
+	return time;
+}
+
+cl::NDRange group_size(render_device const& dev, std::uint32_t rows)
+{
+	return group_size(dev, dev.view.image_width, rows);
+}
+
+cl::NDRange group_size(render_device const& dev, std::uint32_t width, std::uint32_t rows)
+{
+	if (dev.group.x != 0 && width % dev.group.x == 0 && rows % dev.group.y == 0)
+		return cl::NDRange(dev.group.x, dev.group.y);
+
+	bool whole_tiles = width % kGroupTileSize == 0 && rows % kGroupTileSize == 0;
+	return dev.tiled && whole_tiles ? cl::NDRange(kGroupTileSize, kGroupTileSize) : cl::NullRange;
+}
+
+cl_int enqueue_pixels(render_device const& dev, cl::CommandQueue& queue, std::uint32_t row_begin, std::uint32_t row_end,
+                      std::vector<cl::Event> const* wait, cl::Event* event)
+{
+	// blocks over the right or bottom edge of the image write the pixels inside it only
+	auto columns = (dev.view.image_width + dev.coarse.x - 1) / dev.coarse.x;
+	auto rows = (row_end - row_begin + dev.coarse.y - 1) / dev.coarse.y;
+
+	return queue.enqueueNDRangeKernel(dev.kernel, cl::NDRange(0, row_begin / dev.coarse.y), cl::NDRange(columns, rows), group_size(dev, columns, rows), wait,
+	                                  event);
+}
+
+void set_device(render_device& dev, device_entry const& entry, pixel_format format, bool map_readback)
+{
+	dev.device = entry.device;
+	dev.name = entry.name;
+	dev.variants.reset();
+	dev.context = cl::Context();
+	dev.context_properties.clear();
+	dev.buffers.clear();
+	dev.svm = false;
+	dev.svm_arrays.clear();
+	dev.fast_math = false;
+	dev.fast_math_ulps = 0;
+	dev.fast_math_verdicts.clear();
+	dev.fast = false;
+	dev.kernel_report = false;
+	dev.reported_builds.clear();
+	dev.swizzle = false;
+	dev.spare_outputs.clear();
+	dev.scene_key.clear();
+	dev.row_begin = dev.row_end = 0;
+	dev.map_readback = map_readback;
+	dev.gather = false;
+	dev.mapped = nullptr;
+	dev.num_queues = 1;
+	dev.queues.clear();
+	dev.format = format;
+	dev.kernel_time = 0.0;
+	dev.transfer_time = 0.0;
+	dev.build_time = dev.upload_time = 0.0;
+	dev.kernel_profile = dev.transfer_profile = command_time{};
+	dev.group = work_group{ 0, 0 };
+	dev.wavefront = false;
+	dev.waves.active = false;
+	dev.persistent = false;
+	dev.persistent_groups = 0;
+	dev.coarsen = false;
+	dev.coarse = work_group{ 1, 1 };
+	dev.image_reads = false;
+	dev.async_prefetch = false;
+	dev.geometry_row = 0;
+	dev.chunk_spheres = 0;
+	dev.stream_batches = false;
+	dev.stream_chunks = 0;
+	dev.cancel = nullptr;
+	dev.splat_atomic = false;
+	dev.splat_spheres = 0;
+	dev.launch_rows = dev.timed_rows = 0;
+	dev.timed_first = dev.timed_last = cl::Event();
+	dev.aovs = 0;
+	dev.stats = false;
+	dev.stats_spheres = 0;
+	dev.mip_levels = 0;
+	dev.encode_codec = device_codec::none;
+	dev.encode_slot = 0;
+	dev.aa_grid = dev.aa_items = 0;
+	dev.bounces = 0;
+	dev.reflectivity = 0.f;
+	dev.sort_bounces = true;
+	dev.bounce_stages.clear();
+	dev.band_rows = 0;
+	dev.auto_bands = false;
+	dev.band_outputs.clear();
+	dev.speed_guess = static_cast<double>(entry.compute_units) * entry.clock;
+	dev.peak_gflops = entry.peak_gflops;
+	dev.peak_gbs = entry.peak_gbs;
+	dev.timeline_offset = 0.0;
+}
+
+bool share_context(std::vector<device_entry> const& entries, cl::Context& context)
+{
+	std::vector<cl::Device> devices;
+
+	for (auto const& entry : entries)
+	{
+		if (entry.platform() != entries[0].platform())
+			return false;
+
+		devices.push_back(entry.device);
+	}
+
+	context = cl::Context(devices);
+	return true;
+}
+
+void open_device(render_device& dev, std::string const& src, bool use_cache)
+{
+	if (dev.variants)
+		return;
+
+	// a context shared with the other devices of the frame is set already
+	if (dev.context() == nullptr && dev.context_properties.empty())
+		dev.context = cl::Context(dev.device);
+	else if (dev.context() == nullptr)
+		dev.context = cl::Context(dev.device, &dev.context_properties[0]);
+	dev.variants = std::make_shared<program_variants>(dev.context, dev.device, src, use_cache);
+
+	// settings tuned with another driver may not hold any more, they are measured again
+	dev.tuning = tuning_key{ dev.name, dev.device.getInfo<CL_DRIVER_VERSION>(), source_digest(src) };
+	auto dropped = invalidate_tuning(dev.tuning.device, dev.tuning.driver);
+
+	if (dropped != 0)
+		std::cout << dev.name << ": the driver changed, dropped " << dropped << " tuned settings\n";
+
+	// the scene is uploaded with profiled writes instead of CL_MEM_COPY_HOST_PTR
+	dev.queue = cl::CommandQueue(dev.context, dev.device, CL_QUEUE_PROFILING_ENABLE);
+
+	// a marker that has just finished ends at about the same time on both clocks
+	if (timeline_enabled())
+	{
+		cl::Event marker;
+		dev.queue.enqueueMarkerWithWaitList(nullptr, &marker);
+		dev.queue.finish();
+		dev.timeline_offset = timeline_now() - marker.getProfilingInfo<CL_PROFILING_COMMAND_END>() * 1e-3;
+	}
+}
+
+void warm_up_compiler(render_device const& dev)
+{
+	cl::Program program(dev.context, "kernel void warm_up(global int* out) { *out = 0; }");
+	program.build(std::vector<cl::Device>(1, dev.device), "-cl-std=CL1.2");
+}
+
+void record_command(render_device const& dev, char const* name, cl::Event const& first, cl::Event const& last)
+{
+	if (!timeline_enabled())
+		return;
+
+	auto start = first.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	auto end = last.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+	timeline_device_span(dev.name, name, start * 1e-3 + dev.timeline_offset, (end - start) * 1e-3);
+}
+
+void record_command(render_device const& dev, std::uint32_t q, char const* name, cl::Event const& event)
+{
+	if (!timeline_enabled())
+		return;
+
+	auto start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	auto end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+	timeline_device_span(dev.name + " queue " + std::to_string(q), name, start * 1e-3 + dev.timeline_offset, (end - start) * 1e-3);
+}
+
+std::string float_literal(float value)
+{
+	char text[32];
+	std::snprintf(text, sizeof(text), "(%af)", value);
+	return text;
+}
+
+std::string scene_defines(render_scene const& scene, pixel_format format)
+{
+	auto const& view = scene.view;
+
+	std::string options = " -D RT_FORMAT=" + std::to_string(static_cast<int>(format));
+	options += " -D kImageWidth=" + std::to_string(view.image_width) + " -D kImageHeight=" + std::to_string(view.image_height);
+	options += " -D kNumSpheres=" + std::to_string(scene.spheres.size());
+	options += " -D RT_LEFT=" + float_literal(view.left) + " -D RT_BOTTOM=" + float_literal(view.bottom);
+	options += " -D RT_WIDTH=" + float_literal(view.width) + " -D RT_HEIGHT=" + float_literal(view.height);
+	options += " -D RT_NEAR=" + float_literal(view.near) + " -D RT_FAR=" + float_literal(view.far);
+	return options;
+}
+
+namespace
+{
+	char const kFastMathOptions[] = " -cl-fast-relaxed-math -D RT_FAST_MATH";
+
+	// Build options of the kernels of a scene on a device before fast math and the kernel
+	// report, and the kernels they compile in
+	struct kernel_build
+	{
+		std::string options;
+		bool subgroups;
+		bool packed_half;
+		// trace_image compiled in, reading a geometry image of geometry_row texels a row
+		bool image_reads;
+		std::size_t geometry_row;
+		// Pixels of the row spans of trace_span, 0 if it isn't compiled in
+		std::uint32_t cpu_span;
+	};
+
+	// Settle the settings of dev that depend on scene, its bands, --aa, --bounces and view, and
+	// the build of its kernels, writing what changes to log. Returns false with the reason in
+	// log if dev can't render scene.
+	bool plan_kernels(render_device& dev, render_scene const& scene, std::ostream& log, kernel_build& build)
+	{
+		// no contraction (see trace.cl) and correctly rounded sqrt keep the kernels bit-identical
+		// to the CPU tracers, which the hybrid backend relies on
+		std::string options = "-cl-std=CL1.2";
+
+		if ((dev.device.getInfo<CL_DEVICE_SINGLE_FP_CONFIG>() & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT) != 0)
+		{
+			options += " -cl-fp32-correctly-rounded-divide-sqrt";
+		}
+
+		// sizes and view are compile time constants of the kernels, so the loops and the ray
+		// setup fold as before; every combination gets its own entry in the program cache
+		auto const& view = scene.view;
+		dev.view = view;
+		options += scene_defines(scene, dev.format);
+
+		if (scene.spheres.size() <= kUnrollSpheres)
+		{
+			options += " -D RT_UNROLL_SPHERES";
+		}
+
+		if (scene.neighbour_hint && (scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted))
+		{
+			options += " -D RT_NEIGHBOUR_HINT";
+		}
+
+		// the bvh is read in the compressed layout, see render_scene
+		if (scene.mode == accel_mode::bvh && !scene.instances && !scene.compressed_nodes.empty())
+		{
+			options += " -D RT_COMPRESSED_BVH";
+		}
+
+		// an image larger than one allocation is rendered in bands that fit one, like --tiled ones;
+		// the bands chosen for the last scene don't carry over. So is one of more than 2^32 pixels:
+		// the kernels of a band index its pixels with size_t, but the wavefront queues, bounces,
+		// statistics and MIP levels of whole images count them in uint.
+		if (dev.auto_bands)
+		{
+			dev.band_rows = 0;
+			dev.auto_bands = false;
+		}
+
+		auto max_alloc = dev.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+		cl_ulong row_bytes = pixel_size(dev.format) * cl_ulong(view.image_width);
+		cl_ulong uint_rows = std::numeric_limits<std::uint32_t>::max() / view.image_width;
+
+		if (dev.band_rows == 0 && (row_bytes * view.image_height > max_alloc || view.image_height > uint_rows))
+		{
+			if (dev.aovs != 0 || dev.stats)
+			{
+				log << dev.name << ": the image is larger than one allocation of " << max_alloc
+				    << " bytes or 2^32 pixels, only frames without channels or statistics are split\n";
+				return false;
+			}
+
+			// whole blocks of rows, as the bands of --tiled and the rows of partition_rows; rows so
+			// wide that not even one block fits can't be split
+			auto fit = static_cast<std::uint32_t>(std::min(std::min<cl_ulong>(max_alloc / row_bytes, uint_rows), cl_ulong(view.image_height)));
+
+			if (fit < kGroupTileSize)
+			{
+				log << dev.name << ": " << kGroupTileSize << " rows of the image are larger than one allocation of " << max_alloc
+				    << " bytes or 2^32 pixels, can't render it in bands\n";
+				return false;
+			}
+
+			dev.band_rows = fit / kGroupTileSize * kGroupTileSize;
+			dev.auto_bands = true;
+			dev.persistent = false;
+			dev.chunk_spheres = 0;
+
+			log << dev.name << ": the image is larger than one allocation of " << max_alloc << " bytes or 2^32 pixels, rendering it in bands of "
+			    << dev.band_rows << " rows\n";
+		}
+
+		// --aa finds the edges in the id channel of the one kernel per pixel paths
+		bool aa_mode = scene.mode == accel_mode::none || scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted;
+
+		if (dev.aa_grid > 1 && (!aa_mode || scene.instances || is_id_format(dev.format) || dev.band_rows != 0 || (dev.aovs & ~std::uint32_t(aov_id)) != 0))
+		{
+			log << dev.name << ": edges are antialiased in color frames of brute force, bvh and sorted scenes without bands or channels, not antialiasing\n";
+			dev.aa_grid = 0;
+		}
+
+		// --bounces starts the reflections from the same channel and writes the pixels --aa would
+		if (dev.bounces > 0 && (!aa_mode || scene.instances || is_id_format(dev.format) || dev.band_rows != 0 || dev.aa_grid > 1 ||
+		                        (dev.aovs & ~std::uint32_t(aov_id)) != 0))
+		{
+			log << dev.name << ": hits reflect in color frames of brute force, bvh and sorted scenes without bands, channels or --aa, not reflecting\n";
+			dev.bounces = 0;
+		}
+
+		if (dev.aa_grid > 1 || dev.bounces > 0)
+		{
+			dev.aovs |= aov_id;
+		}
+
+		// swizzled launches need an image of whole blocks, all bands are then whole blocks too; the
+		// single rows next to a band --aa traces are not
+		if (dev.swizzle && dev.aa_grid < 2 && (scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted))
+		{
+			if (view.image_width % kSwizzleTile == 0 && view.image_height % kSwizzleTile == 0)
+				options += " -D RT_SWIZZLE";
+			else
+				log << dev.name << ": the image is not made of " << kSwizzleTile << "x" << kSwizzleTile << " blocks, launching in row order\n";
+		}
+
+		// sub-group broadcasts replace the local memory batches of the brute force kernel where the
+		// device has them, trace_subgroup is only compiled then
+		bool subgroups = scene.mode == accel_mode::none && dev.device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_subgroups") != std::string::npos;
+
+		if (subgroups)
+		{
+			options += " -D RT_SUBGROUPS";
+		}
+
+		// the disc test of the halves runs in packed half2 math on GPUs with fp16 arithmetic, whose
+		// ray origins round to finite halves; trace_half2 is only compiled then
+		float view_extent = std::max(std::max(std::fabs(view.left), std::fabs(view.left + view.width)),
+		                             std::max(std::fabs(view.bottom), std::fabs(view.bottom + view.height)));
+		bool packed_half = scene.mode == accel_mode::none && !scene.halves.empty() && view_extent < kMaxPackedHalfOrigin &&
+		                   dev.device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_GPU && dev.device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp16") != std::string::npos;
+
+		if (packed_half)
+		{
+			options += " -D RT_PACKED_HALF";
+		}
+
+		// channels that aren't asked for are compiled out of the kernels
+		char const* aov_defines[] = { " -D RT_AOV_DEPTH", " -D RT_AOV_ID", " -D RT_AOV_NORMAL", " -D RT_AOV_COST" };
+
+		for (std::uint32_t c = 0; c < 4; ++c)
+		{
+			if ((dev.aovs & (1U << c)) != 0)
+			{
+				options += aov_defines[c];
+			}
+		}
+
+		if (dev.band_rows != 0)
+		{
+			options += " -D RT_BANDED";
+		}
+
+		// OpenCL CPU runtimes vectorize one pixel per work-item poorly, brute force traces row
+		// spans of explicit vectors of the native width there; trace_span is only compiled then
+		std::uint32_t cpu_span = 0;
+
+		if (scene.mode == accel_mode::none && scene.halves.empty() && dev.aovs == 0 && dev.band_rows == 0 &&
+		    dev.device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU)
+		{
+			cpu_span = dev.device.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT>() >= 16 ? 16 : 8;
+			options += " -D RT_CPU_SPAN=" + std::to_string(cpu_span);
+		}
+
+		// the geometry image stands in for the buffers of brute force without halves or channels
+		// on devices with images, trace_image is only compiled then
+		std::size_t geometry_row = 0;
+		bool image_reads = dev.image_reads && scene.mode == accel_mode::none && scene.halves.empty() && dev.aovs == 0 && dev.band_rows == 0 &&
+		                   geometry_layout(dev.device, scene.spheres.size(), geometry_row);
+
+		if (image_reads)
+		{
+			options += " -D RT_IMAGE_READS";
+
+			if (geometry_row != 0)
+				options += " -D RT_IMAGE_2D -D kGeometryRow=" + std::to_string(geometry_row) + "U";
+		}
+
+		// splat resolves the footprints with the 64-bit atom_min of the extended atomics where the
+		// device has them and their order doesn't matter, instead of testing every footprint in
+		// every work-group
+		dev.splat_atomic = scene.mode == accel_mode::splat && scene.splat_any_order && dev.band_rows == 0 &&
+		                   dev.device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_int64_extended_atomics") != std::string::npos;
+
+		if (dev.splat_atomic)
+		{
+			options += " -D RT_SPLAT_ATOMIC";
+		}
+
+		build.options = options;
+		build.subgroups = subgroups;
+		build.packed_half = packed_half;
+		build.image_reads = image_reads;
+		build.geometry_row = geometry_row;
+		build.cpu_span = cpu_span;
+		return true;
+	}
+
+	// options with the fast math flags if fast and the ones of the kernel report if dev has it
+	std::string variant_options(render_device const& dev, std::string options, bool fast)
+	{
+		if (fast)
+			options += kFastMathOptions;
+
+		if (dev.kernel_report)
+			options += kernel_report_options(dev.device);
+
+		return options;
+	}
+}
+
+void prefetch_programs(render_device& dev, std::string const& src, render_scene const& scene, bool use_cache)
+{
+	open_device(dev, src, use_cache);
+
+	// the settings are settled again by init_device, which tells what changes
+	render_device probe = dev;
+	std::ostream discard(nullptr);
+	kernel_build build;
+
+	if (!plan_kernels(probe, scene, discard, build))
+		return;
+
+	std::string verdict;
+	auto known = dev.fast_math_verdicts.find(build.options);
+
+	if (!dev.fast_math)
+	{
+		dev.variants->prefetch(variant_options(dev, build.options, false));
+	}
+	else if (known != dev.fast_math_verdicts.end())
+	{
+		dev.variants->prefetch(variant_options(dev, build.options, known->second));
+	}
+	else if (find_tuning(dev.tuning, fast_math_setting(dev, build.options), verdict))
+	{
+		dev.variants->prefetch(variant_options(dev, build.options, verdict == "1"));
+	}
+	else
+	{
+		// validate_fast_math renders a frame of each, the strict one first
+		dev.variants->prefetch(variant_options(dev, build.options, false));
+		dev.variants->prefetch(variant_options(dev, build.options, true));
+	}
+}
+
+bool init_device(render_device& dev, std::string const& src, render_scene& scene, bool use_cache, bool tune, std::string const& scene_key)
+{
+	cl_int err = 0;
+	kernel_build build;
+
+	if (!plan_kernels(dev, scene, std::cout, build))
+		return false;
+
+	auto const& view = scene.view;
+	auto max_alloc = dev.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+	std::string options = build.options;
+	bool subgroups = build.subgroups;
+	bool packed_half = build.packed_half;
+
+	// with fast_math the verdict of the first frames decides between the builds, unless an
+	// earlier run stored one
+	if (dev.fast_math && dev.fast_math_verdicts.count(options) == 0)
+	{
+		std::string verdict;
+
+		// the key of the stored settings comes with the context
+		open_device(dev, src, use_cache);
+
+		if (!find_tuning(dev.tuning, fast_math_setting(dev, options), verdict))
+		{
+			// the fast build compiles while the strict one renders
+			dev.variants->prefetch(variant_options(dev, options, false));
+			dev.variants->prefetch(variant_options(dev, options, true));
+			return validate_fast_math(dev, src, scene, use_cache, tune, scene_key, options);
+		}
+
+		dev.fast_math_verdicts[options] = verdict == "1";
+		std::cout << dev.name << ": " << (verdict == "1" ? "using" : "not using") << " fast math, as validated before\n";
+	}
+
+	dev.fast = dev.fast_math && dev.fast_math_verdicts[options];
+	options = variant_options(dev, options, dev.fast);
+
+	auto build_start = std::chrono::high_resolution_clock::now();
+
+	profile_push("build");
+
+	open_device(dev, src, use_cache);
+
+	dev.program = dev.variants->get(options, &err);
+	dev.program_options = options;
+
+	profile_pop();
+
+	dev.build_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	if (dev.kernel_report && dev.reported_builds.insert(options).second)
+	{
+		std::cout << dev.name << ": kernels of the build with" << (options.empty() ? " no options" : options) << "\n";
+		print_kernel_report(dev.program, dev.device);
+	}
+
+	// the brute force kernel shares sphere blocks across sub-groups if the device has them, or
+	// stages spheres in local memory if the device has real local memory for a batch, otherwise
+	// keeps them in constant memory if they fit there
+	char const* brute_force = "trace";
+
+	std::size_t local_batch_size = 4 * sizeof(float) * kLocalBatch;
+	std::size_t geometry_size = 4 * sizeof(float) * scene.spheres.size();
+
+	if (subgroups)
+	{
+		brute_force = "trace_subgroup";
+	}
+	else if (dev.device.getInfo<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL && dev.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() >= local_batch_size)
+	{
+		// the prefetched batch takes a second buffer
+		bool double_buffered = dev.async_prefetch && dev.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() >= 2 * local_batch_size;
+		brute_force = double_buffered ? "trace_local_async" : "trace_local";
+	}
+	else if (dev.device.getInfo<CL_DEVICE_MAX_CONSTANT_ARGS>() >= 4 && dev.device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>() >= geometry_size)
+	{
+		brute_force = "trace_constant";
+	}
+
+	// the batch in local memory may cap the work-groups a compute unit holds more than it saves
+	std::string pruned;
+
+	if ((std::strcmp(brute_force, "trace_local") == 0 || std::strcmp(brute_force, "trace_local_async") == 0) && prune_variant(dev, brute_force, "trace", pruned))
+	{
+		std::cout << dev.name << ": " << brute_force << " pruned, " << pruned << ", using trace\n";
+		brute_force = "trace";
+	}
+
+	// the halves stand in for the spheres in the hot loop
+	if (!scene.halves.empty())
+	{
+		brute_force = packed_half ? "trace_half2" : "trace_half";
+	}
+
+	if (dev.persistent)
+	{
+		brute_force = "trace_persistent";
+	}
+
+	// only trace writes the channels of the brute force kernels
+	if (dev.aovs != 0)
+	{
+		brute_force = "trace";
+		dev.persistent = false;
+		dev.chunk_spheres = 0;
+	}
+
+	// stream the spheres in chunks if the brute force buffers would not fit: one array larger than an
+	// allocation, or the scene taking more than half the memory. Chunks are sized so the slots of
+	// all chunks in flight take at most a quarter of it.
+	auto global_mem = dev.device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+	cl_ulong sphere_bytes = 7 * sizeof(float);
+
+	if (scene.mode != accel_mode::none)
+	{
+		dev.chunk_spheres = 0;
+	}
+	else if (dev.chunk_spheres == 0 && dev.aovs == 0 && dev.band_rows == 0 && (3 * sizeof(float) * cl_ulong(scene.spheres.size()) > max_alloc || sphere_bytes * scene.spheres.size() > global_mem / 2))
+	{
+		auto fit = std::min<cl_ulong>(max_alloc / (3 * sizeof(float)), global_mem / 4 / (kStreamSlots * sphere_bytes));
+		dev.chunk_spheres = static_cast<std::uint32_t>(std::max<cl_ulong>(fit, 1U));
+	}
+
+	if (dev.chunk_spheres != 0)
+	{
+		brute_force = "trace_chunk";
+	}
+
+	// the pipeline's queues hold the rays of whole scenes on the device, the stages write no channels
+	bool wavefront_mode = scene.mode == accel_mode::none || scene.mode == accel_mode::bvh || scene.mode == accel_mode::sorted;
+	bool wavefront = dev.wavefront && wavefront_mode && !scene.instances && dev.chunk_spheres == 0 && dev.aovs == 0 && dev.band_rows == 0;
+
+	if (dev.wavefront && !wavefront)
+	{
+		std::cout << dev.name << ": the wavefront pipeline traces brute force, bvh and sorted scenes without streaming, channels or bands, using one kernel\n";
+	}
+
+	// the grid kernel stages each cell's sphere list in local memory if the work-groups can
+	// be whole cells: one cell per kGroupTileSize x kGroupTileSize group and no partial groups
+	char const* grid_kernel = "trace_grid";
+
+	std::size_t cell_batch_size = 5 * sizeof(float) * kLocalBatch;
+	bool whole_cells = scene.grid.cell_size == kGroupTileSize && view.image_width % kGroupTileSize == 0 && view.image_height % kGroupTileSize == 0;
+
+	if (whole_cells && dev.device.getInfo<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL && dev.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() >= cell_batch_size)
+	{
+		grid_kernel = "trace_grid_local";
+	}
+
+	char const* kernel_name = brute_force;
+
+	switch (scene.mode)
+	{
+	case accel_mode::bvh: kernel_name = scene.instances ? "trace_instanced" : "trace_bvh"; break;
+	// the kernels trace every pixel of the adaptive mode's grid
+	case accel_mode::grid:
+	case accel_mode::adaptive: kernel_name = grid_kernel; break;
+	case accel_mode::splat: kernel_name = dev.splat_atomic ? "splat_atomic" : "splat"; break;
+	case accel_mode::sorted: kernel_name = "trace_sorted"; break;
+	default: break;
+	}
+
+	if (wavefront)
+	{
+		kernel_name = scene.mode == accel_mode::bvh ? "wave_intersect_bvh" : scene.mode == accel_mode::sorted ? "wave_intersect_sorted" : "wave_intersect";
+	}
+
+	std::cout << dev.name << ": using kernel " << kernel_name << "\n";
+
+	dev.kernel = cl::Kernel(dev.program, kernel_name, &err);
+
+	// splat skips spheres per work-group and trace_local and trace_local_async share a sphere
+	// batch per work-group, so give them square tiles; trace_grid_local requires them
+	dev.tiled = std::strcmp(kernel_name, "splat") == 0 || std::strcmp(kernel_name, "trace_local") == 0 || std::strcmp(kernel_name, "trace_local_async") == 0 ||
+	            std::strcmp(kernel_name, "trace_grid_local") == 0;
+	dev.persistent = std::strcmp(kernel_name, "trace_persistent") == 0;
+	dev.coarse = work_group{ 1, 1 };
+	dev.waves.active = false;
+
+	// times, work-group and geometry image of the previous program don't carry over
+	release_geometry(dev);
+	dev.kernel_time = dev.transfer_time = 0.0;
+	dev.upload_time = 0.0;
+	dev.group = work_group{ 0, 0 };
+
+	auto svm = dev.svm && !scene.file && dev.chunk_spheres == 0 ? svm_capabilities(dev.device) : svm_support::none;
+
+	if (dev.svm && !scene.file && dev.chunk_spheres == 0 && svm == svm_support::none)
+	{
+		std::cout << dev.name << ": no shared virtual memory, uploading the scene\n";
+	}
+
+	// the arrays of the other kind are released, a switch between them uploads everything
+	if (svm == svm_support::none)
+		dev.svm_arrays.clear();
+	else
+		dev.buffers.clear();
+
+	// the sphere arrays of an instanced scene are those of its clusters, with radius for radius2
+	bool keep_spheres = !scene_key.empty() && scene_key == dev.scene_key && dev.chunk_spheres == 0 && !scene.instances && scene_arrays(dev) >= 5;
+
+	// the arrays after the spheres too, if they hold this build of the structure for this kernel
+	std::string structure_key = std::to_string(scene.builds) + " " + accel_mode_name(scene.mode) + " " + kernel_name + " " + options;
+	bool keep_structure = keep_spheres && structure_key == dev.structure_key;
+	std::size_t kept = keep_structure ? scene_arrays(dev) : keep_spheres ? 5 : 0;
+
+	dev.buffers.resize(std::min(dev.buffers.size(), kept));
+	dev.svm_arrays.resize(std::min(dev.svm_arrays.size(), kept));
+	dev.scene_key = dev.chunk_spheres == 0 && !scene.instances ? scene_key : std::string();
+	dev.structure_key = dev.scene_key.empty() ? std::string() : structure_key;
+
+	std::vector<cl::Event> uploads;
+	double svm_time = 0.0;
+	// the largest scene array that doesn't fit one allocation, 0 if all do
+	std::size_t oversized = 0;
+
+	profile_push("upload");
+
+	//init buffers
+	auto make_buffer = [&](void const* data, std::size_t size)
+	{
+		if (size > max_alloc)
+			oversized = std::max(oversized, size);
+
+		dev.buffers.push_back(create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, size, nullptr, &err, "scene array"));
+		uploads.emplace_back();
+		err = dev.queue.enqueueWriteBuffer(dev.buffers.back(), CL_FALSE, 0, size, data, nullptr, &uploads.back());
+		return dev.buffers.back();
+	};
+
+	// scene array index of the kernel: a buffer with an upload, or with svm a block of shared
+	// virtual memory the host writes and the kernel reads in place
+	auto set_array = [&](cl_uint index, void const* data, std::size_t size)
+	{
+		if (keep_structure)
+		{
+			err = set_scene_arg(dev, dev.kernel, index);
+			return;
+		}
+
+		if (svm == svm_support::none)
+		{
+			err = dev.kernel.setArg(index, make_buffer(data, size));
+			return;
+		}
+
+		auto write_start = std::chrono::high_resolution_clock::now();
+
+		dev.svm_arrays.push_back(std::make_shared<svm_block>(dev.context, size, svm == svm_support::fine));
+		err = dev.svm_arrays.back()->write(dev.queue, 0, data, size);
+		err = err == CL_SUCCESS ? clSetKernelArgSVMPointer(dev.kernel(), index, dev.svm_arrays.back()->data()) : err;
+
+		svm_time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - write_start).count();
+	};
+
+	// one buffer per sphere array, the kernel streams cx/cy/cz/radius2 and reads color only for the hit sphere.
+	// Arrays of a mapped scene file are used in place, the driver reads them without a staging copy.
+	auto make_sphere_buffer = [&](scene_array a, std::vector<float>& data)
+	{
+		if (!scene.file)
+			return make_buffer(data.data(), sizeof(float) * data.size());
+
+		if (scene.file->array_bytes(a) > max_alloc)
+			oversized = std::max(oversized, scene.file->array_bytes(a));
+
+		dev.buffers.push_back(create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, scene.file->array_bytes(a),
+		                                    const_cast<float*>(scene.file->array(a)), &err, "scene file array"));
+		return dev.buffers.back();
+	};
+
+	// every device gets a full size image, it writes its band at the band's global offset, or
+	// with band_rows a buffer of one band per band in flight.
+	// Host allocated memory is zero-copy on integrated GPUs and pinned for DMA on discrete ones.
+	cl_mem_flags out_flags = CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY | (dev.map_readback ? CL_MEM_ALLOC_HOST_PTR : 0);
+	std::uint32_t out_rows = dev.band_rows != 0 ? std::min(dev.band_rows, view.image_height) : view.image_height;
+	std::size_t out_size = pixel_size(dev.format) * view.image_width * out_rows;
+
+	if (dev.out_buf() == nullptr || dev.out_buf.getInfo<CL_MEM_SIZE>() != out_size)
+	{
+		auto old_out = dev.out_buf;
+		auto spare = std::find_if(dev.spare_outputs.begin(), dev.spare_outputs.end(), [&](cl::Buffer const& buf)
+		{
+			return buf.getInfo<CL_MEM_SIZE>() == out_size;
+		});
+
+		if (spare != dev.spare_outputs.end())
+		{
+			dev.out_buf = *spare;
+			dev.spare_outputs.erase(spare);
+		}
+		else
+		{
+			dev.out_buf = create_buffer(dev.context, out_flags, out_size, nullptr, &err, "framebuffer");
+
+			if (err != CL_SUCCESS)
+			{
+				std::cout << dev.name << ": can't allocate the framebuffer of " << out_size << " bytes (" << err << ")\n";
+				dev.out_buf = old_out;
+				profile_pop();
+				return false;
+			}
+		}
+
+		if (old_out() != nullptr)
+		{
+			dev.spare_outputs.push_back(old_out);
+		}
+
+		// the longest unused size goes first
+		if (dev.spare_outputs.size() > kSpareOutputs)
+		{
+			dev.spare_outputs.erase(dev.spare_outputs.begin());
+		}
+	}
+
+	dev.band_outputs.clear();
+
+	if (dev.band_rows != 0)
+	{
+		dev.band_outputs.push_back(dev.out_buf);
+
+		while (dev.band_outputs.size() < kBandOutputs)
+		{
+			dev.band_outputs.push_back(create_buffer(dev.context, out_flags, out_size, nullptr, &err, "band framebuffer"));
+
+			if (err != CL_SUCCESS)
+			{
+				std::cout << dev.name << ": can't allocate the band buffers of " << out_size << " bytes (" << err << ")\n";
+				profile_pop();
+				return false;
+			}
+		}
+
+		if (dev.band_queue() == nullptr)
+			dev.band_queue = cl::CommandQueue(dev.context, dev.device, CL_QUEUE_PROFILING_ENABLE, &err);
+	}
+
+	// the tile queues are kept for the next scene, the first one is the device's queue
+	dev.num_queues = std::min(std::max(dev.num_queues, 1U), kMaxTileQueues);
+
+	if (dev.queues.empty())
+		dev.queues.push_back(dev.queue);
+
+	while (dev.queues.size() < dev.num_queues)
+	{
+		dev.queues.push_back(cl::CommandQueue(dev.context, dev.device, CL_QUEUE_PROFILING_ENABLE, &err));
+	}
+
+	// the pyramid is built from the colors of the whole image in out_buf
+	if (dev.mip_levels > 1 && (is_id_format(dev.format) || dev.band_rows != 0))
+	{
+		std::cout << dev.name << ": MIP levels are built from color frames of the whole image only, writing none\n";
+		dev.mip_levels = 0;
+	}
+
+	// it has levels down to one pixel per work-group tile, each at least one pixel in size
+	dev.mip_levels = std::min(dev.mip_levels, kMaxMipLevels);
+
+	while (dev.mip_levels > 1 && (mip_size(view.image_width, dev.mip_levels - 1) == 0 || mip_size(view.image_height, dev.mip_levels - 1) == 0))
+	{
+		--dev.mip_levels;
+	}
+
+	if (dev.mip_levels > 1)
+	{
+		std::size_t mip_pixels = 0;
+
+		for (std::uint32_t level = 1; level < dev.mip_levels; ++level)
+		{
+			mip_pixels += std::size_t(mip_size(view.image_width, level)) * mip_size(view.image_height, level);
+		}
+
+		std::size_t mip_bytes = pixel_size(dev.format) * mip_pixels;
+
+		if (dev.mip_buf() == nullptr || dev.mip_buf.getInfo<CL_MEM_SIZE>() != mip_bytes)
+			dev.mip_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, mip_bytes, nullptr, &err, "mip levels");
+
+		dev.mip_kernel = cl::Kernel(dev.program, "build_mips", &err);
+		err = dev.mip_kernel.setArg(1, dev.mip_levels);
+		err = dev.mip_kernel.setArg(2, dev.mip_buf);
+	}
+
+	// the rows are compressed from the rgba8 pixels of the whole image in out_buf
+	if (dev.encode_codec != device_codec::none && (dev.format != pixel_format::rgba8 || dev.band_rows != 0))
+	{
+		std::cout << dev.name << ": frames are encoded on the device from rgba8 images of the whole image only, reading them back\n";
+		dev.encode_codec = device_codec::none;
+	}
+
+	if (dev.encode_codec != device_codec::none)
+	{
+		bool png = dev.encode_codec == device_codec::png;
+
+		// at worst a QOI pixel takes an rgb chunk of 4 bytes, a PNG byte a 9-bit literal, with the
+		// block headers, the padding and the chunk around them
+		std::size_t row_bytes = 1 + 3 * std::size_t(view.image_width);
+		dev.encode_slot = static_cast<std::uint32_t>(png ? (row_bytes + row_bytes / 8 + 32 + 3) / 4 * 4 : 4 * std::size_t(view.image_width));
+
+		std::size_t rows_bytes = std::size_t(dev.encode_slot) * view.image_height;
+		std::size_t words = sizeof(cl_uint) * view.image_height;
+
+		if (dev.encode_rows() == nullptr || dev.encode_rows.getInfo<CL_MEM_SIZE>() != rows_bytes)
+		{
+			dev.encode_rows = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, rows_bytes, nullptr, &err, "encoded rows");
+			dev.encode_packed = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, rows_bytes, nullptr, &err, "encoded frame");
+		}
+
+		if (dev.encode_sizes() == nullptr || dev.encode_sizes.getInfo<CL_MEM_SIZE>() != words)
+		{
+			dev.encode_sizes = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, words, nullptr, &err, "encoded row sizes");
+			dev.encode_adlers = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, words, nullptr, &err, "encoded row adlers");
+			dev.encode_row_offsets = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, words, nullptr, &err, "encoded row offsets");
+		}
+
+		if (dev.encode_totals() == nullptr)
+			dev.encode_totals = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, 2 * sizeof(cl_uint), nullptr, &err, "encoded totals");
+
+		dev.encode_kernel = cl::Kernel(dev.program, png ? "encode_png_rows" : "encode_qoi_rows", &err);
+		err = dev.encode_kernel.setArg(1, dev.encode_slot);
+		err = dev.encode_kernel.setArg(2, dev.encode_rows);
+		err = dev.encode_kernel.setArg(3, dev.encode_sizes);
+
+		if (png)
+			err = dev.encode_kernel.setArg(4, dev.encode_adlers);
+
+		dev.encode_offsets = cl::Kernel(dev.program, "encode_offsets", &err);
+		err = dev.encode_offsets.setArg(0, dev.encode_sizes);
+		err = dev.encode_offsets.setArg(1, dev.encode_adlers);
+		err = dev.encode_offsets.setArg(2, cl_uint(png ? 1 : 0));
+		err = dev.encode_offsets.setArg(3, dev.encode_row_offsets);
+		err = dev.encode_offsets.setArg(4, dev.encode_totals);
+
+		dev.encode_pack = cl::Kernel(dev.program, "pack_encoded", &err);
+		err = dev.encode_pack.setArg(0, dev.encode_rows);
+		err = dev.encode_pack.setArg(1, dev.encode_slot);
+		err = dev.encode_pack.setArg(2, dev.encode_sizes);
+		err = dev.encode_pack.setArg(3, dev.encode_row_offsets);
+		err = dev.encode_pack.setArg(4, dev.encode_packed);
+	}
+
+	// the statistics reduce the ids of the frame, left on the device by all kernels but the
+	// streaming one with the id formats and by the channel kernels otherwise
+	if (dev.stats && (dev.chunk_spheres != 0 || (!is_id_format(dev.format) && (dev.aovs & aov_id) == 0)))
+	{
+		std::cout << dev.name << ": no sphere ids stay on the device, not reducing frame statistics\n";
+		dev.stats = false;
+	}
+
+	if (dev.chunk_spheres != 0)
+	{
+		init_stream(dev, scene);
+		return true;
+	}
+
+	std::size_t aov_size = sizeof(float) * aov_floats(dev.aovs) * view.image_width * view.image_height;
+
+	if (aov_size != 0 && (dev.aov_buf() == nullptr || dev.aov_buf.getInfo<CL_MEM_SIZE>() != aov_size))
+	{
+		dev.aov_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, aov_size, nullptr, &err, "channels");
+	}
+
+	if (dev.stats)
+	{
+		init_stats(dev, scene);
+	}
+
+	if (keep_spheres)
+	{
+		for (cl_uint a = 0; a < 5; ++a)
+		{
+			err = set_scene_arg(dev, dev.kernel, a);
+		}
+	}
+	else if (scene.instances)
+	{
+		auto const& clusters = scene.instances->spheres;
+		set_array(0, clusters.cx.data(), sizeof(float) * clusters.cx.size());
+		set_array(1, clusters.cy.data(), sizeof(float) * clusters.cy.size());
+		set_array(2, clusters.cz.data(), sizeof(float) * clusters.cz.size());
+		set_array(3, clusters.radius.data(), sizeof(float) * clusters.radius.size());
+		set_array(4, clusters.color.data(), sizeof(float) * clusters.color.size());
+	}
+	else if (svm != svm_support::none)
+	{
+		set_array(0, scene.spheres.cx.data(), sizeof(float) * scene.spheres.cx.size());
+		set_array(1, scene.spheres.cy.data(), sizeof(float) * scene.spheres.cy.size());
+		set_array(2, scene.spheres.cz.data(), sizeof(float) * scene.spheres.cz.size());
+		set_array(3, scene.spheres.radius2.data(), sizeof(float) * scene.spheres.radius2.size());
+		set_array(4, scene.spheres.color.data(), sizeof(float) * scene.spheres.color.size());
+	}
+	else if (scene.file)
+	{
+		err = dev.kernel.setArg(0, make_sphere_buffer(scene_array::cx, scene.spheres.cx));
+		err = dev.kernel.setArg(1, make_sphere_buffer(scene_array::cy, scene.spheres.cy));
+		err = dev.kernel.setArg(2, make_sphere_buffer(scene_array::cz, scene.spheres.cz));
+		err = dev.kernel.setArg(3, make_sphere_buffer(scene_array::radius2, scene.spheres.radius2));
+		err = dev.kernel.setArg(4, make_sphere_buffer(scene_array::color, scene.spheres.color));
+	}
+	else
+	{
+		// the arrays are staged back to back into one block and uploaded with a single write, each
+		// one starts at an offset a sub-buffer may have (CL_DEVICE_MEM_BASE_ADDR_ALIGN is in bits)
+		std::vector<float> const* arrays[5] = { &scene.spheres.cx, &scene.spheres.cy, &scene.spheres.cz, &scene.spheres.radius2, &scene.spheres.color };
+
+		std::size_t align = std::max<std::size_t>(dev.device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8, kArenaAlignment);
+		std::size_t offsets[6] = { 0 };
+
+		for (auto a = 0; a < 5; ++a)
+		{
+			offsets[a + 1] = (offsets[a] + sizeof(float) * arrays[a]->size() + align - 1) / align * align;
+		}
+
+		dev.staging.reset();
+		auto* block = static_cast<unsigned char*>(dev.staging.allocate(offsets[5]));
+
+		for (auto a = 0; a < 5; ++a)
+		{
+			std::memcpy(block + offsets[a], arrays[a]->data(), sizeof(float) * arrays[a]->size());
+		}
+
+		cl::Buffer spheres_buf = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, offsets[5], nullptr, &err, "spheres");
+		uploads.emplace_back();
+		err = dev.queue.enqueueWriteBuffer(spheres_buf, CL_FALSE, 0, offsets[5], block, nullptr, &uploads.back());
+
+		for (cl_uint a = 0; a < 5; ++a)
+		{
+			cl_buffer_region region = { offsets[a], sizeof(float) * arrays[a]->size() };
+			dev.buffers.push_back(spheres_buf.createSubBuffer(CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &region, &err));
+			err = dev.kernel.setArg(a, dev.buffers.back());
+		}
+	}
+
+	// the argument the kernel writes its pixels to, render_bands points it at each band's buffer
+	auto set_output = [&](cl_uint index)
+	{
+		dev.out_arg = index;
+		err = dev.kernel.setArg(index, dev.out_buf);
+	};
+
+	if (dev.splat_atomic)
+	{
+		std::size_t depth_size = sizeof(cl_ulong) * view.image_width * view.image_height;
+
+		if (dev.depth_buf() == nullptr || dev.depth_buf.getInfo<CL_MEM_SIZE>() != depth_size)
+			dev.depth_buf = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, depth_size, nullptr, &err, "splat depth");
+
+		// the band rows are set by enqueue_splat
+		dev.splat_spheres = static_cast<std::uint32_t>(scene.spheres.size());
+		set_array(5, scene.footprints.data(), sizeof(pixel_rect) * scene.footprints.size());
+		err = dev.kernel.setArg(8, dev.depth_buf);
+
+		dev.resolve_kernel = cl::Kernel(dev.program, "resolve_splat", &err);
+		err = set_scene_arg(dev, dev.resolve_kernel, 4);
+		err = dev.resolve_kernel.setArg(1, dev.depth_buf);
+		err = dev.resolve_kernel.setArg(2, dev.out_buf);
+	}
+	else if (scene.mode == accel_mode::splat)
+	{
+		set_array(5, scene.footprints.data(), sizeof(pixel_rect) * scene.footprints.size());
+		set_output(6);
+	}
+	else if (scene.mode == accel_mode::grid || scene.mode == accel_mode::adaptive)
+	{
+		auto& grid = scene.grid;
+		set_array(5, grid.cell_start.data(), sizeof(std::uint32_t) * grid.cell_start.size());
+		set_array(6, grid.indices.data(), sizeof(std::uint32_t) * grid.indices.size());
+		err = dev.kernel.setArg(7, grid.cell_size);
+		err = dev.kernel.setArg(8, grid.cells_x);
+		set_output(9);
+	}
+	else if (scene.mode == accel_mode::bvh && scene.instances)
+	{
+		auto const& set = *scene.instances;
+		set_array(5, set.cluster_bvh.nodes.data(), sizeof(bvh_node) * set.cluster_bvh.nodes.size());
+		set_array(6, set.cluster_bvh.indices.data(), sizeof(std::uint32_t) * set.cluster_bvh.indices.size());
+		set_array(7, set.instances.data(), sizeof(sphere_instance) * set.instances.size());
+		set_array(8, set.top.nodes.data(), sizeof(bvh_node) * set.top.nodes.size());
+		set_array(9, set.top.indices.data(), sizeof(std::uint32_t) * set.top.indices.size());
+		set_output(10);
+	}
+	else if (scene.mode == accel_mode::bvh)
+	{
+		auto& accel = scene.accel;
+
+		if (!scene.compressed_nodes.empty())
+			set_array(5, scene.compressed_nodes.data(), sizeof(compressed_bvh_node) * scene.compressed_nodes.size());
+		else
+			set_array(5, accel.nodes.data(), sizeof(bvh_node) * accel.nodes.size());
+
+		set_array(6, accel.indices.data(), sizeof(std::uint32_t) * accel.indices.size());
+		set_output(7);
+
+		if (dev.aovs != 0)
+			err = dev.kernel.setArg(8, dev.aov_buf);
+	}
+	else if (scene.mode == accel_mode::sorted)
+	{
+		auto& order = scene.order;
+		set_array(5, order.indices.data(), sizeof(std::uint32_t) * order.indices.size());
+		set_array(6, order.zmin.data(), sizeof(float) * order.zmin.size());
+		set_output(7);
+
+		if (dev.aovs != 0)
+			err = dev.kernel.setArg(8, dev.aov_buf);
+	}
+	else if (std::strcmp(kernel_name, "trace_half") == 0 || std::strcmp(kernel_name, "trace_half2") == 0)
+	{
+		set_array(5, scene.halves.data(), sizeof(half_sphere) * scene.halves.size());
+		set_output(6);
+	}
+	else if (dev.persistent)
+	{
+		// the band rows are set and the counter is reset by enqueue_band
+		dev.tile_counter = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint), nullptr, &err, "tile counter");
+		dev.persistent_groups = dev.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * kPersistentGroupsPerUnit;
+
+		err = dev.kernel.setArg(5, dev.tile_counter);
+		set_output(8);
+	}
+	else
+	{
+		set_output(5);
+
+		if (dev.aovs != 0)
+			err = dev.kernel.setArg(6, dev.aov_buf);
+	}
+
+	if (wavefront)
+	{
+		init_wavefront(dev, scene);
+	}
+
+	if (dev.aa_grid > 1)
+	{
+		init_antialias(dev, scene);
+	}
+
+	if (dev.bounces > 0)
+	{
+		init_bounces(dev, scene);
+	}
+
+	err = dev.queue.finish();
+
+	profile_pop();
+
+	// the kernels read every array through one pointer, only brute force streams the spheres
+	// in chunks that fit
+	if (oversized != 0)
+	{
+		std::cout << dev.name << ": a scene array of " << oversized << " bytes is larger than one allocation of " << max_alloc << " bytes\n";
+		dev.scene_key.clear();
+		dev.structure_key.clear();
+		return false;
+	}
+
+	for (auto const& upload : uploads)
+	{
+		dev.upload_time += profile(upload).run;
+		record_command(dev, "upload", upload, upload);
+	}
+
+	// the host writes into shared virtual memory are the upload of an svm scene
+	dev.upload_time += svm_time;
+
+	// bands are whole blocks of kGroupTileSize rows, so are the tuning launches
+	std::uint32_t tuning_rows = view.image_height - view.image_height % kGroupTileSize;
+
+	// a band buffer holds no more rows than a band
+	if (dev.band_rows != 0)
+		tuning_rows = std::min(tuning_rows, dev.band_rows);
+
+	// the blocks of coarsen and the row spans of CPU devices replace one pixel per work-item of
+	// the brute force kernels reading the whole scene, without channels; bands place their
+	// pixels by the launch's offset
+	bool coarse = scene.mode == accel_mode::none && scene.halves.empty() && !dev.persistent && dev.chunk_spheres == 0 && dev.aovs == 0 &&
+	              dev.band_rows == 0 && !wavefront;
+
+	if (coarse && build.cpu_span != 0)
+	{
+		if (dev.coarsen)
+			std::cout << dev.name << ": row spans replace the pixel blocks on CPU devices\n";
+
+		err = use_block_kernel(dev, "trace_span", work_group{ build.cpu_span, 1 });
+		std::cout << dev.name << ": using kernel trace_span of " << build.cpu_span << " pixels\n";
+	}
+	else if (dev.coarsen && !coarse)
+	{
+		std::cout << dev.name << ": pixel blocks are traced by brute force without half spheres, persistent work-groups, streaming, channels, "
+		             "bands or the wavefront pipeline, using one pixel per work-item\n";
+	}
+	else if (dev.coarsen)
+	{
+		choose_coarsening(dev, kernel_name, tune, tuning_rows);
+	}
+
+	// the image reads replace the buffer loads of the same kernels if they kept one pixel per
+	// work-item
+	if (dev.image_reads && !(build.image_reads && coarse && dev.coarse.x == 1 && dev.coarse.y == 1))
+	{
+		std::cout << dev.name << ": the geometry image is read by brute force with one pixel per work-item, without half spheres, persistent "
+		             "work-groups, streaming, channels, bands or the wavefront pipeline, on devices with images, reading buffers\n";
+	}
+	else if (dev.image_reads)
+	{
+		choose_image_reads(dev, scene, kernel_name, tune, tuning_rows, build.geometry_row);
+	}
+
+	// the work-items of the launches, one per block of coarse pixels
+	auto tuning_columns = (view.image_width + dev.coarse.x - 1) / dev.coarse.x;
+
+	if (tune && dev.splat_atomic)
+	{
+		std::cout << dev.name << ": splat_atomic runs one work-item per sphere, not tuned\n";
+	}
+	else if (tune && dev.persistent)
+	{
+		std::cout << dev.name << ": trace_persistent runs with fixed " << kGroupTileSize << "x" << kGroupTileSize << " work-groups, not tuned\n";
+	}
+	else if (tune && dev.waves.active)
+	{
+		std::cout << dev.name << ": the wavefront kernels run with fixed work-groups of " << kWaveGroup << ", not tuned\n";
+	}
+	else if (tune && tuning_rows > 0)
+	{
+		std::cout << dev.name << ": tuning the work-group size of " << dev.kernel.getInfo<CL_KERNEL_FUNCTION_NAME>() << "\n";
+
+		tune_work_group(dev.kernel, dev.device, dev.tuning, tuning_columns, kGroupTileSize / dev.coarse.y, [&](work_group group)
+		{
+			cl::Event event;
+			err = dev.queue.enqueueNDRangeKernel(dev.kernel, cl::NullRange, cl::NDRange(tuning_columns, tuning_rows / dev.coarse.y), cl::NDRange(group.x, group.y),
+			                                     nullptr, &event);
+			err = event.wait();
+			return profile(event).run;
+		}, dev.group);
+	}
+	else if (!dev.persistent && !dev.waves.active && !dev.splat_atomic)
+	{
+		load_work_group(dev.kernel, dev.device, dev.tuning, tuning_columns, kGroupTileSize / dev.coarse.y, dev.group);
+	}
+
+	if (dev.group.x != 0)
+	{
+		std::cout << dev.name << ": using tuned work-groups of " << dev.group.x << "x" << dev.group.y << "\n";
+	}
+
+	return true;
+}
+
+std::size_t scene_arrays(render_device const& dev)
+{
+	return dev.svm_arrays.empty() ? dev.buffers.size() : dev.svm_arrays.size();
+}
+
+void take_arrays(render_device& dev, device_arrays& arrays)
+{
+	arrays.buffers = std::move(dev.buffers);
+	arrays.svm_arrays = std::move(dev.svm_arrays);
+	arrays.scene_key = std::move(dev.scene_key);
+	arrays.structure_key = std::move(dev.structure_key);
+
+	dev.buffers.clear();
+	dev.svm_arrays.clear();
+	dev.scene_key.clear();
+	dev.structure_key.clear();
+}
+
+void restore_arrays(render_device& dev, device_arrays&& arrays)
+{
+	dev.buffers = std::move(arrays.buffers);
+	dev.svm_arrays = std::move(arrays.svm_arrays);
+	dev.scene_key = std::move(arrays.scene_key);
+	dev.structure_key = std::move(arrays.structure_key);
+}
+
+std::size_t arrays_bytes(device_arrays const& arrays)
+{
+	std::size_t bytes = 0;
+
+	for (auto const& buffer : arrays.buffers)
+	{
+		bytes += buffer.getInfo<CL_MEM_SIZE>();
+	}
+
+	for (auto const& block : arrays.svm_arrays)
+	{
+		bytes += block->size();
+	}
+
+	return bytes;
+}
+
+cl_int set_scene_arg(render_device const& dev, cl::Kernel& kernel, cl_uint a)
+{
+	if (dev.svm_arrays.empty())
+		return kernel.setArg(a, dev.buffers[a]);
+
+	return clSetKernelArgSVMPointer(kernel(), a, dev.svm_arrays[a]->data());
+}
+
+namespace
+{
+	// Write size bytes of data at offset into scene array a of dev
+	cl_int write_scene_array(render_device& dev, std::size_t a, std::size_t offset, void const* data, std::size_t size)
+	{
+		if (dev.svm_arrays.empty())
+			return dev.queue.enqueueWriteBuffer(dev.buffers[a], CL_FALSE, offset, size, data);
+
+		return dev.svm_arrays[a]->write(dev.queue, offset, data, size);
+	}
+}
+
+cl_int write_spheres(render_device& dev, sphere_soa const& spheres, std::size_t first, std::size_t count)
+{
+	std::vector<float> const* arrays[5] = { &spheres.cx, &spheres.cy, &spheres.cz, &spheres.radius2, &spheres.color };
+
+	cl_int err = CL_SUCCESS;
+
+	for (auto a = 0; a < 5 && err == CL_SUCCESS; ++a)
+	{
+		std::size_t floats = a == 4 ? 3 : 1;
+		err = write_scene_array(dev, a, sizeof(float) * floats * first, arrays[a]->data() + floats * first, sizeof(float) * floats * count);
+	}
+
+	// trace_image reads the geometry from its own copy
+	if (err == CL_SUCCESS && (dev.geometry_image() != nullptr || dev.geometry_rows() != nullptr))
+	{
+		float const* geometry[4] = { spheres.cx.data(), spheres.cy.data(), spheres.cz.data(), spheres.radius2.data() };
+		err = write_geometry(dev, geometry, first, count);
+	}
+
+	return err;
+}
+
+cl_int write_refit(render_device& dev, render_scene const& scene, std::vector<std::int32_t> const& nodes, std::vector<sphere_range> const& ranges)
+{
+	cl_int err = CL_SUCCESS;
+
+	if (scene_arrays(dev) < 6 || scene.instances)
+		return err;
+
+	if (scene.mode == accel_mode::bvh && !scene.compressed_nodes.empty() && !nodes.empty())
+	{
+		err = write_scene_array(dev, 5, 0, scene.compressed_nodes.data(), sizeof(compressed_bvh_node) * scene.compressed_nodes.size());
+	}
+	else if (scene.mode == accel_mode::bvh && scene.compressed_nodes.empty())
+	{
+		for (std::size_t begin = 0, end = 0; begin < nodes.size() && err == CL_SUCCESS; begin = end)
+		{
+			end = begin + 1;
+
+			while (end < nodes.size() && nodes[end] == nodes[end - 1] + 1)
+				++end;
+
+			err = write_scene_array(dev, 5, sizeof(bvh_node) * nodes[begin], &scene.accel.nodes[nodes[begin]], sizeof(bvh_node) * (end - begin));
+		}
+	}
+	else if (scene.mode == accel_mode::splat)
+	{
+		for (std::size_t r = 0; r < ranges.size() && err == CL_SUCCESS; ++r)
+		{
+			err = write_scene_array(dev, 5, sizeof(pixel_rect) * ranges[r].first, &scene.footprints[ranges[r].first], sizeof(pixel_rect) * ranges[r].count);
+		}
+	}
+
+	return err;
+}
+
+void partition_rows(std::vector<render_device>& devices)
+{
+	std::vector<double> speed(devices.size());
+	double total_speed = 0.0;
+
+	// measured and guessed speeds don't mix, use the guess for all until every device was timed
+	bool measured = std::all_of(devices.begin(), devices.end(), [](render_device const& dev)
+	{
+		return dev.kernel_time > 0.0 && dev.row_end > dev.row_begin;
+	});
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto const& dev = devices[d];
+		speed[d] = measured ? (dev.row_end - dev.row_begin) / dev.kernel_time : dev.speed_guess;
+		total_speed += speed[d];
+	}
+
+	auto const image_height = devices[0].view.image_height;
+	auto const num_blocks = static_cast<std::int64_t>((image_height + kGroupTileSize - 1) / kGroupTileSize);
+	auto const num_devices = static_cast<std::int64_t>(devices.size());
+	std::int64_t block = 0;
+	double accumulated = 0.0;
+
+	for (std::int64_t d = 0; d < num_devices; ++d)
+	{
+		accumulated += speed[d];
+
+		auto end_block = static_cast<std::int64_t>(num_blocks * accumulated / total_speed + 0.5);
+
+		// every device keeps at least one block so it is timed again next frame,
+		// the last one takes whatever is left so rounding never drops rows
+		end_block = std::max(end_block, block + 1);
+		end_block = std::min(end_block, num_blocks - (num_devices - d - 1));
+		end_block = d + 1 == num_devices ? num_blocks : std::max(end_block, block);
+
+		devices[d].row_begin = static_cast<std::uint32_t>(block) * kGroupTileSize;
+		devices[d].row_end = std::min(static_cast<std::uint32_t>(end_block) * kGroupTileSize, image_height);
+		block = end_block;
+	}
+}
+
+cl_int enqueue_kernel(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* kernel_event)
+{
+	auto rows = row_end - row_begin;
+	auto width = dev.view.image_width;
+
+	if (dev.persistent)
+	{
+		// no more groups than tiles, each one loops until the counter passes the last tile
+		auto tiles = ((width + kGroupTileSize - 1) / kGroupTileSize) * ((rows + kGroupTileSize - 1) / kGroupTileSize);
+		auto groups = std::min(dev.persistent_groups, tiles);
+
+		cl_int err = dev.queue.enqueueFillBuffer(dev.tile_counter, 0U, 0, sizeof(cl_uint));
+		err = dev.kernel.setArg(6, row_begin);
+		err = dev.kernel.setArg(7, row_end);
+		return dev.queue.enqueueNDRangeKernel(dev.kernel, cl::NullRange, cl::NDRange(groups * kGroupTileSize, kGroupTileSize),
+		                                      cl::NDRange(kGroupTileSize, kGroupTileSize), nullptr, kernel_event);
+	}
+
+	if (dev.chunk_spheres != 0)
+		return enqueue_chunks(dev, row_begin, row_end, kernel_event);
+
+	if (dev.waves.active)
+		return enqueue_wavefront(dev, row_begin, row_end, kernel_event);
+
+	if (dev.splat_atomic)
+		return enqueue_splat(dev, row_begin, row_end, kernel_event);
+
+	// size the launches from the last band once it has run; nothing waits on it, a band still
+	// in flight keeps the old size
+	if (dev.timed_last() != nullptr && dev.timed_last.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE)
+	{
+		auto const time = profile(dev.timed_first, dev.timed_last).run;
+
+		if (time > 0.0)
+		{
+			auto const fitting = static_cast<std::uint32_t>(std::min(dev.timed_rows * kMaxLaunchTime / time, 1e9));
+			dev.launch_rows = std::max(fitting / kGroupTileSize * kGroupTileSize, kGroupTileSize);
+		}
+
+		dev.timed_last = cl::Event();
+	}
+
+	// back to back launches of at most launch_rows rows, the queue runs them without a gap
+	auto const launch_rows = dev.launch_rows != 0 ? dev.launch_rows : kFirstLaunchRows;
+	cl::Event launch;
+	cl_int err = CL_SUCCESS;
+
+	for (auto begin = row_begin; begin < row_end && err == CL_SUCCESS; begin += launch_rows)
+	{
+		auto const launch_end = std::min(begin + launch_rows, row_end);
+
+		err = enqueue_pixels(dev, dev.queue, begin, launch_end, nullptr, &launch);
+
+		if (begin == row_begin)
+			dev.first_kernel = launch;
+	}
+
+	if (err != CL_SUCCESS)
+		return err;
+
+	dev.timed_first = dev.first_kernel;
+	dev.timed_last = launch;
+	dev.timed_rows = rows;
+
+	if (dev.aa_grid > 1)
+	{
+		err = enqueue_antialias(dev, row_begin, row_end, &launch);
+	}
+
+	if (dev.bounces > 0 && err == CL_SUCCESS)
+	{
+		err = enqueue_bounces(dev, row_begin, row_end, &launch);
+	}
+
+	if (kernel_event != nullptr)
+		*kernel_event = launch;
+
+	return err;
+}
+
+cl_int enqueue_band(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, unsigned char* img, cl::Event* kernel_event)
+{
+	auto rows = row_end - row_begin;
+
+	auto width = dev.view.image_width;
+
+	std::size_t band_offset = pixel_size(dev.format) * width * row_begin;
+	std::size_t band_size = pixel_size(dev.format) * width * rows;
+
+	// bands of an image larger than one allocation take turns in band_outputs, each read
+	// behind its kernel on the in-order queue before the buffer is traced into again
+	if (dev.band_rows != 0)
+	{
+		cl::Event launch;
+		cl_int err = CL_SUCCESS;
+
+		dev.band_reads.clear();
+
+		for (auto begin = row_begin, b = 0U; begin < row_end && err == CL_SUCCESS; begin += dev.band_rows, ++b)
+		{
+			auto end = std::min(begin + dev.band_rows, row_end);
+			auto const& output = dev.band_outputs[b % dev.band_outputs.size()];
+
+			err = dev.kernel.setArg(dev.out_arg, output);
+			err = enqueue_pixels(dev, dev.queue, begin, end, nullptr, &launch);
+
+			if (begin == row_begin)
+				dev.first_kernel = launch;
+
+			dev.band_reads.emplace_back();
+			err = dev.queue.enqueueReadBuffer(output, CL_FALSE, 0, pixel_size(dev.format) * width * (end - begin), img + pixel_size(dev.format) * width * begin,
+			                                  nullptr, &dev.band_reads.back());
+		}
+
+		dev.transfer_event = dev.band_reads.back();
+
+		if (kernel_event != nullptr)
+			*kernel_event = launch;
+
+		return err;
+	}
+
+	cl_int err = enqueue_kernel(dev, row_begin, row_end, kernel_event);
+
+	if (err != CL_SUCCESS)
+		return err;
+
+	if (dev.map_readback)
+	{
+		dev.mapped = static_cast<unsigned char*>(dev.queue.enqueueMapBuffer(dev.out_buf, CL_FALSE, CL_MAP_READ, band_offset, band_size, nullptr, &dev.transfer_event, &err));
+		return err;
+	}
+
+	return dev.queue.enqueueReadBuffer(dev.out_buf, CL_FALSE, band_offset, band_size, img + band_offset, nullptr, &dev.transfer_event);
+}
+
+double finish_band(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, unsigned char* img)
+{
+	dev.transfer_profile = profile(dev.transfer_event);
+	double time = dev.transfer_profile.run;
+
+	// the reads of the bands of the image add up, the first ones ran between the kernels
+	if (dev.band_rows != 0)
+	{
+		time = 0.0;
+
+		for (auto const& read : dev.band_reads)
+		{
+			time += profile(read).run;
+			record_command(dev, "read", read, read);
+		}
+
+		dev.band_reads.clear();
+		return time;
+	}
+
+	record_command(dev, dev.mapped ? "map" : "read", dev.transfer_event, dev.transfer_event);
+
+	if (dev.mapped)
+	{
+		auto copy_start = std::chrono::high_resolution_clock::now();
+
+		std::size_t band_offset = pixel_size(dev.format) * dev.view.image_width * row_begin;
+		std::size_t band_size = pixel_size(dev.format) * dev.view.image_width * (row_end - row_begin);
+
+		std::memcpy(img + band_offset, dev.mapped, band_size);
+		dev.queue.enqueueUnmapMemObject(dev.out_buf, dev.mapped);
+		dev.mapped = nullptr;
+
+		time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - copy_start).count();
+	}
+
+	return time;
+}
+
+void render_frame(std::vector<render_device>& devices, std::vector<unsigned char>& img)
+{
+	render_frame(devices, &img[0]);
+}
+
+void render_frame(std::vector<render_device>& devices, unsigned char* img)
+{
+	std::vector<cl::Event> kernel_events(devices.size());
+
+	cl_int err = 0;
+
+	// the bands are copied within the shared context, read back whole images only
+	auto& first = devices[0];
+	bool gathering = first.gather && std::all_of(devices.begin(), devices.end(), [&](render_device const& dev)
+	{
+		return dev.context() == first.context() && dev.band_rows == 0 && !dev.map_readback && !tiles_queued(dev);
+	});
+
+	profile_push("trace");
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto& dev = devices[d];
+
+		if (dev.row_end == dev.row_begin)
+			continue;
+
+		if (gathering)
+		{
+			err = enqueue_kernel(dev, dev.row_begin, dev.row_end, &kernel_events[d]);
+			err = dev.queue.flush();
+			continue;
+		}
+
+		if (tiles_queued(dev))
+		{
+			err = enqueue_tiles(dev, img, &kernel_events[d]);
+			continue;
+		}
+
+		err = enqueue_band(dev, dev.row_begin, dev.row_end, img, &kernel_events[d]);
+		err = dev.queue.flush();
+	}
+
+	// the copies run on the queue of the first device, each behind the kernels of its band,
+	// and the one read behind all of them
+	if (gathering)
+	{
+		auto row_bytes = pixel_size(first.format) * first.view.image_width;
+
+		for (std::size_t d = 1; d < devices.size(); ++d)
+		{
+			auto& dev = devices[d];
+
+			if (dev.row_end == dev.row_begin)
+				continue;
+
+			std::vector<cl::Event> traced(1, kernel_events[d]);
+			std::size_t band_offset = row_bytes * dev.row_begin;
+
+			err = first.queue.enqueueCopyBuffer(dev.out_buf, first.out_buf, band_offset, band_offset, row_bytes * (dev.row_end - dev.row_begin), &traced,
+			                                    &dev.transfer_event);
+		}
+
+		err = first.queue.enqueueReadBuffer(first.out_buf, CL_FALSE, 0, row_bytes * first.view.image_height, img, nullptr, &first.transfer_event);
+		err = first.queue.flush();
+	}
+
+	// the reads are queued behind the kernels, waiting for a queue waits for both; the first
+	// device holds the gathered image even without a band of its own
+	for (auto& dev : devices)
+	{
+		if (dev.row_end == dev.row_begin && !(gathering && &dev == &first))
+			continue;
+
+		if (tiles_queued(dev))
+		{
+			for (auto& queue : dev.queues)
+			{
+				err = queue.finish();
+			}
+		}
+		else
+		{
+			err = dev.queue.finish();
+		}
+	}
+
+	profile_pop();
+
+	profile_range readback("readback");
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto& dev = devices[d];
+
+		if (dev.row_end == dev.row_begin)
+			continue;
+
+		auto const& first_kernel = dev.persistent ? kernel_events[d] : dev.first_kernel;
+
+		dev.kernel_profile = profile(first_kernel, kernel_events[d]);
+		dev.kernel_time = dev.kernel_profile.run;
+
+		// the copies ran on the clock of the first device
+		if (gathering && d != 0)
+		{
+			record_command(dev, "trace", first_kernel, kernel_events[d]);
+			record_command(first, "gather", dev.transfer_event, dev.transfer_event);
+			dev.transfer_profile = profile(dev.transfer_event);
+			dev.transfer_time = dev.transfer_profile.run;
+			continue;
+		}
+
+		if (!tiles_queued(dev))
+		{
+			record_command(dev, "trace", first_kernel, kernel_events[d]);
+			dev.transfer_time = finish_band(dev, dev.row_begin, dev.row_end, img);
+			continue;
+		}
+
+		// the reads overlap the kernels, the transfer time is the part of the last one after them
+		auto q = static_cast<std::uint32_t>(dev.queues.size());
+
+		for (std::size_t t = 0; t < dev.tile_kernels.size(); ++t)
+		{
+			record_command(dev, static_cast<std::uint32_t>(t % q), "trace", dev.tile_kernels[t]);
+			record_command(dev, static_cast<std::uint32_t>(t % q), "read", dev.tile_reads[t]);
+		}
+
+		dev.transfer_profile = profile(dev.tile_reads.back());
+		dev.transfer_time = dev.transfer_profile.run;
+	}
+}
+
+cl_int enqueue_batch(render_device& dev, sphere_soa const& batch)
+{
+	cl_int err = CL_SUCCESS;
+
+	if (dev.row_end == dev.row_begin)
+		return CL_SUCCESS;
+
+	float const* arrays[5] = { batch.cx.data(), batch.cy.data(), batch.cz.data(), batch.radius2.data(), batch.color.data() };
+
+	// the batch continues the scene at stream_size, the kernels carry the hits across batches
+	// as they do across the chunks of a whole scene
+	for (std::uint32_t first = 0; first < batch.size(); first += dev.chunk_spheres)
+	{
+		auto count = std::min(dev.chunk_spheres, batch.size() - first);
+		float const* chunk_arrays[5];
+
+		for (auto a = 0; a < 5; ++a)
+		{
+			chunk_arrays[a] = arrays[a] + (a == 4 ? 3 : 1) * std::size_t(first);
+		}
+
+		err = enqueue_chunk(dev, dev.slots[dev.stream_chunks % kStreamSlots], chunk_arrays, dev.stream_size + first, count, dev.row_begin, dev.row_end);
+
+		if (err != CL_SUCCESS)
+			return err;
+
+		++dev.stream_chunks;
+	}
+
+	dev.stream_size += batch.size();
+
+	err = dev.queue.flush();
+	return dev.upload_queue.finish();
+}
+
+bool tiles_queued(render_device const& dev)
+{
+	return dev.queues.size() > 1 && !dev.persistent && dev.chunk_spheres == 0 && !dev.waves.active && !dev.splat_atomic && !dev.map_readback &&
+	       dev.band_rows == 0 && dev.aa_grid < 2 && dev.bounces == 0;
+}
+
+bool render_bands(render_device& dev, tiled_image_writer& writer)
+{
+	// A band whose read is queued: its rows and the host buffer the read writes into
+	struct band
+	{
+		std::uint32_t row_begin, row_end;
+		std::vector<unsigned char> pixels;
+		cl::Event kernel, read;
+	};
+
+	auto width = dev.view.image_width;
+	auto height = dev.view.image_height;
+	auto stride = pixel_size(dev.format);
+
+	std::vector<band> pending;
+	cl_int err = CL_SUCCESS;
+
+	dev.kernel_time = dev.transfer_time = 0.0;
+	dev.row_begin = 0;
+	dev.row_end = height;
+
+	// wait for the oldest band, profile it and hand it to the writer, which frees its buffer
+	auto retire = [&]
+	{
+		auto& done = pending.front();
+		err = done.read.wait();
+
+		dev.kernel_profile = profile(done.kernel);
+		dev.transfer_profile = profile(done.read);
+		dev.kernel_time += dev.kernel_profile.run;
+		dev.transfer_time += dev.transfer_profile.run;
+		record_command(dev, "trace", done.kernel, done.kernel);
+		record_command(dev, "read", done.read, done.read);
+
+		writer.write_band(done.row_begin, done.row_end, std::move(done.pixels), stride);
+		pending.erase(pending.begin());
+	};
+
+	profile_range range("trace");
+
+	// b counts the bands rendered, which take turns in the band buffers
+	for (std::uint32_t row_begin = 0, b = 0; row_begin < height && err == CL_SUCCESS; row_begin += dev.band_rows)
+	{
+		// bands restored from a checkpoint are in the file already
+		if (writer.band_done(row_begin))
+			continue;
+
+		// the band before in the same buffer has to be read first
+		if (pending.size() == dev.band_outputs.size())
+			retire();
+
+		band next;
+		next.row_begin = row_begin;
+		next.row_end = std::min(row_begin + dev.band_rows, height);
+
+		auto rows = next.row_end - next.row_begin;
+		auto const& output = dev.band_outputs[b++ % dev.band_outputs.size()];
+
+		next.pixels = writer.take_buffer();
+		next.pixels.resize(stride * width * rows);
+
+		err = dev.kernel.setArg(dev.out_arg, output);
+		err = enqueue_pixels(dev, dev.queue, row_begin, next.row_end, nullptr, &next.kernel);
+		err = dev.queue.flush();
+
+		std::vector<cl::Event> traced(1, next.kernel);
+		err = dev.band_queue.enqueueReadBuffer(output, CL_FALSE, 0, next.pixels.size(), &next.pixels[0], &traced, &next.read);
+		err = dev.band_queue.flush();
+
+		pending.push_back(std::move(next));
+	}
+
+	while (!pending.empty() && err == CL_SUCCESS)
+		retire();
+
+	// after a failure reads may still be writing into the buffers of pending
+	if (err != CL_SUCCESS)
+		dev.band_queue.finish();
+
+	return err == CL_SUCCESS;
+}
+
+bool read_aovs(std::vector<render_device>& devices, std::vector<float>& planes)
+{
+	if (devices.empty() || devices[0].aovs == 0)
+		return true;
+
+	auto const& view = devices[0].view;
+	std::size_t plane_pixels = std::size_t(view.image_width) * view.image_height;
+
+	planes.resize(aov_floats(devices[0].aovs) * plane_pixels);
+
+	profile_range range("readback");
+	cl_int err = CL_SUCCESS;
+
+	for (auto& dev : devices)
+	{
+		if (dev.row_end == dev.row_begin)
+			continue;
+
+		std::size_t offset = 0;
+
+		// the band's rows of every plane, the normals take three floats per pixel and the costs two
+		for (auto channel : { aov_depth, aov_id, aov_normal, aov_cost })
+		{
+			if ((dev.aovs & channel) == 0)
+				continue;
+
+			std::size_t floats = aov_channel_floats(channel);
+			std::size_t band_offset = offset + floats * view.image_width * dev.row_begin;
+			std::size_t band_size = floats * view.image_width * (dev.row_end - dev.row_begin);
+
+			err = dev.queue.enqueueReadBuffer(dev.aov_buf, CL_FALSE, sizeof(float) * band_offset, sizeof(float) * band_size, &planes[band_offset]);
+
+			if (err != CL_SUCCESS)
+				return false;
+
+			offset += floats * plane_pixels;
+		}
+
+		err = dev.queue.flush();
+	}
+
+	bool ok = true;
+
+	for (auto& dev : devices)
+	{
+		ok = dev.queue.finish() == CL_SUCCESS && ok;
+	}
+
+	return ok;
+}
+
+bool reduce_frame_stats(std::vector<render_device>& devices, frame_stats& stats)
+{
+	profile_range range("stats");
+	cl_int err = CL_SUCCESS;
+
+	// the hit counts and group results of every device, read back next to each other
+	std::vector<std::vector<cl_uint>> hits(devices.size());
+	std::vector<std::vector<cl_uint>> groups(devices.size());
+	std::vector<cl::Event> kernels(devices.size());
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto& dev = devices[d];
+
+		if (!dev.stats || dev.row_end == dev.row_begin)
+			continue;
+
+		auto width = dev.view.image_width;
+		auto count = width * (dev.row_end - dev.row_begin);
+		auto num_groups = (count + kStatsGroup * kStatsPixels - 1) / (kStatsGroup * kStatsPixels);
+
+		// the id channel follows the depth plane if there is one
+		cl_uint first = width * dev.row_begin;
+
+		if (!is_id_format(dev.format) && (dev.aovs & aov_depth) != 0)
+			first += width * dev.view.image_height;
+
+		err = dev.svm_arrays.empty() ? dev.stats_kernel.setArg(0, dev.buffers[4]) : clSetKernelArgSVMPointer(dev.stats_kernel(), 0, dev.svm_arrays[4]->data());
+		err = dev.stats_kernel.setArg(1, is_id_format(dev.format) ? dev.out_buf : dev.aov_buf);
+		err = dev.stats_kernel.setArg(2, first);
+		err = dev.stats_kernel.setArg(3, count);
+		err = dev.stats_kernel.setArg(4, dev.stats_spheres);
+		err = dev.stats_kernel.setArg(5, dev.stats_hits);
+		err = dev.stats_kernel.setArg(6, dev.stats_groups);
+
+		hits[d].resize(dev.stats_spheres);
+		groups[d].resize(kStatsWords * num_groups);
+
+		if (!hits[d].empty())
+			err = dev.queue.enqueueFillBuffer(dev.stats_hits, cl_uint(0), 0, sizeof(cl_uint) * hits[d].size());
+
+		err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.stats_kernel, cl::NullRange, cl::NDRange(num_groups * kStatsGroup), cl::NDRange(kStatsGroup), nullptr, &kernels[d]) : err;
+
+		if (err == CL_SUCCESS && !hits[d].empty())
+			err = dev.queue.enqueueReadBuffer(dev.stats_hits, CL_FALSE, 0, sizeof(cl_uint) * hits[d].size(), &hits[d][0]);
+
+		err = err == CL_SUCCESS ? dev.queue.enqueueReadBuffer(dev.stats_groups, CL_FALSE, 0, sizeof(cl_uint) * groups[d].size(), &groups[d][0]) : err;
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		err = dev.queue.flush();
+	}
+
+	bool ok = true;
+
+	for (auto& dev : devices)
+	{
+		ok = dev.queue.finish() == CL_SUCCESS && ok;
+	}
+
+	cl_uint min_keys[3] = { 0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU };
+	cl_uint max_keys[3] = { 0U, 0U, 0U };
+	double sums[3] = { 0.0, 0.0, 0.0 };
+	double covered = 0.0;
+	double pixels = 0.0;
+	bool reduced = false;
+
+	stats.hits.clear();
+	stats.time = 0.0;
+
+	for (std::size_t d = 0; d < devices.size() && ok; ++d)
+	{
+		if (kernels[d]() == nullptr)
+			continue;
+
+		auto const& dev = devices[d];
+
+		stats.hits.resize(std::max(stats.hits.size(), hits[d].size()), 0U);
+
+		for (std::size_t k = 0; k < hits[d].size(); ++k)
+		{
+			stats.hits[k] += hits[d][k];
+		}
+
+		for (std::size_t g = 0; g < groups[d].size(); g += kStatsWords)
+		{
+			for (auto ch = 0; ch < 3; ++ch)
+			{
+				float sum;
+				std::memcpy(&sum, &groups[d][g + 6 + ch], sizeof(sum));
+
+				min_keys[ch] = std::min(min_keys[ch], groups[d][g + ch]);
+				max_keys[ch] = std::max(max_keys[ch], groups[d][g + 3 + ch]);
+				sums[ch] += sum;
+			}
+
+			covered += groups[d][g + 9];
+		}
+
+		pixels += double(dev.view.image_width) * (dev.row_end - dev.row_begin);
+		stats.time += profile(kernels[d]).run;
+		reduced = true;
+	}
+
+	if (!ok || !reduced)
+		return false;
+
+	for (auto ch = 0; ch < 3; ++ch)
+	{
+		stats.min[ch] = key_float(min_keys[ch]);
+		stats.max[ch] = key_float(max_keys[ch]);
+		stats.mean[ch] = sums[ch] / pixels;
+	}
+
+	stats.coverage = covered / pixels;
+	return true;
+}
+
+std::uint32_t mip_size(std::uint32_t size, std::uint32_t level)
+{
+	return size >> level;
+}
+
+bool read_mip_levels(std::vector<render_device>& devices, std::vector<std::vector<unsigned char>>& levels)
+{
+	if (devices.empty() || devices[0].mip_levels < 2)
+		return true;
+
+	auto const& view = devices[0].view;
+	auto num_levels = devices[0].mip_levels;
+	std::size_t pixel_bytes = pixel_size(devices[0].format);
+
+	// the levels are read into one block in the layout of mip_buf and split up afterwards,
+	// level l starts at offsets[l - 1] and ends at offsets[l]
+	std::vector<std::size_t> offsets(num_levels, 0);
+
+	for (std::uint32_t level = 1; level < num_levels; ++level)
+	{
+		offsets[level] = offsets[level - 1] + pixel_bytes * mip_size(view.image_width, level) * mip_size(view.image_height, level);
+	}
+
+	std::vector<unsigned char> block(offsets.back());
+
+	profile_range range("mip levels");
+	cl_int err = CL_SUCCESS;
+
+	for (auto& dev : devices)
+	{
+		if (dev.row_end == dev.row_begin)
+			continue;
+
+		// the band starts at a multiple of kGroupTileSize rows, the tiles of the launch are its own
+		auto rows = dev.row_end - dev.row_begin;
+		auto global_width = (view.image_width + kGroupTileSize - 1) / kGroupTileSize * kGroupTileSize;
+		auto global_rows = (rows + kGroupTileSize - 1) / kGroupTileSize * kGroupTileSize;
+
+		err = dev.mip_kernel.setArg(0, dev.out_buf);
+		err = dev.queue.enqueueNDRangeKernel(dev.mip_kernel, cl::NDRange(0, dev.row_begin), cl::NDRange(global_width, global_rows), cl::NDRange(kGroupTileSize, kGroupTileSize));
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		if (dev.row_begin == 0 && dev.row_end == view.image_height)
+		{
+			err = dev.queue.enqueueReadBuffer(dev.mip_buf, CL_FALSE, 0, block.size(), &block[0]);
+		}
+		else
+		{
+			// the rows of each level the band reduced to
+			for (std::uint32_t level = 1; level < num_levels && err == CL_SUCCESS; ++level)
+			{
+				std::size_t row_bytes = pixel_bytes * mip_size(view.image_width, level);
+				std::size_t first = mip_size(dev.row_begin, level);
+				std::size_t end = dev.row_end == view.image_height ? mip_size(view.image_height, level) : mip_size(dev.row_end, level);
+
+				if (end > first)
+					err = dev.queue.enqueueReadBuffer(dev.mip_buf, CL_FALSE, offsets[level - 1] + row_bytes * first, row_bytes * (end - first), &block[offsets[level - 1] + row_bytes * first]);
+			}
+		}
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		err = dev.queue.flush();
+	}
+
+	bool ok = true;
+
+	for (auto& dev : devices)
+	{
+		ok = dev.queue.finish() == CL_SUCCESS && ok;
+	}
+
+	levels.resize(num_levels - 1);
+
+	for (std::uint32_t level = 1; level < num_levels; ++level)
+	{
+		levels[level - 1].assign(block.begin() + offsets[level - 1], block.begin() + offsets[level]);
+	}
+
+	return ok;
+}
+
+bool encode_frame(render_device& dev, std::string& out)
+{
+	auto const& view = dev.view;
+
+	if (dev.encode_codec == device_codec::none || dev.row_begin != 0 || dev.row_end != view.image_height || tiles_queued(dev))
+	{
+		std::cout << dev.name << " encodes no frames of the whole image\n";
+		return false;
+	}
+
+	bool png = dev.encode_codec == device_codec::png;
+	cl::Event kernel_event, encoded, packed, read;
+	cl_uint totals[2] = {};
+
+	profile_push("trace");
+	cl_int err = enqueue_kernel(dev, 0, view.image_height, &kernel_event);
+
+	err = err == CL_SUCCESS ? dev.encode_kernel.setArg(0, dev.out_buf) : err;
+	err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.encode_kernel, cl::NullRange, cl::NDRange(view.image_height), cl::NullRange, nullptr, &encoded) : err;
+	err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(dev.encode_offsets, cl::NullRange, cl::NDRange(1), cl::NDRange(1)) : err;
+	err = err == CL_SUCCESS ? dev.queue.enqueueReadBuffer(dev.encode_totals, CL_TRUE, 0, sizeof(totals), totals) : err;
+	profile_pop();
+
+	if (err != CL_SUCCESS)
+	{
+		std::cout << "Can't encode the frame on " << dev.name << "\n";
+		return false;
+	}
+
+	profile_range readback("readback");
+
+	out.clear();
+
+	if (png)
+		put_png_header(view.image_width, view.image_height, 3, out);
+	else
+		put_qoi_header(view.image_width, view.image_height, 3, out);
+
+	// only the packed rows cross to the host
+	auto start = out.size();
+	out.resize(start + totals[0]);
+
+	err = dev.queue.enqueueNDRangeKernel(dev.encode_pack, cl::NullRange, cl::NDRange(kPackGroup, view.image_height), cl::NDRange(kPackGroup, 1), nullptr, &packed);
+	err = err == CL_SUCCESS && totals[0] != 0 ? dev.queue.enqueueReadBuffer(dev.encode_packed, CL_TRUE, 0, totals[0], &out[start], nullptr, &read) : err;
+
+	if (err != CL_SUCCESS)
+	{
+		std::cout << "Can't read the encoded frame from " << dev.name << "\n";
+		return false;
+	}
+
+	if (png)
+		put_png_end(totals[1], out);
+	else
+		put_qoi_end(out);
+
+	auto const& first_kernel = dev.persistent ? kernel_event : dev.first_kernel;
+
+	dev.kernel_profile = profile(first_kernel, kernel_event);
+	dev.kernel_time = dev.kernel_profile.run;
+	record_command(dev, "trace", first_kernel, kernel_event);
+	record_command(dev, "encode", encoded, packed);
+
+	if (read() != nullptr)
+	{
+		dev.transfer_profile = profile(read);
+		dev.transfer_time = dev.transfer_profile.run;
+		record_command(dev, "read", read, read);
+	}
+
+	return true;
+}
+
+view_window make_view_window(ortho_view const& view)
+{
+	return view_window{ view.left, view.bottom, view.width / view.image_width, view.height / view.image_height };
+}
+
+bool render_views(std::vector<render_device>& devices, accel_mode mode, std::vector<view_window> const& windows, std::vector<unsigned char>& img)
+{
+	char const* kernel_name = nullptr;
+
+	switch (mode)
+	{
+	case accel_mode::none: kernel_name = "trace_views"; break;
+	case accel_mode::bvh: kernel_name = "trace_views_bvh"; break;
+	case accel_mode::sorted: kernel_name = "trace_views_sorted"; break;
+	default: break;
+	}
+
+	if (devices.empty() || windows.empty())
+		return true;
+
+	auto const& view = devices[0].view;
+	std::size_t image_size = pixel_size(devices[0].format) * view.image_width * view.image_height;
+
+	img.resize(image_size * windows.size());
+
+	// sphere arrays, then the structure of bvh and sorted, see init_device
+	cl_uint scene_args = mode == accel_mode::none ? 5 : 7;
+
+	std::vector<std::size_t> first(devices.size() + 1);
+	std::vector<cl::Event> kernel_events(devices.size());
+
+	cl_int err = CL_SUCCESS;
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto& dev = devices[d];
+
+		first[d] = windows.size() * d / devices.size();
+		first[d + 1] = windows.size() * (d + 1) / devices.size();
+
+		std::size_t count = first[d + 1] - first[d];
+
+		if (count == 0)
+			continue;
+
+		if (!kernel_name || dev.chunk_spheres != 0 || scene_arrays(dev) < scene_args || image_size * count > dev.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>())
+		{
+			std::cout << dev.name << ": batches of views render brute force, bvh or sorted scenes held on the device, up to one allocation of images\n";
+			return false;
+		}
+
+		cl::Kernel kernel(dev.program, kernel_name, &err);
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		for (cl_uint a = 0; a < scene_args; ++a)
+		{
+			err = set_scene_arg(dev, kernel, a);
+		}
+
+		dev.window_buf = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(view_window) * count, nullptr, &err, "view windows");
+		dev.views_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, image_size * count, nullptr, &err, "view images");
+
+		err = kernel.setArg(scene_args, dev.window_buf);
+		err = kernel.setArg(scene_args + 1, dev.views_buf);
+
+		err = dev.queue.enqueueWriteBuffer(dev.window_buf, CL_FALSE, 0, sizeof(view_window) * count, &windows[first[d]]);
+
+		// the kernels are not tiled, only a tuned work-group carries over, one window deep
+		auto group = dev.group.x != 0 && view.image_width % dev.group.x == 0 && view.image_height % dev.group.y == 0
+		                 ? cl::NDRange(dev.group.x, dev.group.y, 1) : cl::NullRange;
+
+		err = dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(view.image_width, view.image_height, count), group, nullptr, &kernel_events[d]);
+		err = dev.queue.enqueueReadBuffer(dev.views_buf, CL_FALSE, 0, image_size * count, &img[image_size * first[d]], nullptr, &dev.transfer_event);
+		err = dev.queue.flush();
+
+		if (err != CL_SUCCESS)
+			return false;
+	}
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto& dev = devices[d];
+
+		if (first[d + 1] == first[d])
+			continue;
+
+		err = dev.queue.finish();
+
+		dev.kernel_profile = profile(kernel_events[d]);
+		dev.kernel_time = dev.kernel_profile.run;
+		dev.transfer_profile = profile(dev.transfer_event);
+		dev.transfer_time = dev.transfer_profile.run;
+
+		record_command(dev, "trace views", kernel_events[d], kernel_events[d]);
+		record_command(dev, "read", dev.transfer_event, dev.transfer_event);
+	}
+
+	return err == CL_SUCCESS;
+}
+
+bool query_occlusion(render_device& dev, accel_mode mode, std::vector<occlusion_ray> const& queries, std::vector<unsigned char>& hits)
+{
+	char const* kernel_name = "occluded";
+
+	switch (mode)
+	{
+	case accel_mode::bvh: kernel_name = "occluded_bvh"; break;
+	case accel_mode::sorted: kernel_name = "occluded_sorted"; break;
+	default: break;
+	}
+
+	// sphere arrays, then the structure of bvh and sorted, see init_device
+	cl_uint scene_args = mode == accel_mode::bvh || mode == accel_mode::sorted ? 7 : 5;
+
+	if (dev.chunk_spheres != 0 || scene_arrays(dev) < scene_args)
+	{
+		std::cout << dev.name << ": occlusion queries need the scene held on the device\n";
+		return false;
+	}
+
+	hits.assign(queries.size(), 0);
+
+	if (queries.empty())
+		return true;
+
+	cl_int err = CL_SUCCESS;
+	cl::Kernel kernel(dev.program, kernel_name, &err);
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	for (cl_uint a = 0; a < scene_args; ++a)
+	{
+		err = set_scene_arg(dev, kernel, a);
+	}
+
+	cl_uint count = static_cast<cl_uint>(queries.size());
+	cl::Buffer queries_buf = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(occlusion_ray) * queries.size(), nullptr, &err, "occlusion queries");
+	cl::Buffer hits_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, hits.size(), nullptr, &err, "occlusion hits");
+
+	err = kernel.setArg(scene_args, queries_buf);
+	err = kernel.setArg(scene_args + 1, count);
+	err = kernel.setArg(scene_args + 2, hits_buf);
+
+	// whole blocks of 64 work-items, the kernels skip the ones past the last query
+	err = dev.queue.enqueueWriteBuffer(queries_buf, CL_FALSE, 0, sizeof(occlusion_ray) * queries.size(), queries.data());
+	err = dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((queries.size() + 63) / 64 * 64), cl::NullRange);
+	err = dev.queue.enqueueReadBuffer(hits_buf, CL_TRUE, 0, hits.size(), hits.data());
+
+	return err == CL_SUCCESS;
+}
+
+bool query_nearest_hits(render_device& dev, accel_mode mode, std::uint32_t k, std::vector<ray_hit>& hits)
+{
+	bool sorted = mode == accel_mode::sorted;
+
+	// sphere arrays, then the depth order of sorted, see init_device
+	cl_uint scene_args = sorted ? 7 : 5;
+
+	if (!nearest_hits_supported(k))
+	{
+		std::cout << dev.name << ": no tracer keeps " << k << " nearest hits\n";
+		return false;
+	}
+
+	if (dev.chunk_spheres != 0 || scene_arrays(dev) < scene_args)
+	{
+		std::cout << dev.name << ": nearest hits need the scene held on the device\n";
+		return false;
+	}
+
+	auto const& view = dev.view;
+	hits.resize(std::size_t(k) * view.image_width * view.image_height);
+
+	cl_int err = CL_SUCCESS;
+	cl::Kernel kernel(dev.program, ((sorted ? "nearest_hits_sorted_" : "nearest_hits_") + std::to_string(k)).c_str(), &err);
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	for (cl_uint a = 0; a < scene_args; ++a)
+	{
+		err = set_scene_arg(dev, kernel, a);
+	}
+
+	cl::Buffer hits_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(ray_hit) * hits.size(), nullptr, &err, "nearest hits");
+	err = kernel.setArg(scene_args, hits_buf);
+
+	// whole 8x8 blocks, the kernels skip the pixels past the image
+	err = dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((view.image_width + 7) / 8 * 8, (view.image_height + 7) / 8 * 8), cl::NDRange(8, 8));
+	err = dev.queue.enqueueReadBuffer(hits_buf, CL_TRUE, 0, sizeof(ray_hit) * hits.size(), hits.data());
+
+	return err == CL_SUCCESS;
+}
+
+bool query_rays(render_device& dev, render_scene const& scene, ray_batch const& rays, bool sort, float* t, std::int32_t* ids)
+{
+	// the full BVH has a walk for rays in any direction, other scenes test every sphere
+	bool walk = scene.mode == accel_mode::bvh && scene.compressed_nodes.empty();
+	cl_uint scene_args = walk ? 7 : 5;
+
+	if (dev.chunk_spheres != 0 || scene.instances || scene_arrays(dev) < scene_args || rays.count > kMaxBatchRays)
+	{
+		std::cout << dev.name << ": ray queries need the spheres held on the device and at most " << kMaxBatchRays << " rays\n";
+		return false;
+	}
+
+	if (rays.count == 0)
+		return true;
+
+	cl_int err = CL_SUCCESS;
+	cl::Kernel kernel(dev.program, walk ? "query_rays_bvh" : "query_rays", &err);
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	for (cl_uint a = 0; a < scene_args; ++a)
+	{
+		err = set_scene_arg(dev, kernel, a);
+	}
+
+	std::size_t launch = std::min(rays.count, kQueryLaunchRays);
+	float const* columns[7] = { rays.ox, rays.oy, rays.oz, rays.dx, rays.dy, rays.dz, rays.tmax };
+	cl::Buffer column_bufs[7];
+
+	for (cl_uint c = 0; c < 7; ++c)
+	{
+		column_bufs[c] = create_buffer(dev.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(float) * launch, nullptr, &err, "query rays");
+		err = kernel.setArg(scene_args + c, column_bufs[c]);
+	}
+
+	cl::Buffer t_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(float) * launch, nullptr, &err, "query distances");
+	cl::Buffer ids_buf = create_buffer(dev.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(cl_int) * launch, nullptr, &err, "query ids");
+	err = kernel.setArg(scene_args + 9, t_buf);
+	err = kernel.setArg(scene_args + 10, ids_buf);
+
+	// the rays of every launch are sorted in place of the bounce queues, on keys over the
+	// origins of the whole batch; without a sort the kernels take the rays in order
+	cl::Kernel keys_kernel, count_kernel, scan, scatter;
+	cl::Buffer keys[2], values[2];
+
+	if (sort)
+	{
+		auto box = origin_box(rays);
+		std::size_t groups = (launch + kWaveGroup - 1) / kWaveGroup;
+		cl::Buffer histogram = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * 16 * groups, nullptr, &err, "query histogram");
+
+		for (auto b = 0; b < 2; ++b)
+		{
+			keys[b] = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * launch, nullptr, &err, "query keys");
+			values[b] = create_buffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * launch, nullptr, &err, "query order");
+		}
+
+		keys_kernel = cl::Kernel(dev.program, "ray_keys", &err);
+		count_kernel = cl::Kernel(dev.program, "radix_count", &err);
+		scan = cl::Kernel(dev.program, "radix_scan", &err);
+		scatter = cl::Kernel(dev.program, "radix_scatter", &err);
+
+		if (err != CL_SUCCESS)
+			return false;
+
+		for (cl_uint c = 0; c < 6; ++c)
+		{
+			err = keys_kernel.setArg(c, column_bufs[c]);
+		}
+
+		for (cl_uint a = 0; a < 3; ++a)
+		{
+			err = keys_kernel.setArg(7 + a, box.lo[a]);
+			err = keys_kernel.setArg(10 + a, box.scale[a]);
+		}
+
+		err = keys_kernel.setArg(13, keys[0]);
+		err = keys_kernel.setArg(14, values[0]);
+		err = count_kernel.setArg(3, histogram);
+		err = scan.setArg(0, histogram);
+		err = scatter.setArg(6, histogram);
+
+		// an even number of passes leaves the order in values[0]
+		err = kernel.setArg(scene_args + 7, values[0]);
+	}
+	else
+	{
+		err = kernel.setArg(scene_args + 7, sizeof(cl_mem), nullptr);
+	}
+
+	// the writes of a launch queue behind the reads of the one before, which used the buffers
+	for (std::size_t first = 0; first < rays.count && err == CL_SUCCESS; first += launch)
+	{
+		auto count = static_cast<cl_uint>(std::min(launch, rays.count - first));
+		cl::NDRange global((count + kWaveGroup - 1) / kWaveGroup * kWaveGroup);
+
+		for (cl_uint c = 0; c < 7; ++c)
+		{
+			err = dev.queue.enqueueWriteBuffer(column_bufs[c], CL_FALSE, 0, sizeof(float) * count, columns[c] + first);
+		}
+
+		if (sort)
+		{
+			err = keys_kernel.setArg(6, count);
+			err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(keys_kernel, cl::NullRange, global, cl::NullRange) : err;
+			err = err == CL_SUCCESS ? enqueue_radix_sort(dev.queue, count_kernel, scan, scatter, keys, values, 0, count, nullptr, nullptr) : err;
+		}
+
+		err = kernel.setArg(scene_args + 8, count);
+		err = err == CL_SUCCESS ? dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange) : err;
+		err = err == CL_SUCCESS ? dev.queue.enqueueReadBuffer(t_buf, CL_FALSE, 0, sizeof(float) * count, t + first) : err;
+		err = err == CL_SUCCESS ? dev.queue.enqueueReadBuffer(ids_buf, CL_FALSE, 0, sizeof(cl_int) * count, ids + first) : err;
+	}
+
+	cl_int finished = dev.queue.finish();
+	return err == CL_SUCCESS && finished == CL_SUCCESS;
+}
+
+void print_profile(command_time const& kernel, command_time const& readback)
+{
+	auto print = [](char const* stage, command_time const& time)
+	{
+		std::cout << "    " << stage << ": queued " << time.queued << " ms, submitted " << time.submitted << " ms, running " << time.run << " ms\n";
+	};
+
+	print("kernel", kernel);
+	print("readback", readback);
+}
+
+void print_profile(render_device const& dev)
+{
+	print_profile(dev.kernel_profile, dev.transfer_profile);
+
+	// the sort of a bounce pays off if it shortens the intersection by more than it takes,
+	// --unsorted-bounces gives the times to compare against
+	for (std::size_t b = 0; b < dev.bounce_stages.size(); ++b)
+	{
+		auto const& stage = dev.bounce_stages[b];
+		double sort = stage.sort_first() != nullptr ? profile(stage.sort_first, stage.sort_last).run : 0.0;
+		double intersect = profile(stage.intersect).run;
+
+		std::cout << "    bounce " << b + 1 << ": " << stage.rays << " rays, sort " << sort << " ms, intersect " << intersect << " ms";
+
+		if (sort + intersect > 0.0)
+			std::cout << ", sorting " << 100.0 * sort / (sort + intersect) << "% of the bounce";
+
+		std::cout << "\n";
+	}
+}
+
+void print_throughput(render_device const& dev, render_scene const& scene)
+{
+	if (dev.kernel_time <= 0.0 || dev.row_end == dev.row_begin)
+		return;
+
+	double seconds = dev.kernel_time / 1000.0;
+	double rays = static_cast<double>(dev.view.image_width) * (dev.row_end - dev.row_begin);
+	double written = rays * pixel_size(dev.format);
+
+	std::cout << "    throughput: " << rays / seconds / 1e6 << " Mrays/s, pixel writes " << written / seconds / 1e9 << " GB/s\n";
+
+	// the structures test a number of spheres per ray the launch doesn't tell, --aov cost counts them
+	if (scene.mode != accel_mode::none)
+		return;
+
+	double tests = rays * scene.spheres.size();
+	double gflops = tests * kFlopsPerTest / seconds / 1e9;
+	double gbs = (tests * kBytesPerTest + rays * kColorBytesPerRay) / seconds / 1e9;
+	double intensity = kFlopsPerTest / kBytesPerTest;
+
+	std::cout << "    sphere tests: " << tests / seconds / 1e9 << " G/s, " << gflops << " GFLOPS of " << dev.peak_gflops << " peak ("
+	          << 100.0 * gflops / dev.peak_gflops << "%), reads " << gbs << " GB/s";
+
+	if (dev.peak_gbs <= 0.0)
+	{
+		std::cout << ", no bandwidth peak for " << dev.name << " (--peak)\n";
+		return;
+	}
+
+	std::cout << " of " << dev.peak_gbs << " peak (" << 100.0 * gbs / dev.peak_gbs << "%)\n";
+
+	// the ridge point of the roofline: below its flops per byte the bandwidth caps the flops
+	double ridge = dev.peak_gflops / dev.peak_gbs;
+
+	std::cout << "    roofline: " << intensity << " flops/byte against the ridge at " << ridge << ", "
+	          << (intensity < ridge ? "memory bound, read fewer bytes per test" : "compute bound, do fewer flops per test");
+
+	// every work-item reads the same spheres, past the memory peak they come from the caches
+	if (gbs > dev.peak_gbs)
+		std::cout << "; the reads beat the memory peak, the caches serve them";
+
+	std::cout << "\n";
+}
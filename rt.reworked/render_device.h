@@ -0,0 +1,617 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+#include "accel.h"
+#include "arena.h"
+#include "cancel_token.h"
+#include "devices.h"
+#include "pixel_format.h"
+#include "program_cache.h"
+#include "ray_queries.h"
+#include "scene_edits.h"
+#include "svm_block.h"
+#include "tuning_db.h"
+#include "work_group_tuner.h"
+
+// Streaming writer of image_writer.h
+class tiled_image_writer;
+
+// Work-group edge of the kernels that work on square tiles
+std::uint32_t const kGroupTileSize = 16;
+// Bands of render_bands in flight per device, each with its output buffer
+std::size_t const kBandOutputs = 2;
+// Longest a launch of a band should run (ms): well below the 2 s the Windows display driver
+// gives a kernel before it resets the device (TDR), long enough that the launches cost nothing
+double const kMaxLaunchTime = 100.;
+// Rows of the launches of a device until a band of it was timed
+std::uint32_t const kFirstLaunchRows = 256;
+// Most in-order queues a device issues the tiles of its band to (--queues), and tiles of a
+// band per queue
+std::uint32_t const kMaxTileQueues = 4;
+std::uint32_t const kTilesPerQueue = 4;
+// Side of the sample grid of an edge pixel of --aa at most
+std::uint32_t const kMaxAaGrid = 8;
+// Reflection bounces of --bounces at most
+std::uint32_t const kMaxBounces = 4;
+
+// Profile of one command in ms, from the timestamps of its event: waiting in the host queue
+// (QUEUED to SUBMIT), waiting on the device (SUBMIT to START) and running (START to END)
+struct command_time
+{
+	double queued;
+	double submitted;
+	double run;
+};
+
+// Profile of the command of event
+command_time profile(cl::Event const& event);
+
+// Profile of the commands first .. last of one in-order queue: the waits of first and
+// the time from the start of first to the end of last
+command_time profile(cl::Event const& first, cl::Event const& last);
+
+// Device buffers of one chunk of the out-of-core brute force, the arrays of sphere_soa in
+// the order of the trace_chunk arguments
+struct stream_slot
+{
+	cl::Buffer arrays[5];
+	// Upload into the slot and the last kernel reading it, used is valid once in_use is set
+	cl::Event uploaded, used;
+	bool in_use;
+};
+
+// Kernels and queues of the wavefront pipeline of a render_device (--wavefront), the wave_*
+// kernels of trace.cl; the device's kernel is the intersection stage
+struct wavefront_pipeline
+{
+	// Set by init_device if the scene is traced by the pipeline
+	bool active;
+	cl::Kernel generate, count, scan, compact, shade;
+	// One queued_ray of trace.cl per pixel of the image, the hit counts and then the offsets
+	// of their work-groups, the indices of the rays that hit and the number of those
+	cl::Buffer rays, group_counts, shade_queue, shaded;
+	// Argument of the ray queue of the intersection kernel, its count follows
+	cl_uint rays_arg;
+	// With the coverage mask of the scene (render_scene::skip_background) the bands queue
+	// only its covered pixels: generate_covered reads them from the work list pixels, the
+	// ascending indices of the set bits, and background fills the others from the mask in
+	// coverage. row_covered[j] is the number of list entries before row j.
+	bool covered;
+	cl::Kernel generate_covered, background;
+	cl::Buffer pixels, coverage;
+	std::vector<cl_uint> row_covered;
+};
+
+// One bounce of the reflections of --bounces as print_profile reports it: the rays it traced,
+// the first and last command of their sort, none if unsorted, and their intersection kernel
+struct bounce_stage
+{
+	cl_uint rays;
+	cl::Event sort_first, sort_last, intersect;
+};
+
+// Window of one view of a batch, view_window in trace.cl: the ray of pixel (i, j) starts at
+// x = left + step_x * (i + 0.5), y = bottom + step_y * (j + 0.5)
+struct view_window
+{
+	float left, bottom;
+	float step_x, step_y;
+};
+
+// Window of view for its image size, the pixel steps rounded like the CPU tracers round them
+view_window make_view_window(ortho_view const& view);
+
+// Channels the kernels can write next to the color, flags of render_device::aovs. Each one
+// is a plane of the image size in aov_buf, in this order when present: depth of the hit as a
+// float (the far plane for the background), sphere index as a 32-bit int (-1 for the
+// background), the unit normal at the hit as three floats (0, 0, 0 for the background) and
+// the cost of the ray as two 32-bit uints, its sphere tests and BVH node visits (pixel_cost in
+// pixel_cost.h). Only the kernels built for the cost channel count them.
+enum aov_channel : std::uint32_t
+{
+	aov_depth = 1,
+	aov_id = 2,
+	aov_normal = 4,
+	aov_cost = 8
+};
+
+// Name of channel for messages and file names
+char const* aov_channel_name(aov_channel channel);
+
+// Parse a comma separated list of channel names into aovs. Returns false for an unknown name
+// and leaves aovs untouched.
+bool parse_aov_channels(char const* names, std::uint32_t& aovs);
+
+// Floats per pixel of the planes of aovs
+std::size_t aov_floats(std::uint32_t aovs);
+
+// Floats per pixel of the plane of channel
+std::size_t aov_channel_floats(aov_channel channel);
+
+// Files encode_frame compresses the frames of a device into (--device-encode), the QOI and
+// PNG files encode_qoi and encode_png of image_encoders.h write
+enum class device_codec
+{
+	none,
+	qoi,
+	png
+};
+
+// Everything one device needs to render its band of rows: each device has its own
+// context, program, queue and copy of the scene buffers
+struct render_device
+{
+	cl::Device device;
+	std::string name;
+	cl::Context context;
+	// Properties open_device creates the context with, zero terminated, empty for none; set to
+	// share a GL context (gl_preview::context_properties)
+	std::vector<cl_context_properties> context_properties;
+	// Specialized builds of trace.cl for this context, program is the one in use
+	std::shared_ptr<program_variants> variants;
+	// Device, driver and hash of the kernel source the tuned settings of the device are stored
+	// under (tuning_db.h), set by open_device
+	tuning_key tuning;
+	cl::Program program;
+	// Build options of program, which name its binary (program_binary_name)
+	std::string program_options;
+	cl::Kernel kernel;
+	cl::CommandQueue queue;
+	// Scene buffers referenced by the kernel arguments, the sphere arrays first. Uploaded sphere
+	// arrays are sub-buffers of one buffer, written in one go from the block staged in staging.
+	std::vector<cl::Buffer> buffers;
+	frame_arena staging;
+	// With svm set (--svm) the scene arrays go to shared virtual memory instead, on devices that
+	// have it: each array of buffers is written into one block of svm_arrays and the kernels
+	// read it in place, without an upload, and buffers stays empty. Scene files, whose arrays
+	// are already used in place, and streamed spheres keep buffers.
+	bool svm;
+	std::vector<std::shared_ptr<svm_block>> svm_arrays;
+	// With fast_math set (--fast-math) init_device also builds the kernels with
+	// -cl-fast-relaxed-math and native square roots and reciprocals, renders a frame with both
+	// builds and keeps the fast one if no channel is more than fast_math_ulps steps of the pixel
+	// format apart. The verdicts are kept per strict build options and stored in the tuning
+	// database, so each build is checked once per device, driver and kernel source; fast is set
+	// while the fast build is in use.
+	bool fast_math;
+	std::uint32_t fast_math_ulps;
+	std::map<std::string, bool> fast_math_verdicts;
+	bool fast;
+	// With kernel_report set (--kernel-report) the builds take the options that make the
+	// vendor's compiler log its register use, and init_device prints the build log and the
+	// resources and occupancy estimate of every kernel of each build of dev once, the options
+	// of those builds kept in reported_builds (kernel_report.h)
+	bool kernel_report;
+	std::set<std::string> reported_builds;
+	// Scene the sphere arrays of buffers hold, empty if init_device uploads them every time
+	std::string scene_key;
+	// Build, mode, kernel and options the scene arrays after the spheres were uploaded for, the
+	// structure; init_device keeps them too if the next setup of scene_key matches
+	std::string structure_key;
+	cl::Buffer out_buf;
+	// Output buffers of earlier image sizes, a view of one of them takes it back instead of
+	// allocating again; at most kSpareOutputs are kept
+	std::vector<cl::Buffer> spare_outputs;
+	// Layout of out_buf and of the framebuffer it is read into
+	pixel_format format;
+	// Image and view the program was built for
+	ortho_view view;
+	// Kernel runs on square work-groups if the image splits into whole ones
+	bool tiled;
+	// trace_bvh and trace_sorted map their work-items to 8x8 pixel blocks in Morton order
+	// (--swizzle), so a wavefront traces a square block instead of part of a row
+	bool swizzle;
+	// Local size from the work-group tuner, x == 0 if there is none
+	work_group group;
+	// With wavefront set brute force, bvh and sorted scenes are traced by the stages of waves
+	// instead of one kernel per pixel, if the whole scene is on the device and no channels are
+	// written
+	bool wavefront;
+	wavefront_pipeline waves;
+	// Brute force runs trace_persistent: persistent_groups work-groups take tiles from tile_counter
+	bool persistent;
+	std::uint32_t persistent_groups;
+	cl::Buffer tile_counter;
+	// With coarsen set (--coarsen) brute force may run a trace_coarse kernel instead, one
+	// work-item per block of coarse.x x coarse.y pixels that reads each sphere once for the
+	// rays of its block. init_device times the block sizes against the kernel of one pixel per
+	// work-item when tuning and stores the fastest in the tuning database, otherwise takes the
+	// stored one. coarse is 1x1 for the kernels of one pixel per work-item.
+	bool coarsen;
+	work_group coarse;
+	// With image_reads set (--image-reads) brute force of one pixel per work-item may run
+	// trace_image instead, which reads the geometry of the spheres from an image through the
+	// texture cache: geometry_image, an image1d_buffer_t over geometry_texels, or for more
+	// spheres than a buffer image holds geometry_rows, an image2d_t of geometry_row texels a
+	// row. init_device times it against the kernel reading buffers when tuning and stores the
+	// faster in the tuning database, otherwise takes the stored one; both images are null while
+	// buffers are read.
+	bool image_reads;
+	// With async_prefetch set (--async-prefetch) brute force runs trace_local_async in place of
+	// trace_local where the device's local memory holds two sphere batches: the next batch is
+	// copied in with async_work_group_copy while the group tests the current one
+	bool async_prefetch;
+	cl::Image1DBuffer geometry_image;
+	cl::Buffer geometry_texels;
+	cl::Image2D geometry_rows;
+	std::size_t geometry_row;
+	// Brute force streams chunks of chunk_spheres spheres from stream_source through slots and
+	// resolve_kernel writes the hits carried in the state buffers, 0 keeps the whole scene on the device
+	std::uint32_t chunk_spheres;
+	std::uint32_t stream_size;
+	// Set before init_device if the spheres arrive in batches after it (--stream-scene) instead
+	// of with the scene, which is empty then: enqueue_batch runs the chunks of every batch as
+	// it comes, counting them in stream_chunks, and enqueue_chunks only resolves them
+	bool stream_batches;
+	std::uint32_t stream_chunks;
+	float const* stream_source[5];
+	std::vector<stream_slot> slots;
+	cl::CommandQueue upload_queue;
+	cl::Kernel resolve_kernel;
+	cl::Buffer maxt_buf, idx_buf, rgb_buf;
+	// Token of a render that may be cancelled, null otherwise: enqueue_chunks then waits for a
+	// slot on the host before reusing it and stops queueing chunks once cancel is cancelled,
+	// leaving the band unfinished
+	cancel_token const* cancel;
+	// splat runs splat_atomic, one work-item per sphere keeping the closest hits in depth_buf
+	// with 64-bit atomics, and then resolve_kernel writes the pixels; see init_device
+	bool splat_atomic;
+	std::uint32_t splat_spheres;
+	cl::Buffer depth_buf;
+	// First kernel of the last band unless it ran persistent work-groups, the band's kernel time
+	// runs from it to the last one
+	cl::Event first_kernel;
+	// The one kernel per pixel path launches a band in launches of launch_rows rows, queued back
+	// to back, so no launch runs long enough for the driver's watchdog to reset the device;
+	// kFirstLaunchRows until a band was timed. timed_first and timed_last are the first and last
+	// launch of the last band and timed_rows its rows, timed by the next band to size
+	// launch_rows for kMaxLaunchTime.
+	std::uint32_t launch_rows;
+	cl::Event timed_first, timed_last;
+	std::uint32_t timed_rows;
+	// Band of rows [row_begin, row_end) of the current frame
+	std::uint32_t row_begin, row_end;
+	// Read the output back by mapping a CL_MEM_ALLOC_HOST_PTR buffer instead of copying
+	bool map_readback;
+	// With gather set (--gather) on the first of the devices of a frame, which then share its
+	// context (share_context), render_frame copies the bands of the others into the out_buf of
+	// the first behind their kernels, device to device, and reads the image back from it once
+	// instead of a read per band; transfer_event is then the copy of the band of a device
+	bool gather;
+	// Band mapped by enqueue_band, copied into the framebuffer and unmapped by finish_band
+	unsigned char* mapped;
+	// With num_queues above 1 (--queues) render_frame splits the band into tiles of whole
+	// work-group rows and issues them round-robin to queues, queue and num_queues - 1 more
+	// in-order queues: the kernel of a tile waits for the one of the tile before it and the
+	// read of the tile follows it in its queue, so the read of one tile runs while the next one
+	// is traced on devices with a separate copy engine. Only the one kernel per pixel path and
+	// read back bands are split, see tiles_queued. tile_kernels and tile_reads are the
+	// commands of the last band's tiles.
+	std::uint32_t num_queues;
+	std::vector<cl::CommandQueue> queues;
+	std::vector<cl::Event> tile_kernels, tile_reads;
+	// Read or map command of the last band
+	cl::Event transfer_event;
+	// Context and program build (or cache load) and scene upload of the last init_device in ms
+	double build_time;
+	double upload_time;
+	// Profiles of the last band's kernel and read or map command
+	command_time kernel_profile;
+	command_time transfer_profile;
+	// Kernel time of the last frame in ms, 0 before the first frame
+	double kernel_time;
+	// Readback time of the last frame in ms
+	double transfer_time;
+	// Initial rows per ms guess, from compute units and clock
+	double speed_guess;
+	// Peaks of the roofline report, device_entry::peak_gflops and peak_gbs
+	double peak_gflops;
+	double peak_gbs;
+	// Microseconds from the profiling clock of the device to the one of the timeline
+	// (timeline.h), measured by open_device if the timeline is enabled
+	double timeline_offset;
+	// Windows and images of the views of the last render_views batch
+	cl::Buffer window_buf, views_buf;
+	// With band_rows set (--tiled) out_buf holds band_rows rows instead of the image: the kernels
+	// are built with -D RT_BANDED and write the band their launch starts at to the start of the
+	// buffer, see render_bands. band_outputs are the buffers of the bands in flight, out_buf the
+	// first of them, and band_queue reads them back while the next band is traced. Only the one
+	// kernel per pixel launches render bands, without channels, sphere streaming, persistent
+	// work-groups or the wavefront pipeline.
+	// init_device sets band_rows itself, with auto_bands, if the image in the format is larger
+	// than CL_DEVICE_MAX_MEM_ALLOC_SIZE: render_frame then traces the bands of the rows of the
+	// device one by one into band_outputs and reads each into its place, band_reads.
+	std::uint32_t band_rows;
+	bool auto_bands;
+	std::vector<cl::Buffer> band_outputs;
+	std::vector<cl::Event> band_reads;
+	cl::CommandQueue band_queue;
+	// Argument of the kernel taking out_buf
+	cl_uint out_arg;
+	// Channels besides the color written by trace, trace_bvh and trace_sorted into the planes of
+	// aov_buf, 0 for none; each one is a -D RT_AOV_* option of the build, see init_device
+	std::uint32_t aovs;
+	cl::Buffer aov_buf;
+	// With stats set (--stats) reduce_frame_stats runs stats_kernel, image_stats of trace.cl, over
+	// the band of the last frame: the ids it reads are out_buf with the id formats, the id
+	// channel of aov_buf with the others. stats_hits counts the pixels of each of the
+	// stats_spheres spheres, stats_groups holds the partial results of the work-groups.
+	bool stats;
+	std::uint32_t stats_spheres;
+	cl::Kernel stats_kernel;
+	cl::Buffer stats_hits, stats_groups;
+	// With mip_levels above 1 (--mip) read_mip_levels runs mip_kernel, build_mips of trace.cl,
+	// over the band of the last frame in out_buf and reads the smaller levels of its pyramid,
+	// which mip_buf holds one after the other, back; see init_device
+	std::uint32_t mip_levels;
+	cl::Kernel mip_kernel;
+	cl::Buffer mip_buf;
+	// With encode_codec set (--device-encode) encode_frame compresses the rgb of the frame in
+	// out_buf on the device: encode_kernel, encode_qoi_rows or encode_png_rows of trace.cl,
+	// compresses every row into its slot of encode_slot bytes in encode_rows, encode_offsets
+	// places the rows one after the other and encode_pack copies them into encode_packed, the
+	// only pixels read back. Only rgba8 frames of the whole image are encoded; see init_device.
+	device_codec encode_codec;
+	std::uint32_t encode_slot;
+	cl::Kernel encode_kernel, encode_offsets, encode_pack;
+	cl::Buffer encode_rows, encode_sizes, encode_adlers, encode_row_offsets, encode_totals, encode_packed;
+	// With aa_grid above 1 (--aa) the edges of the frame are antialiased: the kernel writes the
+	// id channel too, edge_kernel (find_edges of trace.cl) lists the pixels of the band whose 3x3
+	// neighbourhood holds another sphere in edge_buf, counted in edge_count, and aa_kernel
+	// traces each of them again with aa_grid x aa_grid stratified samples, aa_items work-items
+	// striding through the list. Only the one kernel per pixel paths of brute force, bvh and
+	// sorted color frames antialias, without bands, tile queues or other channels.
+	std::uint32_t aa_grid;
+	std::uint32_t aa_items;
+	cl::Kernel edge_kernel, aa_kernel;
+	cl::Buffer edge_buf, edge_count;
+	// With bounces above 0 (--bounces) the hits reflect: the kernel writes the id channel too,
+	// bounce_generate (trace.cl) queues a reflected ray per hit of the band, and each bounce
+	// sorts its rays on their direction octant and origin with the radix kernels, unless
+	// sort_bounces is cleared, before bounce_intersect traces them and queues the next bounce.
+	// resolve_bounces then writes the colors mixed in bounce_accum by reflectivity. The ray
+	// count of a bounce is read back before its launches. Only the one kernel per pixel paths of
+	// brute force, bvh and sorted color frames reflect, without bands, tile queues, other
+	// channels or --aa. bounce_stages holds the bounces of the last band.
+	std::uint32_t bounces;
+	float reflectivity;
+	bool sort_bounces;
+	cl::Kernel bounce_generate, bounce_intersect, bounce_count, bounce_scan, bounce_scatter, bounce_resolve;
+	cl::Buffer bounce_rays[2], bounce_keys[2], bounce_values[2], bounce_queued[2], bounce_histogram, bounce_accum;
+	std::vector<bounce_stage> bounce_stages;
+};
+
+// Work-group size for rows rows of the image of dev: the tuned one, or square tiles for the
+// tiled kernels, if the rows split into whole ones, otherwise left to the runtime
+cl::NDRange group_size(render_device const& dev, std::uint32_t rows);
+
+// Same for a launch over width columns instead of the whole image width
+cl::NDRange group_size(render_device const& dev, std::uint32_t width, std::uint32_t rows);
+
+// Enqueue dev.kernel on queue over rows [row_begin, row_end) of the image, after the events of
+// wait if not null: one work-item per pixel, or per block of dev.coarse pixels, so row_begin
+// has to be a multiple of the block height
+cl_int enqueue_pixels(render_device const& dev, cl::CommandQueue& queue, std::uint32_t row_begin, std::uint32_t row_end,
+                      std::vector<cl::Event> const* wait, cl::Event* event);
+
+// Reset dev to the device of entry with no frame rendered yet, init_device builds the rest
+void set_device(render_device& dev, device_entry const& entry, pixel_format format, bool map_readback);
+
+// Create one context for the devices of entries into context for --gather, to be set as the
+// context of each before open_device. Returns false if they are on more than one platform,
+// which share no context.
+bool share_context(std::vector<device_entry> const& entries, cl::Context& context);
+
+// Create the context, unless set, queue and program variants of dev unless it has them, the
+// part of init_device that doesn't depend on the scene
+void open_device(render_device& dev, std::string const& src, bool use_cache);
+
+// Build an empty program on the opened dev, so the driver loads its compiler before the first
+// real build needs it
+void warm_up_compiler(render_device const& dev);
+
+// Add the commands first .. last of one in-order queue of dev to the timeline as one range
+// named name, on the device's row, if the timeline is enabled
+void record_command(render_device const& dev, char const* name, cl::Event const& first, cl::Event const& last);
+
+// Same for the command of event on the row of queue q of dev.queues
+void record_command(render_device const& dev, std::uint32_t q, char const* name, cl::Event const& event);
+
+// Exact C literal of value, for -D options
+std::string float_literal(float value);
+
+// -D options that bake the pixel format, image size, sphere count and view of scene into
+// the kernels, the ones trace.cl and trace.hip take in place of their defaults
+std::string scene_defines(render_scene const& scene, pixel_format format);
+
+// Scene arrays of a device put aside with the keys they were uploaded for, see gpu_renderer
+struct device_arrays
+{
+	std::vector<cl::Buffer> buffers;
+	std::vector<std::shared_ptr<svm_block>> svm_arrays;
+	std::string scene_key;
+	std::string structure_key;
+};
+
+// Move the scene arrays of dev and their keys into arrays, dev uploads the next scene afresh
+void take_arrays(render_device& dev, device_arrays& arrays);
+
+// Give dev the scene arrays of arrays back, for init_device to keep
+void restore_arrays(render_device& dev, device_arrays&& arrays);
+
+// Device memory the buffers and blocks of arrays take
+std::size_t arrays_bytes(device_arrays const& arrays);
+
+// Create context, program, kernel and buffers of dev for the scene and pick up the tuned
+// work-group size, or time the candidates first if tune is set. Called again for another
+// scene or view, dev keeps its context, queue and program variants, and its sphere buffers
+// if scene_key is not empty and names the scene they were uploaded for, its structure buffers
+// as well if they hold the same build of it for the same kernel. With dev.fast_math
+// the first call for a build also validates its fast math variant, see render_device.
+// Returns false if the program does not build.
+bool init_device(render_device& dev, std::string const& src, render_scene& scene, bool use_cache, bool tune, std::string const& scene_key = std::string());
+
+// Open dev and start building the programs the next init_device for scene will take on a
+// thread, both builds of a fast math validation; init_device waits for them. Prefetched on
+// every device before the first init_device, the builds of all devices compile at once.
+void prefetch_programs(render_device& dev, std::string const& src, render_scene const& scene, bool use_cache);
+
+// Number of scene arrays on dev, the buffers or svm_arrays that hold them
+std::size_t scene_arrays(render_device const& dev);
+
+// Pass scene array a of dev, a buffer or an SVM block, to argument a of kernel
+cl_int set_scene_arg(render_device const& dev, cl::Kernel& kernel, cl_uint a);
+
+// Write spheres first .. first + count - 1 of spheres into the sphere arrays of dev, in place
+// in its shared virtual memory or with writes to its buffers
+cl_int write_spheres(render_device& dev, sphere_soa const& spheres, std::size_t first, std::size_t count);
+
+// Write what refit_scene changed in the structure dev holds after the sphere arrays: the runs
+// of nodes of a full BVH, the whole tree of a compressed one, whose quantized boxes depend on
+// the parent's, or the footprints of the sphere ranges of splat. Other modes have no structure
+// a refit changes.
+cl_int write_refit(render_device& dev, render_scene const& scene, std::vector<std::int32_t> const& nodes, std::vector<sphere_range> const& ranges);
+
+// Split the image rows between the devices in proportion to their speed: rows per ms of
+// the last frame, or the compute units x clock guess before the first one. Bands are
+// multiples of kGroupTileSize rows so the tiled kernels see whole work-groups, only the
+// last band may end with a partial block.
+void partition_rows(std::vector<render_device>& devices);
+
+// Enqueue the kernels tracing rows [row_begin, row_end) of dev into out_buf, kernel_event is
+// the last of them
+cl_int enqueue_kernel(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, cl::Event* kernel_event);
+
+// Upload the spheres of batch, the next ones of a scene streamed in batches (see
+// render_device::stream_batches), chunk by chunk into the slots of dev and enqueue the chunk
+// kernels over its rows [row_begin, row_end) behind those of the batches before. Returns once
+// the uploads are done, so batch can be overwritten, while the kernels may still run;
+// render_frame then resolves the rows.
+cl_int enqueue_batch(render_device& dev, sphere_soa const& batch);
+
+// True if render_frame issues the band of dev as tiles to its queues, see render_device::num_queues
+bool tiles_queued(render_device const& dev);
+
+// Enqueue the kernel for rows [row_begin, row_end) of dev and the read of those rows into the
+// image at img, or their mapping with map_readback; finish_band completes the band after the
+// queue finished
+cl_int enqueue_band(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, unsigned char* img, cl::Event* kernel_event);
+
+// Complete the band of enqueue_band once dev.queue has finished: copy a mapped band into img
+// and unmap it. Returns the transfer time in ms, the read or map command plus the copy.
+double finish_band(render_device& dev, std::uint32_t row_begin, std::uint32_t row_end, unsigned char* img);
+
+// Render the bands of all devices into img and record every kernel's time, the bands of
+// devices with tiles_queued as tiles round-robin across their queues, or gathered on the
+// first device if its gather is set (see render_device::gather). The pointer
+// overload reads the frame into any memory of the frame's size, such as a mapped file
+// (raw_image_file), which holds it once the call returns.
+void render_frame(std::vector<render_device>& devices, std::vector<unsigned char>& img);
+void render_frame(std::vector<render_device>& devices, unsigned char* img);
+
+// Print the queue, launch and run times of a kernel and its readback
+void print_profile(command_time const& kernel, command_time const& readback);
+
+// Same for the last kernel and readback of dev
+void print_profile(render_device const& dev);
+
+// Print what the last band of dev achieved, derived from its launch size and kernel time:
+// rays/s and the GB/s of the pixels written. For the brute force kernels of scene, where every
+// ray tests every sphere, also the sphere tests/s, their GFLOPS and the GB/s of the sphere
+// arrays they read, against the peaks of dev, and which roof of the roofline the arithmetic
+// intensity of the tests puts the kernel under.
+void print_throughput(render_device const& dev, render_scene const& scene);
+
+// Render the image of the view init_device set dev up for band by band of dev.band_rows rows
+// and hand every band to writer once it is read back, so neither the device nor the host holds
+// the image. The bands rotate through dev.band_outputs: the kernel of a band waits for the
+// read of the band before it in its buffer, and reads run on dev.band_queue next to the
+// kernels. Bands writer restored from a checkpoint are skipped. kernel_time and transfer_time
+// add up all bands. Returns false if a command fails.
+bool render_bands(render_device& dev, tiled_image_writer& writer);
+
+// Read the band of every device from the channel planes of the last frame into planes, which
+// holds aov_floats(aovs) floats per pixel in the layout of aov_buf. All devices render the same
+// aovs; returns false if a read fails.
+bool read_aovs(std::vector<render_device>& devices, std::vector<float>& planes);
+
+// Statistics of a frame, reduced on the devices by reduce_frame_stats: the lowest, highest and
+// mean value of each channel of the colors the kernels write, after the output transform and
+// before the quantization of the pixel format (the colors of the spheres for the id formats),
+// the fraction of the pixels that hit a sphere and the pixels each sphere won, indexed like the
+// spheres on the devices
+struct frame_stats
+{
+	float min[3];
+	float max[3];
+	double mean[3];
+	double coverage;
+	std::vector<std::uint32_t> hits;
+	// Kernel time of the reduction in ms, summed over the devices
+	double time;
+};
+
+// Reduce the bands of the last frame of devices with stats set into stats, one launch of
+// image_stats per device over the ids its kernels left on it, without reading the image back.
+// Returns false if no device reduced its band or a command fails.
+bool reduce_frame_stats(std::vector<render_device>& devices, frame_stats& stats);
+
+// Levels of a MIP pyramid build_mips makes at most: it reduces tiles of kGroupTileSize pixels
+// down to one
+std::uint32_t const kMaxMipLevels = 5;
+
+// Width or height of MIP level level of an image of size pixels, halved and rounded down
+// level times
+std::uint32_t mip_size(std::uint32_t size, std::uint32_t level);
+
+// Build the levels 1 to mip_levels - 1 of the MIP pyramid of the last frame on every device
+// from the band it rendered, each level the one above 2x box filtered, and read them into
+// levels in the pixel format of the frame, levels[l - 1] holding level l. A device that
+// rendered the whole image reads all levels in one transfer. Returns false if a command fails.
+bool read_mip_levels(std::vector<render_device>& devices, std::vector<std::vector<unsigned char>>& levels);
+
+// Render the image of the view init_device set dev up for, which traces the whole image, and
+// compress it on dev with dev.encode_codec into out, the whole file: the QOI chunks of every
+// row continue the row above with an index of the row's own pixels, the PNG rows are Up
+// filtered and each is compressed like a band of encode_png into an IDAT chunk of its own.
+// Only the compressed rows are read back, kernel_time and transfer_time are set as by
+// render_frame. Returns false with a message if dev encodes no frames or a command fails.
+bool encode_frame(render_device& dev, std::string& out);
+
+// Render the image of every window into img, one after the other, with one launch per device
+// of a 3D range whose third dimension is the window; each device takes an equal run of the
+// windows. The windows share the image size and depths of the views init_device set the
+// devices up for, and the sphere and structure buffers already on them: brute force, bvh and
+// sorted scenes run trace_views, trace_views_bvh and trace_views_sorted. Returns false with
+// a message for the other modes, streamed spheres or a batch larger than one allocation.
+bool render_views(std::vector<render_device>& devices, accel_mode mode, std::vector<view_window> const& windows, std::vector<unsigned char>& img);
+
+// Answer the occlusion queries (occluded() in cpu_trace.h) on dev, with the spheres and
+// structure init_device uploaded for a scene of mode: bvh and sorted scenes run occluded_bvh
+// and occluded_sorted, the others occluded over every sphere. hits[i] is 1 if query i is
+// blocked. The spheres of a two level scene are not expanded on the device, it can't be
+// queried. Returns false with a message for streamed spheres.
+bool query_occlusion(render_device& dev, accel_mode mode, std::vector<occlusion_ray> const& queries, std::vector<unsigned char>& hits);
+
+// The k nearest hits of the ray of every pixel of the view init_device set dev up for, as
+// render_nearest_hits in cpu_trace.h traces them, into hits, k per pixel. One launch of
+// nearest_hits_<k> of trace.cl, or nearest_hits_sorted_<k> for a sorted scene of mode, which
+// tests the spheres on the device; the other structures are not walked. Returns false with a
+// message for an unsupported k and for streamed spheres.
+bool query_nearest_hits(render_device& dev, accel_mode mode, std::uint32_t k, std::vector<ray_hit>& hits);
+
+// Closest sphere of every ray of rays on dev, as closest_hits in ray_queries.h traces them,
+// into t and ids: query_rays_bvh of trace.cl walks the full BVH of a bvh scene, query_rays
+// tests every sphere of the others. The rays go to the device kQueryLaunchRays at a time, each
+// launch sorted by ray_keys and the radix kernels first if sort is set. scene is the one
+// init_device set dev up for. Returns false with a message for streamed spheres, instanced
+// scenes and batches over kMaxBatchRays.
+bool query_rays(render_device& dev, render_scene const& scene, ray_batch const& rays, bool sort, float* t, std::int32_t* ids);
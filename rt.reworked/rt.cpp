@@ -11,160 +11,2874 @@
 	the same output.
 */
 
+#include "oiio/include/OpenImageIO/hash.h"
 #include "oiio/include/OpenImageIO/imageio.h"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include <CL/cl.hpp>
 
-// Output image dimensions
-std::uint32_t const kImageWidth = 2048;
-std::uint32_t const kImageHeight = 2048;
-// Number of spheres to render
-std::uint32_t const kNumSpheres = 512;
+#include "accel.h"
+#include "animation.h"
+#include "bench.h"
+#include "config.h"
+#include "cpu_trace.h"
+#include "device_memory.h"
+#include "devices.h"
+#include "farm.h"
+#include "frame_loop.h"
+#include "framebuffer_pool.h"
+#include "gl_preview.h"
+#include "gpu_renderer.h"
+#include "hip_device.h"
+#include "image_compare.h"
+#include "image_writer.h"
+#include "intersect_bench.h"
+#include "job_memory.h"
+#include "job_trace.h"
+#include "kernel_files.h"
+#include "lbvh_builder.h"
+#include "line_server.h"
+#include "output_files.h"
+#include "output_transform.h"
+#include "pixel_format.h"
+#include "point_import.h"
+#include "primitives.h"
+#include "profile_markers.h"
+#include "program_cache.h"
+#include "render_device.h"
+#include "render_planner.h"
+#include "roi.h"
+#include "run_options.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "server_metrics.h"
+#include "shared_framebuffer.h"
+#include "snapshot.h"
+#include "sphere_batches.h"
+#include "texture_shading.h"
+#include "thread_pool.h"
+#include "thread_scaling.h"
+#include "tile_cache.h"
+#include "tiled_output.h"
+#include "timeline.h"
+#include "vulkan_device.h"
+#include "work_group_tuner.h"
 
+// Sphere counts and square image sizes the --sweep suites step through
+std::uint32_t const kSweepSpheres[] = { 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 };
+std::uint32_t const kSweepSizes[] = { 512, 1024, 2048, 4096, 8192, 16384 };
+// A sweep drops a configuration for the larger steps once its median frame took longer (us)
+double const kSweepMaxFrameTime = 5e6;
+// Jobs the render server takes into one batch at most
+std::size_t const kMaxServerBatch = 32;
+// Milliseconds the render server waits on quit for its clients to take the answers still queued
+int const kServerQuitFlushMs = 2000;
+// Writers of run_batch encoding images at the same time
+std::size_t const kBatchEncoders = 4;
+// Pixels of one launch of the render server's batch jobs, a row of cache tiles of a 2048 wide image
+std::size_t const kServerSlicePixels = 2048 * kCacheTileSize;
+// Spheres of a chunk of the batches --stream-scene traces without --chunk
+std::uint32_t const kStreamChunkSpheres = 65536;
 
-#define RT_LEFT -10.f
-#define RT_BOTTOM -10.f
-#define RT_WIDTH 20.f
-#define RT_HEIGHT 20.f
-#define RT_NEAR -10.f
-#define RT_FAR 10.f
+// Read the view windows of --views from file, one left,bottom,width,height per line, into
+// views with the image size, near and far of view. Returns false with a message if the file
+// can't be read or holds no windows or a malformed line.
+bool read_view_windows(std::string const& file, ortho_view const& view, std::vector<ortho_view>& views)
+{
+	std::ifstream in(file);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << file << "\n";
+		return false;
+	}
+
+	std::string line;
+
+	for (auto number = 1; std::getline(in, line); ++number)
+	{
+		if (line.empty())
+			continue;
+
+		auto window = view;
+		char end = 0;
+
+		if (std::sscanf(line.c_str(), "%f,%f,%f,%f%c", &window.left, &window.bottom, &window.width, &window.height, &end) != 4 ||
+		    !(window.width > 0.f && window.height > 0.f))
+		{
+			std::cout << file << ":" << number << ": expected left,bottom,width,height\n";
+			return false;
+		}
+
+		views.push_back(window);
+	}
+
+	if (views.empty())
+	{
+		std::cout << file << " holds no view windows\n";
+		return false;
+	}
+
+	return true;
+}
+
+// Generate the num_spheres spheres of the philox generator on the device of entry and read
+// them back into spheres. Returns false if the program does not build or the kernel fails.
+bool generate_on_device(device_entry const& entry, std::string const& src, bool use_cache, std::uint32_t num_spheres, sphere_soa& spheres)
+{
+	cl_int err = 0;
+
+	cl::Context context(entry.device);
+	auto program = build_program(context, entry.device, src, "-cl-std=CL1.2", use_cache, &err);
+
+	if (err != CL_SUCCESS)
+		return false;
+
+	cl::CommandQueue queue(context, entry.device, 0, &err);
+	cl::Kernel kernel(program, "generate_philox", &err);
+
+	spheres.resize(num_spheres);
+
+	std::vector<float>* arrays[] = { &spheres.cx, &spheres.cy, &spheres.cz, &spheres.radius2, &spheres.radius, &spheres.color };
+	std::vector<cl::Buffer> buffers;
+
+	err = kernel.setArg(0, kSceneSeed);
+	err = kernel.setArg(1, num_spheres);
+
+	for (auto a = 0; a < 6; ++a)
+	{
+		buffers.push_back(create_buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(float) * arrays[a]->size(), nullptr, &err, "generated spheres"));
+		err = kernel.setArg(a + 2, buffers.back());
+	}
+
+	// whole blocks of 64 work-items, the kernel skips the ones past the last sphere
+	err = queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((std::size_t(num_spheres) + 63) / 64 * 64), cl::NullRange);
+
+	for (auto a = 0; a < 6; ++a)
+	{
+		err = queue.enqueueReadBuffer(buffers[a], CL_FALSE, 0, sizeof(float) * arrays[a]->size(), arrays[a]->data());
+	}
+
+	return queue.finish() == CL_SUCCESS && err == CL_SUCCESS;
+}
+
+// Render spheres with every CPU tracer and every acceleration mode on the devices of gpus and
+// compare each image against the single-threaded brute force trace(). Channels may be
+// max_ulps float steps apart. Each mode also answers occlusion queries from the pixel
+// centers, which must match testing every sphere. Returns false if anything differs.
+bool verify_backends(sphere_soa const& spheres, ortho_view const& view, std::vector<device_entry> const& gpus, std::string const& src, bool use_cache,
+                     thread_pool& pool, simd_isa isa, std::uint32_t max_ulps)
+{
+	std::size_t num_pixels = std::size_t(view.image_width) * view.image_height;
+
+	std::vector<float> reference(num_pixels * 3);
+	trace(spheres, view, &reference[0]);
+
+	bool all_passed = true;
+
+	auto check = [&](std::string const& name, float const* image)
+	{
+		auto diff = compare_images(image, &reference[0], view.image_width, view.image_height, max_ulps);
+
+		std::cout << "  " << name << ": ";
+
+		if (diff.failed == 0)
+		{
+			std::cout << (diff.max_ulps == 0 ? "identical" : "passed") << ", max " << diff.max_ulps << " ulps\n";
+			return;
+		}
+
+		all_passed = false;
+		std::cout << "FAILED, " << diff.failed << " channels differ, max error " << diff.max_error << " at (" << diff.max_x << ", " << diff.max_y
+		          << "), max " << diff.max_ulps << " ulps\n";
+	};
+
+	// occlusion queries from the pixel centers, ending a quarter to all of the way to the far plane,
+	// answered by testing every sphere
+	std::vector<occlusion_ray> queries;
+	queries.reserve(num_pixels);
+
+	for (auto j = 0U; j < view.image_height; ++j)
+	{
+		for (auto i = 0U; i < view.image_width; ++i)
+		{
+			queries.push_back(occlusion_ray{ view.left + (view.width / view.image_width) * (i + 0.5f), view.bottom + (view.height / view.image_height) * (j + 0.5f),
+			                                 view.near, (view.far - view.near) * static_cast<float>((i + j) % 4 + 1) / 4.f });
+		}
+	}
+
+	std::vector<unsigned char> blocked;
+	std::vector<unsigned char> hits;
+
+	{
+		render_scene brute_force;
+		brute_force.view = view;
+		brute_force.spheres = spheres;
+		occluded(pool, brute_force, queries, blocked);
+	}
+
+	auto check_hits = [&](std::string const& name)
+	{
+		std::size_t differ = 0;
+
+		for (std::size_t q = 0; q < queries.size(); ++q)
+		{
+			differ += hits[q] != blocked[q] ? 1 : 0;
+		}
+
+		std::cout << "  " << name << " occlusion: ";
+
+		if (differ == 0)
+		{
+			std::cout << "identical\n";
+			return;
+		}
+
+		all_passed = false;
+		std::cout << "FAILED, " << differ << " of " << queries.size() << " queries differ\n";
+	};
+
+	std::cout << "Verifying against the reference tracer, tolerance " << max_ulps << " ulps\n";
+
+	for (auto mode : { accel_mode::none, accel_mode::bvh, accel_mode::grid, accel_mode::splat, accel_mode::sorted, accel_mode::adaptive })
+	{
+		render_scene scene;
+		scene.view = view;
+		scene.spheres = spheres;
+		prepare_scene(scene, mode);
+		scene.grid.indices.resize(std::max<std::size_t>(scene.grid.indices.size(), 1U));
+
+		if (scene.mode != mode)
+		{
+			std::cout << "  " << accel_mode_name(mode) << ": spheres cross the near plane, skipped\n";
+			continue;
+		}
+
+		std::vector<float> image(num_pixels * 3);
+
+		// every packet width traces brute force, the accelerated modes use the widest one
+		for (auto candidate : { simd_isa::scalar, simd_isa::sse4, simd_isa::avx2, simd_isa::avx512 })
+		{
+			if (candidate > isa || (mode != accel_mode::none && candidate != isa))
+				continue;
+
+			render_parallel(pool, scene, candidate, &image[0]);
+			check(std::string("cpu ") + (mode == accel_mode::none ? simd_isa_name(candidate) : accel_mode_name(mode)), &image[0]);
+		}
 
-struct ray
+		occluded(pool, scene, queries, hits);
+		check_hits(std::string("cpu ") + accel_mode_name(mode));
+
+		bool hinted = mode == accel_mode::bvh || mode == accel_mode::sorted;
+
+		if (hinted)
+		{
+			scene.neighbour_hint = true;
+			render_parallel(pool, scene, isa, &image[0]);
+			check(std::string("cpu ") + accel_mode_name(mode) + " hint", &image[0]);
+			scene.neighbour_hint = false;
+		}
+
+		for (auto const& entry : gpus)
+		{
+			// brute force also runs with persistent work-groups and streamed in three chunks,
+			// bvh and sorted with the neighbour hint, and those three as a batch of two views
+			// and through the wavefront pipeline
+			char const* variants[] = { accel_mode_name(mode), "persistent", "chunked", "hint", "views", "wavefront" };
+
+			for (auto v = 0; v < 6; ++v)
+			{
+				if ((v == 1 || v == 2) && mode != accel_mode::none)
+					continue;
+
+				if (v == 3 && !hinted)
+					continue;
+
+				if ((v == 4 || v == 5) && !hinted && mode != accel_mode::none)
+					continue;
+
+				std::vector<render_device> devices(1);
+				set_device(devices[0], entry, pixel_format::float32, false);
+				devices[0].persistent = v == 1;
+				devices[0].chunk_spheres = v == 2 ? (spheres.size() + 2) / 3 : 0;
+				devices[0].wavefront = v == 5;
+				scene.neighbour_hint = v == 3;
+
+				if (!init_device(devices[0], src, scene, use_cache, false))
+				{
+					all_passed = false;
+					continue;
+				}
+
+				std::vector<unsigned char> frame(pixel_size(pixel_format::float32) * num_pixels);
+
+				if (v == 4)
+				{
+					// the second window is the image shifted by a column, it must not bleed into the first
+					auto shifted = view;
+					shifted.left += view.width / view.image_width;
+
+					std::vector<view_window> windows = { make_view_window(view), make_view_window(shifted) };
+
+					if (!render_views(devices, scene.mode, windows, frame))
+					{
+						all_passed = false;
+						continue;
+					}
+				}
+				else
+				{
+					partition_rows(devices);
+					render_frame(devices, frame);
+				}
+
+				check(entry.name + " " + variants[v], reinterpret_cast<float const*>(&frame[0]));
+
+				if (v != 0)
+					continue;
+
+				if (query_occlusion(devices[0], scene.mode, queries, hits))
+					check_hits(entry.name + " " + variants[v]);
+				else
+					all_passed = false;
+			}
+		}
+	}
+
+	return all_passed;
+}
+
+// One backend of the --sweep suites
+struct sweep_config
 {
-	// Origin
-	float ox, oy, oz;
-	// Direction
-	float dx, dy, dz;
-	// Intersection distance
-	float maxt;
+	std::string name;
+	accel_mode mode;
+	// OpenCL device, or the CPU: trace() if serial, otherwise the packet tracers of isa on pool
+	bool gpu;
+	device_entry device;
+	bool serial;
+	thread_pool* pool;
+	simd_isa isa;
+	// bvh in the compressed layout, see render_scene
+	bool compressed;
+	// time the on-device BVH build of --animate instead of frames, or a refit of its tree
+	bool build;
+	bool refit;
+	// wide and compressed nodes in treelets, see render_scene
+	bool treelets;
+	// Embree's BVH in place of the own one, see render_scene
+	bool embree;
 };
 
-class sphere
+// Benchmark every backend with warmup and runs frames at each step of the sweep over sphere
+// counts (sphere_sweep) or square image sizes, the other parameter staying at num_spheres or
+// view, and write one CSV line per configuration and step to file. Backends that got too slow
+// or run out of device memory are left out of the larger steps. The lbvh build and refit
+// entries time the device BVH of --animate without tracing. Returns false if file can't be
+// written.
+bool run_sweep(bool sphere_sweep, std::string const& file, ortho_view const& view, std::uint32_t num_spheres, std::vector<device_entry> const& gpus,
+               std::string const& src, bool use_cache, std::uint32_t num_threads, simd_isa isa, std::uint32_t warmup, std::uint32_t runs)
 {
-private:
-	float rand_float()
+	std::ofstream csv(file);
+
+	if (!csv)
+	{
+		std::cout << "Can't write " << file << "\n";
+		return false;
+	}
+
+	write_bench_csv_header(csv);
+
+	thread_pool serial_pool(1U);
+	thread_pool pool(num_threads);
+
+	std::vector<sweep_config> configs;
+
+	auto add_cpu = [&](std::string const& name, accel_mode mode, bool serial, thread_pool& on, simd_isa with)
+	{
+		configs.push_back(sweep_config{ "cpu " + name, mode, false, device_entry(), serial, &on, with, false, false, false, false, false });
+	};
+
+	add_cpu("serial", accel_mode::none, true, serial_pool, simd_isa::scalar);
+	add_cpu("threaded scalar", accel_mode::none, false, pool, simd_isa::scalar);
+
+	if (isa != simd_isa::scalar)
+	{
+		add_cpu(std::string("threaded ") + simd_isa_name(isa), accel_mode::none, false, pool, isa);
+	}
+
+	for (auto mode : { accel_mode::bvh, accel_mode::grid, accel_mode::splat, accel_mode::sorted, accel_mode::adaptive })
 	{
-		return static_cast <float> ( std::rand() ) / static_cast <float> (RAND_MAX);
+		add_cpu(accel_mode_name(mode), mode, false, pool, isa);
 	}
 
-public:
-	// Center
-	float cx, cy, cz;
-	// Radius
-	float radius;
-	// Shpere color
-	float r, g, b;
+	configs.push_back(sweep_config{ "cpu bvh treelets", accel_mode::bvh, false, device_entry(), false, &pool, isa, false, false, false, true, false });
 
-	sphere()
+	if (embree_available())
+		configs.push_back(sweep_config{ "cpu bvh embree", accel_mode::bvh, false, device_entry(), false, &pool, isa, false, false, false, false, true });
+
+	for (auto const& entry : gpus)
+	{
+		for (auto mode : { accel_mode::none, accel_mode::bvh, accel_mode::grid, accel_mode::splat, accel_mode::sorted, accel_mode::adaptive })
+		{
+			configs.push_back(sweep_config{ entry.name + " " + accel_mode_name(mode), mode, true, entry, false, nullptr, isa, false, false, false, false, false });
+		}
+
+		configs.push_back(sweep_config{ entry.name + " bvh compressed", accel_mode::bvh, true, entry, false, nullptr, isa, true, false, false, false, false });
+		configs.push_back(sweep_config{ entry.name + " bvh compressed treelets", accel_mode::bvh, true, entry, false, nullptr, isa, true, false, false, true, false });
+		configs.push_back(sweep_config{ entry.name + " lbvh build", accel_mode::bvh, true, entry, false, nullptr, isa, false, true, false, false, false });
+		configs.push_back(sweep_config{ entry.name + " lbvh refit", accel_mode::bvh, true, entry, false, nullptr, isa, false, false, true, false, false });
+	}
+
+	std::vector<bool> dropped(configs.size(), false);
+
+	std::vector<std::uint32_t> steps = sphere_sweep ? std::vector<std::uint32_t>(std::begin(kSweepSpheres), std::end(kSweepSpheres))
+	                                                : std::vector<std::uint32_t>(std::begin(kSweepSizes), std::end(kSweepSizes));
+
+	for (auto step : steps)
 	{
-		cx = rand_float() * 20.f - 10.f;
-		cy = rand_float() * 20.f - 10.f;
-		cz = rand_float() * 20.f - 5.f;
-		radius = (rand_float() + 0.1f) * 1.5f;
-		r = rand_float();
-		g = rand_float();
-		b = rand_float();
+		ortho_view step_view = view;
+		std::uint32_t step_spheres = num_spheres;
+
+		if (sphere_sweep)
+			step_spheres = step;
+		else
+			step_view.image_width = step_view.image_height = step;
+
+		sphere_soa spheres;
+		generate_spheres(spheres, step_spheres);
+
+		std::size_t num_pixels = std::size_t(step_view.image_width) * step_view.image_height;
+		std::vector<unsigned char> frame(pixel_size(pixel_format::float32) * num_pixels);
+
+		std::cout << step_spheres << " spheres, " << step_view.image_width << "x" << step_view.image_height << "\n";
+
+		for (std::size_t c = 0; c < configs.size(); ++c)
+		{
+			auto const& config = configs[c];
+
+			if (dropped[c])
+				continue;
+
+			render_scene scene;
+			scene.view = step_view;
+			scene.spheres = spheres;
+			scene.compressed_bvh = config.compressed;
+			scene.treelet_layout = config.treelets;
+			scene.embree = config.embree;
+			prepare_scene(scene, config.mode);
+			scene.grid.indices.resize(std::max<std::size_t>(scene.grid.indices.size(), 1U));
+
+			if (scene.mode != config.mode)
+			{
+				std::cout << "  " << config.name << ": spheres cross the near plane, skipped\n";
+				continue;
+			}
+
+			std::vector<render_device> devices;
+			lbvh_builder builder;
+			std::function<void()> run;
+
+			if (config.gpu)
+			{
+				if (config.device.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() < frame.size())
+				{
+					std::cout << "  " << config.name << ": image does not fit into one buffer, dropped\n";
+					dropped[c] = true;
+					continue;
+				}
+
+				devices.resize(1);
+				set_device(devices[0], config.device, pixel_format::float32, false);
+
+				if (!init_device(devices[0], src, scene, use_cache, false))
+				{
+					dropped[c] = true;
+					continue;
+				}
+
+				if (config.build || config.refit)
+				{
+					if (!init_lbvh_builder(builder, devices[0], scene.spheres))
+					{
+						std::cout << "  " << config.name << ": can't create the BVH builder, dropped\n";
+						dropped[c] = true;
+						continue;
+					}
+
+					Imath::Box3f centers;
+
+					for (auto k = 0U; k < spheres.size(); ++k)
+					{
+						centers.extendBy(Imath::V3f(spheres.cx[k], spheres.cy[k], spheres.cz[k]));
+					}
+
+					// a refit keeps the tree of a first build
+					if (config.refit)
+					{
+						enqueue_lbvh_build(builder, devices[0], nullptr, nullptr, centers, nullptr, nullptr, nullptr);
+						devices[0].queue.finish();
+					}
+
+					run = [&, centers]
+					{
+						if (config.refit)
+							enqueue_lbvh_refit(builder, devices[0], nullptr, nullptr, nullptr, nullptr, nullptr);
+						else
+							enqueue_lbvh_build(builder, devices[0], nullptr, nullptr, centers, nullptr, nullptr, nullptr);
+
+						devices[0].queue.finish();
+					};
+				}
+				else
+				{
+					run = [&]
+					{
+						partition_rows(devices);
+						render_frame(devices, frame);
+					};
+				}
+			}
+			else
+			{
+				auto image = reinterpret_cast<float*>(&frame[0]);
+
+				run = [&, image]
+				{
+					if (config.serial)
+						trace(scene.spheres, scene.view, image);
+					else
+						render_parallel(*config.pool, scene, config.isa, image);
+				};
+			}
+
+			bench_result result;
+			result.name = config.name;
+			result.width = step_view.image_width;
+			result.height = step_view.image_height;
+			result.spheres = step_spheres;
+			result.warmup = warmup;
+			result.stats = run_bench(run, warmup, runs);
+
+			if (config.build || config.refit)
+			{
+				result.rays = result.tests = 0.0;
+				// median us per build is ms per thousand spheres
+				result.build_ms_per_million = result.stats.median * 1e3 / step_spheres;
+			}
+			else
+			{
+				result.rays = static_cast<double>(num_pixels);
+				result.tests = result.rays * step_spheres;
+				add_bvh_traffic(scene, config.gpu, config.serial ? simd_isa::scalar : config.isa, result);
+			}
+
+			print_bench(result);
+			write_bench_csv_row(csv, result);
+			csv.flush();
+
+			dropped[c] = result.stats.median > kSweepMaxFrameTime;
+		}
 	}
+
+	return static_cast<bool>(csv);
+}
+
+// Settings of one job of run_server: the server's command line, overridden by the job's options
+struct render_job
+{
+	// Scene file, or generate num_spheres spheres with generator if empty
+	std::string scene_path;
+	// scene_path names a shared_scene of the client instead of a file
+	bool scene_shared;
+	std::uint32_t num_spheres;
+	scene_generator generator;
+	// Seed of the generator, kSceneSeed for the scene of the golden images
+	std::uint32_t seed;
+	ortho_view view;
+	accel_mode mode;
+	std::string output;
+	// Shared memory the server publishes the image to for the client instead of writing output,
+	// see run_server
+	std::string shared_output;
+	// Rendered ahead of batch jobs, see run_server
+	bool interactive;
+	// Pixels rendered and written, the whole image if empty
+	render_roi roi;
 };
 
-// Randomly generate sphere array of num_spheres items
-void generate_spheres( std::vector<sphere>& spheres )
+// Key naming the scene of job: the same key, the same spheres
+std::string job_scene_key(render_job const& job)
+{
+	if (!job.scene_path.empty())
+		return (job.scene_shared ? "shared " : "file ") + job.scene_path;
+
+	return std::string("generate ") + scene_generator_name(job.generator) + " " + std::to_string(job.num_spheres) + " " + std::to_string(job.seed);
+}
+
+// Map the scene file of job, a file or a shared_scene; returns false with a message if it can't
+bool open_job_scene(scene_file& file, render_job const& job)
+{
+	return job.scene_shared ? file.open_shared(job.scene_path) : file.open(job.scene_path);
+}
+
+// Where the image of job goes, the same for two jobs overwriting each other's image
+std::string job_target(render_job const& job)
+{
+	return job.shared_output.empty() ? "file " + job.output : "shared " + job.shared_output;
+}
+
+// Parse the options of a job line into job: --scene file, --scene-shm name, --spheres N,
+// --generator msvc|philox, --seed N, --size WxH, --view left,bottom,width,height,near,far,
+// --accel mode, --output file, --shared name, --priority interactive|batch and --roi
+// WxH+X+Y, separated by whitespace. Returns false with the offending option in error.
+bool parse_job(std::string const& line, render_job& job, std::string& error)
 {
-	for (size_t i = 0; i < spheres.capacity(); ++i)
+	std::istringstream words(line);
+	std::string option, value;
+
+	while (words >> option)
 	{
-		spheres.emplace_back();
+		bool parsed = static_cast<bool>(words >> value);
+
+		if (option == "--scene" || option == "--scene-shm")
+		{
+			job.scene_path = value;
+			job.scene_shared = option == "--scene-shm";
+		}
+		else if (option == "--spheres")
+		{
+			parsed = parsed && std::atoi(value.c_str()) > 0;
+			job.num_spheres = static_cast<std::uint32_t>(std::atoi(value.c_str()));
+			job.scene_path.clear();
+		}
+		else if (option == "--generator")
+		{
+			parsed = parsed && parse_scene_generator(value.c_str(), job.generator);
+			job.scene_path.clear();
+		}
+		else if (option == "--seed")
+		{
+			char* end = nullptr;
+			job.seed = static_cast<std::uint32_t>(std::strtoul(value.c_str(), &end, 0));
+			parsed = parsed && *end == '\0' && !value.empty();
+			job.scene_path.clear();
+		}
+		else if (option == "--size")
+		{
+			parsed = parsed && parse_image_size(value.c_str(), job.view);
+		}
+		else if (option == "--view")
+		{
+			parsed = parsed && parse_view_window(value.c_str(), job.view);
+		}
+		else if (option == "--accel")
+		{
+			parsed = parsed && parse_accel_mode(value.c_str(), job.mode);
+		}
+		else if (option == "--output")
+		{
+			job.output = value;
+			job.shared_output.clear();
+		}
+		else if (option == "--shared")
+		{
+			job.shared_output = value;
+		}
+		else if (option == "--roi")
+		{
+			parsed = parsed && parse_roi(value.c_str(), job.roi);
+		}
+		else if (option == "--priority")
+		{
+			parsed = parsed && (value == "interactive" || value == "batch");
+			job.interactive = value == "interactive";
+		}
+		else
+		{
+			parsed = false;
+		}
+
+		if (!parsed)
+		{
+			error = "bad option " + option;
+			return false;
+		}
 	}
+
+	return true;
 }
 
-int main()
+// Serve render jobs on 127.0.0.1:port until a client sends quit. Any number of client
+// processes connect at once (line_hub) and share the devices, so they don't each set up their
+// own contexts on them. Every line a client sends is one job, parse_job options on top of
+// defaults, and is answered to that client with "ok <ms> ms" once the image is written or
+// "error <reason>", in the order of its lines. The lines the clients sent while the last batch
+// rendered, taken from the clients in turn, form the next batch, up to kMaxServerBatch jobs,
+// so the jobs of several clients batch and cache together: its jobs are grouped by
+// scene, so each scene is loaded and uploaded once per batch, and the jobs of a scene that
+// share image size, depth range and mode render in one render_views launch of all their views
+// as long as those hold at most kServerSlicePixels pixels. A job writing the file of an earlier
+// job of the batch starts the next batch, so the files end up as the lines were sent.
+// A client on the same machine can hand scenes and images over in shared memory instead of
+// files: --scene-shm name maps the shared_scene name of the client, the same name is taken
+// for the same spheres as long as the server runs, and --shared name publishes the image to
+// the shared_framebuffer name, created by the server on the first job naming it, where the
+// client maps it with shared_frame_reader once the job is answered.
+// Larger batch jobs render one row of kCacheTileSize tiles per launch; between the launches
+// the server reads what the clients have sent, and jobs of --priority interactive render right
+// away, in one launch, and are answered with "interactive ok <ms> ms" or "interactive error
+// <reason>" ahead of the batch jobs sent before them. An interactive job thus waits for one
+// launch of a row of tiles rather than for the frames queued before it.
+// One gpu_renderer renders all jobs, so the devices keep their contexts, programs and sphere
+// buffers from job to job; a scene is loaded or generated again only when a job names another
+// one. Images are encoded as encoding says. With a cache, the tiles of every image are looked
+// up by tile_key first and only the missing ones are rendered, one job at a time. A job with
+// --roi renders only that region, past the cache, with render_region and writes an image of it
+// whose data window keeps its place in the whole image. With settings.scene_cache_share the
+// renderer keeps the scenes it leaves, structure and device buffers included, and a job
+// naming one of them again renders without loading, building or uploading it (see
+// gpu_renderer::restore_scene). With a metrics_port the server_metrics of the jobs are served
+// on it for Prometheus (serve_metrics).
+// Jobs are admitted within budget, whose device side defaults to the memory of the smallest
+// device: before a job renders, estimate_job_memory tells what it will hold next to the tile
+// cache and the scenes set aside. Jobs fold into a launch only while all their images fit, a
+// job whose image doesn't fit whole on the devices renders in the bands that do (see
+// gpu_renderer::set_band_rows), and one that doesn't fit even so is answered with an error
+// instead of failing an allocation halfway. With a record_path every line received but quit is
+// appended to a job trace there (job_trace_writer), which --replay sends again. Returns the
+// exit code of the program.
+int run_server(std::uint16_t port, render_job const& defaults, std::vector<device_entry> const& used_devices, std::string const& src,
+               gpu_settings const& settings, image_encoding const& encoding, std::uint32_t num_threads, tile_cache* cache, std::uint16_t metrics_port,
+               memory_budget budget, std::string const& record_path)
 {
-	cl_int err = 0;
+	line_hub server;
+
+	if (!server.listen(port))
+		return 1;
+
+	job_trace_writer trace;
+
+	if (!record_path.empty() && !trace.open(record_path))
+		return 1;
 
-	//init platform
-	std::vector<cl::Platform> all_platforms;
-	cl::Platform::get(&all_platforms);
-	if (all_platforms.size() == 0) 
+	std::cout << "Serving render jobs on 127.0.0.1:" << port << "\n";
+
+	for (auto const& entry : used_devices)
 	{
-		std::cout << " No platforms found. Check OpenCL installation!\n";
-		exit(1);
+		if (budget.device == 0 || entry.global_mem < budget.device)
+			budget.device = static_cast<std::size_t>(entry.global_mem);
 	}
-	cl::Platform default_platform = all_platforms.front();
-	std::cout << "Using platform: " << default_platform.getInfo<CL_PLATFORM_NAME>() << "\n";
 
-	//init device
-	std::vector<cl::Device> devices;
-	default_platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
-	cl::Device device = devices.front();
+	std::cout << "Admitting jobs within " << (budget.device >> 20) << " MB of device memory";
 
-	//create programm
-	std::ifstream trace_file("trace.cl");
-	std::string src( std::istreambuf_iterator<char>(trace_file), (std::istreambuf_iterator<char>()));
+	if (budget.host != 0)
+		std::cout << " and " << (budget.host >> 20) << " MB of host memory";
 
-	cl::Program::Sources sources(1, std::make_pair(src.c_str(), src.length() + 1));
+	std::cout << "\n";
 
-	cl::Context context(device);
-	cl::Program program(context, sources);
+	// shared with the thread answering the scrapes, which outlives the server
+	auto metrics = std::make_shared<server_metrics>();
 
-	err =  program.build("-cl-std=CL1.2");
+	if (metrics_port != 0 && !serve_metrics(metrics_port, metrics))
+		return 1;
 
-	//
-	cl::Kernel kernel(program, "trace", &err);
+	gpu_renderer renderer(used_devices, src, settings);
+	thread_pool pool(num_threads);
+	// jobs of the same image size render into the framebuffer the last one wrote
+	framebuffer_pool frames;
 
-	//init data
-	std::srand(0x88e8fff4);
+	// what the scene of the renderer was loaded from, empty if it has to be loaded again
+	scene_file file;
+	std::string scene_key;
+	// scene_digest of the scene of the renderer, computed only with a cache
+	std::string digest;
+	// with the scene cache, the digest of every scene source key a job named, to find the scene
+	// the renderer set aside for a key; the same key names the same spheres as long as the
+	// server runs, as for scene_key
+	bool scene_cache = settings.scene_cache_share > 0.0;
+	std::map<std::string, std::string> digests;
+	// the spheres of every scene source key a job named, for the estimates of the next jobs
+	std::map<std::string, std::uint32_t> sphere_counts;
+
+	// the shared memory of the --shared jobs by name, with the frames published to it
+	struct shared_output
+	{
+		shared_framebuffer region;
+		std::uint32_t width, height;
+		std::uint64_t frames;
+	};
 
-	std::vector<sphere> spheres;
-	spheres.reserve(kNumSpheres);
+	std::map<std::string, std::unique_ptr<shared_output>> shared_outputs;
 
-	generate_spheres( spheres );
+	// a line a client sent
+	struct received_line
+	{
+		std::uint64_t client;
+		std::string line;
+	};
 
-	std::vector<float> img(kImageWidth * kImageHeight * 3);
+	// a job of the batch being rendered and its answer, empty until it is done
+	struct queued_job
+	{
+		std::uint64_t client;
+		std::string line;
+		render_job job;
+		std::string key;
+		std::string reply;
+	};
 
-	//init buffers
-	cl::Buffer in_buf(context, CL_MEM_READ_ONLY | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR, sizeof(sphere) * spheres.size(), spheres.data(), &err);
-	cl::Buffer out_buf(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(float) * img.size(), img.data(), &err);
+	// make the scene of job the renderer's, returns false with the reason in error
+	auto load_scene = [&](queued_job const& queued, std::string& error)
+	{
+		auto const& job = queued.job;
 
-	err = kernel.setArg(0, in_buf);
-	err = kernel.setArg(1, out_buf);
+		if (queued.key == scene_key)
+			return true;
 
-	//
-	cl::CommandQueue queue(context, device);
+		// a scene set aside comes back with its structure and device buffers, nothing is loaded
+		if (scene_cache && renderer.restore_scene(digests[queued.key]))
+		{
+			digest = digests[queued.key];
+			scene_key = queued.key;
+			return true;
+		}
 
-	//
-	auto start = std::chrono::high_resolution_clock::now();
+		// drop the buffers reading from the mapping before it is replaced
+		renderer.set_scene(sphere_soa());
+		scene_key.clear();
 
-	//
-	err = queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(kImageWidth, kImageHeight));
-	err = queue.enqueueReadBuffer(out_buf, CL_FALSE, 0, sizeof(float) * img.size(), img.data());
-	
-	err = cl::finish();
+		sphere_soa spheres;
 
-	auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		if (!job.scene_path.empty())
+		{
+			if (!open_job_scene(file, job))
+			{
+				error = "can't load " + job.scene_path;
+				return false;
+			}
+
+			file.copy_spheres(spheres);
+
+			if (cache || scene_cache)
+				digest = scene_digest(spheres);
 
-	std::cout << "Execution time " << delta << " ms\n";
+			// buffers set aside must not read a mapping the next file replaces, they are
+			// uploaded from the copy
+			if (scene_cache)
+				renderer.set_scene(std::move(spheres), nullptr, digests[queued.key] = digest);
+			else
+				renderer.set_scene(std::move(spheres), &file);
+		}
+		else
+		{
+			file.close();
+			generate_spheres(spheres, job.num_spheres, job.generator, pool, job.seed);
 
-	OIIO_NAMESPACE::ImageOutput* out = OIIO_NAMESPACE::ImageOutput::create("result.png");
+			if (cache || scene_cache)
+				digest = scene_digest(spheres);
 
-	if (!out)
+			renderer.set_scene(std::move(spheres), nullptr, scene_cache ? digests[queued.key] = digest : std::string());
+		}
+
+		scene_key = queued.key;
+		return true;
+	};
+
+	// spheres of the scene of queued, from the header of its file before it is loaded; a file
+	// that can't be read fails to load later
+	auto job_spheres = [&](queued_job const& queued)
 	{
-		std::cout << "Can't create image file on disk";
-		return -1;
-	}
+		auto found = sphere_counts.find(queued.key);
+
+		if (found != sphere_counts.end())
+			return found->second;
+
+		std::uint32_t count = queued.job.num_spheres;
+
+		if (!queued.job.scene_path.empty())
+		{
+			scene_file peek;
+
+			if (!open_job_scene(peek, queued.job))
+				return 0U;
+
+			count = peek.size();
+		}
+
+		return sphere_counts[queued.key] = count;
+	};
+
+	// memory the job doesn't own: the tile cache full and the scenes set aside on the devices
+	auto taken_memory = [&]()
+	{
+		return job_memory{ cache ? cache->budget() : 0, renderer.set_aside_bytes() };
+	};
+
+	// set the renderer up to render queued on its own within the budget, in bands if its image
+	// doesn't fit whole; returns false with the reason in error if it doesn't fit at all
+	auto admit = [&](queued_job const& queued, std::string& error)
+	{
+		auto const& job = queued.job;
+		auto spheres = job_spheres(queued);
+		std::uint32_t band_rows = 0;
+
+		if (!fit_band_rows(spheres, job.mode, job.view, settings.format, budget, taken_memory(), band_rows))
+		{
+			auto memory = estimate_job_memory(spheres, job.mode, job.view, settings.format, 1, kGroupTileSize);
+			error = "over the memory budget, needs " + std::to_string(memory.host >> 20) + " MB of host and " + std::to_string(memory.device >> 20) +
+			        " MB of device memory";
+			metrics->refused_jobs.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (band_rows != 0)
+		{
+			std::cout << "Job \"" << queued.line << "\": rendering in bands of " << band_rows << " rows to fit the device memory budget\n";
+			metrics->banded_jobs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		renderer.set_band_rows(band_rows);
+		return true;
+	};
+
+	// write img, the image of job, returns false with the reason in error
+	auto write_image = [&](render_job const& job, std::vector<unsigned char> img, std::string& error)
+	{
+		auto window = job.roi.empty() ? full_roi(job.view) : clip_roi(job.roi, job.view);
+
+		if (!job.shared_output.empty())
+		{
+			auto width = static_cast<std::uint32_t>(window.width());
+			auto height = static_cast<std::uint32_t>(window.height());
+			auto& shared = shared_outputs[job.shared_output];
+
+			// a region holds frames of one size, another size gets a new one
+			if (!shared || shared->width != width || shared->height != height)
+			{
+				shared.reset(new shared_output{ {}, width, height, 0 });
+
+				if (!shared->region.create(job.shared_output, false, width, height, static_cast<std::uint32_t>(settings.format), pixel_size(settings.format)))
+				{
+					shared_outputs.erase(job.shared_output);
+					error = "can't create the shared memory " + job.shared_output;
+					return false;
+				}
+			}
+
+			shared->region.publish(shared->frames++, img.data(), img.size());
+			return true;
+		}
+
+		// a region keeps its place in the image as the data window of the file
+		OIIO_NAMESPACE::ImageSpec spec(window.width(), window.height(), 3, pixel_type(settings.format));
+		spec.x = static_cast<int>(window.xbegin);
+		spec.y = static_cast<int>(window.ybegin);
+		spec.full_width = static_cast<int>(job.view.image_width);
+		spec.full_height = static_cast<int>(job.view.image_height);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		image_writer writer(2, &frames, encoding);
+		writer.write(job.output, spec, std::move(img), pixel_size(settings.format));
+
+		bool written = writer.finish();
+		metrics->encode.observe(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+
+		if (!written)
+		{
+			error = "can't write " + job.output;
+			return false;
+		}
+
+		return true;
+	};
+
+	auto serving = std::chrono::steady_clock::now();
+
+	// append a line just received to the job trace
+	auto record = [&](std::string const& line)
+	{
+		if (!trace.is_open() || line == "quit")
+			return;
+
+		render_job job = defaults;
+		std::string error;
+		traced_job traced = { std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - serving).count(), std::string(), 0, 0, false, line };
+
+		if (parse_job(line, job, error))
+		{
+			auto key = job_scene_key(job);
+			OIIO_NAMESPACE::SHA1 sha;
+			sha.append(key.data(), key.size());
+			traced.scene_hash = sha.digest();
+			traced.width = job.view.image_width;
+			traced.height = job.view.image_height;
+			traced.interactive = job.interactive;
+		}
+
+		trace.record(traced);
+	};
+
+	// render the interactive jobs the clients have sent since and keep their other lines for later
+	std::function<void()> serve_interactive;
+	// lines read but not yet taken into a batch
+	std::deque<received_line> waiting;
+
+	// render one job on its own, batch jobs one row of tiles per launch with serve_interactive()
+	// between them; returns false with the reason in error
+	auto render_single = [&](queued_job const& queued, std::string& error)
+	{
+		auto const& job = queued.job;
+
+		if (!admit(queued, error))
+			return false;
+
+		error = "can't build the kernels";
+
+		if (!load_scene(queued, error))
+			return false;
+
+		// a region renders in one launch per row of work-group tiles into an image of its own
+		if (!job.roi.empty())
+		{
+			auto region = clip_roi(job.roi, job.view);
+
+			if (region.empty())
+			{
+				error = "region outside the image";
+				return false;
+			}
+
+			auto pixels = frames.acquire(pixel_size(settings.format) * std::size_t(region.width()) * region.height());
+			framebuffer_view region_target = { &pixels[0], pixel_size(settings.format) * region.width() };
+
+			if (!renderer.render_region(job.view, job.mode, region, region_target, region))
+				return false;
+
+			return write_image(job, std::move(pixels), error);
+		}
+
+		auto img = frames.acquire(pixel_size(settings.format) * std::size_t(job.view.image_width) * job.view.image_height);
+		framebuffer_view target = { &img[0], pixel_size(settings.format) * job.view.image_width };
+
+		if (job.interactive && !cache)
+		{
+			if (!renderer.render(job.view, job.mode, target))
+				return false;
+
+			return write_image(job, std::move(img), error);
+		}
+
+		auto tiles = cache_tiles(job.view);
+
+		// tiles to render and their keys
+		std::vector<tile> missing;
+		std::vector<std::string> missing_keys;
+		std::vector<unsigned char> pixels;
+
+		for (auto const& t : tiles)
+		{
+			if (!cache)
+			{
+				missing.push_back(t);
+				continue;
+			}
+
+			auto key = tile_key(digest, job.view, settings.format, t);
+			auto tile_row_bytes = pixel_size(settings.format) * (t.x1 - t.x0);
+
+			// a file of another size is not this tile, render it again
+			if (!cache->find(key, pixels) || pixels.size() != tile_row_bytes * (t.y1 - t.y0))
+			{
+				missing.push_back(t);
+				missing_keys.push_back(std::move(key));
+				continue;
+			}
+
+			for (auto y = t.y0; y < t.y1; ++y)
+			{
+				std::memcpy(&img[target.row_bytes * y + pixel_size(settings.format) * t.x0], &pixels[tile_row_bytes * (y - t.y0)], tile_row_bytes);
+			}
+		}
+
+		// interactive jobs render their missing tiles at once
+		for (std::size_t begin = 0, end = 0; begin < missing.size(); begin = end)
+		{
+			end = begin + 1;
+
+			while (end < missing.size() && (job.interactive || missing[end].y0 == missing[begin].y0))
+			{
+				++end;
+			}
+
+			std::vector<tile> row(missing.begin() + begin, missing.begin() + end);
+
+			// the scene of an interactive job rendered in between is replaced again
+			if (!load_scene(queued, error) || !renderer.render_tiles(job.view, job.mode, row, target))
+				return false;
+
+			if (renderer.rendered_whole_image())
+				break;
+
+			if (!job.interactive && end < missing.size())
+				serve_interactive();
+		}
+
+		for (std::size_t i = 0; cache && i < missing.size(); ++i)
+		{
+			auto const& t = missing[i];
+			auto tile_row_bytes = pixel_size(settings.format) * (t.x1 - t.x0);
+			pixels.resize(tile_row_bytes * (t.y1 - t.y0));
+
+			for (auto y = t.y0; y < t.y1; ++y)
+			{
+				std::memcpy(&pixels[tile_row_bytes * (y - t.y0)], &img[target.row_bytes * y + pixel_size(settings.format) * t.x0], tile_row_bytes);
+			}
+
+			cache->insert(missing_keys[i], pixels);
+		}
+
+		return write_image(job, std::move(img), error);
+	};
+
+	// answer queued with the time since start or the error
+	auto finish_job = [&](queued_job& queued, bool done, std::string const& error, std::chrono::high_resolution_clock::time_point start)
+	{
+		// the device times of a batch launch go to the first of its jobs
+		auto times = renderer.take_times();
+
+		for (auto const& stage : { std::make_pair(&metrics->build, times.build), std::make_pair(&metrics->upload, times.upload),
+		                           std::make_pair(&metrics->kernel, times.kernel), std::make_pair(&metrics->readback, times.readback) })
+		{
+			if (stage.second > 0.0)
+				stage.first->observe(stage.second);
+		}
+
+		metrics->job.observe(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		metrics->jobs.fetch_add(1, std::memory_order_relaxed);
+		metrics->failed_jobs.fetch_add(done ? 0 : 1, std::memory_order_relaxed);
+		metrics->queue_depth.fetch_sub(1, std::memory_order_relaxed);
+		metrics->scene_hits.store(renderer.scene_hits(), std::memory_order_relaxed);
+		metrics->scene_misses.store(renderer.scene_misses(), std::memory_order_relaxed);
+
+		if (cache)
+		{
+			metrics->tile_memory_hits.store(cache->memory_hits(), std::memory_order_relaxed);
+			metrics->tile_disk_hits.store(cache->disk_hits(), std::memory_order_relaxed);
+			metrics->tile_misses.store(cache->misses(), std::memory_order_relaxed);
+		}
+
+		if (!done)
+		{
+			std::cout << "Job \"" << queued.line << "\": " << error << "\n";
+			queued.reply = "error " + error;
+			return;
+		}
+
+		auto delta = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "Job \"" << queued.line << "\": " << delta << " ms";
+
+		if (cache)
+			std::cout << ", tile cache " << cache->memory_hits() << " memory hits, " << cache->disk_hits() << " disk hits, " << cache->misses() << " misses";
+
+		if (scene_cache)
+			std::cout << ", scene cache " << renderer.scene_hits() << " hits, " << renderer.scene_misses() << " misses";
+
+		std::cout << "\n";
+		queued.reply = "ok " + std::to_string(delta) + " ms";
+	};
+
+	// parse received into queued, answering it with the error if it isn't a job
+	auto parse_line = [&](received_line const& received, queued_job& queued)
+	{
+		auto const& line = received.line;
+		queued = { received.client, received.line, defaults, std::string(), std::string() };
+		std::string error;
+
+		if (!parse_job(line, queued.job, error))
+		{
+			std::cout << "Job \"" << line << "\": " << error << "\n";
+			queued.reply = "error " + error;
+			return false;
+		}
+
+		auto const& job = queued.job;
+		queued.key = job_scene_key(job);
+		metrics->queue_depth.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	};
+
+	// render an interactive job and answer it right away
+	auto render_interactive = [&](queued_job& queued)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		std::string error;
+
+		bool done = render_single(queued, error);
+		finish_job(queued, done, error, start);
+		server.write_line(queued.client, "interactive " + queued.reply);
+	};
+
+	serve_interactive = [&]()
+	{
+		received_line received;
+
+		while (server.poll_line(received.client, received.line))
+		{
+			record(received.line);
+			render_job job = defaults;
+			std::string error;
+
+			// everything else waits for its turn, in order, and is parsed then
+			if (received.line == "quit" || !parse_job(received.line, job, error) || !job.interactive)
+			{
+				waiting.push_back(received);
+				continue;
+			}
+
+			queued_job queued;
+			parse_line(received, queued);
+			render_interactive(queued);
+		}
+	};
+
+	// render the jobs of one scene, which share image size, depth range and mode, in one launch
+	// of all their views and write their images
+	auto render_folded = [&](std::vector<queued_job*> const& jobs, std::chrono::high_resolution_clock::time_point start)
+	{
+		auto const& view = jobs[0]->job.view;
+		std::size_t image_size = pixel_size(settings.format) * std::size_t(view.image_width) * view.image_height;
+
+		std::vector<ortho_view> views;
+
+		for (auto const* queued : jobs)
+		{
+			views.push_back(queued->job.view);
+		}
+
+		auto sheet = frames.acquire(image_size * jobs.size());
+		framebuffer_view target = { &sheet[0], pixel_size(settings.format) * view.image_width };
+
+		// render_batch folded only jobs whose images fit whole
+		renderer.set_band_rows(0);
+
+		std::string error = "can't render the batch";
+		bool rendered = load_scene(*jobs[0], error) && renderer.render_views(views, jobs[0]->job.mode, target);
+
+		std::cout << "Rendered " << jobs.size() << " jobs in one batch\n";
+
+		// the images follow each other in the sheet
+		for (std::size_t j = 0; j < jobs.size(); ++j)
+		{
+			bool done = rendered;
 
-	OIIO_NAMESPACE::ImageSpec spec(kImageWidth, kImageHeight, 3, OIIO_NAMESPACE::TypeDesc::FLOAT);
+			if (rendered)
+			{
+				auto img = frames.acquire(image_size);
+				std::memcpy(&img[0], &sheet[image_size * j], image_size);
+				done = write_image(jobs[j]->job, std::move(img), error);
+			}
 
-	out->open("result.png", spec);
-	out->write_image(OIIO_NAMESPACE::TypeDesc::FLOAT, &img[0], sizeof(float) * 3);
-	out->close();
+			finish_job(*jobs[j], done, error, start);
+		}
 
-	//system("pause");
+		frames.release(std::move(sheet));
+	};
+
+	// render the jobs of batch grouped by scene, folding the compatible ones
+	auto render_batch = [&](std::vector<queued_job>& batch)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (std::size_t first = 0; first < batch.size(); ++first)
+		{
+			// jobs answered already, the ones that failed to parse and earlier scenes
+			if (!batch[first].reply.empty())
+				continue;
+
+			std::vector<queued_job*> scene_jobs;
+
+			for (std::size_t j = first; j < batch.size(); ++j)
+			{
+				if (batch[j].reply.empty() && batch[j].key == batch[first].key)
+					scene_jobs.push_back(&batch[j]);
+			}
+
+			std::string error;
+
+			if (!load_scene(batch[first], error))
+			{
+				for (auto* queued : scene_jobs)
+				{
+					finish_job(*queued, false, error, start);
+				}
+
+				continue;
+			}
+
+			for (std::size_t i = 0; i < scene_jobs.size(); ++i)
+			{
+				auto* lead = scene_jobs[i];
+
+				if (!lead->reply.empty())
+					continue;
+
+				auto const& a = lead->job;
+				std::size_t image_pixels = std::size_t(a.view.image_width) * a.view.image_height;
+				std::vector<queued_job*> folded(1, lead);
+
+				// one more image of the launch within the budget
+				auto fold_fits = [&]
+				{
+					auto memory = estimate_job_memory(job_spheres(*lead), a.mode, a.view, settings.format, folded.size() + 1, 0);
+					auto taken = taken_memory();
+					return budget.fits(job_memory{ memory.host + taken.host, memory.device + taken.device });
+				};
+
+				// tiles of the cache are looked up per job, and a launch stays short enough for
+				// interactive jobs to wait on
+				for (std::size_t j = i + 1; j < scene_jobs.size() && !cache && a.roi.empty() && image_pixels * (folded.size() + 1) <= kServerSlicePixels && fold_fits();
+				     ++j)
+				{
+					auto const& b = scene_jobs[j]->job;
+
+					if (b.roi.empty() && b.view.image_width == a.view.image_width && b.view.image_height == a.view.image_height && b.view.near == a.view.near &&
+					    b.view.far == a.view.far && b.mode == a.mode)
+						folded.push_back(scene_jobs[j]);
+				}
+
+				if (folded.size() > 1)
+				{
+					render_folded(folded, start);
+				}
+				else
+				{
+					bool done = render_single(*lead, error);
+					finish_job(*lead, done, error, start);
+				}
+
+				serve_interactive();
+			}
+		}
+	};
+
+	bool quit = false;
+	// the client that sent quit, answered once the last batch is
+	std::uint64_t quitting = 0;
+
+	while (!quit)
+	{
+		std::vector<queued_job> batch;
+
+		// the lines read already, or the next one, then the ones that arrived while the last
+		// batch rendered
+		while (batch.size() < kMaxServerBatch)
+		{
+			received_line received;
+
+			if (!waiting.empty())
+			{
+				received = std::move(waiting.front());
+				waiting.pop_front();
+			}
+			else if (batch.empty())
+			{
+				if (!server.read_line(received.client, received.line))
+					break;
+
+				record(received.line);
+			}
+			else if (!server.poll_line(received.client, received.line))
+			{
+				break;
+			}
+			else
+			{
+				record(received.line);
+			}
+
+			if (received.line == "quit")
+			{
+				quit = true;
+				quitting = received.client;
+				break;
+			}
+
+			queued_job queued;
+
+			if (parse_line(received, queued))
+			{
+				auto const& job = queued.job;
+
+				if (job.interactive)
+				{
+					render_interactive(queued);
+					continue;
+				}
+
+				auto target = job_target(job);
+				bool rewrites = std::any_of(batch.begin(), batch.end(), [&](queued_job const& other) { return other.reply.empty() && job_target(other.job) == target; });
+
+				if (rewrites)
+				{
+					waiting.push_front(received);
+					break;
+				}
+			}
+
+			batch.push_back(std::move(queued));
+		}
+
+		// a batch ends empty only if the server socket failed
+		if (batch.empty() && !quit)
+			break;
+
+		render_batch(batch);
+
+		for (auto const& queued : batch)
+		{
+			server.write_line(queued.client, queued.reply);
+		}
+	}
+
+	if (quit)
+	{
+		server.write_line(quitting, "ok");
+		server.flush(kServerQuitFlushMs);
+		return 0;
+	}
+
+	std::cout << "Render server socket failed\n";
+	return 1;
+}
+
+// Render every entry of the manifest file, one parse_job line of options on top of defaults
+// each, '#' starting a comment, with one gpu_renderer, so the devices are set up and the
+// kernels built once for all the entries of an image size and sphere count. The entries flow
+// through a pipeline: the scene of the next entry is generated or loaded on the threads of a
+// pool while the devices upload, trace and read back the current one, and the finished images
+// are encoded by kBatchEncoders writers in parallel, the next entry rendering meanwhile.
+// Consecutive entries of the same scene generate it once. Returns the exit code of the program,
+// 1 if the manifest can't be read or an entry failed.
+int run_batch(std::string const& manifest, render_job const& defaults, std::vector<device_entry> const& used_devices, std::string const& src,
+              gpu_settings const& settings, image_encoding const& encoding, std::uint32_t num_threads)
+{
+	std::ifstream in(manifest);
+
+	if (!in)
+	{
+		std::cout << "Can't read " << manifest << "\n";
+		return 1;
+	}
+
+	std::vector<render_job> jobs;
+	std::string line;
+
+	for (auto number = 1; std::getline(in, line); ++number)
+	{
+		line = line.substr(0, line.find('#'));
+
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		render_job job = defaults;
+		std::string error;
+
+		if (!parse_job(line, job, error))
+		{
+			std::cout << manifest << ":" << number << ": " << error << "\n";
+			return 1;
+		}
+
+		if (!job.shared_output.empty())
+		{
+			std::cout << manifest << ":" << number << ": only the render server publishes to shared memory\n";
+			return 1;
+		}
+
+		jobs.push_back(job);
+	}
+
+	std::cout << "Rendering " << jobs.size() << " entries of " << manifest << "\n";
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	gpu_renderer renderer(used_devices, src, settings);
+	thread_pool pool(num_threads);
+	framebuffer_pool frames;
+
+	// the entries go to the writers round-robin, each encodes on a thread of its own
+	std::vector<std::unique_ptr<image_writer>> writers;
+
+	for (std::size_t w = 0; w < kBatchEncoders; ++w)
+	{
+		writers.emplace_back(new image_writer(2, &frames, encoding));
+	}
+
+	// spheres of the scene of entry i, empty if a file can't be loaded
+	auto load = [&](std::size_t i)
+	{
+		sphere_soa spheres;
+
+		if (jobs[i].scene_path.empty())
+		{
+			generate_spheres(spheres, jobs[i].num_spheres, jobs[i].generator, pool, jobs[i].seed);
+			return spheres;
+		}
+
+		scene_file file;
+
+		if (open_job_scene(file, jobs[i]))
+			file.copy_spheres(spheres);
+
+		return spheres;
+	};
+
+	std::future<sphere_soa> next;
+	std::string scene_key;
+	std::size_t failed = 0;
+
+	for (std::size_t i = 0; i < jobs.size(); ++i)
+	{
+		auto const& job = jobs[i];
+		auto key = job_scene_key(job);
+
+		if (key != scene_key)
+		{
+			auto spheres = next.valid() ? next.get() : load(i);
+
+			if (spheres.size() == 0)
+			{
+				std::cout << "Entry " << i + 1 << ": can't load " << job.scene_path << "\n";
+				renderer.set_scene(sphere_soa());
+				scene_key.clear();
+				++failed;
+				continue;
+			}
+
+			renderer.set_scene(std::move(spheres));
+			scene_key = key;
+		}
+
+		// the next scene is made while this one renders
+		for (auto n = i + 1; n < jobs.size() && !next.valid(); ++n)
+		{
+			auto next_key = job_scene_key(jobs[n]);
+
+			if (next_key == scene_key)
+				continue;
+
+			next = std::async(std::launch::async, load, n);
+			break;
+		}
+
+		auto img = frames.acquire(pixel_size(settings.format) * std::size_t(job.view.image_width) * job.view.image_height);
+		framebuffer_view target = { &img[0], pixel_size(settings.format) * job.view.image_width };
+
+		if (!renderer.render(job.view, job.mode, target))
+		{
+			std::cout << "Entry " << i + 1 << ": can't render " << job.output << "\n";
+			++failed;
+			continue;
+		}
+
+		OIIO_NAMESPACE::ImageSpec spec(job.view.image_width, job.view.image_height, 3, pixel_type(settings.format));
+		writers[i % writers.size()]->write(job.output, spec, std::move(img), pixel_size(settings.format));
+	}
+
+	for (auto& writer : writers)
+	{
+		failed += writer->finish() ? 0 : 1;
+	}
+
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "Rendered " << jobs.size() << " entries in " << elapsed << " ms, " << (jobs.empty() ? 0.0 : elapsed / jobs.size()) << " ms each\n";
+
+	return failed == 0 ? 0 : 1;
+}
+
+// Coordinate a render farm (see farm.h) for scene: wait for num_workers workers on port, send
+// them the scene file and the job, hand out the bands of the frame and write the image assembled
+// from their results to output as soon as the last band is in. One thread talks to each worker,
+// with up to kFarmBandsInFlight bands ahead of its results; a straggling band is issued again
+// to a worker that has run out of bands, and the bands of a worker that disconnects go back to
+// the others. Returns the exit code of the program.
+int run_farm_coordinator(std::uint16_t port, std::uint32_t num_workers, render_scene const& scene, pixel_format format, std::string const& output,
+                         image_encoding const& encoding)
+{
+	farm_listener listener;
+
+	if (!listener.listen(port))
+		return 1;
+
+	std::cout << "Waiting for " << num_workers << " render farm workers on port " << port << "\n";
+
+	std::vector<std::unique_ptr<farm_connection>> workers;
+
+	while (workers.size() < num_workers)
+	{
+		std::unique_ptr<farm_connection> worker(new farm_connection);
+
+		if (!listener.accept(*worker))
+		{
+			std::cout << "Render farm socket failed\n";
+			return 1;
+		}
+
+		workers.push_back(std::move(worker));
+	}
+
+	listener.close();
+
+	auto const& view = scene.view;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// the workers load the BVH from the scene file instead of building it
+	auto scene_bytes = scene_file_bytes(scene.spheres, scene.mode == accel_mode::bvh ? &scene.accel : nullptr, view.near);
+	farm_job job = { view, static_cast<std::uint32_t>(scene.mode), static_cast<std::uint32_t>(format) };
+
+	auto num_bands = (view.image_height + kFarmBandRows - 1) / kFarmBandRows;
+	farm_scheduler scheduler(num_bands);
+
+	auto row_bytes = pixel_size(format) * view.image_width;
+	std::vector<unsigned char> img(row_bytes * view.image_height);
+
+	// encoded result bytes
+	std::atomic<std::uint64_t> received(0);
+
+	std::vector<std::thread> threads;
+
+	for (std::uint32_t w = 0; w < num_workers; ++w)
+	{
+		scheduler.add_worker();
+
+		threads.emplace_back([&, w]
+		{
+			auto& worker = *workers[w];
+			worker.set_limit(farm_message::result, sizeof(farm_band) + max_encoded_band(row_bytes * kFarmBandRows, pixel_size(format)));
+
+			// bands sent and not answered yet, the worker answers them in order
+			std::deque<std::uint32_t> in_flight;
+			// the worker started on the band at the front of in_flight
+			auto band_start = std::chrono::high_resolution_clock::now();
+
+			bool alive = worker.send(farm_message::scene, scene_bytes.data(), scene_bytes.size()) && worker.send(farm_message::job, &job, sizeof(job));
+
+			farm_message type;
+			std::string payload;
+
+			while (alive)
+			{
+				std::uint32_t b;
+
+				while (alive && in_flight.size() < kFarmBandsInFlight && scheduler.take(w, b))
+				{
+					farm_band band = { b, b * kFarmBandRows, std::min((b + 1) * kFarmBandRows, view.image_height) };
+
+					if (in_flight.empty())
+						band_start = std::chrono::high_resolution_clock::now();
+
+					in_flight.push_back(b);
+					alive = worker.send(farm_message::band, &band, sizeof(band));
+				}
+
+				if (!alive)
+					break;
+
+				if (in_flight.empty())
+				{
+					if (scheduler.finished())
+						break;
+
+					scheduler.wait();
+					continue;
+				}
+
+				farm_band band;
+
+				if (!worker.receive(type, payload) || type != farm_message::result || payload.size() < sizeof(band))
+				{
+					alive = false;
+					break;
+				}
+
+				std::memcpy(&band, payload.data(), sizeof(band));
+
+				if (band.index != in_flight.front())
+				{
+					alive = false;
+					break;
+				}
+
+				in_flight.pop_front();
+				received += payload.size();
+
+				auto now = std::chrono::high_resolution_clock::now();
+				auto ms = std::chrono::duration<double, std::milli>(now - band_start).count();
+				band_start = now;
+
+				// a band issued again, the other worker was faster
+				if (!scheduler.claim(band.index))
+					continue;
+
+				auto y_begin = band.index * kFarmBandRows;
+				auto y_end = std::min(y_begin + kFarmBandRows, view.image_height);
+
+				if (band.y_begin != y_begin || band.y_end != y_end ||
+				    !decode_band(payload.data() + sizeof(band), payload.size() - sizeof(band), pixel_size(format), &img[row_bytes * y_begin], row_bytes * (y_end - y_begin)))
+				{
+					scheduler.give_back(band.index, true);
+					alive = false;
+					break;
+				}
+
+				scheduler.complete(band.index, ms);
+			}
+
+			for (auto b : in_flight)
+			{
+				scheduler.give_back(b, false);
+			}
+
+			if (alive)
+			{
+				worker.send(farm_message::done, nullptr, 0);
+			}
+			else
+			{
+				std::cout << "Lost render farm worker " << w << "\n";
+			}
+
+			worker.close();
+			scheduler.remove_worker();
+		});
+	}
+
+	bool complete = scheduler.wait_finished();
+
+	auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+	bool written = false;
+
+	if (complete)
+	{
+		std::cout << "Execution time " << delta << " ms, " << num_bands << " bands on " << num_workers << " workers, " << scheduler.reissued() << " issued again\n";
+		std::cout << "Received " << (received >> 10) << " KB for " << (img.size() >> 10) << " KB of pixels\n";
+
+		// sphere indices are written as their colors
+		auto file_format = format;
+
+		if (is_id_format(format))
+		{
+			std::vector<unsigned char> colors(pixel_size(pixel_format::float32) * view.image_width * view.image_height);
+			resolve_ids(&img[0], format, std::size_t(view.image_width) * view.image_height, scene.spheres.color.data(), reinterpret_cast<float*>(&colors[0]));
+			img.swap(colors);
+			file_format = pixel_format::float32;
+		}
+
+		OIIO_NAMESPACE::ImageSpec spec(view.image_width, view.image_height, 3, pixel_type(file_format));
+
+		image_writer writer(2, nullptr, encoding);
+		writer.write(output, spec, std::move(img), pixel_size(file_format));
+
+		written = writer.finish();
+		print_write_times(writer);
+	}
+	else
+	{
+		std::cout << "All render farm workers are gone\n";
+	}
+
+	// workers still running a band that was issued again finish it first
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	return written ? 0 : 1;
+}
+
+// Render bands for the render farm coordinator at host:port (see farm.h) until it is done: with
+// the gpu backend on the first of used_devices, which reads every band into an image of the whole
+// frame, with the cpu backend on num_threads threads into a band buffer. Returns the exit code of
+// the program.
+int run_farm_worker(std::string const& host, std::uint16_t port, bool use_gpu, std::vector<device_entry> const& used_devices, std::string const& src,
+                    bool use_cache, std::uint32_t num_threads, simd_isa isa)
+{
+	farm_connection coordinator;
+
+	if (!coordinator.connect(host, port))
+		return 1;
+
+	farm_message type;
+	std::string payload;
+
+	// the scene file stays open for the devices reading from it, see gpu_renderer::set_scene
+	scene_file file;
+
+	if (!coordinator.receive(type, payload) || type != farm_message::scene || !file.open_bytes(std::move(payload), "the scene of " + host))
+	{
+		std::cout << "No scene from " << host << ":" << port << "\n";
+		return 1;
+	}
+
+	farm_job job;
+
+	if (!coordinator.receive(type, payload) || type != farm_message::job || payload.size() != sizeof(job))
+	{
+		std::cout << "No job from " << host << ":" << port << "\n";
+		return 1;
+	}
+
+	std::memcpy(&job, payload.data(), sizeof(job));
+
+	render_scene scene;
+	scene.view = job.view;
+	file.copy_spheres(scene.spheres);
+	scene.file = &file;
+
+	prepare_scene(scene, static_cast<accel_mode>(job.mode));
+
+	// an empty buffer is invalid, keep at least one entry when no sphere is visible
+	scene.grid.indices.resize(std::max<std::size_t>(scene.grid.indices.size(), 1U));
+
+	auto const& view = scene.view;
+	auto format = static_cast<pixel_format>(job.format);
+	auto row_bytes = pixel_size(format) * view.image_width;
+
+	thread_pool pool(use_gpu ? 1U : num_threads);
+	std::vector<render_device> devices;
+	std::vector<unsigned char> img;
+
+	if (use_gpu)
+	{
+		devices.resize(1);
+		set_device(devices[0], used_devices[0], format, false);
+
+		if (!init_device(devices[0], src, scene, use_cache, false))
+			return 1;
+
+		img.resize(row_bytes * view.image_height);
+	}
+
+	std::cout << "Rendering " << view.image_width << "x" << view.image_height << " bands for " << host << ":" << port << ", " << accel_mode_name(scene.mode) << " on "
+	          << (use_gpu ? devices[0].name : std::to_string(pool.size()) + " CPU threads") << "\n";
+
+	// the CPU renders a band straight into pixels
+	std::vector<unsigned char> pixels;
+	std::string encoded;
+
+	while (coordinator.receive(type, payload))
+	{
+		if (type == farm_message::done)
+			return 0;
+
+		farm_band band;
+
+		if (type != farm_message::band || payload.size() != sizeof(band))
+			break;
+
+		std::memcpy(&band, payload.data(), sizeof(band));
+
+		if (band.y_begin >= band.y_end || band.y_end > view.image_height)
+			break;
+
+		auto rows = band.y_end - band.y_begin;
+		unsigned char const* band_pixels;
+
+		if (use_gpu)
+		{
+			auto& dev = devices[0];
+
+			if (enqueue_band(dev, band.y_begin, band.y_end, &img[0], nullptr) != CL_SUCCESS)
+			{
+				std::cout << "Can't render the band on " << dev.name << "\n";
+				return 1;
+			}
+
+			dev.queue.finish();
+			finish_band(dev, band.y_begin, band.y_end, &img[0]);
+
+			band_pixels = &img[row_bytes * band.y_begin];
+		}
+		else
+		{
+			std::vector<tile> tiles;
+
+			for (auto y = band.y_begin; y < band.y_end; y += kTileSize)
+			{
+				for (auto x = 0U; x < view.image_width; x += kTileSize)
+				{
+					tiles.push_back(tile{ x, y, std::min(x + kTileSize, view.image_width), std::min(y + kTileSize, band.y_end) });
+				}
+			}
+
+			pixels.resize(row_bytes * rows);
+
+			// render_tile addresses the pixels of an image, which starts y_begin rows above the band
+			unsigned char* origin = &pixels[0] - std::size_t(band.y_begin) * row_bytes;
+
+			pool.run(tiles, [&](tile const& t)
+			{
+				render_tile(scene, isa, format, t, origin);
+			});
+
+			band_pixels = &pixels[0];
+		}
+
+		encode_band(band_pixels, row_bytes * rows, pixel_size(format), encoded);
+
+		if (!coordinator.send(farm_message::result, &band, sizeof(band), encoded.data(), encoded.size()))
+			break;
+	}
+
+	std::cout << "Lost the render farm coordinator " << host << ":" << port << "\n";
+	return 1;
+}
+
+// Render the scene reader streams in batches (--stream-scene, --stream-port) with brute force
+// on the devices used, each taking its band of rows: every batch is uploaded and traced in
+// chunks of chunk_spheres as it arrives while the next one is read, carrying the closest hits
+// across the batches, and once the stream ends the hits are resolved and written to output.
+// The image is the one of the spheres of all batches rendered at once, which are written to
+// save_scene unless it is empty.
+int run_scene_stream(sphere_batch_reader& reader, ortho_view const& view, std::vector<device_entry> const& used_devices, std::string const& src,
+                     bool use_cache, pixel_format format, std::uint32_t chunk_spheres, std::string const& output, std::string const& save_scene,
+                     image_encoding const& encoding)
+{
+	// the devices are built for an empty scene, the batches fill it
+	render_scene scene;
+	scene.view = view;
+	prepare_scene(scene, accel_mode::none);
+
+	// an empty buffer is invalid, keep at least one entry when no sphere is visible
+	scene.grid.indices.resize(std::max<std::size_t>(scene.grid.indices.size(), 1U));
+
+	std::vector<render_device> devices(used_devices.size());
+
+	for (std::size_t d = 0; d < devices.size(); ++d)
+	{
+		auto& dev = devices[d];
+		set_device(dev, used_devices[d], format, false);
+		dev.chunk_spheres = chunk_spheres != 0 ? chunk_spheres : kStreamChunkSpheres;
+		dev.stream_batches = true;
+
+		if (!init_device(dev, src, scene, use_cache, false))
+			return 1;
+	}
+
+	partition_rows(devices);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	sphere_soa batch;
+
+	while (reader.next(batch))
+	{
+		for (auto& dev : devices)
+		{
+			if (enqueue_batch(dev, batch) != CL_SUCCESS)
+			{
+				std::cout << dev.name << ": can't trace batch " << reader.batches() << "\n";
+				return 1;
+			}
+		}
+
+		append_spheres(scene.spheres, batch);
+	}
+
+	if (reader.failed())
+		return 1;
+
+	auto stream_end = std::chrono::high_resolution_clock::now();
+
+	std::size_t num_pixels = std::size_t(view.image_width) * view.image_height;
+	std::vector<unsigned char> img(pixel_size(format) * num_pixels);
+	render_frame(devices, img);
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << "Traced " << reader.spheres() << " spheres of " << reader.batches() << " batches in "
+	          << std::chrono::duration<double, std::milli>(end - start).count() << " ms, the image "
+	          << std::chrono::duration<double, std::milli>(end - stream_end).count() << " ms after the stream ended\n";
+
+	// sphere indices are written as their colors
+	auto file_format = format;
+
+	if (is_id_format(format))
+	{
+		std::vector<unsigned char> colors(pixel_size(pixel_format::float32) * num_pixels);
+		resolve_ids(&img[0], format, num_pixels, scene.spheres.color.data(), reinterpret_cast<float*>(&colors[0]));
+		img.swap(colors);
+		file_format = pixel_format::float32;
+	}
+
+	OIIO_NAMESPACE::ImageSpec spec(view.image_width, view.image_height, 3, pixel_type(file_format));
+
+	image_writer writer(2, nullptr, encoding);
+	writer.write(output, spec, std::move(img), pixel_size(file_format));
+
+	bool written = writer.finish();
+	print_write_times(writer);
+
+	if (!save_scene.empty() && !write_scene_file(save_scene, scene.spheres, nullptr, view.near))
+		return 1;
+
+	return written ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	auto startup_start = std::chrono::high_resolution_clock::now();
+
+	run_options options;
+
+	if (!parse_run_options(argc, argv, options) || !resolve_run_options(options))
+		return 1;
+
+	if (!options.compare_baseline.empty())
+	{
+		std::vector<bench_result> baseline, current;
+
+		if (!read_bench_json(options.compare_baseline, baseline) || !read_bench_json(options.compare_current, current))
+			return 1;
+
+		return print_bench_comparison(baseline, current) == 0 ? 0 : 1;
+	}
+
+	if (options.microbench)
+	{
+		return run_intersect_bench("microbench_intersect.csv", options.isa, options.warmup, options.runs) ? 0 : 1;
+	}
+
+	if (!options.convert_points.empty())
+	{
+		point_format points_format;
+		sphere_soa points;
+		thread_pool pool(options.num_threads);
+		auto import_start = std::chrono::high_resolution_clock::now();
+
+		if (!detect_point_format(options.convert_points, points_format))
+		{
+			std::cout << "Can't tell the format of " << options.convert_points << " by its extension, .csv, .txt, .ply or .las\n";
+			return 1;
+		}
+
+		if (!import_points(options.convert_points, points_format, options.point_options, pool, points))
+			return 1;
+
+		std::cout << "Imported " << points.size() << " points from " << options.convert_points << " in "
+		          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - import_start).count() << " ms\n";
+
+		return write_scene_file(options.convert_output, points, nullptr, options.view.near) ? 0 : 1;
+	}
+
+	if (!options.replay_path.empty())
+	{
+		std::vector<traced_job> jobs;
+		replay_report report;
+
+		if (!load_job_trace(options.replay_path, jobs) || !replay_jobs(jobs, options.replay_port, options.replay_rate, report))
+			return 1;
+
+		if (options.json.empty())
+		{
+			write_replay_json(std::cout, report);
+			return 0;
+		}
+
+		std::ofstream out(options.json);
+		write_replay_json(out, report);
+
+		if (!out)
+		{
+			std::cout << "Can't write " << options.json << "\n";
+			return 1;
+		}
+
+		return 0;
+	}
+
+	std::vector<ortho_view> batch;
+
+	if (!options.views_path.empty() && !read_view_windows(options.views_path, options.view, batch))
+	{
+		return 1;
+	}
+
+	// the timeline is written when main returns, once the threads it records have finished
+	struct timeline_file
+	{
+		std::string file;
+
+		~timeline_file()
+		{
+			if (!file.empty())
+				write_timeline(file);
+		}
+	} timeline_out = { options.trace_out };
+
+	if (!options.trace_out.empty())
+	{
+		enable_timeline();
+		name_timeline_thread("main");
+	}
+
+	std::vector<device_entry> used_devices;
+	std::string src;
+
+	// the frame loop renders on devices opened while the scene is loaded, the other paths set
+	// their devices up themselves
+	bool opens_devices = options.serve_port == 0 && options.batch_path.empty() && options.farm_host.empty() && options.farm_port == 0 && !options.verify &&
+	options.sweep.empty() && !options.streamed();
+	std::vector<render_device> devices;
+
+	// the devices' contexts share the GL context of the window, so it is opened first
+	gl_preview preview_window;
+
+	if (options.preview && !preview_window.open(options.view.image_width, options.view.image_height))
+	{
+		return 1;
+	}
+
+	// find the devices, read trace.cl and open the devices, returns false with the reason in
+	// log; runs on its own thread next to loading the scene, so it only writes to log
+	auto setup_devices = [&](std::ostream& log)
+	{
+		profile_range range("init");
+
+		//init device
+		auto all_devices = enumerate_devices();
+		apply_device_peaks(all_devices, options.peaks);
+		if (all_devices.empty())
+		{
+			log << " No devices found. Check OpenCL installation, or render with --backend vulkan!\n";
+			return false;
+		}
+
+		for (std::size_t d = 0; d < all_devices.size(); ++d)
+		{
+			auto const& entry = all_devices[d];
+			log << "  [" << d << "] " << entry.name << ", " << entry.compute_units << " CUs @ " << entry.clock << " MHz, " << (entry.global_mem >> 20) << " MB\n";
+		}
+
+		if (options.multi_gpu && !options.numa_fission)
+		{
+			for (auto const& entry : all_devices)
+			{
+				if ((entry.type & (CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR)) != 0)
+					used_devices.push_back(entry);
+			}
+		}
+
+		if (used_devices.empty())
+		{
+			device_entry selected;
+			if (!select_device(all_devices, options.device_selector, selected))
+			{
+				log << " No device matches \"" << options.device_selector << "\"\n";
+				return false;
+			}
+
+			used_devices.push_back(selected);
+		}
+
+		if (options.numa_fission)
+		{
+			auto domains = split_numa_domains(used_devices[0]);
+
+			if (domains.empty())
+				log << " " << used_devices[0].name << " is no OpenCL CPU device its runtime splits by NUMA node, using it whole\n";
+			else
+				used_devices = domains;
+		}
+
+		for (auto const& entry : used_devices)
+		{
+			log << "Using device: " << entry.name << " (" << entry.platform.getInfo<CL_PLATFORM_NAME>() << ")\n";
+		}
+
+		//create programm
+		src = output_transform_source(options.transform) + load_kernel_file("trace.cl", IDR_TRACE_CL);
+
+		if (!opens_devices)
+			return true;
+
+		devices.resize(used_devices.size());
+
+		cl::Context shared_context;
+
+		if (options.gather && used_devices.size() > 1 && !share_context(used_devices, shared_context))
+			log << " The GPUs are on more than one platform and share no context, reading every band back\n";
+
+		for (std::size_t d = 0; d < devices.size(); ++d)
+		{
+			auto& dev = devices[d];
+			set_device(dev, used_devices[d], options.format, options.map_readback);
+			dev.context = shared_context;
+			dev.gather = d == 0 && shared_context() != nullptr;
+			dev.persistent = options.persistent;
+			dev.coarsen = options.coarsen;
+			dev.image_reads = options.image_reads;
+			dev.async_prefetch = options.async_prefetch;
+			dev.svm = options.svm;
+			dev.fast_math = options.fast_math;
+			dev.kernel_report = options.kernel_report;
+			dev.swizzle = options.swizzle;
+			dev.wavefront = options.wavefront;
+			dev.fast_math_ulps = options.max_ulps;
+			dev.chunk_spheres = options.chunk_spheres;
+			dev.aovs = options.aovs | (options.stats && !is_id_format(options.format) ? std::uint32_t(aov_id) : 0U);
+			dev.stats = options.stats;
+			dev.mip_levels = options.mip_levels;
+			dev.encode_codec = options.device_encode ? options.codec() : device_codec::none;
+			dev.aa_grid = options.aa_grid;
+			dev.bounces = options.bounces;
+			dev.reflectivity = options.reflectivity;
+			dev.sort_bounces = options.sort_bounces;
+			dev.band_rows = options.tiled ? kDeviceBandRows : 0U;
+			dev.num_queues = options.num_queues;
+			dev.context_properties = preview_window.context_properties(used_devices[d].platform);
+
+			// init_device builds for the scene, only the driver's compiler can be loaded ahead
+			open_device(dev, src, options.use_cache);
+			warm_up_compiler(dev);
+		}
+
+		return true;
+	};
+
+	std::ostringstream setup_log;
+	double setup_time = 0.0;
+	// an early return waits for the setup in the future's destructor
+	std::future<bool> setup;
+
+	if (options.backend != render_backend::cpu && !options.single_device())
+	{
+		setup = std::async(std::launch::async, [&]
+		{
+			name_timeline_thread("device setup");
+
+			auto setup_start = std::chrono::high_resolution_clock::now();
+			bool done = setup_devices(setup_log);
+			setup_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - setup_start).count();
+			return done;
+		});
+	}
+
+	// wait for the devices before their first use, returns false if they couldn't be set up
+	auto join_setup = [&]
+	{
+		if (!setup.valid())
+			return true;
+
+		auto wait_start = std::chrono::high_resolution_clock::now();
+		bool done = setup.get();
+
+		std::cout << setup_log.str();
+
+		if (!done)
+			return false;
+
+		std::cout << "Device setup " << setup_time << " ms, waited "
+		          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - wait_start).count() << " ms for it\n";
+		return true;
+	};
+
+	// the server, the batch, the farm worker and a streamed scene set their devices up per job
+	if ((options.serve_port != 0 || !options.batch_path.empty() || !options.farm_host.empty() || options.streamed()) && !join_setup())
+	{
+		return 1;
+	}
+
+	if (options.serve_port != 0 || !options.batch_path.empty())
+	{
+		render_job defaults = { options.scene_path, false, options.num_spheres, options.generator, kSceneSeed, options.view, options.mode, options.output, std::string(),
+		false, render_roi{} };
+
+		gpu_settings settings;
+		settings.format = options.format;
+		settings.use_cache = options.use_cache;
+		settings.map_readback = options.map_readback;
+		settings.persistent = options.persistent;
+		settings.coarsen = options.coarsen;
+		settings.image_reads = options.image_reads;
+		settings.async_prefetch = options.async_prefetch;
+		settings.svm = options.svm;
+		settings.fast_math = options.fast_math;
+		settings.swizzle = options.swizzle;
+		settings.wavefront = options.wavefront;
+		settings.fast_math_ulps = options.max_ulps;
+		settings.chunk_spheres = options.chunk_spheres;
+		settings.num_queues = options.num_queues;
+		settings.scene_cache_share = options.scene_cache_share;
+
+		if (!options.batch_path.empty())
+			return run_batch(options.batch_path, defaults, used_devices, src, settings, options.encoding, options.num_threads);
+
+		std::unique_ptr<tile_cache> cache;
+
+		if (options.tile_cache_mb > 0)
+			cache.reset(new tile_cache(options.tile_cache_mb << 20, options.tile_cache_dir));
+
+		return run_server(options.serve_port, defaults, used_devices, src, settings, options.encoding, options.num_threads, cache.get(), options.metrics_port,
+		                  options.server_budget, options.record_path);
+	}
+
+	if (!options.farm_host.empty())
+	{
+		return run_farm_worker(options.farm_host, options.farm_host_port, options.backend == render_backend::gpu, used_devices, src, options.use_cache,
+		                       options.num_threads, options.isa);
+	}
+
+	if (options.streamed())
+	{
+		std::ifstream stream_file;
+		line_server stream_server;
+		sphere_batch_reader::read_bytes read;
+
+		if (options.stream_port != 0)
+		{
+			if (!stream_server.listen(options.stream_port))
+				return 1;
+
+			std::cout << "Waiting for sphere batches on 127.0.0.1:" << options.stream_port << "\n";
+
+			if (!stream_server.accept())
+				return 1;
+
+			read = [&](void* data, std::size_t size) { return stream_server.read_bytes(data, size); };
+		}
+		else
+		{
+			stream_file.open(options.stream_scene, std::ios::binary);
+
+			if (!stream_file)
+			{
+				std::cout << "Can't open " << options.stream_scene << "\n";
+				return 1;
+			}
+
+			read = [&](void* data, std::size_t size) { return static_cast<bool>(stream_file.read(static_cast<char*>(data), size)); };
+		}
+
+		sphere_batch_reader reader(read);
+		return run_scene_stream(reader, options.view, used_devices, src, options.use_cache, options.format, options.chunk_spheres, options.output, options.save_scene,
+		                        options.encoding);
+	}
+
+	//init data
+	render_scene scene;
+	scene.view = options.view;
+	scene.neighbour_hint = options.neighbour_hint;
+	scene.tiles = options.tiles;
+	scene.compressed_bvh = options.compressed_bvh;
+	scene.treelet_layout = options.treelets;
+	// the mask is of the one view of still spheres
+	scene.skip_background = options.skip_background && options.num_animated == 0 && options.views_path.empty();
+	scene.half_spheres = options.half_spheres;
+	scene.depth_bounds = options.depth_bounds;
+	scene.splat_tiny = options.splat_tiny;
+	scene.embree = options.embree;
+	scene.camera = options.perspective ? projection::pinhole : projection::ortho;
+	scene.pinhole = options.pinhole;
+
+	scene_file file;
+	instance_set instances;
+
+	if (!options.instances_path.empty())
+	{
+		auto load_start = std::chrono::high_resolution_clock::now();
+		profile_range range("generate");
+
+		if (!read_instance_file(options.instances_path, instances))
+			return 1;
+
+		// the frame loop of the gpu backend traces the two levels, every other path the spheres
+		bool two_level = options.backend == render_backend::gpu && options.mode == accel_mode::bvh && !options.perspective && !options.oriented &&
+		options.num_animated == 0 && options.views_path.empty() &&
+		                 options.aovs == 0 && !options.verify && options.sweep.empty() && options.save_scene.empty() && options.farm_port == 0;
+
+		if (two_level && !build_instance_bvhs(instances, options.view.near, scene.arena))
+		{
+			std::cout << "Some instanced spheres cross the near plane, expanding the instances\n";
+			two_level = false;
+		}
+
+		if (two_level)
+			scene.instances = &instances;
+		else
+			expand_instances(instances, scene.spheres);
+
+		std::cout << "Loaded " << instances.instances.size() << " instances of " << instances.num_clusters() << " clusters, " << instances.spheres.size()
+		          << " unique of " << instances.expanded_size() << " spheres" << (two_level ? "" : ", expanded") << ", from " << options.instances_path << " in "
+		          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+	}
+	else if (!options.points_path.empty())
+	{
+		auto load_start = std::chrono::high_resolution_clock::now();
+		profile_range range("generate");
+		point_format points_format;
+		thread_pool pool(options.num_threads);
+
+		if (!detect_point_format(options.points_path, points_format))
+		{
+			std::cout << "Can't tell the format of " << options.points_path << " by its extension, .csv, .txt, .ply or .las\n";
+			return 1;
+		}
+
+		if (!import_points(options.points_path, points_format, options.point_options, pool, scene.spheres))
+			return 1;
+
+		std::cout << "Imported " << scene.spheres.size() << " points (" << point_format_name(points_format) << ") from " << options.points_path << " in "
+		          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+	}
+	else if (!options.scene_path.empty())
+	{
+		auto load_start = std::chrono::high_resolution_clock::now();
+		profile_range range("generate");
+
+		if (!file.open(options.scene_path))
+			return 1;
+
+		file.copy_spheres(scene.spheres);
+		scene.file = &file;
+
+		std::cout << "Loaded " << scene.spheres.size() << " spheres from " << options.scene_path << " in "
+		          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+	}
+	else
+	{
+		auto generate_start = std::chrono::high_resolution_clock::now();
+		profile_range range("generate");
+
+		if (options.generate_device)
+		{
+			if (!join_setup())
+				return 1;
+
+			if (!generate_on_device(used_devices[0], src, options.use_cache, options.num_spheres, scene.spheres))
+			{
+				std::cout << "Can't generate the spheres on " << used_devices[0].name << "\n";
+				return 1;
+			}
+		}
+		else
+		{
+			thread_pool pool(options.num_threads);
+			generate_spheres(scene.spheres, options.num_spheres, options.generator, pool);
+		}
+
+		std::cout << "Generated " << options.num_spheres << " spheres (" << scene_generator_name(options.generator) << (options.generate_device ? " on the device" : "") << ") in "
+		          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - generate_start).count() << " ms\n";
+	}
+
+	// the +Z view keeps the spheres and the BVH a scene file stores for them
+	Imath::M44f view_matrix = ortho_view_matrix(options.orientation, options.view);
+
+	if (options.oriented && view_matrix != Imath::M44f())
+	{
+		transform_spheres(scene.spheres, view_matrix);
+		scene.file = nullptr;
+	}
+
+	sphere_textures textures;
+
+	if (!options.textures_path.empty())
+	{
+		if (!read_texture_file(options.textures_path, scene.spheres.size(), textures))
+			return 1;
+
+		std::cout << "Mapping " << textures.files.size() << " textures onto the spheres of " << options.textures_path << "\n";
+	}
+
+	primitive_set primitives;
+
+	if (!options.primitives_path.empty())
+	{
+		if (!read_primitive_file(options.primitives_path, primitives))
+			return 1;
+
+		frame_arena build_scratch;
+		build_primitive_accels(primitives, options.view.near, build_scratch);
+
+		std::cout << "Adding " << primitives.planes.size() << " planes, " << primitives.boxes.size() << " boxes and " << primitives.capsules.size()
+		          << " capsules of " << options.primitives_path << "\n";
+	}
+
+	// animated spheres move into and out of the view, the other views and a saved scene need
+	// the full set, and verify compares it
+	if (options.num_animated == 0 && options.views_path.empty() && options.save_scene.empty() && !options.verify && options.sweep.empty())
+	{
+		auto total = scene.spheres.size();
+
+		if (options.cull)
+		{
+			auto culled = cull_scene(scene);
+
+			if (culled != 0)
+				std::cout << "Culled " << culled << " of " << total << " spheres outside the view\n";
+		}
+
+		if (options.occlusion_cull)
+		{
+			auto cull_start = std::chrono::high_resolution_clock::now();
+			auto hidden = cull_hidden_spheres(scene);
+
+			std::cout << "Culled " << hidden << " of " << total << " spheres hidden by nearer ones in "
+			          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cull_start).count() << " ms\n";
+		}
+
+		if (options.morton_spheres)
+		{
+			auto sort_start = std::chrono::high_resolution_clock::now();
+
+			if (morton_order_spheres(scene))
+				std::cout << "Sorted the " << scene.spheres.size() << " spheres in Z-order in "
+				          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sort_start).count() << " ms\n";
+		}
+	}
+
+	// the spheres kept by culling are numbered anew, sphere_ids holds their index in the file
+	if (!options.textures_path.empty() && !scene.sphere_ids.empty())
+	{
+		std::vector<std::uint32_t> kept(scene.spheres.size());
+
+		for (std::uint32_t k = 0; k < scene.spheres.size(); ++k)
+		{
+			kept[k] = textures.texture[scene.sphere_ids[k]];
+		}
+
+		textures.texture = std::move(kept);
+	}
+
+	// the planned backend and mode, with the device the calibration keeps its runs under
+	plan_choice planned = {};
+	plan_calibration calibration;
+	tuning_key plan_key;
+
+	if (options.plan)
+	{
+		// without devices the plan is among the cpu modes
+		bool gpu_ready = join_setup();
+		tuning_key gpu_key;
+		tuning_key cpu_key = { std::string("cpu ") + simd_isa_name(options.isa) + " " + std::to_string(options.num_threads) + " threads", std::string(), std::string() };
+
+		for (std::size_t d = 0; gpu_ready && d < used_devices.size(); ++d)
+		{
+			gpu_key.device += (d == 0 ? "" : ", ") + used_devices[d].name;
+			gpu_key.driver += (d == 0 ? "" : ", ") + used_devices[d].device.getInfo<CL_DRIVER_VERSION>();
+		}
+
+		gpu_key.kernel = gpu_ready ? source_digest(src) : std::string();
+
+		auto stats = measure_scene(scene.spheres, options.view);
+		auto choices = plan_render(stats, calibration, cpu_key, options.num_threads, gpu_key, embree_available());
+
+		std::cout << "Planning for " << stats.spheres << " spheres, " << stats.visible << " visible, " << stats.pixels << " pixels: footprints of "
+		          << stats.mean_footprint << " pixels on average and " << stats.max_footprint << " at most, depth complexity " << stats.depth_complexity << "\n";
+
+		for (auto const& choice : choices)
+		{
+			std::cout << "  " << plan_backend_name(choice.backend) << " " << accel_mode_name(choice.mode) << ": " << choice.predicted_ms << " ms"
+			          << (choice.calibrated ? "" : " (uncalibrated)") << "\n";
+		}
+
+		planned = choices.front();
+		options.backend = planned.backend == plan_backend::gpu ? render_backend::gpu : render_backend::cpu;
+		options.mode = planned.mode;
+		options.embree = scene.embree = planned.backend == plan_backend::embree;
+		plan_key = planned.backend == plan_backend::gpu ? gpu_key : cpu_key;
+
+		// the cpu frames don't use the devices opened for the plan
+		if (options.backend == render_backend::cpu)
+			devices.clear();
+
+		std::cout << "Planned " << plan_backend_name(planned.backend) << " " << accel_mode_name(planned.mode) << "\n";
+	}
+
+	auto build_start = std::chrono::high_resolution_clock::now();
+	prepare_scene(scene, options.mode);
+	auto build_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+	if (options.depth_bounds && (scene.mode == accel_mode::grid || scene.mode == accel_mode::adaptive))
+		std::cout << "Depth bounds dropped " << scene.depth_pruned << " of " << scene.depth_pruned + scene.grid.indices.size() << " grid cell entries\n";
+
+	if (!join_setup())
+	{
+		return 1;
+	}
+
+	// compare the first frame of the plan, structure build included, with its prediction and
+	// log it for the next plans
+	auto log_plan = [&](double frame_ms)
+	{
+		if (!options.plan || scene.mode != planned.mode)
+			return;
+
+		auto taken = build_time + frame_ms;
+		std::cout << "Plan " << plan_backend_name(planned.backend) << " " << accel_mode_name(planned.mode) << " predicted " << planned.predicted_ms << " ms, took "
+		          << taken << " ms, off by " << 100.0 * (planned.predicted_ms - taken) / taken << "%\n";
+
+		if (!calibration.record(plan_key, planned.backend, planned.mode, planned.work, taken))
+			std::cout << "Can't log the run for the planner\n";
+
+		options.plan = false;
+	};
+
+	if (scene.mode != options.mode)
+	{
+		std::cout << "Some spheres cross the near plane, falling back to brute force\n";
+	}
+	else if (scene.embree && scene.mode == accel_mode::bvh && !scene.embree_accel)
+	{
+		std::cout << "Embree can't build the BVH, tracing the own one\n";
+	}
+
+	if (scene.compressed_bvh && scene.mode == accel_mode::bvh && !scene.instances && scene.compressed_nodes.empty())
+	{
+		std::cout << "A BVH leaf holds too many spheres to compress, tracing the full nodes\n";
+	}
+
+	if (!options.save_scene.empty() && !write_scene_file(options.save_scene, scene.spheres, scene.mode == accel_mode::bvh && !scene.embree_accel ? &scene.accel : nullptr,
+	                                                     options.view.near))
+	{
+		return 1;
+	}
+
+	// 16-bit indices name the spheres below their background value
+	auto const id_spheres = scene.instances ? scene.instances->spheres.size() : scene.spheres.size();
+
+	if (options.format == pixel_format::id16 && id_spheres > max_id_spheres(options.format))
+	{
+		std::cout << "The scene has too many spheres for 16-bit indices, rendering with --format id32\n";
+		options.format = pixel_format::id32;
+
+		for (auto& dev : devices)
+		{
+			dev.format = options.format;
+		}
+	}
+
+	// an empty buffer is invalid, keep at least one entry when no sphere is visible
+	scene.grid.indices.resize(std::max<std::size_t>(scene.grid.indices.size(), 1U));
+
+	if (options.farm_port != 0)
+	{
+		return run_farm_coordinator(options.farm_port, options.farm_workers, scene, options.format, options.output, options.encoding);
+	}
+
+	if (options.verify)
+	{
+		thread_pool pool(options.num_threads);
+		return verify_backends(scene.spheres, options.view, used_devices, src, options.use_cache, pool, options.isa, options.max_ulps) ? 0 : 1;
+	}
+
+	if (!options.sweep.empty())
+	{
+		bool written = true;
+
+		if (options.sweep == "spheres" || options.sweep == "all")
+			written = run_sweep(true, "sweep_spheres.csv", options.view, options.num_spheres, used_devices, src, options.use_cache, options.num_threads, options.isa,
+			                    options.warmup, options.runs) && written;
+
+		if (options.sweep == "sizes" || options.sweep == "all")
+			written = run_sweep(false, "sweep_sizes.csv", options.view, options.num_spheres, used_devices, src, options.use_cache, options.num_threads, options.isa,
+			                    options.warmup, options.runs) && written;
+
+		if (options.sweep == "threads")
+			written = run_thread_sweep("sweep_threads.csv", scene, options.isa, options.format, options.num_threads, options.tile_sizes, options.affinities,
+			                           options.warmup, options.runs) && written;
+
+		return written ? 0 : 1;
+	}
+
+	// the programs of all devices compile at once, the first device's started first
+	for (auto& dev : devices)
+	{
+		prefetch_programs(dev, src, scene, options.use_cache);
+	}
+
+	for (auto& dev : devices)
+	{
+		if (!init_device(dev, src, scene, options.use_cache, options.tune))
+		{
+			exit(1);
+		}
+
+		std::cout << "  " << dev.name << ": build " << dev.build_time << " ms, upload " << dev.upload_time << " ms\n";
+	}
+
+	if (!options.snapshot_path.empty())
+	{
+		snapshot_state state;
+		char window[256];
+		std::snprintf(window, sizeof(window), "%a,%a,%a,%a,%a,%a", options.view.left, options.view.bottom, options.view.width, options.view.height, options.view.near,
+		              options.view.far);
+
+		state.settings.emplace_back("accel", accel_mode_name(scene.mode));
+		state.settings.emplace_back("size", std::to_string(options.view.image_width) + "x" + std::to_string(options.view.image_height));
+		state.settings.emplace_back("view", window);
+		state.settings.emplace_back("format", pixel_format_name(options.format));
+
+		for (auto const& flag : snapshot_flags(options))
+		{
+			state.settings.emplace_back(flag.first, *flag.second ? "1" : "0");
+		}
+
+		for (auto const& dev : devices)
+		{
+			std::vector<char> binary;
+
+			state.tuning += export_tuning(dev.tuning);
+
+			if (program_binary(dev.program, dev.device, binary))
+				state.blobs.emplace_back(program_binary_name(dev.device, src, dev.program_options), std::move(binary));
+		}
+
+		if (!write_snapshot(options.snapshot_path, scene.spheres, scene.mode == accel_mode::bvh && !scene.embree_accel ? &scene.accel : nullptr, options.view.near, state))
+			return 1;
+
+		std::cout << "Wrote the snapshot " << options.snapshot_path << "\n";
+	}
+
+	// the device reads back frames it can't encode, e.g. ones larger than one allocation
+	if (options.device_encode && devices[0].encode_codec == device_codec::none)
+		options.device_encode = false;
+
+	hip_device hip;
+
+	if (options.backend == render_backend::hip)
+	{
+		auto hip_src = load_kernel_file("trace.hip", IDR_TRACE_HIP);
+
+		if (!init_hip_device(hip, hip_src, scene, options.format, options.device_selector))
+		{
+			exit(1);
+		}
+
+		std::cout << "Using HIP device: " << hip.name << "\n";
+		std::cout << "  " << hip.name << ": build " << hip.build_time << " ms, upload " << hip.upload_time << " ms\n";
+	}
+
+	vulkan_device vulkan;
+
+	if (options.backend == render_backend::vulkan)
+	{
+		auto spirv_file = options.ray_query ? load_kernel_file("trace_rq.spv", IDR_TRACE_RQ_SPV) : load_kernel_file("trace.spv", IDR_TRACE_SPV);
+		std::vector<char> spirv(spirv_file.begin(), spirv_file.end());
+
+		if (!init_vulkan_device(vulkan, spirv, scene, options.format, options.device_selector, options.ray_query))
+		{
+			exit(1);
+		}
+
+		std::cout << "Using Vulkan device: " << vulkan.name << (vulkan.async_transfer ? ", transfers on their own queue" : "")
+		          << (vulkan.ray_query ? ", ray queries" : "") << "\n";
+		std::cout << "  " << vulkan.name << ": build " << vulkan.build_time << " ms, upload " << vulkan.upload_time << " ms";
+
+		if (vulkan.ray_query)
+			std::cout << ", acceleration structure " << vulkan.structure_time << " ms";
+
+		std::cout << "\n";
+	}
+
+	if (options.preview)
+	{
+		auto& dev = devices[0];
+
+		if (!preview_window.attach(dev))
+			return 1;
+
+		std::cout << "Previewing on " << dev.name << ", close the window to stop\n";
+
+		auto start = std::chrono::high_resolution_clock::now();
+		std::uint32_t shown = 0;
+
+		while (preview_window.poll() && (options.num_frames == 1 || shown < options.num_frames))
+		{
+			if (!preview_window.present(dev))
+				return 1;
+
+			++shown;
+		}
+
+		auto delta = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "Showed " << shown << " frames in " << delta << " ms, " << shown * 1000.0 / delta << " frames/s\n";
+		return 0;
+	}
+
+	if (options.num_animated > 0)
+	{
+		return run_animation(options, devices[0], scene);
+	}
+
+	if (!batch.empty())
+	{
+		std::vector<view_window> windows;
+
+		for (auto const& window : batch)
+		{
+			windows.push_back(make_view_window(window));
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<unsigned char> sheet;
+
+		if (!render_views(devices, scene.mode, windows, sheet))
+			return 1;
+
+		auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "Rendered " << windows.size() << " views in " << delta << " ms\n";
+
+		for (auto const& dev : devices)
+		{
+			std::cout << "  " << dev.name << ": kernel " << dev.kernel_time << " ms, transfer " << dev.transfer_time << " ms\n";
+		}
+
+		// the images follow each other in the buffer, so it is one image of all of them stacked
+		OIIO_NAMESPACE::ImageSpec sheet_spec(options.view.image_width, options.view.image_height * windows.size(), 3, pixel_type(options.format));
+
+		image_writer writer(2, nullptr, options.encoding);
+		writer.write(options.output, sheet_spec, std::move(sheet), pixel_size(options.format));
+
+		bool written = writer.finish();
+		print_write_times(writer);
+		return written ? 0 : -1;
+	}
+
+	if (options.tiled)
+	{
+		return run_tiled(options, scene, devices);
+	}
+
+	if (!options.pyramid_path.empty())
+	{
+		return run_pyramid(options, scene);
+	}
 
-	return 0;
+	return run_frame_loop(options, scene, devices, hip, vulkan, textures, primitives, startup_start, log_plan);
 }
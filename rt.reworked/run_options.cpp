@@ -0,0 +1,1296 @@
+#include "run_options.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "embree_bvh.h"
+#include "farm.h"
+#include "output_files.h"
+#include "program_cache.h"
+#include "snapshot.h"
+#include "tuning_db.h"
+
+bool run_options::streamed() const
+{
+	return !stream_scene.empty() || stream_port != 0;
+}
+
+bool run_options::single_device() const
+{
+	return backend == render_backend::hip || backend == render_backend::vulkan;
+}
+
+device_codec run_options::codec() const
+{
+	return requires_fast_encoder(output) ? device_codec::qoi : uses_png_encoder(output, encoding) ? device_codec::png : device_codec::none;
+}
+
+bool parse_run_options(int argc, char** argv, run_options& options)
+{
+	if (auto device_env = std::getenv("RT_DEVICE"))
+		options.device_selector = device_env;
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		bool has_value = i + 1 < argc;
+		device_peak peak;
+		post_op post;
+		std::vector<thread_affinity> placement;
+
+		if (std::strcmp(argv[i], "--accel") == 0 && has_value && parse_accel_mode(argv[i + 1], options.mode))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--hint") == 0)
+		{
+			options.neighbour_hint = true;
+		}
+		else if (std::strcmp(argv[i], "--tile-order") == 0 && has_value && parse_tile_order(argv[i + 1], options.tiles))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--balance") == 0)
+		{
+			options.balance = true;
+		}
+		else if (std::strcmp(argv[i], "--no-cull") == 0)
+		{
+			options.cull = false;
+		}
+		else if (std::strcmp(argv[i], "--occlusion-cull") == 0)
+		{
+			options.occlusion_cull = true;
+		}
+		else if (std::strcmp(argv[i], "--morton-spheres") == 0)
+		{
+			options.morton_spheres = true;
+		}
+		else if (std::strcmp(argv[i], "--depth-bounds") == 0)
+		{
+			options.depth_bounds = true;
+		}
+		else if (std::strcmp(argv[i], "--skip-background") == 0)
+		{
+			options.skip_background = true;
+		}
+		else if (std::strcmp(argv[i], "--half-spheres") == 0)
+		{
+			options.half_spheres = true;
+		}
+		else if (std::strcmp(argv[i], "--splat-tiny") == 0)
+		{
+			options.splat_tiny = true;
+		}
+		else if (std::strcmp(argv[i], "--compress-bvh") == 0)
+		{
+			options.compressed_bvh = true;
+		}
+		else if (std::strcmp(argv[i], "--treelets") == 0)
+		{
+			options.treelets = true;
+		}
+		else if (std::strcmp(argv[i], "--views") == 0 && has_value)
+		{
+			options.views_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--aov") == 0 && has_value && parse_aov_channels(argv[i + 1], options.aovs))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--tiled") == 0)
+		{
+			options.tiled = true;
+		}
+		else if (std::strcmp(argv[i], "--sparse") == 0)
+		{
+			options.sparse = true;
+		}
+		else if (std::strcmp(argv[i], "--checkpoint") == 0)
+		{
+			options.checkpoint = true;
+		}
+		else if (std::strcmp(argv[i], "--pyramid") == 0 && has_value)
+		{
+			options.pyramid_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--pyramid-layout") == 0 && has_value && parse_pyramid_layout(argv[i + 1], options.pyramid.layout))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--pyramid-tile") == 0 && has_value)
+		{
+			options.pyramid.tile_size = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--camera") == 0 && has_value && parse_pinhole_camera(argv[i + 1], options.pinhole))
+		{
+			options.perspective = true;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--view-dir") == 0 && has_value && parse_ortho_orientation(argv[i + 1], options.orientation))
+		{
+			options.oriented = true;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--size") == 0 && has_value && parse_image_size(argv[i + 1], options.view))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--view") == 0 && has_value && parse_view_window(argv[i + 1], options.view))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--spheres") == 0 && has_value)
+		{
+			// the sphere buffers can't be empty
+			options.num_spheres = static_cast<std::uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (std::strcmp(argv[i], "--backend") == 0 && has_value)
+		{
+			++i;
+			options.embree = std::strcmp(argv[i], "embree") == 0;
+
+			if (std::strcmp(argv[i], "cpu") == 0 || options.embree)
+				options.backend = render_backend::cpu;
+			else if (std::strcmp(argv[i], "hybrid") == 0)
+				options.backend = render_backend::hybrid;
+			else if (std::strcmp(argv[i], "hip") == 0)
+				options.backend = render_backend::hip;
+			else if (std::strcmp(argv[i], "vulkan") == 0)
+				options.backend = render_backend::vulkan;
+			else
+				options.backend = render_backend::gpu;
+		}
+		else if (std::strcmp(argv[i], "--ray-query") == 0)
+		{
+			options.ray_query = true;
+		}
+		else if (std::strcmp(argv[i], "--plan") == 0)
+		{
+			options.plan = true;
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && has_value)
+		{
+			options.num_threads = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--affinity") == 0 && has_value && parse_thread_affinities(argv[i + 1], placement) && placement.size() == 1)
+		{
+			options.affinity = placement;
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--runtime") == 0 && has_value && parse_parallel_runtime(argv[i + 1], options.runtime))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--isa") == 0 && has_value)
+		{
+			++i;
+			simd_isa requested = simd_isa::scalar;
+			for (auto candidate : { simd_isa::sse4, simd_isa::avx2, simd_isa::avx512 })
+			{
+				if (std::strcmp(argv[i], simd_isa_name(candidate)) == 0)
+					requested = candidate;
+			}
+			options.isa = std::min(options.isa, requested);
+		}
+		else if (std::strcmp(argv[i], "--device") == 0 && has_value)
+		{
+			options.device_selector = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--peak") == 0 && has_value && parse_device_peak(argv[i + 1], peak))
+		{
+			options.peaks.push_back(peak);
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--multi-gpu") == 0)
+		{
+			options.multi_gpu = true;
+		}
+		else if (std::strcmp(argv[i], "--gather") == 0)
+		{
+			options.gather = true;
+		}
+		else if (std::strcmp(argv[i], "--numa-fission") == 0)
+		{
+			options.numa_fission = true;
+		}
+		else if (std::strcmp(argv[i], "--frames") == 0 && has_value)
+		{
+			options.num_frames = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--animate") == 0 && has_value)
+		{
+			options.num_animated = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--refit") == 0 && has_value)
+		{
+			options.refit_threshold = std::max(1.0, std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--temporal") == 0)
+		{
+			options.temporal = true;
+		}
+		else if (std::strcmp(argv[i], "--delta") == 0 && has_value)
+		{
+			options.delta_interval = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--pipe") == 0 && has_value)
+		{
+			options.pipe_command = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--pipe-format") == 0 && has_value && parse_pipe_format(argv[i + 1], options.pipe_layout))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--readback") == 0 && has_value)
+		{
+			options.map_readback = std::strcmp(argv[++i], "map") == 0;
+		}
+		else if (std::strcmp(argv[i], "--queues") == 0 && has_value)
+		{
+			options.num_queues = std::min(std::max(std::atoi(argv[++i]), 1), static_cast<int>(kMaxTileQueues));
+		}
+		else if (std::strcmp(argv[i], "--persistent") == 0)
+		{
+			options.persistent = true;
+		}
+		else if (std::strcmp(argv[i], "--coarsen") == 0)
+		{
+			options.coarsen = true;
+		}
+		else if (std::strcmp(argv[i], "--image-reads") == 0)
+		{
+			options.image_reads = true;
+		}
+		else if (std::strcmp(argv[i], "--async-prefetch") == 0)
+		{
+			options.async_prefetch = true;
+		}
+		else if (std::strcmp(argv[i], "--svm") == 0)
+		{
+			options.svm = true;
+		}
+		else if (std::strcmp(argv[i], "--fast-math") == 0)
+		{
+			options.fast_math = true;
+		}
+		else if (std::strcmp(argv[i], "--kernel-report") == 0)
+		{
+			options.kernel_report = true;
+		}
+		else if (std::strcmp(argv[i], "--swizzle") == 0)
+		{
+			options.swizzle = true;
+		}
+		else if (std::strcmp(argv[i], "--wavefront") == 0)
+		{
+			options.wavefront = true;
+		}
+		else if (std::strcmp(argv[i], "--chunk") == 0 && has_value)
+		{
+			options.chunk_spheres = static_cast<std::uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (std::strcmp(argv[i], "--format") == 0 && has_value && parse_pixel_format(argv[i + 1], options.format))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--png-level") == 0 && has_value && std::atoi(argv[i + 1]) >= 0 && std::atoi(argv[i + 1]) <= 9)
+		{
+			options.encoding.png_level = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--encoder") == 0 && has_value && (std::strcmp(argv[i + 1], "oiio") == 0 || std::strcmp(argv[i + 1], "fast") == 0))
+		{
+			options.encoding.fast_png = std::strcmp(argv[++i], "fast") == 0;
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && has_value)
+		{
+			options.output = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--no-cache") == 0)
+		{
+			options.use_cache = false;
+		}
+		else if (std::strcmp(argv[i], "--tune") == 0)
+		{
+			options.tune = true;
+		}
+		else if (std::strcmp(argv[i], "--verify") == 0)
+		{
+			options.verify = true;
+		}
+		else if (std::strcmp(argv[i], "--ulps") == 0 && has_value)
+		{
+			options.max_ulps = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--compare") == 0 && has_value)
+		{
+			options.golden = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--tolerance") == 0 && has_value)
+		{
+			options.tolerance = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--exposure") == 0 && has_value)
+		{
+			options.transform.exposure = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--oetf") == 0 && has_value && (std::strcmp(argv[i + 1], "linear") == 0 || std::strcmp(argv[i + 1], "srgb") == 0))
+		{
+			options.transform.srgb = std::strcmp(argv[++i], "srgb") == 0;
+		}
+		else if (std::strcmp(argv[i], "--lut") == 0 && has_value && read_lut_file(argv[i + 1], options.transform.lut))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--stats") == 0)
+		{
+			options.stats = true;
+		}
+		else if (std::strcmp(argv[i], "--mip") == 0 && has_value)
+		{
+			options.mip_levels = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--device-encode") == 0)
+		{
+			options.device_encode = true;
+		}
+		else if (std::strcmp(argv[i], "--nearest-hits") == 0 && has_value)
+		{
+			options.nearest_hits = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--query-rays") == 0 && i + 2 < argc)
+		{
+			options.query_rays_path = argv[++i];
+			options.query_hits_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--sort-rays") == 0)
+		{
+			options.sort_query_rays = true;
+		}
+		else if (std::strcmp(argv[i], "--aa") == 0 && has_value)
+		{
+			options.aa_grid = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--bounces") == 0 && has_value)
+		{
+			options.bounces = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--reflectivity") == 0 && has_value)
+		{
+			options.reflectivity = std::strtof(argv[++i], nullptr);
+		}
+		else if (std::strcmp(argv[i], "--unsorted-bounces") == 0)
+		{
+			options.sort_bounces = false;
+		}
+		else if (std::strcmp(argv[i], "--post") == 0 && has_value && parse_post_op(argv[i + 1], post))
+		{
+			options.post_ops.push_back(post);
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--bench") == 0)
+		{
+			options.bench = true;
+		}
+		else if (std::strcmp(argv[i], "--warmup") == 0 && has_value)
+		{
+			options.warmup = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--runs") == 0 && has_value)
+		{
+			options.runs = static_cast<std::uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (std::strcmp(argv[i], "--json") == 0 && has_value)
+		{
+			options.json = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--trace-out") == 0 && has_value)
+		{
+			options.trace_out = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--memory") == 0)
+		{
+			options.memory_report = true;
+		}
+		else if (std::strcmp(argv[i], "--sweep") == 0 && has_value)
+		{
+			options.sweep = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--compare-bench") == 0 && i + 2 < argc)
+		{
+			options.compare_baseline = argv[++i];
+			options.compare_current = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--microbench") == 0)
+		{
+			options.microbench = true;
+		}
+		else if (std::strcmp(argv[i], "--tile-sizes") == 0 && has_value && parse_tile_sizes(argv[i + 1], options.tile_sizes))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--affinities") == 0 && has_value && parse_thread_affinities(argv[i + 1], options.affinities))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--generator") == 0 && has_value && parse_scene_generator(argv[i + 1], options.generator))
+		{
+			++i;
+		}
+		else if (std::strcmp(argv[i], "--generate-on-device") == 0)
+		{
+			options.generate_device = true;
+		}
+		else if (std::strcmp(argv[i], "--scene") == 0 && has_value)
+		{
+			options.scene_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--snapshot") == 0 && has_value)
+		{
+			options.snapshot_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--restore") == 0 && has_value)
+		{
+			options.restore_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--points") == 0 && has_value)
+		{
+			options.points_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--point-radius") == 0 && has_value && std::atof(argv[i + 1]) > 0.0)
+		{
+			options.point_options.radius = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--fit-points") == 0)
+		{
+			options.point_options.fit = true;
+		}
+		else if (std::strcmp(argv[i], "--convert-points") == 0 && i + 2 < argc)
+		{
+			options.convert_points = argv[++i];
+			options.convert_output = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--instances") == 0 && has_value)
+		{
+			options.instances_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--textures") == 0 && has_value)
+		{
+			options.textures_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--primitives") == 0 && has_value)
+		{
+			options.primitives_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--texture-cache") == 0 && has_value && std::atof(argv[i + 1]) > 0.0)
+		{
+			options.texture_cache_mb = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--save-scene") == 0 && has_value)
+		{
+			options.save_scene = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--stream-scene") == 0 && has_value)
+		{
+			options.stream_scene = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--stream-port") == 0 && has_value && std::atoi(argv[i + 1]) > 0 && std::atoi(argv[i + 1]) < 65536)
+		{
+			options.stream_port = static_cast<std::uint16_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--serve") == 0 && has_value && std::atoi(argv[i + 1]) > 0 && std::atoi(argv[i + 1]) < 65536)
+		{
+			options.serve_port = static_cast<std::uint16_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--batch") == 0 && has_value)
+		{
+			options.batch_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--tile-cache") == 0 && has_value && std::atoi(argv[i + 1]) > 0)
+		{
+			options.tile_cache_mb = static_cast<std::size_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--scene-cache") == 0 && has_value && std::atof(argv[i + 1]) > 0.0 && std::atof(argv[i + 1]) <= 1.0)
+		{
+			options.scene_cache_share = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--metrics-port") == 0 && has_value && std::atoi(argv[i + 1]) > 0 && std::atoi(argv[i + 1]) < 65536)
+		{
+			options.metrics_port = static_cast<std::uint16_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--host-budget") == 0 && has_value && std::atoi(argv[i + 1]) > 0)
+		{
+			options.server_budget.host = static_cast<std::size_t>(std::atoi(argv[++i])) << 20;
+		}
+		else if (std::strcmp(argv[i], "--device-budget") == 0 && has_value && std::atoi(argv[i + 1]) > 0)
+		{
+			options.server_budget.device = static_cast<std::size_t>(std::atoi(argv[++i])) << 20;
+		}
+		else if (std::strcmp(argv[i], "--record-jobs") == 0 && has_value)
+		{
+			options.record_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--replay") == 0 && i + 2 < argc && std::atoi(argv[i + 2]) > 0 && std::atoi(argv[i + 2]) < 65536)
+		{
+			options.replay_path = argv[++i];
+			options.replay_port = static_cast<std::uint16_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--replay-rate") == 0 && has_value && std::atof(argv[i + 1]) > 0.0)
+		{
+			options.replay_rate = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--tile-cache-dir") == 0 && has_value)
+		{
+			options.tile_cache_dir = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--farm") == 0 && has_value && std::atoi(argv[i + 1]) > 0 && std::atoi(argv[i + 1]) < 65536)
+		{
+			options.farm_port = static_cast<std::uint16_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--farm-workers") == 0 && has_value && std::atoi(argv[i + 1]) > 0)
+		{
+			options.farm_workers = static_cast<std::uint32_t>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--farm-worker") == 0 && has_value && parse_host_port(argv[i + 1], options.farm_host, options.farm_host_port))
+		{
+			++i;
+		}
+		else if ((std::strcmp(argv[i], "--shared") == 0 || std::strcmp(argv[i], "--shared-file") == 0) && has_value)
+		{
+			options.shared_is_file = std::strcmp(argv[i], "--shared-file") == 0;
+			options.shared_name = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--preview") == 0)
+		{
+			options.preview = true;
+		}
+		else
+		{
+			std::cout << "Usage: rt.reworked [--accel none|bvh|grid|splat|sorted|adaptive] [--backend gpu|cpu|hybrid|hip|vulkan|embree [--ray-query]] [--threads N] [--affinity none|node|compact|scatter|physical]\n"
+			             "                   [--runtime pool|std|tbb] [--plan]\n"
+			             "                   [--isa scalar|sse4|avx2|avx512] [--tile-order scanline|morton|hilbert] [--balance] [--no-cache] [--tune] [--device N|name] [--peak [name=]GFLOPS,GB/s] [--multi-gpu|--numa-fission [--gather]] [--frames N]\n"
+			             "                   [--readback copy|map] [--queues N] [--persistent] [--coarsen] [--image-reads] [--async-prefetch] [--svm] [--fast-math [--ulps N]] [--kernel-report] [--swizzle]\n"
+			             "                   [--wavefront] [--chunk N] [--format float|half|rgba8|float4|id16|id32] [--output file|file.rtraw] [--png-level N] [--encoder oiio|fast]\n"
+			             "                   [--animate N [--refit X] [--temporal] [--delta N] [--pipe command [--pipe-format rgba|yuv420]]] [--size WxH] [--spheres N] [--view left,bottom,width,height,near,far]\n"
+			             "                   [--verify [--ulps N]] [--compare file [--tolerance X]] [--post thumb:WxH|crop:x,y,WxH|srgb]\n"
+			             "                   [--exposure STOPS] [--oetf linear|srgb] [--lut file] [--stats] [--mip N] [--device-encode] [--nearest-hits K] [--aa N]\n"
+			             "                   [--query-rays rays hits [--sort-rays]]\n"
+			             "                   [--bounces N [--reflectivity X] [--unsorted-bounces]]\n"
+			             "                   [--bench [--warmup K] [--runs N] [--json file]] [--sweep spheres|sizes|all] [--trace-out file] [--memory]\n"
+			             "                   [--sweep threads [--tile-sizes N[,...]] [--affinities none|node|compact|scatter|physical[,...]]] [--microbench] [--compare-bench baseline current]\n"
+			             "                   [--scene file] [--instances file] [--save-scene file] [--snapshot file] [--restore file] [--stream-scene file|--stream-port PORT] [--generator msvc|philox [--generate-on-device]]\n"
+			             "                   [--points file [--point-radius R] [--fit-points]] [--convert-points file out]\n"
+			             "                   [--textures file [--texture-cache MB]] [--primitives file]\n"
+			             "                   [--hint] [--compress-bvh] [--treelets] [--no-cull] [--occlusion-cull] [--morton-spheres] [--depth-bounds] [--skip-background] [--half-spheres] [--splat-tiny]\n"
+			             "                   [--camera eye_x,eye_y,eye_z,target_x,target_y,target_z,fov_y[,far]] [--view-dir dx,dy,dz[,up_x,up_y,up_z]]\n"
+			             "                   [--views file] [--aov depth|id|normal|cost[,...]] [--tiled [--checkpoint] [--sparse]]\n"
+			             "                   [--pyramid path [--pyramid-layout dzi|xyz] [--pyramid-tile N]]\n"
+			             "                   [--serve PORT [--tile-cache MB [--tile-cache-dir path]] [--scene-cache F] [--metrics-port PORT] [--host-budget MB] [--device-budget MB] [--record-jobs file]]\n"
+			             "                   [--replay file PORT [--replay-rate X] [--json file]] [--batch manifest] [--farm PORT [--farm-workers N]] [--farm-worker host:port]\n"
+			             "                   [--shared name] [--shared-file path] [--preview]\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool resolve_run_options(run_options& options)
+{
+	// a snapshot holds the spheres and the devices of one still ortho frame of the gpu backend
+	if ((!options.snapshot_path.empty() || !options.restore_path.empty()) &&
+	    (options.backend != render_backend::gpu || options.perspective || options.oriented || options.num_animated > 0 || !options.instances_path.empty() ||
+	     !options.points_path.empty() ||
+	     !options.primitives_path.empty() || !options.textures_path.empty() || !options.views_path.empty() || !options.stream_scene.empty() || options.stream_port != 0 ||
+	     options.serve_port != 0 ||
+	     options.farm_port != 0 || !options.farm_host.empty() || options.plan))
+	{
+		std::cout << "Snapshots hold one still frame of spheres on the gpu backend, rendering without --snapshot and --restore\n";
+		options.snapshot_path.clear();
+		options.restore_path.clear();
+	}
+
+	// the restored run renders what the snapshot was taken of: its settings replace the ones
+	// given, the spheres were culled and ordered before they were written, and the tuned values
+	// and binaries stand in for tuning.txt and the program cache as long as the devices match
+	if (!options.restore_path.empty())
+	{
+		auto restore_start = std::chrono::high_resolution_clock::now();
+		snapshot_state state;
+
+		if (!read_snapshot(options.restore_path, state))
+			return false;
+
+		if (auto value = state.setting("accel"))
+			parse_accel_mode(value->c_str(), options.mode);
+
+		if (auto value = state.setting("size"))
+			parse_image_size(value->c_str(), options.view);
+
+		if (auto value = state.setting("view"))
+			parse_view_window(value->c_str(), options.view);
+
+		if (auto value = state.setting("format"))
+			parse_pixel_format(value->c_str(), options.format);
+
+		for (auto const& flag : snapshot_flags(options))
+		{
+			if (auto value = state.setting(flag.first))
+				*flag.second = *value == "1";
+		}
+
+		auto tuned = import_tuning(state.tuning);
+
+		for (auto& blob : state.blobs)
+		{
+			preload_program_binary(blob.first, std::move(blob.second));
+		}
+
+		options.scene_path = options.restore_path;
+		options.cull = false;
+		options.occlusion_cull = false;
+		options.morton_spheres = false;
+
+		std::cout << "Restored " << state.settings.size() << " settings, " << tuned << " tuned values and " << state.blobs.size() << " program binaries from "
+		          << options.restore_path << " in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - restore_start).count()
+		          << " ms\n";
+	}
+
+	// the sub-devices render the frames of the gpu backend in bands as the GPUs of --multi-gpu
+	// do, the modes of a single device drop both below
+	if (options.numa_fission && options.backend != render_backend::gpu)
+	{
+		std::cout << "NUMA fission splits the OpenCL CPU device of the gpu backend, rendering without it\n";
+		options.numa_fission = false;
+	}
+
+	options.multi_gpu = options.multi_gpu || options.numa_fission;
+
+	// the kernels and the acceleration structures trace ortho rays, the CPU tracer culls the
+	// spheres of each tile against its pinhole frustum
+	if (options.perspective && (options.mode != accel_mode::none || options.backend != render_backend::cpu || options.num_animated > 0 || options.serve_port != 0 ||
+	                            !options.views_path.empty() || options.aovs != 0))
+	{
+		std::cout << "The pinhole camera renders on the CPU with brute force\n";
+		options.mode = accel_mode::none;
+		options.backend = render_backend::cpu;
+		options.num_animated = 0;
+		options.serve_port = 0;
+		options.views_path.clear();
+		options.aovs = 0;
+	}
+
+	// the hybrid backend balances through the bands its workers take, the others have no tiles
+	if (options.balance && options.backend != render_backend::cpu)
+	{
+		std::cout << "--balance plans the tiles of the cpu backend, rendering without it\n";
+		options.balance = false;
+	}
+
+	// the one view of a scene of spheres that stay put, with the scene file left as it was read
+	if (options.oriented && (options.perspective || options.num_animated > 0 || options.serve_port != 0 || !options.views_path.empty() || options.farm_port != 0 ||
+	                         !options.farm_host.empty() || !options.save_scene.empty()))
+	{
+		std::cout << "The oriented view renders one still view of its own scene, looking along +Z\n";
+		options.oriented = false;
+	}
+
+	// spheres move every frame of an animation, the other acceleration structures would have to
+	// be rebuilt and uploaded each time; the BVH and the grid are rebuilt on the device
+	// (lbvh_builder.h, grid_builder.h)
+	if (options.num_animated > 0 && ((options.mode != accel_mode::none && options.mode != accel_mode::bvh && options.mode != accel_mode::grid) ||
+	                                 options.backend != render_backend::gpu || options.multi_gpu))
+	{
+		std::cout << "Animations render on one device with brute force, --accel bvh or --accel grid\n";
+		options.mode = options.mode == accel_mode::bvh || options.mode == accel_mode::grid ? options.mode : accel_mode::none;
+		options.backend = render_backend::gpu;
+		options.multi_gpu = false;
+	}
+
+	// the tiles of the frame before are reused by the brute force and BVH kernels alone
+	if (options.temporal && options.num_animated > 0 && options.mode == accel_mode::grid)
+	{
+		std::cout << "--temporal traces the frames brute force or with --accel bvh, not with --accel grid\n";
+		options.mode = accel_mode::none;
+	}
+
+	// the device builds the node layout trace_bvh reads uncompressed
+	if (options.num_animated > 0 && options.compressed_bvh)
+	{
+		std::cout << "Animations trace the uncompressed BVH\n";
+		options.compressed_bvh = false;
+	}
+
+	// the animation pipeline rebinds the output buffer of the plain brute force kernels
+	if (options.num_animated > 0 && (options.persistent || options.coarsen || options.image_reads || options.chunk_spheres != 0 || options.wavefront))
+	{
+		std::cout << "Animations render without persistent work-groups, pixel blocks, image reads, sphere streaming or the wavefront pipeline\n";
+		options.persistent = false;
+		options.coarsen = false;
+		options.image_reads = false;
+		options.chunk_spheres = 0;
+		options.wavefront = false;
+	}
+
+	// the device runs the philox generator, and there is one only with a GPU backend
+	if (options.generate_device && (options.generator != scene_generator::philox || options.backend == render_backend::cpu))
+	{
+		std::cout << "Only the philox generator runs on the device, generating on the CPU\n";
+		options.generate_device = false;
+	}
+
+	// the chunks hold a range of sphere indices, the acceleration structures span the whole scene
+	if (options.chunk_spheres != 0 && options.mode != accel_mode::none)
+	{
+		std::cout << "Sphere streaming renders with brute force\n";
+		options.mode = accel_mode::none;
+	}
+
+	// so does a scene streamed in batches, chunk by chunk on the devices as the batches arrive
+	if (options.streamed() && (options.backend != render_backend::gpu || options.mode != accel_mode::none || options.serve_port != 0 || !options.batch_path.empty() ||
+	                           !options.farm_host.empty()))
+	{
+		std::cout << "Streamed scenes render on the gpu backend with brute force\n";
+		options.backend = render_backend::gpu;
+		options.mode = accel_mode::none;
+		options.serve_port = 0;
+		options.batch_path.clear();
+		options.farm_host.clear();
+	}
+
+	// the server and the batch load the scene of each job, the instances and a stream are scenes of their own
+	if (!options.points_path.empty() && (options.serve_port != 0 || !options.batch_path.empty() || !options.instances_path.empty() || options.streamed()))
+	{
+		std::cout << "A point cloud is the scene of one render, use --convert-points for the jobs of a server or a batch\n";
+		options.points_path.clear();
+	}
+
+	// the server exists to keep OpenCL contexts warm, it renders every job on the devices
+	if (options.serve_port != 0 && options.backend != render_backend::gpu)
+	{
+		std::cout << "The render server renders with the gpu backend\n";
+		options.backend = render_backend::gpu;
+	}
+
+	// so does the batch, which renders its manifest and exits instead of serving
+	if (!options.batch_path.empty() && (options.backend != render_backend::gpu || options.serve_port != 0))
+	{
+		std::cout << "The batch renders with the gpu backend and doesn't serve\n";
+		options.backend = render_backend::gpu;
+		options.serve_port = 0;
+	}
+
+	// the batch kernels run on the devices, through the structures that don't depend on the window
+	bool batch_mode = options.mode == accel_mode::none || options.mode == accel_mode::bvh || options.mode == accel_mode::sorted;
+
+	if (!options.views_path.empty() && (options.backend != render_backend::gpu || options.num_animated > 0 || options.serve_port != 0 || options.chunk_spheres != 0 || !batch_mode))
+	{
+		std::cout << "Batches of views render on the devices with brute force, bvh or sorted\n";
+		options.backend = render_backend::gpu;
+		options.num_animated = 0;
+		options.serve_port = 0;
+		options.chunk_spheres = 0;
+		options.mode = batch_mode ? options.mode : accel_mode::none;
+	}
+
+	// trace, trace_bvh and trace_sorted write the channels, for the frames of the plain gpu backend
+	bool aov_mode = options.mode == accel_mode::none || options.mode == accel_mode::bvh || options.mode == accel_mode::sorted;
+
+#ifdef RT_COST_COUNTERS
+	// the CPU tracers of the instrumentation build count the cost channel of their frames
+	bool cpu_cost = options.aovs == aov_cost && options.backend == render_backend::cpu && options.num_animated == 0 && options.serve_port == 0 && options.views_path.empty() &&
+	                options.mode != accel_mode::adaptive && options.mode != accel_mode::splat;
+#else
+	bool cpu_cost = false;
+#endif
+
+	if (options.aovs != 0 && !cpu_cost && (options.backend != render_backend::gpu || options.num_animated > 0 || options.serve_port != 0 || !options.views_path.empty() ||
+	                                       options.persistent || options.chunk_spheres != 0 || !aov_mode))
+	{
+		std::cout << "Channels render on the devices with trace, trace_bvh or trace_sorted\n";
+		options.backend = render_backend::gpu;
+		options.num_animated = 0;
+		options.serve_port = 0;
+		options.views_path.clear();
+		options.persistent = false;
+		options.chunk_spheres = 0;
+		options.mode = aov_mode ? options.mode : accel_mode::none;
+	}
+
+	// the bands are rendered by the tiles of the CPU tracers or by band launches on a device, one
+	// frame straight into the file
+	bool band_backend = options.backend == render_backend::cpu || options.backend == render_backend::gpu;
+
+	if (options.tiled && (!band_backend || options.num_animated > 0 || options.serve_port != 0 || !options.views_path.empty() || options.aovs != 0 || options.bench ||
+	                      options.num_frames > 1))
+	{
+		std::cout << "Tiled output streams one frame from the cpu or the gpu backend\n";
+		options.backend = band_backend ? options.backend : render_backend::cpu;
+		options.num_animated = 0;
+		options.serve_port = 0;
+		options.views_path.clear();
+		options.aovs = 0;
+		options.bench = false;
+		options.num_frames = 1;
+	}
+
+	// one device traces the bands, with the kernels that launch one work-item per pixel
+	if (options.tiled && options.backend == render_backend::gpu && (options.multi_gpu || options.persistent || options.chunk_spheres != 0 || options.wavefront ||
+	                                                                options.fast_math))
+	{
+		std::cout << "Tiled output renders on one device without persistent work-groups, sphere streaming, the wavefront pipeline or fast math\n";
+		options.multi_gpu = false;
+		options.persistent = false;
+		options.chunk_spheres = 0;
+		options.wavefront = false;
+		options.fast_math = false;
+	}
+
+	if (options.checkpoint && !options.tiled)
+	{
+		std::cout << "Only --tiled renders keep a checkpoint, rendering without one\n";
+		options.checkpoint = false;
+	}
+
+	// the tiles come from the footprints of the spheres in the ortho view, the planes of
+	// --primitives may cover any of them
+	if (options.sparse && (!options.tiled || options.backend != render_backend::cpu || options.perspective || !options.primitives_path.empty() || options.checkpoint))
+	{
+		std::cout << "Sparse framebuffers hold --tiled ortho frames of the cpu backend without primitives or a checkpoint, rendering every tile\n";
+		options.sparse = false;
+	}
+
+	// a pyramid is one still ortho image of the CPU tracers, culled by the footprints of the
+	// spheres, which the planes of --primitives and the textures don't have
+	if (!options.pyramid_path.empty() && (options.backend != render_backend::cpu || options.plan || options.perspective || !options.primitives_path.empty() ||
+	                                      !options.textures_path.empty() || options.num_animated > 0 ||
+	                                      options.serve_port != 0 || !options.views_path.empty() || options.aovs != 0 || options.tiled || !options.batch_path.empty() ||
+	                                      options.farm_port != 0 || !options.farm_host.empty()))
+	{
+		std::cout << "Pyramids are still ortho frames of the cpu backend without primitives, textures, aovs or --tiled, rendering --output\n";
+		options.pyramid_path.clear();
+	}
+
+	if (options.pyramid.tile_size == 0 || options.pyramid.tile_size % kTileSize != 0)
+	{
+		std::cout << "Pyramid tiles are a multiple of " << kTileSize << " pixels, using " << kPyramidTileSize << "\n";
+		options.pyramid.tile_size = kPyramidTileSize;
+	}
+
+	// the tiles are files of the format of --output, raw images are whole frames
+	auto output_dot = options.output.find_last_of('.');
+	options.pyramid.extension = output_dot == std::string::npos || is_raw_output(options.output) ? "png" : options.output.substr(output_dot + 1);
+
+	// QOI files store 8 bits per channel, quantized from float rgb if need be, and have no OIIO
+	// writer for the other formats
+	if (requires_fast_encoder(options.output) && options.format != pixel_format::rgba8 && options.format != pixel_format::float32 &&
+	    options.format != pixel_format::float4 && !options.tiled)
+	{
+		std::cout << "QOI writes 8-bit pixels, rendering with --format rgba8\n";
+		options.format = pixel_format::rgba8;
+	}
+
+	options.encoding.threads = options.num_threads;
+
+	// the coordinator hands out bands of one ortho frame and renders nothing itself
+	if (options.farm_port != 0 && (options.perspective || options.num_animated > 0 || options.serve_port != 0 || !options.views_path.empty() || options.aovs != 0 ||
+	                               options.tiled || options.bench || options.num_frames > 1 ||
+	                               !options.farm_host.empty()))
+	{
+		std::cout << "The render farm renders one frame with an ortho view\n";
+		options.perspective = false;
+		options.num_animated = 0;
+		options.serve_port = 0;
+		options.views_path.clear();
+		options.aovs = 0;
+		options.tiled = false;
+		options.bench = false;
+		options.num_frames = 1;
+		options.farm_host.clear();
+	}
+
+	if (options.farm_port != 0)
+	{
+		options.backend = render_backend::cpu;
+		options.generate_device = false;
+	}
+
+	// frames go to the shared region from the main frame loop only
+	if (!options.shared_name.empty() && (options.serve_port != 0 || !options.views_path.empty() || options.tiled || options.farm_port != 0 || !options.farm_host.empty()))
+	{
+		std::cout << "Shared frames are published by the frame loop, writing files instead\n";
+		options.shared_name.clear();
+	}
+
+	// the window shows the frames of one device of the frame loop, not the ones of the other paths
+	if (options.preview && (options.backend != render_backend::gpu || options.multi_gpu || options.num_animated > 0 || options.serve_port != 0 ||
+	                        !options.views_path.empty() || options.aovs != 0 || options.tiled ||
+	                        options.farm_port != 0 || !options.farm_host.empty() || !options.shared_name.empty() || options.bench || options.verify || !options.sweep.empty()))
+	{
+		std::cout << "The preview shows the frames of one gpu device, writing files instead\n";
+		options.preview = false;
+	}
+
+	// the frames are copied into the RGBA8 texture as they are
+	if (options.preview && options.format != pixel_format::rgba8)
+	{
+		std::cout << "The preview shares an RGBA8 texture, rendering with --format rgba8\n";
+		options.format = pixel_format::rgba8;
+	}
+
+	// the derived images are made from the frames of the main frame loop
+	if (!options.post_ops.empty() && (options.num_animated > 0 || options.serve_port != 0 || !options.views_path.empty() || options.tiled || options.farm_port != 0 ||
+	                                  !options.farm_host.empty() || !options.shared_name.empty() ||
+	                                  options.preview || options.verify || !options.sweep.empty()))
+	{
+		std::cout << "--post images are made from the frames of the frame loop only, skipping them\n";
+		options.post_ops.clear();
+	}
+
+	// a raw file holds the one frame of the frame loop as it was rendered
+	if (is_raw_output(options.output) && (options.num_animated > 0 || options.serve_port != 0 || !options.views_path.empty() || options.tiled || options.farm_port != 0 ||
+	                                      !options.farm_host.empty() ||
+	                                      !options.shared_name.empty() || options.preview || !options.post_ops.empty() || !options.golden.empty() || options.num_frames > 1))
+	{
+		options.output = file_stem(options.output) + ".exr";
+		std::cout << "A raw file holds a single frame of the frame loop, writing " << options.output << " instead\n";
+	}
+
+	if (options.metrics_port != 0 && options.serve_port == 0)
+	{
+		std::cout << "Only the render server serves metrics, ignoring --metrics-port\n";
+		options.metrics_port = 0;
+	}
+
+	if ((options.server_budget.host != 0 || options.server_budget.device != 0) && options.serve_port == 0)
+	{
+		std::cout << "Only the render server admits jobs within a memory budget, ignoring --host-budget and --device-budget\n";
+		options.server_budget = memory_budget();
+	}
+
+	if (!options.record_path.empty() && options.serve_port == 0)
+	{
+		std::cout << "Only the render server records jobs, ignoring --record-jobs\n";
+		options.record_path.clear();
+	}
+
+	if (options.temporal && options.num_animated == 0)
+	{
+		std::cout << "Only --animate frames reuse the frame before, ignoring --temporal\n";
+		options.temporal = false;
+	}
+
+	if (options.delta_interval != 0 && (options.num_animated == 0 || !options.pipe_command.empty()))
+	{
+		std::cout << "Only --animate frames written to files are stored as deltas, ignoring --delta\n";
+		options.delta_interval = 0;
+	}
+
+	if (!options.pipe_command.empty() && options.num_animated == 0)
+	{
+		std::cout << "Only --animate frames go to the pipe, writing files instead\n";
+		options.pipe_command.clear();
+	}
+
+	// the encoder gets the rgba8 framebuffer or its conversion, whose chroma takes 2x2 blocks
+	if (!options.pipe_command.empty())
+	{
+		if (options.format != pixel_format::rgba8)
+		{
+			std::cout << "Piped frames are 8-bit, rendering with --format rgba8\n";
+			options.format = pixel_format::rgba8;
+		}
+
+		if (options.pipe_layout == pipe_format::yuv420 && (options.view.image_width % 2 != 0 || options.view.image_height % 2 != 0))
+		{
+			std::cout << "yuv420 frames need an even width and height, piping rgba\n";
+			options.pipe_layout = pipe_format::rgba;
+		}
+	}
+
+	// the HIP and Vulkan backends render whole frames on one device with the kernels of
+	// trace.hip or trace.spv
+	if (options.single_device() && (options.mode == accel_mode::splat || options.persistent || options.chunk_spheres != 0 || options.multi_gpu || options.generate_device))
+	{
+		std::cout << "The " << (options.backend == render_backend::hip ? "hip" : "vulkan")
+		          << " backend renders on one device without splatting, persistent work-groups or sphere streaming\n";
+		options.mode = options.mode == accel_mode::splat ? accel_mode::none : options.mode;
+		options.persistent = false;
+		options.chunk_spheres = 0;
+		options.multi_gpu = false;
+		options.generate_device = false;
+	}
+
+	if (options.ray_query && (options.backend != render_backend::vulkan || options.mode != accel_mode::bvh))
+	{
+		std::cout << "Ray queries trace the bvh mode of the vulkan backend, rendering without --ray-query\n";
+		options.ray_query = false;
+	}
+
+	// trace.spv writes rgb float or rgba8 pixels
+	if (options.backend == render_backend::vulkan && (options.format == pixel_format::half || options.format == pixel_format::float4))
+	{
+		std::cout << "The vulkan backend writes no " << pixel_format_name(options.format) << " pixels, rendering with --format float\n";
+		options.format = pixel_format::float32;
+	}
+
+	// the sphere indices of the frame loop and the render farm are colored when the files are
+	// written; trace.hip and trace.spv write colors only
+	if (is_id_format(options.format) && (options.num_animated > 0 || options.serve_port != 0 || !options.batch_path.empty() || !options.views_path.empty() ||
+	                                     options.tiled || options.single_device()))
+	{
+		std::cout << "Sphere indices are rendered by the frame loop of the gpu, cpu and hybrid backends and the render farm, rendering with --format float\n";
+		options.format = pixel_format::float32;
+	}
+
+	if (options.numa_fission && !options.multi_gpu)
+	{
+		std::cout << "This render runs on a single device, using the OpenCL CPU device without NUMA fission\n";
+		options.numa_fission = false;
+	}
+
+	// the copies of the bands end in the one read of the first device, the reads of the other
+	// readback paths come from every device
+	if (options.gather && (!options.multi_gpu || options.backend != render_backend::gpu || options.map_readback || options.num_queues > 1))
+	{
+		std::cout << "Bands are gathered for --multi-gpu frames of the gpu backend read with one copy queue, reading every band back\n";
+		options.gather = false;
+	}
+
+	// the tiles are plain launches of the one kernel per pixel, each read into the frame
+	if (options.num_queues > 1 && (options.map_readback || options.persistent || options.chunk_spheres != 0 || options.wavefront || options.tiled))
+	{
+		std::cout << "Tiles are queued for the one kernel per pixel with copied readback only, using one queue\n";
+		options.num_queues = 1;
+	}
+
+	// the OpenCL kernels and the device frame loops trace the BVH alone
+	if (options.splat_tiny && (options.backend != render_backend::cpu || options.mode != accel_mode::bvh || options.num_animated > 0 || options.serve_port != 0 ||
+	                           !options.views_path.empty() ||
+	                           options.farm_port != 0 || !options.farm_host.empty()))
+	{
+		std::cout << "Tiny spheres are splatted by the frame loop of the cpu backend with --accel bvh only, tracing them through the BVH\n";
+		options.splat_tiny = false;
+	}
+
+	if (options.embree && !embree_available())
+	{
+		std::cout << "This build has no Embree, build with RT_WITH_EMBREE for --backend embree, rendering with --backend cpu\n";
+		options.embree = false;
+	}
+
+	if (options.embree && options.mode != accel_mode::bvh)
+	{
+		std::cout << "Embree builds a BVH, rendering with --accel bvh\n";
+		options.mode = accel_mode::bvh;
+	}
+
+	// Embree's tree holds the spheres of the ortho view, the tiny spheres go into it too and it
+	// counts no tests
+	if (options.embree && (options.perspective || !options.instances_path.empty() || options.splat_tiny || options.aovs != 0))
+	{
+		std::cout << "Embree traces the ortho frames of spheres without instances, tiny sphere splats or channels, rendering with --backend cpu\n";
+		options.embree = false;
+	}
+
+	// the render server, the view list and the farm run their own loops on the pool
+	if (options.runtime != parallel_runtime::pool && (options.backend != render_backend::cpu || options.serve_port != 0 || !options.views_path.empty() ||
+	                                                  options.farm_port != 0 || !options.farm_host.empty()))
+	{
+		std::cout << "The std and tbb runtimes run the frames of the cpu backend only, using the pool\n";
+		options.runtime = parallel_runtime::pool;
+	}
+
+	if (options.runtime != parallel_runtime::pool && !options.affinity.empty())
+	{
+		std::cout << "The " << parallel_runtime_name(options.runtime) << " runtime places its own threads, ignoring --affinity\n";
+		options.affinity.clear();
+	}
+
+	if (!options.farm_host.empty() && (options.backend == render_backend::hybrid || options.single_device()))
+	{
+		std::cout << "Render farm workers render with the gpu or the cpu backend, using the cpu\n";
+		options.backend = render_backend::cpu;
+	}
+
+	// the texture pass shades the sphere indices of the ortho frames of the cpu frame loop, whose
+	// images the references of --verify and the sweeps don't hold
+	if (!options.textures_path.empty() && (options.backend != render_backend::cpu || options.perspective || options.format != pixel_format::float32 || options.serve_port != 0 ||
+	                                       !options.views_path.empty() || options.farm_port != 0 || !options.farm_host.empty() || options.tiled || options.splat_tiny ||
+	                                       options.aovs != 0 || options.verify ||
+	                                       !options.sweep.empty()))
+	{
+		std::cout << "Textures are shaded on the float frames of the cpu backend only, rendering without them\n";
+		options.textures_path.clear();
+	}
+
+	// the primitives are composited the same way, over the colors of the sphere indices
+	if (!options.primitives_path.empty() && (options.backend != render_backend::cpu || options.perspective || options.oriented ||
+	                                         options.format != pixel_format::float32 || options.serve_port != 0 ||
+	                                         !options.views_path.empty() || options.farm_port != 0 || !options.farm_host.empty() || options.tiled || options.splat_tiny ||
+	                                         options.aovs != 0 || options.verify ||
+	                                         !options.sweep.empty()))
+	{
+		std::cout << "Primitives are traced on the float +Z frames of the cpu backend only, rendering the spheres alone\n";
+		options.primitives_path.clear();
+	}
+
+	// the planner picks between the plain frame loops of the gpu and the cpu backend, the paths
+	// and options above hold for a backend or mode of their own
+	if (options.plan && (options.backend == render_backend::hybrid || options.single_device() || options.num_animated > 0 || options.serve_port != 0 ||
+	                     !options.views_path.empty() || options.farm_port != 0 ||
+	                     !options.farm_host.empty() || options.verify || !options.sweep.empty() || options.aovs != 0 || options.tiled || options.preview ||
+	                     options.perspective || options.splat_tiny || !options.instances_path.empty() ||
+	                     options.generate_device || options.persistent || options.chunk_spheres != 0 || options.wavefront || options.runtime != parallel_runtime::pool ||
+	                     !options.textures_path.empty() ||
+	                     !options.primitives_path.empty()))
+	{
+		std::cout << "The planner picks the backend and mode of plain gpu and cpu frames only, rendering with --backend and --accel\n";
+		options.plan = false;
+	}
+
+	// the devices are set up while the scene loads in case the plan picks them
+	if (options.plan)
+		options.backend = render_backend::gpu;
+
+	// the transform is built into the OpenCL kernels, the other backends and the references of
+	// --verify write the colors as they are
+	if (!options.transform.identity() && (options.backend != render_backend::gpu || options.plan || is_id_format(options.format) || options.verify))
+	{
+		std::cout << "The output transform runs in the kernels of the gpu backend on colors only, writing them as they are\n";
+		options.transform = output_transform();
+	}
+
+	// the statistics reduce the sphere ids a frame leaves on the devices: the image itself with
+	// the id formats, the id channel of trace, trace_bvh and trace_sorted with the others
+	bool stats_ids = is_id_format(options.format) || ((options.mode == accel_mode::none || options.mode == accel_mode::bvh || options.mode == accel_mode::sorted) &&
+	                                                  options.instances_path.empty() && !options.persistent &&
+	                                                  options.chunk_spheres == 0);
+
+	if (options.stats && (options.backend != render_backend::gpu || options.plan || options.serve_port != 0 || !options.views_path.empty() || options.farm_port != 0 ||
+	                      !options.farm_host.empty() || options.tiled || !stats_ids))
+	{
+		std::cout << "Frame statistics are reduced on the frames of the gpu backend traced by trace, trace_bvh or trace_sorted or into sphere indices, rendering without them\n";
+		options.stats = false;
+	}
+
+	if (options.stats && options.aovs != 0 && !is_id_format(options.format) && (options.aovs & aov_id) == 0)
+	{
+		std::cout << "Frame statistics read the id channel, writing it too\n";
+		options.aovs |= aov_id;
+	}
+
+	// the pyramid is built on the devices of the gpu frame loop from the colors of the frame as
+	// they go to its file
+	if (options.mip_levels > 1 && (options.backend != render_backend::gpu || options.plan || is_id_format(options.format) || options.tiled || options.serve_port != 0 ||
+	                               !options.views_path.empty() || options.farm_port != 0 ||
+	                               !options.farm_host.empty() || !options.post_ops.empty() || !options.shared_name.empty() || is_raw_output(options.output)))
+	{
+		std::cout << "MIP levels are built for the color frames the gpu backend writes to image files unchanged, writing none\n";
+		options.mip_levels = 0;
+	}
+
+	// the frames are compressed on the one device of the gpu frame loop that traces them whole,
+	// into the files of the fast encoders
+	if (options.device_encode && (options.backend != render_backend::gpu || options.format != pixel_format::rgba8 || options.codec() == device_codec::none ||
+	                              options.multi_gpu || options.num_animated > 0 || options.plan ||
+	                              options.tiled || options.num_queues > 1 || options.mip_levels > 1 || options.preview || options.serve_port != 0 ||
+	                              !options.batch_path.empty() || !options.views_path.empty() || options.farm_port != 0 ||
+	                              !options.farm_host.empty() || !options.post_ops.empty() || !options.shared_name.empty() || options.verify || !options.sweep.empty()))
+	{
+		std::cout << "Frames are encoded on one device from the rgba8 frames of the gpu backend written unchanged to .qoi or fast .png files, reading them back\n";
+		options.device_encode = false;
+	}
+
+	// the hits of the one view of the whole scene, on the CPU threads or the one device that holds it
+	if (options.nearest_hits != 0 && (!nearest_hits_supported(options.nearest_hits) ||
+	                                  (options.backend != render_backend::cpu && options.backend != render_backend::gpu) || options.perspective ||
+	                                  !options.instances_path.empty() || options.occlusion_cull || options.multi_gpu || options.chunk_spheres != 0 ||
+	                                  options.num_animated > 0 || options.serve_port != 0 ||
+	                                  !options.batch_path.empty() || !options.views_path.empty() || options.farm_port != 0 || !options.farm_host.empty() ||
+	                                  options.tiled || options.verify || !options.sweep.empty()))
+	{
+		std::cout << "The 2, 4, 8 or 16 nearest hits are traced for the one ortho view of the cpu or gpu backend, without instances or occlusion culling\n";
+		options.nearest_hits = 0;
+	}
+
+	// the one batch of rays through the whole scene, on the CPU threads or the first device
+	if (!options.query_rays_path.empty() && ((options.backend != render_backend::cpu && options.backend != render_backend::gpu) || !options.instances_path.empty() ||
+	                                         options.chunk_spheres != 0 ||
+	                                         options.num_animated > 0 || options.serve_port != 0 || !options.batch_path.empty() || !options.views_path.empty() ||
+	                                         options.farm_port != 0 ||
+	                                         !options.farm_host.empty() || options.tiled || options.verify || !options.sweep.empty() || options.bench))
+	{
+		std::cout << "Ray queries run once on the cpu or gpu backend, over spheres held whole\n";
+		options.query_rays_path.clear();
+	}
+
+	if (!options.query_rays_path.empty())
+	{
+		options.cull = false;
+		options.occlusion_cull = false;
+	}
+
+	if (options.mip_levels > kMaxMipLevels)
+	{
+		std::cout << "A work-group tile makes at most " << kMaxMipLevels << " MIP levels, writing that many\n";
+		options.mip_levels = kMaxMipLevels;
+	}
+
+	// the edges are found in the id channel of the color frames of the gpu frame loop, the
+	// other backends and paths trace one sample per pixel
+	if (options.aa_grid > 1 && (options.backend != render_backend::gpu || options.plan || is_id_format(options.format) || options.tiled || options.aovs != 0 ||
+	                            options.serve_port != 0 || !options.views_path.empty() ||
+	                            options.farm_port != 0 || !options.farm_host.empty()))
+	{
+		std::cout << "Edges are antialiased in the color frames of the gpu backend without channels, tracing one sample per pixel\n";
+		options.aa_grid = 0;
+	}
+
+	if (options.aa_grid > kMaxAaGrid)
+	{
+		std::cout << "Edge pixels take at most " << kMaxAaGrid << "x" << kMaxAaGrid << " samples, using that many\n";
+		options.aa_grid = kMaxAaGrid;
+	}
+
+	// the reflections start from the id channel of the gpu frame loop like the edges of --aa,
+	// whose pixels they would overwrite
+	if (options.bounces > 0 && (options.backend != render_backend::gpu || options.plan || is_id_format(options.format) || options.tiled || options.aovs != 0 ||
+	                            options.serve_port != 0 || !options.views_path.empty() ||
+	                            options.farm_port != 0 || !options.farm_host.empty()))
+	{
+		std::cout << "Hits reflect in the color frames of the gpu backend without channels, not reflecting\n";
+		options.bounces = 0;
+	}
+
+	if (options.bounces > 0 && options.aa_grid > 1)
+	{
+		std::cout << "Reflecting frames trace one sample per pixel, not antialiasing\n";
+		options.aa_grid = 0;
+	}
+
+	if (options.bounces > kMaxBounces)
+	{
+		std::cout << "Hits reflect at most " << kMaxBounces << " times, using that many bounces\n";
+		options.bounces = kMaxBounces;
+	}
+
+	if (!(options.reflectivity >= 0.f && options.reflectivity <= 1.f))
+	{
+		std::cout << "The reflectivity is between 0 and 1, using 0.5\n";
+		options.reflectivity = 0.5f;
+	}
+
+	return true;
+}
+
+std::vector<std::pair<char const*, bool*>> snapshot_flags(run_options& options)
+{
+	return {
+		{ "hint", &options.neighbour_hint }, { "compress-bvh", &options.compressed_bvh }, { "treelets", &options.treelets }, { "depth-bounds", &options.depth_bounds },
+		{ "half-spheres", &options.half_spheres }, { "persistent", &options.persistent }, { "coarsen", &options.coarsen }, { "image-reads", &options.image_reads },
+		{ "async-prefetch", &options.async_prefetch }, { "fast-math", &options.fast_math }, { "swizzle", &options.swizzle }
+	};
+}
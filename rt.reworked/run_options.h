@@ -0,0 +1,412 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "accel.h"
+#include "camera.h"
+#include "config.h"
+#include "cpu_trace.h"
+#include "devices.h"
+#include "image_writer.h"
+#include "job_memory.h"
+#include "output_transform.h"
+#include "parallel_executors.h"
+#include "pipe_writer.h"
+#include "pixel_format.h"
+#include "point_import.h"
+#include "post_process.h"
+#include "render_device.h"
+#include "scene.h"
+#include "thread_scaling.h"
+#include "tile_pyramid.h"
+
+// Backends of --backend
+enum class render_backend
+{
+	gpu,
+	cpu,
+	hybrid,
+	hip,
+	vulkan
+};
+
+// The options of the command line of a run, read by parse_run_options and settled by
+// resolve_run_options
+struct run_options
+{
+	// --accel none|bvh|grid|splat|sorted|adaptive selects how the closest sphere is found, see accel_mode;
+	// --hint starts the bvh and sorted rays with a neighbour's sphere, see render_scene
+	accel_mode mode = accel_mode::none;
+	bool neighbour_hint = false;
+	// --tile-order scanline|morton|hilbert is the order the cpu backend issues its tiles in, see
+	// tile_order; their side follows from the L2 of a worker (cache_tile_size)
+	tile_order tiles = tile_order::scanline;
+	// --balance renders the frames of the cpu backend in work items of equal cost instead, the
+	// tiles split and merged by their times in the frame before (render_balanced)
+	bool balance = false;
+	// --compress-bvh traces the bvh on the OpenCL devices in the compressed node layout
+	bool compressed_bvh = false;
+	// --treelets lays the wide and compressed bvh nodes out in page sized treelets, see layout_treelets
+	bool treelets = false;
+	// --no-cull keeps the spheres the view can't see in the set the backends trace, see cull_scene
+	bool cull = true;
+	// --occlusion-cull also drops the spheres nearer ones hide, see cull_hidden_spheres
+	bool occlusion_cull = false;
+	// --morton-spheres stores the spheres in the Z-order of their centers, see morton_order_spheres
+	bool morton_spheres = false;
+	// --depth-bounds prunes the grid cell lists of grid and adaptive by the depth of the nearer
+	// spheres covering a whole cell, see prune_grid_depth
+	bool depth_bounds = false;
+	// --skip-background writes the background of the pixels no sphere covers without tracing
+	// them, on the cpu backend and in the wavefront pipeline, see render_scene::skip_background
+	bool skip_background = false;
+	// --half-spheres tests fp16 copies of the spheres before the float ones in brute force, see
+	// render_scene::half_spheres
+	bool half_spheres = false;
+	// --splat-tiny leaves the spheres covering a pixel or two out of the BVH and splats them
+	// after the rays traced it, on the cpu backend, see render_scene::splat_tiny
+	bool splat_tiny = false;
+	// --camera eye_x,eye_y,eye_z,target_x,target_y,target_z,fov_y[,far] renders through a pinhole
+	// camera, on the CPU
+	bool perspective = false;
+	pinhole_camera pinhole;
+	// --view-dir dx,dy,dz[,up_x,up_y,up_z] turns the ortho view to look along d (see
+	// ortho_view_matrix): the spheres are moved into its space once, where its rays run along +Z
+	// and every tracer and kernel renders them as they are. The default +Z view leaves them.
+	bool oriented = false;
+	ortho_orientation orientation;
+	// --size WxH, --spheres N and --view left,bottom,width,height,near,far override config.h,
+	// the kernels are built for them
+	ortho_view view = default_view();
+	std::uint32_t num_spheres = kNumSpheres;
+	// --scene file renders the spheres of a binary scene file instead of generating them, the
+	// mapped arrays back the device buffers; --save-scene file writes the scene, and the BVH
+	// of --accel bvh, to one
+	std::string scene_path;
+	std::string save_scene;
+	// --snapshot file writes the scene with its BVH, the settings, the tuned values and the
+	// program binaries of the devices to one file once they are ready (snapshot.h); --restore
+	// file starts from one, with the settings it holds, instead of generating, tuning and compiling
+	std::string snapshot_path;
+	std::string restore_path;
+	// --points file renders a point cloud (see import_points), .csv, .txt, .ply or .las, a sphere
+	// of --point-radius R per point without a radius of its own; --fit-points scales it into the
+	// default view. --convert-points file out writes the cloud to the binary scene file out and exits.
+	std::string points_path;
+	point_import_options point_options;
+	std::string convert_points, convert_output;
+	// --stream-scene file renders the spheres of the batches of file (see sphere_batches.h),
+	// a named pipe an upstream simulation writes them to or /dev/stdin, --stream-port PORT the
+	// ones a client sends to 127.0.0.1:PORT: the devices trace every batch as it arrives and
+	// write the image once the stream ends (see run_scene_stream)
+	std::string stream_scene;
+	std::uint16_t stream_port = 0;
+	// --instances file renders the copies of sphere clusters of an instance file (see
+	// read_instance_file) in place of both. Frames of the gpu backend with --accel bvh trace
+	// them through a two level BVH, so the devices hold every cluster once; everything else
+	// renders the expanded scene.
+	std::string instances_path;
+	// --textures file maps images onto the spheres of the cpu backend (see read_texture_file):
+	// the frame is traced into sphere indices and the textured hits are looked up through a
+	// texture cache of at most --texture-cache MB, 256 by default (see texture_shader)
+	std::string textures_path;
+	float texture_cache_mb = 256.f;
+	// --primitives file adds the planes, boxes and capsules of a primitive file (see
+	// read_primitive_file) to the spheres of the cpu backend: the frame is traced into sphere
+	// indices and the primitives are composited over its colors type by type (see
+	// composite_primitives)
+	std::string primitives_path;
+	// --generator msvc|philox selects the random sequence generated scenes are drawn from, they
+	// are generated on all CPU threads; --generate-on-device draws the philox scene on the device
+	scene_generator generator = scene_generator::msvc;
+	bool generate_device = false;
+	// --backend gpu renders with OpenCL only, cpu with the thread pool only, hybrid with both
+	// pulling bands of rows from one queue, hip with trace.hip on one HIP device and vulkan
+	// with trace.spv on one Vulkan device
+	render_backend backend = render_backend::gpu;
+	// --ray-query traces the bvh mode of the vulkan backend with trace_rq.spv, through an
+	// acceleration structure of the driver in the ray tracing units in place of the BVH
+	bool ray_query = false;
+	// --backend embree is the cpu backend tracing the bvh mode through the BVH Embree builds
+	// over the spheres, in builds with RT_WITH_EMBREE (see render_scene::embree)
+	bool embree = false;
+	// --plan picks the backend, gpu or cpu, and the mode with the lowest time predicted from the
+	// statistics of the loaded scene in place of --backend and --accel, then logs the time the
+	// frame took to calibrate later plans (see render_planner.h)
+	bool plan = false;
+	// --threads N and --isa scalar|sse4|avx2|avx512 configure the CPU backend
+	std::uint32_t num_threads = std::thread::hardware_concurrency();
+	simd_isa isa = detect_simd_isa();
+	// --affinity none|node|compact|scatter|physical places the workers of the cpu and hybrid
+	// backends (see thread_affinity); without it the cpu backend pins them to the NUMA nodes and
+	// the hybrid one leaves them to the OS
+	std::vector<thread_affinity> affinity;
+	// --runtime pool|std|tbb runs the tiles of the cpu backend's frames on the built-in pool,
+	// the parallel std algorithms or a TBB arena, see parallel_executors.h
+	parallel_runtime runtime = parallel_runtime::pool;
+	// --no-cache always compiles trace.cl instead of loading a cached program binary
+	bool use_cache = true;
+	// --tune times the work-group sizes the kernel allows and stores the fastest per device,
+	// later runs launch with the stored one
+	bool tune = false;
+	// --device N|name picks the device by position in the ranked list or by name,
+	// the RT_DEVICE environment variable does the same
+	std::string device_selector;
+	// --peak [name=]GFLOPS,GB/s gives the peaks of the devices whose name contains name, or of
+	// all of them, for the roofline report after each frame (print_throughput); the flops are
+	// estimated otherwise and the bandwidth is left out
+	std::vector<device_peak> peaks;
+	// --multi-gpu splits every frame across all GPUs, --frames N renders N frames and
+	// rebalances the split from the kernel times of the previous frame
+	bool multi_gpu = false;
+	std::uint32_t num_frames = 1;
+	// --gather opens the GPUs of --multi-gpu in one context and copies their bands into the
+	// first one, device to device, which reads the whole frame back once (render_device::gather)
+	bool gather = false;
+	// --numa-fission splits the OpenCL CPU device of --device into a sub-device per NUMA node
+	// (split_numa_domains), each with a queue and a copy of the scene of its own, and renders
+	// every frame across them in bands as --multi-gpu does across GPUs
+	bool numa_fission = false;
+	// --animate N renders N frames of a turntable animation through the pipelined brute force
+	// path, or with --accel bvh through a BVH rebuilt on the device every frame
+	std::uint32_t num_animated = 0;
+	// --refit X refits the device BVH of --animate --accel bvh between builds, until the SAH
+	// cost grows by a factor of X; 0 builds every frame
+	double refit_threshold = 0.0;
+	// --temporal reuses the frame before in every --animate frame: the tiles no moving sphere
+	// covers are copied from it, the other pixels test the sphere they hit in it first
+	bool temporal = false;
+	// --delta N writes the --animate frames to a delta container, stem.rtd, as the tiles that
+	// changed since the frame before with a keyframe of every tile each N frames; only the
+	// changed tiles are read back
+	std::uint32_t delta_interval = 0;
+	// --pipe command streams the --animate frames into the standard input of the encoder
+	// command, in the raw layout of --pipe-format, instead of writing a file per frame
+	std::string pipe_command;
+	pipe_format pipe_layout = pipe_format::rgba;
+	// --readback map maps host allocated output buffers instead of copying with a read
+	bool map_readback = false;
+	// --queues N issues the band of every device as tiles round-robin to N in-order queues, so
+	// the read of a tile overlaps the kernel of the next; see render_device::num_queues
+	std::uint32_t num_queues = 1;
+	// --persistent traces brute force with persistent work-groups pulling tiles from an atomic counter
+	bool persistent = false;
+	// --coarsen lets brute force trace blocks of 2x1, 2x2 or 4x1 pixels per work-item where the
+	// tuning found that faster, see render_device::coarsen
+	bool coarsen = false;
+	// --image-reads lets brute force read the sphere geometry from an image through the texture
+	// cache where the tuning found that faster, see render_device::image_reads
+	bool image_reads = false;
+	// --async-prefetch double buffers the sphere batches of the local memory brute force kernel,
+	// see render_device::async_prefetch
+	bool async_prefetch = false;
+	// --svm puts the scene arrays into OpenCL 2.0 shared virtual memory the kernels read in place,
+	// fine-grained where the device has it, instead of uploading them
+	bool svm = false;
+	// --fast-math also builds the kernels with -cl-fast-relaxed-math and native sqrt and
+	// reciprocals and uses them on a device if their first frame there matches the strict
+	// build's, within --ulps N steps of the pixel format
+	bool fast_math = false;
+	// --kernel-report prints the build log of every program build of a device and the private
+	// and local memory, work-group limits, registers and spills where the compiler logs them,
+	// and estimated occupancy of its kernels (render_device::kernel_report)
+	bool kernel_report = false;
+	// --swizzle launches trace_bvh and trace_sorted over 8x8 pixel blocks in Morton order
+	bool swizzle = false;
+	// --wavefront traces brute force, bvh and sorted scenes with the pipeline of ray generation,
+	// intersection, compaction and shading kernels instead of one kernel per pixel
+	bool wavefront = false;
+	// --chunk N streams brute force spheres to the devices N at a time, scenes that don't fit
+	// into device memory are streamed without it
+	std::uint32_t chunk_spheres = 0;
+	// --format float|half|rgba8|float4 selects the framebuffer the kernels write, float4 being
+	// rgb floats padded to one 16-byte store per pixel, id16|id32 the index
+	// of the closest sphere per pixel, 2 or 4 bytes instead of 12, colored when the frame is
+	// written; --output the file it is saved to. The encoders of image_encoders.h write .png,
+	// .ppm and .qoi files, OIIO the other formats it picks from the extension, e.g. .exr or .tif.
+	// A .rtraw output is a raw_image_file the frame is read back into directly, in the pixels
+	// of --format.
+	// Files are encoded on a background thread while the next frame renders.
+	pixel_format format = pixel_format::float32;
+	std::string output = "result.png";
+	// PNG files are written by the parallel encoder of image_encoders.h on --threads threads;
+	// --encoder oiio or --png-level N, the zlib level from 0 to 9, write them with OIIO's PNG
+	// writer instead. The encoders take 8-bit pixels and quantize float ones.
+	image_encoding encoding;
+	// --verify renders with every backend and acceleration mode and compares against the
+	// reference tracer instead of writing a file, --ulps N is the tolerance in float steps
+	bool verify = false;
+	std::uint32_t max_ulps = 0;
+	// --compare file checks the written image against a golden image, --tolerance X is the
+	// largest difference a channel may have
+	std::string golden;
+	float tolerance = 0.f;
+	// --post thumb:WxH|crop:x,y,WxH|srgb, repeatable, saves images derived from every frame of
+	// the frame loop next to it, made by OIIO from the framebuffer in place (post_process.h)
+	std::vector<post_op> post_ops;
+	// --exposure STOPS, --oetf linear|srgb and --lut file transform the colors in the kernels of
+	// the gpu backend as they write the framebuffer (output_transform.h), in place of a pass over
+	// the frame on the host such as --post srgb
+	output_transform transform;
+	// --stats reduces every frame of the gpu backend on the devices to the range and mean of its
+	// channels, the fraction of pixels that hit a sphere and the pixels each sphere won, and
+	// prints them (frame_stats in render_device.h); the image is not read back for them
+	bool stats = false;
+	// --mip N also writes N - 1 smaller MIP levels of every frame of the gpu backend, each 2x box
+	// filtered from the one before on the devices (build_mips in trace.cl): into the --output
+	// file itself for TIFF and OpenEXR, as result.1.png, result.2.png ... for other formats
+	std::uint32_t mip_levels = 0;
+	// --device-encode compresses every frame of the gpu backend on its device into the .qoi or
+	// .png file the writer would encode (encode_frame in render_device.h), so only the
+	// compressed bytes are read back instead of the rgba8 image
+	bool device_encode = false;
+	// --nearest-hits K also traces the K nearest hits of the ray of every pixel of the last frame
+	// of the cpu or gpu backend in one pass (render_nearest_hits, query_nearest_hits), writes their
+	// distances and sphere indices to EXRs of K channels next to --output (see
+	// nearest_hits_file_name) and prints the depth complexity of the view; K is 2, 4, 8 or 16
+	std::uint32_t nearest_hits = 0;
+	// --query-rays rays hits traces the batch of arbitrary rays in the file rays (load_ray_batch)
+	// on the cpu or gpu backend instead of rendering, and writes the closest hit of every ray to
+	// the file hits (closest_hits in ray_queries.h, query_rays). --sort-rays traces them in the
+	// order of their coherence keys. No sphere is culled, the rays go anywhere.
+	std::string query_rays_path, query_hits_path;
+	bool sort_query_rays = false;
+	// --aa N antialiases the edges of the frames of the gpu backend: pixels whose 3x3
+	// neighbourhood holds more than one sphere are traced again with N x N stratified samples on
+	// the devices, the others keep their one sample (render_device::aa_grid)
+	std::uint32_t aa_grid = 0;
+	// --bounces N reflects the hits of the frames of the gpu backend N times, each bounce mixing
+	// in --reflectivity X of what its rays hit (0.5 by default); the rays of every bounce are
+	// sorted for coherence before they are traced unless --unsorted-bounces, which gives the
+	// intersection times the sort is weighed against (render_device::bounces)
+	std::uint32_t bounces = 0;
+	float reflectivity = 0.5f;
+	bool sort_bounces = true;
+	// --bench times --runs N frames after --warmup K untimed ones and writes only the last,
+	// --json file saves the statistics. --sweep spheres|sizes|all benchmarks every backend
+	// over a range of sphere counts or image sizes instead, into sweep_<name>.csv.
+	// --sweep threads times the cpu backend on 1, 2, 4 ... --threads workers for each of
+	// --tile-sizes and --affinities (see thread_scaling.h), into sweep_threads.csv.
+	std::string sweep;
+	std::vector<std::uint32_t> tile_sizes = { kTileSize };
+	std::vector<thread_affinity> affinities = { thread_affinity::none };
+	// --microbench times the hit tests of the brute force tracers alone for each instruction set
+	// up to --isa on synthetic batches (see intersect_bench.h), into microbench_intersect.csv
+	bool microbench = false;
+	// --compare-bench baseline current compares two --json files of --bench and exits with 1 if
+	// a case got slower beyond the noise of both runs
+	std::string compare_baseline, compare_current;
+	bool bench = false;
+	std::uint32_t warmup = 3;
+	std::uint32_t runs = 20;
+	std::string json;
+	// --trace-out file writes a Chrome trace of the run to file: the stages of every thread, the
+	// CPU tiles and the OpenCL commands on one clock (see timeline.h)
+	std::string trace_out;
+	// --memory lists every device allocation with its size, flags and lifetime and the peak host
+	// RSS at the end of the run (see device_memory.h); the benchmark JSON always has the totals
+	bool memory_report = false;
+	// --serve PORT keeps the devices set up and renders the jobs clients send to 127.0.0.1:PORT,
+	// any number of client processes at once, one line of --scene/--spheres/--generator/--size/
+	// --view/--accel/--output options each, on top of the ones given here; scenes and images
+	// may go through shared memory (--scene-shm, --shared, see run_server)
+	std::uint16_t serve_port = 0;
+	// --batch manifest renders every line of manifest, job options as for --serve (--seed N
+	// picks the sequence of the generator), on top of the ones given here, in one process and
+	// device setup, then exits (see run_batch)
+	std::string batch_path;
+	// --tile-cache MB keeps the tiles the server rendered in up to MB of memory and renders only
+	// the tiles of a job no earlier job rendered, --tile-cache-dir path writes the tiles evicted
+	// from memory to path and reads them back from there
+	std::size_t tile_cache_mb = 0;
+	std::string tile_cache_dir;
+	// --scene-cache F keeps the scenes of earlier jobs, with their structures, on the devices in
+	// up to the share F of their memory, so a job returning to one renders without uploading it
+	double scene_cache_share = 0.0;
+	// --metrics-port PORT serves the histograms and counters of the server's jobs at
+	// http://127.0.0.1:PORT/metrics for Prometheus (see serve_metrics)
+	std::uint16_t metrics_port = 0;
+	// --host-budget MB and --device-budget MB bound the memory the server's jobs are estimated to
+	// take, on the devices the memory of the smallest one by default; jobs over them render in
+	// bands or are refused (see run_server)
+	memory_budget server_budget;
+	// --record-jobs file records the lines the server receives, with their times, scene hashes
+	// and image sizes, to the job trace file (see job_trace.h)
+	std::string record_path;
+	// --replay file PORT sends the jobs of the trace file to the server on 127.0.0.1:PORT at
+	// their recorded times divided by --replay-rate X and writes their latency percentiles,
+	// throughput and queueing delays as JSON to --json or the console, then exits (see
+	// replay_jobs)
+	std::string replay_path;
+	std::uint16_t replay_port = 0;
+	double replay_rate = 1.0;
+	// --views file renders the windows left,bottom,width,height of file, one per line, on the image
+	// size, near and far of --view in one launch per device and writes them one below the other
+	// into --output
+	std::string views_path;
+	// --aov depth,id,normal,cost also writes those channels of the frame, rendered in the same
+	// launch, to one EXR each next to --output (see aov_file_name): the hit depth as float, the
+	// sphere index as uint (0xffffffff for the background), the normal as three floats and the
+	// sphere tests and BVH node visits of each ray as two uints. The cost channel also goes to a
+	// heatmap next to them (cost_heatmap_file_name) and its statistics to the console; builds
+	// with RT_COST_COUNTERS count it on the cpu backend too (render_cost).
+	std::uint32_t aovs = 0;
+	// --tiled writes --output as a tiled EXR or TIFF band by band while the CPU threads or one
+	// device render, so the image is never held in host or device memory as a whole (see the
+	// render_streamed overloads). --checkpoint keeps the bands written so far in
+	// output.checkpoint, and a rerun of the same render takes them from there and renders the
+	// others; the checkpoint is deleted once the file is complete. --sparse traces and keeps
+	// only the tiles a sphere touches on the CPU threads and writes the others as the
+	// background, for huge images of sparse scenes (see render_sparse).
+	bool tiled = false;
+	bool checkpoint = false;
+	bool sparse = false;
+	// --pyramid path renders a zoomable tile pyramid instead of --output, the Deep Zoom file
+	// path.dzi and its tiles or the xyz tree in the directory path (--pyramid-layout), in tiles
+	// of --pyramid-tile pixels in the file format of the extension of --output. Every level is
+	// traced at its own resolution on the CPU threads, see render_pyramid.
+	std::string pyramid_path;
+	pyramid_options pyramid;
+	// --farm PORT coordinates a render farm: it waits for --farm-workers N workers on PORT, hands
+	// them the bands of one frame and writes --output (see run_farm_coordinator). --farm-worker
+	// host:port renders bands for the coordinator there with the gpu or the cpu backend.
+	std::uint16_t farm_port = 0;
+	std::uint32_t farm_workers = 1;
+	std::string farm_host;
+	std::uint16_t farm_host_port = 0;
+	// --shared name publishes every frame into the named shared memory name instead of --output,
+	// --shared-file path into a memory mapped file, for another process to map (see
+	// shared_framebuffer.h). The channels of --aov still go to files.
+	std::string shared_name;
+	bool shared_is_file = false;
+	// --preview shows the frames of the gpu backend in a window whose GL texture the device
+	// writes through cl_khr_gl_sharing (gl_preview.h) instead of writing --output, until the
+	// window is closed or --frames N > 1 frames were shown
+	bool preview = false;
+
+	// Whether the scene arrives in batches, of --stream-scene or --stream-port
+	bool streamed() const;
+	// Whether the hip or the vulkan backend renders, on one device with kernels of their own
+	bool single_device() const;
+	// Codec the writer encodes --output with that --device-encode can run on a device
+	device_codec codec() const;
+};
+
+// Read the options of argv into options. Returns false after printing the usage if an argument
+// is none of them or lacks its value.
+bool parse_run_options(int argc, char** argv, run_options& options);
+
+// Settle the options parse_run_options read: take the settings of the snapshot of --restore,
+// and drop or replace every option the path of the run doesn't render with, with a message
+// each, so the rest of the run takes them as they are. Returns false if the snapshot can't be
+// read.
+bool resolve_run_options(run_options& options);
+
+// The settings of options that pick the structure and the kernel variants, by the names a
+// snapshot stores them under as 0 or 1
+std::vector<std::pair<char const*, bool*>> snapshot_flags(run_options& options);
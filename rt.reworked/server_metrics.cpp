@@ -0,0 +1,163 @@
+#include "server_metrics.h"
+
+#include "device_memory.h"
+#include "line_server.h"
+#include "program_cache.h"
+
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	std::string number(double value)
+	{
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.9g", value);
+		return text;
+	}
+
+	void write_header(std::string& out, char const* name, char const* help, char const* type)
+	{
+		out += std::string("# HELP ") + name + " " + help + "\n";
+		out += std::string("# TYPE ") + name + " " + type + "\n";
+	}
+
+	void write_value(std::string& out, char const* name, char const* help, char const* type, double value)
+	{
+		write_header(out, name, help, type);
+		out += std::string(name) + " " + number(value) + "\n";
+	}
+
+	// A counter of hits and misses under a label each, and the hit rate as a gauge of its own
+	void write_cache(std::string& out, char const* cache, std::uint64_t hits, std::uint64_t misses)
+	{
+		std::string name = std::string("rt_") + cache + "_cache";
+
+		write_header(out, (name + "_lookups_total").c_str(), "Cache lookups by result", "counter");
+		out += name + "_lookups_total{result=\"hit\"} " + std::to_string(hits) + "\n";
+		out += name + "_lookups_total{result=\"miss\"} " + std::to_string(misses) + "\n";
+
+		write_value(out, (name + "_hit_ratio").c_str(), "Share of the lookups that hit, 0 before the first", "gauge",
+		            hits + misses > 0 ? double(hits) / double(hits + misses) : 0.0);
+	}
+
+	// The status line and headers of an HTTP/1.1 answer closing the connection, the body follows
+	bool write_response(line_server& client, char const* status, std::string const& body)
+	{
+		return client.write_line(std::string("HTTP/1.1 ") + status + "\r") && client.write_line("Content-Type: text/plain; version=0.0.4\r") &&
+		       client.write_line("Content-Length: " + std::to_string(body.size()) + "\r") && client.write_line("Connection: close\r") &&
+		       client.write_line("\r") && (body.empty() || client.write_line(body.substr(0, body.size() - 1)));
+	}
+}
+
+void latency_histogram::observe(double ms)
+{
+	double seconds = ms / 1000.0;
+	std::size_t b = 0;
+
+	while (b < kLatencyBuckets - 1 && seconds > kLatencyBounds[b])
+	{
+		++b;
+	}
+
+	buckets_[b].fetch_add(1, std::memory_order_relaxed);
+	sum_us_.fetch_add(static_cast<std::uint64_t>(ms * 1000.0 + 0.5), std::memory_order_relaxed);
+}
+
+void latency_histogram::write(std::string& out, char const* name, char const* help) const
+{
+	write_header(out, name, help, "histogram");
+
+	// the buckets are read one by one while others count, the +Inf one is their sum so the
+	// cumulative counts never decrease
+	std::uint64_t cumulative = 0;
+
+	for (std::size_t b = 0; b < kLatencyBuckets; ++b)
+	{
+		cumulative += buckets_[b].load(std::memory_order_relaxed);
+		auto bound = b < kLatencyBuckets - 1 ? number(kLatencyBounds[b]) : std::string("+Inf");
+		out += std::string(name) + "_bucket{le=\"" + bound + "\"} " + std::to_string(cumulative) + "\n";
+	}
+
+	out += std::string(name) + "_sum " + number(sum_us_.load(std::memory_order_relaxed) / 1e6) + "\n";
+	out += std::string(name) + "_count " + std::to_string(cumulative) + "\n";
+}
+
+std::string format_metrics(server_metrics const& metrics)
+{
+	std::string out;
+
+	metrics.job.write(out, "rt_job_seconds", "Time to the answer of a job, from the start of its batch");
+	metrics.build.write(out, "rt_build_seconds", "Kernel builds or program binary loads of the devices set up for a job");
+	metrics.upload.write(out, "rt_upload_seconds", "Scene uploads of the devices set up for a job");
+	metrics.kernel.write(out, "rt_kernel_seconds", "Kernel time of a job, summed over the devices");
+	metrics.readback.write(out, "rt_readback_seconds", "Readback time of a job, summed over the devices");
+	metrics.encode.write(out, "rt_encode_seconds", "Encoding and writing the image of a job");
+
+	write_value(out, "rt_queue_depth", "Jobs taken in and not answered yet", "gauge", double(metrics.queue_depth.load(std::memory_order_relaxed)));
+
+	auto jobs = metrics.jobs.load(std::memory_order_relaxed);
+	auto uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - metrics.started).count();
+
+	write_value(out, "rt_jobs_total", "Jobs answered", "counter", double(jobs));
+	write_value(out, "rt_failed_jobs_total", "Jobs answered with an error", "counter", double(metrics.failed_jobs.load(std::memory_order_relaxed)));
+	write_value(out, "rt_banded_jobs_total", "Jobs rendered in bands to fit the device memory budget", "counter",
+	            double(metrics.banded_jobs.load(std::memory_order_relaxed)));
+	write_value(out, "rt_refused_jobs_total", "Jobs refused as they don't fit the memory budgets", "counter",
+	            double(metrics.refused_jobs.load(std::memory_order_relaxed)));
+	write_value(out, "rt_jobs_per_second", "Jobs answered per second since the server started, rate(rt_jobs_total) for a window", "gauge",
+	            uptime > 0.0 ? jobs / uptime : 0.0);
+	write_value(out, "rt_uptime_seconds", "Time since the server started", "gauge", uptime);
+
+	auto binaries = program_cache_stats();
+	write_cache(out, "program_binary", binaries.hits, binaries.misses);
+	write_cache(out, "scene", metrics.scene_hits.load(std::memory_order_relaxed), metrics.scene_misses.load(std::memory_order_relaxed));
+	write_cache(out, "tile",
+	            metrics.tile_memory_hits.load(std::memory_order_relaxed) + metrics.tile_disk_hits.load(std::memory_order_relaxed),
+	            metrics.tile_misses.load(std::memory_order_relaxed));
+
+	auto memory = device_memory();
+	write_value(out, "rt_device_memory_bytes", "Device memory held on all devices", "gauge", double(memory.live_bytes));
+	write_value(out, "rt_device_memory_peak_bytes", "Most device memory held at once on all devices", "gauge", double(memory.peak_bytes));
+
+	return out;
+}
+
+bool serve_metrics(std::uint16_t port, std::shared_ptr<server_metrics const> metrics)
+{
+	auto server = std::make_shared<line_server>();
+
+	if (!server->listen(port))
+		return false;
+
+	std::cout << "Serving metrics on http://127.0.0.1:" << port << "/metrics\n";
+
+	// the thread owns the socket and the metrics, the process exits past it
+	std::thread([server, metrics]()
+	{
+		while (server->accept())
+		{
+			std::string request, header;
+
+			if (!server->read_line(request))
+				continue;
+
+			// the headers end with an empty line
+			while (server->read_line(header) && !header.empty())
+			{
+			}
+
+			bool scrape = request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0;
+
+			if (scrape)
+				write_response(*server, "200 OK", format_metrics(*metrics));
+			else
+				write_response(*server, "404 Not Found", "not found\n");
+		}
+
+		std::cout << "Metrics server socket failed\n";
+	}).detach();
+
+	return true;
+}
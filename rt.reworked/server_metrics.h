@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Upper bounds of the buckets of latency_histogram in seconds, the +Inf bucket follows them
+double const kLatencyBounds[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+std::size_t const kLatencyBuckets = sizeof(kLatencyBounds) / sizeof(kLatencyBounds[0]) + 1;
+
+// Histogram of durations for the Prometheus text format. observe() takes no lock, only relaxed
+// atomic adds, so the thread doing the work can count on its hot path while another one reads.
+class latency_histogram
+{
+public:
+	// Count a duration of ms milliseconds
+	void observe(double ms);
+
+	// Append the histogram under name, in seconds, with its HELP and TYPE lines to out
+	void write(std::string& out, char const* name, char const* help) const;
+
+private:
+	// Durations per bucket, not cumulative; write() sums them up
+	std::atomic<std::uint64_t> buckets_[kLatencyBuckets] = {};
+	std::atomic<std::uint64_t> sum_us_{ 0 };
+};
+
+// What the render server exposes on /metrics (--metrics-port). run_server updates it from its
+// thread, serve_metrics() reads it from another one, every field is an atomic.
+struct server_metrics
+{
+	// Whole jobs, from the start of their batch to their answer, and their stages: kernel builds
+	// or binary loads and scene uploads of the devices set up for them, kernels, reads and
+	// image encoding
+	latency_histogram job, build, upload, kernel, readback, encode;
+	// Jobs taken in and not answered yet
+	std::atomic<std::int64_t> queue_depth{ 0 };
+	std::atomic<std::uint64_t> jobs{ 0 };
+	std::atomic<std::uint64_t> failed_jobs{ 0 };
+	// Jobs over the memory budgets (--host-budget, --device-budget): rendered in bands to fit,
+	// or refused as not even that fits
+	std::atomic<std::uint64_t> banded_jobs{ 0 };
+	std::atomic<std::uint64_t> refused_jobs{ 0 };
+	// Counts of the renderer and the tile cache, copied after every job as only the server's
+	// thread may touch them
+	std::atomic<std::uint64_t> scene_hits{ 0 };
+	std::atomic<std::uint64_t> scene_misses{ 0 };
+	std::atomic<std::uint64_t> tile_memory_hits{ 0 };
+	std::atomic<std::uint64_t> tile_disk_hits{ 0 };
+	std::atomic<std::uint64_t> tile_misses{ 0 };
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+};
+
+// metrics in the Prometheus text exposition format, with the program binary cache counts of
+// build_program and the device memory held (device_memory.h)
+std::string format_metrics(server_metrics const& metrics);
+
+// Answer HTTP GET /metrics on 127.0.0.1:port with format_metrics(), and anything else with
+// 404, from a thread of its own that runs until the process exits. Returns false with a message
+// if the port can't be bound.
+bool serve_metrics(std::uint16_t port, std::shared_ptr<server_metrics const> metrics);
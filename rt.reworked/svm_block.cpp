@@ -0,0 +1,62 @@
+#include "svm_block.h"
+
+#include <cstring>
+
+#include "device_memory.h"
+
+svm_support svm_capabilities(cl::Device const& device)
+{
+	cl_device_svm_capabilities caps = 0;
+
+	if (clGetDeviceInfo(device(), CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, nullptr) != CL_SUCCESS)
+		return svm_support::none;
+
+	if ((caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0)
+		return svm_support::fine;
+
+	return (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) != 0 ? svm_support::coarse : svm_support::none;
+}
+
+svm_block::svm_block(cl::Context const& context, std::size_t size, bool fine)
+	: context_(context)
+	, size_(size)
+	, fine_(fine)
+	, allocation_(0)
+{
+	// an empty allocation is invalid, keep at least one byte
+	data_ = clSVMAlloc(context_(), CL_MEM_READ_ONLY | (fine ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0), size > 0 ? size : 1, 0);
+
+	if (data_)
+		allocation_ = record_allocation(context_, CL_MEM_READ_ONLY | (fine ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0), size, "svm scene array");
+}
+
+svm_block::~svm_block()
+{
+	if (data_)
+	{
+		clSVMFree(context_(), data_);
+		record_release(allocation_);
+	}
+}
+
+cl_int svm_block::write(cl::CommandQueue const& queue, std::size_t offset, void const* src, std::size_t size)
+{
+	if (!data_)
+		return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+
+	auto* dst = static_cast<char*>(data_) + offset;
+
+	if (fine_)
+	{
+		std::memcpy(dst, src, size);
+		return CL_SUCCESS;
+	}
+
+	cl_int err = clEnqueueSVMMap(queue(), CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, dst, size, 0, nullptr, nullptr);
+
+	if (err != CL_SUCCESS)
+		return err;
+
+	std::memcpy(dst, src, size);
+	return clEnqueueSVMUnmap(queue(), dst, 0, nullptr, nullptr);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+
+#include <CL/cl.hpp>
+
+// Shared virtual memory a device supports for buffers, CL_DEVICE_SVM_CAPABILITIES of OpenCL 2.0
+enum class svm_support
+{
+	// OpenCL 1.x device, or no SVM
+	none,
+	// Host access has to map the memory first
+	coarse,
+	// Host and device use the memory without maps, writes show on the device at the next launch
+	fine
+};
+
+// SVM level of device, none if the query fails
+svm_support svm_capabilities(cl::Device const& device);
+
+// One clSVMAlloc allocation of a context, read only for the kernels, which take it as an
+// argument with clSetKernelArgSVMPointer. On APUs the host writes the memory the kernels read
+// instead of staging a copy for a transfer.
+class svm_block
+{
+public:
+	// Allocate size bytes in context, fine-grained if fine. data() is null if it fails.
+	svm_block(cl::Context const& context, std::size_t size, bool fine);
+	~svm_block();
+
+	svm_block(svm_block const&) = delete;
+	svm_block& operator=(svm_block const&) = delete;
+
+	void* data() const
+	{
+		return data_;
+	}
+
+	std::size_t size() const
+	{
+		return size_;
+	}
+
+	// Copy size bytes of src to offset: straight into fine-grained memory, through a blocking
+	// map on queue for coarse-grained memory. The kernels launched after it read the new data.
+	cl_int write(cl::CommandQueue const& queue, std::size_t offset, void const* src, std::size_t size);
+
+private:
+	cl::Context context_;
+	void* data_;
+	std::size_t size_;
+	bool fine_;
+	// Id of the allocation in device_memory.h
+	std::size_t allocation_;
+};
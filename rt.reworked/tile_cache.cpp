@@ -0,0 +1,180 @@
+#include "tile_cache.h"
+
+#include "oiio/include/OpenImageIO/hash.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+
+std::string scene_digest(sphere_soa const& spheres)
+{
+	OIIO_NAMESPACE::SHA1 sha;
+
+	std::uint32_t count = spheres.size();
+	sha.append(&count, sizeof(count));
+
+	for (auto const* a : { &spheres.cx, &spheres.cy, &spheres.cz, &spheres.radius2, &spheres.color })
+	{
+		if (!a->empty())
+			sha.append(a->data(), sizeof(float) * a->size());
+	}
+
+	return sha.digest();
+}
+
+std::string tile_key(std::string const& digest, ortho_view const& view, pixel_format format, tile const& rect)
+{
+	// the steps as the tracers divide them, which is all the ray setup reads of width and height
+	float const window[] = { view.left, view.bottom, view.width / view.image_width, view.height / view.image_height, view.near, view.far };
+	std::uint32_t const layout[] = { static_cast<std::uint32_t>(format), rect.x0, rect.y0, rect.x1, rect.y1 };
+
+	OIIO_NAMESPACE::SHA1 sha;
+	sha.append(digest.c_str(), digest.size() + 1);
+	sha.append(window, sizeof(window));
+	sha.append(layout, sizeof(layout));
+	return sha.digest();
+}
+
+std::vector<tile> cache_tiles(ortho_view const& view)
+{
+	std::vector<tile> tiles;
+
+	for (std::uint32_t y = 0; y < view.image_height; y += kCacheTileSize)
+	{
+		for (std::uint32_t x = 0; x < view.image_width; x += kCacheTileSize)
+		{
+			tiles.push_back(tile{ x, y, std::min(x + kCacheTileSize, view.image_width), std::min(y + kCacheTileSize, view.image_height) });
+		}
+	}
+
+	return tiles;
+}
+
+tile_cache::tile_cache(std::size_t budget, std::string directory)
+	: bin_budget_(budget / kTileCacheBins), directory_(std::move(directory))
+{
+}
+
+bool tile_cache::find(std::string const& key, std::vector<unsigned char>& pixels)
+{
+	auto& b = bin_of(key);
+
+	{
+		std::lock_guard<std::mutex> lock(b.mutex);
+		auto found = b.tiles.find(key);
+
+		if (found != b.tiles.end())
+		{
+			b.lru.splice(b.lru.begin(), b.lru, found->second.lru);
+			pixels = found->second.pixels;
+			++memory_hits_;
+			return true;
+		}
+	}
+
+	std::ifstream file;
+
+	if (!directory_.empty())
+		file.open(directory_ + "/" + key + ".tile", std::ios::binary);
+
+	if (!file)
+	{
+		++misses_;
+		return false;
+	}
+
+	pixels.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	++disk_hits_;
+
+	std::vector<std::pair<std::string, std::vector<unsigned char>>> evicted;
+
+	{
+		std::lock_guard<std::mutex> lock(b.mutex);
+
+		// another thread may have brought it back meanwhile
+		if (b.tiles.count(key) == 0)
+			keep(b, key, pixels, true, evicted);
+	}
+
+	spill(evicted);
+	return true;
+}
+
+void tile_cache::insert(std::string const& key, std::vector<unsigned char> pixels)
+{
+	auto& b = bin_of(key);
+
+	std::vector<std::pair<std::string, std::vector<unsigned char>>> evicted;
+
+	{
+		std::lock_guard<std::mutex> lock(b.mutex);
+
+		// a tile of a key is always the same, the one kept stays
+		if (b.tiles.count(key) == 0)
+			keep(b, key, std::move(pixels), false, evicted);
+	}
+
+	spill(evicted);
+}
+
+std::size_t tile_cache::memory_hits() const
+{
+	return memory_hits_;
+}
+
+std::size_t tile_cache::disk_hits() const
+{
+	return disk_hits_;
+}
+
+std::size_t tile_cache::misses() const
+{
+	return misses_;
+}
+
+tile_cache::bin& tile_cache::bin_of(std::string const& key)
+{
+	return bins_[std::hash<std::string>()(key) % kTileCacheBins];
+}
+
+void tile_cache::keep(bin& b, std::string const& key, std::vector<unsigned char> pixels, bool on_disk,
+                      std::vector<std::pair<std::string, std::vector<unsigned char>>>& evicted)
+{
+	// a tile larger than the bin's share is not kept in memory at all
+	if (pixels.size() > bin_budget_)
+	{
+		if (!on_disk)
+			evicted.emplace_back(key, std::move(pixels));
+
+		return;
+	}
+
+	b.bytes += pixels.size();
+	b.lru.push_front(key);
+	b.tiles[key] = entry{ std::move(pixels), b.lru.begin(), on_disk };
+
+	while (b.bytes > bin_budget_)
+	{
+		auto victim = b.tiles.find(b.lru.back());
+		b.bytes -= victim->second.pixels.size();
+
+		if (!victim->second.on_disk)
+			evicted.emplace_back(victim->first, std::move(victim->second.pixels));
+
+		b.tiles.erase(victim);
+		b.lru.pop_back();
+	}
+}
+
+void tile_cache::spill(std::vector<std::pair<std::string, std::vector<unsigned char>>> const& evicted)
+{
+	if (directory_.empty())
+		return;
+
+	for (auto const& tile : evicted)
+	{
+		std::ofstream file(directory_ + "/" + tile.first + ".tile", std::ios::binary);
+		file.write(reinterpret_cast<char const*>(tile.second.data()), tile.second.size());
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "grid.h"
+#include "pixel_format.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+// Edge of the tiles of tile_cache, on a grid from the image origin
+std::uint32_t const kCacheTileSize = 64;
+
+// Bins of tile_cache, each with a lock of its own
+std::size_t const kTileCacheBins = 16;
+
+// SHA-1 of the sphere arrays the tracers read, the content address of a scene
+std::string scene_digest(sphere_soa const& spheres);
+
+// Key of the pixels of rect in the image of view rendered in format from the scene of digest
+// (scene_digest). Only what the rays of the tile depend on is hashed: the window origin, the
+// pixel steps and the depths. Renders in another mode, to another file or of a larger window
+// with the same origin and steps share the keys of their common tiles; the tracers give every
+// mode the same pixels.
+std::string tile_key(std::string const& digest, ortho_view const& view, pixel_format format, tile const& rect);
+
+// Tiles of kCacheTileSize of the image of view, clipped to it, by rows and then columns
+std::vector<tile> cache_tiles(ortho_view const& view);
+
+// Rendered tiles of the render server by tile_key, so tiles an earlier job rendered are copied
+// instead of traced again. The tiles are spread over kTileCacheBins bins by key, each with its
+// own lock, map and least recently used list, the design of OIIO's unordered_map_concurrent;
+// each bin holds at most its share of budget bytes. With a directory, tiles evicted from
+// memory are written to it, one file named by the key per tile, and read back into memory by
+// find(). Files are never deleted. All members may be called from any thread.
+class tile_cache
+{
+public:
+	explicit tile_cache(std::size_t budget, std::string directory = std::string());
+
+	tile_cache(tile_cache const&) = delete;
+	tile_cache& operator=(tile_cache const&) = delete;
+
+	// Copy the pixels of key into pixels, from memory or the directory. Returns false if
+	// the tile is in neither.
+	bool find(std::string const& key, std::vector<unsigned char>& pixels);
+
+	// Keep pixels under key, evicting the least recently used tiles of its bin past the budget
+	void insert(std::string const& key, std::vector<unsigned char> pixels);
+
+	// Most bytes the tiles in memory take
+	std::size_t budget() const
+	{
+		return bin_budget_ * kTileCacheBins;
+	}
+
+	// find() calls answered from memory, from the directory and not at all
+	std::size_t memory_hits() const;
+	std::size_t disk_hits() const;
+	std::size_t misses() const;
+
+private:
+	struct entry
+	{
+		std::vector<unsigned char> pixels;
+		std::list<std::string>::iterator lru;
+		// A file of the tile is in the directory already
+		bool on_disk;
+	};
+
+	struct bin
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, entry> tiles;
+		// Keys, the most recently used first
+		std::list<std::string> lru;
+		std::size_t bytes = 0;
+	};
+
+	bin& bin_of(std::string const& key);
+
+	// Add key to b and evict past the bin budget into evicted, b's lock is held
+	void keep(bin& b, std::string const& key, std::vector<unsigned char> pixels, bool on_disk,
+	          std::vector<std::pair<std::string, std::vector<unsigned char>>>& evicted);
+
+	// Write the evicted tiles to the directory
+	void spill(std::vector<std::pair<std::string, std::vector<unsigned char>>> const& evicted);
+
+	std::size_t bin_budget_;
+	std::string directory_;
+	bin bins_[kTileCacheBins];
+
+	std::atomic<std::size_t> memory_hits_{ 0 };
+	std::atomic<std::size_t> disk_hits_{ 0 };
+	std::atomic<std::size_t> misses_{ 0 };
+};
@@ -0,0 +1,247 @@
+#include "tiled_output.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "device_memory.h"
+#include "image_compare.h"
+#include "output_files.h"
+#include "parallel_executors.h"
+#include "sparse_framebuffer.h"
+#include "thread_pool.h"
+#include "tile_cache.h"
+#include "tile_pyramid.h"
+
+namespace
+{
+	// Checkpoint file of the tiled output file output
+	std::string checkpoint_file_name(std::string const& output)
+	{
+		return output + ".checkpoint";
+	}
+
+	// Manifest of the checkpoint of a tiled render of scene in format, in bands of band_rows rows:
+	// everything the pixels of a band depend on. The accel mode is left out, every mode traces the
+	// same pixels.
+	std::string checkpoint_manifest(render_scene const& scene, pixel_format format, std::uint32_t band_rows)
+	{
+		auto const& view = scene.view;
+		char window[256];
+		std::snprintf(window, sizeof(window), "%a %a %a %a %a %a %u %u", view.left, view.bottom, view.width, view.height, view.near, view.far, view.image_width,
+		              view.image_height);
+
+		std::string manifest = "scene " + scene_digest(scene.spheres);
+
+		// the two level scenes trace the clusters of their instances
+		if (scene.instances)
+		{
+			manifest += " instances " + scene_digest(scene.instances->spheres) + " " + std::to_string(scene.instances->instances.size());
+		}
+
+		return manifest + " view " + window + " format " + pixel_format_name(format) + " band " + std::to_string(band_rows);
+	}
+
+	// Checkpoint the bands writer writes to output if manifest isn't empty, see
+	// tiled_image_writer::resume. False if the checkpoint can't be written.
+	bool resume_checkpoint(tiled_image_writer& writer, std::string const& output, std::string const& manifest)
+	{
+		if (manifest.empty())
+			return true;
+
+		auto file = checkpoint_file_name(output);
+
+		if (!writer.resume(file, manifest))
+			return false;
+
+		if (writer.restored_bands() != 0)
+			std::cout << "Resuming from " << file << ", " << writer.restored_bands() << " bands done\n";
+
+		return true;
+	}
+
+	// Render scene on the CPU threads a band of kTileSize rows at a time and stream every band into
+	// the tiled file output as soon as it is rendered (see tiled_image_writer), converted to format.
+	// Host memory holds the bands waiting for the writer instead of the image. With a manifest
+	// (checkpoint_manifest) the bands are checkpointed and the ones of an earlier run of the same
+	// render are taken from its checkpoint. Returns false if the file can't be written.
+	bool render_streamed(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, std::string const& output, std::string const& manifest)
+	{
+		auto const& view = scene.view;
+
+		// the file gets rgb in the framebuffer's channel type, the stride skips the alpha of rgba8
+		OIIO_NAMESPACE::ImageSpec spec(view.image_width, view.image_height, 3, pixel_type(format));
+		spec.tile_width = kTileSize;
+		spec.tile_height = kTileSize;
+
+		tiled_image_writer writer;
+
+		if (!writer.open(output, spec) || !resume_checkpoint(writer, output, manifest))
+			return false;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// make_tiles goes row of tiles by row of tiles, each one is a band
+		auto all_tiles = make_tiles(view, kTileSize);
+		auto tiles_x = (view.image_width + kTileSize - 1) / kTileSize;
+
+		for (std::size_t first = 0; first < all_tiles.size(); first += tiles_x)
+		{
+			std::vector<tile> tiles(all_tiles.begin() + first, all_tiles.begin() + first + tiles_x);
+
+			auto y_begin = tiles[0].y0;
+			auto y_end = tiles[0].y1;
+
+			if (writer.band_done(y_begin))
+				continue;
+
+			auto pixels = writer.take_buffer();
+			pixels.resize(pixel_size(format) * view.image_width * kTileSize);
+
+			// render_tile addresses the pixels of an image, which starts y_begin rows above the band
+			unsigned char* origin = &pixels[0] - std::size_t(y_begin) * view.image_width * pixel_size(format);
+
+			pool.run(tiles, [&](tile const& t)
+			{
+				render_tile(scene, isa, format, t, origin);
+			});
+
+			writer.write_band(y_begin, y_end, std::move(pixels), pixel_size(format));
+		}
+
+		bool written = writer.finish();
+
+		auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "Execution time " << delta << " ms, streamed in bands of " << kTileSize << " rows\n";
+		std::cout << "Wrote " << output << ", encode " << writer.encode_time() << " ms, file open and close " << writer.file_time() << " ms\n";
+		return written;
+	}
+
+	// Render scene on the CPU threads into a sparse_framebuffer, which traces and holds only the
+	// tiles a sphere touches, and write it into the tiled file output, the other tiles as the
+	// background. Returns false if the file can't be written.
+	bool render_sparse(tile_executor& pool, render_scene const& scene, simd_isa isa, pixel_format format, std::string const& output)
+	{
+		auto const& view = scene.view;
+
+		OIIO_NAMESPACE::ImageSpec spec(view.image_width, view.image_height, 3, pixel_type(format));
+		spec.tile_width = kTileSize;
+		spec.tile_height = kTileSize;
+
+		tiled_image_writer writer;
+
+		if (!writer.open(output, spec))
+			return false;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		sparse_framebuffer frame(scene, format, kTileSize);
+		frame.render(pool, scene, isa);
+		frame.write(writer);
+
+		bool written = writer.finish();
+
+		auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		auto all_tiles = std::size_t((view.image_width + kTileSize - 1) / kTileSize) * ((view.image_height + kTileSize - 1) / kTileSize);
+
+		std::cout << "Execution time " << delta << " ms, traced " << frame.tiles().size() << " of " << all_tiles << " tiles, holding "
+		          << (frame.stored_bytes() >> 20) << " of " << (frame.dense_bytes() >> 20) << " MB\n";
+		std::cout << "Wrote " << output << ", encode " << writer.encode_time() << " ms, file open and close " << writer.file_time() << " ms\n";
+		return written;
+	}
+
+	// Render the image of the view init_device set dev up for band by band on the device, with
+	// dev.band_rows set, and stream every band into the tiled file output as it comes back (see
+	// render_bands): the device holds a few band buffers and the host the bands in flight. With a
+	// manifest the bands are checkpointed as on the CPU. Returns false if a band fails or the file
+	// can't be written.
+	bool render_streamed(render_device& dev, std::string const& output, std::string const& manifest)
+	{
+		auto const& view = dev.view;
+
+		OIIO_NAMESPACE::ImageSpec spec(view.image_width, view.image_height, 3, pixel_type(dev.format));
+		spec.tile_width = kTileSize;
+		spec.tile_height = kTileSize;
+
+		tiled_image_writer writer;
+
+		if (!writer.open(output, spec) || !resume_checkpoint(writer, output, manifest))
+			return false;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		bool rendered = render_bands(dev, writer);
+
+		if (!rendered)
+			std::cout << "Can't render the bands on " << dev.name << "\n";
+
+		bool written = writer.finish() && rendered;
+
+		auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "Execution time " << delta << " ms, streamed in bands of " << dev.band_rows << " rows\n";
+		std::cout << "  " << dev.name << ": kernels " << dev.kernel_time << " ms, reads " << dev.transfer_time << " ms\n";
+		std::cout << "Wrote " << output << ", encode " << writer.encode_time() << " ms, file open and close " << writer.file_time() << " ms\n";
+		return written;
+	}
+}
+
+int run_tiled(run_options const& options, render_scene const& scene, std::vector<render_device>& devices)
+{
+	if (options.backend == render_backend::gpu)
+	{
+		if (!render_streamed(devices[0], options.output, options.checkpoint ? checkpoint_manifest(scene, options.format, kDeviceBandRows) : std::string()))
+			return -1;
+
+		if (options.memory_report)
+			print_memory_footprint(true);
+
+		return options.golden.empty() || check_image_file(options.output, options.golden, options.tolerance) ? 0 : 1;
+	}
+
+	// the cpu backend runs its tiles on the pool, or on the executor of another runtime, which
+	// then leaves the pool a single idle thread
+	auto runtime_executor = make_executor(options.runtime, options.num_threads);
+
+	thread_pool pool(runtime_executor ? 1U : options.num_threads);
+	tile_executor& executor = runtime_executor ? *runtime_executor : static_cast<tile_executor&>(pool);
+
+	std::cout << "Using " << executor.size() << " " << (runtime_executor ? parallel_runtime_name(options.runtime) : "CPU") << " threads, "
+	          << (scene.mode == accel_mode::none ? simd_isa_name(options.isa) : accel_mode_name(scene.mode)) << "\n";
+
+	if (options.sparse ? !render_sparse(executor, scene, options.isa, options.format, options.output)
+	                   : !render_streamed(executor, scene, options.isa, options.format, options.output,
+	                                      options.checkpoint ? checkpoint_manifest(scene, options.format, kTileSize) : std::string()))
+		return -1;
+
+	return options.golden.empty() || check_image_file(options.output, options.golden, options.tolerance) ? 0 : 1;
+}
+
+int run_pyramid(run_options const& options, render_scene& scene)
+{
+	// the cpu backend runs its tiles on the pool, or on the executor of another runtime, which
+	// then leaves the pool a single idle thread
+	auto runtime_executor = make_executor(options.runtime, options.num_threads);
+
+	thread_pool pool(runtime_executor ? 1U : options.num_threads);
+	tile_executor& executor = runtime_executor ? *runtime_executor : static_cast<tile_executor&>(pool);
+
+	std::cout << "Using " << executor.size() << " " << (runtime_executor ? parallel_runtime_name(options.runtime) : "CPU") << " threads, "
+	          << (scene.mode == accel_mode::none ? simd_isa_name(options.isa) : accel_mode_name(scene.mode)) << "\n";
+
+	auto pyramid = options.pyramid;
+	pyramid.encoding = options.encoding;
+	pyramid_stats stats;
+
+	if (!render_pyramid(executor, scene, options.mode, options.isa, pyramid, options.pyramid_path, stats))
+		return -1;
+
+	std::cout << "Execution time " << stats.total_time << " ms, tracing " << stats.trace_time << " ms, " << stats.levels << " levels, "
+	          << stats.builds << " structure builds\n";
+	std::cout << "Wrote " << stats.tiles << " " << pyramid_layout_name(pyramid.layout) << " tiles of " << pyramid.tile_size << " pixels to " << options.pyramid_path
+	          << ", " << stats.empty_tiles << " of them background, " << stats.traced << " tracer tiles traced\n";
+	return 0;
+}
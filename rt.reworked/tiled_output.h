@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu_trace.h"
+#include "render_device.h"
+#include "run_options.h"
+#include "scene.h"
+
+// Rows of the bands --tiled renders on a device, whole tiles of the file and work-groups
+std::uint32_t const kDeviceBandRows = 8 * kTileSize;
+
+// Render the one frame of scene into the tiled file of --output band by band (--tiled): on the
+// device of devices with the gpu backend, on the CPU threads with the cpu one. Returns the exit
+// code of main.
+int run_tiled(run_options const& options, render_scene const& scene, std::vector<render_device>& devices);
+
+// Render the tile pyramid of --pyramid of scene on the CPU threads, see render_pyramid. Returns
+// the exit code of main.
+int run_pyramid(run_options const& options, render_scene& scene);
@@ -1,25 +1,28 @@
+// No a*b+c contraction into fma: the kernels must round like the CPU tracers
+#pragma OPENCL FP_CONTRACT OFF
+
+// View, image size and sphere count are baked in by the host with -D options, the values
+// below are the defaults of config.h
+
+#ifndef RT_LEFT
 #define RT_LEFT -10.f
 #define RT_BOTTOM -10.f
 #define RT_WIDTH 20.f
 #define RT_HEIGHT 20.f
 #define RT_NEAR -10.f
 #define RT_FAR 10.f
+#endif
 
 // Output image dimensions
+#ifndef kImageWidth
 #define kImageWidth 2048
 #define kImageHeight 2048
+#endif
+
 // Number of spheres to render
+#ifndef kNumSpheres
 #define kNumSpheres 512
-
-typedef struct tag_sphere
-{
-	// Center
-	float cx, cy, cz;
-	// Radius
-	float radius;
-	// Shpere color
-	float r, g, b;
-} sphere;
+#endif
 
 typedef struct tag_ray
 {
@@ -29,17 +32,284 @@ typedef struct tag_ray
 	float dx, dy, dz;
 	// Intersection distance
 	float maxt;
+#ifdef RT_AOV_COST
+	// Sphere tests and BVH nodes of the ray so far, the cost channel
+	uint tests, visits;
+#endif
 } ray;
 
+// Count the work of a ray for the cost channel, nothing without it
+#ifdef RT_AOV_COST
+#define RT_START_COST(r) ((r).tests = (r).visits = 0U)
+#define RT_COUNT_TEST(r) (++(r).tests)
+#define RT_COUNT_VISIT(r) (++(r).visits)
+#else
+#define RT_START_COST(r)
+#define RT_COUNT_TEST(r)
+#define RT_COUNT_VISIT(r)
+#endif
+
+// Flattened BVH node, mirrors bvh_node in bvh.h.
+// Interior nodes (count == 0): first child follows the node, second child at offset.
+// Leaves: count sphere indices starting at indices[offset].
+typedef struct tag_bvh_node
+{
+	float bmin[3];
+	int offset;
+	float bmax[3];
+	int count;
+} bvh_node;
+
+// Interior BVH node in the compressed layout of --compress-bvh, mirrors compressed_bvh_node in
+// bvh.h: the boxes of both children quantized to 8 bits per bound from origin in power-of-two
+// steps, leaf_mask bit c set if child c is a leaf of count[c] spheres at indices[child[c]]
+typedef struct tag_compressed_bvh_node
+{
+	float origin[3];
+	uchar exponent[3];
+	uchar leaf_mask;
+	uchar qlo[6];
+	uchar qhi[6];
+	ushort count[2];
+	int child[2];
+} compressed_bvh_node;
+
+// Nodes trace_bvh and trace_views_bvh walk
+#ifdef RT_COMPRESSED_BVH
+typedef compressed_bvh_node bvh_node_t;
+#else
+typedef bvh_node bvh_node_t;
+#endif
+
+// Small scenes are built with RT_UNROLL_SPHERES: the loops over all kNumSpheres spheres get
+// unrolled, the trip count is a build constant
+#ifdef RT_UNROLL_SPHERES
+#define RT_SPHERE_LOOP _Pragma("unroll")
+#else
+#define RT_SPHERE_LOOP
+#endif
+
+// Built with RT_FAST_MATH (--fast-math, next to -cl-fast-relaxed-math) square roots and
+// reciprocals take the native paths of the hardware. The host keeps that build on a device only
+// if its first frame matches the one of the strict build, see init_device.
+#ifdef RT_FAST_MATH
+#define RT_SQRT(x) native_sqrt(x)
+#define RT_RECIP(x) native_recip(x)
+#else
+#define RT_SQRT(x) sqrt(x)
+#define RT_RECIP(x) (1.f / (x))
+#endif
+
+// Traversal stack size, kBvhMaxDepth in bvh.h
+#define kBvhMaxDepth 64
+
+// Spheres staged into local memory at a time by trace_local, trace_local_async and trace_grid_local, kLocalBatch in rt.cpp
+#define kLocalBatch 256
+
+// Work-group edge of trace_grid_local, one grid cell; kGroupTileSize in rt.cpp
+#define kGroupTileSize 16
+
+// Output pixel formats, pixel_format in pixel_format.h. The host selects one with -D RT_FORMAT.
+#define RT_FORMAT_FLOAT 0
+#define RT_FORMAT_HALF 1
+#define RT_FORMAT_RGBA8 2
+#define RT_FORMAT_ID16 3
+#define RT_FORMAT_ID32 4
+#define RT_FORMAT_FLOAT4 5
+
+#ifndef RT_FORMAT
+#define RT_FORMAT RT_FORMAT_FLOAT
+#endif
+
+#if RT_FORMAT == RT_FORMAT_RGBA8
+typedef uchar4 pixel_t;
+#elif RT_FORMAT == RT_FORMAT_ID16
+typedef ushort pixel_t;
+#elif RT_FORMAT == RT_FORMAT_ID32
+typedef uint pixel_t;
+#elif RT_FORMAT == RT_FORMAT_HALF
+typedef half pixel_t;
+#elif RT_FORMAT == RT_FORMAT_FLOAT4
+typedef float4 pixel_t;
+#else
+typedef float pixel_t;
+#endif
+
+// Quantize to 8 bits like OIIO's float to UINT8 conversion, which truncates c * 255 + 0.5
+// computed in double. fma rounds that sum once; if it rounded up to the next integer the
+// exact remainder is negative and the step is undone.
+uchar quantize(float c)
+{
+	float n = floor(fma(c, 255.f, 0.5f));
+
+	if (fma(c, 255.f, 0.5f - n) < 0.f)
+		n -= 1.f;
+
+	return convert_uchar_sat(n);
+}
+
+#ifdef RT_OUTPUT_TRANSFORM
+// Channel c of a color as it is written: scaled by the exposure, encoded with the sRGB OETF
+// and looked up in the LUT, the steps the host defines (output_transform.h)
+float output_channel(float c)
+{
+#ifdef RT_EXPOSURE_SCALE
+	c *= RT_EXPOSURE_SCALE;
+#endif
+
+#ifdef RT_OETF_SRGB
+	c = c <= 0.0031308f ? c * 12.92f : 1.055f * pow(c, 1.f / 2.4f) - 0.055f;
+#endif
+
+#ifdef RT_LUT_SIZE
+	float x = clamp(c, 0.f, 1.f) * (RT_LUT_SIZE - 1);
+	int i = min((int)x, RT_LUT_SIZE - 2);
+	c = mix(kOutputLut[i], kOutputLut[i + 1], x - (float)i);
+#endif
+
+	return c;
+}
+#endif
+
+// Write the color of sphere idx, or the background if idx < 0, to pixel id of img. The id
+// formats write idx itself, all ones for the background, and read no color.
+void write_pixel(__global pixel_t* img, size_t id, __global float const* color, int idx)
+{
+#ifdef RT_BANDED
+	// img holds only the band of rows the launch starts at (--tiled), not the image
+	id -= get_global_offset(1) * kImageWidth;
+#endif
+
+#if RT_FORMAT == RT_FORMAT_ID16 || RT_FORMAT == RT_FORMAT_ID32
+	img[id] = idx >= 0 ? (pixel_t)idx : (pixel_t)~(pixel_t)0;
+#else
+	float r = 0.1f;
+	float g = 0.1f;
+	float b = 0.1f;
+
+	if (idx >= 0)
+	{
+		r = color[idx * 3];
+		g = color[idx * 3 + 1];
+		b = color[idx * 3 + 2];
+	}
+
+#ifdef RT_OUTPUT_TRANSFORM
+	r = output_channel(r);
+	g = output_channel(g);
+	b = output_channel(b);
+#endif
+
+#if RT_FORMAT == RT_FORMAT_RGBA8
+	uchar4 p;
+	p.x = quantize(r);
+	p.y = quantize(g);
+	p.z = quantize(b);
+	p.w = 255;
+	img[id] = p;
+#elif RT_FORMAT == RT_FORMAT_HALF
+	// round to nearest even, as OIIO converts float to half
+	vstore_half(r, id * 3, img);
+	vstore_half(g, id * 3 + 1, img);
+	vstore_half(b, id * 3 + 2, img);
+#elif RT_FORMAT == RT_FORMAT_FLOAT4
+	// one aligned 16-byte store, the work-items of a row write a contiguous run
+	img[id] = (float4)(r, g, b, 0.f);
+#else
+	vstore3((float3)(r, g, b), id, img);
+#endif
+#endif
+}
+
+// Roots of the camera ray r against the sphere at (cx, cy, cz), false if its line misses.
+// The ray points along +Z, so a = 1 and half of b is the relative oz: the roots are
+// -oz -+ sqrt(oz^2 - c) without the 4ac product and the division. The full formula only
+// differs by powers of two, so the roots are the same floats.
+bool sphere_roots(ray const* r, float cx, float cy, float cz, float radius2, float* t0, float* t1)
+{
+	float ox = r->ox - cx;
+	float oy = r->oy - cy;
+	float oz = r->oz - cz;
+
+	float c = (ox * ox) + (oy * oy) + (oz * oz) - radius2;
+	float d = (oz * oz) - c;
+
+	if (d < 0)
+		return false;
+
+	float root = RT_SQRT(d);
+
+	*t0 = -oz - root;
+	*t1 = -oz + root;
+	return true;
+}
+
+// Extra channels next to the color, aov_channel in render_device.h. The host enables each
+// one with -D RT_AOV_DEPTH, RT_AOV_ID, RT_AOV_NORMAL or RT_AOV_COST; trace, trace_bvh and
+// trace_sorted then take the planes as a last argument, and without any of them the kernels
+// are unchanged.
+#if defined(RT_AOV_DEPTH) || defined(RT_AOV_ID) || defined(RT_AOV_NORMAL) || defined(RT_AOV_COST)
+#define RT_AOV_PARAMS , __global float* aov
+#define RT_WRITE_AOVS(id, r, idx) write_aovs(aov, id, &(r), idx, cx, cy, cz, radius2)
+
+// Write the channels of pixel id for the hit idx of r to their planes in aov, each
+// kImageWidth x kImageHeight pixels: the depth r ends at, the sphere index, the unit normal
+// and the tests and node visits of r
+void write_aovs(__global float* aov, size_t id, ray const* r, int idx, __global float const* cx, __global float const* cy,
+                __global float const* cz, __global float const* radius2)
+{
+	size_t plane = (size_t)kImageWidth * kImageHeight;
+
+#ifdef RT_AOV_DEPTH
+	aov[id] = r->oz + r->maxt;
+	aov += plane;
+#endif
+
+#ifdef RT_AOV_ID
+	((__global int*)aov)[id] = idx;
+	aov += plane;
+#endif
+
+#ifdef RT_AOV_NORMAL
+	float nx = 0.f;
+	float ny = 0.f;
+	float nz = 0.f;
+
+	if (idx >= 0)
+	{
+		float inv_radius = RT_RECIP(RT_SQRT(radius2[idx]));
+		nx = (r->ox - cx[idx]) * inv_radius;
+		ny = (r->oy - cy[idx]) * inv_radius;
+		nz = (r->oz + r->maxt - cz[idx]) * inv_radius;
+	}
+
+	aov[id * 3] = nx;
+	aov[id * 3 + 1] = ny;
+	aov[id * 3 + 2] = nz;
+	aov += plane * 3;
+#endif
+
+#ifdef RT_AOV_COST
+	((__global uint*)aov)[id * 2] = r->tests;
+	((__global uint*)aov)[id * 2 + 1] = r->visits;
+#endif
+}
+#else
+#define RT_AOV_PARAMS
+#define RT_WRITE_AOVS(id, r, idx)
+#endif
+
 // Render the image img usign ray tracing for ortho projection camera.
 // Each pixel of img contains color of closest sphere after the function has finished.
+// Spheres come in structure-of-arrays layout: centers cx/cy/cz, squared radii and
+// an rgb color table, so the sphere loop only streams the four geometry arrays.
 __kernel
-void trace(__global sphere* spheres, __global float* img)
+void trace(__global float const* cx, __global float const* cy, __global float const* cz,
+           __global float const* radius2, __global float const* color, __global pixel_t* img RT_AOV_PARAMS)
 {
 	size_t gid0 = get_global_id(0);
 	size_t gid1 = get_global_id(1);
-	size_t gsz = get_global_size(0);
-	size_t id = (gid1 * gsz) + gid0;
+	size_t id = (gid1 * kImageWidth) + gid0;
 	
 	ray r;
 	r.oz = RT_NEAR;
@@ -48,57 +318,4034 @@ void trace(__global sphere* spheres, __global float* img)
 	r.dx = r.dy = 0.f;
 	r.dz = 1.f;
 	r.maxt = RT_FAR - RT_NEAR;
+	RT_START_COST(r);
 
 	int idx = -1;
 	
+	RT_SPHERE_LOOP
 	for (size_t k = 0U; k < kNumSpheres; ++k)
 	{	
 		bool is_intersect = false;
-		bool is_found_roots = false;
 
-		ray rtemp = r;
-		rtemp.ox -= spheres[k].cx;
-		rtemp.oy -= spheres[k].cy;
-		rtemp.oz -= spheres[k].cz;
+		float t0, t1;
+		RT_COUNT_TEST(r);
 
-		float a = rtemp.dx * rtemp.dx + rtemp.dy * rtemp.dy + rtemp.dz * rtemp.dz;
-		float b = 2 * (rtemp.ox * rtemp.dx + rtemp.oy * rtemp.dy + rtemp.oz * rtemp.dz);
-		float c = (rtemp.ox * rtemp.ox) + (rtemp.oy * rtemp.oy) + (rtemp.oz * rtemp.oz) - (spheres[k].radius * spheres[k].radius);
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+		{
+			r.maxt = t0 > 0.f ? t0 : t1;
+			is_intersect = true;
+		}
 
-		float t0, t1;
+		if (is_intersect)
+		{
+			idx = k;
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+	RT_WRITE_AOVS(id, r, idx);
+}
+
+// Pixels of the largest block a work-item of the trace_coarse kernels traces
+#define kMaxCoarsePixels 4
+
+// trace for a block of bx x by pixels per work-item, the block of work-item (i, j) starting at
+// pixel (i * bx, j * by): every sphere is read once and tested against the rays of the block,
+// which stay in registers, so the loads per pixel drop by the block size at the cost of as
+// many rays live at once. Pixels of a block past the image are not written. Constant bx and by
+// let the loops over the block unroll; the hits are those of trace.
+inline void trace_block(__global float const* cx, __global float const* cy, __global float const* cz,
+                        __global float const* radius2, __global float const* color, __global pixel_t* img, uint bx, uint by)
+{
+	size_t x0 = get_global_id(0) * bx;
+	size_t y0 = get_global_id(1) * by;
+
+	ray r[kMaxCoarsePixels];
+	int idx[kMaxCoarsePixels];
+
+	for (uint p = 0U; p < bx * by; ++p)
+	{
+		size_t x = x0 + p % bx;
+		size_t y = y0 + p / bx;
+
+		r[p].oz = RT_NEAR;
+		r[p].ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (x + 0.5f);
+		r[p].oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (y + 0.5f);
+		r[p].dx = r[p].dy = 0.f;
+		r[p].dz = 1.f;
+		r[p].maxt = RT_FAR - RT_NEAR;
+		idx[p] = -1;
+	}
 
-		float d = (b*b) - (4 * a*c);
+	RT_SPHERE_LOOP
+	for (size_t k = 0U; k < kNumSpheres; ++k)
+	{
+		float scx = cx[k];
+		float scy = cy[k];
+		float scz = cz[k];
+		float sradius2 = radius2[k];
 
-		if (d >= 0)
+		for (uint p = 0U; p < bx * by; ++p)
 		{
-			float den = 1 / (2 * a);
-			t0 = (-b - sqrt(d))*den;
-			t1 = (-b + sqrt(d))*den;
-			is_found_roots = true;
+			float t0, t1;
+
+			if (sphere_roots(&r[p], scx, scy, scz, sradius2, &t0, &t1) && t0 <= r[p].maxt && t1 >= 0.f)
+			{
+				r[p].maxt = t0 > 0.f ? t0 : t1;
+				idx[p] = k;
+			}
 		}
+	}
+
+	for (uint p = 0U; p < bx * by; ++p)
+	{
+		size_t x = x0 + p % bx;
+		size_t y = y0 + p / bx;
+
+		if (x < kImageWidth && y < kImageHeight)
+			write_pixel(img, (y * kImageWidth) + x, color, idx[p]);
+	}
+}
+
+// The block sizes the host picks from per device (init_device), 1x1 being trace itself
+__kernel
+void trace_coarse_2x1(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	trace_block(cx, cy, cz, radius2, color, img, 2U, 1U);
+}
+
+__kernel
+void trace_coarse_2x2(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	trace_block(cx, cy, cz, radius2, color, img, 2U, 2U);
+}
+
+__kernel
+void trace_coarse_4x1(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	trace_block(cx, cy, cz, radius2, color, img, 4U, 1U);
+}
+
+#ifdef RT_CPU_SPAN
+#define RT_PASTE(a, b) a##b
+#define RT_SPAN(a, n) RT_PASTE(a, n)
+
+typedef RT_SPAN(float, RT_CPU_SPAN) float_span;
+typedef RT_SPAN(int, RT_CPU_SPAN) int_span;
+
+#if RT_CPU_SPAN == 16
+#define kSpanLanes ((float16)(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f))
+#else
+#define kSpanLanes ((float8)(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f))
+#endif
+
+// trace for OpenCL CPU devices: a work-item traces a span of RT_CPU_SPAN pixels of a row, the
+// span of work-item (i, j) starting at pixel (i * RT_CPU_SPAN, j), with the rays in the lanes
+// of float8 or float16 vectors the host picks by the native vector width. A sphere is read
+// once per span and tested against all of its rays in vector arithmetic, which CPU runtimes
+// map to their SIMD units instead of vectorizing work-items implicitly. The rays of a row share
+// oy and oz, so the lanes compute sphere_roots and the acceptance of trace in the same order
+// and pick the same hits. Pixels of a span past the image are not written. The host builds it
+// with RT_CPU_SPAN on CPU devices.
+__kernel
+void trace_span(__global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	size_t x0 = get_global_id(0) * RT_CPU_SPAN;
+	size_t y = get_global_id(1);
+
+	float_span ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (((float_span)((float)x0) + kSpanLanes) + 0.5f);
+	float oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (y + 0.5f);
+	float oz = RT_NEAR;
+
+	float_span maxt = (float_span)(RT_FAR - RT_NEAR);
+	int_span idx = (int_span)(-1);
+
+	RT_SPHERE_LOOP
+	for (size_t k = 0U; k < kNumSpheres; ++k)
+	{
+		float_span dx = ox - cx[k];
+		float dy = oy - cy[k];
+		float dz = oz - cz[k];
+
+		float_span c = (dx * dx) + (dy * dy) + (dz * dz) - radius2[k];
+		float_span d = (dz * dz) - c;
+
+		float_span root = RT_SQRT(d);
+		float_span t0 = -dz - root;
+		float_span t1 = -dz + root;
+
+		int_span hit = d >= 0.f && t0 <= maxt && t1 >= 0.f;
+
+		maxt = select(maxt, select(t1, t0, t0 > 0.f), hit);
+		idx = select(idx, (int_span)((int)k), hit);
+	}
+
+	int hits[RT_CPU_SPAN];
+	RT_SPAN(vstore, RT_CPU_SPAN)(idx, 0, hits);
+
+	for (uint p = 0U; p < RT_CPU_SPAN && x0 + p < kImageWidth; ++p)
+	{
+		write_pixel(img, (y * kImageWidth) + x0 + p, color, hits[p]);
+	}
+}
+#endif
+
+// trace testing the half_sphere of every sphere first, 8 bytes of fp16 read with vload_half4
+// in place of the 16 of its center and radius: the float test only runs for a ray inside the
+// disc of the half that could still reach its zmin. The host rounds the discs outwards and the
+// depths down (half_spheres.h), so the image is the one of trace.
+__kernel
+void trace_half(__global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global float const* color, __global half const* halves, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	RT_SPHERE_LOOP
+	for (size_t k = 0U; k < kNumSpheres; ++k)
+	{
+		// x, y, zmin, radius
+		float4 h = vload_half4(k, halves);
+		float dx = r.ox - h.x;
+		float dy = r.oy - h.y;
+
+		if (dx * dx + dy * dy > h.w * h.w || h.z - r.oz > r.maxt)
+			continue;
+
+		float t0, t1;
 
-		if (is_found_roots && t0 <= r.maxt && t1 >= 0.f)
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
 		{
 			r.maxt = t0 > 0.f ? t0 : t1;
-			is_intersect = true;
+			idx = k;
 		}
+	}
 
-		if (is_intersect)
+	write_pixel(img, id, color, idx);
+}
+
+#ifdef RT_PACKED_HALF
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+
+// Widening of the squared disc radius of trace_half2 over the rounding of its half arithmetic:
+// a factor of 1 + 2^-7 for the differences, squares and sums, each off by at most 2^-11, and
+// a floor of 2^-13 for the squares that are subnormal
+#define kHalfDiscScale ((half)1.0078125f)
+#define kHalfDiscFloor ((half)0.0001220703125f)
+
+// trace_half with the disc test in packed half2 arithmetic, two spheres per step, which GPUs
+// with packed fp16 math (RDNA, Vega) run at twice the float rate. The ray origin is rounded to
+// half once and the distance that moved it widens the radius of every disc, the factor and
+// floor above cover the rounding of the test, so it only rejects spheres the float disc test
+// of trace_half rejects too. The spheres passing it get the depth bound of their half_sphere
+// and sphere_roots in float, in index order, so the image is the one of trace. The host builds
+// it with RT_PACKED_HALF on GPUs with cl_khr_fp16 whose views lie within the range of half.
+__kernel
+void trace_half2(__global float const* cx, __global float const* cy, __global float const* cz,
+                 __global float const* radius2, __global float const* color, __global half const* halves, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	half2 hox = (half2)(convert_half(r.ox));
+	half2 hoy = (half2)(convert_half(r.oy));
+	half2 slack = (half2)(convert_half_rtp(fabs((float)hox.x - r.ox) + fabs((float)hoy.x - r.oy)));
+
+	int idx = -1;
+
+	for (size_t k = 0U; k < kNumSpheres; k += 2U)
+	{
+		// x, y, zmin, radius of spheres k and k + 1, the last one twice for an odd count
+		half4 a = vload4(k, halves);
+		half4 b = k + 1U < kNumSpheres ? vload4(k + 1U, halves) : a;
+
+		half2 dx = hox - (half2)(a.x, b.x);
+		half2 dy = hoy - (half2)(a.y, b.y);
+		half2 reach = (half2)(a.w, b.w) + slack;
+		short2 miss = isgreater(dx * dx + dy * dy, reach * reach * kHalfDiscScale + kHalfDiscFloor);
+
+		for (uint lane = 0U; lane < 2U; ++lane)
 		{
-			idx = k;
+			size_t j = k + lane;
+
+			if (j >= kNumSpheres || (lane == 0U ? miss.x : miss.y) != 0 || (float)(lane == 0U ? a.z : b.z) - r.oz > r.maxt)
+				continue;
+
+			float t0, t1;
+
+			if (sphere_roots(&r, cx[j], cy[j], cz[j], radius2[j], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+			{
+				r.maxt = t0 > 0.f ? t0 : t1;
+				idx = j;
+			}
 		}
 	}
 
-	if (idx >= 0)
+	write_pixel(img, id, color, idx);
+}
+#endif
+
+// Test sphere k against r out of index order: it becomes the hit idx if it is closer, or as
+// close and of a higher index, the sphere the loop in trace keeps. Returns the new hit.
+int closer_hit(ray* r, int k, int idx, __global float const* cx, __global float const* cy, __global float const* cz,
+               __global float const* radius2)
+{
+	float t0, t1;
+	RT_COUNT_TEST(*r);
+
+	if (sphere_roots(r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1))
 	{
-		img[id * 3] = spheres[idx].r;
-		img[id * 3 + 1] = spheres[idx].g;
-		img[id * 3 + 2] = spheres[idx].b;
+		if (t0 <= r->maxt && t1 >= 0.f && !(t0 == r->maxt && k < idx))
+		{
+			r->maxt = t0 > 0.f ? t0 : t1;
+			return k;
+		}
 	}
-	else
+
+	return idx;
+}
+
+#ifdef RT_COMPRESSED_BVH
+// Closest sphere of r through the compressed BVH nodes/indices, starting from the hit idx at
+// r->maxt. Both child boxes of a node are decoded and tested in it, the host rounds them
+// outwards, so every child the full boxes let through is visited; leaves are tested right
+// away and the nearer interior child is descended into first. With first_hit the walk returns
+// at the first sphere r hits, for occlusion queries.
+int bvh_closest(ray* r, int idx, __global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global compressed_bvh_node const* nodes, __global uint const* indices, bool first_hit)
+{
+	int stack[kBvhMaxDepth];
+	int sp = 0;
+	int node = 0;
+
+	for (;;)
+	{
+		__global compressed_bvh_node const* n = nodes + node;
+		RT_COUNT_VISIT(*r);
+
+		float step[3];
+
+		for (int a = 0; a < 3; ++a)
+		{
+			step[a] = as_float((uint)n->exponent[a] << 23);
+		}
+
+		int inner[2];
+		float inner_z[2];
+		int num_inner = 0;
+
+		for (int c = 0; c < 2; ++c)
+		{
+			float lo[3], hi[3];
+
+			for (int a = 0; a < 3; ++a)
+			{
+				lo[a] = n->origin[a] + n->qlo[c * 3 + a] * step[a];
+				hi[a] = n->origin[a] + n->qhi[c * 3 + a] * step[a];
+			}
+
+			// The ray runs along +Z: inside the box footprint and overlapping [0, maxt] in depth
+			bool visit = r->ox >= lo[0] && r->ox <= hi[0] && r->oy >= lo[1] && r->oy <= hi[1] && lo[2] - r->oz <= r->maxt &&
+			             hi[2] - r->oz >= 0.f;
+
+			if (!visit)
+				continue;
+
+			if (n->leaf_mask & (1U << c))
+			{
+				for (int l = 0; l < n->count[c]; ++l)
+				{
+					idx = closer_hit(r, (int)indices[n->child[c] + l], idx, cx, cy, cz, radius2);
+				}
+
+				if (first_hit && idx >= 0)
+					return idx;
+			}
+			else
+			{
+				inner[num_inner] = n->child[c];
+				inner_z[num_inner++] = lo[2];
+			}
+		}
+
+		if (num_inner == 2)
+		{
+			// Descend into the child nearer along +Z first
+			bool swap = inner_z[1] < inner_z[0];
+			stack[sp++] = inner[swap ? 0 : 1];
+			node = inner[swap ? 1 : 0];
+			continue;
+		}
+
+		if (num_inner == 1)
+		{
+			node = inner[0];
+			continue;
+		}
+
+		if (sp == 0)
+			break;
+
+		node = stack[--sp];
+	}
+
+	return idx;
+}
+#else
+// Closest sphere of r through the BVH nodes/indices, starting from the hit idx at r->maxt, or
+// with first_hit the first sphere it meets
+int bvh_closest(ray* r, int idx, __global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global bvh_node const* nodes, __global uint const* indices, bool first_hit)
+{
+	int stack[kBvhMaxDepth];
+	int sp = 0;
+	int node = 0;
+
+	for (;;)
+	{
+		__global bvh_node const* n = nodes + node;
+		RT_COUNT_VISIT(*r);
+
+		// The ray runs along +Z: inside the box footprint and overlapping [0, maxt] in depth
+		bool visit = r->ox >= n->bmin[0] && r->ox <= n->bmax[0] && r->oy >= n->bmin[1] && r->oy <= n->bmax[1] &&
+		             n->bmin[2] - r->oz <= r->maxt && n->bmax[2] - r->oz >= 0.f;
+
+		if (visit && n->count == 0)
+		{
+			// Descend into the child nearer along +Z first
+			int first = node + 1;
+			int second = n->offset;
+
+			if (nodes[second].bmin[2] < nodes[first].bmin[2])
+			{
+				int tmp = first;
+				first = second;
+				second = tmp;
+			}
+
+			stack[sp++] = second;
+			node = first;
+			continue;
+		}
+
+		if (visit)
+		{
+			for (int l = 0; l < n->count; ++l)
+			{
+				idx = closer_hit(r, (int)indices[n->offset + l], idx, cx, cy, cz, radius2);
+			}
+
+			if (first_hit && idx >= 0)
+				return idx;
+		}
+
+		if (sp == 0)
+			break;
+
+		node = stack[--sp];
+	}
+
+	return idx;
+}
+#endif
+
+// Closest sphere of r walking the spheres front to back in the depth order of order/zmin,
+// starting from the hit idx at r->maxt; stops at the first sphere that starts beyond maxt, or
+// with first_hit at the first sphere r hits
+int sorted_closest(ray* r, int idx, __global float const* cx, __global float const* cy, __global float const* cz,
+                   __global float const* radius2, __global uint const* order, __global float const* zmin, bool first_hit)
+{
+	for (size_t l = 0U; l < kNumSpheres; ++l)
+	{
+		// Equal depth is kept, a tie can still change the winning index
+		if (zmin[l] - r->oz > r->maxt)
+			break;
+
+		idx = closer_hit(r, (int)order[l], idx, cx, cy, cz, radius2);
+
+		if (first_hit && idx >= 0)
+			return idx;
+	}
+
+	return idx;
+}
+
+// Pixel (gid0, gid1) traced by the work-item of trace_bvh, trace_sorted and trace_instanced. Launches built with
+// RT_SWIZZLE number their work-items in the order of the groups and of the local ids in them,
+// the order the hardware packs them into wavefronts, and walk blocks of kSwizzleTile x
+// kSwizzleTile pixels in Morton order: each run of 64 work-items traces a square block
+// instead of a strip of a row, so its rays visit the same nodes. The host only swizzles images
+// of whole blocks; the image is still written in linear layout.
+#define kSwizzleTile 8
+
+void launch_pixel(size_t* gid0, size_t* gid1)
+{
+#ifdef RT_SWIZZLE
+	size_t group = get_group_id(1) * get_num_groups(0) + get_group_id(0);
+	size_t n = (group * get_local_size(1) + get_local_id(1)) * get_local_size(0) + get_local_id(0);
+	size_t block = n / (kSwizzleTile * kSwizzleTile);
+	uint m = (uint)(n % (kSwizzleTile * kSwizzleTile));
+
+	// even bits of the Morton code are x, odd bits y
+	uint x = (m & 1U) | ((m >> 1) & 2U) | ((m >> 2) & 4U);
+	uint y = ((m >> 1) & 1U) | ((m >> 2) & 2U) | ((m >> 3) & 4U);
+
+	size_t blocks_x = kImageWidth / kSwizzleTile;
+	*gid0 = (block % blocks_x) * kSwizzleTile + x;
+	*gid1 = get_global_offset(1) + (block / blocks_x) * kSwizzleTile + y;
+#else
+	*gid0 = get_global_id(0);
+	*gid1 = get_global_id(1);
+#endif
+}
+
+// Same as trace, but finds the closest sphere through the BVH nodes/indices.
+// Spheres are tested out of index order, so on equal distance the higher index
+// wins, which is the sphere the loop in trace keeps.
+// With RT_NEIGHBOUR_HINT the first work-item of each work-group traces its pixel first and
+// every ray of the group starts with the sphere it hit, which shrinks maxt before the
+// traversal; the closest hit doesn't depend on the order, so neither does the image.
+// Built with RT_COMPRESSED_BVH the nodes are in the compressed layout.
+__kernel
+void trace_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+               __global float const* radius2, __global float const* color,
+               __global bvh_node_t const* nodes, __global uint const* indices, __global pixel_t* img RT_AOV_PARAMS)
+{
+	size_t gid0, gid1;
+	launch_pixel(&gid0, &gid1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+	RT_START_COST(r);
+
+	int idx = -1;
+
+#ifdef RT_NEIGHBOUR_HINT
+	__local int group_hint;
+
+	if (get_local_id(0) == 0 && get_local_id(1) == 0)
+	{
+		ray first = r;
+		group_hint = bvh_closest(&first, -1, cx, cy, cz, radius2, nodes, indices, false);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (group_hint >= 0)
+		idx = closer_hit(&r, group_hint, -1, cx, cy, cz, radius2);
+#endif
+
+	idx = bvh_closest(&r, idx, cx, cy, cz, radius2, nodes, indices, false);
+
+	write_pixel(img, id, color, idx);
+	RT_WRITE_AOVS(id, r, idx);
+}
+
+// Same as trace, but walks the spheres front to back in the depth order of order/zmin
+// (depth_order in depth_order.h) and stops at the first sphere that starts beyond maxt.
+// On equal distance the higher index wins, as in trace_bvh, which it follows for
+// RT_NEIGHBOUR_HINT too.
+__kernel
+void trace_sorted(__global float const* cx, __global float const* cy, __global float const* cz,
+                  __global float const* radius2, __global float const* color,
+                  __global uint const* order, __global float const* zmin, __global pixel_t* img RT_AOV_PARAMS)
+{
+	size_t gid0, gid1;
+	launch_pixel(&gid0, &gid1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+	RT_START_COST(r);
+
+	int idx = -1;
+
+#ifdef RT_NEIGHBOUR_HINT
+	__local int group_hint;
+
+	if (get_local_id(0) == 0 && get_local_id(1) == 0)
+	{
+		ray first = r;
+		group_hint = sorted_closest(&first, -1, cx, cy, cz, radius2, order, zmin, false);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (group_hint >= 0)
+		idx = closer_hit(&r, group_hint, -1, cx, cy, cz, radius2);
+#endif
+
+	idx = sorted_closest(&r, idx, cx, cy, cz, radius2, order, zmin, false);
+
+	write_pixel(img, id, color, idx);
+	RT_WRITE_AOVS(id, r, idx);
+}
+
+// Temporal reuse of --temporal in animations (render_animation in rt.cpp): the kernel of a
+// frame also gets the image and the id of every pixel of the frame before. The pixels of a
+// tile of kGroupTileSize pixels that dirty leaves clear, one no sphere that moved since
+// covers, keep both as they were. The others test the sphere they hit in the frame before
+// first, so their ray starts out with the maxt of a likely hit, and then every sphere or the
+// BVH out of index order with closer_hit. ids gets the hits of the frame for the next one.
+
+// Copy pixel id of from to img, in any format
+void copy_pixel(__global pixel_t* img, __global pixel_t const* from, size_t id)
+{
+#if RT_FORMAT == RT_FORMAT_FLOAT
+	vstore3(vload3(id, from), id, img);
+#elif RT_FORMAT == RT_FORMAT_HALF
+	// the bits of the halves, without converting them
+	vstore3(vload3(id, (__global ushort const*)from), id, (__global ushort*)img);
+#else
+	img[id] = from[id];
+#endif
+}
+
+// True if the tile of pixel (gid0, gid1) is marked in dirty, a byte per tile in rows
+bool dirty_tile(__global uchar const* dirty, size_t gid0, size_t gid1)
+{
+	size_t tiles_x = (kImageWidth + kGroupTileSize - 1) / kGroupTileSize;
+	return dirty[(gid1 / kGroupTileSize) * tiles_x + gid0 / kGroupTileSize] != 0;
+}
+
+__kernel
+void trace_temporal(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color, __global pixel_t* img,
+                    __global pixel_t const* prev_img, __global int const* prev_ids, __global int* ids, __global uchar const* dirty)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	if (!dirty_tile(dirty, gid0, gid1))
+	{
+		copy_pixel(img, prev_img, id);
+		ids[id] = prev_ids[id];
+		return;
+	}
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+	RT_START_COST(r);
+
+	int hint = prev_ids[id];
+	int idx = hint >= 0 ? closer_hit(&r, hint, -1, cx, cy, cz, radius2) : -1;
+
+	for (int k = 0; k < kNumSpheres; ++k)
+	{
+		idx = closer_hit(&r, k, idx, cx, cy, cz, radius2);
+	}
+
+	write_pixel(img, id, color, idx);
+	ids[id] = idx;
+}
+
+__kernel
+void trace_bvh_temporal(__global float const* cx, __global float const* cy, __global float const* cz,
+                        __global float const* radius2, __global float const* color,
+                        __global bvh_node_t const* nodes, __global uint const* indices, __global pixel_t* img,
+                        __global pixel_t const* prev_img, __global int const* prev_ids, __global int* ids, __global uchar const* dirty)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	if (!dirty_tile(dirty, gid0, gid1))
+	{
+		copy_pixel(img, prev_img, id);
+		ids[id] = prev_ids[id];
+		return;
+	}
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+	RT_START_COST(r);
+
+	int hint = prev_ids[id];
+	int idx = hint >= 0 ? closer_hit(&r, hint, -1, cx, cy, cz, radius2) : -1;
+
+	idx = bvh_closest(&r, idx, cx, cy, cz, radius2, nodes, indices, false);
+
+	write_pixel(img, id, color, idx);
+	ids[id] = idx;
+}
+
+// Occlusion query, mirrors occlusion_ray in accel.h: a ray along +Z from (ox, oy, oz) that is
+// blocked if it meets a sphere within [0, tmax]
+typedef struct tag_occlusion_ray
+{
+	float ox, oy, oz;
+	float tmax;
+} occlusion_ray;
+
+// Ray of query i of queries
+ray query_ray(__global occlusion_ray const* queries, size_t i)
+{
+	ray r;
+	r.ox = queries[i].ox;
+	r.oy = queries[i].oy;
+	r.oz = queries[i].oz;
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = queries[i].tmax;
+	return r;
+}
+
+// Any-hit queries: hits[i] is 1 if a sphere blocks query i, by the hit test of trace, else 0.
+// Each query stops at the first sphere it meets. occluded tests every sphere, occluded_bvh
+// and occluded_sorted walk the structures of trace_bvh and trace_sorted; they take the
+// arguments of those kernels up to the structure, so the host binds the scene arrays the
+// same way, and color is not read.
+__kernel
+void occluded(__global float const* cx, __global float const* cy, __global float const* cz,
+              __global float const* radius2, __global float const* color,
+              __global occlusion_ray const* queries, uint count, __global uchar* hits)
+{
+	size_t i = get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	ray r = query_ray(queries, i);
+	uchar blocked = 0;
+
+	for (size_t k = 0U; k < kNumSpheres && !blocked; ++k)
+	{
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+			blocked = 1;
+	}
+
+	hits[i] = blocked;
+}
+
+__kernel
+void occluded_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+                  __global float const* radius2, __global float const* color,
+                  __global bvh_node_t const* nodes, __global uint const* indices,
+                  __global occlusion_ray const* queries, uint count, __global uchar* hits)
+{
+	size_t i = get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	ray r = query_ray(queries, i);
+	hits[i] = bvh_closest(&r, -1, cx, cy, cz, radius2, nodes, indices, true) >= 0 ? 1 : 0;
+}
+
+__kernel
+void occluded_sorted(__global float const* cx, __global float const* cy, __global float const* cz,
+                     __global float const* radius2, __global float const* color,
+                     __global uint const* order, __global float const* zmin,
+                     __global occlusion_ray const* queries, uint count, __global uchar* hits)
+{
+	size_t i = get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	ray r = query_ray(queries, i);
+	hits[i] = sorted_closest(&r, -1, cx, cy, cz, radius2, order, zmin, true) >= 0 ? 1 : 0;
+}
+
+// One of the k nearest hits of a ray, mirrors ray_hit in accel.h: the distance of the hit and
+// the index of the sphere, the far end of the ray and -1 past the last hit
+typedef struct tag_ray_hit
+{
+	float t;
+	int id;
+} ray_hit;
+
+// Most hits nearest_hits keeps, kMaxNearestHits in accel.h
+#define kMaxNearestHits 16
+
+// Keep sphere k hit at distance hit_t in t and id, the count nearest hits of a ray sorted
+// nearest first, if it is among the nearest k; on equal distance the higher index goes first,
+// as trace keeps it
+void add_nearest(float* t, int* id, uint* count, uint k, float hit_t, int sphere)
+{
+	if (*count == k && !(hit_t < t[k - 1] || (hit_t == t[k - 1] && sphere > id[k - 1])))
+		return;
+
+	uint s = *count < k ? (*count)++ : k - 1;
+
+	for (; s > 0 && (hit_t < t[s - 1] || (hit_t == t[s - 1] && sphere > id[s - 1])); --s)
+	{
+		t[s] = t[s - 1];
+		id[s] = id[s - 1];
+	}
+
+	t[s] = hit_t;
+	id[s] = sphere;
+}
+
+// The k nearest hits of the ray of pixel (gid0, gid1) in a single pass, written to hits k per
+// pixel nearest first: every sphere is tested, or with an order the spheres of the depth order
+// of trace_sorted up to the first one starting beyond the k-th hit. The kernels pass k as a
+// constant, so the hits stay in registers; see render_nearest_hits in cpu_trace.h.
+void nearest_hits(__global float const* cx, __global float const* cy, __global float const* cz, __global float const* radius2,
+                  __global uint const* order, __global float const* zmin, __global ray_hit* hits, uint k)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+
+	if (gid0 >= kImageWidth || gid1 >= kImageHeight)
+		return;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	float t[kMaxNearestHits];
+	int id[kMaxNearestHits];
+	uint count = 0;
+
+	for (size_t l = 0U; l < kNumSpheres; ++l)
+	{
+		if (order && zmin[l] - r.oz > (count < k ? r.maxt : t[k - 1]))
+			break;
+
+		int sphere = order ? (int)order[l] : (int)l;
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[sphere], cy[sphere], cz[sphere], radius2[sphere], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+			add_nearest(t, id, &count, k, t0 > 0.f ? t0 : t1, sphere);
+	}
+
+	__global ray_hit* pixel = hits + (gid1 * kImageWidth + gid0) * k;
+
+	for (uint s = 0; s < k; ++s)
+	{
+		pixel[s].t = s < count ? t[s] : r.maxt;
+		pixel[s].id = s < count ? id[s] : -1;
+	}
+}
+
+// The sizes of k the host picks from (query_nearest_hits), brute force and through the depth
+// order; they take the arguments of trace and trace_sorted up to the structure, color unread
+__kernel
+void nearest_hits_2(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, 0, 0, hits, 2U);
+}
+
+__kernel
+void nearest_hits_4(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, 0, 0, hits, 4U);
+}
+
+__kernel
+void nearest_hits_8(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, 0, 0, hits, 8U);
+}
+
+__kernel
+void nearest_hits_16(__global float const* cx, __global float const* cy, __global float const* cz,
+                     __global float const* radius2, __global float const* color, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, 0, 0, hits, 16U);
+}
+
+__kernel
+void nearest_hits_sorted_2(__global float const* cx, __global float const* cy, __global float const* cz,
+                           __global float const* radius2, __global float const* color,
+                           __global uint const* order, __global float const* zmin, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, order, zmin, hits, 2U);
+}
+
+__kernel
+void nearest_hits_sorted_4(__global float const* cx, __global float const* cy, __global float const* cz,
+                           __global float const* radius2, __global float const* color,
+                           __global uint const* order, __global float const* zmin, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, order, zmin, hits, 4U);
+}
+
+__kernel
+void nearest_hits_sorted_8(__global float const* cx, __global float const* cy, __global float const* cz,
+                           __global float const* radius2, __global float const* color,
+                           __global uint const* order, __global float const* zmin, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, order, zmin, hits, 8U);
+}
+
+__kernel
+void nearest_hits_sorted_16(__global float const* cx, __global float const* cy, __global float const* cz,
+                            __global float const* radius2, __global float const* color,
+                            __global uint const* order, __global float const* zmin, __global ray_hit* hits)
+{
+	nearest_hits(cx, cy, cz, radius2, order, zmin, hits, 16U);
+}
+
+// Copy of a sphere cluster, mirrors sphere_instance in instances.h. Sphere k of the cluster
+// lies at its center * scale + offset with radius * scale, and is sphere index_base + k of
+// the expanded scene.
+typedef struct tag_sphere_instance
+{
+	float offset[3];
+	float scale;
+	int root;
+	int index_base;
+	uint cluster;
+	uint first;
+} sphere_instance;
+
+// Relative widening of the cluster nodes placed by an instance, covers the rounding of the
+// placement like kBoundsSlack in scene.cpp covers the one of the sphere bounds
+#define kInstanceSlack (1.f / (1 << 20))
+
+// closer_hit for cluster sphere k placed by inst, placed the way expand_instances does so the
+// roots are those of the expanded scene. The hit is the sphere's expanded index, *hit_k the
+// cluster sphere whose color it takes.
+int instance_hit(ray* r, __global sphere_instance const* inst, int k, int idx, int* hit_k, __global float const* cx, __global float const* cy,
+                 __global float const* cz, __global float const* radius)
+{
+	float s = inst->scale;
+	float placed_radius = radius[k] * s;
+	int expanded = inst->index_base + k;
+
+	float t0, t1;
+
+	if (sphere_roots(r, cx[k] * s + inst->offset[0], cy[k] * s + inst->offset[1], cz[k] * s + inst->offset[2], placed_radius * placed_radius, &t0, &t1))
+	{
+		if (t0 <= r->maxt && t1 >= 0.f && !(t0 == r->maxt && expanded < idx))
+		{
+			r->maxt = t0 > 0.f ? t0 : t1;
+			*hit_k = k;
+			return expanded;
+		}
+	}
+
+	return idx;
+}
+
+// Closest sphere of r through the cluster BVH of inst, its nodes placed by the instance
+int cluster_closest(ray* r, __global sphere_instance const* inst, int idx, int* hit_k, __global float const* cx, __global float const* cy,
+                    __global float const* cz, __global float const* radius, __global bvh_node const* nodes, __global uint const* indices)
+{
+	int stack[kBvhMaxDepth];
+	int sp = 0;
+	int node = inst->root;
+
+	float s = inst->scale;
+
+	for (;;)
+	{
+		__global bvh_node const* n = nodes + node;
+
+		float lo[3], hi[3];
+
+		for (int a = 0; a < 3; ++a)
+		{
+			lo[a] = n->bmin[a] * s + inst->offset[a];
+			hi[a] = n->bmax[a] * s + inst->offset[a];
+
+			float pad = (fabs(lo[a]) + fabs(hi[a])) * kInstanceSlack;
+			lo[a] -= pad;
+			hi[a] += pad;
+		}
+
+		bool visit = r->ox >= lo[0] && r->ox <= hi[0] && r->oy >= lo[1] && r->oy <= hi[1] && lo[2] - r->oz <= r->maxt && hi[2] - r->oz >= 0.f;
+
+		if (visit && n->count == 0)
+		{
+			// the scale is positive, the order along +Z is the one of the cluster
+			int first = node + 1;
+			int second = n->offset;
+
+			if (nodes[second].bmin[2] < nodes[first].bmin[2])
+			{
+				int tmp = first;
+				first = second;
+				second = tmp;
+			}
+
+			stack[sp++] = second;
+			node = first;
+			continue;
+		}
+
+		if (visit)
+		{
+			for (int l = 0; l < n->count; ++l)
+			{
+				idx = instance_hit(r, inst, (int)indices[n->offset + l], idx, hit_k, cx, cy, cz, radius);
+			}
+		}
+
+		if (sp == 0)
+			break;
+
+		node = stack[--sp];
+	}
+
+	return idx;
+}
+
+// Two level BVH traversal of an instanced scene (instance_set in instances.h): top_nodes and
+// top_indices find the instances a ray passes, the nodes of each instance's cluster in
+// nodes/indices its spheres. cx, cy, cz, radius and color hold the spheres of all clusters once,
+// so the device holds the unique spheres only. Every sphere is tested as placed in the
+// expanded scene and ties go to the higher expanded index, as in trace_bvh, so the image is the
+// one of the expanded scene.
+__kernel
+void trace_instanced(__global float const* cx, __global float const* cy, __global float const* cz,
+                     __global float const* radius, __global float const* color,
+                     __global bvh_node const* nodes, __global uint const* indices, __global sphere_instance const* instances,
+                     __global bvh_node const* top_nodes, __global uint const* top_indices, __global pixel_t* img)
+{
+	size_t gid0, gid1;
+	launch_pixel(&gid0, &gid1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+	int hit_k = -1;
+
+	int stack[kBvhMaxDepth];
+	int sp = 0;
+	int node = 0;
+
+	for (;;)
+	{
+		__global bvh_node const* n = top_nodes + node;
+
+		bool visit = r.ox >= n->bmin[0] && r.ox <= n->bmax[0] && r.oy >= n->bmin[1] && r.oy <= n->bmax[1] &&
+		             n->bmin[2] - r.oz <= r.maxt && n->bmax[2] - r.oz >= 0.f;
+
+		if (visit && n->count == 0)
+		{
+			int first = node + 1;
+			int second = n->offset;
+
+			if (top_nodes[second].bmin[2] < top_nodes[first].bmin[2])
+			{
+				int tmp = first;
+				first = second;
+				second = tmp;
+			}
+
+			stack[sp++] = second;
+			node = first;
+			continue;
+		}
+
+		if (visit)
+		{
+			for (int l = 0; l < n->count; ++l)
+			{
+				idx = cluster_closest(&r, instances + top_indices[n->offset + l], idx, &hit_k, cx, cy, cz, radius, nodes, indices);
+			}
+		}
+
+		if (sp == 0)
+			break;
+
+		node = stack[--sp];
+	}
+
+	write_pixel(img, id, color, idx >= 0 ? hit_k : -1);
+}
+
+// Window of one image of a batch, mirrors view_window in render_device.h. The host divides
+// the window by the image size like the CPU tracers do, so the rays don't depend on how
+// the device rounds a division.
+typedef struct tag_view_window
+{
+	float left, bottom;
+	float step_x, step_y;
+} view_window;
+
+// Ray of pixel (gid0, gid1) of window w, between the depths of RT_NEAR and RT_FAR
+ray window_ray(__global view_window const* w, size_t gid0, size_t gid1)
+{
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = w->left + w->step_x * (gid0 + 0.5f);
+	r.oy = w->bottom + w->step_y * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+	return r;
+}
+
+// Same as trace for a batch of views: global id 2 selects the window, and the images of the
+// windows follow each other in img, kImageWidth x kImageHeight pixels each
+__kernel
+void trace_views(__global float const* cx, __global float const* cy, __global float const* cz,
+                 __global float const* radius2, __global float const* color,
+                 __global view_window const* windows, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t gid2 = get_global_id(2);
+	size_t id = ((gid2 * kImageHeight + gid1) * kImageWidth) + gid0;
+
+	ray r = window_ray(windows + gid2, gid0, gid1);
+
+	int idx = -1;
+
+	RT_SPHERE_LOOP
+	for (size_t k = 0U; k < kNumSpheres; ++k)
+	{
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+		{
+			r.maxt = t0 > 0.f ? t0 : t1;
+			idx = k;
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+}
+
+// Same as trace_views through the BVH of trace_bvh, which doesn't depend on the window
+__kernel
+void trace_views_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+                     __global float const* radius2, __global float const* color,
+                     __global bvh_node_t const* nodes, __global uint const* indices,
+                     __global view_window const* windows, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t gid2 = get_global_id(2);
+	size_t id = ((gid2 * kImageHeight + gid1) * kImageWidth) + gid0;
+
+	ray r = window_ray(windows + gid2, gid0, gid1);
+
+	write_pixel(img, id, color, bvh_closest(&r, -1, cx, cy, cz, radius2, nodes, indices, false));
+}
+
+// Same as trace_views in the depth order of trace_sorted
+__kernel
+void trace_views_sorted(__global float const* cx, __global float const* cy, __global float const* cz,
+                        __global float const* radius2, __global float const* color,
+                        __global uint const* order, __global float const* zmin,
+                        __global view_window const* windows, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t gid2 = get_global_id(2);
+	size_t id = ((gid2 * kImageHeight + gid1) * kImageWidth) + gid0;
+
+	ray r = window_ray(windows + gid2, gid0, gid1);
+
+	write_pixel(img, id, color, sorted_closest(&r, -1, cx, cy, cz, radius2, order, zmin, false));
+}
+
+// Same as trace, but tests only the spheres binned into the pixel's cell of the
+// screen-space grid (sphere_grid in grid.h). Cell lists keep index order, so the
+// result matches trace exactly.
+__kernel
+void trace_grid(__global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global float const* color,
+                __global uint const* cell_start, __global uint const* indices,
+                uint cell_size, uint cells_x, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	uint cell = (gid1 / cell_size) * cells_x + gid0 / cell_size;
+	uint end = cell_start[cell + 1];
+
+	for (uint l = cell_start[cell]; l < end; ++l)
+	{
+		uint k = indices[l];
+
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1))
+		{
+			if (t0 <= r.maxt && t1 >= 0.f)
+			{
+				r.maxt = t0 > 0.f ? t0 : t1;
+				idx = k;
+			}
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+}
+
+// Same as trace_grid, for work-groups of exactly one grid cell: the group stages its cell's
+// list in local memory in batches, so each listed sphere is read from global memory once per
+// tile instead of once per pixel. The list order, and so the hit, is the one of trace_grid.
+__kernel __attribute__((reqd_work_group_size(kGroupTileSize, kGroupTileSize, 1)))
+void trace_grid_local(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color,
+                      __global uint const* cell_start, __global uint const* indices,
+                      uint cell_size, uint cells_x, __global pixel_t* img)
+{
+	__local float lcx[kLocalBatch];
+	__local float lcy[kLocalBatch];
+	__local float lcz[kLocalBatch];
+	__local float lradius2[kLocalBatch];
+	__local uint lindex[kLocalBatch];
+
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	size_t lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+	size_t lsz = get_local_size(0) * get_local_size(1);
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	// the same cell for the whole work-group
+	uint cell = (gid1 / cell_size) * cells_x + gid0 / cell_size;
+	uint begin = cell_start[cell];
+	uint end = cell_start[cell + 1];
+
+	for (uint base = begin; base < end; base += kLocalBatch)
+	{
+		uint count = min((uint)kLocalBatch, end - base);
+
+		for (size_t l = lid; l < (size_t)count; l += lsz)
+		{
+			uint k = indices[base + l];
+			lcx[l] = cx[k];
+			lcy[l] = cy[k];
+			lcz[l] = cz[k];
+			lradius2[l] = radius2[k];
+			lindex[l] = k;
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint l = 0; l < count; ++l)
+		{
+			float t0, t1;
+
+			if (sphere_roots(&r, lcx[l], lcy[l], lcz[l], lradius2[l], &t0, &t1))
+			{
+				if (t0 <= r.maxt && t1 >= 0.f)
+				{
+					r.maxt = t0 > 0.f ? t0 : t1;
+					idx = lindex[l];
+				}
+			}
+		}
+
+		// The next batch overwrites the local arrays
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	write_pixel(img, id, color, idx);
+}
+
+// Sphere splatting: spheres are visited in index order and only touch the pixels of their
+// footprint (pixel rectangle x0, y0, x1, y1 from sphere_footprints in grid.h). Spheres whose
+// footprint misses the work-group's tile are skipped by the whole group at once. Every pixel
+// sees the same sequence of tests as in trace, so the result matches trace exactly.
+__kernel
+void splat(__global float const* cx, __global float const* cy, __global float const* cz,
+           __global float const* radius2, __global float const* color,
+           __global int4 const* footprint, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	int px = (int)gid0;
+	int py = (int)gid1;
+
+	// Tile covered by the work-group, from the global id so a global offset is honoured
+	int tx0 = px - (int)get_local_id(0);
+	int ty0 = py - (int)get_local_id(1);
+	int tx1 = tx0 + (int)get_local_size(0);
+	int ty1 = ty0 + (int)get_local_size(1);
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	RT_SPHERE_LOOP
+	for (int k = 0; k < kNumSpheres; ++k)
+	{
+		int4 rect = footprint[k];
+
+		if (rect.x >= tx1 || rect.z <= tx0 || rect.y >= ty1 || rect.w <= ty0)
+			continue;
+
+		if (px < rect.x || px >= rect.z || py < rect.y || py >= rect.w)
+			continue;
+
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1))
+		{
+			if (t0 <= r.maxt && t1 >= 0.f)
+			{
+				r.maxt = t0 > 0.f ? t0 : t1;
+				idx = k;
+			}
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+}
+
+#ifdef RT_SPLAT_ATOMIC
+#pragma OPENCL EXTENSION cl_khr_int64_extended_atomics : enable
+
+// Depth buffer entry of a pixel no sphere was splatted into
+#define kEmptyDepthKey 0xFFFFFFFFFFFFFFFFUL
+
+// Depth buffer entry of a hit of sphere k at t >= 0: the bits of t, which order like the
+// floats, above the inverted index, so the smallest entry is the closest hit and the highest
+// index of the ones at that depth
+ulong depth_key(float t, int k)
+{
+	uint bits = as_uint(t);
+	bits ^= (bits & 0x80000000U) != 0U ? 0xFFFFFFFFU : 0x80000000U;
+	return ((ulong)bits << 32) | (ulong)~(uint)k;
+}
+
+// Sphere splatting without an order between the spheres (-D RT_SPLAT_ATOMIC, on devices with
+// cl_khr_int64_extended_atomics, which has the 64-bit atom_min): one work-item per sphere tests the pixels of its footprint in
+// rows [row_begin, row_end) and keeps its hits with atom_min on the depth_key entries of
+// depth, which the host fills with kEmptyDepthKey first. The host picks it only if every
+// sphere lies beyond the near plane: every hit is then the first root, and the sphere trace
+// keeps is the closest one, the highest index at equal depth, the one of the smallest entry.
+// resolve_splat writes the colors.
+__kernel
+void splat_atomic(__global float const* cx, __global float const* cy, __global float const* cz,
+                  __global float const* radius2, __global float const* color,
+                  __global int4 const* footprint, uint row_begin, uint row_end, __global ulong* depth)
+{
+	int k = (int)get_global_id(0);
+
+	if (k >= kNumSpheres)
+		return;
+
+	int4 rect = footprint[k];
+	int y0 = max(rect.y, (int)row_begin);
+	int y1 = min(rect.w, (int)row_end);
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	for (int py = y0; py < y1; ++py)
+	{
+		r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (py + 0.5f);
+
+		for (int px = rect.x; px < rect.z; ++px)
+		{
+			r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (px + 0.5f);
+
+			float t0, t1;
+
+			if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+			{
+				atom_min(&depth[(size_t)py * kImageWidth + px], depth_key(t0, k));
+			}
+		}
+	}
+}
+
+// Write the pixels of the launch from the depth buffer of splat_atomic
+__kernel
+void resolve_splat(__global float const* color, __global ulong const* depth, __global pixel_t* img)
+{
+	size_t id = (get_global_id(1) * kImageWidth) + get_global_id(0);
+	ulong key = depth[id];
+
+	write_pixel(img, id, color, key == kEmptyDepthKey ? -1 : (int)~(uint)key);
+}
+#endif
+
+// Same as trace, but the work-group cooperatively copies batches of kLocalBatch spheres
+// into local memory first, so each sphere is read from global memory once per group
+// instead of once per pixel.
+__kernel
+void trace_local(__global float const* cx, __global float const* cy, __global float const* cz,
+                 __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	__local float lcx[kLocalBatch];
+	__local float lcy[kLocalBatch];
+	__local float lcz[kLocalBatch];
+	__local float lradius2[kLocalBatch];
+
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	size_t lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+	size_t lsz = get_local_size(0) * get_local_size(1);
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	for (int base = 0; base < kNumSpheres; base += kLocalBatch)
+	{
+		int count = min(kLocalBatch, kNumSpheres - base);
+
+		for (size_t l = lid; l < (size_t)count; l += lsz)
+		{
+			lcx[l] = cx[base + l];
+			lcy[l] = cy[base + l];
+			lcz[l] = cz[base + l];
+			lradius2[l] = radius2[base + l];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (int l = 0; l < count; ++l)
+		{
+			float t0, t1;
+
+			if (sphere_roots(&r, lcx[l], lcy[l], lcz[l], lradius2[l], &t0, &t1))
+			{
+				if (t0 <= r.maxt && t1 >= 0.f)
+				{
+					r.maxt = t0 > 0.f ? t0 : t1;
+					idx = base + l;
+				}
+			}
+		}
+
+		// The next batch overwrites the local arrays
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	write_pixel(img, id, color, idx);
+}
+
+// Same as trace_local with two batches in local memory: async_work_group_copy fetches batch
+// N + 1 into one while the work-items test batch N in the other, so the loads of the next batch
+// overlap the intersection tests instead of the group waiting on them between two barriers.
+// One barrier per batch keeps a buffer from being refilled while a work-item still tests it.
+__kernel
+void trace_local_async(__global float const* cx, __global float const* cy, __global float const* cz,
+                       __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	__local float lcx[2][kLocalBatch];
+	__local float lcy[2][kLocalBatch];
+	__local float lcz[2][kLocalBatch];
+	__local float lradius2[2][kLocalBatch];
+
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	// the copies of a batch chain on one event
+	int count = min(kLocalBatch, kNumSpheres);
+	event_t fetched = async_work_group_copy(lcx[0], cx, count, 0);
+	fetched = async_work_group_copy(lcy[0], cy, count, fetched);
+	fetched = async_work_group_copy(lcz[0], cz, count, fetched);
+	fetched = async_work_group_copy(lradius2[0], radius2, count, fetched);
+
+	for (int base = 0, b = 0; base < kNumSpheres; base += kLocalBatch, b ^= 1)
+	{
+		count = min(kLocalBatch, kNumSpheres - base);
+
+		wait_group_events(1, &fetched);
+
+		// every work-item is done with the batch before, whose buffer the next one fills
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		int next = base + kLocalBatch;
+
+		if (next < kNumSpheres)
+		{
+			int next_count = min(kLocalBatch, kNumSpheres - next);
+			fetched = async_work_group_copy(lcx[b ^ 1], cx + next, next_count, 0);
+			fetched = async_work_group_copy(lcy[b ^ 1], cy + next, next_count, fetched);
+			fetched = async_work_group_copy(lcz[b ^ 1], cz + next, next_count, fetched);
+			fetched = async_work_group_copy(lradius2[b ^ 1], radius2 + next, next_count, fetched);
+		}
+
+		for (int l = 0; l < count; ++l)
+		{
+			float t0, t1;
+
+			if (sphere_roots(&r, lcx[b][l], lcy[b][l], lcz[b][l], lradius2[b][l], &t0, &t1))
+			{
+				if (t0 <= r.maxt && t1 >= 0.f)
+				{
+					r.maxt = t0 > 0.f ? t0 : t1;
+					idx = base + l;
+				}
+			}
+		}
+	}
+
+	// a scene without spheres leaves the empty first copy to wait for
+	if (kNumSpheres == 0)
+		wait_group_events(1, &fetched);
+
+	write_pixel(img, id, color, idx);
+}
+
+// Same as trace with persistent work-groups: the host launches only enough groups to fill
+// the device and each kGroupTileSize x kGroupTileSize group pulls tiles of rows
+// [row_begin, row_end) from the atomic counter next_tile, which starts at 0, until all
+// are taken. Cheap and expensive tiles then balance across the groups.
+__kernel __attribute__((reqd_work_group_size(kGroupTileSize, kGroupTileSize, 1)))
+void trace_persistent(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color,
+                      __global uint* next_tile, uint row_begin, uint row_end, __global pixel_t* img)
+{
+	__local uint tile;
+
+	uint tiles_x = (kImageWidth + kGroupTileSize - 1) / kGroupTileSize;
+	uint num_tiles = tiles_x * ((row_end - row_begin + kGroupTileSize - 1) / kGroupTileSize);
+
+	for (;;)
+	{
+		if (get_local_id(0) == 0 && get_local_id(1) == 0)
+			tile = atomic_inc(next_tile);
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		uint t = tile;
+		// Every work-item has read tile before it is overwritten by the next pull
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (t >= num_tiles)
+			break;
+
+		uint px = (t % tiles_x) * kGroupTileSize + (uint)get_local_id(0);
+		uint py = row_begin + (t / tiles_x) * kGroupTileSize + (uint)get_local_id(1);
+
+		// Work-items of partial tiles on the right and bottom edges keep pulling with the group
+		if (px >= kImageWidth || py >= row_end)
+			continue;
+
+		ray r;
+		r.oz = RT_NEAR;
+		r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (px + 0.5f);
+		r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (py + 0.5f);
+		r.dx = r.dy = 0.f;
+		r.dz = 1.f;
+		r.maxt = RT_FAR - RT_NEAR;
+
+		int idx = -1;
+
+		RT_SPHERE_LOOP
+		for (int k = 0; k < kNumSpheres; ++k)
+		{
+			float t0, t1;
+
+			if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1))
+			{
+				if (t0 <= r.maxt && t1 >= 0.f)
+				{
+					r.maxt = t0 > 0.f ? t0 : t1;
+					idx = k;
+				}
+			}
+		}
+
+		write_pixel(img, (size_t)py * kImageWidth + px, color, idx);
+	}
+}
+
+// One pass of the out-of-core brute force: tests the count spheres of a chunk, which are spheres
+// base .. base + count - 1 of the scene, and carries the closest hit of every pixel from chunk
+// to chunk in maxt, idx and its color in rgb. Chunks run in index order and maxt is kept as
+// is, so the sequence of tests and updates is the one of trace. The first chunk (base 0)
+// starts every pixel empty, resolve_chunks writes the image after the last one.
+__kernel
+void trace_chunk(__global float const* cx, __global float const* cy, __global float const* cz,
+                 __global float const* radius2, __global float const* color, uint base, uint count,
+                 __global float* maxt, __global int* idx, __global float* rgb)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = base == 0 ? RT_FAR - RT_NEAR : maxt[id];
+
+	int hit = -1;
+
+	for (uint k = 0U; k < count; ++k)
+	{
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1))
+		{
+			if (t0 <= r.maxt && t1 >= 0.f)
+			{
+				r.maxt = t0 > 0.f ? t0 : t1;
+				hit = (int)k;
+			}
+		}
+	}
+
+	maxt[id] = r.maxt;
+
+	if (hit >= 0)
+	{
+		idx[id] = (int)base + hit;
+		rgb[id * 3] = color[hit * 3];
+		rgb[id * 3 + 1] = color[hit * 3 + 1];
+		rgb[id * 3 + 2] = color[hit * 3 + 2];
+	}
+	else if (base == 0)
+	{
+		idx[id] = -1;
+	}
+}
+
+// Write the pixels trace_chunk has resolved, the color of the closest sphere is already in rgb
+__kernel
+void resolve_chunks(__global int const* idx, __global float const* rgb, __global pixel_t* img)
+{
+	size_t id = (get_global_id(1) * kImageWidth) + get_global_id(0);
+
+#if RT_FORMAT == RT_FORMAT_ID16 || RT_FORMAT == RT_FORMAT_ID32
+	write_pixel(img, id, rgb, idx[id]);
+#else
+	write_pixel(img, id, rgb, idx[id] >= 0 ? (int)id : -1);
+#endif
+}
+
+// Same as trace, but the sphere geometry lives in constant memory, which is
+// cached and broadcast when all work-items read the same sphere.
+__kernel
+void trace_constant(__constant float* cx, __constant float* cy, __constant float* cz,
+                    __constant float* radius2, __global float const* color, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	RT_SPHERE_LOOP
+	for (int k = 0; k < kNumSpheres; ++k)
+	{
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1))
+		{
+			if (t0 <= r.maxt && t1 >= 0.f)
+			{
+				r.maxt = t0 > 0.f ? t0 : t1;
+				idx = k;
+			}
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+}
+
+#ifdef RT_IMAGE_READS
+#ifdef RT_IMAGE_2D
+__constant sampler_t kGeometrySampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+
+#define RT_GEOMETRY_IMAGE image2d_t
+#define RT_READ_GEOMETRY(geometry, k) read_imagef(geometry, kGeometrySampler, (int2)((int)((k) % kGeometryRow), (int)((k) / kGeometryRow)))
+#else
+#define RT_GEOMETRY_IMAGE image1d_buffer_t
+#define RT_READ_GEOMETRY(geometry, k) read_imagef(geometry, (int)(k))
+#endif
+
+// Same as trace, but the geometry of sphere k is texel k of an image of CL_RGBA CL_FLOAT texels
+// (cx, cy, cz, radius2), read with read_imagef through the texture cache, which serves the
+// work-items all reading the same sphere where the buffer loads of trace bypass it on some
+// GPUs. The image is an image1d_buffer_t, or with RT_IMAGE_2D an image2d_t of kGeometryRow
+// texels per row for more spheres than a buffer image holds. Nearest reads of float texels
+// return the floats themselves, so the result matches trace exactly. The host builds it with
+// RT_IMAGE_READS on devices with images (--image-reads); the buffers of the spheres stay
+// arguments so it takes the arguments of trace.
+__kernel
+void trace_image(__global float const* cx, __global float const* cy, __global float const* cz,
+                 __global float const* radius2, __global float const* color, __read_only RT_GEOMETRY_IMAGE geometry, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	RT_SPHERE_LOOP
+	for (size_t k = 0U; k < kNumSpheres; ++k)
+	{
+		float4 sphere = RT_READ_GEOMETRY(geometry, k);
+		float t0, t1;
+
+		if (sphere_roots(&r, sphere.x, sphere.y, sphere.z, sphere.w, &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+		{
+			r.maxt = t0 > 0.f ? t0 : t1;
+			idx = k;
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+}
+#endif
+
+#ifdef RT_SUBGROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+
+// Same as trace, but each sub-group (a wavefront) loads a block of as many spheres as it has
+// lanes, one per lane, and hands them to every lane with sub_group_broadcast: a sphere is read
+// once per sub-group instead of once per work-item, without local memory or barriers. The
+// host builds it with RT_SUBGROUPS on devices with cl_khr_subgroups. The spheres are tested
+// in index order, so the result matches trace exactly.
+__kernel
+void trace_subgroup(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color, __global pixel_t* img)
+{
+	size_t gid0 = get_global_id(0);
+	size_t gid1 = get_global_id(1);
+	size_t id = (gid1 * kImageWidth) + gid0;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+
+	int idx = -1;
+
+	// the last sub-group of a work-group may be smaller, each one steps by its own size
+	int lanes = (int)get_sub_group_size();
+	int lane = (int)get_sub_group_local_id();
+
+	for (int base = 0; base < kNumSpheres; base += lanes)
+	{
+		int count = min(lanes, kNumSpheres - base);
+		int k = base + min(lane, count - 1);
+
+		float lcx = cx[k];
+		float lcy = cy[k];
+		float lcz = cz[k];
+		float lradius2 = radius2[k];
+
+		for (int l = 0; l < count; ++l)
+		{
+			float t0, t1;
+
+			if (sphere_roots(&r, sub_group_broadcast(lcx, (uint)l), sub_group_broadcast(lcy, (uint)l), sub_group_broadcast(lcz, (uint)l),
+			                 sub_group_broadcast(lradius2, (uint)l), &t0, &t1))
+			{
+				if (t0 <= r.maxt && t1 >= 0.f)
+				{
+					r.maxt = t0 > 0.f ? t0 : t1;
+					idx = base + l;
+				}
+			}
+		}
+	}
+
+	write_pixel(img, id, color, idx);
+}
+#endif
+
+// Philox4x32-10 over counter with the key (key0, key1), philox4x32 in scene.cpp
+uint4 philox4x32(uint4 counter, uint key0, uint key1)
+{
+	for (int round = 0; round < 10; ++round)
+	{
+		uint hi0 = mul_hi(0xD2511F53U, counter.x);
+		uint lo0 = 0xD2511F53U * counter.x;
+		uint hi1 = mul_hi(0xCD9E8D57U, counter.z);
+		uint lo1 = 0xCD9E8D57U * counter.z;
+
+		counter = (uint4)(hi1 ^ counter.y ^ key0, lo1, hi0 ^ counter.w ^ key1, lo0);
+
+		key0 += 0x9E3779B9U;
+		key1 += 0xBB67AE85U;
+	}
+
+	return counter;
+}
+
+// Top 24 bits of bits as a float in [0, 1), exact
+float unit_float(uint bits)
+{
+	return (float)(bits >> 8) * (1.f / 16777216.f);
+}
+
+// Sphere i of the philox scene generator (generate_sphere_range in scene.cpp) for every
+// work-item i < count, written in the sphere_soa layout
+__kernel
+void generate_philox(uint seed, uint count, __global float* cx, __global float* cy, __global float* cz,
+                     __global float* radius2, __global float* radius, __global float* color)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	uint4 first = philox4x32((uint4)(i, 0U, 0U, 0U), seed, 0U);
+	uint4 second = philox4x32((uint4)(i, 1U, 0U, 0U), seed, 0U);
+
+	float r = (unit_float(first.w) + 0.1f) * 1.5f;
+
+	cx[i] = unit_float(first.x) * 20.f - 10.f;
+	cy[i] = unit_float(first.y) * 20.f - 10.f;
+	cz[i] = unit_float(first.z) * 20.f - 5.f;
+	radius[i] = r;
+	radius2[i] = r * r;
+	color[i * 3] = unit_float(second.x);
+	color[i * 3 + 1] = unit_float(second.y);
+	color[i * 3 + 2] = unit_float(second.z);
+}
+
+// On-device linear BVH of --animate with --accel bvh, rebuilt from the moved centers
+// (lbvh_builder.h): Morton codes, a radix sort and the hierarchy of Karras' binary radix tree,
+// emitted as the bvh_node array and indices trace_bvh reads. A refit reruns lbvh_bounds and
+// lbvh_emit over the tree of the last build. Keys sort in
+// kRadixBits digits, a work-group of kRadixGroup work-items takes one key each.
+#define kRadixGroup 256
+#define kRadixBits 4
+#define kRadixDigits 16
+
+// 10 bits of v spread to every third bit
+uint spread_bits(uint v)
+{
+	v = (v | (v << 16)) & 0x030000FFU;
+	v = (v | (v << 8)) & 0x0300F00FU;
+	v = (v | (v << 4)) & 0x030C30C3U;
+	v = (v | (v << 2)) & 0x09249249U;
+	return v;
+}
+
+// 30 bit Morton code of the center of every sphere i < count in the box of the centers from
+// lo with scale the reciprocal of its extent, and its index as the value sorted along
+__kernel
+void lbvh_morton(__global float const* cx, __global float const* cy, __global float const* cz, uint count,
+                 float lo_x, float lo_y, float lo_z, float scale_x, float scale_y, float scale_z,
+                 __global uint* keys, __global uint* values)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	uint x = (uint)clamp((cx[i] - lo_x) * scale_x * 1024.f, 0.f, 1023.f);
+	uint y = (uint)clamp((cy[i] - lo_y) * scale_y * 1024.f, 0.f, 1023.f);
+	uint z = (uint)clamp((cz[i] - lo_z) * scale_z * 1024.f, 0.f, 1023.f);
+
+	keys[i] = (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+	values[i] = i;
+}
+
+// Digit counts of the keys of each work-group at shift, histogram[digit * groups + group]
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void radix_count(__global uint const* keys, uint count, uint shift, __global uint* histogram)
+{
+	__local uint counts[kRadixDigits];
+
+	uint i = (uint)get_global_id(0);
+	uint lid = (uint)get_local_id(0);
+
+	if (lid < kRadixDigits)
+		counts[lid] = 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (i < count)
+		atomic_inc(&counts[(keys[i] >> shift) & (kRadixDigits - 1)]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid < kRadixDigits)
+		histogram[lid * get_num_groups(0) + get_group_id(0)] = counts[lid];
+}
+
+// Exclusive prefix sum of the size counts of histogram in place, by one work-group: each
+// work-item sums a run of counts, the run totals are scanned and each run rewritten from its offset
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void radix_scan(__global uint* histogram, uint size)
+{
+	__local uint totals[kRadixGroup];
+
+	uint lid = (uint)get_local_id(0);
+	uint run = (size + kRadixGroup - 1) / kRadixGroup;
+	uint begin = min(lid * run, size);
+	uint end = min(begin + run, size);
+
+	uint sum = 0U;
+
+	for (uint l = begin; l < end; ++l)
+		sum += histogram[l];
+
+	totals[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid == 0)
+	{
+		uint offset = 0U;
+
+		for (uint l = 0; l < kRadixGroup; ++l)
+		{
+			uint total = totals[l];
+			totals[l] = offset;
+			offset += total;
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint offset = totals[lid];
+
+	for (uint l = begin; l < end; ++l)
+	{
+		uint n = histogram[l];
+		histogram[l] = offset;
+		offset += n;
+	}
+}
+
+// Exclusive prefix sum of the flags of the work-group, and their total in *total
+uint group_scan(__local uint* flags, uint lid, uint flag, uint* total)
+{
+	flags[lid] = flag;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint step = 1; step < kRadixGroup; step <<= 1)
+	{
+		uint add = lid >= step ? flags[lid - step] : 0U;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		flags[lid] += add;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	*total = flags[kRadixGroup - 1];
+	uint inclusive = flags[lid];
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return inclusive - flag;
+}
+
+// Stable scatter of the keys and values of each work-group by their digit at shift, to the
+// offsets radix_scan left in histogram. The keys of a group are sorted by their digit in local
+// memory with one split per bit, a work-item past count takes the largest key and stays last.
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void radix_scatter(__global uint const* keys_in, __global uint const* values_in, __global uint* keys_out, __global uint* values_out,
+                   uint count, uint shift, __global uint const* histogram)
+{
+	__local uint keys[kRadixGroup];
+	__local uint values[kRadixGroup];
+	__local uint flags[kRadixGroup];
+	__local uint starts[kRadixDigits];
+
+	uint i = (uint)get_global_id(0);
+	uint lid = (uint)get_local_id(0);
+	uint group = (uint)get_group_id(0);
+	uint valid = min((uint)kRadixGroup, count - group * kRadixGroup);
+
+	uint key = i < count ? keys_in[i] : 0xFFFFFFFFU;
+	uint value = i < count ? values_in[i] : 0U;
+
+	for (uint b = 0; b < kRadixBits; ++b)
+	{
+		uint zero = ((key >> (shift + b)) & 1U) == 0U ? 1U : 0U;
+		uint zeros;
+		uint before = group_scan(flags, lid, zero, &zeros);
+		uint to = zero ? before : zeros + lid - before;
+
+		keys[to] = key;
+		values[to] = value;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		key = keys[lid];
+		value = values[lid];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// the first position of every digit in the sorted group, keys still holds the sorted keys
+	uint digit = (key >> shift) & (kRadixDigits - 1);
+
+	if (lid < valid && (lid == 0 || ((keys[lid - 1] >> shift) & (kRadixDigits - 1)) != digit))
+		starts[digit] = lid;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid < valid)
+	{
+		uint to = histogram[digit * get_num_groups(0) + group] + lid - starts[digit];
+		keys_out[to] = key;
+		values_out[to] = value;
+	}
+}
+
+// Length of the common prefix of the keys at i and j, their indices breaking ties between
+// equal keys, -1 if j is outside the count keys
+int key_prefix(__global uint const* keys, uint count, int i, int j)
+{
+	if (j < 0 || j >= (int)count)
+		return -1;
+
+	uint a = keys[i];
+	uint b = keys[j];
+
+	return a != b ? (int)clz(a ^ b) : 32 + (int)clz((uint)i ^ (uint)j);
+}
+
+// Internal node i < count - 1 of the radix tree over the sorted keys (Karras 2012): the range
+// of keys it covers and its children in nodes[i] as (first, last, left, right), and the
+// parents of the children. Nodes 0 .. count - 2 are internal, node count - 1 + k is leaf k.
+__kernel
+void lbvh_hierarchy(__global uint const* keys, uint count, __global int4* nodes, __global int* parents)
+{
+	int i = (int)get_global_id(0);
+
+	if (i >= (int)count - 1)
+		return;
+
+	// direction of the range from the neighbour with the longer common prefix
+	int d = key_prefix(keys, count, i, i + 1) > key_prefix(keys, count, i, i - 1) ? 1 : -1;
+	int min_prefix = key_prefix(keys, count, i, i - d);
+
+	int max_length = 2;
+
+	while (key_prefix(keys, count, i, i + max_length * d) > min_prefix)
+		max_length *= 2;
+
+	int length = 0;
+
+	for (int t = max_length / 2; t >= 1; t /= 2)
+	{
+		if (key_prefix(keys, count, i, i + (length + t) * d) > min_prefix)
+			length += t;
+	}
+
+	int j = i + length * d;
+	int node_prefix = key_prefix(keys, count, i, j);
+
+	// the split: the last key sharing more than the node's prefix with i
+	int split = 0;
+	int t = length;
+
+	do
+	{
+		t = (t + 1) / 2;
+
+		if (key_prefix(keys, count, i, i + (split + t) * d) > node_prefix)
+			split += t;
+	} while (t > 1);
+
+	int gamma = i + split * d + min(d, 0);
+	int first = min(i, j);
+	int last = max(i, j);
+
+	int left = first == gamma ? (int)count - 1 + gamma : gamma;
+	int right = last == gamma + 1 ? (int)count - 1 + gamma + 1 : gamma + 1;
+
+	nodes[i] = (int4)(first, last, left, right);
+	parents[left] = i;
+	parents[right] = i;
+}
+
+// Bounds of every leaf k < count (sphere_bounds in scene.cpp for the sorted sphere), then up
+// the tree: the second child to arrive at a node writes the union of both. boxes holds
+// min and max of every node, arrivals counts the children done, zero before the launch.
+__kernel
+void lbvh_bounds(__global float const* cx, __global float const* cy, __global float const* cz, __global float const* radius2,
+                 __global float const* radius, __global uint const* order, uint count, float ray_origin_z,
+                 __global int4 const* nodes, __global int const* parents, __global float* boxes, __global int* arrivals)
+{
+	int k = (int)get_global_id(0);
+
+	if (k >= (int)count)
+		return;
+
+	uint s = order[k];
+	float x = cx[s];
+	float y = cy[s];
+	float z = cz[s];
+	float r = radius[s];
+
+	float dz = fabs(z - ray_origin_z) + r;
+	float sum = dz * dz + 2.f * r * r;
+	float rb = sqrt(radius2[s] + sum * (64.f / (1 << 24)));
+
+	float slack_xy = (fabs(x) + fabs(y) + rb) * (1.f / (1 << 20));
+	float slack_z = (fabs(z) + fabs(ray_origin_z) + rb) * (1.f / (1 << 20));
+
+	int node = (int)count - 1 + k;
+	__global float* box = boxes + node * 6;
+
+	box[0] = x - rb - slack_xy;
+	box[1] = y - rb - slack_xy;
+	box[2] = z - rb - slack_z;
+	box[3] = x + rb + slack_xy;
+	box[4] = y + rb + slack_xy;
+	box[5] = z + rb + slack_z;
+
+	for (node = parents[node]; node >= 0; node = parents[node])
+	{
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+		// the first child to arrive leaves the node to the second one
+		if (atomic_inc(arrivals + node) == 0)
+			return;
+
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+		__global float const volatile* a = boxes + nodes[node].z * 6;
+		__global float const volatile* b = boxes + nodes[node].w * 6;
+		box = boxes + node * 6;
+
+		for (int c = 0; c < 3; ++c)
+		{
+			box[c] = min(a[c], b[c]);
+			box[c + 3] = max(a[c + 3], b[c + 3]);
+		}
+	}
+}
+
+// Every node of the tree as the bvh_node of trace_bvh at its depth first position: a left
+// child follows its parent, a right child comes after the 2 * leaves - 1 nodes of its left
+// sibling. Leaf k lists the sorted sphere k, the indices are the sorted values.
+__kernel
+void lbvh_emit(uint count, __global int4 const* nodes, __global int const* parents, __global float const* boxes, __global bvh_node* out)
+{
+	int node = (int)get_global_id(0);
+
+	if (node >= 2 * (int)count - 1)
+		return;
+
+	int position = 0;
+
+	for (int child = node, parent = parents[node]; parent >= 0; child = parent, parent = parents[parent])
+	{
+		int4 p = nodes[parent];
+		int left_leaves = p.z >= (int)count - 1 ? 1 : nodes[p.z].y - nodes[p.z].x + 1;
+		position += child == p.w ? 2 * left_leaves : 1;
+	}
+
+	bvh_node n;
+
+	for (int c = 0; c < 3; ++c)
+	{
+		n.bmin[c] = boxes[node * 6 + c];
+		n.bmax[c] = boxes[node * 6 + c + 3];
+	}
+
+	if (node >= (int)count - 1)
+	{
+		n.offset = node - ((int)count - 1);
+		n.count = 1;
+	}
+	else
+	{
+		int4 range = nodes[node];
+		int left_leaves = range.z >= (int)count - 1 ? 1 : nodes[range.z].y - nodes[range.z].x + 1;
+		n.offset = position + 2 * left_leaves;
+		n.count = 0;
+	}
+
+	out[position] = n;
+}
+
+// Sums of the half areas of the nodes of each work-group, the SAH cost of the tree times the
+// half area of the root: traversing a node costs about one sphere test like in build_bvh, and
+// every leaf holds one sphere
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void lbvh_cost(uint count, __global float const* boxes, __global float* partials)
+{
+	__local float sums[kRadixGroup];
+
+	int node = (int)get_global_id(0);
+	uint lid = (uint)get_local_id(0);
+
+	float area = 0.f;
+
+	if (node < 2 * (int)count - 1)
+	{
+		float dx = boxes[node * 6 + 3] - boxes[node * 6];
+		float dy = boxes[node * 6 + 4] - boxes[node * 6 + 1];
+		float dz = boxes[node * 6 + 5] - boxes[node * 6 + 2];
+		area = dx * dy + dy * dz + dz * dx;
+	}
+
+	sums[lid] = area;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint step = kRadixGroup / 2; step > 0; step >>= 1)
+	{
+		if (lid < step)
+			sums[lid] += sums[lid + step];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+		partials[get_group_id(0)] = sums[0];
+}
+
+// On-device screen-space grid of --animate with --accel grid (grid_builder.h), the
+// sphere_grid of build_grid binned from the moved centers without leaving the device:
+// grid_count finds the cells of the footprint of every sphere, radix_scan turns the counts
+// into the first pair of each sphere, grid_pairs writes the (cell, sphere) pairs in sphere
+// order and the stable radix sort orders them by cell, which keeps every cell's list in index
+// order. grid_starts then finds where each list begins.
+
+// First and last pixel along one axis whose center lies in [lo, hi], widened by one pixel
+// (pixel_span in grid.cpp), first > last if none is; clamped in float, far spheres don't
+// overflow the conversion
+int2 pixel_span(float lo, float hi, float origin, float pixel_size, int num_pixels)
+{
+	float first = clamp(floor((lo - origin) / pixel_size - 0.5f) - 1.f, 0.f, (float)num_pixels);
+	float last = clamp(ceil((hi - origin) / pixel_size - 0.5f) + 1.f, -1.f, (float)(num_pixels - 1));
+
+	return (int2)((int)first, (int)last);
+}
+
+// Cells (x0, y0, x1, y1, inclusive) of the footprint of every sphere k < count of the view
+// (sphere_footprint in grid.cpp over the bounds of lbvh_bounds), x1 < x0 for no cell, and the
+// number of them in counts
+__kernel
+void grid_count(__global float const* cx, __global float const* cy, __global float const* cz, __global float const* radius2,
+                __global float const* radius, uint count, uint cell_size, __global int4* cells, __global uint* counts)
+{
+	uint k = (uint)get_global_id(0);
+
+	if (k >= count)
+		return;
+
+	float x = cx[k];
+	float y = cy[k];
+	float z = cz[k];
+	float r = radius[k];
+
+	float dz = fabs(z - RT_NEAR) + r;
+	float sum = dz * dz + 2.f * r * r;
+	float rb = sqrt(radius2[k] + sum * (64.f / (1 << 24)));
+	float slack_xy = (fabs(x) + fabs(y) + rb) * (1.f / (1 << 20));
+
+	int2 xs = pixel_span(x - rb - slack_xy, x + rb + slack_xy, RT_LEFT, RT_WIDTH / kImageWidth, kImageWidth);
+	int2 ys = pixel_span(y - rb - slack_xy, y + rb + slack_xy, RT_BOTTOM, RT_HEIGHT / kImageHeight, kImageHeight);
+
+	if (xs.x > xs.y || ys.x > ys.y)
+	{
+		cells[k] = (int4)(0, 0, -1, -1);
+		counts[k] = 0U;
+		return;
+	}
+
+	int size = (int)cell_size;
+	int4 c = (int4)(xs.x / size, ys.x / size, xs.y / size, ys.y / size);
+
+	cells[k] = c;
+	counts[k] = (uint)((c.z - c.x + 1) * (c.w - c.y + 1));
+}
+
+// The pairs of every sphere k < count from its first, offsets[k] scanned from the counts of
+// grid_count: the cell row by row as the key, k as the value. A pair past capacity is dropped,
+// the host sizes the pairs so none is.
+__kernel
+void grid_pairs(__global int4 const* cells, __global uint const* offsets, uint count, uint cells_x, uint capacity,
+                __global uint* keys, __global uint* values)
+{
+	uint k = (uint)get_global_id(0);
+
+	if (k >= count)
+		return;
+
+	int4 c = cells[k];
+	uint to = offsets[k];
+
+	for (int y = c.y; y <= c.w; ++y)
+	{
+		for (int x = c.x; x <= c.z; ++x, ++to)
+		{
+			if (to < capacity)
+			{
+				keys[to] = (uint)y * cells_x + (uint)x;
+				values[to] = k;
+			}
+		}
+	}
+}
+
+// cell_start of the num_cells lists of the capacity sorted keys, the unused pairs after them
+// keyed 0xFFFFFFFF: work-item i <= capacity starts every cell after the key before it up to
+// its own at i, the unused keys and the one past the end count as num_cells, so the entry
+// after the last cell gets the number of pairs
+__kernel
+void grid_starts(__global uint const* keys, uint capacity, uint num_cells, __global uint* cell_start)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i > capacity)
+		return;
+
+	uint key = i < capacity ? min(keys[i], num_cells) : num_cells;
+	uint first = i > 0 ? min(keys[i - 1], num_cells) + 1 : 0U;
+
+	for (uint c = first; c <= key; ++c)
+		cell_start[c] = i;
+}
+
+// Batched queries of arbitrary rays for other programs (query_rays in render_device.h, ray_batch
+// in ray_queries.h): the rays come as columns of origins, directions of any length and tmax,
+// and each gets the distance and index of its closest sphere. Optionally ray_keys keys them on
+// their direction octant and origin first and radix_count, radix_scan and radix_scatter sort
+// the keys, so neighbouring work-items trace rays leaving the same region in the same general
+// direction.
+
+// Coherence key of every ray i < count, ray_sort_key in ray_queries.h: the octant of its
+// direction in bits 27 to 29 above the Morton code of its origin in the box from lo with scale
+// the reciprocal of its extent, 9 bits per axis, and i as the value sorted along
+__kernel
+void ray_keys(__global float const* ox, __global float const* oy, __global float const* oz,
+              __global float const* dx, __global float const* dy, __global float const* dz, uint count,
+              float lo_x, float lo_y, float lo_z, float scale_x, float scale_y, float scale_z,
+              __global uint* keys, __global uint* values)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	uint x = (uint)clamp((ox[i] - lo_x) * scale_x * 512.f, 0.f, 511.f);
+	uint y = (uint)clamp((oy[i] - lo_y) * scale_y * 512.f, 0.f, 511.f);
+	uint z = (uint)clamp((oz[i] - lo_z) * scale_z * 512.f, 0.f, 511.f);
+	uint octant = (dx[i] < 0.f ? 1U : 0U) | (dy[i] < 0.f ? 2U : 0U) | (dz[i] < 0.f ? 4U : 0U);
+
+	keys[i] = (octant << 27) | (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+	values[i] = i;
+}
+
+// Test sphere k against the ray from o along the unit direction d, keeping the distance to the
+// hit idx in *t. Unlike closer_hit the distances of the hits are compared, the exit of a sphere
+// around the origin included, and the higher index wins a tie, so the closest hit is the same
+// in any test order. Returns the new hit.
+int query_closer(float3 o, float3 d, int k, int idx, float* t, __global float const* cx, __global float const* cy, __global float const* cz,
+                 __global float const* radius2)
+{
+	float ox = o.x - cx[k];
+	float oy = o.y - cy[k];
+	float oz = o.z - cz[k];
+
+	// the direction is a unit vector, a = 1
+	float half_b = ox * d.x + oy * d.y + oz * d.z;
+	float c = (ox * ox) + (oy * oy) + (oz * oz) - radius2[k];
+	float disc = half_b * half_b - c;
+
+	if (disc < 0.f)
+		return idx;
+
+	float root = RT_SQRT(disc);
+	float t0 = -half_b - root;
+	float t1 = -half_b + root;
+	float hit = t0 > 0.f ? t0 : t1;
+
+	if (hit < 0.f || hit > *t || (hit == *t && k < idx))
+		return idx;
+
+	*t = hit;
+	return k;
+}
+
+#ifndef RT_COMPRESSED_BVH
+// Closest sphere of the ray from o along d through the BVH nodes/indices of trace_bvh, its
+// distance in *t: the boxes are slab tested along the ray, the children in order, as
+// bounce_bvh_closest walks them
+int query_bvh_closest(float3 o, float3 d, float* t, __global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global bvh_node const* nodes, __global uint const* indices)
+{
+	int stack[kBvhMaxDepth];
+	int sp = 0;
+	int node = 0;
+	int idx = -1;
+
+	float3 inv = (float3)(1.f) / d;
+
+	for (;;)
+	{
+		__global bvh_node const* n = nodes + node;
+
+		float3 lo = ((float3)(n->bmin[0], n->bmin[1], n->bmin[2]) - o) * inv;
+		float3 hi = ((float3)(n->bmax[0], n->bmax[1], n->bmax[2]) - o) * inv;
+		float3 enter3 = fmin(lo, hi);
+		float3 leave3 = fmax(lo, hi);
+
+		float enter = fmax(fmax(enter3.x, enter3.y), fmax(enter3.z, 0.f));
+		float leave = fmin(fmin(leave3.x, leave3.y), fmin(leave3.z, *t));
+		bool visit = enter <= leave;
+
+		if (visit && n->count == 0)
+		{
+			stack[sp++] = n->offset;
+			node = node + 1;
+			continue;
+		}
+
+		if (visit)
+		{
+			for (int l = 0; l < n->count; ++l)
+			{
+				idx = query_closer(o, d, (int)indices[n->offset + l], idx, t, cx, cy, cz, radius2);
+			}
+		}
+
+		if (sp == 0)
+			break;
+
+		node = stack[--sp];
+	}
+
+	return idx;
+}
+#endif
+
+// Ray i of a batch: ray order[i] of the rays sorted on their keys, or ray i without an order,
+// returned with its origin in *o, its direction as the unit vector *d and the length of the
+// direction it came with in *len, and its far end along *d in *t
+uint query_ray(__global float const* ox, __global float const* oy, __global float const* oz, __global float const* dx,
+               __global float const* dy, __global float const* dz, __global float const* tmax, __global uint const* order, uint i,
+               float3* o, float3* d, float* len, float* t)
+{
+	uint r = order ? order[i] : i;
+
+	*len = sqrt(dx[r] * dx[r] + dy[r] * dy[r] + dz[r] * dz[r]);
+	*o = (float3)(ox[r], oy[r], oz[r]);
+	*d = (float3)(dx[r] / *len, dy[r] / *len, dz[r] / *len);
+	*t = tmax[r] * *len;
+	return r;
+}
+
+// Closest sphere of every ray i < count of the batch in the columns ox .. tmax, in the order of
+// query_ray: t gets the distance of the hit in multiples of the direction of the ray and ids
+// the sphere, tmax and -1 for a miss. query_rays tests every sphere, query_rays_bvh walks the
+// full BVH of trace_bvh; both take the arguments of those kernels up to it.
+__kernel
+void query_rays(__global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global float const* color,
+                __global float const* ox, __global float const* oy, __global float const* oz,
+                __global float const* dx, __global float const* dy, __global float const* dz, __global float const* tmax,
+                __global uint const* order, uint count, __global float* t, __global int* ids)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	float3 o, d;
+	float len, hit;
+	uint r = query_ray(ox, oy, oz, dx, dy, dz, tmax, order, i, &o, &d, &len, &hit);
+	int idx = -1;
+
+	for (int k = 0; k < kNumSpheres; ++k)
+	{
+		idx = query_closer(o, d, k, idx, &hit, cx, cy, cz, radius2);
+	}
+
+	t[r] = idx >= 0 ? hit / len : tmax[r];
+	ids[r] = idx;
+}
+
+#ifndef RT_COMPRESSED_BVH
+__kernel
+void query_rays_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color,
+                    __global bvh_node const* nodes, __global uint const* indices,
+                    __global float const* ox, __global float const* oy, __global float const* oz,
+                    __global float const* dx, __global float const* dy, __global float const* dz, __global float const* tmax,
+                    __global uint const* order, uint count, __global float* t, __global int* ids)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	float3 o, d;
+	float len, hit;
+	uint r = query_ray(ox, oy, oz, dx, dy, dz, tmax, order, i, &o, &d, &len, &hit);
+	int idx = query_bvh_closest(o, d, &hit, cx, cy, cz, radius2, nodes, indices);
+
+	t[r] = idx >= 0 ? hit / len : tmax[r];
+	ids[r] = idx;
+}
+#endif
+
+// Wavefront pipeline of --wavefront (render_device::wavefront): instead of one kernel taking
+// a pixel from its camera ray to its color, each stage is a kernel over a queue of rays.
+// wave_generate queues the camera rays of a band, or with the coverage mask of the scene
+// wave_background fills its uncovered pixels and wave_generate_covered queues the work list
+// of the others; wave_intersect, wave_intersect_bvh and wave_intersect_sorted find their
+// closest hits; wave_count, radix_scan and wave_compact compact the rays that hit into the
+// shade queue in pixel order with prefix sums and write the background of the others;
+// wave_shade colors the queued hits. Rays that end drop out of the later stages, whose
+// work-groups stay full of rays still alive. The scene has no lights yet: a shadow stage
+// would queue occlusion_ray from wave_shade into the occluded kernels.
+
+// Ray of the queue, with its pixel and the sphere it hit, -1 for none
+typedef struct tag_queued_ray
+{
+	float ox, oy, oz;
+	float maxt;
+	uint pixel;
+	int hit;
+} queued_ray;
+
+// Ray of entry i of rays
+ray dequeue_ray(__global queued_ray const* rays, uint i)
+{
+	ray r;
+	r.ox = rays[i].ox;
+	r.oy = rays[i].oy;
+	r.oz = rays[i].oz;
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = rays[i].maxt;
+	return r;
+}
+
+// Camera ray of pixel, set up like in trace
+queued_ray camera_ray(uint pixel)
+{
+	uint gid0 = pixel % kImageWidth;
+	uint gid1 = pixel / kImageWidth;
+
+	queued_ray q;
+	q.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * (gid0 + 0.5f);
+	q.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * (gid1 + 0.5f);
+	q.oz = RT_NEAR;
+	q.maxt = RT_FAR - RT_NEAR;
+	q.pixel = pixel;
+	q.hit = -1;
+	return q;
+}
+
+// Camera rays of the count pixels from row row_begin on
+__kernel
+void wave_generate(uint row_begin, uint count, __global queued_ray* rays)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	rays[i] = camera_ray(row_begin * kImageWidth + i);
+}
+
+// Camera rays of the count pixels of the work list pixels from entry first on: the pixels a
+// sphere may cover in ascending order, set bits of the host's coverage mask
+__kernel
+void wave_generate_covered(uint first, uint count, __global uint const* pixels, __global queued_ray* rays)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	rays[i] = camera_ray(pixels[first + i]);
+}
+
+// Background of the pixels of the count from row row_begin on that no sphere covers, bit
+// pixel % 32 of word pixel / 32 of coverage clear; wave_generate_covered queues the others
+__kernel
+void wave_background(uint row_begin, uint count, __global uint const* coverage, __global pixel_t* img)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	uint pixel = row_begin * kImageWidth + i;
+
+	if ((coverage[pixel / 32] & (1U << (pixel % 32))) == 0U)
+		write_pixel(img, pixel, 0, -1); // the background reads no color
+}
+
+// Closest hit of the count queued rays among all spheres in index order, as trace finds it.
+// The intersection kernels take the scene arguments of trace, trace_bvh and trace_sorted.
+__kernel
+void wave_intersect(__global float const* cx, __global float const* cy, __global float const* cz,
+                    __global float const* radius2, __global float const* color,
+                    __global queued_ray* rays, uint count)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	ray r = dequeue_ray(rays, i);
+	int idx = -1;
+
+	RT_SPHERE_LOOP
+	for (size_t k = 0U; k < kNumSpheres; ++k)
+	{
+		float t0, t1;
+
+		if (sphere_roots(&r, cx[k], cy[k], cz[k], radius2[k], &t0, &t1) && t0 <= r.maxt && t1 >= 0.f)
+		{
+			r.maxt = t0 > 0.f ? t0 : t1;
+			idx = k;
+		}
+	}
+
+	rays[i].maxt = r.maxt;
+	rays[i].hit = idx;
+}
+
+__kernel
+void wave_intersect_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+                        __global float const* radius2, __global float const* color,
+                        __global bvh_node_t const* nodes, __global uint const* indices,
+                        __global queued_ray* rays, uint count)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	ray r = dequeue_ray(rays, i);
+	int idx = bvh_closest(&r, -1, cx, cy, cz, radius2, nodes, indices, false);
+
+	rays[i].maxt = r.maxt;
+	rays[i].hit = idx;
+}
+
+__kernel
+void wave_intersect_sorted(__global float const* cx, __global float const* cy, __global float const* cz,
+                           __global float const* radius2, __global float const* color,
+                           __global uint const* order, __global float const* zmin,
+                           __global queued_ray* rays, uint count)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count)
+		return;
+
+	ray r = dequeue_ray(rays, i);
+	int idx = sorted_closest(&r, -1, cx, cy, cz, radius2, order, zmin, false);
+
+	rays[i].maxt = r.maxt;
+	rays[i].hit = idx;
+}
+
+// Rays of each work-group that hit a sphere, radix_scan turns the counts into the offsets of
+// the groups in the shade queue
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void wave_count(__global queued_ray const* rays, uint count, __global uint* group_counts)
+{
+	__local uint hits;
+
+	uint i = (uint)get_global_id(0);
+
+	if (get_local_id(0) == 0)
+		hits = 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (i < count && rays[i].hit >= 0)
+		atomic_inc(&hits);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0)
+		group_counts[get_group_id(0)] = hits;
+}
+
+// Queue the index of every ray that hit at its group's offset plus the hits before it in the
+// group, keeping the pixel order, and write the background of the misses. The last group
+// stores the length of the shade queue in *shaded.
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void wave_compact(__global queued_ray const* rays, uint count, __global uint const* group_offsets, __global uint* shade_queue,
+                  __global uint* shaded, __global pixel_t* img)
+{
+	__local uint flags[kRadixGroup];
+
+	uint i = (uint)get_global_id(0);
+	uint lid = (uint)get_local_id(0);
+	uint group = (uint)get_group_id(0);
+
+	int hit = i < count ? rays[i].hit : -1;
+
+	uint hits;
+	uint before = group_scan(flags, lid, hit >= 0 ? 1U : 0U, &hits);
+
+	if (hit >= 0)
+		shade_queue[group_offsets[group] + before] = i;
+	else if (i < count)
+		write_pixel(img, rays[i].pixel, 0, -1); // the background reads no color
+
+	if (group + 1 == get_num_groups(0) && lid == 0)
+		*shaded = group_offsets[group] + hits;
+}
+
+// Color of the pixel of every ray in the shade queue. The launch covers all rays of the band,
+// the work-items past the queue end at once.
+__kernel
+void wave_shade(__global float const* cx, __global float const* cy, __global float const* cz,
+                __global float const* radius2, __global float const* color,
+                __global queued_ray const* rays, __global uint const* shade_queue, __global uint const* shaded, __global pixel_t* img)
+{
+	uint q = (uint)get_global_id(0);
+
+	if (q >= *shaded)
+		return;
+
+	uint i = shade_queue[q];
+	write_pixel(img, rays[i].pixel, color, rays[i].hit);
+}
+
+#if RT_FORMAT == RT_FORMAT_RGBA8
+// Planar YUV 4:2:0 of the rgba8 image img for a video encoder (pipe_format::yuv420): the Y
+// plane of kImageWidth x kImageHeight bytes, then the U and V planes at half the width and
+// height, BT.601 limited range. Work-item (x, y) converts the 2x2 block at (2x, 2y) and
+// writes the mean of its chroma.
+__kernel
+void convert_yuv420(__global uchar4 const* img, __global uchar* yuv)
+{
+	uint x = (uint)get_global_id(0);
+	uint y = (uint)get_global_id(1);
+
+	float u = 0.f;
+	float v = 0.f;
+
+	for (uint dy = 0; dy < 2; ++dy)
+	{
+		for (uint dx = 0; dx < 2; ++dx)
+		{
+			uint p = (2 * y + dy) * kImageWidth + 2 * x + dx;
+			float4 c = convert_float4(img[p]);
+
+			yuv[p] = convert_uchar_sat_rte(16.f + 0.256788f * c.x + 0.504129f * c.y + 0.097906f * c.z);
+			u += -0.148223f * c.x - 0.290993f * c.y + 0.439216f * c.z;
+			v += 0.439216f * c.x - 0.367788f * c.y - 0.071427f * c.z;
+		}
+	}
+
+	uint luma = kImageWidth * kImageHeight;
+	uint chroma = y * (kImageWidth / 2) + x;
+
+	yuv[luma + chroma] = convert_uchar_sat_rte(128.f + 0.25f * u);
+	yuv[luma + luma / 4 + chroma] = convert_uchar_sat_rte(128.f + 0.25f * v);
+}
+#endif
+
+#if RT_FORMAT == RT_FORMAT_RGBA8
+// Device side encoding of the rgb of the rgba8 image (encode_frame in render_device.h): the
+// encode kernels compress one image row per work-item into its slot of out, slot bytes apart,
+// and store its size in sizes; encode_offsets places the rows one after the other and
+// pack_encoded copies them there, so only the compressed bytes are read back.
+
+// QOI chunks of row y, which continue the ones of the row above as encode_qoi writes them: the
+// previous pixel of the first one is the last pixel of the row above, and runs end with the
+// row. The index of the decoder carries the pixels of the rows above, which the work-item
+// doesn't know: it only takes index chunks from the slots its own row filled, which hold the
+// same pixel in the decoder's index.
+__kernel
+void encode_qoi_rows(__global uchar4 const* img, uint slot, __global uchar* out, __global uint* sizes)
+{
+	uint y = (uint)get_global_id(0);
+
+	if (y >= kImageHeight)
+		return;
+
+	__global uchar4 const* row = img + y * kImageWidth;
+	__global uchar* dst = out + (size_t)y * slot;
+	uint n = 0;
+
+	uchar4 index[64];
+	ulong filled = 0;
+	uchar4 previous = y == 0 ? (uchar4)(0, 0, 0, 255) : img[y * kImageWidth - 1];
+	uint run = 0;
+
+	// the file holds rgb, alpha is opaque
+	previous.w = 255;
+
+	for (uint x = 0; x < kImageWidth; ++x)
+	{
+		uchar4 px = row[x];
+		px.w = 255;
+
+		if (all(px == previous))
+		{
+			++run;
+
+			if (run == 62 || x + 1 == kImageWidth)
+			{
+				dst[n++] = (uchar)(0xc0 | (run - 1));
+				run = 0;
+			}
+
+			continue;
+		}
+
+		if (run > 0)
+		{
+			dst[n++] = (uchar)(0xc0 | (run - 1));
+			run = 0;
+		}
+
+		uint hash = (px.x * 3 + px.y * 5 + px.z * 7 + 255 * 11) % 64;
+
+		if ((filled >> hash & 1) != 0 && all(index[hash] == px))
+		{
+			dst[n++] = (uchar)hash;
+		}
+		else
+		{
+			index[hash] = px;
+			filled |= 1UL << hash;
+
+			// wrapping differences, as the format defines them
+			int dr = as_char((uchar)(px.x - previous.x));
+			int dg = as_char((uchar)(px.y - previous.y));
+			int db = as_char((uchar)(px.z - previous.z));
+			int dr_dg = as_char((uchar)(dr - dg));
+			int db_dg = as_char((uchar)(db - dg));
+
+			if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+			{
+				dst[n++] = (uchar)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+			}
+			else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+			{
+				dst[n++] = (uchar)(0x80 | (dg + 32));
+				dst[n++] = (uchar)((dr_dg + 8) << 4 | (db_dg + 8));
+			}
+			else
+			{
+				dst[n++] = 0xfe;
+				dst[n++] = px.x;
+				dst[n++] = px.y;
+				dst[n++] = px.z;
+			}
+		}
+
+		previous = px;
+	}
+
+	sizes[y] = n;
+}
+
+// Bytes of a filtered PNG row: the filter type and the rgb of every pixel
+#define kPngRowBytes (1 + 3 * kImageWidth)
+
+// Byte i of filtered row y as encode_png filters it: the Up filter, the first row of the image
+// as it is
+uchar png_filtered(__global uchar4 const* img, uint y, uint i)
+{
+	if (i == 0)
+		return y == 0 ? 0 : 2;
+
+	uint p = y * kImageWidth + (i - 1) / 3;
+	uint c = (i - 1) % 3;
+	uchar4 value = img[p];
+	uchar4 above = y == 0 ? (uchar4)(0) : img[p - kImageWidth];
+
+	return c == 0 ? value.x - above.x : c == 1 ? value.y - above.y : value.z - above.z;
+}
+
+// Deflate bit stream, least significant bit first, into dst at *n
+void put_bits(__global uchar* dst, uint* n, ulong* buffer, uint* count, uint value, uint bits)
+{
+	*buffer |= (ulong)value << *count;
+	*count += bits;
+
+	while (*count >= 8)
+	{
+		dst[(*n)++] = (uchar)*buffer;
+		*buffer >>= 8;
+		*count -= 8;
+	}
+}
+
+// Fixed Huffman code (RFC 1951 3.2.6) of literal/length symbol s, bit reversed for the stream,
+// and its bits
+uint fixed_code(uint s, uint* bits)
+{
+	uint code;
+
+	if (s < 144)
+	{
+		code = 0x30 + s;
+		*bits = 8;
+	}
+	else if (s < 256)
+	{
+		code = 0x190 + s - 144;
+		*bits = 9;
+	}
+	else if (s < 280)
+	{
+		code = s - 256;
+		*bits = 7;
+	}
+	else
+	{
+		code = 0xc0 + s - 280;
+		*bits = 8;
+	}
+
+	uint reversed = 0;
+
+	for (uint b = 0; b < *bits; ++b)
+	{
+		reversed |= (code >> b & 1) << (*bits - 1 - b);
+	}
+
+	return reversed;
+}
+
+__constant ushort kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+__constant uchar kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+// Filtered row y compressed as deflate_band of image_encoders.cpp compresses a band, into an
+// IDAT chunk of its own: one fixed Huffman block, not the last one, whose only matches are runs
+// of a repeated byte and an empty stored block that ends it on a byte. adlers[y] is the
+// Adler-32 of the filtered row, encode_offsets combines them.
+__kernel
+void encode_png_rows(__global uchar4 const* img, uint slot, __global uchar* out, __global uint* sizes, __global uint* adlers)
+{
+	uint y = (uint)get_global_id(0);
+
+	if (y >= kImageHeight)
+		return;
+
+	__global uchar* dst = out + (size_t)y * slot;
+
+	// the length goes in front once it is known
+	dst[4] = 'I';
+	dst[5] = 'D';
+	dst[6] = 'A';
+	dst[7] = 'T';
+
+	uint n = 8;
+	ulong buffer = 0;
+	uint count = 0;
+	uint bits;
+
+	// BFINAL 0, BTYPE 01
+	put_bits(dst, &n, &buffer, &count, 2, 3);
+
+	uint a = 1, b = 0;
+	uint pending = 0;
+	uchar last = 0;
+
+	for (uint i = 0; i < kPngRowBytes;)
+	{
+		uchar value = png_filtered(img, y, i);
+
+		// run of the previous byte: a match of distance 1
+		uint run = 0;
+
+		if (i > 0)
+		{
+			uint limit = min(258U, kPngRowBytes - i);
+
+			while (run < limit && png_filtered(img, y, i + run) == last)
+			{
+				++run;
+			}
+		}
+
+		uint length = run >= 3 ? run : 1;
+
+		// the Adler-32 of the bytes, the sums stay below 2^32 for 5552 bytes between reductions
+		for (uint k = 0; k < length; ++k)
+		{
+			a += run >= 3 ? last : value;
+			b += a;
+
+			if (++pending == 5552)
+			{
+				a %= 65521;
+				b %= 65521;
+				pending = 0;
+			}
+		}
+
+		if (run >= 3)
+		{
+			uint s = 28;
+
+			while (kLengthBase[s] > run)
+			{
+				--s;
+			}
+
+			uint code = fixed_code(257 + s, &bits);
+			put_bits(dst, &n, &buffer, &count, code, bits);
+			put_bits(dst, &n, &buffer, &count, run - kLengthBase[s], kLengthExtra[s]);
+			// distance code 0, five zero bits
+			put_bits(dst, &n, &buffer, &count, 0, 5);
+			i += run;
+		}
+		else
+		{
+			uint code = fixed_code(value, &bits);
+			put_bits(dst, &n, &buffer, &count, code, bits);
+			last = value;
+			++i;
+		}
+	}
+
+	// end of block
+	uint code = fixed_code(256, &bits);
+	put_bits(dst, &n, &buffer, &count, code, bits);
+
+	// BFINAL 0, BTYPE 00, padded to the byte, LEN 0 and NLEN 0xffff
+	put_bits(dst, &n, &buffer, &count, 0, 3);
+
+	if (count > 0)
+		put_bits(dst, &n, &buffer, &count, 0, 8 - count);
+
+	dst[n++] = 0x00;
+	dst[n++] = 0x00;
+	dst[n++] = 0xff;
+	dst[n++] = 0xff;
+
+	uint length = n - 8;
+	dst[0] = (uchar)(length >> 24);
+	dst[1] = (uchar)(length >> 16);
+	dst[2] = (uchar)(length >> 8);
+	dst[3] = (uchar)length;
+
+	// CRC-32 of the type and the data, bit by bit
+	uint crc = 0xffffffffU;
+
+	for (uint k = 4; k < n; ++k)
+	{
+		crc ^= dst[k];
+
+		for (uint j = 0; j < 8; ++j)
+		{
+			crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1)));
+		}
+	}
+
+	crc = ~crc;
+	dst[n++] = (uchar)(crc >> 24);
+	dst[n++] = (uchar)(crc >> 16);
+	dst[n++] = (uchar)(crc >> 8);
+	dst[n++] = (uchar)crc;
+
+	sizes[y] = n;
+	adlers[y] = (b % 65521) << 16 | a % 65521;
+}
+
+// Adler-32 of two pieces of data from the ones of the pieces, adler2 over size2 bytes, see
+// zlib's adler32_combine
+uint adler32_combine(uint adler1, uint adler2, uint size2)
+{
+	uint rem = size2 % 65521;
+	uint sum1 = adler1 & 0xffff;
+	uint sum2 = (uint)(((ulong)rem * sum1) % 65521);
+
+	sum1 += (adler2 & 0xffff) + 65521 - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + 65521 - rem;
+
+	if (sum1 >= 65521)
+		sum1 -= 65521;
+
+	if (sum1 >= 65521)
+		sum1 -= 65521;
+
+	if (sum2 >= 2 * 65521)
+		sum2 -= 2 * 65521;
+
+	if (sum2 >= 65521)
+		sum2 -= 65521;
+
+	return sum2 << 16 | sum1;
+}
+
+// One work-item: offsets[y] is where row y goes in the packed stream, totals[0] the size of
+// the stream and, if png is set, totals[1] the Adler-32 of all filtered rows
+__kernel
+void encode_offsets(__global uint const* sizes, __global uint const* adlers, uint png, __global uint* offsets, __global uint* totals)
+{
+	uint offset = 0;
+	uint adler = png != 0 ? adlers[0] : 0;
+
+	for (uint y = 0; y < kImageHeight; ++y)
+	{
+		offsets[y] = offset;
+		offset += sizes[y];
+
+		if (png != 0 && y > 0)
+			adler = adler32_combine(adler, adlers[y], kPngRowBytes);
+	}
+
+	totals[0] = offset;
+	totals[1] = adler;
+}
+
+// Work-group y copies the bytes of row y from its slot of out to its place in packed
+__kernel
+void pack_encoded(__global uchar const* out, uint slot, __global uint const* sizes, __global uint const* offsets, __global uchar* packed)
+{
+	uint y = (uint)get_group_id(1);
+	__global uchar const* src = out + (size_t)y * slot;
+	__global uchar* dst = packed + offsets[y];
+
+	for (uint i = (uint)get_local_id(0); i < sizes[y]; i += (uint)get_local_size(0))
+	{
+		dst[i] = src[i];
+	}
+}
+#endif
+
+// Frame statistics of --stats (frame_stats in render_device.h), a follow-up kernel over the
+// sphere ids of a frame. Work-items of its work-groups, pixels each of them reduces and slots
+// of the local table of a group's sphere hits, kStatsGroup and kStatsPixels in render_device.cpp
+#define kStatsGroup 256
+#define kStatsPixels 16
+#define kStatsSlots 256
+// Slots a sphere probes in the table before its hit goes to the global histogram
+#define kStatsProbes 4
+#define kStatsEmpty 0xFFFFFFFFU
+
+#if RT_FORMAT == RT_FORMAT_ID16 || RT_FORMAT == RT_FORMAT_ID32
+// the id formats reduce the image itself, all ones for the background
+typedef pixel_t stats_id_t;
+#else
+// the color formats the id channel, -1 for the background
+typedef uint stats_id_t;
+#endif
+
+// Key of f that compares as f does when compared as an unsigned int, for the atomic min and max
+uint float_key(float f)
+{
+	uint u = as_uint(f);
+	return (u & 0x80000000U) != 0U ? ~u : u | 0x80000000U;
+}
+
+// Reduce the pixels first .. first + count - 1 of the sphere ids ids to the color write_pixel
+// gives them, output transform included. Each work-group takes kStatsGroup * kStatsPixels
+// pixels, work-item i every kStatsGroup-th from the i-th on, and stores 10 words at
+// groups[group * 10]: the min and max keys (float_key) of r, g and b, the sums of r, g and b
+// as float bits and the pixels that hit a sphere. The group counts the hits of each sphere in
+// a local table and adds them to hits once; a sphere that finds no slot counts its hits there
+// directly.
+__kernel __attribute__((reqd_work_group_size(kStatsGroup, 1, 1)))
+void image_stats(__global float const* color, __global stats_id_t const* ids, uint first, uint count, uint num_spheres,
+                 __global uint* hits, __global uint* groups)
+{
+	__local uint lmin[3];
+	__local uint lmax[3];
+	__local uint lcovered;
+	__local float lsum[3 * kStatsGroup];
+	__local uint lkeys[kStatsSlots];
+	__local uint lcounts[kStatsSlots];
+
+	uint lid = (uint)get_local_id(0);
+	uint group = (uint)get_group_id(0);
+
+	for (uint s = lid; s < kStatsSlots; s += kStatsGroup)
+	{
+		lkeys[s] = kStatsEmpty;
+		lcounts[s] = 0U;
+	}
+
+	if (lid < 3)
+	{
+		lmin[lid] = kStatsEmpty;
+		lmax[lid] = 0U;
+	}
+
+	if (lid == 0)
+		lcovered = 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint kmin[3] = { kStatsEmpty, kStatsEmpty, kStatsEmpty };
+	uint kmax[3] = { 0U, 0U, 0U };
+	float sum[3] = { 0.f, 0.f, 0.f };
+	uint covered = 0U;
+
+	for (uint n = 0; n < kStatsPixels; ++n)
+	{
+		uint p = group * (kStatsGroup * kStatsPixels) + n * kStatsGroup + lid;
+
+		if (p >= count)
+			break;
+
+		stats_id_t id = ids[first + p];
+		float c[3] = { 0.1f, 0.1f, 0.1f };
+
+		if (id != (stats_id_t)~(stats_id_t)0 && id < num_spheres)
+		{
+			uint k = (uint)id;
+
+			c[0] = color[k * 3];
+			c[1] = color[k * 3 + 1];
+			c[2] = color[k * 3 + 2];
+			++covered;
+
+			uint slot = k % kStatsSlots;
+			uint probe = 0;
+
+			for (; probe < kStatsProbes; ++probe, slot = (slot + 1) % kStatsSlots)
+			{
+				uint key = atomic_cmpxchg(&lkeys[slot], kStatsEmpty, k);
+
+				if (key == kStatsEmpty || key == k)
+				{
+					atomic_inc(&lcounts[slot]);
+					break;
+				}
+			}
+
+			if (probe == kStatsProbes)
+				atomic_inc(&hits[k]);
+		}
+
+		for (uint ch = 0; ch < 3; ++ch)
+		{
+#ifdef RT_OUTPUT_TRANSFORM
+			c[ch] = output_channel(c[ch]);
+#endif
+			kmin[ch] = min(kmin[ch], float_key(c[ch]));
+			kmax[ch] = max(kmax[ch], float_key(c[ch]));
+			sum[ch] += c[ch];
+		}
+	}
+
+	for (uint ch = 0; ch < 3; ++ch)
+	{
+		atomic_min(&lmin[ch], kmin[ch]);
+		atomic_max(&lmax[ch], kmax[ch]);
+		lsum[ch * kStatsGroup + lid] = sum[ch];
+	}
+
+	atomic_add(&lcovered, covered);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// the sums in a fixed order, the same for every run
+	for (uint half = kStatsGroup / 2; half > 0; half /= 2)
+	{
+		if (lid < half)
+		{
+			for (uint ch = 0; ch < 3; ++ch)
+			{
+				lsum[ch * kStatsGroup + lid] += lsum[ch * kStatsGroup + lid + half];
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for (uint s = lid; s < kStatsSlots; s += kStatsGroup)
+	{
+		if (lkeys[s] != kStatsEmpty)
+			atomic_add(&hits[lkeys[s]], lcounts[s]);
+	}
+
+	if (lid < 3)
+	{
+		groups[group * 10 + lid] = lmin[lid];
+		groups[group * 10 + 3 + lid] = lmax[lid];
+		groups[group * 10 + 6 + lid] = as_uint(lsum[lid * kStatsGroup]);
+	}
+
+	if (lid == 0)
+		groups[group * 10 + 9] = lcovered;
+}
+
+#if RT_FORMAT != RT_FORMAT_ID16 && RT_FORMAT != RT_FORMAT_ID32
+// Color of pixel id of img as floats, rgba8 scaled to [0, 1]
+float3 read_color(__global pixel_t const* img, size_t id)
+{
+#if RT_FORMAT == RT_FORMAT_RGBA8
+	return convert_float4(img[id]).xyz * (1.f / 255.f);
+#elif RT_FORMAT == RT_FORMAT_HALF
+	return vload_half3(id, img);
+#elif RT_FORMAT == RT_FORMAT_FLOAT4
+	return img[id].xyz;
+#else
+	return vload3(id, img);
+#endif
+}
+
+// Write c to pixel id of img the way write_pixel writes a color
+void write_color(__global pixel_t* img, size_t id, float3 c)
+{
+#if RT_FORMAT == RT_FORMAT_RGBA8
+	img[id] = (uchar4)(quantize(c.x), quantize(c.y), quantize(c.z), 255);
+#elif RT_FORMAT == RT_FORMAT_HALF
+	vstore_half3(c, id, img);
+#elif RT_FORMAT == RT_FORMAT_FLOAT4
+	img[id] = (float4)(c, 0.f);
+#else
+	vstore3(c, id, img);
+#endif
+}
+
+// Smaller levels of the MIP pyramid of --mip (render_device::mip_levels): every level is the
+// one above 2x box filtered, its size halved and rounded down, and mips holds levels 1 to
+// levels - 1 one after the other. A work-group reads its kGroupTileSize square tile of img
+// once and reduces it in local memory to 8x8, 4x4 ... pixels, so levels is at most
+// log2(kGroupTileSize) + 1. Launches start at a row that is a multiple of kGroupTileSize.
+__kernel __attribute__((reqd_work_group_size(kGroupTileSize, kGroupTileSize, 1)))
+void build_mips(__global pixel_t const* img, uint levels, __global pixel_t* mips)
+{
+	__local float3 tile[kGroupTileSize * kGroupTileSize];
+
+	uint x = (uint)get_global_id(0);
+	uint y = (uint)get_global_id(1);
+	uint lx = (uint)get_local_id(0);
+	uint ly = (uint)get_local_id(1);
+
+	tile[ly * kGroupTileSize + lx] = x < kImageWidth && y < kImageHeight ? read_color(img, (size_t)y * kImageWidth + x) : (float3)(0.f);
+
+	size_t offset = 0;
+
+	for (uint level = 1, side = kGroupTileSize / 2; level < levels; ++level, side /= 2)
+	{
+		bool active = lx < side && ly < side;
+		float3 c = (float3)(0.f);
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		// pixels of the level inside the image only read pixels of the level above inside it
+		if (active)
+		{
+			uint p = 2 * ly * kGroupTileSize + 2 * lx;
+			c = 0.25f * (tile[p] + tile[p + 1] + tile[p + kGroupTileSize] + tile[p + kGroupTileSize + 1]);
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		uint width = kImageWidth >> level;
+		uint height = kImageHeight >> level;
+		uint mx = ((x - lx) >> level) + lx;
+		uint my = ((y - ly) >> level) + ly;
+
+		if (active)
+		{
+			tile[ly * kGroupTileSize + lx] = c;
+
+			if (mx < width && my < height)
+				write_color(mips, offset + (size_t)my * width + mx, c);
+		}
+
+		offset += (size_t)width * height;
+	}
+}
+
+// Edge pixels of the adaptive antialiasing of --aa in the rows of the launch: a pixel whose
+// 3x3 neighbourhood, clipped to the image, holds another sphere index in ids, the id channel
+// of the first pass, than its own is appended to edges and counted in count. A work-group
+// counts its edges in local memory and reserves their run of edges with one atomic; the order
+// of the list varies from run to run, the pixels in it don't.
+__kernel
+void find_edges(__global int const* ids, __global uint* count, __global uint* edges)
+{
+	__local uint group_count;
+	__local uint group_base;
+
+	int x = (int)get_global_id(0);
+	int y = (int)get_global_id(1);
+	bool first = get_local_id(0) == 0 && get_local_id(1) == 0;
+	size_t id = (size_t)y * kImageWidth + x;
+	int own = ids[id];
+	bool edge = false;
+
+	for (int ny = max(y - 1, 0); ny <= min(y + 1, kImageHeight - 1); ++ny)
+	{
+		for (int nx = max(x - 1, 0); nx <= min(x + 1, kImageWidth - 1); ++nx)
+		{
+			edge |= ids[(size_t)ny * kImageWidth + nx] != own;
+		}
+	}
+
+	if (first)
+		group_count = 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint slot = edge ? atomic_inc(&group_count) : 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (first && group_count != 0U)
+		group_base = atomic_add(count, group_count);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (edge)
+		edges[group_base + slot] = (uint)id;
+}
+
+// Well mixed bits of x, the jitter of the samples of the antialias kernels
+uint hash_uint(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+// Ray of sample s of pixel id in a grid x grid stratification of the pixel: one ray through
+// each cell of the grid, at a point jittered inside it by a hash of the pixel and sample
+ray sample_ray(uint id, uint s, uint grid)
+{
+	uint h = hash_uint(id * 0x9e3779b9U ^ hash_uint(s));
+	float u = ((float)(s % grid) + (float)(h & 0xFFFFU) * (1.f / 65536.f)) / (float)grid;
+	float v = ((float)(s / grid) + (float)(h >> 16) * (1.f / 65536.f)) / (float)grid;
+
+	ray r;
+	r.oz = RT_NEAR;
+	r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * ((float)(id % kImageWidth) + u);
+	r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * ((float)(id / kImageWidth) + v);
+	r.dx = r.dy = 0.f;
+	r.dz = 1.f;
+	r.maxt = RT_FAR - RT_NEAR;
+	RT_START_COST(r);
+	return r;
+}
+
+// Samples of an edge pixel so far: the sum of their colors and the sphere of the first one,
+// mixed once another sphere came up
+typedef struct tag_pixel_samples
+{
+	float3 sum;
+	int first;
+	bool mixed;
+} pixel_samples;
+
+// Add the hit idx, -1 for the background, as sample s
+void add_sample(pixel_samples* p, uint s, __global float const* color, int idx)
+{
+	p->sum += idx >= 0 ? vload3(idx, color) : (float3)(0.1f);
+	p->mixed |= s != 0U && idx != p->first;
+	p->first = s == 0U ? idx : p->first;
+}
+
+// Write the mean of the count samples of p to pixel id of img, through the output transform
+// like write_pixel; a pixel whose samples all hit one sphere gets its color as it is
+void write_samples(__global pixel_t* img, size_t id, __global float const* color, pixel_samples const* p, uint count)
+{
+	if (!p->mixed)
+	{
+		write_pixel(img, id, color, p->first);
+		return;
+	}
+
+	float3 c = p->sum / (float)count;
+
+#ifdef RT_OUTPUT_TRANSFORM
+	c = (float3)(output_channel(c.x), output_channel(c.y), output_channel(c.z));
+#endif
+
+	write_color(img, id, c);
+}
+
+// Second pass of --aa: the count edge pixels find_edges listed in edges are traced again with
+// grid x grid stratified samples each and their mean replaces the color of the first pass in
+// img. The host launches a fixed number of work-items for the device, which stride through
+// the list, so the pass costs as much as the edges of the frame without reading their count
+// back first. antialias tests every sphere, antialias_bvh and antialias_sorted walk the
+// structures of trace_bvh and trace_sorted and take the arguments of those kernels up to it.
+__kernel
+void antialias(__global float const* cx, __global float const* cy, __global float const* cz,
+               __global float const* radius2, __global float const* color, __global pixel_t* img,
+               __global uint const* count, __global uint const* edges, uint grid)
+{
+	uint n = *count;
+
+	for (uint i = (uint)get_global_id(0); i < n; i += (uint)get_global_size(0))
+	{
+		pixel_samples p = { (float3)(0.f), -1, false };
+
+		for (uint s = 0U; s < grid * grid; ++s)
+		{
+			ray r = sample_ray(edges[i], s, grid);
+			int idx = -1;
+
+			for (int k = 0; k < kNumSpheres; ++k)
+			{
+				idx = closer_hit(&r, k, idx, cx, cy, cz, radius2);
+			}
+
+			add_sample(&p, s, color, idx);
+		}
+
+		write_samples(img, edges[i], color, &p, grid * grid);
+	}
+}
+
+__kernel
+void antialias_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+                   __global float const* radius2, __global float const* color,
+                   __global bvh_node_t const* nodes, __global uint const* indices, __global pixel_t* img,
+                   __global uint const* count, __global uint const* edges, uint grid)
+{
+	uint n = *count;
+
+	for (uint i = (uint)get_global_id(0); i < n; i += (uint)get_global_size(0))
+	{
+		pixel_samples p = { (float3)(0.f), -1, false };
+
+		for (uint s = 0U; s < grid * grid; ++s)
+		{
+			ray r = sample_ray(edges[i], s, grid);
+			add_sample(&p, s, color, bvh_closest(&r, -1, cx, cy, cz, radius2, nodes, indices, false));
+		}
+
+		write_samples(img, edges[i], color, &p, grid * grid);
+	}
+}
+
+__kernel
+void antialias_sorted(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color,
+                      __global uint const* order, __global float const* zmin, __global pixel_t* img,
+                      __global uint const* count, __global uint const* edges, uint grid)
+{
+	uint n = *count;
+
+	for (uint i = (uint)get_global_id(0); i < n; i += (uint)get_global_size(0))
+	{
+		pixel_samples p = { (float3)(0.f), -1, false };
+
+		for (uint s = 0U; s < grid * grid; ++s)
+		{
+			ray r = sample_ray(edges[i], s, grid);
+			add_sample(&p, s, color, sorted_closest(&r, -1, cx, cy, cz, radius2, order, zmin, false));
+		}
+
+		write_samples(img, edges[i], color, &p, grid * grid);
+	}
+}
+
+// Reflections of --bounces (render_device::bounces): every hit of the first pass, read from the
+// id channel, spawns a ray reflected about the sphere's normal, and every bounce but the last
+// spawns the next one where its ray hits. The rays of a bounce point every which way, so before
+// they are traced radix_count, radix_scan and radix_scatter sort them on bounce_key, their
+// direction octant above the Morton code of their origin: neighbouring work-items then take
+// rays leaving the same region in the same general direction, which test the same spheres and
+// walk the same nodes. Unlike the camera rays these run in any direction, so they have an
+// intersection test and a BVH walk of their own. A pixel's color is its hit mixed with what
+// its rays reflect, each bounce weighted by the reflectivity, summed in accum until
+// resolve_bounces writes it.
+
+// Work-group of the bounce kernels, kBounceGroup in render_device.cpp
+#define kBounceGroup 64
+
+// Reflected ray of a bounce queue, mirrors kBounceRayBytes in render_device.cpp: its unit
+// direction, the pixel it adds to, its weight in the pixel's color and the sphere it leaves,
+// which it can't hit again
+typedef struct tag_bounce_ray
+{
+	float ox, oy, oz;
+	float dx, dy, dz;
+	uint pixel;
+	float weight;
+	int from;
+} bounce_ray;
+
+// Sort key of b: the octant of its direction in bits 27 to 29 above the Morton code of its
+// origin in the view volume, 9 bits per axis
+uint bounce_key(bounce_ray const* b)
+{
+	uint x = (uint)clamp((b->ox - RT_LEFT) * (512.f / RT_WIDTH), 0.f, 511.f);
+	uint y = (uint)clamp((b->oy - RT_BOTTOM) * (512.f / RT_HEIGHT), 0.f, 511.f);
+	uint z = (uint)clamp((b->oz - RT_NEAR) * (512.f / (RT_FAR - RT_NEAR)), 0.f, 511.f);
+	uint octant = (b->dx < 0.f ? 1U : 0U) | (b->dy < 0.f ? 2U : 0U) | (b->dz < 0.f ? 4U : 0U);
+
+	return (octant << 27) | (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+}
+
+// Ray reflected off sphere k where the ray from o along d hits it at t, adding weight of its
+// color to pixel
+bounce_ray reflect_ray(float3 o, float3 d, float t, int k, __global float const* cx, __global float const* cy, __global float const* cz,
+                       __global float const* radius2, uint pixel, float weight)
+{
+	float3 p = o + t * d;
+	float3 n = (p - (float3)(cx[k], cy[k], cz[k])) * RT_RECIP(RT_SQRT(radius2[k]));
+	float3 out = d - 2.f * dot(d, n) * n;
+
+	bounce_ray b = { p.x, p.y, p.z, out.x, out.y, out.z, pixel, weight, k };
+	return b;
+}
+
+// Append b to the queue rays if queue is set, with its key and its slot in keys and values as
+// radix_scatter sorts them: the work-group counts its rays in group[0] and reserves their run
+// with one atomic on *count, as find_edges does. Every work-item of the group calls it.
+void queue_bounce(__local uint* group, bool queue, bounce_ray const* b, __global uint* count, __global bounce_ray* rays, __global uint* keys,
+                  __global uint* values)
+{
+	bool first = get_local_id(0) == 0;
+
+	if (first)
+		group[0] = 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint slot = queue ? atomic_inc(&group[0]) : 0U;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (first && group[0] != 0U)
+		group[1] = atomic_add(count, group[0]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (queue)
+	{
+		slot += group[1];
+		rays[slot] = *b;
+		keys[slot] = bounce_key(b);
+		values[slot] = slot;
+	}
+}
+
+// Test sphere k against b out of index order, as closer_hit does for camera rays, keeping the
+// distance to the hit idx in *t. Returns the new hit.
+int bounce_closer(bounce_ray const* b, int k, int idx, float* t, __global float const* cx, __global float const* cy, __global float const* cz,
+                  __global float const* radius2)
+{
+	if (k == b->from)
+		return idx;
+
+	float ox = b->ox - cx[k];
+	float oy = b->oy - cy[k];
+	float oz = b->oz - cz[k];
+
+	// the direction is a unit vector, a = 1
+	float half_b = ox * b->dx + oy * b->dy + oz * b->dz;
+	float c = (ox * ox) + (oy * oy) + (oz * oz) - radius2[k];
+	float d = half_b * half_b - c;
+
+	if (d < 0.f)
+		return idx;
+
+	float root = RT_SQRT(d);
+	float t0 = -half_b - root;
+	float t1 = -half_b + root;
+
+	if (t0 <= *t && t1 >= 0.f && !(t0 == *t && k < idx))
+	{
+		*t = t0 > 0.f ? t0 : t1;
+		return k;
+	}
+
+	return idx;
+}
+
+#ifndef RT_COMPRESSED_BVH
+// Closest sphere of b through the BVH nodes/indices of trace_bvh, its distance in *t: the
+// boxes are slab tested along the direction of b, the children in order
+int bounce_bvh_closest(bounce_ray const* b, float* t, __global float const* cx, __global float const* cy, __global float const* cz,
+                       __global float const* radius2, __global bvh_node const* nodes, __global uint const* indices)
+{
+	int stack[kBvhMaxDepth];
+	int sp = 0;
+	int node = 0;
+	int idx = -1;
+
+	float3 o = (float3)(b->ox, b->oy, b->oz);
+	float3 inv = (float3)(1.f) / (float3)(b->dx, b->dy, b->dz);
+
+	for (;;)
+	{
+		__global bvh_node const* n = nodes + node;
+
+		float3 lo = ((float3)(n->bmin[0], n->bmin[1], n->bmin[2]) - o) * inv;
+		float3 hi = ((float3)(n->bmax[0], n->bmax[1], n->bmax[2]) - o) * inv;
+		float3 enter3 = fmin(lo, hi);
+		float3 leave3 = fmax(lo, hi);
+
+		float enter = fmax(fmax(enter3.x, enter3.y), fmax(enter3.z, 0.f));
+		float leave = fmin(fmin(leave3.x, leave3.y), fmin(leave3.z, *t));
+		bool visit = enter <= leave;
+
+		if (visit && n->count == 0)
+		{
+			stack[sp++] = n->offset;
+			node = node + 1;
+			continue;
+		}
+
+		if (visit)
+		{
+			for (int l = 0; l < n->count; ++l)
+			{
+				idx = bounce_closer(b, (int)indices[n->offset + l], idx, t, cx, cy, cz, radius2);
+			}
+		}
+
+		if (sp == 0)
+			break;
+
+		node = stack[--sp];
+	}
+
+	return idx;
+}
+#endif
+
+// Add what b brings to its pixel in accum, the color of the sphere idx it hit at t or the
+// background, and set next to the ray reflected off idx unless last. Returns whether next is
+// a ray to queue.
+bool shade_bounce(bounce_ray const* b, int idx, float t, float reflectivity, bool last, __global float const* cx, __global float const* cy,
+                  __global float const* cz, __global float const* radius2, __global float const* color, __global float* accum, bounce_ray* next)
+{
+	bool again = idx >= 0 && !last;
+	float3 c = idx >= 0 ? vload3(idx, color) : (float3)(0.1f);
+
+	vstore3(vload3(b->pixel, accum) + b->weight * (again ? 1.f - reflectivity : 1.f) * c, b->pixel, accum);
+
+	if (again)
+		*next = reflect_ray((float3)(b->ox, b->oy, b->oz), (float3)(b->dx, b->dy, b->dz), t, idx, cx, cy, cz, radius2, b->pixel, b->weight * reflectivity);
+
+	return again;
+}
+
+// First bounce of the count pixels from first on: a pixel the id channel ids has a hit for
+// starts its color in accum at 1 - reflectivity of the hit's and queues the ray reflected off
+// it, carrying the rest
+__kernel __attribute__((reqd_work_group_size(kBounceGroup, 1, 1)))
+void bounce_generate(__global float const* cx, __global float const* cy, __global float const* cz,
+                     __global float const* radius2, __global float const* color, __global int const* ids,
+                     uint first, uint count, float reflectivity, __global float* accum,
+                     __global uint* queued, __global bounce_ray* rays, __global uint* keys, __global uint* values)
+{
+	__local uint group[2];
+
+	uint i = (uint)get_global_id(0);
+	uint pixel = first + i;
+	int idx = i < count ? ids[pixel] : -1;
+	bounce_ray b;
+
+	if (idx >= 0)
+	{
+		// the camera ray of the pixel as trace sets it up
+		ray r;
+		r.ox = RT_LEFT + (RT_WIDTH / kImageWidth) * ((float)(pixel % kImageWidth) + 0.5f);
+		r.oy = RT_BOTTOM + (RT_HEIGHT / kImageHeight) * ((float)(pixel / kImageWidth) + 0.5f);
+		r.oz = RT_NEAR;
+		r.dx = r.dy = 0.f;
+		r.dz = 1.f;
+
+		float t0 = 0.f;
+		float t1 = 0.f;
+		sphere_roots(&r, cx[idx], cy[idx], cz[idx], radius2[idx], &t0, &t1);
+
+		b = reflect_ray((float3)(r.ox, r.oy, r.oz), (float3)(0.f, 0.f, 1.f), t0 > 0.f ? t0 : t1, idx, cx, cy, cz, radius2, pixel, reflectivity);
+		vstore3((1.f - reflectivity) * vload3(idx, color), pixel, accum);
+	}
+
+	queue_bounce(group, idx >= 0, &b, queued, rays, keys, values);
+}
+
+// Trace the count rays of a bounce in the order of order, the values sorted along their keys
+// or their slots unsorted, and add their colors to accum. Unless last, the rays that hit
+// queue their reflections into next for the next bounce. bounce_intersect tests every sphere,
+// bounce_intersect_bvh walks the full BVH of trace_bvh; both take the arguments of those
+// kernels up to it.
+__kernel __attribute__((reqd_work_group_size(kBounceGroup, 1, 1)))
+void bounce_intersect(__global float const* cx, __global float const* cy, __global float const* cz,
+                      __global float const* radius2, __global float const* color,
+                      __global bounce_ray const* rays, __global uint const* order, uint count, float reflectivity, uint last,
+                      __global float* accum, __global uint* queued, __global bounce_ray* next, __global uint* keys, __global uint* values)
+{
+	__local uint group[2];
+
+	uint i = (uint)get_global_id(0);
+	bool queue = false;
+	bounce_ray n;
+
+	if (i < count)
+	{
+		bounce_ray b = rays[order[i]];
+		float t = INFINITY;
+		int idx = -1;
+
+		for (int k = 0; k < kNumSpheres; ++k)
+		{
+			idx = bounce_closer(&b, k, idx, &t, cx, cy, cz, radius2);
+		}
+
+		queue = shade_bounce(&b, idx, t, reflectivity, last != 0U, cx, cy, cz, radius2, color, accum, &n);
+	}
+
+	queue_bounce(group, queue, &n, queued, next, keys, values);
+}
+
+#ifndef RT_COMPRESSED_BVH
+__kernel __attribute__((reqd_work_group_size(kBounceGroup, 1, 1)))
+void bounce_intersect_bvh(__global float const* cx, __global float const* cy, __global float const* cz,
+                          __global float const* radius2, __global float const* color,
+                          __global bvh_node const* nodes, __global uint const* indices,
+                          __global bounce_ray const* rays, __global uint const* order, uint count, float reflectivity, uint last,
+                          __global float* accum, __global uint* queued, __global bounce_ray* next, __global uint* keys, __global uint* values)
+{
+	__local uint group[2];
+
+	uint i = (uint)get_global_id(0);
+	bool queue = false;
+	bounce_ray n;
+
+	if (i < count)
+	{
+		bounce_ray b = rays[order[i]];
+		float t = INFINITY;
+		int idx = bounce_bvh_closest(&b, &t, cx, cy, cz, radius2, nodes, indices);
+
+		queue = shade_bounce(&b, idx, t, reflectivity, last != 0U, cx, cy, cz, radius2, color, accum, &n);
+	}
+
+	queue_bounce(group, queue, &n, queued, next, keys, values);
+}
+#endif
+
+// Write the colors accum mixed for the count pixels from first on that have a hit in ids,
+// through the output transform like write_pixel
+__kernel
+void resolve_bounces(__global int const* ids, __global float const* accum, uint first, uint count, __global pixel_t* img)
+{
+	uint i = (uint)get_global_id(0);
+
+	if (i >= count || ids[first + i] < 0)
+		return;
+
+	float3 c = vload3(first + i, accum);
+
+#ifdef RT_OUTPUT_TRANSFORM
+	c = (float3)(output_channel(c.x), output_channel(c.y), output_channel(c.z));
+#endif
+
+	write_color(img, first + i, c);
+}
+#endif
+
+// --delta: the tiles of kGroupTileSize pixels of the frames of an animation that changed since
+// the frame before (delta_frames.h). diff_tiles flags the tiles whose pixels differ from the
+// frame before, which is still on the device, or every tile of a keyframe; list_tiles lists
+// the flagged tiles in order and pack_tiles copies them into blocks one after the other, so
+// only they are read back.
+
+// Bytes of a pixel of RT_FORMAT, compared and copied a byte at a time
+#if RT_FORMAT == RT_FORMAT_FLOAT
+#define kPixelBytes 12
+#elif RT_FORMAT == RT_FORMAT_HALF
+#define kPixelBytes 6
+#elif RT_FORMAT == RT_FORMAT_ID16
+#define kPixelBytes 2
+#elif RT_FORMAT == RT_FORMAT_FLOAT4
+#define kPixelBytes 16
+#else
+#define kPixelBytes 4
+#endif
+
+// A work-group per tile and a work-item per pixel, the launch covers whole tiles. changed
+// gets 1 for every tile of img that differs from prev, a word per tile in rows.
+__kernel __attribute__((reqd_work_group_size(kGroupTileSize, kGroupTileSize, 1)))
+void diff_tiles(__global uchar const* img, __global uchar const* prev, uint keyframe, __global uint* changed)
+{
+	__local uint differs;
+
+	uint x = (uint)get_global_id(0);
+	uint y = (uint)get_global_id(1);
+	bool first = get_local_id(0) == 0 && get_local_id(1) == 0;
+
+	if (first)
+		differs = keyframe;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (x < kImageWidth && y < kImageHeight)
+	{
+		size_t p = ((size_t)y * kImageWidth + x) * kPixelBytes;
+		bool same = true;
+
+		for (uint b = 0; b < kPixelBytes; ++b)
+		{
+			same = same && img[p + b] == prev[p + b];
+		}
+
+		if (!same)
+			atomic_or(&differs, 1U);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (first)
+		changed[get_group_id(1) * get_num_groups(0) + get_group_id(0)] = differs;
+}
+
+// One work-group: list[0] gets the number of the count tiles changed flags, the indices of
+// those tiles follow in ascending order
+__kernel __attribute__((reqd_work_group_size(kRadixGroup, 1, 1)))
+void list_tiles(__global uint const* changed, uint count, __global uint* list)
+{
+	__local uint flags[kRadixGroup];
+
+	uint lid = (uint)get_local_id(0);
+	uint listed = 0;
+
+	for (uint first = 0; first < count; first += kRadixGroup)
+	{
+		uint t = first + lid;
+		uint flag = t < count && changed[t] != 0U ? 1U : 0U;
+
+		uint total;
+		uint before = group_scan(flags, lid, flag, &total);
+
+		if (flag != 0U)
+			list[1 + listed + before] = t;
+
+		listed += total;
+	}
+
+	if (lid == 0)
+		list[0] = listed;
+}
+
+// Work-group g copies the tile of img at entry g of list into block g of blocks, kGroupTileSize
+// rows of kGroupTileSize pixels, zero past the edge of the image. The launch covers every tile
+// of the image, the groups past the listed ones end at once.
+__kernel __attribute__((reqd_work_group_size(kGroupTileSize, kGroupTileSize, 1)))
+void pack_tiles(__global uchar const* img, __global uint const* list, __global uchar* blocks)
+{
+	uint g = (uint)get_group_id(1);
+
+	if (g >= list[0])
+		return;
+
+	uint tiles_x = (kImageWidth + kGroupTileSize - 1) / kGroupTileSize;
+	uint t = list[1 + g];
+	uint x = (t % tiles_x) * kGroupTileSize + (uint)get_local_id(0);
+	uint y = (t / tiles_x) * kGroupTileSize + (uint)get_local_id(1);
+
+	bool inside = x < kImageWidth && y < kImageHeight;
+	size_t src = ((size_t)y * kImageWidth + x) * kPixelBytes;
+	size_t dst = (((size_t)g * kGroupTileSize + get_local_id(1)) * kGroupTileSize + get_local_id(0)) * kPixelBytes;
+
+	for (uint b = 0; b < kPixelBytes; ++b)
 	{
-		img[id * 3] = 0.1f;
-		img[id * 3 + 1] = 0.1f;
-		img[id * 3 + 2] = 0.1f;
+		blocks[dst + b] = inside ? img[src + b] : (uchar)0;
 	}
-}
\ No newline at end of file
+}
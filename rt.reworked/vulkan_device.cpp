@@ -0,0 +1,1116 @@
+#include "vulkan_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef RT_WITH_VULKAN
+#include <vulkan/vulkan.h>
+
+namespace
+{
+	// Bindings of trace.comp: the sphere arrays, the structure buffers of all modes and the image
+	std::uint32_t const kSphereBindings = 5;
+	std::uint32_t const kNumBindings = 12;
+	std::uint32_t const kImageBinding = 11;
+	// Binding of the acceleration structure in trace_rq.spv, in place of the BVH nodes
+	std::uint32_t const kStructureBinding = 5;
+
+	// Device extensions ray queries take besides Vulkan 1.2
+	char const* const kRayQueryExtensions[] = { VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, VK_KHR_RAY_QUERY_EXTENSION_NAME,
+	                                            VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME };
+
+	struct device_buffer
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+	};
+
+	// Specialization constants of trace.comp in constant_id order
+	struct shader_constants
+	{
+		std::uint32_t image_width, image_height, num_spheres;
+		float left, bottom, width, height, near, far;
+		std::uint32_t format, mode;
+		VkBool32 neighbour_hint;
+	};
+
+	// Push constants of trace.comp
+	struct band_constants
+	{
+		std::uint32_t row_begin, cell_size, cells_x;
+	};
+
+	double host_ms(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+struct vulkan_objects
+{
+	~vulkan_objects();
+
+	VkInstance instance = VK_NULL_HANDLE;
+	VkPhysicalDevice physical = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	std::uint32_t compute_family = 0, transfer_family = 0;
+	VkQueue compute_queue = VK_NULL_HANDLE, transfer_queue = VK_NULL_HANDLE;
+	VkCommandPool compute_pool = VK_NULL_HANDLE, transfer_pool = VK_NULL_HANDLE;
+	VkShaderModule shader = VK_NULL_HANDLE;
+	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+	VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+	VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+	// Scene buffers on the device, bound in the order of the bindings, and their staging copy
+	std::vector<device_buffer> buffers;
+	device_buffer staging;
+	// Image on the device and the host visible copy it is read back into, mapped at mapped
+	device_buffer out, readback;
+	void* mapped = nullptr;
+	bool coherent = false;
+	// Bands [band_rows[b], band_rows[b + 1]) of the image
+	std::vector<std::uint32_t> band_rows;
+	// Per band: the dispatch, the copy into readback and the semaphore between them
+	std::vector<VkCommandBuffer> compute_cmds, transfer_cmds;
+	std::vector<VkSemaphore> band_done;
+	VkFence fence = VK_NULL_HANDLE;
+	// Start and end timestamps of every band on both queues
+	VkQueryPool compute_queries = VK_NULL_HANDLE, transfer_queries = VK_NULL_HANDLE;
+	double tick_ms = 0.0;
+	bool transfer_timestamps = false;
+	// With ray queries: the bottom level structure over the sphere boxes, the top level one over
+	// its instance, the buffers they live in and how to destroy them (VK_KHR_acceleration_structure)
+	VkAccelerationStructureKHR bottom = VK_NULL_HANDLE, top = VK_NULL_HANDLE;
+	device_buffer bottom_buffer, top_buffer;
+	PFN_vkDestroyAccelerationStructureKHR destroy_structure = nullptr;
+
+	// Index of a memory type of the bits in type_bits with required, and preferred if there is one
+	std::uint32_t memory_type(std::uint32_t type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const;
+
+	// Create buf of size bytes for usage in memory of required properties, shared by both queue
+	// families if they differ, with a device address if usage asks for one. Returns false if it
+	// can't be allocated.
+	bool create_buffer(device_buffer& buf, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+	void destroy_buffer(device_buffer& buf);
+};
+
+vulkan_objects::~vulkan_objects()
+{
+	if (device)
+	{
+		vkDeviceWaitIdle(device);
+
+		for (auto& buf : buffers)
+		{
+			destroy_buffer(buf);
+		}
+
+		destroy_buffer(staging);
+		destroy_buffer(out);
+		destroy_buffer(readback);
+
+		if (destroy_structure)
+		{
+			destroy_structure(device, top, nullptr);
+			destroy_structure(device, bottom, nullptr);
+		}
+
+		destroy_buffer(top_buffer);
+		destroy_buffer(bottom_buffer);
+
+		for (auto semaphore : band_done)
+		{
+			vkDestroySemaphore(device, semaphore, nullptr);
+		}
+
+		vkDestroyFence(device, fence, nullptr);
+		vkDestroyQueryPool(device, compute_queries, nullptr);
+		vkDestroyQueryPool(device, transfer_queries, nullptr);
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+		vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+		vkDestroyDescriptorSetLayout(device, set_layout, nullptr);
+		vkDestroyShaderModule(device, shader, nullptr);
+		vkDestroyCommandPool(device, compute_pool, nullptr);
+		vkDestroyCommandPool(device, transfer_pool, nullptr);
+		vkDestroyDevice(device, nullptr);
+	}
+
+	if (instance)
+		vkDestroyInstance(instance, nullptr);
+}
+
+std::uint32_t vulkan_objects::memory_type(std::uint32_t type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+	VkPhysicalDeviceMemoryProperties props;
+	vkGetPhysicalDeviceMemoryProperties(physical, &props);
+
+	std::uint32_t found = UINT32_MAX;
+
+	for (std::uint32_t t = 0; t < props.memoryTypeCount; ++t)
+	{
+		auto flags = props.memoryTypes[t].propertyFlags;
+
+		if ((type_bits & (1U << t)) == 0 || (flags & required) != required)
+			continue;
+
+		if ((flags & preferred) == preferred)
+			return t;
+
+		found = found == UINT32_MAX ? t : found;
+	}
+
+	return found;
+}
+
+bool vulkan_objects::create_buffer(device_buffer& buf, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+{
+	std::uint32_t families[] = { compute_family, transfer_family };
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.size = size;
+	info.usage = usage;
+
+	// both queues use the buffers, concurrent sharing saves the ownership transfers
+	if (compute_family != transfer_family)
+	{
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.queueFamilyIndexCount = 2;
+		info.pQueueFamilyIndices = families;
+	}
+
+	if (vkCreateBuffer(device, &info, nullptr, &buf.buffer) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements needs;
+	vkGetBufferMemoryRequirements(device, buf.buffer, &needs);
+
+	VkMemoryAllocateInfo alloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	alloc.allocationSize = needs.size;
+	alloc.memoryTypeIndex = memory_type(needs.memoryTypeBits, required, preferred);
+
+	VkMemoryAllocateFlagsInfo flags = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO };
+	flags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+
+	if ((usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) != 0)
+		alloc.pNext = &flags;
+
+	if (alloc.memoryTypeIndex == UINT32_MAX || vkAllocateMemory(device, &alloc, nullptr, &buf.memory) != VK_SUCCESS)
+		return false;
+
+	buf.size = size;
+	return vkBindBufferMemory(device, buf.buffer, buf.memory, 0) == VK_SUCCESS;
+}
+
+void vulkan_objects::destroy_buffer(device_buffer& buf)
+{
+	vkDestroyBuffer(device, buf.buffer, nullptr);
+	vkFreeMemory(device, buf.memory, nullptr);
+	buf = device_buffer();
+}
+
+namespace
+{
+	// Physical device selector names, see init_vulkan_device, or null
+	VkPhysicalDevice select_vulkan_device(VkInstance instance, std::string const& selector)
+	{
+		std::uint32_t count = 0;
+		vkEnumeratePhysicalDevices(instance, &count, nullptr);
+
+		std::vector<VkPhysicalDevice> devices(count);
+		vkEnumeratePhysicalDevices(instance, &count, devices.data());
+
+		if (devices.empty())
+			return VK_NULL_HANDLE;
+
+		char* end = nullptr;
+		long index = std::strtol(selector.c_str(), &end, 10);
+
+		if (!selector.empty() && *end == '\0')
+			return index >= 0 && index < static_cast<long>(devices.size()) ? devices[index] : VK_NULL_HANDLE;
+
+		for (auto physical : devices)
+		{
+			VkPhysicalDeviceProperties props;
+			vkGetPhysicalDeviceProperties(physical, &props);
+
+			bool matches = selector.empty() ? props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU : std::strstr(props.deviceName, selector.c_str()) != nullptr;
+
+			if (matches)
+				return physical;
+		}
+
+		return selector.empty() ? devices[0] : VK_NULL_HANDLE;
+	}
+
+	// True if physical has every device extension ray queries take and the features they need
+	bool has_ray_query(VkPhysicalDevice physical)
+	{
+		std::uint32_t count = 0;
+		vkEnumerateDeviceExtensionProperties(physical, nullptr, &count, nullptr);
+
+		std::vector<VkExtensionProperties> extensions(count);
+		vkEnumerateDeviceExtensionProperties(physical, nullptr, &count, extensions.data());
+
+		for (auto name : kRayQueryExtensions)
+		{
+			auto found = std::find_if(extensions.begin(), extensions.end(), [name](VkExtensionProperties const& e) { return std::strcmp(e.extensionName, name) == 0; });
+
+			if (found == extensions.end())
+				return false;
+		}
+
+		VkPhysicalDeviceRayQueryFeaturesKHR ray_query = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR };
+		VkPhysicalDeviceAccelerationStructureFeaturesKHR structure = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+		VkPhysicalDeviceVulkan12Features vulkan12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+		structure.pNext = &ray_query;
+		vulkan12.pNext = &structure;
+
+		VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		features.pNext = &vulkan12;
+		vkGetPhysicalDeviceFeatures2(physical, &features);
+
+		return ray_query.rayQuery && structure.accelerationStructure && vulkan12.bufferDeviceAddress;
+	}
+
+	// Create the logical device of vk.physical with a compute queue and a transfer queue, of a
+	// family without graphics or compute if there is one, and with ray_query the extensions and
+	// features of ray queries. Returns false if it has no compute queue.
+	bool create_device(vulkan_objects& vk, bool ray_query)
+	{
+		std::uint32_t count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(vk.physical, &count, nullptr);
+
+		std::vector<VkQueueFamilyProperties> families(count);
+		vkGetPhysicalDeviceQueueFamilyProperties(vk.physical, &count, families.data());
+
+		vk.compute_family = vk.transfer_family = UINT32_MAX;
+
+		for (std::uint32_t f = 0; f < count; ++f)
+		{
+			auto flags = families[f].queueFlags;
+
+			if ((flags & VK_QUEUE_COMPUTE_BIT) != 0 && vk.compute_family == UINT32_MAX)
+				vk.compute_family = f;
+
+			if ((flags & VK_QUEUE_TRANSFER_BIT) != 0 && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0 && vk.transfer_family == UINT32_MAX)
+				vk.transfer_family = f;
+		}
+
+		if (vk.compute_family == UINT32_MAX)
+			return false;
+
+		float priorities[] = { 1.f, 1.f };
+		std::vector<VkDeviceQueueCreateInfo> queues;
+
+		VkDeviceQueueCreateInfo queue = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
+		queue.queueFamilyIndex = vk.compute_family;
+		queue.queueCount = 1;
+		queue.pQueuePriorities = priorities;
+
+		// without a transfer family the copies go to a second compute queue, if there is one
+		std::uint32_t transfer_index = 0;
+
+		if (vk.transfer_family == UINT32_MAX)
+		{
+			vk.transfer_family = vk.compute_family;
+			queue.queueCount = std::min(2U, families[vk.compute_family].queueCount);
+			transfer_index = queue.queueCount - 1;
+		}
+
+		queues.push_back(queue);
+
+		if (vk.transfer_family != vk.compute_family)
+		{
+			queue.queueFamilyIndex = vk.transfer_family;
+			queue.queueCount = 1;
+			queues.push_back(queue);
+		}
+
+		VkDeviceCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
+		info.queueCreateInfoCount = static_cast<std::uint32_t>(queues.size());
+		info.pQueueCreateInfos = queues.data();
+
+		VkPhysicalDeviceRayQueryFeaturesKHR query_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR };
+		VkPhysicalDeviceAccelerationStructureFeaturesKHR structure_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+		VkPhysicalDeviceVulkan12Features vulkan12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+
+		if (ray_query)
+		{
+			query_features.rayQuery = VK_TRUE;
+			structure_features.accelerationStructure = VK_TRUE;
+			structure_features.pNext = &query_features;
+			vulkan12.bufferDeviceAddress = VK_TRUE;
+			vulkan12.pNext = &structure_features;
+
+			info.pNext = &vulkan12;
+			info.enabledExtensionCount = sizeof(kRayQueryExtensions) / sizeof(kRayQueryExtensions[0]);
+			info.ppEnabledExtensionNames = kRayQueryExtensions;
+		}
+
+		if (vkCreateDevice(vk.physical, &info, nullptr, &vk.device) != VK_SUCCESS)
+			return false;
+
+		vkGetDeviceQueue(vk.device, vk.compute_family, 0, &vk.compute_queue);
+		vkGetDeviceQueue(vk.device, vk.transfer_family, transfer_index, &vk.transfer_queue);
+
+		VkCommandPoolCreateInfo pool = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		pool.queueFamilyIndex = vk.compute_family;
+		vkCreateCommandPool(vk.device, &pool, nullptr, &vk.compute_pool);
+
+		pool.queueFamilyIndex = vk.transfer_family;
+		vkCreateCommandPool(vk.device, &pool, nullptr, &vk.transfer_pool);
+
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(vk.physical, &props);
+
+		vk.tick_ms = props.limits.timestampPeriod * 1e-6;
+		vk.transfer_timestamps = families[vk.transfer_family].timestampValidBits != 0;
+		return true;
+	}
+
+	VkCommandBuffer allocate_commands(vulkan_objects const& vk, VkCommandPool pool)
+	{
+		VkCommandBufferAllocateInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		info.commandPool = pool;
+		info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		info.commandBufferCount = 1;
+
+		VkCommandBuffer commands = VK_NULL_HANDLE;
+		vkAllocateCommandBuffers(vk.device, &info, &commands);
+		return commands;
+	}
+
+	// Stage the arrays of sources into vk.staging and copy each one into a device buffer of
+	// vk.buffers on the transfer queue, signalling vk.fence when done. Returns false if the
+	// buffers can't be allocated.
+	bool start_upload(vulkan_objects& vk, std::vector<std::pair<void const*, std::size_t>> const& sources, VkCommandBuffer commands)
+	{
+		VkDeviceSize total = 0;
+
+		for (auto const& source : sources)
+		{
+			total += source.second;
+		}
+
+		if (!vk.create_buffer(vk.staging, total, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0))
+			return false;
+
+		void* staged = nullptr;
+		vkMapMemory(vk.device, vk.staging.memory, 0, total, 0, &staged);
+
+		VkCommandBufferBeginInfo begin = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commands, &begin);
+
+		VkDeviceSize offset = 0;
+
+		for (auto const& source : sources)
+		{
+			vk.buffers.emplace_back();
+
+			if (!vk.create_buffer(vk.buffers.back(), source.second, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0))
+				return false;
+
+			std::memcpy(static_cast<char*>(staged) + offset, source.first, source.second);
+
+			VkBufferCopy region = { offset, 0, source.second };
+			vkCmdCopyBuffer(commands, vk.staging.buffer, vk.buffers.back().buffer, 1, &region);
+
+			offset += source.second;
+		}
+
+		vkUnmapMemory(vk.device, vk.staging.memory);
+		vkEndCommandBuffer(commands);
+
+		VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+		submit.commandBufferCount = 1;
+		submit.pCommandBuffers = &commands;
+
+		return vkQueueSubmit(vk.transfer_queue, 1, &submit, vk.fence) == VK_SUCCESS;
+	}
+
+	VkDeviceAddress buffer_address(vulkan_objects const& vk, device_buffer const& buf)
+	{
+		VkBufferDeviceAddressInfo info = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+		info.buffer = buf.buffer;
+		return vkGetBufferDeviceAddress(vk.device, &info);
+	}
+
+	// Create the acceleration structure of type in a buffer of vk of the size build asks for,
+	// build it from geometry on the compute queue and wait for it. The scratch buffer is freed
+	// when done. Returns false if a buffer can't be allocated or the build fails.
+	bool build_structure(vulkan_objects& vk, VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR const& geometry, std::uint32_t primitives,
+	                     VkAccelerationStructureKHR& structure, device_buffer& storage)
+	{
+		auto get_sizes = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(vkGetDeviceProcAddr(vk.device, "vkGetAccelerationStructureBuildSizesKHR"));
+		auto create = reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(vkGetDeviceProcAddr(vk.device, "vkCreateAccelerationStructureKHR"));
+		auto build = reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(vkGetDeviceProcAddr(vk.device, "vkCmdBuildAccelerationStructuresKHR"));
+
+		VkAccelerationStructureBuildGeometryInfoKHR info = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+		info.type = type;
+		info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+		info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		info.geometryCount = 1;
+		info.pGeometries = &geometry;
+
+		VkAccelerationStructureBuildSizesInfoKHR sizes = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+		get_sizes(vk.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &info, &primitives, &sizes);
+
+		device_buffer scratch;
+
+		if (!vk.create_buffer(storage, sizes.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0) ||
+		    !vk.create_buffer(scratch, sizes.buildScratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0))
+		{
+			vk.destroy_buffer(scratch);
+			return false;
+		}
+
+		VkAccelerationStructureCreateInfoKHR create_info = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+		create_info.buffer = storage.buffer;
+		create_info.size = sizes.accelerationStructureSize;
+		create_info.type = type;
+
+		if (create(vk.device, &create_info, nullptr, &structure) != VK_SUCCESS)
+		{
+			vk.destroy_buffer(scratch);
+			return false;
+		}
+
+		info.dstAccelerationStructure = structure;
+		info.scratchData.deviceAddress = buffer_address(vk, scratch);
+
+		VkAccelerationStructureBuildRangeInfoKHR range = { primitives, 0, 0, 0 };
+		VkAccelerationStructureBuildRangeInfoKHR const* ranges = &range;
+
+		auto commands = allocate_commands(vk, vk.compute_pool);
+
+		VkCommandBufferBeginInfo begin = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commands, &begin);
+		build(commands, 1, &info, &ranges);
+		vkEndCommandBuffer(commands);
+
+		VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+		submit.commandBufferCount = 1;
+		submit.pCommandBuffers = &commands;
+
+		// the queue is idle once the build is, the top level build and the first frame see the
+		// structure complete
+		bool built = vkQueueSubmit(vk.compute_queue, 1, &submit, VK_NULL_HANDLE) == VK_SUCCESS && vkQueueWaitIdle(vk.compute_queue) == VK_SUCCESS;
+
+		vkFreeCommandBuffers(vk.device, vk.compute_pool, 1, &commands);
+		vk.destroy_buffer(scratch);
+		return built;
+	}
+
+	// Build the bottom level acceleration structure of vk over the sphere_bounds() of the spheres
+	// of scene, box k for sphere k, and the top level one over a single instance of it. The
+	// boxes and the instance are read by the builds from host visible buffers freed afterwards.
+	// Returns false if a buffer can't be allocated or a build fails.
+	bool build_structures(vulkan_objects& vk, render_scene const& scene)
+	{
+		vk.destroy_structure = reinterpret_cast<PFN_vkDestroyAccelerationStructureKHR>(vkGetDeviceProcAddr(vk.device, "vkDestroyAccelerationStructureKHR"));
+		auto structure_address =
+		    reinterpret_cast<PFN_vkGetAccelerationStructureDeviceAddressKHR>(vkGetDeviceProcAddr(vk.device, "vkGetAccelerationStructureDeviceAddressKHR"));
+
+		auto const& spheres = scene.spheres;
+		auto num_spheres = static_cast<std::uint32_t>(spheres.size());
+
+		auto input_usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+		auto host_memory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+		device_buffer boxes, instance;
+		void* mapped = nullptr;
+
+		// an empty scene still gets a buffer, of one unread box
+		if (!vk.create_buffer(boxes, sizeof(VkAabbPositionsKHR) * std::max(num_spheres, 1U), input_usage, host_memory, 0) ||
+		    vkMapMemory(vk.device, boxes.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		{
+			vk.destroy_buffer(boxes);
+			return false;
+		}
+
+		auto aabbs = static_cast<VkAabbPositionsKHR*>(mapped);
+
+		for (std::uint32_t k = 0; k < num_spheres; ++k)
+		{
+			auto bounds = sphere_bounds(spheres, k, scene.view.near);
+			aabbs[k] = VkAabbPositionsKHR{ bounds.min.x, bounds.min.y, bounds.min.z, bounds.max.x, bounds.max.y, bounds.max.z };
+		}
+
+		vkUnmapMemory(vk.device, boxes.memory);
+
+		// every box comes up as a candidate whatever its opacity, the shader tests the sphere
+		VkAccelerationStructureGeometryKHR geometry = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+		geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
+		geometry.geometry.aabbs.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR;
+		geometry.geometry.aabbs.data.deviceAddress = buffer_address(vk, boxes);
+		geometry.geometry.aabbs.stride = sizeof(VkAabbPositionsKHR);
+
+		bool built = build_structure(vk, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, geometry, num_spheres, vk.bottom, vk.bottom_buffer);
+		vk.destroy_buffer(boxes);
+
+		if (!built || !vk.create_buffer(instance, sizeof(VkAccelerationStructureInstanceKHR), input_usage, host_memory, 0) ||
+		    vkMapMemory(vk.device, instance.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		{
+			vk.destroy_buffer(instance);
+			return false;
+		}
+
+		VkAccelerationStructureDeviceAddressInfoKHR bottom = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+		bottom.accelerationStructure = vk.bottom;
+
+		// the identity transform, the scene is in world space
+		VkAccelerationStructureInstanceKHR placed = {};
+		placed.transform.matrix[0][0] = placed.transform.matrix[1][1] = placed.transform.matrix[2][2] = 1.f;
+		placed.mask = 0xFF;
+		placed.accelerationStructureReference = structure_address(vk.device, &bottom);
+		std::memcpy(mapped, &placed, sizeof(placed));
+		vkUnmapMemory(vk.device, instance.memory);
+
+		geometry = VkAccelerationStructureGeometryKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+		geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+		geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+		geometry.geometry.instances.data.deviceAddress = buffer_address(vk, instance);
+
+		built = build_structure(vk, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, geometry, 1, vk.top, vk.top_buffer);
+		vk.destroy_buffer(instance);
+		return built;
+	}
+
+	// Create the descriptor set, specialized pipeline and layouts of the shader in spirv, with
+	// ray_query those of trace_rq.spv, which reads the acceleration structure at
+	// kStructureBinding in place of the BVH nodes
+	bool create_pipeline(vulkan_objects& vk, std::vector<char> const& spirv, shader_constants const& constants, bool ray_query)
+	{
+		VkShaderModuleCreateInfo module = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+		module.codeSize = spirv.size();
+		module.pCode = reinterpret_cast<std::uint32_t const*>(spirv.data());
+
+		if (vkCreateShaderModule(vk.device, &module, nullptr, &vk.shader) != VK_SUCCESS)
+			return false;
+
+		VkDescriptorSetLayoutBinding bindings[kNumBindings];
+
+		for (std::uint32_t b = 0; b < kNumBindings; ++b)
+		{
+			auto type = ray_query && b == kStructureBinding ? VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[b] = VkDescriptorSetLayoutBinding{ b, type, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+		}
+
+		VkDescriptorSetLayoutCreateInfo set_layout = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+		set_layout.bindingCount = kNumBindings;
+		set_layout.pBindings = bindings;
+		vkCreateDescriptorSetLayout(vk.device, &set_layout, nullptr, &vk.set_layout);
+
+		VkPushConstantRange push = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(band_constants) };
+
+		VkPipelineLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+		layout.setLayoutCount = 1;
+		layout.pSetLayouts = &vk.set_layout;
+		layout.pushConstantRangeCount = 1;
+		layout.pPushConstantRanges = &push;
+		vkCreatePipelineLayout(vk.device, &layout, nullptr, &vk.pipeline_layout);
+
+		// every constant is 4 bytes, in constant_id order
+		VkSpecializationMapEntry entries[sizeof(shader_constants) / 4];
+
+		for (std::uint32_t c = 0; c < sizeof(shader_constants) / 4; ++c)
+		{
+			entries[c] = VkSpecializationMapEntry{ c, c * 4, 4 };
+		}
+
+		VkSpecializationInfo specialization = { sizeof(shader_constants) / 4, entries, sizeof(shader_constants), &constants };
+
+		VkComputePipelineCreateInfo pipeline = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		pipeline.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline.stage.module = vk.shader;
+		pipeline.stage.pName = "main";
+		pipeline.stage.pSpecializationInfo = &specialization;
+		pipeline.layout = vk.pipeline_layout;
+
+		if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &pipeline, nullptr, &vk.pipeline) != VK_SUCCESS)
+			return false;
+
+		VkDescriptorPoolSize pool_sizes[] = { { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, kNumBindings }, { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 } };
+
+		VkDescriptorPoolCreateInfo pool = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		pool.maxSets = 1;
+		pool.poolSizeCount = ray_query ? 2 : 1;
+		pool.pPoolSizes = pool_sizes;
+		vkCreateDescriptorPool(vk.device, &pool, nullptr, &vk.descriptor_pool);
+
+		VkDescriptorSetAllocateInfo set = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		set.descriptorPool = vk.descriptor_pool;
+		set.descriptorSetCount = 1;
+		set.pSetLayouts = &vk.set_layout;
+		return vkAllocateDescriptorSets(vk.device, &set, &vk.descriptor_set) == VK_SUCCESS;
+	}
+
+	// Point the bindings at the scene buffers, the structure ones of mode at the buffers after
+	// the sphere arrays and the others at the first sphere array, and at the image
+	void bind_buffers(vulkan_objects& vk, accel_mode mode)
+	{
+		std::uint32_t first_structure = kSphereBindings;
+
+		switch (mode)
+		{
+		case accel_mode::bvh: first_structure = 5; break;
+		case accel_mode::sorted: first_structure = 7; break;
+		case accel_mode::grid:
+		case accel_mode::adaptive: first_structure = 9; break;
+		default: break;
+		}
+
+		VkDescriptorBufferInfo infos[kNumBindings];
+		VkWriteDescriptorSet writes[kNumBindings];
+
+		for (std::uint32_t b = 0; b < kNumBindings; ++b)
+		{
+			std::size_t buffer = 0;
+
+			if (b < kSphereBindings)
+				buffer = b;
+			else if (mode != accel_mode::none && b >= first_structure && b < first_structure + 2)
+				buffer = kSphereBindings + (b - first_structure);
+
+			infos[b] = VkDescriptorBufferInfo{ b == kImageBinding ? vk.out.buffer : vk.buffers[buffer].buffer, 0, VK_WHOLE_SIZE };
+
+			writes[b] = VkWriteDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			writes[b].dstSet = vk.descriptor_set;
+			writes[b].dstBinding = b;
+			writes[b].descriptorCount = 1;
+			writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[b].pBufferInfo = &infos[b];
+		}
+
+		vkUpdateDescriptorSets(vk.device, kNumBindings, writes, 0, nullptr);
+	}
+
+	// Point the bindings of trace_rq.spv at the sphere arrays, the top level acceleration
+	// structure and the image, and the ones of the structures it doesn't read at the first
+	// sphere array
+	void bind_structure(vulkan_objects& vk)
+	{
+		VkDescriptorBufferInfo infos[kNumBindings];
+		VkWriteDescriptorSet writes[kNumBindings];
+
+		VkWriteDescriptorSetAccelerationStructureKHR structure = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
+		structure.accelerationStructureCount = 1;
+		structure.pAccelerationStructures = &vk.top;
+
+		for (std::uint32_t b = 0; b < kNumBindings; ++b)
+		{
+			writes[b] = VkWriteDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			writes[b].dstSet = vk.descriptor_set;
+			writes[b].dstBinding = b;
+			writes[b].descriptorCount = 1;
+
+			if (b == kStructureBinding)
+			{
+				writes[b].descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+				writes[b].pNext = &structure;
+				continue;
+			}
+
+			infos[b] = VkDescriptorBufferInfo{ b == kImageBinding ? vk.out.buffer : vk.buffers[b < kSphereBindings ? b : 0].buffer, 0, VK_WHOLE_SIZE };
+			writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[b].pBufferInfo = &infos[b];
+		}
+
+		vkUpdateDescriptorSets(vk.device, kNumBindings, writes, 0, nullptr);
+	}
+
+	// Record the dispatch and the readback of every band, they are the same for every frame.
+	// The first dispatch resets the timestamps of both queues, the copies only run after it.
+	void record_bands(vulkan_objects& vk, ortho_view const& view, std::size_t row_size, band_constants constants)
+	{
+		auto bands = static_cast<std::uint32_t>(vk.band_rows.size() - 1);
+
+		VkCommandBufferBeginInfo begin = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+
+		for (std::uint32_t b = 0; b < bands; ++b)
+		{
+			auto rows = vk.band_rows[b + 1] - vk.band_rows[b];
+			constants.row_begin = vk.band_rows[b];
+
+			auto compute = vk.compute_cmds[b] = allocate_commands(vk, vk.compute_pool);
+			vkBeginCommandBuffer(compute, &begin);
+
+			if (b == 0)
+			{
+				vkCmdResetQueryPool(compute, vk.compute_queries, 0, 2 * bands);
+				vkCmdResetQueryPool(compute, vk.transfer_queries, 0, 2 * bands);
+			}
+
+			vkCmdWriteTimestamp(compute, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.compute_queries, 2 * b);
+			vkCmdBindPipeline(compute, VK_PIPELINE_BIND_POINT_COMPUTE, vk.pipeline);
+			vkCmdBindDescriptorSets(compute, VK_PIPELINE_BIND_POINT_COMPUTE, vk.pipeline_layout, 0, 1, &vk.descriptor_set, 0, nullptr);
+			vkCmdPushConstants(compute, vk.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+			vkCmdDispatch(compute, (view.image_width + kGroupTileSize - 1) / kGroupTileSize, (rows + kGroupTileSize - 1) / kGroupTileSize, 1);
+			vkCmdWriteTimestamp(compute, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.compute_queries, 2 * b + 1);
+			vkEndCommandBuffer(compute);
+
+			auto transfer = vk.transfer_cmds[b] = allocate_commands(vk, vk.transfer_pool);
+			vkBeginCommandBuffer(transfer, &begin);
+
+			if (vk.transfer_timestamps)
+				vkCmdWriteTimestamp(transfer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.transfer_queries, 2 * b);
+
+			VkBufferCopy region = { row_size * vk.band_rows[b], row_size * vk.band_rows[b], row_size * rows };
+			vkCmdCopyBuffer(transfer, vk.out.buffer, vk.readback.buffer, 1, &region);
+
+			VkMemoryBarrier to_host = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			to_host.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			to_host.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(transfer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &to_host, 0, nullptr, 0, nullptr);
+
+			if (vk.transfer_timestamps)
+				vkCmdWriteTimestamp(transfer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.transfer_queries, 2 * b + 1);
+
+			vkEndCommandBuffer(transfer);
+		}
+	}
+
+	// Milliseconds from the first start to the last end timestamp of the bands in queries
+	double band_time(vulkan_objects const& vk, VkQueryPool queries, std::uint32_t bands)
+	{
+		std::vector<std::uint64_t> stamps(2 * bands);
+		vkGetQueryPoolResults(vk.device, queries, 0, 2 * bands, sizeof(std::uint64_t) * stamps.size(), stamps.data(), sizeof(std::uint64_t),
+		                      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+		return (stamps.back() - stamps.front()) * vk.tick_ms;
+	}
+}
+#else
+struct vulkan_objects
+{
+};
+#endif
+
+vulkan_device::vulkan_device() = default;
+
+vulkan_device::~vulkan_device() = default;
+
+bool init_vulkan_device(vulkan_device& dev, std::vector<char> const& spirv, render_scene const& scene, pixel_format format, std::string const& selector,
+                        bool ray_query)
+{
+#ifdef RT_WITH_VULKAN
+	if (scene.mode == accel_mode::splat)
+	{
+		std::cout << "trace.comp has no shader for " << accel_mode_name(scene.mode) << "\n";
+		return false;
+	}
+
+	if (ray_query && scene.mode != accel_mode::bvh)
+	{
+		std::cout << "trace_rq.spv traces bvh scenes only, not " << accel_mode_name(scene.mode) << " ones\n";
+		return false;
+	}
+
+	if (format == pixel_format::half || format == pixel_format::float4)
+	{
+		std::cout << "trace.comp writes no " << pixel_format_name(format) << " pixels\n";
+		return false;
+	}
+
+	if (spirv.empty() || spirv.size() % 4 != 0)
+	{
+		if (ray_query)
+			std::cout << "trace_rq.spv is missing, compile it with glslangValidator -V --target-env vulkan1.2 -DRT_RAY_QUERY trace.comp -o trace_rq.spv\n";
+		else
+			std::cout << "trace.spv is missing, compile it with glslangValidator -V trace.comp -o trace.spv\n";
+
+		return false;
+	}
+
+	dev.vk.reset(new vulkan_objects);
+	auto& vk = *dev.vk;
+
+	VkApplicationInfo app = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+	app.pApplicationName = "rt.reworked";
+	// ray queries and the device addresses of their buffers take Vulkan 1.2
+	app.apiVersion = ray_query ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
+
+	VkInstanceCreateInfo instance = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO };
+	instance.pApplicationInfo = &app;
+
+	if (vkCreateInstance(&instance, nullptr, &vk.instance) != VK_SUCCESS)
+	{
+		std::cout << " No Vulkan driver found\n";
+		return false;
+	}
+
+	vk.physical = select_vulkan_device(vk.instance, selector);
+
+	VkPhysicalDeviceProperties props;
+
+	if (vk.physical && ray_query)
+	{
+		vkGetPhysicalDeviceProperties(vk.physical, &props);
+
+		if (props.apiVersion < VK_API_VERSION_1_2 || !has_ray_query(vk.physical))
+		{
+			std::cout << props.deviceName << " has no Vulkan 1.2 ray queries (VK_KHR_ray_query), render without --ray-query\n";
+			return false;
+		}
+	}
+
+	if (!vk.physical || !create_device(vk, ray_query))
+	{
+		std::cout << " No Vulkan device with compute matches \"" << selector << "\"\n";
+		return false;
+	}
+
+	vkGetPhysicalDeviceProperties(vk.physical, &props);
+
+	dev.name = props.deviceName;
+	dev.ray_query = ray_query;
+	dev.async_transfer = vk.transfer_family != vk.compute_family;
+	dev.format = format;
+	dev.view = scene.view;
+
+	VkFenceCreateInfo fence = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	vkCreateFence(vk.device, &fence, nullptr, &vk.fence);
+
+	// the scene goes up on the transfer queue while the pipeline is created
+	auto upload_start = std::chrono::high_resolution_clock::now();
+
+	auto const& spheres = scene.spheres;
+	std::vector<std::pair<void const*, std::size_t>> sources = {
+		{ spheres.cx.data(), sizeof(float) * spheres.cx.size() },
+		{ spheres.cy.data(), sizeof(float) * spheres.cy.size() },
+		{ spheres.cz.data(), sizeof(float) * spheres.cz.size() },
+		{ spheres.radius2.data(), sizeof(float) * spheres.radius2.size() },
+		{ spheres.color.data(), sizeof(float) * spheres.color.size() }
+	};
+
+	std::uint32_t mode = 0;
+
+	// the acceleration structure takes the place of the BVH buffers
+	if (ray_query)
+	{
+		mode = 1;
+	}
+	else if (scene.mode == accel_mode::bvh)
+	{
+		mode = 1;
+		sources.emplace_back(scene.accel.nodes.data(), sizeof(bvh_node) * scene.accel.nodes.size());
+		sources.emplace_back(scene.accel.indices.data(), sizeof(std::uint32_t) * scene.accel.indices.size());
+	}
+	else if (scene.mode == accel_mode::sorted)
+	{
+		mode = 2;
+		sources.emplace_back(scene.order.indices.data(), sizeof(std::uint32_t) * scene.order.indices.size());
+		sources.emplace_back(scene.order.zmin.data(), sizeof(float) * scene.order.zmin.size());
+	}
+	else if (scene.mode != accel_mode::none)
+	{
+		mode = 3;
+		sources.emplace_back(scene.grid.cell_start.data(), sizeof(std::uint32_t) * scene.grid.cell_start.size());
+		sources.emplace_back(scene.grid.indices.data(), sizeof(std::uint32_t) * scene.grid.indices.size());
+	}
+
+	auto upload_commands = allocate_commands(vk, vk.transfer_pool);
+
+	if (!start_upload(vk, sources, upload_commands))
+	{
+		std::cout << "Can't upload the scene to " << dev.name << "\n";
+		return false;
+	}
+
+	double submit_time = host_ms(upload_start);
+
+	auto build_start = std::chrono::high_resolution_clock::now();
+
+	auto const& view = scene.view;
+	shader_constants constants = { view.image_width, view.image_height, static_cast<std::uint32_t>(spheres.size()),
+	                               view.left, view.bottom, view.width, view.height, view.near, view.far,
+	                               static_cast<std::uint32_t>(format), mode, scene.neighbour_hint ? VK_TRUE : VK_FALSE };
+
+	if (!create_pipeline(vk, spirv, constants, ray_query))
+	{
+		std::cout << "Can't create the " << (ray_query ? "trace_rq.spv" : "trace.spv") << " pipeline on " << dev.name << "\n";
+		return false;
+	}
+
+	dev.build_time = host_ms(build_start);
+
+	// the structures are built on the compute queue while the spheres still go up
+	if (ray_query)
+	{
+		auto structure_start = std::chrono::high_resolution_clock::now();
+
+		if (!build_structures(vk, scene))
+		{
+			std::cout << "Can't build the acceleration structure on " << dev.name << "\n";
+			return false;
+		}
+
+		dev.structure_time = host_ms(structure_start);
+	}
+
+	auto wait_start = std::chrono::high_resolution_clock::now();
+	vkWaitForFences(vk.device, 1, &vk.fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(vk.device, 1, &vk.fence);
+	vk.destroy_buffer(vk.staging);
+
+	// the part of the upload the pipeline creation didn't hide
+	dev.upload_time = submit_time + host_ms(wait_start);
+
+	auto row_size = pixel_size(format) * view.image_width;
+	auto image_size = row_size * view.image_height;
+
+	// the shader indexes the 32-bit words of the image with a uint
+	if (image_size / sizeof(std::uint32_t) > UINT32_MAX)
+	{
+		std::cout << "The image has more than 2^32 words, too many for the trace.spv pipeline on " << dev.name << "\n";
+		return false;
+	}
+
+	bool allocated = vk.create_buffer(vk.out, image_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0) &&
+	                 vk.create_buffer(vk.readback, image_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+	                                  VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (!allocated || vkMapMemory(vk.device, vk.readback.memory, 0, image_size, 0, &vk.mapped) != VK_SUCCESS)
+	{
+		std::cout << "Can't allocate the image on " << dev.name << "\n";
+		return false;
+	}
+
+	VkPhysicalDeviceMemoryProperties memory;
+	vkGetPhysicalDeviceMemoryProperties(vk.physical, &memory);
+
+	VkMemoryRequirements needs;
+	vkGetBufferMemoryRequirements(vk.device, vk.readback.buffer, &needs);
+	auto type = vk.memory_type(needs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vk.coherent = (memory.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+	if (ray_query)
+		bind_structure(vk);
+	else
+		bind_buffers(vk, scene.mode);
+
+	// bands of whole work-groups, only the last one may end with a partial one
+	auto band_height = (view.image_height + kVulkanBands * kGroupTileSize - 1) / (kVulkanBands * kGroupTileSize) * kGroupTileSize;
+
+	for (std::uint32_t row = 0; row < view.image_height; row += band_height)
+	{
+		vk.band_rows.push_back(row);
+	}
+
+	vk.band_rows.push_back(view.image_height);
+
+	auto bands = static_cast<std::uint32_t>(vk.band_rows.size() - 1);
+
+	VkQueryPoolCreateInfo queries = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	queries.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queries.queryCount = 2 * bands;
+	vkCreateQueryPool(vk.device, &queries, nullptr, &vk.compute_queries);
+	vkCreateQueryPool(vk.device, &queries, nullptr, &vk.transfer_queries);
+
+	vk.compute_cmds.resize(bands);
+	vk.transfer_cmds.resize(bands);
+	vk.band_done.resize(bands);
+
+	VkSemaphoreCreateInfo semaphore = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+	for (auto& done : vk.band_done)
+	{
+		vkCreateSemaphore(vk.device, &semaphore, nullptr, &done);
+	}
+
+	record_bands(vk, view, row_size, band_constants{ 0, scene.grid.cell_size, scene.grid.cells_x });
+	return true;
+#else
+	(void)dev;
+	(void)spirv;
+	(void)scene;
+	(void)format;
+	(void)selector;
+	(void)ray_query;
+
+	std::cout << "This build has no Vulkan support, build with RT_WITH_VULKAN for --backend vulkan\n";
+	return false;
+#endif
+}
+
+bool render_vulkan_frame(vulkan_device& dev, std::vector<unsigned char>& img)
+{
+#ifdef RT_WITH_VULKAN
+	auto& vk = *dev.vk;
+	auto bands = static_cast<std::uint32_t>(vk.band_rows.size() - 1);
+
+	// band b signals its semaphore when traced, the copy of band b waits for it while the
+	// compute queue goes on with band b + 1
+	std::vector<VkSubmitInfo> dispatches(bands, VkSubmitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO });
+	std::vector<VkSubmitInfo> copies(bands, VkSubmitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO });
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	for (std::uint32_t b = 0; b < bands; ++b)
+	{
+		dispatches[b].commandBufferCount = 1;
+		dispatches[b].pCommandBuffers = &vk.compute_cmds[b];
+		dispatches[b].signalSemaphoreCount = 1;
+		dispatches[b].pSignalSemaphores = &vk.band_done[b];
+
+		copies[b].waitSemaphoreCount = 1;
+		copies[b].pWaitSemaphores = &vk.band_done[b];
+		copies[b].pWaitDstStageMask = &wait_stage;
+		copies[b].commandBufferCount = 1;
+		copies[b].pCommandBuffers = &vk.transfer_cmds[b];
+	}
+
+	auto dispatch_start = std::chrono::high_resolution_clock::now();
+	auto err = vkQueueSubmit(vk.compute_queue, bands, dispatches.data(), VK_NULL_HANDLE);
+	double dispatch_time = host_ms(dispatch_start);
+
+	auto copy_start = std::chrono::high_resolution_clock::now();
+	err = err == VK_SUCCESS ? vkQueueSubmit(vk.transfer_queue, bands, copies.data(), vk.fence) : err;
+	double copy_time = host_ms(copy_start);
+
+	if (err != VK_SUCCESS)
+		return false;
+
+	vkWaitForFences(vk.device, 1, &vk.fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(vk.device, 1, &vk.fence);
+
+	double frame_time = host_ms(copy_start);
+
+	if (!vk.coherent)
+	{
+		VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+		range.memory = vk.readback.memory;
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(vk.device, 1, &range);
+	}
+
+	std::memcpy(&img[0], vk.mapped, vk.readback.size);
+
+	// without timestamps on the transfer queue the copies count from their submit to the fence
+	dev.kernel_profile = command_time{ dispatch_time, 0.0, band_time(vk, vk.compute_queries, bands) };
+	dev.transfer_profile = command_time{ copy_time, 0.0, vk.transfer_timestamps ? band_time(vk, vk.transfer_queries, bands) : frame_time };
+	dev.kernel_time = dev.kernel_profile.run;
+	dev.transfer_time = dev.transfer_profile.run;
+	return true;
+#else
+	(void)dev;
+	(void)img;
+	return false;
+#endif
+}
+
+void print_profile(vulkan_device const& dev)
+{
+	print_profile(dev.kernel_profile, dev.transfer_profile);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "accel.h"
+#include "pixel_format.h"
+#include "render_device.h"
+
+// Instance, device, queues, pipeline and buffers of a vulkan_device, defined in vulkan_device.cpp
+struct vulkan_objects;
+
+// One GPU rendering whole frames through Vulkan compute for --backend vulkan, on machines with a
+// Vulkan driver and no OpenCL ICD. The shader is trace.spv, compiled from trace.comp, the port of
+// trace, trace_bvh, trace_sorted and trace_grid; the scene is given to it as specialization
+// constants and reads the same sphere arrays and structures. The image is dispatched in
+// kVulkanBands bands of rows, and each band is copied back on the transfer queue while the
+// compute queue traces the next one; the scene upload on the transfer queue runs while the
+// pipeline is created. With --ray-query the bvh mode runs trace_rq.spv, which traverses an
+// acceleration structure of the driver over the sphere boxes in the ray tracing units of the
+// GPU (VK_KHR_ray_query) and tests the candidates with the spheres in the shader. Vulkan is
+// only used if the program is built with RT_WITH_VULKAN, otherwise init_vulkan_device fails
+// with a message.
+struct vulkan_device
+{
+	vulkan_device();
+	~vulkan_device();
+
+	vulkan_device(vulkan_device const&) = delete;
+	vulkan_device& operator=(vulkan_device const&) = delete;
+
+	std::string name;
+	std::unique_ptr<vulkan_objects> vk;
+	// True if the transfers run on a queue family of their own
+	bool async_transfer = false;
+	pixel_format format = pixel_format::float32;
+	ortho_view view;
+	// True if the bvh mode traces through the acceleration structure with ray queries
+	bool ray_query = false;
+	// Pipeline creation and scene upload of init_vulkan_device in ms, and the build of the
+	// acceleration structure with ray_query
+	double build_time = 0.0;
+	double upload_time = 0.0;
+	double structure_time = 0.0;
+	// Profiles of the last frame's bands, from the start of the first to the end of the last
+	// kernel or copy. Vulkan has no submit timestamp: queued is the time the vkQueueSubmit took
+	// on the host, submitted stays 0.
+	command_time kernel_profile = {};
+	command_time transfer_profile = {};
+	double kernel_time = 0.0;
+	double transfer_time = 0.0;
+};
+
+// Bands of rows a Vulkan frame is traced and read back in
+std::uint32_t const kVulkanBands = 4;
+
+// Pick the Vulkan device named by selector, its index or part of its name, or the first
+// discrete GPU if it is empty, create the pipeline of scene.mode from the SPIR-V spirv and
+// upload the scene. Brute force, bvh, sorted, grid and adaptive scenes render, adaptive through
+// the grid like on the OpenCL devices, into rgb float or rgba8 pixels. With ray_query spirv is
+// trace_rq.spv, the scene a bvh one, and the acceleration structure is built over the spheres
+// instead of uploading the BVH. Returns false with a message if there is no such device, the
+// mode or format has no shader, or ray_query is set and the device has no ray queries.
+bool init_vulkan_device(vulkan_device& dev, std::vector<char> const& spirv, render_scene const& scene, pixel_format format, std::string const& selector,
+                        bool ray_query);
+
+// Render the whole image of dev into img and record the kernel and readback times
+bool render_vulkan_frame(vulkan_device& dev, std::vector<unsigned char>& img);
+
+// Print the queue, launch and run times of the last kernels and readbacks of dev
+void print_profile(vulkan_device const& dev);
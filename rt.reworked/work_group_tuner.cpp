@@ -0,0 +1,116 @@
+#include "work_group_tuner.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace
+{
+	// Launches timed per candidate, the fastest counts
+	int const kTuningRuns = 3;
+
+	// Setting of the local size of kernel in the tuning database, its value is x and y
+	std::string work_group_setting(cl::Kernel const& kernel)
+	{
+		return "work_group " + kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+	}
+
+	bool is_candidate(std::vector<work_group> const& candidates, work_group group)
+	{
+		return std::any_of(candidates.begin(), candidates.end(), [&](work_group const& c)
+		{
+			return c.x == group.x && c.y == group.y;
+		});
+	}
+}
+
+std::vector<work_group> work_group_candidates(cl::Kernel const& kernel, cl::Device const& device, std::uint32_t width, std::uint32_t block_rows)
+{
+	std::vector<work_group> candidates;
+
+	auto max_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+	auto multiple = std::max<std::size_t>(kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device), 1U);
+	auto max_items = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+	if (max_items.size() < 2)
+		return candidates;
+
+	// a kernel compiled with reqd_work_group_size runs with that size only
+	auto required = kernel.getWorkGroupInfo<CL_KERNEL_COMPILE_WORK_GROUP_SIZE>(device);
+
+	if (required[0] != 0)
+	{
+		if (width % required[0] == 0 && block_rows % required[1] == 0)
+			candidates.push_back(work_group{ static_cast<std::uint32_t>(required[0]), static_cast<std::uint32_t>(required[1]) });
+
+		return candidates;
+	}
+
+	for (std::size_t y = 1; y <= block_rows && y <= max_items[1]; y *= 2)
+	{
+		for (std::size_t x = 1; x * y <= max_size && x <= max_items[0]; x *= 2)
+		{
+			if (width % x == 0 && block_rows % y == 0 && (x * y) % multiple == 0)
+				candidates.push_back(work_group{ static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y) });
+		}
+	}
+
+	return candidates;
+}
+
+bool load_work_group(cl::Kernel const& kernel, cl::Device const& device, tuning_key const& key, std::uint32_t width, std::uint32_t block_rows,
+                     work_group& group)
+{
+	std::string value;
+
+	if (!find_tuning(key, work_group_setting(kernel), value))
+		return false;
+
+	work_group stored = {};
+	std::istringstream values(value);
+
+	if (!(values >> stored.x >> stored.y))
+		return false;
+
+	// the image may have changed since, the stored size has to fit this one
+	if (!is_candidate(work_group_candidates(kernel, device, width, block_rows), stored))
+		return false;
+
+	group = stored;
+	return true;
+}
+
+bool tune_work_group(cl::Kernel const& kernel, cl::Device const& device, tuning_key const& key, std::uint32_t width, std::uint32_t block_rows,
+                     std::function<double(work_group)> const& launch, work_group& group)
+{
+	auto candidates = work_group_candidates(kernel, device, width, block_rows);
+
+	if (candidates.empty())
+		return false;
+
+	double best_time = 0.0;
+
+	for (auto const& candidate : candidates)
+	{
+		double time = launch(candidate);
+
+		for (auto run = 1; run < kTuningRuns; ++run)
+		{
+			time = std::min(time, launch(candidate));
+		}
+
+		std::cout << "  " << candidate.x << "x" << candidate.y << ": " << time << " ms\n";
+
+		if (&candidate == &candidates.front() || time < best_time)
+		{
+			best_time = time;
+			group = candidate;
+		}
+	}
+
+	if (!store_tuning(key, work_group_setting(kernel), std::to_string(group.x) + " " + std::to_string(group.y)))
+		std::cout << "Can't store the tuned work-group size\n";
+
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+#include "tuning_db.h"
+
+// 2D local size of a kernel launch
+struct work_group
+{
+	std::uint32_t x, y;
+};
+
+// Local sizes worth timing for kernel on device over images width columns wide, split into
+// bands of whole block_rows blocks: power of two edges with x dividing width and y dividing
+// block_rows, within CL_KERNEL_WORK_GROUP_SIZE and the device's item limits, and a whole
+// multiple of CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE. A kernel with a required
+// work-group size only has that one.
+std::vector<work_group> work_group_candidates(cl::Kernel const& kernel, cl::Device const& device, std::uint32_t width, std::uint32_t block_rows);
+
+// Local size of kernel on device stored under key by an earlier tune_work_group(), if it still
+// is one of the candidates. Returns false if there is none.
+bool load_work_group(cl::Kernel const& kernel, cl::Device const& device, tuning_key const& key, std::uint32_t width, std::uint32_t block_rows,
+                     work_group& group);
+
+// Time every candidate with launch, which runs the kernel with the given local size and
+// returns its time in ms, and store the fastest under key and the kernel's name in the tuning
+// database for later runs. Returns false if there is no candidate.
+bool tune_work_group(cl::Kernel const& kernel, cl::Device const& device, tuning_key const& key, std::uint32_t width, std::uint32_t block_rows,
+                     std::function<double(work_group)> const& launch, work_group& group);